@@ -54,6 +54,65 @@ int __machnet_listen_go(MachnetChannelCtx_t* ctx, uint32_t local_ip,
   return machnet_listen(ctx, local_ip, port);
 }
 
+// Batched entry points: each moves a whole batch of messages per cgo call.
+// Message `i' of a batch sits at offset `i * stride' of one contiguous buffer,
+// its length in `lens[i]' and its flow in `flows[i]'; none of them holds
+// pointers, so Go memory is passed as is, pinned for the duration of the call.
+#define MACHNET_GO_BATCH_MAX 32
+
+int __machnet_sendmmsg_go(const MachnetChannelCtx_t* ctx, uint8_t* buf,
+                          size_t stride, const uint32_t* lens,
+                          const MachnetFlow_t* flows, int nr) {
+  MachnetIovec_t iovs[MACHNET_GO_BATCH_MAX];      // NOLINT
+  MachnetMsgHdr_t msghdrs[MACHNET_GO_BATCH_MAX];  // NOLINT
+  int sent = 0;
+  while (sent < nr) {
+    int batch = nr - sent;
+    if (batch > MACHNET_GO_BATCH_MAX) batch = MACHNET_GO_BATCH_MAX;
+    for (int i = 0; i < batch; i++) {
+      iovs[i].base = buf + (size_t)(sent + i) * stride;
+      iovs[i].len = lens[sent + i];
+      msghdrs[i].msg_size = lens[sent + i];
+      msghdrs[i].flow_info = flows[sent + i];
+      msghdrs[i].msg_iov = &iovs[i];
+      msghdrs[i].msg_iovlen = 1;
+      msghdrs[i].flags = 0;
+    }
+    const int ret = machnet_sendmmsg(ctx, msghdrs, batch);
+    sent += ret;
+    if (ret < batch) break;
+  }
+  return sent;
+}
+
+int __machnet_recvmmsg_go(const MachnetChannelCtx_t* ctx, uint8_t* buf,
+                          size_t stride, uint32_t* lens, MachnetFlow_t* flows,
+                          int nr) {
+  MachnetIovec_t iovs[MACHNET_GO_BATCH_MAX];      // NOLINT
+  MachnetMsgHdr_t msghdrs[MACHNET_GO_BATCH_MAX];  // NOLINT
+  int received = 0;
+  while (received < nr) {
+    int batch = nr - received;
+    if (batch > MACHNET_GO_BATCH_MAX) batch = MACHNET_GO_BATCH_MAX;
+    for (int i = 0; i < batch; i++) {
+      iovs[i].base = buf + (size_t)(received + i) * stride;
+      iovs[i].len = stride;
+      msghdrs[i].msg_iov = &iovs[i];
+      msghdrs[i].msg_iovlen = 1;
+    }
+    const int ret = machnet_recvmmsg(ctx, msghdrs, batch);
+    // Messages that do not fit `stride' are dropped (-1 if all were).
+    if (ret <= 0) break;
+    for (int i = 0; i < ret; i++) {
+      lens[received + i] = msghdrs[i].msg_size;
+      flows[received + i] = msghdrs[i].flow_info;
+    }
+    received += ret;
+    if (ret < batch) break;
+  }
+  return received;
+}
+
 MachnetFlow_t* __machnet_init_flow() {
   // cppcheck-suppress cstyleCast
   MachnetFlow_t* flow = (MachnetFlow_t*)malloc(
@@ -112,3 +112,67 @@ func RecvMsg(ctx *MachnetChannelCtx, base *uint8, iov_len uint) (int, MachnetFlo
 		return 0, convert_net_flow_go(&flow)
 	}
 }
+
+// MachnetFlow is handed to C in place, in batches: it must match the layout
+// of MachnetFlow_t (both constants overflow otherwise).
+const _ = uint(unsafe.Sizeof(MachnetFlow{}) - unsafe.Sizeof(C.MachnetFlow_t{}))
+const _ = uint(unsafe.Sizeof(C.MachnetFlow_t{}) - unsafe.Sizeof(MachnetFlow{}))
+
+// A batch of messages, sent or received with one cgo call each way (see
+// SendMMsg and RecvMMsg). Message i sits at offset i * Stride of Buf, and has
+// Lens[i] bytes, on flow Flows[i].
+type MsgBatch struct {
+	Buf    []uint8
+	Stride uint
+	Lens   []uint32
+	Flows  []MachnetFlow
+}
+
+// Allocate a batch of `nr' messages of up to `max_msg_size' bytes each.
+func NewMsgBatch(nr int, max_msg_size uint) *MsgBatch {
+	return &MsgBatch{
+		Buf:    make([]uint8, uint(nr)*max_msg_size),
+		Stride: max_msg_size,
+		Lens:   make([]uint32, nr),
+		Flows:  make([]MachnetFlow, nr),
+	}
+}
+
+// Return the number of messages the batch can hold.
+func (batch *MsgBatch) Cap() int {
+	return len(batch.Lens)
+}
+
+// Return message i of the batch, of Lens[i] bytes.
+func (batch *MsgBatch) Msg(i int) []uint8 {
+	start := uint(i) * batch.Stride
+	return batch.Buf[start : start+uint(batch.Lens[i])]
+}
+
+// Send the first `nr' messages of the batch, each on its own flow.
+// Returns the number of messages sent: the first ones of the batch.
+func SendMMsg(ctx *MachnetChannelCtx, batch *MsgBatch, nr int) int {
+	if nr <= 0 {
+		return 0
+	}
+	ret := C.__machnet_sendmmsg_go((*C.MachnetChannelCtx_t)(ctx),
+		(*C.uint8_t)(unsafe.Pointer(&batch.Buf[0])), C.size_t(batch.Stride),
+		(*C.uint32_t)(unsafe.Pointer(&batch.Lens[0])),
+		(*C.MachnetFlow_t)(unsafe.Pointer(&batch.Flows[0])), C.int(nr))
+	return (int)(ret)
+}
+
+// Receive up to a batch of pending messages, setting their lengths and flows.
+// Messages larger than the stride of the batch are dropped.
+// Returns the number of messages received: the first ones of the batch.
+func RecvMMsg(ctx *MachnetChannelCtx, batch *MsgBatch) int {
+	if batch.Cap() == 0 {
+		return 0
+	}
+	ret := C.__machnet_recvmmsg_go((*C.MachnetChannelCtx_t)(ctx),
+		(*C.uint8_t)(unsafe.Pointer(&batch.Buf[0])), C.size_t(batch.Stride),
+		(*C.uint32_t)(unsafe.Pointer(&batch.Lens[0])),
+		(*C.MachnetFlow_t)(unsafe.Pointer(&batch.Flows[0])),
+		C.int(batch.Cap()))
+	return (int)(ret)
+}
@@ -1,6 +1,7 @@
 package main
 
 import (
+	"bytes"
 	"flag"
 	"math"
 	"os"
@@ -25,6 +26,7 @@ var msg_nr uint64 = math.MaxUint64
 var active_generator bool = false
 var verify bool = false
 var latency bool = false
+var batch_size int = 1
 
 type stats struct {
 	tx_success   uint64
@@ -40,6 +42,8 @@ type task_ctx struct {
 	flow     machnet.MachnetFlow
 	msg_data []uint8
 	rx_msg   []uint8
+	tx_batch *machnet.MsgBatch
+	rx_batch *machnet.MsgBatch
 }
 
 // TODO: Currently, allows for exactly `msg_size` bytes of data.
@@ -50,6 +54,8 @@ func new_task_ctx(ctx *machnet.MachnetChannelCtx, flow machnet.MachnetFlow) *tas
 	task.flow = flow
 	task.msg_data = make([]uint8, msg_size)
 	task.rx_msg = make([]uint8, msg_size)
+	task.tx_batch = machnet.NewMsgBatch(batch_size, uint(msg_size))
+	task.rx_batch = machnet.NewMsgBatch(batch_size, uint(msg_size))
 
 	// Initialize the message data.
 	task.msg_data[0] = 1
@@ -57,6 +63,13 @@ func new_task_ctx(ctx *machnet.MachnetChannelCtx, flow machnet.MachnetFlow) *tas
 		task.msg_data[i] = 0
 	}
 
+	// Every message of a TX batch is a copy of the message data.
+	for i := 0; i < batch_size; i++ {
+		task.tx_batch.Lens[i] = uint32(msg_size)
+		task.tx_batch.Flows[i] = flow
+		copy(task.tx_batch.Msg(i), task.msg_data)
+	}
+
 	return task
 }
 
@@ -84,6 +97,7 @@ func init_flags() {
 	flag.BoolVar(&active_generator, "active_generator", active_generator, "When 'true' this host is generating the traffic, otherwise it is bouncing.")
 	flag.BoolVar(&verify, "verify", verify, "When 'true' verify the payload of received messages.")
 	flag.BoolVar(&latency, "latency", latency, "When 'true' measure the latency of the messages.")
+	flag.IntVar(&batch_size, "batch_size", batch_size, "Number of messages sent or received per cgo call (not with -latency).")
 	flag.Parse()
 }
 
@@ -157,6 +171,27 @@ func tx(task *task_ctx, stats *stats) {
 	}
 }
 
+// Like tx, but sends as many messages as the window allows with one cgo call.
+func tx_batch(task *task_ctx, stats *stats) {
+	// Return if we have already sent the required number of messages, and
+	// don't send more than msg_window messages at a time.
+	if msg_nr <= stats.tx_success || stats.tx_success-stats.rx_count >= msg_window {
+		return
+	}
+	nr := uint64(batch_size)
+	if nr > msg_nr-stats.tx_success {
+		nr = msg_nr - stats.tx_success
+	}
+	if nr > msg_window-(stats.tx_success-stats.rx_count) {
+		nr = msg_window - (stats.tx_success - stats.rx_count)
+	}
+
+	sent := machnet.SendMMsg(task.ctx, task.tx_batch, int(nr))
+	stats.tx_success += uint64(sent)
+	stats.tx_bytes += uint64(sent) * uint64(msg_size)
+	stats.err_tx_drops += nr - uint64(sent)
+}
+
 func rx(task *task_ctx, stats *stats) {
 	channel_ctx := task.ctx
 
@@ -221,6 +256,19 @@ func ping(task *task_ctx, stats *stats, histogram *hdrhistogram.Histogram) {
 	stats.rx_bytes += uint64(msg_size)
 }
 
+// Like rx, but receives a batch of messages with one cgo call.
+func rx_batch(task *task_ctx, stats *stats) {
+	batch := task.rx_batch
+	nr := machnet.RecvMMsg(task.ctx, batch)
+	for i := 0; i < nr; i++ {
+		if verify && !bytes.Equal(batch.Msg(i), task.msg_data) {
+			glog.Fatalf("Received message does not match the sent message")
+		}
+		stats.rx_bytes += uint64(batch.Lens[i])
+	}
+	stats.rx_count += uint64(nr)
+}
+
 func bounce(task *task_ctx, stats *stats) {
 	channel_ctx := task.ctx
 
@@ -248,6 +296,31 @@ func bounce(task *task_ctx, stats *stats) {
 	}
 }
 
+// Like bounce, but bounces a batch of messages with two cgo calls, in place.
+func bounce_batch(task *task_ctx, stats *stats) {
+	batch := task.rx_batch
+	nr := machnet.RecvMMsg(task.ctx, batch)
+	if nr == 0 {
+		return
+	}
+	for i := 0; i < nr; i++ {
+		stats.rx_bytes += uint64(batch.Lens[i])
+
+		// Swap the source and destination IP addresses.
+		flow := &batch.Flows[i]
+		flow.SrcIp, flow.DstIp = flow.DstIp, flow.SrcIp
+		flow.SrcPort, flow.DstPort = flow.DstPort, flow.SrcPort
+	}
+	stats.rx_count += uint64(nr)
+
+	sent := machnet.SendMMsg(task.ctx, batch, nr)
+	for i := 0; i < sent; i++ {
+		stats.tx_bytes += uint64(batch.Lens[i])
+	}
+	stats.tx_success += uint64(sent)
+	stats.err_tx_drops += uint64(nr - sent)
+}
+
 func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_chan chan<- stats) {
 	task_stats := new_stats()
 	count_histogram := hdrhistogram.New(1, 1000000, 3)
@@ -255,6 +328,9 @@ func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_
 		for {
 			if latency {
 				ping(task, task_stats, count_histogram)
+			} else if batch_size > 1 {
+				tx_batch(task, task_stats)
+				rx_batch(task, task_stats)
 			} else {
 				tx(task, task_stats)
 				rx(task, task_stats)
@@ -274,7 +350,11 @@ func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_
 		}
 	} else {
 		for {
-			bounce(task, task_stats)
+			if batch_size > 1 {
+				bounce_batch(task, task_stats)
+			} else {
+				bounce(task, task_stats)
+			}
 
 			// Report the stats every second.
 			select {
@@ -289,6 +369,9 @@ func run_worker(task *task_ctx, active_generator bool, tick *time.Ticker, stats_
 
 func main() {
 	init_flags()
+	if batch_size < 1 {
+		glog.Fatal("The batch size must be at least 1.")
+	}
 
 	if active_generator {
 		glog.Info("Starting in active generator mode.")
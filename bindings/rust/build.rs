@@ -16,6 +16,7 @@ fn main() {
         .header(format!("{}/machnet.h", lib_path))
         .parse_callbacks(Box::new(bindgen::CargoCallbacks::new()))
         .allowlist_function(".*machnet.*")
+        .allowlist_var("MACHNET_.*")
         .generate()
         .expect("Unable to generate bindings");
 
@@ -0,0 +1,106 @@
+// Copyright (C) 2023 Vahab Jabrayilov
+// Email: vjabrayilov@cs.columbia.edu
+//
+// This file is part of the Machnet project.
+//
+// This project is licensed under the MIT License - see the LICENSE file for details
+
+//! Async receive on a tokio runtime (feature `tokio`).
+
+use crate::bindings;
+use crate::msg::{machnet_recvmsg_zc, machnet_sendmmsg, MachnetRecvMsg};
+use crate::{MachnetChannel, MachnetFlow};
+
+use std::{ffi::c_void, io, os::fd::RawFd};
+use tokio::io::unix::AsyncFd;
+
+/// A channel whose messages are received asynchronously, so that a task
+/// waiting for messages does not hold a thread.
+///
+/// Tasks wait on the notification descriptor of the channel (an eventfd,
+/// signaled by Machnet when it delivers messages while the notification is
+/// armed), registered with the runtime. With a Machnet that does not provide
+/// one, waiting tasks poll instead, yielding to the runtime between attempts.
+///
+/// # Examples
+///
+/// ```no_run
+/// use machnet::{machnet_attach, machnet_init, AsyncMachnetChannel};
+///
+/// # async fn serve() -> std::io::Result<()> {
+/// machnet_init();
+/// let channel = AsyncMachnetChannel::new(machnet_attach().unwrap())?;
+/// loop {
+///     let msg = channel.recv().await;
+///     let data = msg.to_vec();
+///     let flow = msg.flow();
+///     drop(msg); // Releases the channel buffers.
+///     channel.send_batch(&[(flow.reversed(), &data[..])]);
+/// }
+/// # }
+/// ```
+#[derive(Debug)]
+pub struct AsyncMachnetChannel<'a> {
+    channel: MachnetChannel<'a>,
+    notify: Option<AsyncFd<RawFd>>,
+}
+
+impl<'a> AsyncMachnetChannel<'a> {
+    /// Registers the notification descriptor of the channel with the current
+    /// tokio runtime; must be called from within one.
+    pub fn new(channel: MachnetChannel<'a>) -> io::Result<Self> {
+        let fd = unsafe { bindings::machnet_notify_fd(channel.get_ptr()) };
+        let notify = if fd >= 0 {
+            Some(AsyncFd::new(fd)?)
+        } else {
+            None
+        };
+        Ok(AsyncMachnetChannel { channel, notify })
+    }
+
+    pub fn channel(&self) -> &MachnetChannel<'a> {
+        &self.channel
+    }
+
+    /// Receives the next message, without copying it (see
+    /// [`MachnetRecvMsg`]). Cancel-safe: a message is only taken off the
+    /// channel when the future completes.
+    pub async fn recv(&self) -> MachnetRecvMsg<'_> {
+        loop {
+            if let Some(msg) = machnet_recvmsg_zc(&self.channel) {
+                return msg;
+            }
+            self.wait().await;
+        }
+    }
+
+    /// Like [`machnet_recvmsg_zc`]: returns a message if one is pending,
+    /// without waiting.
+    pub fn try_recv(&self) -> Option<MachnetRecvMsg<'_>> {
+        machnet_recvmsg_zc(&self.channel)
+    }
+
+    /// Enqueues a batch of messages (see [`machnet_sendmmsg`]). Sends do not
+    /// wait, as Machnet takes messages as long as the channel has room.
+    pub fn send_batch(&self, msgs: &[(MachnetFlow, &[u8])]) -> usize {
+        machnet_sendmmsg(&self.channel, msgs)
+    }
+
+    // Waits until messages may be pending; wake-ups may be spurious.
+    async fn wait(&self) {
+        let ptr: *mut c_void = self.channel.get_ptr();
+        let Some(notify) = &self.notify else {
+            tokio::task::yield_now().await;
+            return;
+        };
+        // Arming re-checks the channel, so that messages delivered meanwhile
+        // are not missed; it fails if they are already pending.
+        if unsafe { bindings::machnet_notify_arm(ptr) } != 0 {
+            return;
+        }
+        if let Ok(mut guard) = notify.readable().await {
+            guard.clear_ready();
+        }
+        unsafe { bindings::machnet_notify_disarm(ptr) };
+    }
+}
@@ -14,6 +14,14 @@ mod bindings {
 
 pub use bindings::MachnetFlow;
 
+mod msg;
+pub use msg::{machnet_recvmsg_zc, machnet_sendmmsg, MachnetRecvMsg};
+
+#[cfg(feature = "tokio")]
+mod async_channel;
+#[cfg(feature = "tokio")]
+pub use async_channel::AsyncMachnetChannel;
+
 use std::{
     ffi::{c_void, CString},
     marker::PhantomData,
@@ -66,6 +74,12 @@ impl MachnetFlow {
             dst_port,
         }
     }
+
+    /// Returns the flow in the other direction, e.g., to respond to a message
+    /// received on this flow.
+    pub fn reversed(&self) -> Self {
+        MachnetFlow::new(self.dst_ip, self.dst_port, self.src_ip, self.src_port)
+    }
 }
 
 /// Initializes the Machnet library for interacting with the Machnet sidecar.
@@ -0,0 +1,168 @@
+// Copyright (C) 2023 Vahab Jabrayilov
+// Email: vjabrayilov@cs.columbia.edu
+//
+// This file is part of the Machnet project.
+//
+// This project is licensed under the MIT License - see the LICENSE file for details
+
+//! Zero-copy receive and batched send.
+
+use crate::bindings::{self, MachnetFlow, MachnetIovec, MachnetMsg, MachnetMsgHdr};
+use crate::MachnetChannel;
+
+use std::{ffi::c_void, marker::PhantomData, ptr, slice};
+
+/// A message received in place: a view over the channel buffers that hold it,
+/// which go back to the channel when the view is dropped.
+///
+/// Messages larger than a channel buffer span several segments; see
+/// [`MachnetRecvMsg::segments`].
+#[derive(Debug)]
+pub struct MachnetRecvMsg<'c> {
+    channel: *mut c_void,
+    msg: MachnetMsg,
+    // Backs `msg.msg_iov`; its heap storage does not move with the view.
+    segs: Vec<MachnetIovec>,
+    _marker: PhantomData<&'c ()>,
+}
+
+// The buffers may be released from any thread.
+unsafe impl<'c> Send for MachnetRecvMsg<'c> {}
+
+impl<'c> MachnetRecvMsg<'c> {
+    /// Returns the size of the message, in bytes.
+    pub fn len(&self) -> usize {
+        self.msg.msg_size as usize
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.msg.msg_size == 0
+    }
+
+    /// Returns the flow the message came from.
+    pub fn flow(&self) -> MachnetFlow {
+        self.msg.flow_info
+    }
+
+    /// Returns the segments of the message, in order.
+    pub fn segments(&self) -> impl Iterator<Item = &[u8]> {
+        self.segs[..self.msg.msg_iovlen]
+            .iter()
+            .map(|seg| unsafe { slice::from_raw_parts(seg.base as *const u8, seg.len) })
+    }
+
+    /// Returns the message as one slice, if it fits in a single segment (i.e.,
+    /// is no larger than a channel buffer).
+    pub fn as_slice(&self) -> Option<&[u8]> {
+        match self.msg.msg_iovlen {
+            0 => Some(&[]),
+            1 => self.segments().next(),
+            _ => None,
+        }
+    }
+
+    /// Copies the message out.
+    pub fn to_vec(&self) -> Vec<u8> {
+        let mut data = Vec::with_capacity(self.len());
+        self.segments().for_each(|seg| data.extend_from_slice(seg));
+        data
+    }
+}
+
+impl<'c> Drop for MachnetRecvMsg<'c> {
+    fn drop(&mut self) {
+        unsafe { bindings::machnet_msg_release(self.channel, &mut self.msg) }
+    }
+}
+
+/// Receives a pending message without copying it (see [`MachnetRecvMsg`]).
+///
+/// # Returns
+///
+/// Returns `None` if no message is pending, or if the pending message could
+/// not be received (it is dropped).
+///
+/// # Examples
+///
+/// ```no_run
+/// use machnet::{machnet_attach, machnet_recvmsg_zc};
+///
+/// let channel = machnet_attach().unwrap();
+/// if let Some(msg) = machnet_recvmsg_zc(&channel) {
+///     println!("Received {} bytes from {:?}", msg.len(), msg.flow());
+/// }; // The buffers of `msg` go back to the channel here.
+/// ```
+///
+pub fn machnet_recvmsg_zc<'c>(channel: &'c MachnetChannel) -> Option<MachnetRecvMsg<'c>> {
+    let channel_ptr = channel.get_ptr();
+    unsafe {
+        let iovlen = bindings::machnet_msg_iovlen(channel_ptr, bindings::MACHNET_MSG_MAX_LEN);
+        let mut segs = vec![
+            MachnetIovec {
+                base: ptr::null_mut(),
+                len: 0,
+            };
+            iovlen
+        ];
+        let mut msg: MachnetMsg = std::mem::zeroed();
+        msg.msg_iov = segs.as_mut_ptr();
+        msg.msg_iovlen = segs.len();
+        match bindings::machnet_recvmsg_zc(channel_ptr, &mut msg) {
+            1 => Some(MachnetRecvMsg {
+                channel: channel_ptr,
+                msg,
+                segs,
+                _marker: PhantomData,
+            }),
+            _ => None,
+        }
+    }
+}
+
+/// Enqueues a batch of messages for transmission, each on its own flow, with
+/// one call into Machnet.
+///
+/// # Arguments
+///
+/// * `channel` - A reference to the `MachnetChannel`.
+/// * `msgs` - The messages, each with the flow to send it on.
+///
+/// # Returns
+///
+/// Returns the number of messages enqueued: the first ones of `msgs`.
+///
+/// # Examples
+///
+/// ```no_run
+/// use machnet::{machnet_attach, machnet_sendmmsg, MachnetFlow};
+///
+/// let channel = machnet_attach().unwrap();
+/// let flow = MachnetFlow::default();
+/// let sent = machnet_sendmmsg(&channel, &[(flow, &b"ping"[..]), (flow, &b"pong"[..])]);
+/// println!("Enqueued {} messages", sent);
+/// ```
+///
+pub fn machnet_sendmmsg(channel: &MachnetChannel, msgs: &[(MachnetFlow, &[u8])]) -> usize {
+    let mut iovs: Vec<MachnetIovec> = msgs
+        .iter()
+        .map(|(_, buf)| MachnetIovec {
+            base: buf.as_ptr() as *mut c_void,
+            len: buf.len(),
+        })
+        .collect();
+    let msghdrs: Vec<MachnetMsgHdr> = msgs
+        .iter()
+        .zip(iovs.iter_mut())
+        .map(|((flow, buf), iov)| MachnetMsgHdr {
+            msg_size: buf.len() as u32,
+            flow_info: *flow,
+            msg_iov: iov,
+            msg_iovlen: 1,
+            flags: 0,
+        })
+        .collect();
+    let ret = unsafe {
+        bindings::machnet_sendmmsg(channel.get_ptr(), msghdrs.as_ptr(), msghdrs.len() as i32)
+    };
+    ret.max(0) as usize
+}
@@ -1,5 +1,7 @@
 
 #include <bits/stdc++.h>
+#include <machnet_common.h>
+#include <perf_report.h>
 #include <pthread.h>
 #include <sched.h>
 #include <time.h>
@@ -28,6 +30,13 @@ jring2_t *g_p2c_ring;  // Producer to consumer ring
 jring2_t *g_c2p_ring;  // Consumer to producer ring
 double g_rdtsc_freq_ghz = 0.0;
 
+// Totals of the producer over the whole run, for the report.
+struct ProducerStats {
+  size_t responses{0};
+  uint64_t cycles{0};
+  MachnetLatencyHist_t rtt_hist{};
+};
+
 uint64_t rdtsc() {
   uint32_t lo, hi;
   asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
@@ -47,12 +56,13 @@ double MeasureRdtscFreqGHz() {
   return rdtsc_diff * 1.0 / ns_diff;
 }
 
-void ProducerThread() {
+void ProducerThread(ProducerStats *stats) {
   juggler::utils::BindThisThreadToCore(kProducerCore);
 
   size_t seq_num = 0;
   size_t sum_lat_cycles = 0;
   uint64_t msr_start_cycles = rdtsc();
+  const uint64_t run_start_cycles = msr_start_cycles;
   srand(time(NULL));
 
   std::array<uint64_t, kWindowSize> timestamps{};
@@ -65,11 +75,16 @@ void ProducerThread() {
       while (true) {
         int result = jring2_dequeue_burst(g_c2p_ring, &resp_msg, 1);
         if (result == 1) break;
+        if (g_stop.load()) break;
       }
+      if (g_stop.load()) break;
 
       const size_t msg_lat_cycles =
           (rdtsc() - timestamps[seq_num % kWindowSize]);
       sum_lat_cycles += msg_lat_cycles;
+      stats->responses++;
+      __machnet_latency_hist_record(&stats->rtt_hist,
+                                    msg_lat_cycles / g_rdtsc_freq_ghz);
 
       // Check message contents
       for (size_t i = 0; i < kMsgPayloadSize8B; i++) {
@@ -115,8 +130,8 @@ void ProducerThread() {
     jring2_enqueue_bulk(g_p2c_ring, &req_msg, 1);
     inflight_requests++;
   }
+  stats->cycles = rdtsc() - run_start_cycles;
   std::cout << "Producer exiting" << std::endl;
-  exit(0);
 }
 
 void ConsumerThread() {
@@ -127,7 +142,9 @@ void ConsumerThread() {
     while (true) {
       int result = jring2_dequeue_burst(g_p2c_ring, &req_msg, 1);
       if (result == 1) break;
+      if (g_stop.load()) break;
     }
+    if (g_stop.load()) break;
 
     // Send a response
     Msg resp_msg{};
@@ -143,10 +160,12 @@ void ConsumerThread() {
   }
 
   std::cout << "Consumer exiting" << std::endl;
-  exit(0);
 }
 
-int main() {
+// Runs until SIGINT, then reports the round trips of the producer (see
+// perf_report.h for the options).
+int main(int argc, char **argv) {
+  const auto perf_options = juggler::perf::Options::Parse(&argc, argv);
   std::cout << "Measuring RDTSC freq" << std::endl;
   g_rdtsc_freq_ghz = MeasureRdtscFreqGHz();
   std::cout << "RDTSC freq: " << g_rdtsc_freq_ghz << " GHz" << std::endl;
@@ -186,7 +205,8 @@ int main() {
 
   sleep(1);
   std::cout << "Starting producer thread" << std::endl;
-  std::thread tsend(ProducerThread);
+  ProducerStats stats;
+  std::thread tsend(ProducerThread, &stats);
 
   tsend.join();
   trecv.join();
@@ -194,5 +214,18 @@ int main() {
   free(g_p2c_ring);
   free(g_c2p_ring);
 
-  return 0;
+  juggler::perf::Report report("jring2_perf");
+  juggler::perf::Result result;
+  result.name = "ping_pong";
+  result.Param("msg_size", sizeof(Msg)).Param("window", kWindowSize);
+  if (stats.responses != 0 && stats.cycles != 0) {
+    const double ns = stats.cycles / g_rdtsc_freq_ghz;
+    auto quantile = [&stats](double q) {
+      return __machnet_latency_hist_quantile(&stats.rtt_hist, q);
+    };
+    result.OpsPerSec(stats.responses / (ns / 1e9))
+        .Latency(quantile(0.5), quantile(0.99), quantile(0.999));
+  }
+  report.Add(std::move(result));
+  return juggler::perf::Finish(report, perf_options);
 }
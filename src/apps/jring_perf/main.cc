@@ -1,8 +1,12 @@
 #include <common.h>
 #include <glog/logging.h>
 #include <jring.h>
+#include <machnet_common.h>
+#include <perf_report.h>
+#include <signal.h>
 #include <utils.h>
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
@@ -21,6 +25,20 @@ struct msg_t {
 };
 static_assert(sizeof(msg_t) == kMsgSize, "Message size is not correct");
 
+// Totals of the consumer over the whole run, for the report.
+struct consumer_stats_t {
+  size_t num_rx{0};
+  size_t duration_ns{0};
+  MachnetLatencyHist_t lat_hist{};
+};
+
+static std::atomic<bool> g_stop{false};
+
+static size_t ns_between(const struct timespec &start,
+                         const struct timespec &end) {
+  return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
 void SetThisThreadName(const std::string &name) {
   pthread_setname_np(pthread_self(), name.c_str());
 }
@@ -60,11 +78,11 @@ void ProducerThread(jring_t *ring) {
   clock_gettime(CLOCK_REALTIME, &msr_start);
   size_t num_msg_since_last_msr = 0;
 
-  while (true) {
+  while (!g_stop.load()) {
     msg_t msg;
     clock_gettime(CLOCK_REALTIME, &msg.ts);
     while (jring_sp_enqueue_bulk(ring, &msg, 1, nullptr) != 1) {
-      // do nothing
+      if (g_stop.load()) return;
     }
 
     BusySleepNs(500);  // Emulate 2 Mpps
@@ -83,32 +101,30 @@ void ProducerThread(jring_t *ring) {
   }
 }
 
-void ConsumerThread(jring_t *ring) {
+void ConsumerThread(jring_t *ring, consumer_stats_t *stats) {
   LOG(INFO) << "Consumer thread started, binding to core "
             << kConsumerCpuCoreId;
   juggler::utils::BindThisThreadToCore(kConsumerCpuCoreId);
   SetThisThreadName("jring_consumer");
 
-  struct timespec msr_start;
+  struct timespec msr_start, run_start, ts;
   clock_gettime(CLOCK_REALTIME, &msr_start);
+  run_start = msr_start;
   size_t num_rx = 0;
   size_t ns_sum = 0;
 
-  while (true) {
+  while (!g_stop.load()) {
     msg_t msg;
-    while (jring_sc_dequeue_bulk(ring, &msg, 1, nullptr) != 1) {
-      // do nothing
-    }
+    if (jring_sc_dequeue_bulk(ring, &msg, 1, nullptr) != 1) continue;
     num_rx++;
-    struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
 
-    const size_t msg_lat_ns =
-        (ts.tv_sec - msg.ts.tv_sec) * 1e9 + (ts.tv_nsec - msg.ts.tv_nsec);
+    const size_t msg_lat_ns = ns_between(msg.ts, ts);
     ns_sum += msg_lat_ns;
+    stats->num_rx++;
+    __machnet_latency_hist_record(&stats->lat_hist, msg_lat_ns);
 
-    const size_t ns_since_last_msr =
-        (ts.tv_sec - msr_start.tv_sec) * 1e9 + (ts.tv_nsec - msr_start.tv_nsec);
+    const size_t ns_since_last_msr = ns_between(msr_start, ts);
     if (ns_since_last_msr >= 1e9) {
       const double kpps = num_rx / 1e3;
       const size_t avg_lat_ns = ns_sum / num_rx;
@@ -119,18 +135,37 @@ void ConsumerThread(jring_t *ring) {
       msr_start = ts;
     }
   }
+  clock_gettime(CLOCK_REALTIME, &ts);
+  stats->duration_ns = ns_between(run_start, ts);
 }
 
-int main() {
+// Runs until SIGINT, then reports the totals of the consumer (see
+// perf_report.h for the options).
+int main(int argc, char **argv) {
+  const auto perf_options = juggler::perf::Options::Parse(&argc, argv);
   google::InitGoogleLogging("jring_bench");
   FLAGS_logtostderr = true;
+  signal(SIGINT, [](int) { g_stop.store(true); });
   jring_t *ring = init_ring(kNumRingElems);
+  consumer_stats_t stats;
   std::thread producer(ProducerThread, ring);
-  std::thread consumer(ConsumerThread, ring);
+  std::thread consumer(ConsumerThread, ring, &stats);
 
   producer.join();
   consumer.join();
-
   free(ring);
-  return 0;
+
+  juggler::perf::Report report("jring_perf");
+  juggler::perf::Result result;
+  result.name = "producer_consumer";
+  result.Param("msg_size", kMsgSize);
+  if (stats.num_rx != 0 && stats.duration_ns != 0) {
+    auto quantile = [&stats](double q) {
+      return __machnet_latency_hist_quantile(&stats.lat_hist, q);
+    };
+    result.OpsPerSec(stats.num_rx / (stats.duration_ns / 1e9))
+        .Latency(quantile(0.5), quantile(0.99), quantile(0.999));
+  }
+  report.Add(std::move(result));
+  return juggler::perf::Finish(report, perf_options);
 }
@@ -0,0 +1,55 @@
+// XDP program of Machnet's AF_XDP ports (see `af_xdp.h'): redirects the UDP
+// packets to the ports Machnet uses to the AF_XDP socket of their RX queue,
+// and passes everything else to the kernel.
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+// The AF_XDP sockets, by RX queue; filled by DPDK's `net_af_xdp' driver.
+struct {
+  __uint(type, BPF_MAP_TYPE_XSKMAP);
+  __uint(max_entries, 64);
+  __type(key, __u32);
+  __type(value, __u32);
+} xsks_map SEC(".maps");
+
+// Non-zero for the UDP ports to steer; pinned, for Machnet to update.
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 65536);
+  __type(key, __u32);
+  __type(value, __u32);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} machnet_ports SEC(".maps");
+
+SEC("xdp")
+int machnet_xdp(struct xdp_md *ctx) {
+  void *data = (void *)(long)ctx->data;
+  void *data_end = (void *)(long)ctx->data_end;
+
+  struct ethhdr *eth = data;
+  if ((void *)(eth + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IP)) {
+    return XDP_PASS;
+  }
+  // Machnet sends neither IP options nor fragments.
+  struct iphdr *ip = (void *)(eth + 1);
+  if ((void *)(ip + 1) > data_end || ip->ihl != 5 ||
+      ip->protocol != IPPROTO_UDP ||
+      (ip->frag_off & bpf_htons(0x3fff)) != 0) {
+    return XDP_PASS;
+  }
+  struct udphdr *udp = (void *)(ip + 1);
+  if ((void *)(udp + 1) > data_end) return XDP_PASS;
+
+  __u32 port = bpf_ntohs(udp->dest);
+  __u32 *steer = bpf_map_lookup_elem(&machnet_ports, &port);
+  if (steer == NULL || *steer == 0) return XDP_PASS;
+  return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
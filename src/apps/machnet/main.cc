@@ -8,6 +8,9 @@
 
 DEFINE_string(config_json, "../src/apps/machnet/config.json",
               "JSON file with Machnet-related parameters.");
+DEFINE_bool(hot_restart, false,
+            "Take the channels and flows over from the Machnet running on "
+            "this host, which exits, rather than start afresh.");
 
 int main(int argc, char *argv[]) {
   ::google::InitGoogleLogging(argv[0]);
@@ -16,6 +19,7 @@ int main(int argc, char *argv[]) {
 
   juggler::MachnetController *controller =
       CHECK_NOTNULL(juggler::MachnetController::Create(FLAGS_config_json));
+  if (FLAGS_hot_restart) controller->TakeOver();
   controller->Run();
 
   juggler::MachnetController::ReleaseInstance();
@@ -0,0 +1,44 @@
+/**
+ * @file trace_decode.cc
+ * @brief Decodes the traces that Machnet engines write on SIGUSR2 (see
+ * `trace::Tracer').
+ */
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <trace.h>
+
+#include <cinttypes>
+#include <cstdio>
+
+DEFINE_string(trace, "", "Trace file written by an engine.");
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("Decodes a Machnet engine trace.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  const auto trace = juggler::trace::Tracer::Load(FLAGS_trace);
+  if (!trace.has_value()) {
+    LOG(ERROR) << "Cannot decode trace " << FLAGS_trace;
+    return 1;
+  }
+  const auto &[header, records] = trace.value();
+  std::printf("# port %hu, rx queue %hu: %" PRIu64 " records (%" PRIu64
+              " lost), TSC at %" PRIu64 " Hz\n",
+              header.port_id, header.rx_queue_id, header.records_nr,
+              header.lost_nr, header.tsc_hz);
+  std::printf("# time_us event flow seqno arg\n");
+  if (records.empty()) return 0;
+
+  // Times are relative to the oldest record.
+  const auto start_tsc = records.front().tsc;
+  for (const auto &record : records) {
+    const double time_us =
+        static_cast<double>(record.tsc - start_tsc) * 1e6 / header.tsc_hz;
+    std::printf("%.3f %s %08x %u %u\n", time_us,
+                juggler::trace::EventToString(
+                    static_cast<juggler::trace::Event>(record.event)),
+                record.flow, record.seqno, record.arg);
+  }
+  return 0;
+}
@@ -2,6 +2,12 @@
  * @file main.cc
  * @brief This application is a simple message generator that supports sending
  * and receiving network messages using Machnet.
+ *
+ * By default, each client thread keeps a fixed window of requests in flight
+ * (closed loop). With `--rate', requests are instead sent at the times of an
+ * arrival process, whether responses came back or not (open loop), and their
+ * latency counts from the time they were due: a slow response does not delay
+ * (and hide) the requests behind it.
  */
 
 #include <gflags/gflags.h>
@@ -9,14 +15,18 @@
 #include <hdr/hdr_histogram.h>
 #include <machnet.h>
 
+#include <algorithm>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <numeric>
+#include <random>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
@@ -27,14 +37,33 @@ DEFINE_string(remote_ip, "", "IP of the remote server's Machnet interface");
 DEFINE_uint32(remote_port, 888, "Remote port to connect to.");
 DEFINE_uint32(local_port, 888, "Remote port to connect to.");
 DEFINE_uint32(msg_size, 64, "Size of the message (request/response) to send.");
+DEFINE_uint32(resp_size, 0,
+              "Size of the responses (mean size with --size_dist), requested "
+              "by the client; 0 for the request size.");
+DEFINE_string(size_dist, "fixed",
+              "Distribution of the request and response sizes: fixed, "
+              "uniform (0 to twice the size) or exponential (of mean size).");
 DEFINE_uint32(msg_window, 8, "Maximum number of messages in flight.");
 DEFINE_uint64(msg_nr, UINT64_MAX, "Number of messages to send.");
 DEFINE_bool(verify, false, "Verify payload of received messages.");
+DEFINE_uint32(threads, 1,
+              "Number of threads, each on its own channel. Thread `i' uses "
+              "port `local_port + i' (server) or `remote_port + i' (client).");
+DEFINE_uint32(flows, 1, "Number of flows per client thread.");
+DEFINE_double(rate, 0,
+              "Requests per second per client thread, sent open loop; 0 for "
+              "closed loop (see --msg_window).");
+DEFINE_string(arrival, "poisson",
+              "Arrival process of open-loop requests: poisson or fixed.");
 
 static volatile int g_keep_running = 1;
 
 struct app_hdr_t {
   uint64_t window_slot;
+  // When the request was due, in ns of the client's clock; echoed back.
+  uint64_t tx_ns;
+  // Size of the response the client asks for.
+  uint32_t resp_size;
 };
 
 struct stats_t {
@@ -47,19 +76,26 @@ struct stats_t {
   uint64_t err_tx_drops;
 };
 
+static uint64_t NowNs() {
+  return duration_cast<std::chrono::nanoseconds>(
+             high_resolution_clock::now().time_since_epoch())
+      .count();
+}
+
 class ThreadCtx {
  private:
   static constexpr int64_t kMinLatencyMicros = 1;
   static constexpr int64_t kMaxLatencyMicros = 1000 * 1000 * 100;  // 100 sec
   static constexpr int64_t kLatencyPrecision = 2;  // Two significant digits
 
-  struct msg_latency_info_t {
-    time_point<high_resolution_clock> tx_ts;
-  };
-
  public:
-  ThreadCtx(const void *channel_ctx, const MachnetFlow_t *flow_info)
-      : channel_ctx(CHECK_NOTNULL(channel_ctx)), flow(flow_info), stats() {
+  ThreadCtx(uint32_t id, const void *channel_ctx,
+            std::vector<MachnetFlow_t> flows)
+      : id(id),
+        channel_ctx(CHECK_NOTNULL(channel_ctx)),
+        flows(std::move(flows)),
+        rng(id),
+        stats() {
     // Fill-in max-sized messages, we'll send the actual size later
     rx_message.resize(MACHNET_MSG_MAX_LEN);
     tx_message.resize(MACHNET_MSG_MAX_LEN);
@@ -70,36 +106,38 @@ class ThreadCtx {
     int ret = hdr_init(kMinLatencyMicros, kMaxLatencyMicros, kLatencyPrecision,
                        &latency_hist);
     CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
-
-    msg_latency_info_vec.resize(FLAGS_msg_window);
   }
   ~ThreadCtx() { hdr_close(latency_hist); }
 
-  void RecordRequestStart(uint64_t window_slot) {
-    msg_latency_info_vec[window_slot].tx_ts = high_resolution_clock::now();
-  }
-
   /// Return the request's latency in microseconds
-  size_t RecordRequestEnd(uint64_t window_slot) {
-    auto &msg_latency_info = msg_latency_info_vec[window_slot];
-    auto latency_us = duration_cast<std::chrono::microseconds>(
-                          high_resolution_clock::now() - msg_latency_info.tx_ts)
-                          .count();
-
+  size_t RecordRequestEnd(const app_hdr_t *resp_hdr) {
+    const auto latency_us = (NowNs() - resp_hdr->tx_ns) / 1000;
     hdr_record_value(latency_hist, latency_us);
     num_request_latency_samples++;
     return latency_us;
   }
 
+  /// Return a message size of mean `mean' (see --size_dist).
+  uint32_t SampleSize(uint32_t mean) {
+    double size = mean;
+    if (FLAGS_size_dist == "uniform") {
+      size = std::uniform_real_distribution<double>(0, 2.0 * mean)(rng);
+    } else if (FLAGS_size_dist == "exponential") {
+      size = std::exponential_distribution<double>(1.0 / mean)(rng);
+    }
+    return std::clamp<double>(size, sizeof(app_hdr_t), MACHNET_MSG_MAX_LEN);
+  }
+
  public:
+  const uint32_t id;
   const void *channel_ctx;
-  const MachnetFlow_t *flow;
+  const std::vector<MachnetFlow_t> flows;
+  std::mt19937_64 rng;
   std::vector<uint8_t> rx_message;
   std::vector<uint8_t> tx_message;
   std::vector<uint8_t> message_gold;
   hdr_histogram *latency_hist;
-  size_t num_request_latency_samples;
-  std::vector<msg_latency_info_t> msg_latency_info_vec;
+  size_t num_request_latency_samples{0};
 
   struct {
     stats_t current;
@@ -149,20 +187,33 @@ void ReportStats(ThreadCtx *thread_ctx) {
       drops_stats_ss << ", TX drops: " << msg_dropped;
     }
 
-    std::cout << "TX/RX (msg/sec, Gbps): (" << std::fixed
+    std::ostringstream thread_ss;
+    if (FLAGS_threads > 1) thread_ss << "[T" << thread_ctx->id << "] ";
+
+    std::cout << thread_ss.str() << "TX/RX (msg/sec, Gbps): (" << std::fixed
               << std::setprecision(1) << tx_kmps << "K/" << rx_kmps << "K"
               << std::fixed << std::setprecision(3) << ", " << tx_gbps << "/"
               << rx_gbps << "). " << latency_stats_ss.str()
               << drops_stats_ss.str() << std::endl;
 
     hdr_reset(thread_ctx->latency_hist);
+    thread_ctx->num_request_latency_samples = 0;
     thread_ctx->stats.last_measure_time = now;
     thread_ctx->stats.prev = thread_ctx->stats.current;
   }
 }
 
-void ServerLoop(void *channel_ctx) {
-  ThreadCtx thread_ctx(channel_ctx, nullptr /* flow info */);
+void ReportTotalStats(const ThreadCtx &thread_ctx) {
+  const auto &stats_cur = thread_ctx.stats.current;
+  LOG(INFO) << "Application Statistics (TOTAL) - [TX] Sent: "
+            << stats_cur.tx_success << " (" << stats_cur.tx_bytes
+            << " Bytes), Drops: " << stats_cur.err_tx_drops
+            << ", [RX] Received: " << stats_cur.rx_count << " ("
+            << stats_cur.rx_bytes << " Bytes)";
+}
+
+void ServerLoop(uint32_t id, void *channel_ctx) {
+  ThreadCtx thread_ctx(id, channel_ctx, {} /* flows */);
   LOG(INFO) << "Server Loop: Starting.";
 
   while (true) {
@@ -186,10 +237,12 @@ void ServerLoop(void *channel_ctx) {
         reinterpret_cast<const app_hdr_t *>(thread_ctx.rx_message.data());
     VLOG(1) << "Server: Received msg for window slot " << req_hdr->window_slot;
 
-    // Send the response
+    // Send the response, echoing the header of the request.
     app_hdr_t *resp_hdr =
         reinterpret_cast<app_hdr_t *>(thread_ctx.tx_message.data());
-    resp_hdr->window_slot = req_hdr->window_slot;
+    *resp_hdr = *req_hdr;
+    const uint32_t resp_size =
+        req_hdr->resp_size != 0 ? req_hdr->resp_size : FLAGS_msg_size;
 
     MachnetFlow_t tx_flow;
     tx_flow.dst_ip = rx_flow.src_ip;
@@ -198,10 +251,10 @@ void ServerLoop(void *channel_ctx) {
     tx_flow.dst_port = rx_flow.src_port;
 
     const int ret = machnet_send(channel_ctx, tx_flow,
-                                 thread_ctx.tx_message.data(), FLAGS_msg_size);
+                                 thread_ctx.tx_message.data(), resp_size);
     if (ret == 0) {
       stats_cur.tx_success++;
-      stats_cur.tx_bytes += FLAGS_msg_size;
+      stats_cur.tx_bytes += resp_size;
     } else {
       stats_cur.err_tx_drops++;
     }
@@ -209,29 +262,30 @@ void ServerLoop(void *channel_ctx) {
     ReportStats(&thread_ctx);
   }
 
-  auto &stats_cur = thread_ctx.stats.current;
-  LOG(INFO) << "Application Statistics (TOTAL) - [TX] Sent: "
-            << stats_cur.tx_success << " (" << stats_cur.tx_bytes
-            << " Bytes), Drops: " << stats_cur.err_tx_drops
-            << ", [RX] Received: " << stats_cur.rx_count << " ("
-            << stats_cur.rx_bytes << " Bytes)";
+  ReportTotalStats(thread_ctx);
 }
 
-void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot) {
+// Sends a request due at `tx_ns' on the next flow of the thread.
+void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot,
+                   uint64_t tx_ns) {
   VLOG(1) << "Client: Sending message for window slot " << window_slot;
   auto &stats_cur = thread_ctx->stats.current;
-  thread_ctx->msg_latency_info_vec[window_slot].tx_ts =
-      high_resolution_clock::now();
 
   app_hdr_t *req_hdr =
       reinterpret_cast<app_hdr_t *>(thread_ctx->tx_message.data());
   req_hdr->window_slot = window_slot;
-
-  const int ret = machnet_send(thread_ctx->channel_ctx, *thread_ctx->flow,
-                               thread_ctx->tx_message.data(), FLAGS_msg_size);
+  req_hdr->tx_ns = tx_ns;
+  req_hdr->resp_size = thread_ctx->SampleSize(
+      FLAGS_resp_size != 0 ? FLAGS_resp_size : FLAGS_msg_size);
+  const uint32_t msg_size = thread_ctx->SampleSize(FLAGS_msg_size);
+
+  const auto &flow =
+      thread_ctx->flows[window_slot % thread_ctx->flows.size()];
+  const int ret = machnet_send(thread_ctx->channel_ctx, flow,
+                               thread_ctx->tx_message.data(), msg_size);
   if (ret == 0) {
     stats_cur.tx_success++;
-    stats_cur.tx_bytes += FLAGS_msg_size;
+    stats_cur.tx_bytes += msg_size;
   } else {
     LOG(WARNING) << "Client: Failed to send message for window slot "
                  << window_slot;
@@ -239,6 +293,32 @@ void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot) {
   }
 }
 
+// Processes a response received in the RX message of the thread, and returns
+// its window slot.
+uint64_t ClientOnResponse(ThreadCtx *thread_ctx, ssize_t rx_size) {
+  thread_ctx->stats.current.rx_count++;
+  thread_ctx->stats.current.rx_bytes += rx_size;
+
+  const auto *resp_hdr =
+      reinterpret_cast<app_hdr_t *>(thread_ctx->rx_message.data());
+  const size_t latency_us = thread_ctx->RecordRequestEnd(resp_hdr);
+  VLOG(1) << "Client: Received message for window slot "
+          << resp_hdr->window_slot << " in " << latency_us << " us";
+
+  if (FLAGS_verify) {
+    for (uint32_t i = sizeof(app_hdr_t); i < rx_size; i++) {
+      if (thread_ctx->rx_message[i] != thread_ctx->message_gold[i]) {
+        LOG(ERROR) << "Message data mismatch at index " << i << std::hex << " "
+                   << static_cast<uint32_t>(thread_ctx->rx_message[i]) << " "
+                   << static_cast<uint32_t>(thread_ctx->message_gold[i]);
+        break;
+      }
+    }
+  }
+
+  return resp_hdr->window_slot;
+}
+
 // Return the window slot for which a response was received
 uint64_t ClientRecvOneBlocking(ThreadCtx *thread_ctx) {
   const auto *channel_ctx = thread_ctx->channel_ctx;
@@ -255,47 +335,24 @@ uint64_t ClientRecvOneBlocking(ThreadCtx *thread_ctx) {
                      thread_ctx->rx_message.size(), &rx_flow);
     if (rx_size <= 0) continue;
 
-    thread_ctx->stats.current.rx_count++;
-    thread_ctx->stats.current.rx_bytes += rx_size;
-
-    const auto *resp_hdr =
-        reinterpret_cast<app_hdr_t *>(thread_ctx->rx_message.data());
-    if (resp_hdr->window_slot >= FLAGS_msg_window) {
-      LOG(ERROR) << "Received invalid window slot: " << resp_hdr->window_slot;
+    const auto window_slot = ClientOnResponse(thread_ctx, rx_size);
+    if (window_slot >= FLAGS_msg_window) {
+      LOG(ERROR) << "Received invalid window slot: " << window_slot;
       continue;
     }
-
-    const size_t latency_us =
-        thread_ctx->RecordRequestEnd(resp_hdr->window_slot);
-    VLOG(1) << "Client: Received message for window slot "
-            << resp_hdr->window_slot << " in " << latency_us << " us";
-
-    if (FLAGS_verify) {
-      for (uint32_t i = sizeof(app_hdr_t); i < rx_size; i++) {
-        if (thread_ctx->rx_message[i] != thread_ctx->message_gold[i]) {
-          LOG(ERROR) << "Message data mismatch at index " << i << std::hex
-                     << " " << static_cast<uint32_t>(thread_ctx->rx_message[i])
-                     << " "
-                     << static_cast<uint32_t>(thread_ctx->message_gold[i]);
-          break;
-        }
-      }
-    }
-
-    return resp_hdr->window_slot;
+    return window_slot;
   }
 
   LOG(FATAL) << "Should not reach here";
   return 0;
 }
 
-void ClientLoop(void *channel_ctx, MachnetFlow *flow) {
-  ThreadCtx thread_ctx(channel_ctx, flow);
+void ClientLoop(ThreadCtx *thread_ctx) {
   LOG(INFO) << "Client Loop: Starting.";
 
   // Send a full window of messages
   for (uint32_t i = 0; i < FLAGS_msg_window; i++) {
-    ClientSendOne(&thread_ctx, i /* window slot */);
+    ClientSendOne(thread_ctx, i /* window slot */, NowNs());
   }
 
   while (true) {
@@ -304,18 +361,65 @@ void ClientLoop(void *channel_ctx, MachnetFlow *flow) {
       break;
     }
 
-    const uint64_t rx_window_slot = ClientRecvOneBlocking(&thread_ctx);
-    ClientSendOne(&thread_ctx, rx_window_slot);
+    const uint64_t rx_window_slot = ClientRecvOneBlocking(thread_ctx);
+    ClientSendOne(thread_ctx, rx_window_slot, NowNs());
 
-    ReportStats(&thread_ctx);
+    ReportStats(thread_ctx);
   }
+}
 
-  auto &stats_cur = thread_ctx.stats.current;
-  LOG(INFO) << "Application Statistics (TOTAL) - [TX] Sent: "
-            << stats_cur.tx_success << " (" << stats_cur.tx_bytes
-            << " Bytes), Drops: " << stats_cur.err_tx_drops
-            << ", [RX] Received: " << stats_cur.rx_count << " ("
-            << stats_cur.rx_bytes << " Bytes)";
+/**
+ * Open-loop client: requests are due at the arrival times of a Poisson (or
+ * fixed-rate) process of `--rate' requests per second, and are sent when due
+ * regardless of the responses outstanding, round-robin over the flows of the
+ * thread. A request sent late (e.g., while the thread was receiving) still
+ * counts its latency from when it was due.
+ */
+void OpenLoopClientLoop(ThreadCtx *thread_ctx) {
+  LOG(INFO) << "Open-Loop Client Loop: Starting, " << FLAGS_rate
+            << " requests/sec (" << FLAGS_arrival << ").";
+
+  const double mean_gap_ns = 1E9 / FLAGS_rate;
+  std::exponential_distribution<double> poisson_gap_ns(1.0 / mean_gap_ns);
+  auto next_gap_ns = [&]() {
+    return FLAGS_arrival == "poisson" ? poisson_gap_ns(thread_ctx->rng)
+                                      : mean_gap_ns;
+  };
+
+  uint64_t seqno = 0;
+  double next_tx_ns = NowNs();
+  while (g_keep_running != 0) {
+    // Send the requests that are due.
+    const auto now_ns = NowNs();
+    while (next_tx_ns <= now_ns && seqno < FLAGS_msg_nr) {
+      ClientSendOne(thread_ctx, seqno++, static_cast<uint64_t>(next_tx_ns));
+      next_tx_ns += next_gap_ns();
+    }
+
+    // Receive the responses that came back.
+    MachnetFlow_t rx_flow;
+    ssize_t rx_size;
+    while ((rx_size = machnet_recv(thread_ctx->channel_ctx,
+                                   thread_ctx->rx_message.data(),
+                                   thread_ctx->rx_message.size(),
+                                   &rx_flow)) > 0) {
+      ClientOnResponse(thread_ctx, rx_size);
+    }
+
+    ReportStats(thread_ctx);
+  }
+  LOG(INFO) << "MsgGenLoop: Exiting.";
+}
+
+void ClientThread(uint32_t id, void *channel_ctx,
+                  std::vector<MachnetFlow_t> flows) {
+  ThreadCtx thread_ctx(id, channel_ctx, std::move(flows));
+  if (FLAGS_rate > 0) {
+    OpenLoopClientLoop(&thread_ctx);
+  } else {
+    ClientLoop(&thread_ctx);
+  }
+  ReportTotalStats(thread_ctx);
 }
 
 int main(int argc, char *argv[]) {
@@ -326,6 +430,16 @@ int main(int argc, char *argv[]) {
   FLAGS_logtostderr = 1;
 
   CHECK_GT(FLAGS_msg_size, sizeof(app_hdr_t)) << "Message size too small";
+  CHECK(FLAGS_resp_size == 0 || FLAGS_resp_size > sizeof(app_hdr_t))
+      << "Response size too small";
+  CHECK(FLAGS_size_dist == "fixed" || FLAGS_size_dist == "uniform" ||
+        FLAGS_size_dist == "exponential")
+      << "Invalid size distribution: " << FLAGS_size_dist;
+  CHECK(FLAGS_arrival == "poisson" || FLAGS_arrival == "fixed")
+      << "Invalid arrival process: " << FLAGS_arrival;
+  CHECK_GE(FLAGS_rate, 0) << "Invalid rate";
+  CHECK_GT(FLAGS_threads, 0) << "At least one thread is needed";
+  CHECK_GT(FLAGS_flows, 0) << "At least one flow is needed";
   if (FLAGS_remote_ip == "") {
     LOG(INFO) << "Starting in server mode, response size " << FLAGS_msg_size;
   } else {
@@ -333,38 +447,45 @@ int main(int argc, char *argv[]) {
   }
 
   CHECK_EQ(machnet_init(), 0) << "Failed to initialize Machnet library.";
-  void *channel_ctx = machnet_attach();
-  CHECK_NOTNULL(channel_ctx);
-
-  MachnetFlow_t flow;
-  std::thread datapath_thread;
-  if (FLAGS_remote_ip != "") {
-    // Client-mode
-    int ret =
-        machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
-                        FLAGS_remote_ip.c_str(), FLAGS_remote_port, &flow);
-    CHECK(ret == 0) << "Failed to connect to remote host. machnet_connect() "
-                       "error: "
-                    << strerror(ret);
-
-    LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
-              << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port << "]";
-
-    datapath_thread = std::thread(ClientLoop, channel_ctx, &flow);
-  } else {
-    int ret =
-        machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), FLAGS_local_port);
-    CHECK(ret == 0)
-        << "Failed to listen on local port. machnet_listen() error: "
-        << strerror(ret);
 
-    LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << FLAGS_local_port
-              << "]";
+  std::vector<std::thread> datapath_threads;
+  for (uint32_t i = 0; i < FLAGS_threads; i++) {
+    // Each thread has a channel of its own.
+    void *channel_ctx = machnet_attach();
+    CHECK_NOTNULL(channel_ctx);
+
+    if (FLAGS_remote_ip != "") {
+      // Client-mode
+      std::vector<MachnetFlow_t> flows(FLAGS_flows);
+      for (auto &flow : flows) {
+        int ret = machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
+                                  FLAGS_remote_ip.c_str(),
+                                  FLAGS_remote_port + i, &flow);
+        CHECK(ret == 0) << "Failed to connect to remote host. "
+                           "machnet_connect() error: "
+                        << strerror(ret);
+
+        LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
+                  << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port << "]";
+      }
 
-    datapath_thread = std::thread(ServerLoop, channel_ctx);
+      datapath_threads.emplace_back(ClientThread, i, channel_ctx,
+                                    std::move(flows));
+    } else {
+      int ret = machnet_listen(channel_ctx, FLAGS_local_ip.c_str(),
+                               FLAGS_local_port + i);
+      CHECK(ret == 0)
+          << "Failed to listen on local port. machnet_listen() error: "
+          << strerror(ret);
+
+      LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":"
+                << FLAGS_local_port + i << "]";
+
+      datapath_threads.emplace_back(ServerLoop, i, channel_ctx);
+    }
   }
 
   while (g_keep_running) sleep(5);
-  datapath_thread.join();
+  for (auto &thread : datapath_threads) thread.join();
   return 0;
 }
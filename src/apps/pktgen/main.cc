@@ -8,6 +8,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <ipv4.h>
+#include <machnet_common.h>
 #include <machnet_config.h>
 #include <math.h>
 #include <packet.h>
@@ -16,9 +17,17 @@
 #include <utils.h>
 #include <worker.h>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <string>
 #include <vector>
 
 #include "ttime.h"
@@ -44,10 +53,30 @@ DEFINE_bool(active_generator, false,
             "bouncing.");
 DEFINE_bool(zerocopy, true, "Use memcpy to fill packet payload.");
 DEFINE_string(rtt_log, "", "Log file for RTT measurements.");
+DEFINE_uint32(queues, 1,
+              "Number of RX/TX queue pairs, each served by its own core, taken "
+              "in order from the `cpu_mask' of the interface.");
+DEFINE_uint64(rate, 0,
+              "TX rate limit of each queue, in packets per second; 0 for as "
+              "fast as the NIC takes them.");
+DEFINE_uint32(udp_ports, 1,
+              "Number of UDP source ports the generated packets are spread "
+              "over, from 6666 on, to exercise RSS on the receiver.");
+DEFINE_string(port_mode, "rotate",
+              "How packets pick their UDP source port among `udp_ports': "
+              "'rotate' or 'random'.");
 
 // This is the source/destination UDP port used by the application.
 const uint16_t kAppUDPPort = 6666;
 
+// Workers publish their statistics to the main thread, which reports them
+// every second, at this period (see `publish_stats').
+const uint64_t kPublishPeriodMs = 10;
+
+// Tag of the packets this process generates, in their IPv4 identification
+// field: only those yield RTT samples when they come back.
+static const uint16_t g_packet_tag = static_cast<uint16_t>(getpid());
+
 static volatile int g_keep_running = 1;
 
 void int_handler([[maybe_unused]] int signal) { g_keep_running = 0; }
@@ -69,6 +98,63 @@ struct stats {
   uint64_t err_tx_drops;
 };
 
+/**
+ * @brief The statistics of a queue and the histogram of its RTT samples, as
+ * its worker publishes them.
+ */
+struct stats_snapshot {
+  stats counters;
+  MachnetLatencyHist_t rtt_hist{};
+
+  void add(const stats_snapshot &other) {
+    counters.tx_success += other.counters.tx_success;
+    counters.tx_bytes += other.counters.tx_bytes;
+    counters.rx_count += other.counters.rx_count;
+    counters.rx_bytes += other.counters.rx_bytes;
+    counters.err_no_mbufs += other.counters.err_no_mbufs;
+    counters.err_tx_drops += other.counters.err_tx_drops;
+    for (uint32_t i = 0; i < MACHNET_LATENCY_HIST_BUCKETS; i++) {
+      rtt_hist.buckets[i] += other.rtt_hist.buckets[i];
+    }
+  }
+};
+
+/**
+ * @brief Token bucket that limits the TX rate of a queue to `rate' packets per
+ * second, in bursts of at most `burst' packets. A rate of 0 means no limit.
+ */
+class token_bucket {
+ public:
+  token_bucket(uint64_t rate, uint32_t burst) : rate_(rate), burst_(burst) {}
+
+  /**
+   * @brief Takes the tokens to send up to `packets_nr' packets now.
+   * @return The number of packets that may be sent.
+   */
+  uint32_t take(uint64_t now, uint32_t packets_nr) {
+    if (rate_ == 0) return packets_nr;
+    if (last_tsc_ == 0) {
+      // The TSC frequency is known on the thread of the worker only.
+      tokens_per_cycle_ = static_cast<double>(rate_) / juggler::time::tsc_hz;
+      tokens_ = burst_;
+    } else {
+      tokens_ = std::min<double>(
+          burst_, tokens_ + (now - last_tsc_) * tokens_per_cycle_);
+    }
+    last_tsc_ = now;
+    const auto taken = std::min(packets_nr, static_cast<uint32_t>(tokens_));
+    tokens_ -= taken;
+    return taken;
+  }
+
+ private:
+  const uint64_t rate_;
+  const uint32_t burst_;
+  double tokens_per_cycle_{0};
+  double tokens_{0};
+  uint64_t last_tsc_{0};
+};
+
 /**
  * @brief This structure contains all the metadata required for all the routines
  * implemented in this application.
@@ -85,44 +171,77 @@ struct task_context {
    * applicaton in `juggler::net::Ipv4::Address` format. `std::nullopt` in
    * passive mode.
    * @param packet_size Size of the packets to be generated.
+   * @param queue_id Index of the queue pair of the task.
    * @param rxring Pointer to the RX ring previously initialized.
    * @param txring Pointer to the TX ring previously initialized.
+   * @param payloads Payloads to copy into packets, shared by all tasks.
    */
   task_context(juggler::net::Ethernet::Address local_mac,
                juggler::net::Ipv4::Address local_ip,
                std::optional<juggler::net::Ethernet::Address> remote_mac,
                std::optional<juggler::net::Ipv4::Address> remote_ip,
-               uint16_t packet_size, juggler::dpdk::RxRing *rxring,
-               juggler::dpdk::TxRing *txring,
-               std::vector<std::vector<uint8_t>> payloads)
+               uint16_t packet_size, uint16_t queue_id,
+               juggler::dpdk::RxRing *rxring, juggler::dpdk::TxRing *txring,
+               const std::vector<std::vector<uint8_t>> &payloads)
       : local_mac_addr(local_mac),
         local_ipv4_addr(local_ip),
         remote_mac_addr(remote_mac),
         remote_ipv4_addr(remote_ip),
         packet_size(packet_size),
+        queue_id(queue_id),
         rx_ring(CHECK_NOTNULL(rxring)),
         tx_ring(CHECK_NOTNULL(txring)),
         packet_payloads(payloads),
         arp_handler(local_mac, {local_ip}),
+        tx_bucket(FLAGS_rate, FLAGS_tx_batch_size),
+        random_ports(FLAGS_port_mode == "random"),
+        port_rng(queue_id),
         statistics(),
+        rtt_hist(),
         rtt_log() {}
   const juggler::net::Ethernet::Address local_mac_addr;
   const juggler::net::Ipv4::Address local_ipv4_addr;
   const std::optional<juggler::net::Ethernet::Address> remote_mac_addr;
   const std::optional<juggler::net::Ipv4::Address> remote_ipv4_addr;
   const uint16_t packet_size;
+  const uint16_t queue_id;
 
   juggler::dpdk::PacketPool *packet_pool;
   juggler::dpdk::RxRing *rx_ring;
   juggler::dpdk::TxRing *tx_ring;
 
-  std::vector<std::vector<uint8_t>> packet_payloads;
+  const std::vector<std::vector<uint8_t>> &packet_payloads;
   juggler::ArpHandler arp_handler;
 
+  token_bucket tx_bucket;
+  // State of the choice of UDP source ports (see `next_src_port').
+  const bool random_ports;
+  std::minstd_rand port_rng;
+  uint32_t port_index{0};
+
   stats statistics;
+  // RTTs of the packets generated by this process, from any queue, that the
+  // remote host bounced back to this queue.
+  MachnetLatencyHist_t rtt_hist;
   juggler::utils::TimeLog rtt_log;
+
+  // What the main thread reports (see `publish_stats').
+  std::mutex published_mutex;
+  stats_snapshot published;
+  uint64_t last_publish_tsc{0};
 };
 
+/**
+ * @brief Returns the UDP source port of the next packet generated, among
+ * `udp_ports' ports from `kAppUDPPort' on.
+ */
+uint16_t next_src_port(task_context *ctx) {
+  if (FLAGS_udp_ports <= 1) return kAppUDPPort;
+  const auto index = ctx->random_ports ? ctx->port_rng() % FLAGS_udp_ports
+                                      : ctx->port_index++ % FLAGS_udp_ports;
+  return kAppUDPPort + index;
+}
+
 /**
  * @brief Resolves the MAC address of a remote IP using ARP, with busy-waiting.
  *
@@ -218,7 +337,7 @@ void prepare_packet(void *context, juggler::dpdk::Packet *packet,
   auto *ipv4h = reinterpret_cast<juggler::net::Ipv4 *>(eh + 1);
   ipv4h->version_ihl = 0x45;
   ipv4h->type_of_service = 0;
-  ipv4h->packet_id = juggler::be16_t(0x1513);
+  ipv4h->packet_id = juggler::be16_t(g_packet_tag);
   ipv4h->fragment_offset = juggler::be16_t(0);
   ipv4h->time_to_live = juggler::net::Ipv4::kDefaultTTL;
   ipv4h->next_proto_id = juggler::net::Ipv4::Proto::kUdp;
@@ -230,7 +349,7 @@ void prepare_packet(void *context, juggler::dpdk::Packet *packet,
 
   // Prepare the L4 header.
   auto *udph = reinterpret_cast<juggler::net::Udp *>(ipv4h + 1);
-  udph->src_port.port = juggler::be16_t(kAppUDPPort);
+  udph->src_port.port = juggler::be16_t(next_src_port(ctx));
   udph->dst_port.port = juggler::be16_t(kAppUDPPort);
   udph->len = juggler::be16_t(len - sizeof(*eh) - sizeof(*ipv4h));
   udph->cksum = juggler::be16_t(0);
@@ -247,7 +366,7 @@ void prepare_packet(void *context, juggler::dpdk::Packet *packet,
   if (!FLAGS_zerocopy) {
     auto payload_len = len - kMinPacketLength;
     const size_t kPayloadArrayBitmask = ctx->packet_payloads.size() - 1;
-    static size_t payload_idx = 0;
+    thread_local size_t payload_idx = 0;
     auto *src_payload =
         ctx->packet_payloads[payload_idx & kPayloadArrayBitmask].data();
     auto *dst_payload = reinterpret_cast<uint8_t *>(pkt_timestamp + 1);
@@ -336,44 +455,116 @@ void ping(uint64_t now, void *context) {
 }
 
 /**
- * @brief Helper function to report TX/RX statistics at second granularity. It
- * keeps a checkpoint of the statistics since the previous report to calculate
- * per-second statistics.
+ * @brief Publishes the statistics of a queue to the main thread, which reports
+ * them (see `report_stats'), every `kPublishPeriodMs'.
  *
  * @param now Current TSC.
- * @param cur Pointer to the main statistics object.
+ * @param context Opaque pointer to the task context.
+ */
+void publish_stats(uint64_t now, void *context) {
+  auto *ctx = static_cast<task_context *>(context);
+  if (now - ctx->last_publish_tsc <
+      juggler::time::ms_to_cycles(kPublishPeriodMs))
+    return;
+  std::lock_guard<std::mutex> lock(ctx->published_mutex);
+  ctx->published.counters = ctx->statistics;
+  ctx->published.rtt_hist = ctx->rtt_hist;
+  ctx->last_publish_tsc = now;
+}
+
+/**
+ * @brief Formats the rates of a queue, or of all of them, and the RTT
+ * quantiles of the packets received, between two snapshots.
  */
-void report_stats(uint64_t now, void *context) {
+std::string format_stats(const stats_snapshot &cur, const stats_snapshot &prev,
+                         double sec_elapsed) {
   static const size_t kGiga = 1E9;
-  thread_local uint64_t last_report_timestamp;
-  thread_local stats stats_checkpoint;
-  const auto *ctx = static_cast<task_context *>(context);
-  const stats *cur = &ctx->statistics;
-
-  auto cycles_elapsed = now - last_report_timestamp;
-  if (cycles_elapsed > juggler::time::s_to_cycles(1)) {
-    auto sec_elapsed = juggler::time::cycles_to_s<double>(cycles_elapsed);
-    auto packets_sent = cur->tx_success - stats_checkpoint.tx_success;
-    auto tx_pps = static_cast<double>(packets_sent) / sec_elapsed;
-    auto tx_gbps =
-        static_cast<double>(cur->tx_bytes - stats_checkpoint.tx_bytes) /
-        sec_elapsed * 8.0 / kGiga;
-    auto packets_received = cur->rx_count - stats_checkpoint.rx_count;
-    auto rx_pps = static_cast<double>(packets_received / sec_elapsed);
-    auto rx_gbps =
-        static_cast<double>(cur->rx_bytes - stats_checkpoint.rx_bytes) /
-        sec_elapsed * 8.0 / kGiga;
-    auto packets_dropped = cur->err_tx_drops - stats_checkpoint.err_tx_drops;
-    auto tx_drop_pps = static_cast<double>(packets_dropped / sec_elapsed);
-
-    LOG(INFO) << juggler::utils::Format(
-        "[TX PPS: %lf (%lf Gbps), RX PPS: %lf (%lf Gbps), TX_DROP PPS: %lf]",
-        tx_pps, tx_gbps, rx_pps, rx_gbps, tx_drop_pps);
-
-    // Update local variables for next report.
-    stats_checkpoint = *cur;
-    last_report_timestamp = now;
+  const stats *c = &cur.counters, *p = &prev.counters;
+  auto tx_pps =
+      static_cast<double>(c->tx_success - p->tx_success) / sec_elapsed;
+  auto tx_gbps = static_cast<double>(c->tx_bytes - p->tx_bytes) / sec_elapsed *
+                 8.0 / kGiga;
+  auto rx_pps = static_cast<double>(c->rx_count - p->rx_count) / sec_elapsed;
+  auto rx_gbps = static_cast<double>(c->rx_bytes - p->rx_bytes) / sec_elapsed *
+                 8.0 / kGiga;
+  auto tx_drop_pps =
+      static_cast<double>(c->err_tx_drops - p->err_tx_drops) / sec_elapsed;
+  auto s = juggler::utils::Format(
+      "[TX PPS: %lf (%lf Gbps), RX PPS: %lf (%lf Gbps), TX_DROP PPS: %lf",
+      tx_pps, tx_gbps, rx_pps, rx_gbps, tx_drop_pps);
+
+  MachnetLatencyHist_t rtt_hist;
+  for (uint32_t i = 0; i < MACHNET_LATENCY_HIST_BUCKETS; i++) {
+    rtt_hist.buckets[i] = cur.rtt_hist.buckets[i] - prev.rtt_hist.buckets[i];
   }
+  if (__machnet_latency_hist_count(&rtt_hist) != 0) {
+    s += juggler::utils::Format(
+        ", RTT p50/p99 (us): %.1lf/%.1lf",
+        __machnet_latency_hist_quantile(&rtt_hist, 0.5) / 1E3,
+        __machnet_latency_hist_quantile(&rtt_hist, 0.99) / 1E3);
+  }
+  return s + "]";
+}
+
+/**
+ * @brief Reports the TX/RX statistics of each queue (if there are several),
+ * and of all of them, since the previous report.
+ *
+ * @param ctxs The contexts of the tasks, one per queue.
+ * @param checkpoints The snapshots of the previous report, updated.
+ * @param sec_elapsed Seconds since the previous report.
+ */
+void report_stats(const std::vector<std::unique_ptr<task_context>> &ctxs,
+                  std::vector<stats_snapshot> *checkpoints,
+                  double sec_elapsed) {
+  stats_snapshot total, total_checkpoint;
+  for (size_t i = 0; i < ctxs.size(); i++) {
+    stats_snapshot cur;
+    {
+      std::lock_guard<std::mutex> lock(ctxs[i]->published_mutex);
+      cur = ctxs[i]->published;
+    }
+    auto &checkpoint = (*checkpoints)[i];
+    if (ctxs.size() > 1) {
+      LOG(INFO) << "Queue " << i << ": "
+                << format_stats(cur, checkpoint, sec_elapsed);
+    }
+    total.add(cur);
+    total_checkpoint.add(checkpoint);
+    checkpoint = cur;
+  }
+  LOG(INFO) << format_stats(total, total_checkpoint, sec_elapsed);
+}
+
+/**
+ * @brief Reports the totals of each queue (if there are several), and of all
+ * of them, when the workers are done: packets sent and received, and the RTT
+ * quantiles of the packets generated here and bounced back.
+ */
+void report_final_queue_stats(
+    const std::vector<std::unique_ptr<task_context>> &ctxs) {
+  auto format = [](const stats_snapshot &snapshot) {
+    const auto *st = &snapshot.counters;
+    const auto *rtt_hist = &snapshot.rtt_hist;
+    return juggler::utils::Format(
+        "[TX] Sent: %lu, Drops: %lu, DropsNoMbuf: %lu [RX] Received: %lu "
+        "[RTT (ns)] samples: %lu, p50=%lu, p99=%lu, p999=%lu",
+        st->tx_success, st->err_tx_drops, st->err_no_mbufs, st->rx_count,
+        __machnet_latency_hist_count(rtt_hist),
+        __machnet_latency_hist_quantile(rtt_hist, 0.5),
+        __machnet_latency_hist_quantile(rtt_hist, 0.99),
+        __machnet_latency_hist_quantile(rtt_hist, 0.999));
+  };
+
+  stats_snapshot total;
+  for (size_t i = 0; i < ctxs.size(); i++) {
+    stats_snapshot queue;
+    queue.counters = ctxs[i]->statistics;
+    queue.rtt_hist = ctxs[i]->rtt_hist;
+    if (ctxs.size() > 1) LOG(INFO) << "Queue " << i << ": " << format(queue);
+    total.add(queue);
+  }
+  LOG(INFO) << "Application Statistics (TOTAL) - " << format(total);
 }
 
 void report_final_stats(void *context) {
@@ -438,17 +629,21 @@ void report_final_stats(void *context) {
 }
 
 // Main transmit (generator) routine.
-// It generates packets in batches and attempts to transmit them to the remote
-// host.
-void tx(void *context) {
+// It generates packets in batches, as the rate limit of the queue allows, and
+// attempts to transmit them to the remote host. Packets carry the TSC of their
+// batch, for the RTT of those the remote host bounces back.
+void tx(uint64_t now, void *context) {
   auto *ctx = static_cast<task_context *>(context);
   auto *tx = ctx->tx_ring;
   auto *pp = tx->GetPacketPool();
   auto *st = &ctx->statistics;
 
+  const auto packets_nr = ctx->tx_bucket.take(now, FLAGS_tx_batch_size);
+  if (packets_nr == 0) return;
+
   thread_local uint64_t seqno;
   juggler::dpdk::PacketBatch batch;
-  const auto ret = pp->PacketBulkAlloc(&batch, FLAGS_tx_batch_size);
+  const auto ret = pp->PacketBulkAlloc(&batch, packets_nr);
   if (!ret) {
     st->err_no_mbufs++;
     return;
@@ -456,18 +651,38 @@ void tx(void *context) {
 
   for (uint16_t i = 0; i < batch.GetSize(); i++) {
     auto *packet = batch[i];
-    prepare_packet(context, packet, seqno++, 0);
+    prepare_packet(context, packet, seqno++, now);
   }
 
   auto packets_sent = tx->TrySendPackets(&batch);
-  st->err_tx_drops += FLAGS_tx_batch_size - packets_sent;
+  st->err_tx_drops += packets_nr - packets_sent;
   st->tx_success += packets_sent;
   st->tx_bytes += static_cast<uint64_t>(packets_sent * ctx->packet_size);
 }
 
+/**
+ * @brief Records the RTT of a packet if this process generated it, and the
+ * remote host bounced it back (see `tx').
+ */
+void record_rtt(task_context *ctx, juggler::dpdk::Packet *packet,
+                uint64_t now) {
+  if (packet->length() < kMinPacketLength) return;
+  const auto *eh = packet->head_data<juggler::net::Ethernet *>();
+  if (eh->eth_type.value() != juggler::net::Ethernet::kIpv4) return;
+  const auto *ipv4h = reinterpret_cast<const juggler::net::Ipv4 *>(eh + 1);
+  if (ipv4h->packet_id.value() != g_packet_tag ||
+      ipv4h->src_addr.address != ctx->remote_ipv4_addr.value().address)
+    return;
+  const auto *udph = reinterpret_cast<const juggler::net::Udp *>(ipv4h + 1);
+  const auto *pkt_timestamp = reinterpret_cast<const uint64_t *>(udph + 1) + 1;
+  if (*pkt_timestamp == 0 || *pkt_timestamp > now) return;
+  __machnet_latency_hist_record(
+      &ctx->rtt_hist, juggler::time::cycles_to_ns(now - *pkt_timestamp));
+}
+
 // Main network receive routine.
-// This function receives packets in the application, and immediately releases
-// the mbufs.
+// This function receives packets in the application, records the RTT of the
+// packets generated here, and immediately releases the mbufs.
 void rx(void *context) {
   auto ctx = static_cast<task_context *>(context);
   auto *rx = ctx->rx_ring;
@@ -475,9 +690,11 @@ void rx(void *context) {
 
   juggler::dpdk::PacketBatch batch;
   auto packets_received = rx->RecvPackets(&batch);
+  const auto now = juggler::time::rdtsc();
   for (uint16_t i = 0; i < packets_received; i++) {
     auto *packet = batch[i];
     st->rx_bytes += packet->length();
+    record_rtt(ctx, packet, now);
   }
   st->rx_count += packets_received;
   // We need to release the received packet mbufs back to the pool.
@@ -552,6 +769,20 @@ int main(int argc, char *argv[]) {
 
   signal(SIGINT, int_handler);
 
+  if (FLAGS_queues == 0 || (FLAGS_ping && FLAGS_queues != 1)) {
+    LOG(ERROR) << "Invalid number of queues: " << FLAGS_queues
+               << " (ping mode uses a single queue).";
+    exit(1);
+  }
+  if (FLAGS_port_mode != "rotate" && FLAGS_port_mode != "random") {
+    LOG(ERROR) << "Invalid UDP port mode: " << FLAGS_port_mode;
+    exit(1);
+  }
+  if (FLAGS_udp_ports == 0 || FLAGS_udp_ports > UINT16_MAX - kAppUDPPort + 1) {
+    LOG(ERROR) << "Invalid number of UDP ports: " << FLAGS_udp_ports;
+    exit(1);
+  }
+
   // Parse the remote IP address.
   std::optional<juggler::net::Ipv4::Address> remote_ip;
   if (!FLAGS_active_generator && !FLAGS_ping) {
@@ -587,7 +818,31 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  juggler::dpdk::PmdPort pmd_obj(pmd_port_id.value());
+  // Each queue pair gets a core of the interface's CPU mask; a single queue
+  // pair runs on any of them.
+  const auto cpu_mask = interface.cpu_mask();
+  std::vector<cpu_set_t> cpu_masks;
+  if (FLAGS_queues == 1) {
+    cpu_masks.emplace_back(cpu_mask);
+  } else {
+    for (size_t cpu = 0;
+         cpu < CPU_SETSIZE && cpu_masks.size() < FLAGS_queues; cpu++) {
+      if (!CPU_ISSET(cpu, &cpu_mask)) continue;
+      cpu_set_t core_mask;
+      CPU_ZERO(&core_mask);
+      CPU_SET(cpu, &core_mask);
+      cpu_masks.emplace_back(core_mask);
+    }
+    if (cpu_masks.size() < FLAGS_queues) {
+      LOG(ERROR) << "The CPU mask of the interface has fewer cores than the "
+                 << FLAGS_queues << " queues.";
+      exit(1);
+    }
+  }
+
+  // With several RX queues, RSS spreads the packets received over them.
+  juggler::dpdk::PmdPort pmd_obj(pmd_port_id.value(), FLAGS_queues,
+                                 FLAGS_queues);
   pmd_obj.InitDriver();
 
   auto *rxring = pmd_obj.GetRing<juggler::dpdk::RxRing>(0);
@@ -631,29 +886,36 @@ int main(int argc, char *argv[]) {
   // auto tx_packet_pool = std::make_unique<juggler::dpdk::PacketPool>(4096);
   // We share the packet pool attached to the RX ring. Since we plan to handle a
   // queue pair from a single core this is safe.
-  task_context task_ctx(interface.l2_addr(), interface.ip_addr(),
-                        remote_l2_addr, remote_ip, packet_len, rxring, txring,
-                        packet_payloads);
+  std::vector<std::unique_ptr<task_context>> task_ctxs;
+  for (uint16_t q = 0; q < FLAGS_queues; q++) {
+    task_ctxs.emplace_back(std::make_unique<task_context>(
+        interface.l2_addr(), interface.ip_addr(), remote_l2_addr, remote_ip,
+        packet_len, q, pmd_obj.GetRing<juggler::dpdk::RxRing>(q),
+        pmd_obj.GetRing<juggler::dpdk::TxRing>(q), packet_payloads));
+  }
 
   auto packet_generator = [](uint64_t now, void *context) {
-    tx(context);
+    tx(now, context);
     rx(context);
-    report_stats(now, context);
+    publish_stats(now, context);
   };
 
   auto pingpong = [](uint64_t now, void *context) { ping(now, context); };
 
   auto packet_bouncer = [](uint64_t now, void *context) {
     bounce(context);
-    report_stats(now, context);
+    publish_stats(now, context);
   };
 
   auto routine =
       FLAGS_ping ? pingpong
                  : (FLAGS_active_generator ? packet_generator : packet_bouncer);
-  // Create a task object to pass to worker thread.
-  auto task =
-      std::make_shared<juggler::Task>(routine, static_cast<void *>(&task_ctx));
+  // Create a task object per queue pair to pass to its worker thread.
+  std::vector<std::shared_ptr<juggler::Task>> tasks;
+  for (auto &task_ctx : task_ctxs) {
+    tasks.emplace_back(std::make_shared<juggler::Task>(
+        routine, static_cast<void *>(task_ctx.get())));
+  }
 
   if (FLAGS_ping)
     std::cout << "Starting in ping mode; press Ctrl-C to stop." << std::endl;
@@ -662,19 +924,30 @@ int main(int argc, char *argv[]) {
   else
     std::cout << "Starting in passive message bouncing mode." << std::endl;
 
-  juggler::WorkerPool<juggler::Task> WPool({task}, {interface.cpu_mask()});
+  juggler::WorkerPool<juggler::Task> WPool(tasks, cpu_masks);
   WPool.Init();
 
   // Set worker to running.
   WPool.Launch();
 
+  std::vector<stats_snapshot> checkpoints(task_ctxs.size());
+  auto last_report = std::chrono::steady_clock::now();
   while (g_keep_running) {
-    sleep(5);
+    sleep(1);
+    if (FLAGS_ping) continue;
+    const auto now = std::chrono::steady_clock::now();
+    report_stats(task_ctxs, &checkpoints,
+                 std::chrono::duration<double>(now - last_report).count());
+    last_report = now;
   }
 
   WPool.Pause();
   WPool.Terminate();
-  report_final_stats(&task_ctx);
+  if (FLAGS_ping) {
+    report_final_stats(task_ctxs.front().get());
+  } else {
+    report_final_queue_stats(task_ctxs);
+  }
   pmd_obj.DumpStats();
 
   return (0);
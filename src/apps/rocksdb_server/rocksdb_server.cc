@@ -10,9 +10,12 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 DEFINE_int32(num_keys, 1000, "Number of keys to insert and retrieve");
@@ -20,55 +23,242 @@ DEFINE_int32(num_probes, 10000, "Number of probes to perform");
 DEFINE_int32(value_size, 200, "Size of value in bytes");
 DEFINE_string(local, "", "Local IP address, needed for Machnet only");
 DEFINE_string(transport, "machnet", "Transport to use (machnet, udp)");
+DEFINE_uint32(threads, 1,
+              "Number of Machnet worker threads, each on its own channel. "
+              "Thread `i' listens on port 888 + i.");
+DEFINE_uint32(batch_size, 32,
+              "Maximum number of requests a Machnet worker looks up with one "
+              "MultiGet.");
+DEFINE_bool(zero_copy, false,
+            "Read requests in place from the channel buffers, and write "
+            "responses in place into loaned ones (Machnet only).");
 
 static constexpr uint16_t kPort = 888;
+static constexpr size_t kMaxKeySize = 1024;
 const char kNsaasRocksDbServerFile[] = "/tmp/testdb";
 
-void MachnetTransportServer(rocksdb::DB *db) {
-  // Initialize machnet and attach
-  int ret = machnet_init();
-  CHECK_EQ(ret, 0) << "machnet_init() failed";
-  void *channel = machnet_attach();
+MachnetFlow_t ReverseFlow(const MachnetFlow_t &rx_flow) {
+  MachnetFlow_t tx_flow;
+  tx_flow.dst_ip = rx_flow.src_ip;
+  tx_flow.src_ip = rx_flow.dst_ip;
+  tx_flow.dst_port = rx_flow.src_port;
+  tx_flow.src_port = rx_flow.dst_port;
+  return tx_flow;
+}
 
-  CHECK(channel != nullptr) << "machnet_attach() failed";
-  ret = machnet_listen(channel, FLAGS_local.c_str(), kPort);
-  CHECK_EQ(ret, 0) << "machnet_listen() failed";
+// State of a Machnet worker, sized for one batch of requests.
+struct MachnetWorker {
+  MachnetWorker(uint32_t id, void *channel, rocksdb::DB *db)
+      : id(id),
+        channel(channel),
+        db(db),
+        rx_bufs(FLAGS_batch_size),
+        rx_iovs(FLAGS_batch_size),
+        rx_msghdrs(FLAGS_batch_size),
+        rx_msgs(FLAGS_batch_size),
+        rx_segs(FLAGS_batch_size,
+                std::vector<MachnetIovec_t>(
+                    machnet_msg_iovlen(channel, MACHNET_MSG_MAX_LEN))),
+        keys(FLAGS_batch_size),
+        values(FLAGS_batch_size),
+        statuses(FLAGS_batch_size),
+        tx_flows(FLAGS_batch_size),
+        tx_iovs(FLAGS_batch_size),
+        tx_msghdrs(FLAGS_batch_size),
+        tx_segs(machnet_msg_iovlen(channel, MACHNET_MSG_MAX_LEN)) {}
 
-  // Handle client requests
-  LOG(INFO) << "Waiting for client requests";
-  while (true) {
-    std::array<char, 1024> buf;
-    MachnetFlow rx_flow;
-    const ssize_t ret = machnet_recv(channel, buf.data(), buf.size(), &rx_flow);
-    CHECK_GE(ret, 0) << "machnet_recv() failed";
-    if (ret == 0) {
-      usleep(1);
+  const uint32_t id;
+  void *const channel;
+  rocksdb::DB *const db;
+
+  // Requests, copied out of the channel.
+  std::vector<std::array<char, kMaxKeySize>> rx_bufs;
+  std::vector<MachnetIovec_t> rx_iovs;
+  std::vector<MachnetMsgHdr_t> rx_msghdrs;
+  // Requests, left in the channel buffers (`--zero_copy').
+  std::vector<MachnetMsg_t> rx_msgs;
+  std::vector<std::vector<MachnetIovec_t>> rx_segs;
+  std::vector<std::string> split_keys;  // Keys that span several buffers.
+
+  std::vector<rocksdb::Slice> keys;
+  std::vector<rocksdb::PinnableSlice> values;
+  std::vector<rocksdb::Status> statuses;
+  std::vector<MachnetFlow_t> tx_flows;
+
+  std::vector<MachnetIovec_t> tx_iovs;
+  std::vector<MachnetMsgHdr_t> tx_msghdrs;
+  // Segments of a response written in place (`--zero_copy').
+  std::vector<MachnetIovec_t> tx_segs;
+};
+
+// Receives a batch of requests, copied out; returns their number.
+size_t MachnetRecvBatch(MachnetWorker *w) {
+  for (size_t i = 0; i < w->rx_msghdrs.size(); i++) {
+    w->rx_iovs[i] = {w->rx_bufs[i].data(), w->rx_bufs[i].size()};
+    w->rx_msghdrs[i].msg_iov = &w->rx_iovs[i];
+    w->rx_msghdrs[i].msg_iovlen = 1;
+  }
+  const int ret = machnet_recvmmsg(w->channel, w->rx_msghdrs.data(),
+                                   w->rx_msghdrs.size());
+  if (ret < 0) {
+    LOG(ERROR) << "machnet_recvmmsg() dropped requests larger than "
+               << kMaxKeySize << " bytes";
+    return 0;
+  }
+  for (int i = 0; i < ret; i++) {
+    w->keys[i] =
+        rocksdb::Slice(w->rx_bufs[i].data(), w->rx_msghdrs[i].msg_size);
+    w->tx_flows[i] = ReverseFlow(w->rx_msghdrs[i].flow_info);
+  }
+  return ret;
+}
+
+// Receives a batch of requests, left in the channel buffers until
+// `MachnetReleaseBatch'; returns their number.
+size_t MachnetRecvBatchZeroCopy(MachnetWorker *w) {
+  w->split_keys.clear();
+  w->split_keys.reserve(w->rx_msgs.size());
+  size_t n = 0;
+  while (n < w->rx_msgs.size()) {
+    MachnetMsg_t *msg = &w->rx_msgs[n];
+    msg->msg_iov = w->rx_segs[n].data();
+    msg->msg_iovlen = w->rx_segs[n].size();
+    const int ret = machnet_recvmsg_zc(w->channel, msg);
+    if (ret == 0) break;
+    if (ret < 0) {
+      LOG(ERROR) << "machnet_recvmsg_zc() failed";
       continue;
     }
+    if (msg->msg_iovlen == 1) {
+      w->keys[n] = rocksdb::Slice(static_cast<char *>(msg->msg_iov[0].base),
+                                  msg->msg_iov[0].len);
+    } else {
+      // Rare: only keys larger than a buffer are copied.
+      auto &key = w->split_keys.emplace_back();
+      for (size_t i = 0; i < msg->msg_iovlen; i++) {
+        key.append(static_cast<char *>(msg->msg_iov[i].base),
+                   msg->msg_iov[i].len);
+      }
+      w->keys[n] = key;
+    }
+    w->tx_flows[n] = ReverseFlow(msg->flow_info);
+    n++;
+  }
+  return n;
+}
 
-    std::string key(buf.data(), ret);
-    VLOG(1) << "Received GET request for key: " << key;
+void MachnetReleaseBatch(MachnetWorker *w, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    machnet_msg_release(w->channel, &w->rx_msgs[i]);
+  }
+}
 
-    std::string value;
-    const rocksdb::Status status = db->Get(rocksdb::ReadOptions(), key, &value);
+// Sends the values found, in batches; the values stay pinned meanwhile.
+void MachnetSendBatch(MachnetWorker *w, size_t n) {
+  size_t tx_nr = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!w->statuses[i].ok()) {
+      LOG(ERROR) << "Error retrieving key: " << w->statuses[i].ToString();
+      continue;
+    }
+    w->tx_iovs[tx_nr] = {const_cast<char *>(w->values[i].data()),
+                         w->values[i].size()};
+    auto &msghdr = w->tx_msghdrs[tx_nr];
+    msghdr.msg_size = w->values[i].size();
+    msghdr.flow_info = w->tx_flows[i];
+    msghdr.msg_iov = &w->tx_iovs[tx_nr];
+    msghdr.msg_iovlen = 1;
+    msghdr.flags = 0;
+    tx_nr++;
+  }
+  size_t sent = 0;
+  while (sent < tx_nr) {
+    const int ret = machnet_sendmmsg(w->channel, w->tx_msghdrs.data() + sent,
+                                     tx_nr - sent);
+    if (ret <= 0) {
+      LOG(ERROR) << "machnet_sendmmsg() failed, dropping " << tx_nr - sent
+                 << " responses";
+      break;
+    }
+    sent += ret;
+  }
+}
 
-    if (status.ok()) {
-      MachnetFlow tx_flow;
-      tx_flow.dst_ip = rx_flow.src_ip;
-      tx_flow.src_ip = rx_flow.dst_ip;
-      tx_flow.dst_port = rx_flow.src_port;
-      tx_flow.src_port = rx_flow.dst_port;
+// Writes the values found straight into loaned channel buffers, and sends
+// them.
+void MachnetSendBatchZeroCopy(MachnetWorker *w, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (!w->statuses[i].ok()) {
+      LOG(ERROR) << "Error retrieving key: " << w->statuses[i].ToString();
+      continue;
+    }
+    const rocksdb::PinnableSlice &value = w->values[i];
+    MachnetMsg_t msg = {};
+    msg.msg_iov = w->tx_segs.data();
+    msg.msg_iovlen = w->tx_segs.size();
+    if (machnet_msg_alloc(w->channel, value.size(), &msg) != 0) {
+      LOG(ERROR) << "machnet_msg_alloc() failed";
+      continue;
+    }
+    size_t ofs = 0;
+    for (size_t j = 0; j < msg.msg_iovlen; j++) {
+      std::memcpy(msg.msg_iov[j].base, value.data() + ofs, msg.msg_iov[j].len);
+      ofs += msg.msg_iov[j].len;
+    }
+    msg.flow_info = w->tx_flows[i];
+    msg.flags = 0;
+    if (machnet_msg_send(w->channel, &msg) != 0) {
+      LOG(ERROR) << "machnet_msg_send() failed";
+      machnet_msg_free(w->channel, &msg);
+    }
+  }
+}
 
-      ssize_t send_ret =
-          machnet_send(channel, tx_flow, value.data(), value.size());
-      VLOG(1) << "Sent value of size " << value.size() << " bytes to client";
-      if (send_ret == -1) {
-        LOG(ERROR) << "machnet_send() failed";
-      }
+void MachnetWorkerLoop(MachnetWorker *w) {
+  LOG(INFO) << "[T" << w->id << "] Waiting for client requests";
+  const rocksdb::ReadOptions read_options;
+  while (true) {
+    const size_t n = FLAGS_zero_copy ? MachnetRecvBatchZeroCopy(w)
+                                     : MachnetRecvBatch(w);
+    if (n == 0) {
+      usleep(1);
+      continue;
+    }
+    VLOG(1) << "[T" << w->id << "] Received " << n << " GET requests";
+
+    // One lookup for the whole batch; values are pinned in the block cache
+    // rather than copied out.
+    w->db->MultiGet(read_options, w->db->DefaultColumnFamily(), n,
+                    w->keys.data(), w->values.data(), w->statuses.data());
+    if (FLAGS_zero_copy) {
+      MachnetReleaseBatch(w, n);
+      MachnetSendBatchZeroCopy(w, n);
     } else {
-      LOG(ERROR) << "Error retrieving key: " << status.ToString();
+      MachnetSendBatch(w, n);
     }
+    for (size_t i = 0; i < n; i++) w->values[i].Reset();
+  }
+}
+
+void MachnetTransportServer(rocksdb::DB *db) {
+  // Initialize machnet and attach
+  int ret = machnet_init();
+  CHECK_EQ(ret, 0) << "machnet_init() failed";
+  CHECK_GT(FLAGS_threads, 0) << "At least one thread is needed";
+  CHECK_GT(FLAGS_batch_size, 0) << "The batch size must be positive";
+
+  // Each worker has a channel of its own, and serves its own port.
+  std::vector<std::unique_ptr<MachnetWorker>> workers;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < FLAGS_threads; i++) {
+    void *channel = machnet_attach();
+    CHECK(channel != nullptr) << "machnet_attach() failed";
+    ret = machnet_listen(channel, FLAGS_local.c_str(), kPort + i);
+    CHECK_EQ(ret, 0) << "machnet_listen() failed";
+    workers.emplace_back(std::make_unique<MachnetWorker>(i, channel, db));
+    threads.emplace_back(MachnetWorkerLoop, workers.back().get());
   }
+  for (auto &thread : threads) thread.join();
 }
 
 void UDPTransportServer(rocksdb::DB *db) {
@@ -0,0 +1,283 @@
+/**
+ * @file engine_loopback_bench.cc
+ * @brief Benchmark of the per-message cost of the Machnet engine, without
+ * NICs: a client and a server engine are wired back-to-back through a pair of
+ * DPDK ring ports (what one port sends, the other receives), and their
+ * channels are driven through the shim. The client keeps a window of messages
+ * in flight, spread over its flows; the server echoes them back.
+ *
+ * A single thread runs both engines and both applications, so that the TSC
+ * cycles spent in the engines are measured exactly. Reported, per message
+ * size and number of flows:
+ *  - `items_per_second': messages (round trips) per second.
+ *  - `Mpps': packets received by both ports, including ACKs, in millions per
+ *    second.
+ *  - `cycles/msg': TSC cycles spent in both engines per round trip, including
+ *    the polls that found nothing to do.
+ *  - `p50_ns', `p99_ns': round-trip time of messages, from the client's send
+ *    to its receive of the echo.
+ */
+#include <benchmark/benchmark.h>
+#include <channel.h>
+#include <dpdk.h>
+#include <glog/logging.h>
+#include <machnet.h>
+#include <machnet_engine.h>
+#include <perf_benchmark.h>
+#include <pmd.h>
+#include <rte_eth_ring.h>
+#include <rte_ring.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+using juggler::MachnetEngine;
+using juggler::MachnetEngineSharedState;
+using juggler::dpdk::PmdPort;
+using juggler::net::Ethernet;
+using juggler::net::Ipv4;
+
+static constexpr char kClientIp[] = "10.0.0.1";
+static constexpr char kServerIp[] = "10.0.0.2";
+static constexpr uint16_t kServerPort = 888;
+static constexpr uint32_t kRingDescNr = 1024;
+// Messages the client keeps in flight, over all its flows.
+static constexpr size_t kWindow = 32;
+// Round trips per benchmark iteration.
+static constexpr size_t kMsgsPerIteration = 1024;
+
+/**
+ * @brief The two ports of the wire. They live for the whole run: closing a
+ * ring port releases it.
+ */
+static std::shared_ptr<PmdPort> g_ports[2];
+
+static void CreateWire() {
+  rte_ring *rings[2];
+  for (int i = 0; i < 2; i++) {
+    rings[i] = CHECK_NOTNULL(rte_ring_create(
+        juggler::utils::Format("bench_wire%d", i).c_str(), 4 * kRingDescNr,
+        rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ));
+  }
+  for (int i = 0; i < 2; i++) {
+    // Port `i' receives from ring `i' and sends to the other one.
+    const int port_id = rte_eth_from_rings(
+        juggler::utils::Format("bench_port%d", i).c_str(), &rings[i], 1,
+        &rings[1 - i], 1, rte_socket_id());
+    CHECK_GE(port_id, 0) << "Cannot create ring port " << i;
+    g_ports[i] = std::make_shared<PmdPort>(port_id, 1, 1, kRingDescNr,
+                                           kRingDescNr);
+    g_ports[i]->InitDriver();
+  }
+}
+
+/**
+ * @brief One end of the wire: an engine, and the channel of its application.
+ */
+struct Host {
+  Host(int port, const char *ip, const char *peer_ip,
+       juggler::shm::ChannelManager *channel_mgr) {
+    const auto &pmd_port = g_ports[port];
+    Ipv4::Address local_addr, peer_addr;
+    CHECK(local_addr.FromString(ip));
+    CHECK(peer_addr.FromString(peer_ip));
+    // The peer is the other port of the wire; no ARP is needed.
+    const auto peer_l2addr = g_ports[1 - port]->GetL2Addr();
+    auto shared_state = std::make_shared<MachnetEngineSharedState>(
+        pmd_port->GetRSSKey(), pmd_port->GetL2Addr(),
+        std::vector<Ipv4::Address>{local_addr},
+        std::vector<std::pair<Ipv4::Address, Ethernet::Address>>{
+            {peer_addr, peer_l2addr}});
+
+    const auto mtu =
+        pmd_port->GetMTU().value_or(juggler::dpdk::PmdRing::kDefaultFrameSize);
+    const auto name = juggler::utils::Format("bench_channel%d", port);
+    CHECK(channel_mgr->AddChannel(
+        name.c_str(), juggler::shm::ChannelManager::kDefaultRingSize,
+        juggler::shm::ChannelManager::kDefaultRingSize,
+        juggler::shm::ChannelManager::kDefaultBufferCount,
+        mtu - sizeof(Ipv4) - sizeof(juggler::net::Udp) -
+            sizeof(juggler::net::MachnetPktHdr)));
+    channel = channel_mgr->GetChannel(name.c_str());
+    engine = std::make_unique<MachnetEngine>(pmd_port, 0, 0, shared_state,
+                                             std::vector{channel});
+  }
+
+  void *ctx() const { return channel->ctx(); }
+
+  std::shared_ptr<juggler::shm::Channel> channel;
+  std::unique_ptr<MachnetEngine> engine;
+};
+
+/**
+ * @brief The client and the server, and the engine cycles spent so far.
+ */
+class Loopback {
+ public:
+  explicit Loopback(size_t flows_nr)
+      : client_(0, kClientIp, kServerIp, &channel_mgr_),
+        server_(1, kServerIp, kClientIp, &channel_mgr_) {
+    CHECK_EQ(RunUntil(std::async(std::launch::async,
+                                 [this] {
+                                   return machnet_listen(server_.ctx(),
+                                                         kServerIp,
+                                                         kServerPort);
+                                 })),
+             0);
+    flows_.resize(flows_nr);
+    for (auto &flow : flows_) {
+      CHECK_EQ(RunUntil(std::async(std::launch::async,
+                                   [this, &flow] {
+                                     return machnet_connect(
+                                         client_.ctx(), kClientIp, kServerIp,
+                                         kServerPort, &flow);
+                                   })),
+               0);
+    }
+  }
+
+  // Runs both engines once, and accounts the cycles they spent.
+  void RunEngines() {
+    const auto start = juggler::time::rdtsc();
+    client_.engine->Run(start);
+    server_.engine->Run(juggler::time::rdtsc());
+    engine_cycles_ += juggler::time::rdtsc() - start;
+  }
+
+  // Runs the engines until a control request of the shim completes.
+  int RunUntil(std::future<int> &&request) {
+    while (request.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      RunEngines();
+    }
+    return request.get();
+  }
+
+  /**
+   * @brief Completes `msgs_nr' round trips of messages of `msg_size' bytes,
+   * and appends their round-trip times (in TSC cycles) to `rtts'. Every
+   * message carries the TSC of its send.
+   */
+  void RoundTrips(size_t msgs_nr, std::vector<uint8_t> *buf,
+                  std::vector<uint64_t> *rtts) {
+    size_t sent = 0, received = 0, inflight = 0;
+    while (received < msgs_nr) {
+      while (inflight < kWindow && sent < msgs_nr) {
+        const uint64_t tsc = juggler::time::rdtsc();
+        std::memcpy(buf->data(), &tsc, sizeof(tsc));
+        if (machnet_send(client_.ctx(), flows_[sent % flows_.size()],
+                         buf->data(), buf->size()) != 0)
+          break;
+        sent++;
+        inflight++;
+      }
+
+      RunEngines();
+
+      // Echo what the server received.
+      MachnetFlow_t rx_flow;
+      while (machnet_recv(server_.ctx(), buf->data(), buf->size(),
+                          &rx_flow) > 0) {
+        MachnetFlow_t tx_flow;
+        tx_flow.src_ip = rx_flow.dst_ip;
+        tx_flow.dst_ip = rx_flow.src_ip;
+        tx_flow.src_port = rx_flow.dst_port;
+        tx_flow.dst_port = rx_flow.src_port;
+        // Retry until the ring to the engine has room.
+        while (machnet_send(server_.ctx(), tx_flow, buf->data(),
+                            buf->size()) != 0) {
+          RunEngines();
+        }
+      }
+
+      while (machnet_recv(client_.ctx(), buf->data(), buf->size(),
+                          &rx_flow) > 0) {
+        uint64_t tsc;
+        std::memcpy(&tsc, buf->data(), sizeof(tsc));
+        rtts->emplace_back(juggler::time::rdtsc() - tsc);
+        received++;
+        inflight--;
+      }
+    }
+  }
+
+  uint64_t engine_cycles() const { return engine_cycles_; }
+
+ private:
+  juggler::shm::ChannelManager channel_mgr_;
+  Host client_;
+  Host server_;
+  std::vector<MachnetFlow_t> flows_;
+  uint64_t engine_cycles_{0};
+};
+
+static uint64_t PortRxPackets() {
+  uint64_t packets = 0;
+  for (const auto &port : g_ports) {
+    port->UpdatePortStats();
+    packets += port->GetPortRxPkts();
+  }
+  return packets;
+}
+
+static void BM_EngineLoopback(benchmark::State &st) {  // NOLINT
+  const auto msg_size = static_cast<size_t>(st.range(0));
+  const auto flows_nr = static_cast<size_t>(st.range(1));
+  Loopback loopback(flows_nr);
+  std::vector<uint8_t> buf(msg_size);
+  std::vector<uint64_t> rtts;
+
+  const auto start_cycles = loopback.engine_cycles();
+  const auto start_packets = PortRxPackets();
+  for (auto _ : st) {
+    loopback.RoundTrips(kMsgsPerIteration, &buf, &rtts);
+  }
+  const auto msgs_nr = st.iterations() * kMsgsPerIteration;
+  st.SetItemsProcessed(msgs_nr);
+  st.SetBytesProcessed(msgs_nr * msg_size);
+
+  st.counters["Mpps"] = benchmark::Counter(
+      static_cast<double>(PortRxPackets() - start_packets) / 1e6,
+      benchmark::Counter::kIsRate);
+  st.counters["cycles/msg"] =
+      static_cast<double>(loopback.engine_cycles() - start_cycles) / msgs_nr;
+  auto quantile_ns = [&rtts](double q) {
+    const auto nth = rtts.begin() + static_cast<size_t>(q * (rtts.size() - 1));
+    std::nth_element(rtts.begin(), nth, rtts.end());
+    return juggler::time::cycles_to_ns<double>(*nth);
+  };
+  st.counters["p50_ns"] = quantile_ns(0.5);
+  st.counters["p99_ns"] = quantile_ns(0.99);
+}
+
+BENCHMARK(BM_EngineLoopback)
+    ->ArgNames({"msg_size", "flows"})
+    ->ArgsProduct({{64, 1024, 8192, 65536}, {1, 16, 128}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  const auto perf_options = juggler::perf::Options::Parse(&argc, argv);
+  benchmark::Initialize(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+  CreateWire();
+
+  const int status = juggler::perf::RunSpecifiedBenchmarks(
+      "engine_loopback_bench", perf_options);
+  benchmark::Shutdown();
+  return status;
+}
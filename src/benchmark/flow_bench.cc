@@ -0,0 +1,343 @@
+/**
+ * @file flow_bench.cc
+ * @brief Microbenchmarks of the per-packet classes of a flow, in isolation:
+ * `TXTracking', `RXTracking', the SACK recovery of `Flow::process_ack', and
+ * the SACK bitmap of `swift::Pcb'. Packets are synthetic, and the channel is
+ * a real shared memory channel that no application reads: whatever the flow
+ * delivers is freed right away.
+ */
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "channel.h"
+#include "dpdk.h"
+#include "machnet.h"
+#include "machnet_pkthdr.h"
+#include "packet_pool.h"
+#include "perf_benchmark.h"
+#include "pmd.h"
+#include "ttime.h"
+#include "utils.h"
+
+#define private public
+#include "flow.h"
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+static constexpr uint32_t kRingSize = 1 << 10;
+static constexpr uint32_t kBuffersNr = 1 << 13;
+static constexpr uint32_t kMbufsNr = 1 << 13;
+// Payload of the synthetic messages and packets.
+static constexpr uint32_t kPayloadSize = 64;
+static constexpr size_t kNetHdrLen = sizeof(Ethernet) + sizeof(Ipv4) +
+                                     sizeof(Udp) + sizeof(MachnetPktHdr);
+
+// The port flows send to; the null PMD drops everything.
+static std::shared_ptr<dpdk::PmdPort> g_port;
+
+/**
+ * @brief A channel, as sized by the engine for the MTU of `g_port', and a pool
+ * of packets to build synthetic ones from.
+ */
+class Fixture {
+ public:
+  Fixture() {
+    const auto mtu =
+        g_port->GetMTU().value_or(dpdk::PmdRing::kDefaultFrameSize);
+    CHECK(channel_mgr_.AddChannel(kName, kRingSize, kRingSize, kBuffersNr,
+                                  mtu - sizeof(Ipv4) - sizeof(Udp) -
+                                      sizeof(MachnetPktHdr)));
+    channel_ = channel_mgr_.GetChannel(kName);
+    pkt_pool_ = std::make_unique<dpdk::PacketPool>(
+        kMbufsNr, dpdk::PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
+                      RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+  }
+  ~Fixture() {
+    pkt_pool_.reset();
+    channel_.reset();
+    channel_mgr_.DestroyChannel(kName);
+  }
+
+  shm::Channel *channel() const { return channel_.get(); }
+  dpdk::PacketPool *pkt_pool() const { return pkt_pool_.get(); }
+
+  // A message of `buffers_nr' buffers of `kPayloadSize' bytes each.
+  shm::MsgBuf *CreateMsg(uint32_t buffers_nr) {
+    shm::MsgBuf *head = nullptr;
+    shm::MsgBuf *tail = nullptr;
+    for (uint32_t i = 0; i < buffers_nr; i++) {
+      auto *msgbuf = CHECK_NOTNULL(channel_->MsgBufAlloc());
+      CHECK_NOTNULL(msgbuf->append(kPayloadSize));
+      if (head == nullptr) {
+        head = msgbuf;
+      } else {
+        tail->set_next(msgbuf);
+      }
+      tail = msgbuf;
+    }
+    head->set_msg_length(buffers_nr * kPayloadSize);
+    head->set_last(tail->index());
+    head->mark_first();
+    tail->mark_last();
+    return head;
+  }
+
+  // A data packet that carries a single-packet message; its seqno is set by
+  // the caller.
+  dpdk::Packet *CreatePacket() {
+    auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+    auto *eh =
+        CHECK_NOTNULL(packet->append<Ethernet *>(kNetHdrLen + kPayloadSize));
+    // Only the Machnet header matters to `RXTracking'.
+    auto *machneth = reinterpret_cast<MachnetPktHdr *>(
+        reinterpret_cast<uint8_t *>(eh) + kNetHdrLen - sizeof(MachnetPktHdr));
+    machneth->magic = be16_t(MachnetPktHdr::kMagic);
+    machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
+    machneth->msg_flags = MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+    return packet;
+  }
+
+  static void SetSeqno(dpdk::Packet *packet, uint32_t seqno) {
+    packet
+        ->head_data<MachnetPktHdr *>(kNetHdrLen - sizeof(MachnetPktHdr))
+        ->seqno = be32_t(seqno);
+  }
+
+  // Frees the messages delivered to the application.
+  void DrainDelivered() {
+    MachnetRingSlot_t indices[shm::MsgBufBatch::kMaxBurst];
+    uint32_t n;
+    while ((n = __machnet_channel_machnet_ring_dequeue(
+                channel_->ctx(), shm::MsgBufBatch::kMaxBurst, indices)) != 0) {
+      CHECK(channel_->MsgBufBulkFree(indices, n));
+    }
+  }
+
+ private:
+  static constexpr char kName[] = "flow_bench";
+  shm::ChannelManager<shm::Channel> channel_mgr_;
+  std::shared_ptr<shm::Channel> channel_;
+  std::unique_ptr<dpdk::PacketPool> pkt_pool_;
+};
+
+/**
+ * @brief A window of messages of `range(1)' buffers each, `range(0)' buffers
+ * in all, is queued with `Append', sent, and acknowledged at once with
+ * `ReceiveAcks'. Allocating the buffers of the messages is included.
+ */
+static void BM_TXTrackingAppendAck(benchmark::State &st) {  // NOLINT
+  const auto window = static_cast<uint32_t>(st.range(0));
+  const auto buffers_per_msg = static_cast<uint32_t>(st.range(1));
+  Fixture fixture;
+  TXTracking tx_tracking(fixture.channel());
+  uint32_t seqno = 0;
+
+  for (auto _ : st) {
+    for (uint32_t i = 0; i < window; i += buffers_per_msg) {
+      CHECK(tx_tracking.Append(fixture.CreateMsg(buffers_per_msg)));
+    }
+    const auto now = time::rdtsc();
+    for (auto msgbuf = tx_tracking.GetAndUpdateOldestUnsent();
+         msgbuf.has_value(); msgbuf = tx_tracking.GetAndUpdateOldestUnsent()) {
+      tx_tracking.OnTransmit(seqno++, msgbuf.value(), now);
+    }
+    tx_tracking.ReceiveAcks(window);
+    tx_tracking.scoreboard()->OnAck(seqno);
+  }
+  st.SetItemsProcessed(st.iterations() * window);
+}
+
+BENCHMARK(BM_TXTrackingAppendAck)
+    ->ArgNames({"window", "buffers_per_msg"})
+    ->ArgsProduct({{32, 256}, {1, 8}});
+
+// Orders in which a window of packets arrives.
+enum class Order : int64_t {
+  kInOrder,
+  kPairsSwapped,  // 1, 0, 3, 2, ...
+  kReversed,      // The first packet arrives last.
+  kShuffled,      // Random, within the window.
+};
+
+static std::vector<uint32_t> ArrivalOrder(Order order, uint32_t window) {
+  std::vector<uint32_t> indices(window);
+  std::iota(indices.begin(), indices.end(), 0);
+  switch (order) {
+    case Order::kInOrder:
+      break;
+    case Order::kPairsSwapped:
+      for (uint32_t i = 0; i + 1 < window; i += 2) {
+        std::swap(indices[i], indices[i + 1]);
+      }
+      break;
+    case Order::kReversed:
+      std::reverse(indices.begin(), indices.end());
+      break;
+    case Order::kShuffled:
+      std::shuffle(indices.begin(), indices.end(), std::mt19937(42));
+      break;
+  }
+  return indices;
+}
+
+/**
+ * @brief A window of `range(0)' single-packet messages is consumed in the
+ * order `range(1)' (see `Order'); the messages it delivers are freed.
+ */
+static void BM_RXTrackingConsume(benchmark::State &st) {  // NOLINT
+  const auto window = static_cast<uint32_t>(st.range(0));
+  const auto order = ArrivalOrder(static_cast<Order>(st.range(1)), window);
+  Fixture fixture;
+  Ipv4::Address local_addr, remote_addr;
+  CHECK(local_addr.FromString("10.0.0.1"));
+  CHECK(remote_addr.FromString("10.0.0.2"));
+  RXTracking rx_tracking(local_addr.address.value(), 1234,
+                         remote_addr.address.value(), 888, fixture.channel());
+  swift::Pcb pcb;
+  std::vector<dpdk::Packet *> packets(window);
+  for (auto &packet : packets) packet = fixture.CreatePacket();
+
+  for (auto _ : st) {
+    const auto base = pcb.rcv_nxt;
+    for (const auto i : order) {
+      Fixture::SetSeqno(packets[i], base + i);
+      CHECK_EQ(rx_tracking.Consume(&pcb, packets[i]), 0);
+    }
+    fixture.DrainDelivered();
+  }
+  CHECK_EQ(pcb.rcv_nxt, static_cast<uint32_t>(st.iterations() * window));
+  st.SetItemsProcessed(st.iterations() * window);
+  for (auto *packet : packets) dpdk::Packet::Free(packet);
+}
+
+BENCHMARK(BM_RXTrackingConsume)
+    ->ArgNames({"window", "order"})
+    ->ArgsProduct({{16, 64, 256},
+                   {static_cast<int64_t>(Order::kInOrder),
+                    static_cast<int64_t>(Order::kPairsSwapped),
+                    static_cast<int64_t>(Order::kReversed),
+                    static_cast<int64_t>(Order::kShuffled)}});
+
+/**
+ * @brief A window of single-buffer messages is sent; a first ACK SACKs all of
+ * them but `range(0)' packets spread over the window, which are deemed lost
+ * and retransmitted; a second ACK acknowledges the whole window.
+ *
+ * The flow uses a fixed window, so that every iteration sends the same
+ * packets, and its RTT is set to a nanosecond, so that packets SACKed around
+ * a hole make it a loss at once.
+ */
+static void BM_FlowSackRecovery(benchmark::State &st) {  // NOLINT
+  const auto lost_nr = static_cast<uint32_t>(st.range(0));
+  Fixture fixture;
+  dpdk::TxBatch txbatch(g_port->GetRing<dpdk::TxRing>(0));
+  Ipv4::Address local_addr, remote_addr;
+  CHECK(local_addr.FromString("10.0.0.1"));
+  CHECK(remote_addr.FromString("10.0.0.2"));
+  auto flow = std::make_unique<Flow>(
+      local_addr, Udp::Port(1234), remote_addr, Udp::Port(888),
+      g_port->GetL2Addr(), g_port->GetL2Addr(), &txbatch,
+      [](shm::Channel *, bool, const Key &) {}, swift::Algorithm::kFixedWindow,
+      fixture.channel());
+  flow->state_ = Flow::State::kEstablished;
+  flow->pcb_.latest_rtt_ns = flow->pcb_.min_rtt_ns = flow->pcb_.srtt_ns = 1;
+  const uint32_t window = flow->cc().GetWindow();
+  CHECK_LT(lost_nr, window);
+
+  // The SACK bitmap of the first ACK: every `stride'-th packet is missing,
+  // the last one excepted.
+  Scoreboard::SackBitmap sack_bitmap = {};
+  const auto stride = window / lost_nr;
+  for (uint32_t i = 0; i < window; i++) {
+    if (i % stride != 0 || i / stride >= lost_nr) {
+      sack_bitmap[i / 64] |= uint64_t{1} << (i % 64);
+    }
+  }
+  MachnetPktHdr sack = {};
+  sack.magic = be16_t(MachnetPktHdr::kMagic);
+  sack.net_flags = MachnetPktHdr::MachnetFlags::kAck;
+  sack.rcv_wnd = be16_t(flow->pcb_.sack_window());
+  MachnetPktHdr ack = sack;
+  for (size_t i = 0; i < sack_bitmap.size(); i++) {
+    sack.sack_bitmap[i] = be64_t(sack_bitmap[i]);
+  }
+
+  const auto start_rexmits = flow->pcb_.fast_rexmits;
+  for (auto _ : st) {
+    for (uint32_t i = 0; i < window; i++) {
+      flow->OutputMessage(fixture.CreateMsg(1));
+    }
+    const auto snd_una = flow->pcb_.snd_una;
+    sack.ackno = be32_t(snd_una);
+    ack.ackno = be32_t(snd_una + window);
+    flow->process_ack(&sack, Ipv4::kDefaultTTL, time::rdtsc(), time::rdtsc());
+    flow->process_ack(&ack, Ipv4::kDefaultTTL, time::rdtsc(), time::rdtsc());
+    txbatch.Flush();
+  }
+  // One recovery episode per iteration (the counter wraps around).
+  CHECK_EQ(static_cast<uint16_t>(flow->pcb_.fast_rexmits - start_rexmits),
+           static_cast<uint16_t>(st.iterations()));
+  CHECK_EQ(fixture.channel()->GetFreeBufCount(),
+           fixture.channel()->GetTotalBufCount());
+  st.SetItemsProcessed(st.iterations() * window);
+  flow.reset();
+}
+
+BENCHMARK(BM_FlowSackRecovery)->ArgName("lost")->Arg(1)->Arg(4)->Arg(16);
+
+/**
+ * @brief `rcv_nxt' moves forward by `range(0)' packets at a time.
+ */
+static void BM_PcbSackBitmapShiftRight(benchmark::State &st) {  // NOLINT
+  const auto n = static_cast<size_t>(st.range(0));
+  swift::Pcb pcb;
+  for (auto _ : st) {
+    pcb.sack_bitmap_count = n;
+    pcb.sack_last = n;
+    pcb.sack_bitmap_shift_right(n);
+    benchmark::DoNotOptimize(pcb.sack_head);
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+
+BENCHMARK(BM_PcbSackBitmapShiftRight)
+    ->ArgName("n")
+    ->Arg(1)
+    ->Arg(7)
+    ->Arg(64)
+    ->Arg(200);
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  const auto perf_options = juggler::perf::Options::Parse(&argc, argv);
+  benchmark::Initialize(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--vdev=net_null0,copy=1", "--no-pci"});
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+  juggler::net::flow::g_port =
+      std::make_shared<juggler::dpdk::PmdPort>(0, 1, 1, 1024, 1024);
+  juggler::net::flow::g_port->InitDriver();
+
+  const int status =
+      juggler::perf::RunSpecifiedBenchmarks("flow_bench", perf_options);
+  benchmark::Shutdown();
+  juggler::net::flow::g_port.reset();
+  return status;
+}
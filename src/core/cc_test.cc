@@ -0,0 +1,329 @@
+/**
+ * @file cc_test.cc
+ *
+ * Unit tests for the congestion control policies.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "cc.h"
+
+namespace juggler {
+namespace net {
+namespace swift {
+
+class SwiftTest : public ::testing::Test {
+ protected:
+  static constexpr uint64_t kRttNs = 20'000;
+
+  static AckSample Sample(uint64_t now_ns, uint64_t fabric_ns,
+                          uint64_t endpoint_ns = 0) {
+    return {.now_ns = now_ns,
+            .acked_nr = 1,
+            .ce_nr = 0,
+            .has_delay = true,
+            .rtt_ns = kRttNs,
+            .fabric_ns = fabric_ns,
+            .endpoint_ns = endpoint_ns,
+            .hops = 0};
+  }
+
+  // Feeds `acks_nr' ACKs of one packet each, one RTT apart, with the given
+  // fabric and endpoint delays.
+  void Ack(size_t acks_nr, uint64_t fabric_ns, uint64_t endpoint_ns = 0) {
+    for (size_t i = 0; i < acks_nr; i++) {
+      now_ns_ += kRttNs;
+      swift_.OnAck(Sample(now_ns_, fabric_ns, endpoint_ns));
+    }
+  }
+
+  Swift swift_;
+  uint64_t now_ns_{1'000'000};
+};
+
+TEST_F(SwiftTest, AdditiveIncrease) {
+  const auto &params = swift_.GetParams();
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), params.initial_cwnd);
+
+  // One window's worth of ACKs below target grows the window by `ai'.
+  Ack(static_cast<size_t>(params.initial_cwnd), 0);
+  EXPECT_NEAR(swift_.GetCwnd(), params.initial_cwnd + params.ai, 0.05);
+
+  // Never beyond the maximum.
+  Ack(100000, 0);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), params.max_cwnd);
+  EXPECT_EQ(swift_.GetWindow(), static_cast<uint32_t>(params.max_cwnd));
+}
+
+TEST_F(SwiftTest, MaxWindow) {
+  // A negotiated window lets the window grow beyond the default cap.
+  swift_.SetMaxWindow(1024);
+  Ack(1'000'000, 0);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), 1024);
+  swift_.SetMaxWindow(100);
+  EXPECT_EQ(swift_.GetWindow(), 100);
+
+  CongestionController fixed(Algorithm::kFixedWindow);
+  fixed.SetMaxWindow(8);
+  EXPECT_EQ(fixed.GetWindow(), 8);
+}
+
+TEST_F(SwiftTest, MultiplicativeDecrease) {
+  const auto &params = swift_.GetParams();
+  const auto target_ns = swift_.GetFabricTargetNs(0);
+
+  // Twice the target: decrease by `beta' times the excess (half the delay).
+  Ack(1, 2 * target_ns);
+  const auto expected = params.initial_cwnd * (1 - params.beta * 0.5);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), expected);
+
+  // Far above target: decrease by at most `max_mdf'.
+  Ack(1, 1000 * target_ns);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), expected * (1 - params.max_mdf));
+}
+
+TEST_F(SwiftTest, EndpointDelay) {
+  const auto &params = swift_.GetParams();
+  Ack(1, 0, 2 * params.endpoint_target_ns);
+  EXPECT_LT(swift_.GetCwnd(), params.initial_cwnd);
+}
+
+TEST_F(SwiftTest, DecreaseOncePerRtt) {
+  const auto target_ns = swift_.GetFabricTargetNs(0);
+  Ack(1, 2 * target_ns);
+  const auto cwnd = swift_.GetCwnd();
+
+  // Within the same RTT: no further decrease.
+  swift_.OnAck(Sample(now_ns_ + kRttNs / 2, 2 * target_ns));
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), cwnd);
+  swift_.OnFastRetransmit(now_ns_ + kRttNs / 2);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), cwnd);
+
+  swift_.OnFastRetransmit(now_ns_ + kRttNs);
+  EXPECT_LT(swift_.GetCwnd(), cwnd);
+}
+
+TEST_F(SwiftTest, TargetDelay) {
+  const auto &params = swift_.GetParams();
+  // One hop allowance per hop.
+  EXPECT_EQ(swift_.GetFabricTargetNs(3) - swift_.GetFabricTargetNs(0),
+            3 * params.hop_scale_ns);
+
+  // Flow scaling: the smaller the window, the larger the target, up to
+  // `fs_range_ns' above the base.
+  const auto large_window_target_ns = swift_.GetFabricTargetNs(0);
+  while (swift_.GetCwnd() > params.fs_min_cwnd) Ack(1, 1000'000'000);
+  const auto small_window_target_ns = swift_.GetFabricTargetNs(0);
+  EXPECT_GT(small_window_target_ns, large_window_target_ns);
+  EXPECT_LE(small_window_target_ns,
+            params.fabric_base_target_ns + params.fs_range_ns);
+}
+
+TEST_F(SwiftTest, FractionalWindow) {
+  EXPECT_EQ(swift_.GetPacingDelayNs(), 0);
+  while (swift_.GetCwnd() >= 0.5) Ack(1, 1000'000'000);
+
+  // Below one packet: one packet in flight, sent every RTT / cwnd.
+  EXPECT_EQ(swift_.GetWindow(), 1);
+  const auto expected_ns = swift_.GetSmoothedRttNs() / swift_.GetCwnd();
+  EXPECT_NEAR(swift_.GetPacingDelayNs(), expected_ns, 1);
+  EXPECT_GT(swift_.GetPacingDelayNs(), 2 * kRttNs);
+
+  // Additive increase is by `ai' per ACK while below one packet.
+  const auto cwnd = swift_.GetCwnd();
+  Ack(1, 0);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), cwnd + swift_.GetParams().ai);
+}
+
+TEST_F(SwiftTest, PacingInterval) {
+  EXPECT_EQ(swift_.GetPacingIntervalNs(), 0);
+  Ack(1, 0);
+  // One window per RTT, but no minimum gap while the window is not small.
+  EXPECT_NEAR(swift_.GetPacingIntervalNs(),
+              swift_.GetSmoothedRttNs() / swift_.GetCwnd(), 1);
+  EXPECT_EQ(swift_.GetPacingDelayNs(), 0);
+}
+
+TEST_F(SwiftTest, RetransmitTimeouts) {
+  const auto &params = swift_.GetParams();
+  swift_.OnRetransmitTimeout(now_ns_);
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(),
+                   params.initial_cwnd * (1 - params.max_mdf));
+
+  for (uint32_t i = 1; i < params.retx_reset_threshold; i++) {
+    now_ns_ += kRttNs;
+    swift_.OnRetransmitTimeout(now_ns_);
+  }
+  EXPECT_DOUBLE_EQ(swift_.GetCwnd(), params.min_cwnd);
+
+  // An ACK resets the count of consecutive timeouts.
+  Ack(1, 0);
+  now_ns_ += kRttNs;
+  swift_.OnRetransmitTimeout(now_ns_);
+  EXPECT_GT(swift_.GetCwnd(), params.min_cwnd);
+}
+
+TEST_F(SwiftTest, AckWithoutDelay) {
+  auto sample = Sample(now_ns_, 1000'000'000);
+  sample.has_delay = false;
+  swift_.OnAck(sample);
+  EXPECT_GT(swift_.GetCwnd(), swift_.GetParams().initial_cwnd);
+  EXPECT_EQ(swift_.GetSmoothedRttNs(), 0);
+}
+
+class EcnTest : public ::testing::Test {
+ protected:
+  // Acknowledges `windows_nr' windows of data, one packet per ACK, with the
+  // given fraction of them CE-marked.
+  void Ack(size_t windows_nr, double ce_fraction) {
+    for (size_t w = 0; w < windows_nr; w++) {
+      const auto packets_nr = ecn_.GetWindow();
+      const auto marked_nr = static_cast<uint32_t>(packets_nr * ce_fraction);
+      for (uint32_t i = 0; i < packets_nr; i++) {
+        ecn_.OnAck({.now_ns = 0,
+                    .acked_nr = 1,
+                    .ce_nr = i < marked_nr ? 1u : 0u,
+                    .has_delay = false});
+      }
+    }
+  }
+
+  Ecn ecn_;
+};
+
+TEST_F(EcnTest, NoMarks) {
+  const auto &params = ecn_.GetParams();
+  Ack(1, 0);
+  EXPECT_NEAR(ecn_.GetCwnd(), params.initial_cwnd + params.ai, 0.05);
+  EXPECT_DOUBLE_EQ(ecn_.GetAlpha(), 0);
+}
+
+TEST_F(EcnTest, Marks) {
+  const auto &params = ecn_.GetParams();
+  // All packets marked: `alpha' converges to 1, the window to the minimum.
+  Ack(1, 1);
+  EXPECT_DOUBLE_EQ(ecn_.GetAlpha(), params.g);
+  EXPECT_LT(ecn_.GetCwnd(), params.initial_cwnd);
+  Ack(200, 1);
+  EXPECT_GT(ecn_.GetAlpha(), 0.9);
+  EXPECT_DOUBLE_EQ(ecn_.GetCwnd(), params.min_cwnd);
+  EXPECT_EQ(ecn_.GetWindow(), 1);
+}
+
+TEST_F(EcnTest, Losses) {
+  const auto &params = ecn_.GetParams();
+  ecn_.OnFastRetransmit(0);
+  EXPECT_DOUBLE_EQ(ecn_.GetCwnd(), params.initial_cwnd / 2);
+  // At most once per window.
+  ecn_.OnFastRetransmit(0);
+  EXPECT_DOUBLE_EQ(ecn_.GetCwnd(), params.initial_cwnd / 2);
+
+  ecn_.OnRetransmitTimeout(0);
+  EXPECT_DOUBLE_EQ(ecn_.GetCwnd(), params.min_cwnd);
+}
+
+TEST(CongestionControllerTest, Algorithms) {
+  const AckSample sample = {.now_ns = 0, .acked_nr = 100, .has_delay = false};
+  for (const auto algorithm :
+       {Algorithm::kSwift, Algorithm::kEcn, Algorithm::kFixedWindow}) {
+    CongestionController cc(algorithm);
+    EXPECT_EQ(cc.GetAlgorithm(), algorithm);
+    EXPECT_EQ(cc.UsesEcn(), algorithm == Algorithm::kEcn);
+    cc.OnAck(sample);
+    if (algorithm == Algorithm::kFixedWindow) {
+      EXPECT_EQ(cc.GetWindow(), FixedWindow::kDefaultWindow);
+    } else {
+      EXPECT_GT(cc.GetWindow(), FixedWindow::kDefaultWindow);
+    }
+  }
+  for (const char *name : {"swift", "ecn", "fixed"}) {
+    const auto algorithm = AlgorithmFromString(name);
+    ASSERT_TRUE(algorithm.has_value());
+    EXPECT_STREQ(AlgorithmToString(algorithm.value()), name);
+  }
+  EXPECT_FALSE(AlgorithmFromString("cubic").has_value());
+  EXPECT_NE(CongestionController(Algorithm::kSwift).Get<Swift>(), nullptr);
+  EXPECT_EQ(CongestionController(Algorithm::kSwift).Get<Ecn>(), nullptr);
+}
+
+TEST(PcbTest, SackBitmap) {
+  Pcb pcb;
+  for (size_t index : {1, 2, 63, 64, 65, 130, 255}) {
+    pcb.sack_bitmap_bit_set(index);
+  }
+  EXPECT_EQ(pcb.sack_bitmap_count, 7);
+  EXPECT_TRUE(pcb.sack_bitmap_bit_test(64));
+  EXPECT_FALSE(pcb.sack_bitmap_bit_test(66));
+  EXPECT_EQ(pcb.sack_bitmap_leading_nr(), 0);
+
+  // Packet 0 arrives: packets 0-2 are in order.
+  pcb.sack_bitmap_bit_set(0);
+  ASSERT_EQ(pcb.sack_bitmap_leading_nr(), 3);
+  pcb.sack_bitmap_shift_right(3);
+  EXPECT_EQ(pcb.sack_bitmap_count, 5);
+  for (size_t index : {60, 61, 62, 127, 252}) {
+    EXPECT_TRUE(pcb.sack_bitmap_bit_test(index)) << index;
+  }
+
+  // Fill the hole up to 127, across words.
+  for (size_t index = 0; index < 127; index++) {
+    if (!pcb.sack_bitmap_bit_test(index)) pcb.sack_bitmap_bit_set(index);
+  }
+  ASSERT_EQ(pcb.sack_bitmap_leading_nr(), 128);
+  pcb.sack_bitmap_shift_right(128);
+  EXPECT_EQ(pcb.sack_bitmap_count, 1);
+  EXPECT_TRUE(pcb.sack_bitmap_bit_test(124));
+}
+
+TEST(PcbTest, ExtendedWindow) {
+  Pcb pcb;
+  pcb.sack_bitmap_resize(1024);
+  EXPECT_EQ(pcb.sack_window(), 1024);
+  pcb.sack_bitmap_bit_set(100);
+  EXPECT_EQ(pcb.sack_offset(), 0);
+  // Beyond the first slice: the slice ends with the word of the packet.
+  pcb.sack_bitmap_bit_set(700);
+  EXPECT_EQ(pcb.sack_offset(), 448);
+  EXPECT_EQ(pcb.sack_bitmap_word(640), uint64_t{1} << 60);
+
+  // Deliver 1000 packets, so that the ring wraps around.
+  for (size_t index = 0; index < 1000; index++) {
+    if (!pcb.sack_bitmap_bit_test(index)) pcb.sack_bitmap_bit_set(index);
+  }
+  pcb.sack_bitmap_bit_set(1010);
+  ASSERT_EQ(pcb.sack_bitmap_leading_nr(), 1000);
+  pcb.sack_bitmap_shift_right(1000);
+  EXPECT_EQ(pcb.sack_bitmap_count, 1);
+  EXPECT_EQ(pcb.sack_bitmap_word(0), uint64_t{1} << 10);
+  pcb.sack_bitmap_bit_set(1000);
+  EXPECT_EQ(pcb.sack_offset(), 768);
+  EXPECT_EQ(pcb.sack_bitmap_word(960), uint64_t{1} << 40);
+  EXPECT_EQ(pcb.sack_bitmap_leading_nr(), 0);
+}
+
+TEST(PcbTest, ReceiveWindow) {
+  Pcb pcb;
+  pcb.snd_una = UINT32_MAX - 5;
+  pcb.snd_nxt = pcb.snd_una + 20;
+  pcb.snd_wnd = 32;
+  EXPECT_EQ(pcb.congestion_wnd(64, 4), 48);
+  EXPECT_EQ(pcb.receive_wnd(), 12);
+  EXPECT_EQ(pcb.effective_wnd(64, 4), 12);
+  EXPECT_EQ(pcb.effective_wnd(24, 4), 8);
+
+  // SACKed packets still take room at the receiver.
+  pcb.snd_wnd = 16;
+  EXPECT_EQ(pcb.receive_wnd(), 0);
+  EXPECT_EQ(pcb.effective_wnd(64, 10), 0);
+  EXPECT_EQ(pcb.congestion_wnd(64, 10), 54);
+}
+
+}  // namespace swift
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,81 @@
+/**
+ * @file checkpoint_test.cc
+ *
+ * Unit tests for the checkpoints of hot restarts.
+ */
+#include <checkpoint.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+
+struct Record {
+  uint32_t a;
+  uint16_t b;
+  uint64_t c;
+};
+
+TEST(CheckpointTest, RoundTrip) {
+  CheckpointWriter writer;
+  writer.Put<uint32_t>(42);
+  writer.Put(Record{1, 2, 3});
+  writer.Put(std::vector<uint16_t>{4, 5, 6});
+  writer.Put(std::string("channel"));
+  writer.Put(std::vector<Record>{});
+  const int fd = writer.ToFd();
+  ASSERT_GE(fd, 0);
+
+  CheckpointReader reader(fd);
+  close(fd);
+  uint32_t value;
+  ASSERT_TRUE(reader.Get(&value));
+  EXPECT_EQ(value, 42);
+  Record record;
+  ASSERT_TRUE(reader.Get(&record));
+  EXPECT_EQ(record.a, 1);
+  EXPECT_EQ(record.b, 2);
+  EXPECT_EQ(record.c, 3);
+  std::vector<uint16_t> values;
+  ASSERT_TRUE(reader.Get(&values));
+  EXPECT_EQ(values, std::vector<uint16_t>({4, 5, 6}));
+  std::string name;
+  ASSERT_TRUE(reader.Get(&name));
+  EXPECT_EQ(name, "channel");
+  std::vector<Record> records{{7, 8, 9}};
+  ASSERT_TRUE(reader.Get(&records));
+  EXPECT_TRUE(records.empty());
+  EXPECT_TRUE(reader.AtEnd());
+}
+
+TEST(CheckpointTest, Truncated) {
+  CheckpointWriter writer;
+  writer.Put<uint64_t>(1000);  // Read back as the size of a vector.
+  writer.Put<uint32_t>(1);
+  const int fd = writer.ToFd();
+  ASSERT_GE(fd, 0);
+
+  CheckpointReader reader(fd);
+  close(fd);
+  std::vector<uint32_t> values;
+  EXPECT_FALSE(reader.Get(&values));
+  EXPECT_FALSE(reader.ok());
+  // Every read fails from then on.
+  uint32_t value;
+  EXPECT_FALSE(reader.Get(&value));
+  EXPECT_FALSE(reader.AtEnd());
+}
+
+}  // namespace utils
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,102 @@
+/**
+ * @file checksum_bench.cc
+ * @brief Benchmark of the Internet checksum kernels of checksum.h against the
+ * scalar loop that `utils::ComputeChecksum16' used to run, over buffers from
+ * an IPv4 header to a jumbo frame.
+ */
+#include <benchmark/benchmark.h>
+#include <checksum.h>
+#include <glog/logging.h>
+#include <perf_benchmark.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using juggler::utils::ChecksumFold;
+using juggler::utils::ChecksumKernel;
+
+// The previous `ComputeChecksum16': one 16-bit word per iteration.
+static uint64_t ChecksumSumLegacy(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  const auto *ptr = reinterpret_cast<const uint16_t *>(data);
+  for (; length > 1; length -= 2) sum += *ptr++;
+  if (length == 1) sum += *reinterpret_cast<const uint8_t *>(ptr);
+  return sum;
+}
+
+static void RunKernel(benchmark::State &st, ChecksumKernel kernel) {
+  const auto length = static_cast<size_t>(st.range(0));
+  // One byte of slack, to checksum from an odd address as well.
+  std::vector<uint8_t> buf(length + 1);
+  std::mt19937 rng(42);
+  for (auto &byte : buf) byte = rng();
+  const uint8_t *data = buf.data() + st.range(1);
+
+  for (auto _ : st) {
+    benchmark::DoNotOptimize(data);
+    benchmark::DoNotOptimize(ChecksumFold(kernel(data, length)));
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(st.iterations() * length);
+}
+
+static void BM_ChecksumLegacy(benchmark::State &st) {  // NOLINT
+  RunKernel(st, ChecksumSumLegacy);
+}
+
+static void BM_ChecksumScalar(benchmark::State &st) {  // NOLINT
+  RunKernel(st, juggler::utils::ChecksumSumScalar);
+}
+
+// The kernel `RawChecksum' runs on this CPU, short buffers included.
+static void BM_ChecksumDispatch(benchmark::State &st) {  // NOLINT
+  RunKernel(st, [](const uint8_t *data, size_t length) -> uint64_t {
+    return juggler::utils::RawChecksum(data, length);
+  });
+}
+
+#if defined(__x86_64__)
+static void BM_ChecksumAvx2(benchmark::State &st) {  // NOLINT
+  if (!__builtin_cpu_supports("avx2")) {
+    st.SkipWithError("AVX2 not supported");
+    return;
+  }
+  RunKernel(st, juggler::utils::ChecksumSumAvx2);
+}
+
+static void BM_ChecksumAvx512(benchmark::State &st) {  // NOLINT
+  if (!__builtin_cpu_supports("avx512f")) {
+    st.SkipWithError("AVX-512 not supported");
+    return;
+  }
+  RunKernel(st, juggler::utils::ChecksumSumAvx512);
+}
+#elif defined(__aarch64__)
+static void BM_ChecksumNeon(benchmark::State &st) {  // NOLINT
+  RunKernel(st, juggler::utils::ChecksumSumNeon);
+}
+#endif
+
+// Buffer length, and misalignment of its start.
+static void Lengths(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"len", "offset"});
+  for (const int64_t len : {20, 64, 128, 512, 1500, 4096, 9000}) {
+    b->Args({len, 0});
+  }
+  b->Args({1500, 1});
+}
+
+BENCHMARK(BM_ChecksumLegacy)->Apply(Lengths);
+BENCHMARK(BM_ChecksumScalar)->Apply(Lengths);
+BENCHMARK(BM_ChecksumDispatch)->Apply(Lengths);
+#if defined(__x86_64__)
+BENCHMARK(BM_ChecksumAvx2)->Apply(Lengths);
+BENCHMARK(BM_ChecksumAvx512)->Apply(Lengths);
+#elif defined(__aarch64__)
+BENCHMARK(BM_ChecksumNeon)->Apply(Lengths);
+#endif
+
+int main(int argc, char **argv) {
+  return juggler::perf::BenchmarkMain("checksum_bench", argc, argv);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file checksum_test.cc
+ *
+ * Unit tests for the Internet checksum kernels and incremental updates.
+ */
+#include <checksum.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+
+// RFC 1071, section 4.1: big-endian 16-bit words, odd byte padded with zero.
+static uint16_t ReferenceChecksum(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  if (length & 1) sum += data[length - 1] << 8;
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  return sum;
+}
+
+// Converts a sum in memory order to the value of its big-endian bytes.
+static uint16_t ToValue(uint16_t raw) {
+  const auto *bytes = reinterpret_cast<const uint8_t *>(&raw);
+  return (bytes[0] << 8) | bytes[1];
+}
+
+static std::vector<uint8_t> RandomBytes(size_t length, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> buf(length);
+  for (auto &byte : buf) byte = rng();
+  return buf;
+}
+
+TEST(ChecksumTest, KernelsMatchReference) {
+  std::vector<ChecksumKernel> kernels = {ChecksumSumScalar,
+                                         SelectChecksumKernel()};
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) kernels.push_back(ChecksumSumAvx2);
+  if (__builtin_cpu_supports("avx512f")) kernels.push_back(ChecksumSumAvx512);
+#endif
+
+  const auto buf = RandomBytes(9100, 42);
+  for (const size_t offset : {0, 1, 2, 3}) {
+    for (size_t length = 0; length < 300; length++) {
+      const uint16_t expected = ReferenceChecksum(&buf[offset], length);
+      for (const auto kernel : kernels) {
+        EXPECT_EQ(ToValue(ChecksumFold(kernel(&buf[offset], length))),
+                  expected)
+            << "offset " << offset << " length " << length;
+      }
+      EXPECT_EQ(ToValue(RawChecksum(&buf[offset], length)), expected);
+    }
+    for (const size_t length : {1500, 4095, 9000}) {
+      const uint16_t expected = ReferenceChecksum(&buf[offset], length);
+      for (const auto kernel : kernels) {
+        EXPECT_EQ(ToValue(ChecksumFold(kernel(&buf[offset], length))),
+                  expected);
+      }
+    }
+  }
+}
+
+TEST(ChecksumTest, AllOnes) {
+  // Sums that carry a lot: the 64-bit accumulators must not lose any.
+  const std::vector<uint8_t> buf(1 << 16, 0xFF);
+  EXPECT_EQ(RawChecksum(buf.data(), buf.size()), 0xFFFF);
+}
+
+TEST(ChecksumTest, InitialAndSplit) {
+  const auto buf = RandomBytes(1000, 7);
+  const uint16_t whole = RawChecksum(buf.data(), buf.size());
+  // Parts of even length chain through `initial'.
+  const uint16_t head = RawChecksum(buf.data(), 400);
+  EXPECT_EQ(RawChecksum(&buf[400], 600, head), whole);
+  EXPECT_EQ(ChecksumAdd(head, RawChecksum(&buf[400], 600)), whole);
+}
+
+TEST(ChecksumTest, IncrementalUpdate) {
+  auto buf = RandomBytes(64, 3);
+  // Checksum stored in the buffer, as in a header: the buffer sums to ~0.
+  buf[10] = buf[11] = 0;
+  const uint16_t cksum = ~RawChecksum(buf.data(), buf.size());
+  std::memcpy(&buf[10], &cksum, sizeof(cksum));
+  ASSERT_EQ(RawChecksum(buf.data(), buf.size()), 0xFFFF);
+
+  std::mt19937 rng(5);
+  for (int i = 0; i < 1000; i++) {
+    uint16_t stored;
+    std::memcpy(&stored, &buf[10], sizeof(stored));
+    if (i % 2) {
+      uint16_t old_word, new_word = rng();
+      std::memcpy(&old_word, &buf[20], sizeof(old_word));
+      std::memcpy(&buf[20], &new_word, sizeof(new_word));
+      stored = ChecksumUpdate16(stored, old_word, new_word);
+    } else {
+      // E.g., rewriting an IPv4 address.
+      uint32_t old_word, new_word = i == 0 ? 0 : rng();
+      std::memcpy(&old_word, &buf[12], sizeof(old_word));
+      std::memcpy(&buf[12], &new_word, sizeof(new_word));
+      stored = ChecksumUpdate32(stored, old_word, new_word);
+    }
+    std::memcpy(&buf[10], &stored, sizeof(stored));
+    ASSERT_EQ(RawChecksum(buf.data(), buf.size()), 0xFFFF) << "update " << i;
+  }
+}
+
+}  // namespace utils
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
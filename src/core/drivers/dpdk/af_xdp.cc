@@ -0,0 +1,288 @@
+#include <af_xdp.h>
+#include <glog/logging.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+// Runs an ethtool command (`struct ethtool_*') on an interface.
+static bool Ethtool(const std::string &ifname, void *cmd) {
+  const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  struct ifreq ifr = {};
+  std::strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+  ifr.ifr_data = static_cast<char *>(cmd);
+  const int ret = ioctl(fd, SIOCETHTOOL, &ifr);
+  close(fd);
+  return ret == 0;
+}
+
+// A netlink request, with room for a few attributes after its header.
+template <typename T>
+struct NetlinkRequest {
+  struct nlmsghdr nh;
+  T msg;
+  char attrs[64];
+
+  NetlinkRequest(uint16_t type, uint16_t flags) {
+    std::memset(this, 0, sizeof(*this));
+    nh.nlmsg_len = NLMSG_LENGTH(sizeof(T));
+    nh.nlmsg_type = type;
+    nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+  }
+
+  // Appends an attribute; returns it, to nest others in it.
+  struct rtattr *AddAttr(uint16_t type, const void *data, size_t len) {
+    auto *attr = reinterpret_cast<struct rtattr *>(
+        reinterpret_cast<char *>(&nh) + NLMSG_ALIGN(nh.nlmsg_len));
+    CHECK_LE(NLMSG_ALIGN(nh.nlmsg_len) + RTA_SPACE(len), sizeof(*this));
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(len);
+    if (len != 0) std::memcpy(RTA_DATA(attr), data, len);
+    nh.nlmsg_len = NLMSG_ALIGN(nh.nlmsg_len) + RTA_ALIGN(attr->rta_len);
+    return attr;
+  }
+  // Extends a nesting attribute over the attributes appended since.
+  void EndNest(struct rtattr *nest) {
+    nest->rta_len = reinterpret_cast<char *>(&nh) + nh.nlmsg_len -
+                    reinterpret_cast<char *>(nest);
+  }
+
+  // Sends the request to the kernel, and waits for its acknowledgement.
+  bool Send() {
+    const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) return false;
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    bool ok = sendto(fd, &nh, nh.nlmsg_len, 0,
+                     reinterpret_cast<struct sockaddr *>(&addr),
+                     sizeof(addr)) == static_cast<ssize_t>(nh.nlmsg_len);
+    char buf[NLMSG_SPACE(sizeof(struct nlmsgerr))];
+    if (ok) {
+      const auto nbytes = recv(fd, buf, sizeof(buf), 0);
+      const auto *ack = reinterpret_cast<const struct nlmsghdr *>(buf);
+      ok = nbytes >= static_cast<ssize_t>(NLMSG_LENGTH(sizeof(nlmsgerr))) &&
+           ack->nlmsg_type == NLMSG_ERROR &&
+           static_cast<const struct nlmsgerr *>(NLMSG_DATA(ack))->error == 0;
+    }
+    close(fd);
+    return ok;
+  }
+};
+
+// Detaches the XDP program of an interface, if any.
+static bool DetachXdpProgram(const std::string &ifname) {
+  NetlinkRequest<struct ifinfomsg> req(RTM_SETLINK, 0);
+  req.msg.ifi_family = AF_UNSPEC;
+  req.msg.ifi_index = if_nametoindex(ifname.c_str());
+  auto *xdp = req.AddAttr(IFLA_XDP | NLA_F_NESTED, nullptr, 0);
+  const int32_t fd = -1;
+  req.AddAttr(IFLA_XDP_FD, &fd, sizeof(fd));
+  req.EndNest(xdp);
+  return req.msg.ifi_index != 0 && req.Send();
+}
+
+static bool WriteSysfs(const std::string &path, uint32_t value) {
+  std::ofstream file(path);
+  file << value;
+  file.flush();
+  return file.good();
+}
+
+std::string AfXdp::GetVdevArgs(const std::string &ifname, uint16_t queues_nr,
+                               uint32_t busy_budget,
+                               const std::string &prog_path) {
+  return std::string(kDriverName) + "_" + ifname + ",iface=" + ifname +
+         ",start_queue=0,queue_count=" + std::to_string(queues_nr) +
+         ",busy_budget=" + std::to_string(busy_budget) +
+         ",xdp_prog=" + prog_path;
+}
+
+std::string AfXdp::GetDefaultProgPath() {
+  std::error_code ec;
+  const auto exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+  return (exe.parent_path() / kProgName).string();
+}
+
+bool AfXdp::PrepareInterface(const std::string &ifname, uint16_t queues_nr) {
+  LOG_IF(WARNING, !DetachXdpProgram(ifname))
+      << "Failed to detach the XDP program of " << ifname;
+
+  // Drivers that have no channels have a single queue.
+  struct ethtool_channels channels = {};
+  channels.cmd = ETHTOOL_GCHANNELS;
+  uint32_t rx_queues_nr = 1;
+  if (Ethtool(ifname, &channels)) {
+    rx_queues_nr = channels.combined_count + channels.rx_count;
+  }
+  if (rx_queues_nr < queues_nr) {
+    LOG(ERROR) << ifname << " has " << rx_queues_nr << " RX queues for "
+               << queues_nr << " engines; try `ethtool -L " << ifname
+               << " combined " << queues_nr << "'.";
+    return false;
+  }
+
+  // Packets landing on a queue without a socket would go to the kernel.
+  if (rx_queues_nr > queues_nr) {
+    struct ethtool_rxfh_indir size_cmd = {};
+    size_cmd.cmd = ETHTOOL_GRXFHINDIR;
+    Ethtool(ifname, &size_cmd);
+    std::vector<uint32_t> buf(
+        (sizeof(size_cmd) + sizeof(uint32_t) - 1) / sizeof(uint32_t) +
+        size_cmd.size);
+    auto *indir = reinterpret_cast<struct ethtool_rxfh_indir *>(buf.data());
+    indir->cmd = ETHTOOL_SRXFHINDIR;
+    indir->size = size_cmd.size;
+    for (uint32_t i = 0; i < indir->size; i++) {
+      indir->ring_index[i] = i % queues_nr;
+    }
+    if (indir->size == 0 || !Ethtool(ifname, indir)) {
+      LOG(ERROR) << "Failed to spread RSS over the first " << queues_nr
+                 << " queues of " << ifname << "; try `ethtool -L " << ifname
+                 << " combined " << queues_nr << "'.";
+      return false;
+    }
+  }
+
+  // The engines pick local ports that hash to their queue.
+  if (queues_nr > 1) {
+    constexpr uint64_t kUdpPortsHash =
+        RXH_IP_SRC | RXH_IP_DST | RXH_L4_B_0_1 | RXH_L4_B_2_3;
+    struct ethtool_rxnfc rxnfc = {};
+    rxnfc.cmd = ETHTOOL_GRXFH;
+    rxnfc.flow_type = UDP_V4_FLOW;
+    if (!Ethtool(ifname, &rxnfc) || rxnfc.data != kUdpPortsHash) {
+      rxnfc.cmd = ETHTOOL_SRXFH;
+      rxnfc.data = kUdpPortsHash;
+      if (!Ethtool(ifname, &rxnfc)) {
+        LOG(ERROR) << "Failed to hash UDP packets on their ports on "
+                   << ifname << "; try `ethtool -N " << ifname
+                   << " rx-flow-hash udp4 sdfn'.";
+        return false;
+      }
+    }
+  }
+
+  const auto sysfs = "/sys/class/net/" + ifname + "/";
+  if (!WriteSysfs(sysfs + "napi_defer_hard_irqs", kNapiDeferHardIrqs) ||
+      !WriteSysfs(sysfs + "gro_flush_timeout", kGroFlushTimeoutNs)) {
+    LOG(WARNING) << "Failed to set the NAPI settings of " << ifname
+                 << " for busy polling; polling is interrupt-driven.";
+  }
+  return true;
+}
+
+bool AfXdp::GetRssConf(const std::string &ifname, std::vector<uint8_t> *key,
+                       std::vector<uint16_t> *reta) {
+  struct ethtool_rxfh size_cmd = {};
+  size_cmd.cmd = ETHTOOL_GRSSH;
+  if (!Ethtool(ifname, &size_cmd) || size_cmd.key_size == 0 ||
+      size_cmd.indir_size == 0) {
+    return false;
+  }
+  std::vector<uint8_t> buf(sizeof(size_cmd) +
+                           size_cmd.indir_size * sizeof(uint32_t) +
+                           size_cmd.key_size);
+  auto *rxfh = reinterpret_cast<struct ethtool_rxfh *>(buf.data());
+  *rxfh = size_cmd;
+  // The kernel's `ETH_RSS_HASH_TOP', which its UAPI does not export.
+  constexpr uint8_t kHashToeplitz = 1 << 0;
+  if (!Ethtool(ifname, rxfh) || rxfh->hfunc != kHashToeplitz) return false;
+
+  reta->assign(rxfh->rss_config, rxfh->rss_config + rxfh->indir_size);
+  const auto *key_bytes =
+      reinterpret_cast<const uint8_t *>(rxfh->rss_config + rxfh->indir_size);
+  key->assign(key_bytes, key_bytes + rxfh->key_size);
+  return true;
+}
+
+AfXdp::Neighbors AfXdp::GetNeighbors(const std::string &ifname) {
+  std::ifstream arp_table("/proc/net/arp");
+  return ParseNeighbors(&arp_table, ifname);
+}
+
+AfXdp::Neighbors AfXdp::ParseNeighbors(std::istream *arp_table,
+                                       const std::string &ifname) {
+  Neighbors neighbors;
+  std::string line;
+  // Skip the header.
+  std::getline(*arp_table, line);
+  while (std::getline(*arp_table, line)) {
+    std::istringstream fields(line);
+    std::string ip_str, hw_type, flags, l2_str, mask, device;
+    if (!(fields >> ip_str >> hw_type >> flags >> l2_str >> mask >> device)) {
+      continue;
+    }
+    // Only complete entries carry an address.
+    if (device != ifname ||
+        !(std::strtoul(flags.c_str(), nullptr, 16) & ATF_COM)) {
+      continue;
+    }
+    net::Ipv4::Address ip_addr;
+    net::Ethernet::Address l2_addr;
+    if (!ip_addr.FromString(ip_str) || !l2_addr.FromString(l2_str)) continue;
+    neighbors.emplace_back(ip_addr, l2_addr);
+  }
+  return neighbors;
+}
+
+bool AfXdp::ResolveNeighbor(const std::string &ifname,
+                            const net::Ipv4::Address &ip_addr) {
+  // `NTF_USE' has the kernel act as if it were to use the entry.
+  NetlinkRequest<struct ndmsg> req(RTM_NEWNEIGH, NLM_F_CREATE);
+  req.msg.ndm_family = AF_INET;
+  req.msg.ndm_ifindex = if_nametoindex(ifname.c_str());
+  req.msg.ndm_state = NUD_NONE;
+  req.msg.ndm_flags = NTF_USE;
+  const uint32_t dst = ip_addr.address.raw_value();
+  req.AddAttr(NDA_DST, &dst, sizeof(dst));
+  return req.msg.ndm_ifindex != 0 && req.Send();
+}
+
+std::unique_ptr<XdpPortMap> XdpPortMap::Open(const std::string &path) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.pathname = reinterpret_cast<uint64_t>(path.c_str());
+  const int fd = syscall(__NR_bpf, BPF_OBJ_GET, &attr, sizeof(attr));
+  if (fd < 0) {
+    PLOG(ERROR) << "Failed to open the XDP port map " << path;
+    return nullptr;
+  }
+  return std::make_unique<XdpPortMap>(fd);
+}
+
+XdpPortMap::~XdpPortMap() { close(fd_); }
+
+bool XdpPortMap::Set(uint16_t port, bool steer) {
+  const uint32_t key = port;
+  const uint32_t value = steer;
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = fd_;
+  attr.key = reinterpret_cast<uint64_t>(&key);
+  attr.value = reinterpret_cast<uint64_t>(&value);
+  attr.flags = BPF_ANY;
+  return syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr)) == 0;
+}
+
+}  // namespace dpdk
+}  // namespace juggler
@@ -0,0 +1,59 @@
+/**
+ * @file af_xdp_test.cc
+ *
+ * Unit tests for the kernel side of AF_XDP ports.
+ */
+#include <af_xdp.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+namespace juggler {
+namespace dpdk {
+
+TEST(AfXdpTest, VdevArgs) {
+  EXPECT_EQ(AfXdp::GetVdevArgs("eth1", 4, 32, "/opt/machnet_xdp.o"),
+            "net_af_xdp_eth1,iface=eth1,start_queue=0,queue_count=4,"
+            "busy_budget=32,xdp_prog=/opt/machnet_xdp.o");
+}
+
+TEST(AfXdpTest, ParseNeighbors) {
+  std::istringstream arp_table(
+      "IP address       HW type     Flags       HW address            Mask     "
+      "Device\n"
+      "10.0.0.1         0x1         0x2         12:34:56:78:9a:bc     *        "
+      "eth1\n"
+      "10.0.0.2         0x1         0x0         00:00:00:00:00:00     *        "
+      "eth1\n"
+      "10.0.0.3         0x1         0x6         de:ad:be:ef:00:01     *        "
+      "eth1\n"
+      "10.0.1.1         0x1         0x2         12:34:56:78:9a:bd     *        "
+      "eth0\n"
+      "garbage\n");
+  const auto neighbors = AfXdp::ParseNeighbors(&arp_table, "eth1");
+
+  // Incomplete entries, and those of other interfaces, are left out.
+  ASSERT_EQ(neighbors.size(), 2);
+  EXPECT_EQ(neighbors[0].first, net::Ipv4::Address::MakeAddress("10.0.0.1"));
+  EXPECT_EQ(neighbors[0].second,
+            net::Ethernet::Address("12:34:56:78:9a:bc"));
+  EXPECT_EQ(neighbors[1].first, net::Ipv4::Address::MakeAddress("10.0.0.3"));
+  EXPECT_EQ(neighbors[1].second,
+            net::Ethernet::Address("de:ad:be:ef:00:01"));
+}
+
+TEST(AfXdpTest, ParseNoNeighbors) {
+  std::istringstream empty;
+  EXPECT_TRUE(AfXdp::ParseNeighbors(&empty, "eth1").empty());
+}
+
+}  // namespace dpdk
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
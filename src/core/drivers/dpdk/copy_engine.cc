@@ -0,0 +1,89 @@
+#include <copy_engine.h>
+#include <glog/logging.h>
+#include <rte_dmadev.h>
+
+#include <algorithm>
+#include <string>
+
+namespace juggler {
+namespace dpdk {
+
+bool CopyEngine::AttachDmaDevice(const std::string &name, uint16_t ring_size) {
+  CHECK(!HasDmaDevice()) << "A DMA device is already attached.";
+  const int dev_id = rte_dma_get_dev_id_by_name(name.c_str());
+  if (dev_id < 0) {
+    LOG(WARNING) << "DMA device " << name << " not found.";
+    return false;
+  }
+
+  struct rte_dma_info info;
+  int ret = rte_dma_info_get(dev_id, &info);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_dma_info_get() failed for " << name << ": " << ret;
+    return false;
+  }
+  if (!(info.dev_capa & RTE_DMA_CAPA_MEM_TO_MEM) || info.max_vchans < 1) {
+    LOG(WARNING) << "DMA device " << name << " cannot copy memory.";
+    return false;
+  }
+
+  struct rte_dma_conf dev_conf = {};
+  dev_conf.nb_vchans = 1;
+  ret = rte_dma_configure(dev_id, &dev_conf);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_dma_configure() failed for " << name << ": " << ret;
+    return false;
+  }
+
+  struct rte_dma_vchan_conf vchan_conf = {};
+  vchan_conf.direction = RTE_DMA_DIR_MEM_TO_MEM;
+  vchan_conf.nb_desc = std::clamp(ring_size, info.min_desc, info.max_desc);
+  ret = rte_dma_vchan_setup(dev_id, kVchan, &vchan_conf);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_dma_vchan_setup() failed for " << name << ": " << ret;
+    return false;
+  }
+
+  ret = rte_dma_start(dev_id);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_dma_start() failed for " << name << ": " << ret;
+    return false;
+  }
+
+  dma_dev_id_ = dev_id;
+  pending_.reserve(vchan_conf.nb_desc);
+  LOG(INFO) << "[DMA: " << dev_id << "] Copies of " << dma_threshold_
+            << " bytes or more offloaded to " << name << " ("
+            << vchan_conf.nb_desc << " descriptors).";
+  return true;
+}
+
+void CopyEngine::DetachDmaDevice() {
+  if (!HasDmaDevice()) return;
+  Wait();
+  rte_dma_stop(*dma_dev_id_);
+  dma_dev_id_.reset();
+}
+
+void CopyEngine::RecoverFrom(size_t failed) {
+  // Each failed or skipped copy reports a status; drain them all.
+  size_t drained = failed;
+  while (drained < pending_.size()) {
+    uint16_t last_idx;
+    enum rte_dma_status_code status[kDefaultRingDescNr];
+    const uint16_t max = std::min<size_t>(pending_.size() - drained,
+                                          kDefaultRingDescNr);
+    drained += rte_dma_completed_status(*dma_dev_id_, kVchan, max, &last_idx,
+                                        status);
+  }
+
+  LOG(WARNING) << "[DMA: " << *dma_dev_id_ << "] Copy failed. Redoing "
+               << pending_.size() - failed << " copies on the CPU.";
+  for (size_t i = failed; i < pending_.size(); i++) {
+    stats_.dma_errors_nr++;
+    Copy(pending_[i].dest, pending_[i].src, pending_[i].len);
+  }
+}
+
+}  // namespace dpdk
+}  // namespace juggler
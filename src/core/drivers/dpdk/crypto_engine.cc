@@ -0,0 +1,353 @@
+#include <crypto_engine.h>
+#include <glog/logging.h>
+#include <rte_crypto.h>
+#include <rte_cryptodev.h>
+#include <rte_mbuf.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+namespace {
+
+// `Packet' wraps an mbuf, as its first and only member.
+struct rte_mbuf *ToMbuf(Packet *pkt) {
+  return reinterpret_cast<struct rte_mbuf *>(pkt);
+}
+
+}  // namespace
+
+bool CryptoEngine::AttachDevice(const std::string &name,
+                                const std::vector<uint8_t> &master_key,
+                                uint16_t aad_len, uint32_t sessions_nr) {
+  CHECK(!HasDevice()) << "A crypto device is already attached.";
+  if (master_key.size() != 16 && master_key.size() != 32) {
+    LOG(WARNING) << "Invalid master key length: " << master_key.size();
+    return false;
+  }
+  const int dev_id = rte_cryptodev_get_dev_id(name.c_str());
+  if (dev_id < 0) {
+    LOG(WARNING) << "Crypto device " << name << " not found.";
+    return false;
+  }
+
+  struct rte_cryptodev_sym_capability_idx cap_idx = {};
+  cap_idx.type = RTE_CRYPTO_SYM_XFORM_AEAD;
+  cap_idx.algo.aead = RTE_CRYPTO_AEAD_AES_GCM;
+  const auto *cap = rte_cryptodev_sym_capability_get(dev_id, &cap_idx);
+  if (cap == nullptr ||
+      rte_cryptodev_sym_capability_check_aead(cap, master_key.size(),
+                                              kTagLen, aad_len,
+                                              kNonceLen) != 0) {
+    LOG(WARNING) << "Crypto device " << name << " does not support AES-GCM"
+                 << " with " << master_key.size() * 8 << "-bit keys.";
+    return false;
+  }
+
+  struct rte_cryptodev_info info;
+  rte_cryptodev_info_get(dev_id, &info);
+  if (info.max_nb_queue_pairs < 1) {
+    LOG(WARNING) << "Crypto device " << name << " has no queue pair.";
+    return false;
+  }
+  if (info.sym.max_nb_sessions != 0) {
+    sessions_nr = std::min(sessions_nr, info.sym.max_nb_sessions);
+  }
+
+  const int socket_id = std::max(rte_cryptodev_socket_id(dev_id), 0);
+  const std::string suffix = std::to_string(dev_id);
+  session_pool_ = rte_cryptodev_sym_session_pool_create(
+      ("crypto_sess_" + suffix).c_str(), sessions_nr + 1, 0, 0, 0, socket_id);
+  session_priv_pool_ = rte_mempool_create(
+      ("crypto_sess_priv_" + suffix).c_str(), sessions_nr + 1,
+      rte_cryptodev_sym_get_private_session_size(dev_id), 0, 0, nullptr,
+      nullptr, nullptr, nullptr, socket_id, 0);
+  op_pool_ = rte_crypto_op_pool_create(
+      ("crypto_op_" + suffix).c_str(), RTE_CRYPTO_OP_TYPE_SYMMETRIC,
+      kDefaultOpsNr, 0, kNonceLen, socket_id);
+  kdf_pool_ = rte_pktmbuf_pool_create(
+      ("crypto_kdf_" + suffix).c_str(), 63, 0, 0,
+      RTE_PKTMBUF_HEADROOM + aad_len + kMaxKeyLen + kTagLen, socket_id);
+  if (session_pool_ == nullptr || session_priv_pool_ == nullptr ||
+      op_pool_ == nullptr || kdf_pool_ == nullptr) {
+    LOG(WARNING) << "Failed to create the pools of crypto device " << name;
+    FreePools();
+    return false;
+  }
+
+  struct rte_cryptodev_config dev_conf = {};
+  dev_conf.socket_id = socket_id;
+  dev_conf.nb_queue_pairs = 1;
+  dev_conf.ff_disable =
+      RTE_CRYPTODEV_FF_ASYMMETRIC_CRYPTO | RTE_CRYPTODEV_FF_SECURITY;
+  int ret = rte_cryptodev_configure(dev_id, &dev_conf);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_cryptodev_configure() failed for " << name << ": "
+                 << ret;
+    FreePools();
+    return false;
+  }
+
+  struct rte_cryptodev_qp_conf qp_conf = {};
+  qp_conf.nb_descriptors = kDefaultOpsNr;
+  qp_conf.mp_session = session_pool_;
+  qp_conf.mp_session_private = session_priv_pool_;
+  ret = rte_cryptodev_queue_pair_setup(dev_id, kQp, &qp_conf, socket_id);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_cryptodev_queue_pair_setup() failed for " << name
+                 << ": " << ret;
+    FreePools();
+    return false;
+  }
+
+  ret = rte_cryptodev_start(dev_id);
+  if (ret != 0) {
+    LOG(WARNING) << "rte_cryptodev_start() failed for " << name << ": "
+                 << ret;
+    FreePools();
+    return false;
+  }
+
+  dev_id_ = dev_id;
+  key_len_ = master_key.size();
+  aad_len_ = aad_len;
+  cpu_device_ = !(info.feature_flags & RTE_CRYPTODEV_FF_HW_ACCELERATED);
+  out_of_place_ = info.feature_flags & RTE_CRYPTODEV_FF_OOP_LB_IN_LB_OUT;
+  master_session_ = CreateSession(master_key.data(), true);
+  if (master_session_ == nullptr) {
+    LOG(WARNING) << "Failed to create the master session of " << name;
+    DetachDevice();
+    return false;
+  }
+  pending_.reserve(kDefaultOpsNr);
+  LOG(INFO) << "[CRYPTO: " << dev_id << "] AES-" << key_len_ * 8
+            << "-GCM on " << name << (cpu_device_ ? " (CPU)" : "")
+            << (out_of_place_ ? ", out of place" : ", in place") << ".";
+  return true;
+}
+
+void CryptoEngine::DetachDevice() {
+  if (!HasDevice()) return;
+  Wait();
+  if (master_session_ != nullptr) DestroySession(master_session_);
+  master_session_ = nullptr;
+  rte_cryptodev_stop(*dev_id_);
+  rte_cryptodev_close(*dev_id_);
+  dev_id_.reset();
+  FreePools();
+}
+
+void CryptoEngine::FreePools() {
+  rte_mempool_free(session_pool_);
+  rte_mempool_free(session_priv_pool_);
+  rte_mempool_free(op_pool_);
+  rte_mempool_free(kdf_pool_);
+  session_pool_ = nullptr;
+  session_priv_pool_ = nullptr;
+  op_pool_ = nullptr;
+  kdf_pool_ = nullptr;
+}
+
+CryptoEngine::Session *CryptoEngine::CreateSession(const uint8_t *key,
+                                                   bool encrypt) {
+  auto *session = rte_cryptodev_sym_session_create(session_pool_);
+  if (session == nullptr) return nullptr;
+  struct rte_crypto_sym_xform xform = {};
+  xform.type = RTE_CRYPTO_SYM_XFORM_AEAD;
+  xform.aead.op =
+      encrypt ? RTE_CRYPTO_AEAD_OP_ENCRYPT : RTE_CRYPTO_AEAD_OP_DECRYPT;
+  xform.aead.algo = RTE_CRYPTO_AEAD_AES_GCM;
+  xform.aead.key.data = key;
+  xform.aead.key.length = key_len_;
+  xform.aead.iv.offset = kNonceOffset;
+  xform.aead.iv.length = kNonceLen;
+  xform.aead.digest_length = kTagLen;
+  xform.aead.aad_length = aad_len_;
+  if (rte_cryptodev_sym_session_init(*dev_id_, session, &xform,
+                                     session_priv_pool_) != 0) {
+    rte_cryptodev_sym_session_free(session);
+    return nullptr;
+  }
+  return session;
+}
+
+void CryptoEngine::DestroySession(Session *session) {
+  Wait();
+  rte_cryptodev_sym_session_clear(*dev_id_, session);
+  rte_cryptodev_sym_session_free(session);
+}
+
+void CryptoEngine::PrepareOp(struct rte_crypto_op *op, Session *session,
+                             struct rte_mbuf *dst, struct rte_mbuf *src,
+                             uint16_t aad_offset, uint16_t offset,
+                             uint16_t len, uint64_t iv) {
+  rte_crypto_op_attach_sym_session(op, session);
+  auto *sym = op->sym;
+  sym->m_src = src;
+  sym->m_dst = src == dst ? nullptr : dst;
+  sym->aead.data.offset = offset;
+  sym->aead.data.length = len;
+  sym->aead.digest.data =
+      rte_pktmbuf_mtod_offset(dst, uint8_t *, offset + len);
+  sym->aead.digest.phys_addr = rte_pktmbuf_iova_offset(dst, offset + len);
+  sym->aead.aad.data = rte_pktmbuf_mtod_offset(dst, uint8_t *, aad_offset);
+  sym->aead.aad.phys_addr = rte_pktmbuf_iova_offset(dst, aad_offset);
+  auto *nonce = rte_crypto_op_ctod_offset(op, uint8_t *, kNonceOffset);
+  std::memset(nonce, 0, kNonceLen - kIvLen);
+  std::memcpy(nonce + kNonceLen - kIvLen, &iv, kIvLen);
+}
+
+void CryptoEngine::Run(struct rte_crypto_op **ops, uint16_t nb_ops) {
+  struct rte_crypto_op *done[kBurst];
+  uint16_t enqueued = 0;
+  uint16_t dequeued = 0;
+  while (dequeued < nb_ops) {
+    if (enqueued < nb_ops) {
+      enqueued += rte_cryptodev_enqueue_burst(*dev_id_, kQp, ops + enqueued,
+                                              nb_ops - enqueued);
+    }
+    // The operations report their status themselves.
+    dequeued += rte_cryptodev_dequeue_burst(
+        *dev_id_, kQp, done, std::min<uint16_t>(nb_ops - dequeued, kBurst));
+  }
+}
+
+bool CryptoEngine::DeriveKey(const uint8_t *initiator_nonce,
+                             const uint8_t *responder_nonce,
+                             uint8_t direction, uint8_t *key) {
+  uint8_t inner_key[kMaxKeyLen];
+  if (!Keystream(master_session_, initiator_nonce, inner_key)) return false;
+  auto *session = CreateSession(inner_key, true);
+  explicit_bzero(inner_key, sizeof(inner_key));
+  if (session == nullptr) return false;
+  uint8_t nonce[kNonceLen];
+  std::memcpy(nonce, responder_nonce, kNonceLen);
+  nonce[kNonceLen - 1] ^= direction;
+  const bool ok = Keystream(session, nonce, key);
+  DestroySession(session);
+  return ok;
+}
+
+bool CryptoEngine::Keystream(Session *session, const uint8_t *nonce,
+                             uint8_t *out) {
+  auto *m = rte_pktmbuf_alloc(kdf_pool_);
+  if (m == nullptr) return false;
+  // Zeros as the header, then as the plaintext.
+  auto *data = reinterpret_cast<uint8_t *>(
+      rte_pktmbuf_append(m, aad_len_ + key_len_ + kTagLen));
+  std::memset(data, 0, aad_len_ + key_len_ + kTagLen);
+  auto *op = rte_crypto_op_alloc(op_pool_, RTE_CRYPTO_OP_TYPE_SYMMETRIC);
+  if (op == nullptr) {
+    rte_pktmbuf_free(m);
+    return false;
+  }
+  PrepareOp(op, session, m, m, 0, aad_len_, key_len_, 0);
+  // The whole nonce, rather than an explicit IV.
+  std::memcpy(rte_crypto_op_ctod_offset(op, uint8_t *, kNonceOffset), nonce,
+              kNonceLen);
+  Run(&op, 1);
+  const bool ok = op->status == RTE_CRYPTO_OP_STATUS_SUCCESS;
+  if (ok) std::memcpy(out, data + aad_len_, key_len_);
+  explicit_bzero(data, aad_len_ + key_len_ + kTagLen);
+  rte_crypto_op_free(op);
+  rte_pktmbuf_free(m);
+  return ok;
+}
+
+void CryptoEngine::EncryptAsync(Session *session, Packet *dst, Packet *src,
+                                uint16_t aad_offset, uint16_t len,
+                                uint64_t iv) {
+  auto *op = rte_crypto_op_alloc(op_pool_, RTE_CRYPTO_OP_TYPE_SYMMETRIC);
+  if (op == nullptr) [[unlikely]] {
+    // Out of operations: complete the pending ones.
+    Wait();
+    op = CHECK_NOTNULL(
+        rte_crypto_op_alloc(op_pool_, RTE_CRYPTO_OP_TYPE_SYMMETRIC));
+  }
+  auto *dst_mbuf = ToMbuf(dst);
+  PrepareOp(op, session, dst_mbuf, src == nullptr ? dst_mbuf : ToMbuf(src),
+            aad_offset, aad_offset + aad_len_ + kIvLen, len, iv);
+  pending_.push_back(op);
+}
+
+void CryptoEngine::Wait() {
+  if (pending_.empty()) return;
+  for (size_t i = 0; i < pending_.size(); i += kBurst) {
+    Run(&pending_[i], std::min<size_t>(pending_.size() - i, kBurst));
+  }
+  size_t failed_nr = 0;
+  for (auto *op : pending_) {
+    auto *sym = op->sym;
+    if (op->status == RTE_CRYPTO_OP_STATUS_SUCCESS) [[likely]] {
+      stats_.encrypted_nr++;
+    } else {
+      failed_nr++;
+      auto *dst = sym->m_dst != nullptr ? sym->m_dst : sym->m_src;
+      std::memset(
+          rte_pktmbuf_mtod_offset(dst, uint8_t *, sym->aead.data.offset), 0,
+          sym->aead.data.length + kTagLen);
+    }
+    // Out of place, the plaintext came in a packet of its own.
+    if (sym->m_dst != nullptr) rte_pktmbuf_free(sym->m_src);
+    rte_crypto_op_free(op);
+  }
+  if (failed_nr != 0) [[unlikely]] {
+    stats_.errors_nr += failed_nr;
+    LOG_EVERY_N(WARNING, 1000) << "[CRYPTO: " << *dev_id_ << "] "
+                               << failed_nr << " encryptions failed.";
+  }
+  pending_.clear();
+}
+
+uint64_t CryptoEngine::Decrypt(Session *session, Packet *const *pkts,
+                               uint16_t nb_pkts, uint16_t aad_offset) {
+  CHECK_LE(nb_pkts, kBurst);
+  struct rte_crypto_op *ops[kBurst];
+  uint16_t idx[kBurst];
+  uint16_t nb_ops = 0;
+  const uint16_t offset = aad_offset + aad_len_ + kIvLen;
+  for (uint16_t i = 0; i < nb_pkts; i++) {
+    auto *m = ToMbuf(pkts[i]);
+    if (m->nb_segs != 1 || m->pkt_len < offset + kTagLen) {
+      stats_.auth_failures_nr++;
+      continue;
+    }
+    idx[nb_ops++] = i;
+  }
+  if (nb_ops == 0) return 0;
+  if (rte_crypto_op_bulk_alloc(op_pool_, RTE_CRYPTO_OP_TYPE_SYMMETRIC, ops,
+                               nb_ops) == 0) [[unlikely]] {
+    LOG_EVERY_N(WARNING, 1000) << "[CRYPTO: " << *dev_id_
+                               << "] Out of operations; packets dropped.";
+    return 0;
+  }
+  for (uint16_t i = 0; i < nb_ops; i++) {
+    auto *m = ToMbuf(pkts[idx[i]]);
+    uint64_t iv;
+    std::memcpy(&iv, rte_pktmbuf_mtod_offset(m, uint8_t *, offset - kIvLen),
+                kIvLen);
+    PrepareOp(ops[i], session, m, m, aad_offset, offset,
+              m->pkt_len - offset - kTagLen, iv);
+  }
+  Run(ops, nb_ops);
+
+  uint64_t ok = 0;
+  for (uint16_t i = 0; i < nb_ops; i++) {
+    if (ops[i]->status == RTE_CRYPTO_OP_STATUS_SUCCESS) [[likely]] {
+      ok |= 1ULL << idx[i];
+      stats_.decrypted_nr++;
+    } else {
+      stats_.auth_failures_nr++;
+    }
+    rte_crypto_op_free(ops[i]);
+  }
+  return ok;
+}
+
+}  // namespace dpdk
+}  // namespace juggler
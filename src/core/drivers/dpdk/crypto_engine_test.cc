@@ -0,0 +1,241 @@
+/**
+ * @file crypto_engine_test.cc
+ *
+ * Unit tests for the CryptoEngine class, on AES-NI: one "crypto_aesni_gcm"
+ * virtual device for each end of a flow.
+ */
+#include <crypto_engine.h>
+#include <dpdk.h>
+#include <ether.h>
+#include <gtest/gtest.h>
+#include <ipv4.h>
+#include <machnet_pkthdr.h>
+#include <packet_pool.h>
+#include <pmd.h>
+#include <udp.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+class CryptoEngineTest : public ::testing::Test {
+ protected:
+  using Nonce = std::array<uint8_t, CryptoEngine::kNonceLen>;
+
+  // Encrypted data packets, as flows lay them out: the Machnet header is
+  // authenticated, and followed by the IV, the payload and the tag.
+  static constexpr uint16_t kAadOffset =
+      sizeof(net::Ethernet) + sizeof(net::Ipv4) + sizeof(net::Udp);
+  static constexpr uint16_t kAadLen = sizeof(net::MachnetPktHdr);
+  static constexpr uint16_t kHdrLen =
+      kAadOffset + kAadLen + CryptoEngine::kIvLen;
+  static constexpr uint16_t kPayloadLen = 1000;
+  static constexpr uint32_t kMbufsNr = 1024;
+
+  static void SetUpTestSuite() {
+    const std::vector<uint8_t> master_key(32, 0x5a);
+    initiator_ = std::make_unique<CryptoEngine>();
+    CHECK(initiator_->AttachDevice("crypto_aesni_gcm0", master_key, kAadLen));
+    responder_ = std::make_unique<CryptoEngine>();
+    CHECK(responder_->AttachDevice("crypto_aesni_gcm1", master_key, kAadLen));
+  }
+  static void TearDownTestSuite() {
+    responder_.reset();
+    initiator_.reset();
+  }
+
+  void SetUp() override {
+    std::generate(initiator_nonce_.begin(), initiator_nonce_.end(), std::rand);
+    std::generate(responder_nonce_.begin(), responder_nonce_.end(), std::rand);
+    pkt_pool_ = std::make_unique<PacketPool>(
+        kMbufsNr, PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
+                      RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+  }
+  void TearDown() override { pkt_pool_.reset(); }
+
+  // Derives the key of `direction' on `engine', as flows do in the handshake
+  // (see `Flow::ProcessCryptoOptions').
+  std::vector<uint8_t> DeriveKey(CryptoEngine *engine, uint8_t direction,
+                                 const Nonce &initiator_nonce,
+                                 const Nonce &responder_nonce) {
+    std::vector<uint8_t> key(engine->GetKeyLen());
+    CHECK(engine->DeriveKey(initiator_nonce.data(), responder_nonce.data(),
+                            direction, key.data()));
+    return key;
+  }
+  std::vector<uint8_t> DeriveKey(CryptoEngine *engine, uint8_t direction) {
+    return DeriveKey(engine, direction, initiator_nonce_, responder_nonce_);
+  }
+
+  // Creates a data packet with sequence number `seqno', IV `iv', `payload'
+  // in the clear, and room for the tag.
+  Packet *CreatePacket(uint32_t seqno, uint64_t iv,
+                       const std::vector<uint8_t> &payload) {
+    auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+    auto *data = CHECK_NOTNULL(packet->append<uint8_t *>(
+        kHdrLen + payload.size() + CryptoEngine::kTagLen));
+    std::memset(data, 0, kHdrLen);
+    auto *machneth = reinterpret_cast<net::MachnetPktHdr *>(data + kAadOffset);
+    machneth->magic = be16_t(net::MachnetPktHdr::kMagic);
+    machneth->net_flags = net::MachnetPktHdr::MachnetFlags::kData;
+    machneth->seqno = be32_t(seqno);
+    std::memcpy(machneth + 1, &iv, sizeof(iv));
+    std::memcpy(data + kHdrLen, payload.data(), payload.size());
+    return packet;
+  }
+
+  static uint8_t *Payload(Packet *packet) {
+    return packet->head_data<uint8_t *>(kHdrLen);
+  }
+
+  std::vector<uint8_t> RandomPayload(size_t len) {
+    std::vector<uint8_t> payload(len);
+    std::generate(payload.begin(), payload.end(), std::rand);
+    return payload;
+  }
+
+  inline static std::unique_ptr<CryptoEngine> initiator_;
+  inline static std::unique_ptr<CryptoEngine> responder_;
+  Nonce initiator_nonce_;
+  Nonce responder_nonce_;
+  std::unique_ptr<PacketPool> pkt_pool_;
+};
+
+TEST_F(CryptoEngineTest, DeriveKey) {
+  // Both ends derive the same key for each direction, from the nonces alone.
+  const auto key = DeriveKey(initiator_.get(), 0);
+  EXPECT_EQ(key.size(), 32u);
+  EXPECT_EQ(DeriveKey(responder_.get(), 0), key);
+  EXPECT_EQ(DeriveKey(responder_.get(), 1), DeriveKey(initiator_.get(), 1));
+  EXPECT_EQ(DeriveKey(initiator_.get(), 0), key);
+
+  // Each direction, and each nonce of either end, gets a key of its own.
+  EXPECT_NE(DeriveKey(initiator_.get(), 1), key);
+  EXPECT_NE(key, std::vector<uint8_t>(key.size(), 0x5a));
+  auto nonce = initiator_nonce_;
+  nonce.back() ^= 1;
+  EXPECT_NE(DeriveKey(initiator_.get(), 0, nonce, responder_nonce_), key);
+  nonce = responder_nonce_;
+  nonce.front() ^= 1;
+  EXPECT_NE(DeriveKey(initiator_.get(), 0, initiator_nonce_, nonce), key);
+  // The nonces are not interchangeable.
+  EXPECT_NE(DeriveKey(initiator_.get(), 0, responder_nonce_, initiator_nonce_),
+            key);
+}
+
+TEST_F(CryptoEngineTest, RoundTrip) {
+  const auto key = DeriveKey(initiator_.get(), 0);
+  CryptoKey tx_key;
+  tx_key.Set(key.data(), key.size(), true);
+  ASSERT_TRUE(tx_key.Bind(initiator_.get()));
+  CryptoKey rx_key;
+  rx_key.Set(DeriveKey(responder_.get(), 0).data(), key.size(), false);
+  ASSERT_TRUE(rx_key.Bind(responder_.get()));
+
+  constexpr uint16_t kPacketsNr = 8;
+  const auto stats = initiator_->GetStats();
+  std::vector<std::vector<uint8_t>> payloads;
+  std::vector<Packet *> packets;
+  for (uint16_t i = 0; i < kPacketsNr; i++) {
+    payloads.emplace_back(RandomPayload(kPayloadLen + i));
+    packets.emplace_back(CreatePacket(i, i, payloads.back()));
+    initiator_->EncryptAsync(tx_key.session(), packets.back(), nullptr,
+                             kAadOffset, payloads.back().size(), i);
+  }
+  // Encryption completes on `Wait()'.
+  EXPECT_TRUE(initiator_->HasPending());
+  initiator_->Wait();
+  EXPECT_FALSE(initiator_->HasPending());
+  EXPECT_EQ(initiator_->GetStats().encrypted_nr,
+            stats.encrypted_nr + kPacketsNr);
+  EXPECT_EQ(initiator_->GetStats().errors_nr, stats.errors_nr);
+  for (uint16_t i = 0; i < kPacketsNr; i++) {
+    EXPECT_NE(std::memcmp(Payload(packets[i]), payloads[i].data(),
+                          payloads[i].size()),
+              0);
+  }
+
+  EXPECT_EQ(responder_->Decrypt(rx_key.session(), packets.data(), kPacketsNr,
+                                kAadOffset),
+            (1ULL << kPacketsNr) - 1);
+  for (uint16_t i = 0; i < kPacketsNr; i++) {
+    EXPECT_EQ(std::memcmp(Payload(packets[i]), payloads[i].data(),
+                          payloads[i].size()),
+              0);
+    Packet::Free(packets[i]);
+  }
+}
+
+TEST_F(CryptoEngineTest, Tampering) {
+  const auto key = DeriveKey(initiator_.get(), 0);
+  CryptoKey tx_key;
+  tx_key.Set(key.data(), key.size(), true);
+  ASSERT_TRUE(tx_key.Bind(initiator_.get()));
+  CryptoKey rx_key;
+  rx_key.Set(key.data(), key.size(), false);
+  ASSERT_TRUE(rx_key.Bind(responder_.get()));
+  CryptoKey reverse_rx_key;
+  reverse_rx_key.Set(DeriveKey(responder_.get(), 1).data(), key.size(), false);
+  ASSERT_TRUE(reverse_rx_key.Bind(responder_.get()));
+
+  enum Tamper { kHeader, kIv, kCiphertext, kTag, kNone, kTampersNr };
+  const auto payload = RandomPayload(kPayloadLen);
+  std::vector<Packet *> packets;
+  for (uint16_t i = 0; i < kTampersNr; i++) {
+    packets.emplace_back(CreatePacket(i, i, payload));
+    initiator_->EncryptAsync(tx_key.session(), packets.back(), nullptr,
+                             kAadOffset, payload.size(), i);
+  }
+  initiator_->Wait();
+  auto *data = packets[kHeader]->head_data<uint8_t *>(kAadOffset);
+  reinterpret_cast<net::MachnetPktHdr *>(data)->seqno = be32_t(kTampersNr);
+  packets[kIv]->head_data<uint8_t *>(kHdrLen - 1)[0] ^= 1;
+  Payload(packets[kCiphertext])[kPayloadLen / 2] ^= 1;
+  Payload(packets[kTag])[kPayloadLen + CryptoEngine::kTagLen - 1] ^= 1;
+
+  // Only the untouched packet is authenticated.
+  const auto stats = responder_->GetStats();
+  EXPECT_EQ(responder_->Decrypt(rx_key.session(), packets.data(), kTampersNr,
+                                kAadOffset),
+            1ULL << kNone);
+  EXPECT_EQ(responder_->GetStats().auth_failures_nr,
+            stats.auth_failures_nr + kTampersNr - 1);
+  EXPECT_EQ(std::memcmp(Payload(packets[kNone]), payload.data(),
+                        payload.size()),
+            0);
+  for (auto *packet : packets) Packet::Free(packet);
+
+  // Nor does a packet pass under the key of the other direction, e.g., sent
+  // back to its sender.
+  auto *packet = CreatePacket(0, kTampersNr, payload);
+  initiator_->EncryptAsync(tx_key.session(), packet, nullptr, kAadOffset,
+                           payload.size(), kTampersNr);
+  initiator_->Wait();
+  EXPECT_EQ(
+      responder_->Decrypt(reverse_rx_key.session(), &packet, 1, kAadOffset),
+      0u);
+  Packet::Free(packet);
+}
+
+}  // namespace dpdk
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024", "--log-level",
+       "8", "--vdev=crypto_aesni_gcm0", "--vdev=crypto_aesni_gcm1",
+       "--no-pci"});
+
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  return RUN_ALL_TESTS();
+}
@@ -10,7 +10,8 @@ namespace juggler {
 namespace dpdk {
 
 [[maybe_unused]] static rte_mempool* CreateSpScPacketPool(
-    const std::string& name, uint32_t nmbufs, uint16_t mbuf_data_size) {
+    const std::string& name, uint32_t nmbufs, uint16_t mbuf_data_size,
+    int socket_id) {
   struct rte_mempool* mp;
   struct rte_pktmbuf_pool_private mbp_priv;
 
@@ -24,7 +25,7 @@ namespace dpdk {
       RTE_MEMPOOL_F_SC_GET | RTE_MEMPOOL_F_SP_PUT;
   mp = rte_mempool_create(name.c_str(), nmbufs, elt_size, 0, sizeof(mbp_priv),
                           rte_pktmbuf_pool_init, &mbp_priv, rte_pktmbuf_init,
-                          NULL, rte_socket_id(), kMemPoolFlags);
+                          NULL, socket_id, kMemPoolFlags);
   if (mp == nullptr) {
     LOG(ERROR) << "rte_mempool_create() failed. ";
     return nullptr;
@@ -38,18 +39,21 @@ uint16_t PacketPool::next_id_ = 0;
 // 'id' of the PacketPool usually refers to the thread id.
 // 'nmbufs' is the number of mbufs to allocate in the backing pool.
 // 'mbuf_size' the size of an mbuf buffer. (MBUF_DATASZ_DEFAULT is the minimum)
+// 'socket_id' the NUMA node of the mbufs (SOCKET_ID_ANY for the caller's).
 PacketPool::PacketPool(uint32_t nmbufs, uint16_t mbuf_size,
-                       const char* mempool_name)
+                       const char* mempool_name, int socket_id)
     : is_dpdk_primary_process_(rte_eal_process_type() == RTE_PROC_PRIMARY) {
   if (is_dpdk_primary_process_) {
     // Create mempool here, choose the name automatically
     id_ = ++next_id_;
     std::string mpool_name = "mbufpool" + std::to_string(id_);
+    if (socket_id == SOCKET_ID_ANY) socket_id = rte_socket_id();
     LOG(INFO) << "[ALLOC] [type:mempool, name:" << mpool_name
-              << ", nmbufs:" << nmbufs << ", mbuf_size:" << mbuf_size << "]";
+              << ", nmbufs:" << nmbufs << ", mbuf_size:" << mbuf_size
+              << ", socket:" << socket_id << "]";
     // mpool_ = rte_pktmbuf_pool_create(mpool_name.c_str(), nmbufs, 0, 0,
     //                                  mbuf_size, SOCKET_ID_ANY);
-    mpool_ = CreateSpScPacketPool(mpool_name, nmbufs, mbuf_size);
+    mpool_ = CreateSpScPacketPool(mpool_name, nmbufs, mbuf_size, socket_id);
     CHECK(mpool_) << "Failed to create packet pool.";
   } else {
     // Lookup mempool created earlier by the primary
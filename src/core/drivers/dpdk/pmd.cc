@@ -1,8 +1,13 @@
 #include <glog/logging.h>
 #include <pmd.h>
+#include <rte_byteorder.h>
 #include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
 #include <utils.h>
 
+#include <net/if.h>
+
 #include <algorithm>
 #include <cstring>
 #include <memory>
@@ -29,10 +34,13 @@ __attribute__((unused)) static void ReportLinkStatus(uint8_t port_id) {
   }
 }
 
-static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
+static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo,
+                                   uint16_t mtu, bool rx_intr, bool tx_uso,
+                                   bool tx_extbuf, bool rx_timestamp) {
   CHECK_NOTNULL(devinfo);
 
   struct rte_eth_conf port_conf = rte_eth_conf();
+  port_conf.intr_conf.rxq = rx_intr ? 1 : 0;
 
   // The `net_null' driver is only used for testing, and it does not support
   // offloads so return a very basic ethernet configuration.
@@ -47,11 +55,19 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
   port_conf.lpbk_mode = 1;
   port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
 
-  port_conf.rxmode.mtu = PmdRing::kDefaultFrameSize;
-  port_conf.rxmode.max_lro_pkt_size = PmdRing::kDefaultFrameSize;
+  port_conf.rxmode.mtu = mtu;
+  port_conf.rxmode.max_lro_pkt_size = mtu;
   port_conf.rxmode.split_hdr_size = 0;
   const auto rx_offload_capa = devinfo->rx_offload_capa;
   port_conf.rxmode.offloads |= ((RTE_ETH_RX_OFFLOAD_CHECKSUM)&rx_offload_capa);
+  if (rx_timestamp) {
+    if (rx_offload_capa & RTE_ETH_RX_OFFLOAD_TIMESTAMP) {
+      LOG(INFO) << "Enabling RX timestamps.";
+      port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+    } else {
+      LOG(WARNING) << "Hardware does not support RX timestamps; using TSC.";
+    }
+  }
 
   port_conf.rx_adv_conf.rss_conf = {
       .rss_key = nullptr,
@@ -60,23 +76,39 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
   };
 
   const auto tx_offload_capa = devinfo->tx_offload_capa;
-  if (!(tx_offload_capa & DEV_TX_OFFLOAD_IPV4_CKSUM) ||
-      !(tx_offload_capa & DEV_TX_OFFLOAD_UDP_CKSUM)) {
-    // Making this fatal; not sure what NIC does not support checksum offloads.
-    LOG(FATAL) << "Hardware does not support checksum offloads.";
+  const uint64_t kChecksumOffloads =
+      DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_UDP_CKSUM;
+  if ((tx_offload_capa & kChecksumOffloads) != kChecksumOffloads) {
+    // The TX rings compute the missing checksums in software.
+    LOG(WARNING) << "Hardware does not support checksum offloads; computing "
+                    "checksums in software.";
   }
 
   port_conf.txmode.mq_mode = ETH_MQ_TX_NONE;
-  port_conf.txmode.offloads =
-      (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_UDP_CKSUM);
+  port_conf.txmode.offloads = kChecksumOffloads & tx_offload_capa;
 
-  if (tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
+  if (tx_extbuf) {
+    LOG(INFO) << "Not enabling FAST FREE: packets carry external buffers.";
+  } else if (tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
     // TODO(ilias): Add option to the constructor to enable this offload.
     LOG(WARNING)
         << "Enabling FAST FREE: use always the same mempool for each queue.";
     port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
   }
 
+  if (tx_uso) {
+    // UDP segmentation needs multi-segment packets as well.
+    const uint64_t kUsoOffloads =
+        RTE_ETH_TX_OFFLOAD_UDP_TSO | RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
+    if ((tx_offload_capa & kUsoOffloads) == kUsoOffloads) {
+      LOG(INFO) << "Enabling UDP segmentation offload.";
+      port_conf.txmode.offloads |= kUsoOffloads;
+    } else {
+      LOG(WARNING) << "Hardware does not support UDP segmentation offload; "
+                      "sending one packet per message buffer.";
+    }
+  }
+
   return port_conf;
 }
 
@@ -88,6 +120,49 @@ void TxRing::Init() {
   }
 }
 
+void TxRing::ChecksumInSoftware(Packet **pkts, uint16_t nb_pkts) const {
+  for (uint16_t i = 0; i < nb_pkts; i++) {
+    auto *mbuf = reinterpret_cast<struct rte_mbuf *>(pkts[i]);
+    const uint64_t flags = mbuf->ol_flags & sw_csum_flags_;
+    if (flags == 0 || (mbuf->ol_flags & RTE_MBUF_F_TX_UDP_SEG)) continue;
+
+    auto *ipv4h = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *,
+                                          mbuf->l2_len);
+    if (flags & RTE_MBUF_F_TX_IP_CKSUM) {
+      ipv4h->hdr_checksum = 0;
+      ipv4h->hdr_checksum = ~utils::RawChecksum(ipv4h, mbuf->l3_len);
+    }
+
+    if (flags & RTE_MBUF_F_TX_UDP_CKSUM) {
+      auto *udph = reinterpret_cast<struct rte_udp_hdr *>(
+          reinterpret_cast<uint8_t *>(ipv4h) + mbuf->l3_len);
+      udph->dgram_cksum = 0;
+      uint16_t sum = rte_ipv4_phdr_cksum(ipv4h, 0);
+      // The datagram may span several segments. A segment that starts at an
+      // odd offset of the datagram has its bytes summed in swapped lanes.
+      size_t remaining = rte_be_to_cpu_16(udph->dgram_len);
+      size_t offset = mbuf->l2_len + mbuf->l3_len;
+      bool odd = false;
+      for (auto *seg = mbuf; seg != nullptr && remaining > 0;
+           seg = seg->next, offset = 0) {
+        if (seg->data_len <= offset) continue;
+        const size_t len = std::min<size_t>(seg->data_len - offset, remaining);
+        uint16_t part = utils::RawChecksum(
+            rte_pktmbuf_mtod_offset(seg, const uint8_t *, offset), len);
+        if (odd) part = rte_bswap16(part);
+        sum = utils::ChecksumAdd(sum, part);
+        odd ^= len & 1;
+        remaining -= len;
+      }
+      const uint16_t cksum = ~sum;
+      // A zero UDP checksum means "none" (RFC 768).
+      udph->dgram_cksum = cksum == 0 ? 0xFFFF : cksum;
+    }
+
+    mbuf->ol_flags &= ~flags;
+  }
+}
+
 void RxRing::Init() {
   int ret = rte_eth_rx_queue_setup(this->GetPortId(), this->GetRingId(),
                                    this->GetDescNum(), SOCKET_ID_ANY, &conf_,
@@ -97,7 +172,44 @@ void RxRing::Init() {
   }
 }
 
-void PmdPort::InitDriver(uint16_t mtu) {
+// The Toeplitz key of Microsoft's RSS specification, for flow hashes where the
+// kernel's is unknown.
+static const std::vector<uint8_t> kDefaultRssKey = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+    0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+    0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+    0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+
+void PmdPort::FetchKernelRssConf() {
+  char ifname[IF_NAMESIZE];
+  std::vector<uint16_t> reta;
+  if (if_indextoname(devinfo_.if_index, ifname) == nullptr ||
+      !AfXdp::GetRssConf(ifname, &rss_hash_key_, &reta)) {
+    // With one queue, whatever the hash, packets land on it.
+    CHECK_EQ(rx_rings_nr_, 1)
+        << "Failed to get the RSS configuration of port "
+        << static_cast<int>(port_id_) << " from the kernel";
+    rss_hash_key_ = kDefaultRssKey;
+    reta.assign(1, 0);
+  }
+  CHECK(utils::is_power_of_two(reta.size()))
+      << "RSS indirection table of port " << static_cast<int>(port_id_)
+      << " of size " << reta.size();
+
+  devinfo_.reta_size = reta.size();
+  rss_reta_conf_.assign(
+      (reta.size() + RTE_ETH_RETA_GROUP_SIZE - 1) / RTE_ETH_RETA_GROUP_SIZE,
+      {0, {0}});
+  for (auto i = 0u; i < reta.size(); i++) {
+    auto index = i / RTE_ETH_RETA_GROUP_SIZE;
+    auto shift = i % RTE_ETH_RETA_GROUP_SIZE;
+    rss_reta_conf_[index].reta[shift] = reta[i];
+    rss_reta_conf_[index].mask |= 1ull << shift;
+  }
+}
+
+void PmdPort::InitDriver(uint16_t mtu, bool rx_intr, bool tx_uso,
+                         bool tx_extbuf, bool rx_timestamp) {
   if (is_dpdk_primary_process_) {
     // Get DPDK port info.
     FetchDpdkPortInfo(port_id_, &devinfo_, &l2_addr_, &pci_info_);
@@ -135,7 +247,14 @@ void PmdPort::InitDriver(uint16_t mtu) {
     }
 
     LOG(INFO) << "Rings nr: " << rx_rings_nr_;
-    const rte_eth_conf portconf = DefaultEthConf(&devinfo_);
+    LOG_IF(INFO, rx_intr) << "Enabling RX queue interrupts.";
+    if (mtu > devinfo_.max_mtu) {
+      LOG(FATAL) << "MTU " << mtu << " not supported by port "
+                 << static_cast<int>(port_id_) << " (max " << devinfo_.max_mtu
+                 << ")";
+    }
+    const rte_eth_conf portconf = DefaultEthConf(
+        &devinfo_, mtu, rx_intr, tx_uso, tx_extbuf, rx_timestamp);
     int ret =
         rte_eth_dev_configure(port_id_, rx_rings_nr_, tx_rings_nr_, &portconf);
     if (ret != 0) {
@@ -156,50 +275,54 @@ void PmdPort::InitDriver(uint16_t mtu) {
       }
     }
 
-    // Try to get the RSS configuration from the device.
-    rss_hash_key_.resize(devinfo_.hash_key_size, 0);
-    struct rte_eth_rss_conf rss_conf;
-    rss_conf.rss_key = rss_hash_key_.data();
-    rss_conf.rss_key_len = devinfo_.hash_key_size;
-    ret = rte_eth_dev_rss_hash_conf_get(port_id_, &rss_conf);
-    if (ret != 0) {
-      LOG(WARNING) << "Failed to get RSS configuration for port "
-                   << static_cast<int>(port_id_) << ". Error "
-                   << rte_strerror(ret);
-    }
+    if (IsAfXdp()) {
+      FetchKernelRssConf();
+    } else {
+      // Try to get the RSS configuration from the device.
+      rss_hash_key_.resize(devinfo_.hash_key_size, 0);
+      struct rte_eth_rss_conf rss_conf;
+      rss_conf.rss_key = rss_hash_key_.data();
+      rss_conf.rss_key_len = devinfo_.hash_key_size;
+      ret = rte_eth_dev_rss_hash_conf_get(port_id_, &rss_conf);
+      if (ret != 0) {
+        LOG(WARNING) << "Failed to get RSS configuration for port "
+                     << static_cast<int>(port_id_) << ". Error "
+                     << rte_strerror(ret);
+      }
 
-    rss_reta_conf_.resize(devinfo_.reta_size / RTE_ETH_RETA_GROUP_SIZE,
-                          {-1ull, {0}});
+      rss_reta_conf_.resize(devinfo_.reta_size / RTE_ETH_RETA_GROUP_SIZE,
+                            {-1ull, {0}});
 
-    for (auto i = 0u; i < devinfo_.reta_size; i++) {
-      // Initialize the RETA table in a round-robin fashion.
-      auto index = i / RTE_ETH_RETA_GROUP_SIZE;
-      auto shift = i % RTE_ETH_RETA_GROUP_SIZE;
-      rss_reta_conf_[index].reta[shift] = i % rx_rings_nr_;
-      rss_reta_conf_[index].mask |= (1 << shift);
-    }
+      for (auto i = 0u; i < devinfo_.reta_size; i++) {
+        // Initialize the RETA table in a round-robin fashion.
+        auto index = i / RTE_ETH_RETA_GROUP_SIZE;
+        auto shift = i % RTE_ETH_RETA_GROUP_SIZE;
+        rss_reta_conf_[index].reta[shift] = i % rx_rings_nr_;
+        rss_reta_conf_[index].mask |= (1 << shift);
+      }
 
-    ret = rte_eth_dev_rss_reta_update(port_id_, rss_reta_conf_.data(),
-                                      devinfo_.reta_size);
-    if (ret != 0) {
-      // By default the RSS RETA table is configured and it works when the
-      // number of RX queues is a power of two. In case of non-power-of-two it
-      // seems that RSS is not behaving as expected, although it should be
-      // supported by 'mlx5' drivers according to the documentation.
-      //
-      // Explicitly updating the RSS RETA table with the default configuration
-      // seems to fix the issue.
-      LOG(WARNING) << "Failed to update RSS RETA configuration for port "
-                   << static_cast<int>(port_id_) << ". Error "
-                   << rte_strerror(ret);
-    }
+      ret = rte_eth_dev_rss_reta_update(port_id_, rss_reta_conf_.data(),
+                                        devinfo_.reta_size);
+      if (ret != 0) {
+        // By default the RSS RETA table is configured and it works when the
+        // number of RX queues is a power of two. In case of non-power-of-two it
+        // seems that RSS is not behaving as expected, although it should be
+        // supported by 'mlx5' drivers according to the documentation.
+        //
+        // Explicitly updating the RSS RETA table with the default configuration
+        // seems to fix the issue.
+        LOG(WARNING) << "Failed to update RSS RETA configuration for port "
+                     << static_cast<int>(port_id_) << ". Error "
+                     << rte_strerror(ret);
+      }
 
-    ret = rte_eth_dev_rss_reta_query(port_id_, rss_reta_conf_.data(),
-                                     devinfo_.reta_size);
-    if (ret != 0) {
-      LOG(WARNING) << "Failed to get RSS RETA configuration for port "
-                   << static_cast<int>(port_id_) << ". Error "
-                   << rte_strerror(ret);
+      ret = rte_eth_dev_rss_reta_query(port_id_, rss_reta_conf_.data(),
+                                       devinfo_.reta_size);
+      if (ret != 0) {
+        LOG(WARNING) << "Failed to get RSS RETA configuration for port "
+                     << static_cast<int>(port_id_) << ". Error "
+                     << rte_strerror(ret);
+      }
     }
 
     LOG(INFO) << utils::Format("RSS indirection table (size %d):\n",
@@ -228,6 +351,14 @@ void PmdPort::InitDriver(uint16_t mtu) {
       std::cout << reta_table;
     }
 
+    if (IsAfXdp()) {
+      // The driver fills its rings with this many buffers whatever the
+      // descriptors asked for; the pools must hold them.
+      rx_ring_desc_nr_ =
+          std::max(rx_ring_desc_nr_, devinfo_.default_rxportconf.ring_size);
+      tx_ring_desc_nr_ =
+          std::max(tx_ring_desc_nr_, devinfo_.default_txportconf.ring_size);
+    }
     ret = rte_eth_dev_adjust_nb_rx_tx_desc(port_id_, &rx_ring_desc_nr_,
                                            &tx_ring_desc_nr_);
     if (ret != 0) {
@@ -238,13 +369,18 @@ void PmdPort::InitDriver(uint16_t mtu) {
 
     const auto mbuf_data_size =
         mtu + RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM;
+    // Keep the mbufs on the NIC's NUMA node, next to the engines serving it.
+    const int socket_id = GetNumaNode();
+    LOG(INFO) << "Port " << static_cast<int>(port_id_) << " NUMA node: "
+              << socket_id;
 
     // Setup the TX queues.
     for (auto q = 0; q < tx_rings_nr_; q++) {
       LOG(INFO) << "Initializing TX ring: " << q;
       auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
                                       devinfo_.default_txconf,
-                                      2 * tx_ring_desc_nr_ - 1, mbuf_data_size);
+                                      2 * tx_ring_desc_nr_ - 1, mbuf_data_size,
+                                      socket_id);
       // auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
       //                                 devinfo_.default_txconf);
       tx_ring.get()->Init();
@@ -256,16 +392,20 @@ void PmdPort::InitDriver(uint16_t mtu) {
       LOG(INFO) << "Initializing RX ring: " << q;
       auto rx_ring = makeRing<RxRing>(this, port_id_, q, rx_ring_desc_nr_,
                                       devinfo_.default_rxconf,
-                                      2 * rx_ring_desc_nr_ - 1, mbuf_data_size);
+                                      2 * rx_ring_desc_nr_ - 1, mbuf_data_size,
+                                      socket_id);
       rx_ring.get()->Init();
       rx_rings_.emplace_back(std::move(rx_ring));
     }
 
-    ret = rte_eth_promiscuous_enable(port_id_);
-    if (ret != 0)
-      LOG(WARNING) << "rte_eth_promiscuous_enable() failed.";
-    else
-      LOG(INFO) << "Promiscuous mode enabled.";
+    // The interface of an AF_XDP port is the kernel's, and so is its mode.
+    if (!IsAfXdp()) {
+      ret = rte_eth_promiscuous_enable(port_id_);
+      if (ret != 0)
+        LOG(WARNING) << "rte_eth_promiscuous_enable() failed.";
+      else
+        LOG(INFO) << "Promiscuous mode enabled.";
+    }
 
     ret = rte_eth_stats_reset(port_id_);
     if (ret != 0) LOG(WARNING) << "Failed to reset port statistics.";
@@ -317,6 +457,31 @@ void PmdPort::InitDriver(uint16_t mtu) {
     }
   }
 
+  // Record the offloads in effect. For secondary processes, these are the
+  // ones the primary process configured the port with.
+  struct rte_eth_conf dev_conf;
+  if (rte_eth_dev_conf_get(port_id_, &dev_conf) == 0) {
+    tx_offloads_ = dev_conf.txmode.offloads;
+    rx_offloads_ = dev_conf.rxmode.offloads;
+    if ((rx_offloads_ & RTE_ETH_RX_OFFLOAD_TIMESTAMP) &&
+        !Packet::RegisterRxTimestamp()) {
+      LOG(WARNING) << "Failed to register the RX timestamp field; ignoring "
+                      "RX timestamps.";
+      rx_offloads_ &= ~RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+    }
+  } else {
+    LOG(WARNING) << "Failed to get the configuration of port "
+                 << static_cast<int>(port_id_);
+  }
+
+  // Checksums the NIC does not compute are computed by the TX rings.
+  uint64_t sw_csum_flags = 0;
+  if (!IsTxIpv4ChecksumOffloaded()) sw_csum_flags |= RTE_MBUF_F_TX_IP_CKSUM;
+  if (!IsTxUdpChecksumOffloaded()) sw_csum_flags |= RTE_MBUF_F_TX_UDP_CKSUM;
+  for (auto &ring : tx_rings_) {
+    static_cast<TxRing *>(ring.get())->SetSwChecksums(sw_csum_flags);
+  }
+
   // Mark port as initialized.
   initialized_ = true;
 }
@@ -329,6 +494,30 @@ void PmdPort::UpdatePortStats() {
   }
 }
 
+void PmdPort::UpdateXstats() {
+  const int nr = rte_eth_xstats_get(port_id_, nullptr, 0);
+  std::vector<struct rte_eth_xstat> values(std::max(nr, 0));
+  if (nr <= 0 || rte_eth_xstats_get(port_id_, values.data(), nr) != nr) {
+    LOG(WARNING) << "Failed to retrieve DPDK port xstats.";
+    xstats_.clear();
+    return;
+  }
+
+  // The names of the counters do not change, unless their number does.
+  if (xstats_.size() != values.size()) {
+    std::vector<struct rte_eth_xstat_name> names(nr);
+    xstats_.clear();
+    if (rte_eth_xstats_get_names(port_id_, names.data(), nr) != nr) {
+      LOG(WARNING) << "Failed to retrieve DPDK port xstats names.";
+      return;
+    }
+    for (const auto &name : names) xstats_.emplace_back(name.name, 0);
+  }
+  for (const auto &xstat : values) {
+    if (xstat.id < xstats_.size()) xstats_[xstat.id].second = xstat.value;
+  }
+}
+
 void PmdPort::DeInit() {
   if (!initialized_ || !is_dpdk_primary_process_) return;
   rte_eth_dev_stop(port_id_);
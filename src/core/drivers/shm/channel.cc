@@ -6,6 +6,13 @@
 #include <channel.h>
 #include <flow.h>
 #include <glog/logging.h>
+#include <linux/mempolicy.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
 
 namespace juggler {
 namespace shm {
@@ -14,29 +21,180 @@ ShmChannel::ShmChannel(const std::string channel_name,
                        const MachnetChannelCtx_t *channel_ctx,
                        const size_t channel_mem_size, const bool is_posix_shm,
                        int channel_fd)
+    : ShmChannel(channel_name, channel_ctx, channel_mem_size, is_posix_shm,
+                 channel_fd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+                 eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+ShmChannel::ShmChannel(const std::string channel_name,
+                       const MachnetChannelCtx_t *channel_ctx,
+                       const size_t channel_mem_size, const bool is_posix_shm,
+                       int channel_fd, int doorbell_fd, int notify_fd)
     : name_(channel_name),
+      shm_name_(channel_name),
       ctx_(CHECK_NOTNULL(channel_ctx)),
       mem_size_(channel_mem_size),
       is_posix_shm_(is_posix_shm),
+      handed_off_(false),
       channel_fd_(channel_fd),
-      cached_buf_indices(),
-      cached_bufs(),
-      cached_buf_count(0) {}
+      doorbell_fd_(doorbell_fd),
+      notify_fd_(notify_fd),
+      numa_node_(MACHNET_NUMA_NODE_ANY),
+      delivered_(false),
+      next_queue_(0),
+      buf_caches_(),
+      buf_budget_(nullptr),
+      buf_pool_idle_ticks_(0) {
+  LOG_IF(WARNING, doorbell_fd_ < 0)
+      << "Failed to create the doorbell of channel " << name_
+      << "; the engine will not be woken up by the application.";
+  LOG_IF(WARNING, notify_fd_ < 0)
+      << "Failed to create the notification of channel " << name_
+      << "; the application will not be woken up by the engine.";
+}
 
 ShmChannel::~ShmChannel() {
+  SetBufBudget(nullptr);
+  if (doorbell_fd_ >= 0) close(doorbell_fd_);
+  if (notify_fd_ >= 0) close(notify_fd_);
   __machnet_channel_destroy(
       const_cast<void *>(reinterpret_cast<const void *>(ctx_)), mem_size_,
-      &channel_fd_, is_posix_shm_, name_.c_str());
+      &channel_fd_, is_posix_shm_ && !handed_off_, shm_name_.c_str());
+}
+
+void ShmChannel::HandOff() {
+  std::vector<MachnetRingSlot_t> indices;
+  GetAllCachedBufferIndices(&indices);
+  uint32_t freed = 0;
+  while (freed < indices.size()) {
+    freed += __machnet_channel_buf_free_bulk(ctx_, indices.size() - freed,
+                                             indices.data() + freed);
+  }
+  handed_off_ = true;
+}
+
+void ShmChannel::SetBufBudget(std::shared_ptr<std::atomic<int64_t>> budget) {
+  const int64_t grown =
+      static_cast<int64_t>(GetBufSegCount() - 1) * ctx_->data_ctx.buf_seg_nr;
+  if (buf_budget_ != nullptr) buf_budget_->fetch_add(grown);
+  buf_budget_ = std::move(budget);
+  if (buf_budget_ != nullptr) buf_budget_->fetch_sub(grown);
+}
+
+bool ShmChannel::GrowBufPool() {
+  if (GetBufSegCount() >= ctx_->data_ctx.buf_segs_max) return false;
+  const int64_t seg_nr = ctx_->data_ctx.buf_seg_nr;
+  if (buf_budget_ != nullptr && buf_budget_->fetch_sub(seg_nr) < seg_nr) {
+    buf_budget_->fetch_add(seg_nr);
+    LOG_EVERY_N(WARNING, 100) << "Channel " << name_
+                              << " is out of its buffer budget.";
+    return false;
+  }
+  if (__machnet_channel_buf_grow(ctx(), channel_fd_) != 0) {
+    if (buf_budget_ != nullptr) buf_budget_->fetch_add(seg_nr);
+    PLOG_EVERY_N(WARNING, 100) << "Failed to grow the buffer pool of channel "
+                               << name_;
+    return false;
+  }
+  VLOG(1) << "Channel " << name_ << " grew to " << GetBufSegCount()
+          << " segments of buffers.";
+  return true;
+}
+
+bool ShmChannel::ShrinkBufPool() {
+  if (GetBufSegCount() <= 1) return false;
+  // The engine's cached buffers may belong to the last segment.
+  std::vector<MachnetRingSlot_t> indices;
+  GetAllCachedBufferIndices(&indices);
+  uint32_t freed = 0;
+  while (freed < indices.size()) {
+    freed += __machnet_channel_buf_free_bulk(ctx_, indices.size() - freed,
+                                             indices.data() + freed);
+  }
+  if (__machnet_channel_buf_shrink(ctx(), channel_fd_) != 0) return false;
+  if (buf_budget_ != nullptr) buf_budget_->fetch_add(ctx_->data_ctx.buf_seg_nr);
+  VLOG(1) << "Channel " << name_ << " shrank to " << GetBufSegCount()
+          << " segments of buffers.";
+  return true;
+}
+
+void ShmChannel::AdaptBufPool() {
+  if (!IsBufPoolElastic()) return;
+  const uint32_t seg_nr = ctx_->data_ctx.buf_seg_nr;
+  const uint32_t free_nr =
+      jring_count(__machnet_channel_buf_class_ring(ctx_, 0)) +
+      buf_caches_[0].count;
+  if (free_nr < seg_nr / 8) {
+    buf_pool_idle_ticks_ = 0;
+    GrowBufPool();
+    return;
+  }
+  // Releasing a segment has to leave some slack, lest the pool grows back.
+  if (free_nr < seg_nr + seg_nr / 2) {
+    buf_pool_idle_ticks_ = 0;
+    return;
+  }
+  if (++buf_pool_idle_ticks_ < kBufPoolShrinkTicks) return;
+  buf_pool_idle_ticks_ = 0;
+  ShrinkBufPool();
+}
+
+void ShmChannel::Rename(const std::string &name) {
+  name_ = name;
+  // Also for the tools that read the name from the channel's memory.
+  auto *ctx = this->ctx();
+  strncpy(ctx->name, name.c_str(), sizeof(ctx->name));
+  ctx->name[sizeof(ctx->name) - 1] = '\0';
+}
+
+bool ShmChannel::BindToNumaNode(int node) {
+  // A single word of node mask is plenty for the hosts we run on.
+  constexpr int kMaxNodes = sizeof(unsigned long) * 8;  // NOLINT
+  if (node < 0 || node >= kMaxNodes) {
+    LOG(ERROR) << "Invalid NUMA node " << node << " for channel " << name_;
+    return false;
+  }
+
+  // The memory is populated when the channel is created, so its pages have to
+  // be moved, too. Prefer the node rather than insist on it, so that the
+  // channel still works when the node runs out of (huge) pages. The kernel
+  // takes the number of bits of the node mask plus one.
+  const unsigned long nodemask = 1UL << node;  // NOLINT
+  const auto ret =
+      syscall(SYS_mbind, const_cast<MachnetChannelCtx_t *>(ctx_), mem_size_,
+              MPOL_PREFERRED, &nodemask, kMaxNodes + 1, MPOL_MF_MOVE);
+  if (ret != 0) {
+    PLOG(WARNING) << "Failed to bind channel " << name_ << " to NUMA node "
+                  << node;
+    return false;
+  }
+
+  numa_node_ = node;
+  return true;
 }
 
 Channel::Channel(const std::string &channel_name,
                  const MachnetChannelCtx_t *channel_ctx,
                  const size_t channel_mem_size, const bool is_posix_shm,
                  int channel_fd)
+    : Channel(channel_name, channel_ctx, channel_mem_size, is_posix_shm,
+              channel_fd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+              eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+Channel::Channel(const std::string &channel_name,
+                 const MachnetChannelCtx_t *channel_ctx,
+                 const size_t channel_mem_size, const bool is_posix_shm,
+                 int channel_fd, int doorbell_fd, int notify_fd)
     : ShmChannel(channel_name, channel_ctx, channel_mem_size, is_posix_shm,
-                 channel_fd),
+                 channel_fd, doorbell_fd, notify_fd),
+      ext_shinfo_(GetTotalBufCount()),
       listeners_(),
-      active_flows_() {}
+      active_flows_() {
+  for (auto &shinfo : ext_shinfo_) {
+    shinfo.free_cb = free_ext_buf_cb;
+    shinfo.fcb_opaque = this;
+    rte_mbuf_ext_refcnt_set(&shinfo, 0);
+  }
+}
 
 Channel::~Channel() { UnregisterDMAMem(); }
 
@@ -50,6 +208,13 @@ bool Channel::RegisterMemForDMA(rte_device *dev) {
     return false;
   }
 
+  // The buffers of an elastic pool come and go, and so would their pages.
+  if (IsBufPoolElastic()) {
+    LOG(ERROR) << "Channel " << GetName()
+               << " has an elastic buffer pool; it cannot be registered";
+    return false;
+  }
+
   // Check that the memory is page-aligned.
   if (reinterpret_cast<uintptr_t>(bufp_mem_start) & (page_size - 1)) {
     LOG(ERROR) << "Channel memory is not page-aligned (page size: " << page_size
@@ -167,9 +332,17 @@ void Channel::UnregisterDMAMem() {
 }
 
 void Channel::RemoveFlow(
-    const std::list<std::unique_ptr<Flow>>::const_iterator &flow_it) {
+    const std::list<FlowSlab::Ptr>::const_iterator &flow_it) {
   active_flows_.erase(flow_it);
 }
 
+void Channel::RemoveFlow(const Flow *flow) {
+  auto it = std::find_if(active_flows_.begin(), active_flows_.end(),
+                         [flow](const auto &f) { return f.get() == flow; });
+  CHECK(it != active_flows_.end())
+      << "Flow does not belong to channel " << GetName();
+  active_flows_.erase(it);
+}
+
 }  // namespace shm
 }  // namespace juggler
@@ -4,12 +4,15 @@
 #include <glog/logging.h>
 #include <machnet.h>
 #include <machnet_common.h>
+#include <perf_report.h>
 #include <signal.h>
 #include <ttime.h>
 #include <unistd.h>
 #include <utils.h>
 
+#include <algorithm>
 #include <numeric>
+#include <string>
 #include <thread>
 
 static constexpr uint8_t kStackCpuCoreId = 3;
@@ -287,7 +290,28 @@ void print_results(const thread_conf &stack_conf, const thread_conf &app_conf) {
   std::cout << std::endl;
 }
 
-int main() {
+// Adds an experiment to the report: messages received by both sides, per
+// second of the longer of their runs.
+void add_result(const std::string &experiment, const thread_conf &stack_conf,
+                const thread_conf &app_conf, juggler::perf::Report *report) {
+  const auto messages =
+      stack_conf.messages_received + app_conf.messages_received;
+  const auto duration_in_ns =
+      std::max(stack_conf.duration_in_ns, app_conf.duration_in_ns);
+  juggler::perf::Result result;
+  result.name = experiment;
+  result.Param("msg_size", stack_conf.tx_message_size)
+      .Param("messages", stack_conf.messages_to_send +
+                             app_conf.messages_to_send);
+  if (messages != 0 && duration_in_ns != 0) {
+    result.OpsPerSec(static_cast<double>(messages) / (duration_in_ns / 1e9))
+        .NsPerOp(static_cast<double>(duration_in_ns) / messages);
+  }
+  report->Add(std::move(result));
+}
+
+int main(int argc, char **argv) {
+  const auto perf_options = juggler::perf::Options::Parse(&argc, argv);
   google::InitGoogleLogging("channel_bench");
   FLAGS_logtostderr = 1;
   signal(SIGINT, [](int) { g_should_stop.store(true); });
@@ -304,14 +328,18 @@ int main() {
   const uint64_t kMessagesToSend = 2 * 1e7;
   const uint64_t kTxMessageSize = 64;
   std::vector<std::pair<uint64_t, uint64_t>> exp_config_vec;
+  const std::vector<std::string> kExpNames = {"stack_to_app", "app_to_stack",
+                                              "bidirectional"};
 
   exp_config_vec.emplace_back(kMessagesToSend, 0);  // Stack -> app only
   exp_config_vec.emplace_back(0, kMessagesToSend);  // App -> stack only
   exp_config_vec.emplace_back(kMessagesToSend, kMessagesToSend);  // Bi-dir
+  juggler::perf::Report report("channel_bench");
 
   LOG(INFO) << "Running channel_bench";
 
-  for (const auto &exp_conf : exp_config_vec) {
+  for (size_t i = 0; i < exp_config_vec.size(); i++) {
+    const auto &exp_conf = exp_config_vec[i];
     LOG(INFO) << "Running experiment: Stack will send " << exp_conf.first
               << " messages, App will send " << exp_conf.second << " messages.";
 
@@ -349,7 +377,8 @@ int main() {
     }
 
     print_results(stack_conf, app_conf);
+    add_result(kExpNames[i], stack_conf, app_conf, &report);
   }
 
-  return 0;
+  return juggler::perf::Finish(report, perf_options);
 }
@@ -5,6 +5,7 @@
  */
 #include <channel.h>
 #include <channel_msgbuf.h>
+#include <fcntl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
@@ -102,8 +103,9 @@ bool machnet_msg_prepare(juggler::shm::MsgBufBatch *batch, const uint8_t *msg,
 
 TEST(BasicChannelTest, ChannelCreateDestroy) {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
-  const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
-  const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
+  // Keep the channels small; the manager holds up to `kMaxChannelNr' of them.
+  const uint32_t kChannelRingSize = 1 << 4;  // 16 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
 
   ChannelManager channel_mgr;
 
@@ -125,6 +127,84 @@ TEST(BasicChannelTest, ChannelCreateDestroy) {
   }
 }
 
+TEST(BasicChannelTest, ChannelNewAdopt) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 4;  // 16 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const std::string pooled_name = std::string(fname) + "-pooled";
+  const std::string channel_name = std::string(fname) + "-adopted";
+
+  // A channel created ahead of time joins a manager under another name.
+  auto channel = ChannelManager::NewChannel(
+      pooled_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kBufferSize);
+  ASSERT_NE(channel, nullptr);
+  EXPECT_EQ(channel->GetName(), pooled_name);
+
+  ChannelManager channel_mgr;
+  EXPECT_TRUE(channel_mgr.AdoptChannel(channel_name.c_str(), channel));
+  EXPECT_EQ(channel_mgr.GetChannelCount(), 1);
+  EXPECT_EQ(channel_mgr.GetChannel(channel_name.c_str()), channel);
+  EXPECT_EQ(channel->GetName(), channel_name);
+  EXPECT_EQ(std::string(channel->ctx()->name), channel_name);
+
+  // Names stay unique.
+  auto other = ChannelManager::NewChannel(
+      (pooled_name + "-other").c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kBufferSize);
+  ASSERT_NE(other, nullptr);
+  EXPECT_FALSE(channel_mgr.AdoptChannel(channel_name.c_str(), other));
+  EXPECT_EQ(other->GetName(), pooled_name + "-other");
+  EXPECT_EQ(channel_mgr.GetChannelCount(), 1);
+}
+
+TEST(BasicChannelTest, ChannelHandOffMap) {
+  using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
+  const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const std::string shm_name = std::string(fname) + "-handoff";
+  const std::string channel_name = std::string(fname) + "-handed-off";
+
+  auto channel = ChannelManager::NewChannel(
+      shm_name.c_str(), kChannelRingSize, kChannelRingSize, kChannelRingSize,
+      kBufferSize);
+  ASSERT_NE(channel, nullptr);
+  channel->Rename(channel_name);
+  EXPECT_EQ(channel->GetShmName(), shm_name);
+  // Leave a buffer in use, and some in the engine's cache.
+  auto *msgbuf = channel->MsgBufAlloc();
+  ASSERT_NE(msgbuf, nullptr);
+  const auto msgbuf_index = msgbuf->index();
+  const auto total_bufs = channel->GetTotalBufCount();
+  EXPECT_EQ(channel->GetFreeBufCount(), total_bufs - 1);
+
+  // The other process gets copies of the descriptors.
+  const int channel_fd = dup(channel->GetFd());
+  const int doorbell_fd = dup(channel->GetDoorbellFd());
+  const int notify_fd = dup(channel->GetNotifyFd());
+  channel->HandOff();
+  channel.reset();
+
+  auto mapped = ChannelManager::MapChannel(shm_name.c_str(), channel_fd,
+                                           doorbell_fd, notify_fd);
+  ASSERT_NE(mapped, nullptr);
+  EXPECT_EQ(mapped->GetShmName(), shm_name);
+  EXPECT_EQ(std::string(mapped->ctx()->name), channel_name);
+  EXPECT_EQ(mapped->GetFd(), channel_fd);
+  EXPECT_EQ(mapped->GetDoorbellFd(), doorbell_fd);
+  EXPECT_EQ(mapped->GetNotifyFd(), notify_fd);
+  // The buffers cached went back to the pool; the one in use is still out.
+  EXPECT_EQ(mapped->GetFreeBufCount(), total_bufs - 1);
+  EXPECT_TRUE(mapped->MsgBufFree(mapped->GetMsgBuf(msgbuf_index)));
+  EXPECT_EQ(mapped->GetFreeBufCount(), total_bufs);
+
+  // A descriptor that is not of a channel is refused, and closed.
+  const int bad_fd = open("/dev/null", O_RDONLY);
+  EXPECT_EQ(ChannelManager::MapChannel(shm_name.c_str(), bad_fd, -1, -1),
+            nullptr);
+  EXPECT_EQ(fcntl(bad_fd, F_GETFD), -1);
+}
+
 TEST(BasicChannelTest, ChannelMsgBufAllocFree) {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::ShmChannel>;
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
@@ -217,6 +297,103 @@ TEST(BasicChannelTest, ChannelEnqueue) {
   EXPECT_EQ(rx_msg, tx_msg);
 }
 
+TEST(BasicChannelTest, PendingBitmap) {
+  const uint32_t kChannelRingSize = 1 << 4;  // 16 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  using PendingBitmap = juggler::shm::PendingBitmap;
+
+  PendingBitmap bitmap;
+  // Slots are handed out in order, and freed slots are reused.
+  for (uint32_t i = 0; i < PendingBitmap::kSlotsNr; i++) {
+    EXPECT_EQ(bitmap.AllocSlot(), i);
+  }
+  EXPECT_FALSE(bitmap.AllocSlot().has_value());
+  EXPECT_EQ(bitmap.GetActiveWordsNr(), PendingBitmap::kWordsNr);
+  for (uint32_t i = 0; i < PendingBitmap::kSlotsNr; i++) bitmap.FreeSlot(i);
+  EXPECT_EQ(bitmap.GetActiveWordsNr(), 0);
+  const uint32_t kSlot = 70;
+  for (uint32_t i = 0; i <= kSlot; i++) EXPECT_EQ(bitmap.AllocSlot(), i);
+  EXPECT_EQ(bitmap.GetActiveWordsNr(), kSlot / 64 + 1);
+
+  juggler::shm::ChannelManager<juggler::shm::ShmChannel> channel_mgr;
+  std::string channel_name(fname);
+  EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto channel = channel_mgr.GetChannel(channel_name.c_str());
+  ASSERT_NE(channel, nullptr);
+  EXPECT_FALSE(channel->UsesPendingBitmap());
+
+  // Map the bitmap the way an application does, and notify the engine.
+  channel->SetPendingSlot(kSlot);
+  auto *app_bitmap = static_cast<MachnetPendingBitmap_t *>(
+      mmap(nullptr, sizeof(MachnetPendingBitmap_t), PROT_READ | PROT_WRITE,
+           MAP_SHARED, bitmap.GetFd(), 0));
+  ASSERT_NE(app_bitmap, MAP_FAILED);
+  channel->ctx()->doorbell.app_pending = &app_bitmap->words[kSlot / 64];
+  EXPECT_TRUE(channel->UsesPendingBitmap());
+
+  EXPECT_EQ(bitmap.Collect(kSlot / 64), 0);
+  EXPECT_EQ(__machnet_channel_notify(channel->ctx()), 0);
+  EXPECT_EQ(__machnet_channel_notify(channel->ctx()), 0);
+  EXPECT_EQ(bitmap.Collect(0), 0);
+  EXPECT_EQ(bitmap.Collect(kSlot / 64), 1ULL << (kSlot % 64));
+  EXPECT_EQ(bitmap.Collect(kSlot / 64), 0);
+
+  channel->ctx()->doorbell.app_pending = nullptr;
+  munmap(app_bitmap, sizeof(MachnetPendingBitmap_t));
+}
+
+TEST(BasicChannelTest, QueuePairs) {
+  const uint32_t kChannelRingSize = 1 << 4;  // 16 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const uint32_t kQueuePairsNr = 2;
+
+  juggler::shm::ChannelManager<juggler::shm::ShmChannel> channel_mgr;
+  std::string channel_name(fname);
+  EXPECT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize, kQueuePairsNr));
+  auto channel = channel_mgr.GetChannel(channel_name.c_str());
+  ASSERT_NE(channel, nullptr);
+  EXPECT_EQ(channel->GetQueuePairCount(), kQueuePairsNr);
+  auto *ctx = channel->ctx();
+
+  // The application sends on queue pair 0, on the shared ring, and on queue
+  // pair 1.
+  EXPECT_EQ(__machnet_channel_queue_claim(ctx), 0);
+  juggler::shm::MsgBufBatch batch;
+  ASSERT_TRUE(channel->MsgBufBulkAlloc(&batch, 3));
+  const auto *indices = batch.buf_indices();
+  EXPECT_EQ(__machnet_channel_queue_app_enqueue(ctx, 0, 1, &indices[0]), 1);
+  EXPECT_EQ(__machnet_channel_app_ring_enqueue(ctx, 1, &indices[1]), 1);
+  EXPECT_EQ(__machnet_channel_queue_app_enqueue(ctx, 1, 1, &indices[2]), 1);
+  EXPECT_NE(__machnet_channel_engine_pending(ctx), 0);
+
+  // The engine drains all of them, and tags each with its queue pair.
+  juggler::shm::MsgBufBatch rx_batch;
+  EXPECT_EQ(channel->DequeueMessages(&rx_batch), 3);
+  EXPECT_EQ(__machnet_channel_engine_pending(ctx), 0);
+  for (uint32_t i = 0; i < 3; i++) {
+    const auto *msgbuf = channel->GetMsgBuf(indices[i]);
+    EXPECT_EQ(msgbuf->queue(), i == 1 ? MACHNET_CHANNEL_QUEUE_SHARED : i / 2);
+  }
+
+  // Messages are delivered to claimed queue pairs only.
+  EXPECT_EQ(channel->GetDeliveryQueue(0), 0);
+  EXPECT_EQ(channel->GetDeliveryQueue(1), MACHNET_CHANNEL_QUEUE_SHARED);
+  EXPECT_EQ(channel->EnqueueMessages(&batch.bufs()[0], 1, 0), 1);
+  EXPECT_EQ(channel->EnqueueMessages(&batch.bufs()[1], 1, 1), 1);
+  EXPECT_EQ(__machnet_channel_machnet_ring_pending(ctx), 1);
+  MachnetRingSlot_t index;
+  EXPECT_EQ(__machnet_channel_queue_machnet_dequeue(ctx, 0, 1, &index), 1);
+  EXPECT_EQ(index, indices[0]);
+
+  __machnet_channel_queue_release(ctx, 0);
+  EXPECT_EQ(channel->GetDeliveryQueue(0), MACHNET_CHANNEL_QUEUE_SHARED);
+  EXPECT_TRUE(channel->MsgBufBulkFree(&batch));
+}
+
 TEST(ChannelFullDuplex, SendRecvMsg) {
   const std::chrono::milliseconds kTimeoutMs =
       std::chrono::milliseconds(60 * 1000);   // 60 seconds.
@@ -335,16 +512,10 @@ TEST(ChannelFullDuplex, SendRecvMsg) {
     std::vector<MachnetRingSlot_t> buffers;
     uint32_t buffers_size = channel->GetTotalBufCount();
 
-    // Allocate all the buffers in the channel in 3 parts
-    // Allocate from ctx->cache
-    uint32_t current_buffers_cnt;
-    auto ctx = channel->ctx();
-    while (ctx->app_buffer_cache.count > 0)
-      buffers.push_back(
-          ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count]);
-    current_buffers_cnt = buffers.size();
+    // Allocate all the buffers in the channel in 2 parts (the child returned
+    // the buffers cached by its threads when it exited).
     // Allocate from shm::channel->cache
-    current_buffers_cnt += channel->GetAllCachedBufferIndices(&buffers);
+    uint32_t current_buffers_cnt = channel->GetAllCachedBufferIndices(&buffers);
     // Allocate from ring
     buffers.resize(buffers_size);
     current_buffers_cnt += __machnet_channel_buf_alloc_bulk(
@@ -0,0 +1,91 @@
+/**
+ * @file flow_table_bench.cc
+ * @brief Benchmark of flow lookups as the number of flows per engine grows:
+ * the engine's `FlowTable' against the `std::unordered_map' (plus list
+ * iterator indirection) it replaced.
+ */
+#include <benchmark/benchmark.h>
+#include <flow_key.h>
+#include <flow_table.h>
+#include <glog/logging.h>
+#include <perf_benchmark.h>
+
+#include <list>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using juggler::net::flow::Flow;
+using juggler::net::flow::FlowTable;
+using juggler::net::flow::Key;
+
+// Number of lookups issued per benchmark iteration.
+static constexpr size_t kLookupsNr = 1 << 12;
+
+struct FlowSet {
+  explicit FlowSet(size_t flows_nr) {
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < flows_nr; i++) {
+      keys.emplace_back(static_cast<uint32_t>(rng()),
+                        static_cast<uint16_t>(rng()),
+                        static_cast<uint32_t>(rng()),
+                        static_cast<uint16_t>(rng()));
+      hashes.emplace_back(rng());
+    }
+    // Random lookup order, so that consecutive lookups do not share lines.
+    for (size_t i = 0; i < kLookupsNr; i++) {
+      order.emplace_back(rng() % flows_nr);
+    }
+  }
+  std::vector<Key> keys;
+  std::vector<uint32_t> hashes;
+  std::vector<size_t> order;
+};
+
+static void BM_FlowTableLookup(benchmark::State &st) {  // NOLINT
+  const auto flows_nr = static_cast<size_t>(st.range(0));
+  FlowSet set(flows_nr);
+  FlowTable table;
+  for (size_t i = 0; i < flows_nr; i++) {
+    CHECK(table.Insert(set.keys[i], set.hashes[i],
+                       reinterpret_cast<Flow *>((i + 1) * sizeof(void *))));
+  }
+
+  for (auto _ : st) {
+    for (const auto idx : set.order) {
+      benchmark::DoNotOptimize(table.Find(set.keys[idx], set.hashes[idx]));
+    }
+  }
+  st.SetItemsProcessed(st.iterations() * kLookupsNr);
+}
+
+static void BM_UnorderedMapLookup(benchmark::State &st) {  // NOLINT
+  const auto flows_nr = static_cast<size_t>(st.range(0));
+  FlowSet set(flows_nr);
+  // Mirrors the previous engine layout: map from key to a list iterator that
+  // points to the owning `unique_ptr'.
+  std::list<std::unique_ptr<uint64_t>> flows;
+  std::unordered_map<Key,
+                     const std::list<std::unique_ptr<uint64_t>>::const_iterator>
+      map;
+  for (size_t i = 0; i < flows_nr; i++) {
+    flows.emplace_back(std::make_unique<uint64_t>(i));
+    map.emplace(set.keys[i], std::prev(flows.end()));
+  }
+
+  for (auto _ : st) {
+    for (const auto idx : set.order) {
+      const auto it = map.find(set.keys[idx]);
+      benchmark::DoNotOptimize(**it->second);
+    }
+  }
+  st.SetItemsProcessed(st.iterations() * kLookupsNr);
+}
+
+BENCHMARK(BM_FlowTableLookup)->RangeMultiplier(4)->Range(1 << 6, 1 << 20);
+BENCHMARK(BM_UnorderedMapLookup)->RangeMultiplier(4)->Range(1 << 6, 1 << 20);
+
+int main(int argc, char **argv) {
+  return juggler::perf::BenchmarkMain("flow_table_bench", argc, argv);
+}
@@ -0,0 +1,141 @@
+/**
+ * @file flow_table_test.cc
+ *
+ * Unit tests for the engine's flow table.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "flow_key.h"
+#include "flow_table.h"
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class FlowTableTest : public ::testing::Test {
+ protected:
+  FlowTableTest() : rng_(std::random_device{}()) {}  // NOLINT
+
+  Key RandomKey() {
+    return Key(static_cast<uint32_t>(rng_()), static_cast<uint16_t>(rng_()),
+               static_cast<uint32_t>(rng_()), static_cast<uint16_t>(rng_()));
+  }
+
+  // Flows are opaque to the table; any distinct non-null pointer will do.
+  static Flow *FakeFlow(size_t i) {
+    return reinterpret_cast<Flow *>((i + 1) * sizeof(void *));
+  }
+
+  std::mt19937 rng_;
+};
+
+TEST_F(FlowTableTest, InsertFindErase) {
+  FlowTable table;
+  const Key key(0x0a000001, 1234, 0x0a000002, 888);
+  const uint32_t hash = 0xdeadbeef;
+
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.Find(key, hash), nullptr);
+  EXPECT_TRUE(table.Insert(key, hash, FakeFlow(0)));
+  EXPECT_FALSE(table.Insert(key, hash, FakeFlow(1)));
+  EXPECT_EQ(table.size(), 1);
+  EXPECT_EQ(table.Find(key, hash), FakeFlow(0));
+
+  // A lookup with a different hash must not match.
+  EXPECT_EQ(table.Find(key, hash + 1), nullptr);
+
+  EXPECT_TRUE(table.Erase(key, hash));
+  EXPECT_FALSE(table.Erase(key, hash));
+  EXPECT_EQ(table.Find(key, hash), nullptr);
+  EXPECT_TRUE(table.empty());
+}
+
+TEST_F(FlowTableTest, SameHashDifferentKeys) {
+  // All keys share one hash (i.e., one probe sequence and tag).
+  FlowTable table(FlowTable::kGroupSize);
+  const uint32_t hash = 0x12345678;
+  const size_t kFlowsNr = FlowTable::kGroupSize * 8;
+  std::vector<Key> keys;
+  for (size_t i = 0; i < kFlowsNr; i++) {
+    keys.emplace_back(0x0a000001, static_cast<uint16_t>(i), 0x0a000002, 888);
+    EXPECT_TRUE(table.Insert(keys.back(), hash, FakeFlow(i)));
+  }
+
+  for (size_t i = 0; i < kFlowsNr; i++) {
+    EXPECT_EQ(table.Find(keys[i], hash), FakeFlow(i));
+  }
+
+  // Erase every other key; the remaining ones must still be reachable across
+  // the resulting tombstones.
+  for (size_t i = 0; i < kFlowsNr; i += 2) {
+    EXPECT_TRUE(table.Erase(keys[i], hash));
+  }
+  for (size_t i = 0; i < kFlowsNr; i++) {
+    EXPECT_EQ(table.Find(keys[i], hash), i % 2 ? FakeFlow(i) : nullptr);
+  }
+}
+
+TEST_F(FlowTableTest, RandomizedAgainstUnorderedMap) {
+  FlowTable table(FlowTable::kGroupSize);
+  std::unordered_map<Key, std::pair<uint32_t, Flow *>> reference;
+  const size_t kOpsNr = 1 << 16;
+
+  for (size_t i = 0; i < kOpsNr; i++) {
+    if (reference.empty() || rng_() % 3 != 0) {
+      const auto key = RandomKey();
+      // Emulate RSS hashes of flows landing on the same queue: low bits fixed.
+      const uint32_t hash = (rng_() & ~0x7fu) | 0x5;
+      const auto inserted = table.Insert(key, hash, FakeFlow(i));
+      EXPECT_EQ(inserted, reference.find(key) == reference.end());
+      if (inserted) reference.insert({key, {hash, FakeFlow(i)}});
+    } else {
+      auto it = reference.begin();
+      std::advance(it, rng_() % std::min<size_t>(reference.size(), 16));
+      EXPECT_TRUE(table.Erase(it->first, it->second.first));
+      reference.erase(it);
+    }
+  }
+
+  EXPECT_EQ(table.size(), reference.size());
+  for (const auto &[key, value] : reference) {
+    EXPECT_EQ(table.Find(key, value.first), value.second);
+  }
+
+  size_t visited = 0;
+  table.ForEach([&](const Key &key, uint32_t hash, Flow *flow) {
+    const auto it = reference.find(key);
+    ASSERT_NE(it, reference.end());
+    EXPECT_EQ(it->second.first, hash);
+    EXPECT_EQ(it->second.second, flow);
+    visited++;
+  });
+  EXPECT_EQ(visited, reference.size());
+}
+
+TEST_F(FlowTableTest, EraseWhileIterating) {
+  FlowTable table;
+  const size_t kFlowsNr = 4096;
+  for (size_t i = 0; i < kFlowsNr; i++) {
+    EXPECT_TRUE(table.Insert(RandomKey(), rng_(), FakeFlow(i)));
+  }
+
+  table.ForEach([&table](const Key &key, uint32_t hash, Flow *) {
+    EXPECT_TRUE(table.Erase(key, hash));
+  });
+  EXPECT_TRUE(table.empty());
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
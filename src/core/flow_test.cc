@@ -8,8 +8,11 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include <random>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "channel.h"
@@ -50,6 +53,7 @@ class FlowTest : public ::testing::Test {
   const uint32_t kBufferRingSize = 1 << 13;  // 8K Buffers.
   const uint32_t kBufferSize = 1 << 11;      // 2KB for each buffer.
   const uint32_t kMbufsNr = 1 << 13;         // 8K mbufs.
+  static constexpr uint16_t kRingDescNr = 512;
 
   FlowTest()
       : rng_(std::random_device{}()),  // NOLINT
@@ -62,6 +66,14 @@ class FlowTest : public ::testing::Test {
     remote_port_.port = be16_t(kRemotePort);
   }
 
+  // The null port flows send to (see `CreateEstablishedFlow').
+  static void SetUpTestSuite() {
+    pmd_port_ = std::make_shared<dpdk::PmdPort>(0, 1, 1, kRingDescNr,
+                                                kRingDescNr);
+    pmd_port_->InitDriver();
+  }
+  static void TearDownTestSuite() { pmd_port_.reset(); }
+
   void SetUp() override {
     CHECK_EQ(channel_mgr_.AddChannel(fname, kChannelRingSize, kChannelRingSize,
                                      kBufferRingSize, kBufferSize),
@@ -75,9 +87,12 @@ class FlowTest : public ::testing::Test {
     pkt_pool_ = std::make_unique<dpdk::PacketPool>(
         kMbufsNr, dpdk::PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
                       RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+    txbatch_ = std::make_unique<dpdk::TxBatch>(
+        pmd_port_->GetRing<dpdk::TxRing>(0));
   }
 
   void TearDown() override {
+    txbatch_.reset();
     pkt_pool_.reset();
     rx_tracking_.reset();
     tx_tracking_.reset();
@@ -166,6 +181,7 @@ class FlowTest : public ::testing::Test {
           std::min(max_packet_payload_size, data.size() - data_offset);
       auto *eh = CHECK_NOTNULL(
           packet->append<net::Ethernet *>(payload_size + packet_hdr_size));
+      std::memset(eh, 0, packet_hdr_size);
 
       // We do not need to fill in the Ethernet, Ipv4, and UDP headers, as
       // they are not used by the RXQeueue.
@@ -193,6 +209,129 @@ class FlowTest : public ::testing::Test {
     return packets;
   }
 
+  /**
+   * @brief Creates a flow between the test addresses, closed, on the channel
+   * of the fixture. Its packets go to the null port through `txbatch_'.
+   *
+   * @param max_window Receive window of the flow (see `Flow::SetMaxWindow').
+   */
+  std::unique_ptr<Flow> CreateFlow(uint32_t max_window = Flow::kDefaultWindow) {
+    auto flow = std::make_unique<Flow>(
+        local_addr_, local_port_, remote_addr_, remote_port_,
+        pmd_port_->GetL2Addr(), pmd_port_->GetL2Addr(), txbatch_.get(),
+        [](shm::Channel *, bool, const Key &) {}, swift::Algorithm::kSwift,
+        channel_.get());
+    flow->SetMaxWindow(max_window);
+    return flow;
+  }
+
+  // Same as `CreateFlow', but the flow is established.
+  std::unique_ptr<Flow> CreateEstablishedFlow(
+      uint32_t max_window = Flow::kDefaultWindow) {
+    auto flow = CreateFlow(max_window);
+    flow->SetState(Flow::State::kEstablished);
+    return flow;
+  }
+
+  /**
+   * @brief Creates a SYN packet from the peer, with `options' as its payload,
+   * or none if nullptr.
+   */
+  dpdk::Packet *CreateSynPacket(const net::MachnetSynOptions *options) {
+    constexpr auto packet_hdr_size = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                                     sizeof(net::Udp) +
+                                     sizeof(net::MachnetPktHdr);
+    const size_t options_size = options != nullptr ? sizeof(*options) : 0;
+    auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+    auto *eh = CHECK_NOTNULL(
+        packet->append<uint8_t *>(packet_hdr_size + options_size));
+    std::memset(eh, 0, packet_hdr_size);
+    auto *machneth = reinterpret_cast<net::MachnetPktHdr *>(
+        eh + packet_hdr_size - sizeof(net::MachnetPktHdr));
+    machneth->magic = be16_t(net::MachnetPktHdr::kMagic);
+    machneth->net_flags = net::MachnetPktHdr::MachnetFlags::kSyn;
+    if (options != nullptr) std::memcpy(machneth + 1, options, options_size);
+    return packet;
+  }
+
+  /**
+   * @brief Creates the data packets of `nb_msgs' single-packet messages the
+   * peer of `flow' sends, from sequence number `seqno' on.
+   */
+  std::vector<dpdk::Packet *> CreateDataPackets(uint32_t seqno,
+                                                size_t nb_msgs) {
+    swift::Pcb peer_pcb;
+    peer_pcb.snd_nxt = seqno;
+    std::vector<dpdk::Packet *> packets;
+    for (size_t i = 0; i < nb_msgs; i++) {
+      const std::vector<uint8_t> data(64, static_cast<uint8_t>(i));
+      const auto train = CreatePacketTrain(&peer_pcb, data);
+      packets.insert(packets.end(), train.begin(), train.end());
+    }
+    return packets;
+  }
+
+  /**
+   * @brief Has `flow' process `packets' as one RX burst, and frees them.
+   * @return True if the flow asks for its timers to be polled.
+   */
+  static bool InputBurst(Flow *flow,
+                         const std::vector<dpdk::Packet *> &packets,
+                         uint64_t now = time::rdtsc()) {
+    const bool timers =
+        flow->InputPackets(packets.data(), packets.size(), now);
+    for (auto *packet : packets) dpdk::Packet::Free(packet);
+    return timers;
+  }
+
+  /**
+   * @brief Creates an established flow that initiated its handshake over
+   * `paths_nr' paths, all of which the peer took (see `Flow::SetMultipath').
+   * The ports of the paths beyond the first follow `kLocalPort'.
+   */
+  std::unique_ptr<Flow> CreateMultipathFlow(size_t paths_nr,
+                                            uint64_t flowlet_gap_ns) {
+    std::vector<Udp::Port> ports;
+    for (size_t i = 1; i < paths_nr; i++) ports.emplace_back(kLocalPort + i);
+    auto flow = CreateFlow();
+    flow->SetMultipath(paths_nr, flowlet_gap_ns, ports);
+    flow->SetState(Flow::State::kSynSent);
+    net::MachnetSynOptions options{};
+    options.window = be32_t(Flow::kDefaultWindow);
+    options.mss = be16_t(flow->GetLocalMss());
+    options.paths_nr = paths_nr;
+    auto *syn_ack = CreateSynPacket(&options);
+    CHECK(flow->ProcessSynOptions(syn_ack));
+    dpdk::Packet::Free(syn_ack);
+    flow->SetState(Flow::State::kEstablished);
+    return flow;
+  }
+
+  // Receives a message delivered to the channel; empty if there is none.
+  std::vector<uint8_t> ReceiveMessage() {
+    std::vector<uint8_t> rx_message(kBufferSize);
+    MachnetIovec_t rx_iov{rx_message.data(), rx_message.size()};
+    MachnetMsgHdr_t rx_msghdr{};
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    if (machnet_recvmsg(channel_->ctx(), &rx_msghdr) != 1) return {};
+    rx_message.resize(rx_msghdr.msg_size);
+    return rx_message;
+  }
+
+  // Receives the messages delivered to the channel, and returns how many.
+  size_t DrainChannel() {
+    size_t msgs_nr = 0;
+    while (!ReceiveMessage().empty()) msgs_nr++;
+    return msgs_nr;
+  }
+
+  // Number of packets the flows of the test sent so far, ACKs included.
+  uint64_t SentPacketsNr() const {
+    return txbatch_->GetPacketCount() + txbatch_->GetSize();
+  }
+
+  inline static std::shared_ptr<dpdk::PmdPort> pmd_port_;
   Ipv4::Address local_addr_;
   Udp::Port local_port_;
   Ipv4::Address remote_addr_;
@@ -203,6 +342,7 @@ class FlowTest : public ::testing::Test {
   std::unique_ptr<TXTracking> tx_tracking_;
   std::unique_ptr<RXTracking> rx_tracking_;
   std::unique_ptr<dpdk::PacketPool> pkt_pool_;
+  std::unique_ptr<dpdk::TxBatch> txbatch_;
 };
 
 TEST_F(FlowTest, TXQueue_init) {
@@ -270,6 +410,197 @@ TEST_F(FlowTest, TXQueue_PushPop) {
   EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 }
 
+TEST_F(FlowTest, TXQueue_NotifyDelivery) {
+  // Three messages of three buffers each; the first and the last ask for a
+  // completion.
+  const std::vector<uint8_t> data(3 * channel_->GetUsableBufSize());
+  for (uint16_t i = 0; i < 3; i++) {
+    auto *msgbuf = CreateMsg(data);
+    msgbuf->set_dst_port(i);
+    if (i != 1) msgbuf->add_flags(MACHNET_MSGBUF_NOTIFY_DELIVERY);
+    ASSERT_TRUE(tx_tracking_->Append(msgbuf));
+  }
+  while (tx_tracking_->GetAndUpdateOldestUnsent().has_value()) {
+  }
+
+  auto *ctx = channel_->ctx();
+  MachnetTxCompletion_t compls[4];
+  // Not until the last buffer of the message is acknowledged.
+  tx_tracking_->ReceiveAcks(2);
+  EXPECT_EQ(__machnet_channel_tx_compl_dequeue(ctx, 4, compls), 0);
+  tx_tracking_->ReceiveAcks(5);
+  ASSERT_EQ(__machnet_channel_tx_compl_dequeue(ctx, 4, compls), 1);
+  EXPECT_EQ(compls[0].flow.dst_port, 0);
+  EXPECT_EQ(compls[0].msg_len, data.size());
+  EXPECT_EQ(compls[0].status, MACHNET_TX_COMPL_DELIVERED);
+  tx_tracking_->ReceiveAcks(2);
+  ASSERT_EQ(__machnet_channel_tx_compl_dequeue(ctx, 4, compls), 1);
+  EXPECT_EQ(compls[0].flow.dst_port, 2);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+}
+
+TEST_F(FlowTest, Aggregation) {
+  constexpr uint32_t kMaxLen = 64;
+  const auto free_nr = channel_->GetFreeBufCount();
+  tx_tracking_->SetAggregation(kMaxLen);
+
+  // Small messages share a buffer; others close it.
+  std::vector<std::vector<uint8_t>> msgs;
+  for (uint32_t len = 1; len <= kMaxLen; len *= 2) {
+    msgs.emplace_back(len);
+    std::generate(msgs.back().begin(), msgs.back().end(), std::rand);
+    ASSERT_TRUE(tx_tracking_->Append(CreateMsg(msgs.back())));
+  }
+  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), 1);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - 1);
+  auto *notify = CreateMsg(msgs[0]);
+  notify->add_flags(MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  ASSERT_TRUE(tx_tracking_->Append(notify));
+  ASSERT_TRUE(tx_tracking_->Append(CreateMsg(msgs[0])));
+  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), 3);
+  EXPECT_EQ(tx_tracking_->GetOpenAggregate(), tx_tracking_->GetLastMsgBuf());
+
+  auto *agg = tx_tracking_->GetAndUpdateOldestUnsent().value();
+  EXPECT_TRUE(agg->is_first() && agg->is_last());
+  EXPECT_TRUE(agg->flags() & MACHNET_MSGBUF_FLAGS_AGGREGATE);
+  EXPECT_FALSE(tx_tracking_->GetOldestUnsentMsgBuf()->flags() &
+               MACHNET_MSGBUF_FLAGS_AGGREGATE);
+
+  // The peer splits the packet into the messages.
+  swift::Pcb rx_pcb;
+  const auto rcv_nxt = rx_pcb.get_rcv_nxt();
+  constexpr auto packet_hdr_size = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                                   sizeof(net::Udp) +
+                                   sizeof(net::MachnetPktHdr);
+  auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+  auto *eh = CHECK_NOTNULL(
+      packet->append<net::Ethernet *>(packet_hdr_size + agg->length()));
+  auto *machneth = reinterpret_cast<net::MachnetPktHdr *>(
+      reinterpret_cast<uint8_t *>(eh) + packet_hdr_size -
+      sizeof(net::MachnetPktHdr));
+  machneth->magic = be16_t(net::MachnetPktHdr::kMagic);
+  machneth->net_flags = net::MachnetPktHdr::MachnetFlags::kData;
+  machneth->seqno = be32_t(rcv_nxt);
+  machneth->msg_flags = agg->flags();
+  utils::Copy(machneth + 1, agg->head_data<uint8_t *>(), agg->length());
+
+  const auto *stats = channel_->GetEngineStats();
+  const auto rx_msgs = stats->rx_msgs;
+  EXPECT_EQ(rx_tracking_->Consume(&rx_pcb, packet), 0);
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), rcv_nxt + 1);
+  EXPECT_EQ(stats->rx_msgs, rx_msgs + msgs.size());
+  for (const auto &msg : msgs) {
+    std::vector<uint8_t> rx_message(kMaxLen);
+    MachnetIovec_t rx_iov{rx_message.data(), rx_message.size()};
+    MachnetMsgHdr_t rx_msghdr{};
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    ASSERT_EQ(machnet_recvmsg(channel_->ctx(), &rx_msghdr), 1);
+    EXPECT_EQ(rx_msghdr.msg_size, msg.size());
+    rx_message.resize(msg.size());
+    EXPECT_EQ(rx_message, msg);
+  }
+  dpdk::Packet::Free(packet);
+
+  while (tx_tracking_->GetAndUpdateOldestUnsent().has_value()) {
+  }
+  tx_tracking_->ReceiveAcks(3);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr);
+}
+
+TEST_F(FlowTest, TXQueue_Resegment) {
+  // Below the size of the channel buffers, messages are copied into buffers
+  // of up to the MSS, one packet each.
+  constexpr uint32_t kMss = 500;
+  const auto free_nr = channel_->GetFreeBufCount();
+  tx_tracking_->SetMss(kMss);
+  ASSERT_EQ(tx_tracking_->GetMss(), kMss);
+
+  std::vector<std::vector<uint8_t>> msgs;
+  for (const size_t len : {size_t{2} * channel_->GetUsableBufSize() + 100,
+                           size_t{kMss}, size_t{kMss} + 1, size_t{1}}) {
+    msgs.emplace_back(len);
+    std::generate(msgs.back().begin(), msgs.back().end(), std::rand);
+    ASSERT_TRUE(tx_tracking_->Append(CreateMsg(msgs.back())));
+  }
+  size_t buffers_nr = 0;
+  for (const auto &msg : msgs) buffers_nr += (msg.size() + kMss - 1) / kMss;
+  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), buffers_nr);
+  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), buffers_nr);
+  // The original buffers are freed.
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - buffers_nr);
+
+  // Each message is in order, in a chain of full buffers but the last.
+  for (const auto &msg : msgs) {
+    std::vector<uint8_t> tx_message;
+    const size_t msg_buffers_nr = (msg.size() + kMss - 1) / kMss;
+    for (size_t i = 0; i < msg_buffers_nr; i++) {
+      auto *msgbuf = tx_tracking_->GetAndUpdateOldestUnsent().value();
+      const bool last = i + 1 == msg_buffers_nr;
+      EXPECT_EQ(msgbuf->is_first(), i == 0);
+      EXPECT_EQ(msgbuf->is_last(), last);
+      EXPECT_EQ(msgbuf->is_sg(), !last);
+      if (i == 0) EXPECT_EQ(msgbuf->msg_length(), msg.size());
+      EXPECT_EQ(msgbuf->length(), last ? msg.size() - i * kMss : kMss);
+      const auto *data = msgbuf->head_data<uint8_t *>();
+      tx_message.insert(tx_message.end(), data, data + msgbuf->length());
+    }
+    EXPECT_EQ(tx_message, msg);
+  }
+  EXPECT_FALSE(tx_tracking_->GetAndUpdateOldestUnsent().has_value());
+
+  tx_tracking_->ReceiveAcks(buffers_nr);
+  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), 0u);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr);
+}
+
+TEST_F(FlowTest, MssNegotiation) {
+  auto flow = CreateFlow();
+  const uint32_t local_mss = flow->GetLocalMss();
+  EXPECT_EQ(flow->tx_tracking_.GetMss(), local_mss);
+
+  // The MSS of a peer that takes larger packets leaves the local one.
+  net::MachnetSynOptions options{};
+  options.window = be32_t(Flow::kDefaultWindow);
+  options.mss = be16_t(local_mss + 100);
+  options.paths_nr = 1;
+  auto *syn = CreateSynPacket(&options);
+  EXPECT_TRUE(flow->ProcessSynOptions(syn));
+  dpdk::Packet::Free(syn);
+  EXPECT_EQ(flow->tx_tracking_.GetMss(), local_mss);
+
+  // A smaller one is taken.
+  constexpr uint16_t kPeerMss = 700;
+  options.mss = be16_t(kPeerMss);
+  syn = CreateSynPacket(&options);
+  EXPECT_TRUE(flow->ProcessSynOptions(syn));
+  dpdk::Packet::Free(syn);
+  EXPECT_EQ(flow->tx_tracking_.GetMss(), kPeerMss);
+
+  // The MSS never grows back, e.g., on a retransmitted SYN of an older peer,
+  // without options, that gets the default.
+  syn = CreateSynPacket(nullptr);
+  EXPECT_TRUE(flow->ProcessSynOptions(syn));
+  dpdk::Packet::Free(syn);
+  EXPECT_GT(flow->GetDefaultMss(), kPeerMss);
+  EXPECT_EQ(flow->tx_tracking_.GetMss(), kPeerMss);
+
+  // Messages are cut into packets of up to the MSS.
+  const auto free_nr = channel_->GetFreeBufCount();
+  const std::vector<uint8_t> msg(3 * kPeerMss + 1, 7);
+  ASSERT_TRUE(flow->tx_tracking_.Append(CreateMsg(msg)));
+  EXPECT_EQ(flow->tx_tracking_.NumUnsentMsgbufs(), 4u);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - 4);
+  uint32_t len = 0;
+  while (auto msgbuf = flow->tx_tracking_.GetAndUpdateOldestUnsent()) {
+    EXPECT_LE(msgbuf.value()->length(), kPeerMss);
+    len += msgbuf.value()->length();
+  }
+  EXPECT_EQ(len, msg.size());
+  flow->tx_tracking_.ReceiveAcks(4);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr);
+}
+
 TEST_F(FlowTest, RXQueue_Push) {
   std::mt19937 engine(rng_);
   std::uniform_int_distribution<std::mt19937::result_type> dist(
@@ -289,6 +620,9 @@ TEST_F(FlowTest, RXQueue_Push) {
 
     swift::Pcb rx_pcb;
     auto buffers_used = 0;
+    const auto *stats = channel_->GetEngineStats();
+    const auto rx_msgs = stats->rx_msgs;
+    const auto rx_bytes = stats->rx_bytes;
     // Push the packets into the RX queue.
     for (auto &pkt : packets) {
       auto prev_rcv_nxt = rx_pcb.get_rcv_nxt();
@@ -303,6 +637,9 @@ TEST_F(FlowTest, RXQueue_Push) {
     }
 
     // At this point the message should have been delivered to the application.
+    EXPECT_EQ(stats->rx_msgs, rx_msgs + 1);
+    EXPECT_EQ(stats->rx_bytes, rx_bytes + msg_len);
+    EXPECT_EQ(stats->rx_ring_full, 0);
     std::vector<uint8_t> rx_message(msg_len);
     MachnetIovec_t rx_iov;
     rx_iov.base = rx_message.data();
@@ -503,6 +840,405 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
   }
 }
 
+TEST_F(FlowTest, RXQueue_ZeroCopy) {
+  // With zero-copy RX, the engine lends channel buffers to the packets of its
+  // RX queue (see `MachnetEngine::RxZeroCopyRefill'), and the NIC receives
+  // into them.
+  constexpr size_t kHdrLen = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                             sizeof(net::Udp) + sizeof(net::MachnetPktHdr);
+  constexpr size_t kMsgsNr = 8;
+  const auto free_nr = channel_->GetFreeBufCount();
+  auto packets = CreateDataPackets(0, kMsgsNr);
+  std::vector<const uint8_t *> payloads;
+  for (auto *packet : packets) {
+    const auto *frame = packet->head_data<uint8_t *>();
+    const std::vector<uint8_t> data(frame, frame + packet->length());
+    auto *msgbuf = CHECK_NOTNULL(channel_->MsgBufAlloc());
+    packet->set_buf(msgbuf->base(), msgbuf->iova(), msgbuf->size());
+    auto *rx_frame = CHECK_NOTNULL(packet->append<uint8_t *>(data.size()));
+    std::memcpy(rx_frame, data.data(), data.size());
+    payloads.push_back(rx_frame + kHdrLen);
+  }
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - kMsgsNr);
+
+  // The flow hands each buffer over as is, and lends the packet another.
+  swift::Pcb rx_pcb;
+  for (auto *packet : packets) {
+    const auto *lent = channel_->GetMsgBufByBase(packet->buf_addr());
+    ASSERT_NE(lent, nullptr);
+    EXPECT_EQ(rx_tracking_->Consume(&rx_pcb, packet), 0);
+    const auto *fresh = channel_->GetMsgBufByBase(packet->buf_addr());
+    EXPECT_NE(fresh, nullptr);
+    EXPECT_NE(fresh, lent);
+  }
+  EXPECT_EQ(rx_pcb.get_rcv_nxt(), kMsgsNr);
+  // As many buffers are lent to the packets as before, and the messages
+  // delivered hold the others.
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - 2 * kMsgsNr);
+
+  // The application reads the payloads where the NIC put them.
+  for (size_t i = 0; i < kMsgsNr; i++) {
+    MachnetIovec_t rx_iov{};
+    MachnetMsg_t rx_msg{};
+    rx_msg.msg_iov = &rx_iov;
+    rx_msg.msg_iovlen = 1;
+    ASSERT_EQ(machnet_recvmsg_zc(channel_->ctx(), &rx_msg), 1);
+    ASSERT_EQ(rx_msg.msg_iovlen, 1u);
+    EXPECT_EQ(rx_iov.base, payloads[i]);
+    const std::vector<uint8_t> data(64, static_cast<uint8_t>(i));
+    EXPECT_EQ(rx_iov.len, data.size());
+    EXPECT_EQ(std::memcmp(rx_iov.base, data.data(), data.size()), 0);
+    machnet_msg_release(channel_->ctx(), &rx_msg);
+  }
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr - kMsgsNr);
+
+  // Freed packets keep the buffers they were lent, until the engine takes
+  // them back from the pool (see `MachnetEngine::RxZeroCopyStop').
+  for (auto *packet : packets) dpdk::Packet::Free(packet);
+  std::pair<shm::Channel *, uint32_t> arg{channel_.get(), 0};
+  rte_mempool_obj_iter(
+      pkt_pool_->GetMemPool(),
+      [](rte_mempool *, void *opaque, void *obj, unsigned int) {
+        auto *arg = static_cast<std::pair<shm::Channel *, uint32_t> *>(opaque);
+        auto *pkt = static_cast<dpdk::Packet *>(obj);
+        auto *msgbuf = arg->first->GetMsgBufByBase(pkt->buf_addr());
+        if (msgbuf == nullptr) return;
+        CHECK(arg->first->MsgBufFree(msgbuf));
+        dpdk::Packet::Reset(pkt);
+        arg->second++;
+      },
+      &arg);
+  EXPECT_EQ(arg.second, kMsgsNr);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr);
+}
+
+TEST_F(FlowTest, AckPolicy_PerBurst) {
+  auto flow = CreateEstablishedFlow();
+  const uint32_t rcv_nxt = flow->pcb_.rcv_nxt;
+
+  // By default, a burst of in-order packets gets a single cumulative ACK.
+  const auto sent_nr = SentPacketsNr();
+  EXPECT_FALSE(InputBurst(flow.get(), CreateDataPackets(rcv_nxt, 8)));
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 8);
+  EXPECT_EQ(flow->pending_acks_, 0);
+  EXPECT_EQ(flow->ack_deadline_, 0);
+
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 8, 3));
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 2);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 11);
+}
+
+TEST_F(FlowTest, AckPolicy_EveryN) {
+  auto flow = CreateEstablishedFlow();
+  const uint32_t rcv_nxt = flow->pcb_.rcv_nxt;
+
+  // An ACK every 4 packets within the burst, and one for the rest at its end.
+  flow->SetAckPolicy(4, 0);
+  auto sent_nr = SentPacketsNr();
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt, 10));
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 3);
+  EXPECT_EQ(flow->pending_acks_, 0);
+
+  // With a delay, the rest waits for the deadline, or the next 4th packet.
+  const uint64_t kDelayUs = 1000;
+  flow->SetAckPolicy(4, kDelayUs);
+  sent_nr = SentPacketsNr();
+  const uint64_t now = time::rdtsc();
+  EXPECT_TRUE(InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 10, 2), now));
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+  EXPECT_EQ(flow->pending_acks_, 2);
+  EXPECT_EQ(flow->ack_deadline_, now + time::us_to_cycles(kDelayUs));
+  EXPECT_TRUE(flow->TimerCheck(now));
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 12, 2), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_EQ(flow->ack_deadline_, 0);
+
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 14, 1), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_NE(flow->ack_deadline_, 0);
+  EXPECT_FALSE(flow->TimerCheck(flow->ack_deadline_));
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 2);
+  EXPECT_EQ(flow->pending_acks_, 0);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 15);
+}
+
+TEST_F(FlowTest, AckPolicy_OutOfOrder) {
+  auto flow = CreateEstablishedFlow();
+  const uint32_t rcv_nxt = flow->pcb_.rcv_nxt;
+  flow->SetAckPolicy(16, 1000);
+  const uint64_t now = time::rdtsc();
+
+  // In-order packets wait for the delayed ACK.
+  auto sent_nr = SentPacketsNr();
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt, 2), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+  EXPECT_EQ(flow->pending_acks_, 2);
+
+  // A packet past a gap is acknowledged at once, and so is each one while the
+  // gap lasts, for the sender to detect the loss.
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 3, 1), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_EQ(flow->pending_acks_, 0);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 2);
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 4, 1), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 2);
+
+  // So is the packet that fills the gap.
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt + 2, 1), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 3);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 5);
+
+  // And a duplicate.
+  InputBurst(flow.get(), CreateDataPackets(rcv_nxt, 1), now);
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 4);
+  EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + 5);
+  EXPECT_EQ(flow->ack_deadline_, 0);
+}
+
+TEST_F(FlowTest, RxWindow_NoPollingWhileOpen) {
+  // A window larger than the free buffers of the channel is capped to them,
+  // and needs no window update as long as the peer has room to send.
+  auto flow = CreateEstablishedFlow(Flow::kMaxWindow);
+  ASSERT_LT(channel_->GetFreeBufCount(), Flow::kMaxWindow);
+  EXPECT_FALSE(InputBurst(flow.get(), CreateDataPackets(0, 8)));
+  EXPECT_LT(flow->rcv_wnd_advertised_, Flow::kMaxWindow);
+  EXPECT_FALSE(flow->rcv_wnd_reduced_);
+  EXPECT_FALSE(flow->TimersPending());
+  EXPECT_EQ(DrainChannel(), 8);
+}
+
+TEST_F(FlowTest, RxWindow_Undelivered) {
+  // More messages than the ring to the application holds: the others wait in
+  // the flow, and the window closes.
+  constexpr uint32_t kWindow = 512;
+  constexpr size_t kMsgsNr = 300;
+  auto flow = CreateEstablishedFlow(kWindow);
+  const auto free_nr = channel_->GetFreeBufCount();
+  const auto rx_ring_full = channel_->GetEngineStats()->rx_ring_full;
+  const uint64_t now = time::rdtsc();
+  EXPECT_TRUE(InputBurst(flow.get(), CreateDataPackets(0, kMsgsNr), now));
+  EXPECT_EQ(flow->pcb_.rcv_nxt, kMsgsNr);
+  ASSERT_TRUE(flow->rx_tracking_.HasUndelivered());
+  EXPECT_GT(channel_->GetEngineStats()->rx_ring_full, rx_ring_full);
+  EXPECT_EQ(flow->rx_tracking_.GetWindow(&flow->pcb_), 0);
+  EXPECT_EQ(flow->rcv_wnd_advertised_, 0);
+  EXPECT_TRUE(flow->rcv_wnd_reduced_);
+
+  // Nothing changes until the application catches up.
+  auto sent_nr = SentPacketsNr();
+  EXPECT_TRUE(flow->TimerCheck(now));
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+
+  // Then the messages held back are delivered, and a window update goes out.
+  const size_t delivered_nr = DrainChannel();
+  EXPECT_LT(delivered_nr, kMsgsNr);
+  EXPECT_FALSE(flow->TimerCheck(now));
+  EXPECT_FALSE(flow->rx_tracking_.HasUndelivered());
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_EQ(flow->rcv_wnd_advertised_, kWindow);
+  EXPECT_FALSE(flow->rcv_wnd_reduced_);
+  EXPECT_EQ(delivered_nr + DrainChannel(), kMsgsNr);
+  EXPECT_EQ(channel_->GetFreeBufCount(), free_nr);
+}
+
+TEST_F(FlowTest, RxWindow_Probe) {
+  auto flow = CreateEstablishedFlow();
+
+  // The peer has no room: the message waits, under the persist timer.
+  flow->pcb_.snd_wnd = 0;
+  const auto snd_nxt = flow->pcb_.snd_nxt;
+  const auto rto_ns = flow->pcb_.rto_ns;
+  auto sent_nr = SentPacketsNr();
+  flow->OutputMessage(CreateMsg(std::vector<uint8_t>(100, 1)));
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+  EXPECT_EQ(flow->tx_tracking_.NumUnsentMsgbufs(), 1);
+  ASSERT_FALSE(flow->RtoDisabled());
+
+  // On expiry, a packet probes the window, and the timer backs off.
+  EXPECT_TRUE(flow->RtoCheck(flow->rto_deadline_));
+  EXPECT_EQ(SentPacketsNr(), sent_nr + 1);
+  EXPECT_EQ(flow->pcb_.snd_nxt, snd_nxt + 1);
+  EXPECT_EQ(flow->pcb_.snd_wnd, 1);
+  EXPECT_EQ(flow->pcb_.rto_ns, std::min(2 * rto_ns, swift::Pcb::kMaxRtoNs));
+  EXPECT_EQ(flow->tx_tracking_.NumUnsentMsgbufs(), 0);
+}
+
+TEST_F(FlowTest, Encryption_UniqueIv) {
+  // The IVs come from the flow, whether or not the handshake set up its keys.
+  dpdk::CryptoEngine crypto;
+  auto flow = CreateFlow();
+  flow->SetEncryption(&crypto);
+  flow->SetState(Flow::State::kEstablished);
+  constexpr size_t kIvOffset = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                               sizeof(net::Udp) + sizeof(net::MachnetPktHdr);
+  const std::vector<uint8_t> data(100, 1);
+  auto *msgbuf = CreateMsg(data);
+
+  // Each sequence number is sent, then sent again, as on retransmission.
+  std::unordered_set<uint64_t> ivs;
+  for (uint32_t i = 0; i < 16; i++) {
+    auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+    flow->PrepareDataPacket<CopyMode::kMemCopy>(msgbuf, packet, i / 2,
+                                                time::rdtsc());
+    uint64_t iv;
+    std::memcpy(&iv, packet->head_data<uint8_t *>(kIvOffset), sizeof(iv));
+    EXPECT_TRUE(ivs.insert(iv).second) << "IV " << iv << " repeated";
+    // Without keys, the payload is zeroed rather than sent in the clear.
+    const auto *payload =
+        packet->head_data<uint8_t *>(kIvOffset + dpdk::CryptoEngine::kIvLen);
+    EXPECT_TRUE(std::all_of(payload, payload + data.size(),
+                            [](uint8_t b) { return b == 0; }));
+    dpdk::Packet::Free(packet);
+  }
+  CHECK(channel_->MsgBufFree(msgbuf));
+}
+
+TEST_F(FlowTest, Multipath_Handshake) {
+  // The passive end takes up to its own number of the paths offered in the
+  // SYN, and finds the flow by the ports of the peer on them.
+  const std::vector<uint16_t> kPeerPorts = {5001, 5002, 5003};
+  net::MachnetSynOptions options{};
+  options.window = be32_t(Flow::kDefaultWindow);
+  options.mss = be16_t(1400);
+  options.paths_nr = 1 + kPeerPorts.size();
+  for (size_t i = 0; i < kPeerPorts.size(); i++) {
+    options.path_ports[i] = be16_t(kPeerPorts[i]);
+  }
+  auto passive = CreateFlow();
+  passive->SetMultipath(3, 0);
+  auto *syn = CreateSynPacket(&options);
+  EXPECT_TRUE(passive->ProcessSynOptions(syn));
+  dpdk::Packet::Free(syn);
+  EXPECT_EQ(passive->GetPathsNr(), 3u);
+  const auto passive_keys = passive->GetPathKeys();
+  ASSERT_EQ(passive_keys.size(), 2u);
+  for (size_t i = 0; i < passive_keys.size(); i++) {
+    EXPECT_EQ(passive_keys[i], Key(local_addr_, local_port_, remote_addr_,
+                                   Udp::Port(kPeerPorts[i])));
+  }
+
+  // A retransmitted SYN changes nothing.
+  passive->SetState(Flow::State::kSynReceived);
+  options.paths_nr = 1;
+  syn = CreateSynPacket(&options);
+  EXPECT_TRUE(passive->ProcessSynOptions(syn));
+  dpdk::Packet::Free(syn);
+  EXPECT_EQ(passive->GetPathsNr(), 3u);
+  EXPECT_EQ(passive->GetPathKeys().size(), 2u);
+
+  // The initiating end uses as many of its paths as the peer took, and finds
+  // the flow by its own ports on all of them.
+  const std::vector<Udp::Port> kPorts = {Udp::Port(6001), Udp::Port(6002),
+                                         Udp::Port(6003)};
+  auto active = CreateFlow();
+  active->SetMultipath(4, 0, kPorts);
+  active->SetState(Flow::State::kSynSent);
+  options.paths_nr = 2;
+  auto *syn_ack = CreateSynPacket(&options);
+  EXPECT_TRUE(active->ProcessSynOptions(syn_ack));
+  dpdk::Packet::Free(syn_ack);
+  EXPECT_EQ(active->GetPathsNr(), 2u);
+  const auto active_keys = active->GetPathKeys();
+  ASSERT_EQ(active_keys.size(), kPorts.size());
+  for (size_t i = 0; i < active_keys.size(); i++) {
+    EXPECT_EQ(active_keys[i],
+              Key(local_addr_, kPorts[i], remote_addr_, remote_port_));
+  }
+
+  // A peer without multipath keeps the flow on a single path.
+  auto single = CreateFlow();
+  single->SetMultipath(4, 0, kPorts);
+  single->SetState(Flow::State::kSynSent);
+  syn_ack = CreateSynPacket(nullptr);
+  EXPECT_TRUE(single->ProcessSynOptions(syn_ack));
+  dpdk::Packet::Free(syn_ack);
+  EXPECT_EQ(single->GetPathsNr(), 1u);
+}
+
+TEST_F(FlowTest, Multipath_SelectPath) {
+  constexpr size_t kPathsNr = 3;
+  constexpr uint64_t kFlowletGapNs = 100000;
+  auto flow = CreateMultipathFlow(kPathsNr, kFlowletGapNs);
+  ASSERT_EQ(flow->GetPathsNr(), kPathsNr);
+
+  // The packets of a flowlet stay on its path; after an idle gap, the next
+  // one takes the next path, round-robin.
+  const uint64_t gap = time::ns_to_cycles(kFlowletGapNs);
+  uint64_t now = time::rdtsc();
+  flow->SelectPath(now);
+  const size_t path = flow->tx_path_;
+  for (size_t i = 0; i < 4; i++) {
+    flow->SelectPath(now += gap / 2);
+    EXPECT_EQ(flow->tx_path_, path);
+  }
+  for (size_t i = 1; i <= kPathsNr; i++) {
+    flow->SelectPath(now += gap);
+    EXPECT_EQ(flow->tx_path_, (path + i) % kPathsNr);
+  }
+
+  // Without a gap, every packet takes the next path.
+  auto sprayed = CreateMultipathFlow(kPathsNr, 0);
+  for (size_t i = 1; i <= kPathsNr; i++) {
+    sprayed->SelectPath(now);
+    EXPECT_EQ(sprayed->tx_path_, i % kPathsNr);
+  }
+
+  // Paths differ by the source port: the flow's on the first one.
+  constexpr size_t kHdrLen = sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                             sizeof(net::Udp) + sizeof(net::MachnetPktHdr);
+  auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+  CHECK_NOTNULL(packet->append(kHdrLen));
+  for (size_t p = 0; p < kPathsNr; p++) {
+    flow->PrepareHeaders(packet, p);
+    const auto *udph =
+        packet->head_data<Udp *>(sizeof(net::Ethernet) + sizeof(net::Ipv4));
+    EXPECT_EQ(udph->src_port, Udp::Port(kLocalPort + p));
+    EXPECT_EQ(udph->dst_port, remote_port_);
+  }
+  dpdk::Packet::Free(packet);
+}
+
+TEST_F(FlowTest, Multipath_Reordering) {
+  // Packets sprayed round-robin over paths of different delays arrive path
+  // by path.
+  constexpr size_t kPathsNr = 3;
+  constexpr size_t kMsgsNr = 4 * kPathsNr;
+  auto flow = CreateMultipathFlow(kPathsNr, 0);
+  flow->SetAckPolicy(16, 1000);
+  const uint32_t rcv_nxt = flow->pcb_.rcv_nxt;
+  const auto packets = CreateDataPackets(rcv_nxt, kMsgsNr);
+  const auto sent_nr = SentPacketsNr();
+  const uint64_t now = time::rdtsc();
+  size_t delivered_nr = 0;
+  for (size_t path = 0; path < kPathsNr; path++) {
+    std::vector<dpdk::Packet *> burst;
+    for (size_t i = path; i < kMsgsNr; i += kPathsNr) {
+      burst.push_back(packets[i]);
+    }
+    InputBurst(flow.get(), burst, now);
+
+    // Messages are delivered in order, once the gaps before them fill.
+    const size_t in_order_nr = path + 1 < kPathsNr ? path + 1 : kMsgsNr;
+    EXPECT_EQ(flow->pcb_.rcv_nxt, rcv_nxt + in_order_nr);
+    for (; delivered_nr < in_order_nr; delivered_nr++) {
+      const auto rx_message = ReceiveMessage();
+      ASSERT_EQ(rx_message.size(), 64u);
+      EXPECT_EQ(rx_message[0], static_cast<uint8_t>(delivered_nr));
+    }
+    EXPECT_TRUE(ReceiveMessage().empty());
+  }
+  EXPECT_TRUE(flow->rx_tracking_.reass_q_.empty());
+
+  // Reordering is the norm across paths, and does not call for an immediate
+  // ACK (see `Flow::DetectLosses').
+  EXPECT_EQ(SentPacketsNr(), sent_nr);
+  EXPECT_EQ(flow->pending_acks_, kMsgsNr);
+  EXPECT_NE(flow->ack_deadline_, 0);
+}
+
 }  // namespace flow
 }  // namespace net
 }  // namespace juggler
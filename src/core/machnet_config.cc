@@ -1,12 +1,17 @@
 #include "machnet_config.h"
 
 #include <algorithm>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <ranges>
 #include <string>
 
+#include "af_xdp.h"
 #include "dpdk.h"
 #include "ether.h"
+#include "machnet_common.h"
 
 namespace juggler {
 
@@ -59,6 +64,24 @@ static std::optional<std::string> GetPCIeAddressSysfs(
   return std::nullopt;
 }
 
+static std::optional<std::string> GetInterfaceNameSysfs(
+    const juggler::net::Ethernet::Address &l2_addr) {
+  for (const auto &entry :
+       std::filesystem::directory_iterator("/sys/class/net")) {
+    // Members of a bond or failover pair (e.g., the VF under Azure's netvsc)
+    // share its address; the kernel sends and receives on the master.
+    if (std::filesystem::exists(entry.path() / "master")) continue;
+    std::ifstream address_file(entry.path() / "address");
+    std::string interface_l2_addr;
+    if (!(address_file >> interface_l2_addr)) continue;
+    const juggler::net::Ethernet::Address interface_addr(interface_l2_addr);
+    if (interface_addr == l2_addr && entry.path().filename() != "lo") {
+      return entry.path().filename();
+    }
+  }
+  return std::nullopt;
+}
+
 MachnetConfigProcessor::MachnetConfigProcessor(
     const std::string &config_json_filename)
     : config_json_filename_(config_json_filename), interfaces_config_{} {
@@ -84,7 +107,22 @@ void MachnetConfigProcessor::AssertJsonValidMachnetConfig() {
     }
     for (const auto &[key, _] : interface.items()) {
       if (key != "ip" && key != "engine_threads" && key != "cpu_mask" &&
-          key != "pcie") {
+          key != "pcie" && key != "idle_polls" && key != "idle_sleep_us" &&
+          key != "tx_uso" && key != "rx_zerocopy" &&
+          key != "flow_steering" && key != "congestion_control" &&
+          key != "pacing" && key != "max_window" && key != "mtu" &&
+          key != "multipath" && key != "flowlet_gap_us" &&
+          key != "neighbors" && key != "engine_cpus" && key != "bond" &&
+          key != "early_data" && key != "keepalive_us" &&
+          key != "flow_latency_stats" && key != "copy_nt_threshold" &&
+          key != "copy_dma_threshold" && key != "dma_devices" &&
+          key != "channel_buffer_classes" && key != "channel_pool_size" &&
+          key != "channel_max_buffers" && key != "app_max_buffers" &&
+          key != "priority_dscp" && key != "encryption_key_file" &&
+          key != "crypto_devices" && key != "af_xdp" &&
+          key != "af_xdp_prog" && key != "aggregation_max_msg" &&
+          key != "aggregation_hold_us" && key != "ack_every_n" &&
+          key != "ack_delay_us") {
         LOG(FATAL) << "Invalid key " << key << " in " << interface << " in "
                    << config_json_filename_;
       }
@@ -101,10 +139,28 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
     net::Ipv4::Address ip_addr;
     CHECK(ip_addr.FromString(json_val.at("ip")));
 
+    std::vector<uint32_t> engine_cpus;
+    if (json_val.find("engine_cpus") != json_val.end()) {
+      engine_cpus = json_val.at("engine_cpus").get<std::vector<uint32_t>>();
+      CHECK(!engine_cpus.empty()) << "Empty engine_cpus for "
+                                  << l2_addr.ToString();
+      for (const auto &cpu : engine_cpus) {
+        CHECK_LT(cpu, CPU_SETSIZE) << "Invalid engine_cpus for "
+                                   << l2_addr.ToString();
+      }
+    }
+
     if (json_val.find("engine_threads") != json_val.end()) {
       engine_threads = json_val.at("engine_threads");
       LOG(INFO) << "Using " << engine_threads << " engine threads for "
                 << l2_addr.ToString();
+      CHECK(engine_cpus.empty() || engine_cpus.size() == engine_threads)
+          << "engine_cpus and engine_threads disagree for "
+          << l2_addr.ToString();
+    } else if (!engine_cpus.empty()) {
+      engine_threads = engine_cpus.size();
+      LOG(INFO) << "Using " << engine_threads << " engines (engine_cpus) for "
+                << l2_addr.ToString();
     } else {
       LOG(INFO) << "Using default engine threads = " << engine_threads
                 << " for " << l2_addr.ToString();
@@ -137,8 +193,261 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
       }
     }
 
+    uint32_t idle_polls = 0;
+    uint32_t idle_sleep_us = NetworkInterfaceConfig::kDefaultIdleSleepUs;
+    if (json_val.find("idle_polls") != json_val.end()) {
+      idle_polls = json_val.at("idle_polls");
+    }
+    if (json_val.find("idle_sleep_us") != json_val.end()) {
+      idle_sleep_us = json_val.at("idle_sleep_us");
+      CHECK_GT(idle_sleep_us, 0) << "Invalid idle_sleep_us for "
+                                 << l2_addr.ToString();
+    }
+
+    bool tx_uso = false;
+    if (json_val.find("tx_uso") != json_val.end()) {
+      tx_uso = json_val.at("tx_uso");
+    }
+    bool rx_zerocopy = false;
+    if (json_val.find("rx_zerocopy") != json_val.end()) {
+      rx_zerocopy = json_val.at("rx_zerocopy");
+    }
+    bool flow_steering = false;
+    if (json_val.find("flow_steering") != json_val.end()) {
+      flow_steering = json_val.at("flow_steering");
+    }
+    auto congestion_control = net::swift::Algorithm::kSwift;
+    if (json_val.find("congestion_control") != json_val.end()) {
+      const std::string name = json_val.at("congestion_control");
+      const auto algorithm = net::swift::AlgorithmFromString(name);
+      CHECK(algorithm.has_value()) << "Invalid congestion_control " << name
+                                   << " for " << l2_addr.ToString();
+      congestion_control = algorithm.value();
+    }
+    bool pacing = false;
+    if (json_val.find("pacing") != json_val.end()) {
+      pacing = json_val.at("pacing");
+    }
+    uint32_t max_window = NetworkInterfaceConfig::kDefaultMaxWindow;
+    if (json_val.find("max_window") != json_val.end()) {
+      max_window = json_val.at("max_window");
+      CHECK(max_window >= NetworkInterfaceConfig::kDefaultMaxWindow &&
+            max_window <= net::swift::Pcb::kMaxWindow &&
+            (max_window & (max_window - 1)) == 0)
+          << "Invalid max_window for " << l2_addr.ToString();
+    }
+    uint32_t mtu = NetworkInterfaceConfig::kDefaultMtu;
+    if (json_val.find("mtu") != json_val.end()) {
+      mtu = json_val.at("mtu");
+      CHECK(mtu >= dpdk::PmdRing::kDefaultFrameSize &&
+            mtu <= dpdk::PmdRing::kJumboFrameSize)
+          << "Invalid mtu for " << l2_addr.ToString();
+    }
+    uint32_t multipath = 1;
+    if (json_val.find("multipath") != json_val.end()) {
+      multipath = json_val.at("multipath");
+      CHECK(multipath >= 1 && multipath <= net::MachnetSynOptions::kMaxPaths)
+          << "Invalid multipath for " << l2_addr.ToString();
+    }
+    uint32_t flowlet_gap_us = 0;
+    if (json_val.find("flowlet_gap_us") != json_val.end()) {
+      flowlet_gap_us = json_val.at("flowlet_gap_us");
+    }
+    NetworkInterfaceConfig::Neighbors neighbors;
+    if (json_val.find("neighbors") != json_val.end()) {
+      for (const auto &[neighbor_ip, neighbor_l2] :
+           json_val.at("neighbors").items()) {
+        net::Ipv4::Address neighbor_ip_addr;
+        CHECK(neighbor_ip_addr.FromString(neighbor_ip))
+            << "Invalid neighbor IP " << neighbor_ip << " for "
+            << l2_addr.ToString();
+        net::Ethernet::Address neighbor_l2_addr;
+        CHECK(neighbor_l2_addr.FromString(neighbor_l2.get<std::string>()))
+            << "Invalid neighbor MAC for " << neighbor_ip << " for "
+            << l2_addr.ToString();
+        neighbors.emplace_back(neighbor_ip_addr, neighbor_l2_addr);
+      }
+    }
+
+    NetworkInterfaceConfig::Bond bond;
+    if (json_val.find("bond") != json_val.end()) {
+      CHECK(!rx_zerocopy && !flow_steering)
+          << "bond rules out rx_zerocopy and flow_steering for "
+          << l2_addr.ToString();
+      for (const auto &member : json_val.at("bond")) {
+        net::Ethernet::Address member_l2_addr;
+        CHECK(member_l2_addr.FromString(member.get<std::string>()))
+            << "Invalid bond member " << member << " for "
+            << l2_addr.ToString();
+        CHECK(member_l2_addr != l2_addr)
+            << "Interface " << l2_addr.ToString() << " bonded with itself";
+        const auto member_pci_addr = GetPCIeAddressSysfs(member_l2_addr);
+        LOG_IF(WARNING, !member_pci_addr.has_value())
+            << "Failed to get PCIe address from sysfs for bond member "
+            << member_l2_addr.ToString();
+        bond.emplace_back(member_l2_addr, member_pci_addr.value_or(""));
+      }
+    }
+
+    bool early_data = false;
+    if (json_val.find("early_data") != json_val.end()) {
+      early_data = json_val.at("early_data");
+    }
+    uint32_t keepalive_us = NetworkInterfaceConfig::kDefaultKeepAliveUs;
+    if (json_val.find("keepalive_us") != json_val.end()) {
+      keepalive_us = json_val.at("keepalive_us");
+      CHECK_GT(keepalive_us, 0)
+          << "Invalid keepalive_us for " << l2_addr.ToString();
+    }
+    bool flow_latency_stats = false;
+    if (json_val.find("flow_latency_stats") != json_val.end()) {
+      flow_latency_stats = json_val.at("flow_latency_stats");
+    }
+    size_t copy_nt_threshold = 0;
+    if (json_val.find("copy_nt_threshold") != json_val.end()) {
+      copy_nt_threshold = json_val.at("copy_nt_threshold");
+    }
+    size_t copy_dma_threshold = 0;
+    if (json_val.find("copy_dma_threshold") != json_val.end()) {
+      copy_dma_threshold = json_val.at("copy_dma_threshold");
+    }
+    std::vector<std::string> dma_devices;
+    if (json_val.find("dma_devices") != json_val.end()) {
+      dma_devices = json_val.at("dma_devices").get<std::vector<std::string>>();
+      CHECK_EQ(dma_devices.size(), engine_threads)
+          << "dma_devices and engine_threads disagree for "
+          << l2_addr.ToString();
+    }
+    CHECK(copy_dma_threshold == 0 || !dma_devices.empty())
+        << "copy_dma_threshold without dma_devices for " << l2_addr.ToString();
+    NetworkInterfaceConfig::BufClasses channel_buffer_classes;
+    if (json_val.find("channel_buffer_classes") != json_val.end()) {
+      for (const auto &[buffer_size_str, buffers_nr] :
+           json_val.at("channel_buffer_classes").items()) {
+        char *end;
+        const auto buffer_size = strtoul(buffer_size_str.c_str(), &end, 10);
+        CHECK(*end == '\0' && buffer_size > 0 && buffer_size <= UINT16_MAX)
+            << "Invalid channel buffer size " << buffer_size_str << " for "
+            << l2_addr.ToString();
+        const uint32_t slot_nr = buffers_nr;
+        CHECK(slot_nr > 1 && utils::is_power_of_two(slot_nr))
+            << "Invalid number of channel buffers " << buffers_nr << " for "
+            << l2_addr.ToString();
+        channel_buffer_classes.emplace_back(buffer_size, slot_nr);
+      }
+      // Keys are strings, in lexicographic order.
+      std::sort(channel_buffer_classes.begin(), channel_buffer_classes.end());
+      CHECK(std::adjacent_find(channel_buffer_classes.begin(),
+                               channel_buffer_classes.end(),
+                               [](const auto &a, const auto &b) {
+                                 return a.first == b.first;
+                               }) == channel_buffer_classes.end())
+          << "Duplicate channel_buffer_classes for " << l2_addr.ToString();
+      CHECK_LT(channel_buffer_classes.size(), MACHNET_CHANNEL_BUF_CLASSES_MAX)
+          << "Too many channel_buffer_classes for " << l2_addr.ToString();
+    }
+    size_t channel_pool_size = 0;
+    if (json_val.find("channel_pool_size") != json_val.end()) {
+      channel_pool_size = json_val.at("channel_pool_size");
+    }
+    size_t channel_max_buffers = 0;
+    if (json_val.find("channel_max_buffers") != json_val.end()) {
+      channel_max_buffers = json_val.at("channel_max_buffers");
+    }
+    size_t app_max_buffers = 0;
+    if (json_val.find("app_max_buffers") != json_val.end()) {
+      app_max_buffers = json_val.at("app_max_buffers");
+    }
+    NetworkInterfaceConfig::PriorityDscp priority_dscp{};
+    if (json_val.find("priority_dscp") != json_val.end()) {
+      const auto dscp = json_val.at("priority_dscp").get<std::vector<int>>();
+      CHECK_EQ(dscp.size(), priority_dscp.size())
+          << "Invalid priority_dscp for " << l2_addr.ToString();
+      for (size_t i = 0; i < dscp.size(); i++) {
+        CHECK(dscp[i] >= 0 && dscp[i] < 64)
+            << "Invalid DSCP " << dscp[i] << " for " << l2_addr.ToString();
+        priority_dscp[i] = dscp[i];
+      }
+    }
+    std::vector<uint8_t> encryption_key;
+    if (json_val.find("encryption_key_file") != json_val.end()) {
+      const std::string key_fname = json_val.at("encryption_key_file");
+      std::ifstream key_file(key_fname, std::ios::binary);
+      CHECK(key_file) << "Cannot read " << key_fname << " for "
+                      << l2_addr.ToString();
+      encryption_key.assign(std::istreambuf_iterator<char>(key_file), {});
+      CHECK(encryption_key.size() == 16 || encryption_key.size() == 32)
+          << "The key in " << key_fname << " is neither 16 nor 32 bytes long";
+    }
+    std::vector<std::string> crypto_devices;
+    if (json_val.find("crypto_devices") != json_val.end()) {
+      crypto_devices =
+          json_val.at("crypto_devices").get<std::vector<std::string>>();
+      CHECK_EQ(crypto_devices.size(), engine_threads)
+          << "crypto_devices and engine_threads disagree for "
+          << l2_addr.ToString();
+    }
+    CHECK_EQ(encryption_key.empty(), crypto_devices.empty())
+        << "encryption_key_file and crypto_devices go together for "
+        << l2_addr.ToString();
+    std::string af_xdp_iface, af_xdp_prog;
+    if (json_val.find("af_xdp") != json_val.end() && json_val.at("af_xdp")) {
+      CHECK(!rx_zerocopy && !flow_steering && bond.empty())
+          << "af_xdp rules out rx_zerocopy, flow_steering and bond for "
+          << l2_addr.ToString();
+      const auto ifname = GetInterfaceNameSysfs(l2_addr);
+      CHECK(ifname.has_value())
+          << "No kernel interface for AF_XDP with L2 address "
+          << l2_addr.ToString();
+      af_xdp_iface = ifname.value();
+      af_xdp_prog = dpdk::AfXdp::GetDefaultProgPath();
+      if (json_val.find("af_xdp_prog") != json_val.end()) {
+        af_xdp_prog = json_val.at("af_xdp_prog");
+      }
+    }
+    uint32_t aggregation_max_msg = 0;
+    if (json_val.find("aggregation_max_msg") != json_val.end()) {
+      aggregation_max_msg = json_val.at("aggregation_max_msg");
+      CHECK_LE(aggregation_max_msg, UINT16_MAX)
+          << "Invalid aggregation_max_msg for " << l2_addr.ToString();
+    }
+    uint32_t aggregation_hold_us =
+        NetworkInterfaceConfig::kDefaultAggregationHoldUs;
+    if (json_val.find("aggregation_hold_us") != json_val.end()) {
+      aggregation_hold_us = json_val.at("aggregation_hold_us");
+      CHECK_LE(aggregation_hold_us, 1000)
+          << "Invalid aggregation_hold_us for " << l2_addr.ToString();
+    }
+    uint32_t ack_every_n = NetworkInterfaceConfig::kDefaultAckEveryN;
+    if (json_val.find("ack_every_n") != json_val.end()) {
+      ack_every_n = json_val.at("ack_every_n");
+      CHECK_GT(ack_every_n, 0)
+          << "Invalid ack_every_n for " << l2_addr.ToString();
+    }
+    uint32_t ack_delay_us = 0;
+    if (json_val.find("ack_delay_us") != json_val.end()) {
+      ack_delay_us = json_val.at("ack_delay_us");
+      CHECK_LE(ack_delay_us, 1000)
+          << "Invalid ack_delay_us for " << l2_addr.ToString();
+    }
+
     interfaces_config_.emplace(pci_addr, l2_addr, ip_addr, engine_threads,
-                               cpu_mask);
+                               cpu_mask, idle_polls, idle_sleep_us, tx_uso,
+                               rx_zerocopy, flow_steering, congestion_control,
+                               pacing, max_window, mtu, multipath,
+                               flowlet_gap_us, std::move(neighbors),
+                               std::move(engine_cpus), std::move(bond),
+                               early_data, keepalive_us, flow_latency_stats,
+                               copy_nt_threshold, copy_dma_threshold,
+                               std::move(dma_devices),
+                               std::move(channel_buffer_classes),
+                               channel_pool_size, channel_max_buffers,
+                               app_max_buffers, priority_dscp,
+                               std::move(encryption_key),
+                               std::move(crypto_devices),
+                               std::move(af_xdp_iface),
+                               std::move(af_xdp_prog), aggregation_max_msg,
+                               aggregation_hold_us, ack_every_n, ack_delay_us);
   }
   for (const auto &interface : interfaces_config_) {
     interface.Dump();
@@ -150,13 +459,52 @@ utils::CmdLineOpts MachnetConfigProcessor::GetEalOpts() const {
   // TODO(ilias) : What cpu mask to set for EAL?
   eal_opts.Append({"-c", "0x1"});
   eal_opts.Append({"-n", "4"});
+  bool pci_allowlist = false;
+  bool all_af_xdp = true;
   for (const auto &interface : interfaces_config_) {
-    if (interface.pcie_addr() != "") {
-      eal_opts.Append({"-a", interface.pcie_addr()});
+    all_af_xdp &= interface.af_xdp();
+    if (interface.af_xdp()) {
+      // The NIC stays with its kernel driver: no PCIe device for it.
+      const auto vdev = dpdk::AfXdp::GetVdevArgs(
+          interface.af_xdp_iface(), interface.engine_threads(),
+          dpdk::PacketBatch::kMaxBurst, interface.af_xdp_prog());
+      eal_opts.Append({"--vdev", vdev});
+    }
+    if (interface.af_xdp() || interface.pcie_addr() != "") {
+      if (!interface.af_xdp()) {
+        eal_opts.Append({"-a", interface.pcie_addr()});
+        pci_allowlist = true;
+      }
+      for (const auto &[member_l2_addr, member_pci_addr] : interface.bond()) {
+        if (member_pci_addr != "") eal_opts.Append({"-a", member_pci_addr});
+      }
+      // DMA devices on the PCIe bus (e.g., IOAT); DSA work queues are not.
+      for (const auto &device : interface.dma_devices()) {
+        if (device.find(':') != std::string::npos) {
+          eal_opts.Append({"-a", device});
+          pci_allowlist = true;
+        }
+      }
+      for (const auto &device : interface.crypto_devices()) {
+        if (device.find(':') != std::string::npos) {
+          eal_opts.Append({"-a", device});
+          pci_allowlist = true;
+        }
+      }
     } else {
       LOG(WARNING) << "Not passing PCIe allowlist for interface "
                    << interface.l2_addr().ToString();
     }
+    // Crypto devices off the PCIe bus (e.g., AES-NI) are virtual devices.
+    for (const auto &device : interface.crypto_devices()) {
+      if (device.find(':') == std::string::npos) {
+        eal_opts.Append({"--vdev", device});
+      }
+    }
+  }
+  // Otherwise, the EAL would probe every PCIe device.
+  if (all_af_xdp && !pci_allowlist && !interfaces_config_.empty()) {
+    eal_opts.Append({"--no-pci"});
   }
 
   return eal_opts;
@@ -1,14 +1,25 @@
+#include <af_xdp.h>
 #include <config.h>
 #include <dpdk.h>
 #include <glog/logging.h>
 #include <machnet_controller.h>
 #include <machnet_ctrl.h>
 #include <utils.h>
+#include <unistd.h>
 #include <worker.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <future>
 #include <memory>
+#include <optional>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 namespace juggler {
 
@@ -32,6 +43,26 @@ void MachnetController::Run() {
   }
 
   signal(SIGINT, MachnetController::sig_handler);
+  signal(SIGUSR1, MachnetController::sig_handler);
+  signal(SIGUSR2, MachnetController::sig_handler);
+
+  // The interfaces of AF_XDP ports must be set up before their ports start,
+  // with the EAL. The port map of a previous run goes with its program.
+  for (const auto &interface : config_processor_.interfaces_config()) {
+    if (!interface.af_xdp()) continue;
+    unlink(dpdk::AfXdp::kPortMapPath);
+    if (access(interface.af_xdp_prog().c_str(), R_OK) != 0) {
+      LOG(ERROR) << "Cannot read the XDP program " << interface.af_xdp_prog()
+                 << " for interface " << interface.af_xdp_iface();
+      return;
+    }
+    if (!dpdk::AfXdp::PrepareInterface(interface.af_xdp_iface(),
+                                       interface.engine_threads())) {
+      LOG(ERROR) << "Cannot prepare interface " << interface.af_xdp_iface()
+                 << " for AF_XDP";
+      return;
+    }
+  }
 
   // Initialize DPDK.
   dpdk_.InitDpdk(config_processor_.GetEalOpts());
@@ -42,11 +73,16 @@ void MachnetController::Run() {
                   "the kernel driver with driverctl";
     LOG(ERROR) << "2. The user libraries for the NIC are not installed, e.g., "
                   "libmlx5 for Mellanox NICs";
-    LOG(ERROR) << "3. The NIC is not supported by DPDK";
+    LOG(ERROR) << "3. The NIC is not supported by DPDK; `af_xdp` runs it on "
+                  "AF_XDP sockets instead, through its kernel driver";
     return;
   }
 
+  // The engines of each worker thread, and the CPU mask of the thread. Engines
+  // mapped to the same core (see `engine_cpus') share the worker of the core.
+  std::vector<std::vector<std::shared_ptr<MachnetEngine>>> worker_engines;
   std::vector<cpu_set_t> cpu_masks;
+  std::unordered_map<uint32_t, size_t> core_workers;
   // Find the PMD port id for each interface.
   for (const auto &interface : config_processor_.interfaces_config()) {
     auto pmd_port_id = dpdk_.GetPmdPortIdByMac(interface.l2_addr());
@@ -64,29 +100,161 @@ void MachnetController::Run() {
     pmd_ports_.emplace_back(std::make_shared<juggler::dpdk::PmdPort>(
         interface.dpdk_port_id().value(), rx_rings_nr, tx_rings_nr,
         dpdk::PmdRing::kDefaultRingDescNr, dpdk::PmdRing::kDefaultRingDescNr));
-    pmd_ports_.back()->InitDriver();
+    // RX interrupts are only needed for engines that sleep when idle. Channel
+    // memory is registered for DMA only with zero-copy, and only then do TX
+    // packets carry channel buffers. Hardware RX timestamps, if available,
+    // sharpen the delay samples of congestion control.
+    pmd_ports_.back()->InitDriver(
+        interface.mtu(), interface.idle_polls() > 0,
+        interface.tx_uso(), kShmZeroCopyEnabled || interface.rx_zerocopy(),
+        true);
+    const auto pmd_port = pmd_ports_.back();
+
+    // Initialize the ports bonded with the interface, alike.
+    std::vector<std::shared_ptr<dpdk::PmdPort>> bond_ports;
+    for (const auto &[member_l2_addr, _] : interface.bond()) {
+      auto member_port_id = dpdk_.GetPmdPortIdByMac(member_l2_addr);
+      if (!member_port_id) {
+        LOG(ERROR) << "Cannot find PMD port id for bond member with L2 "
+                      "address: "
+                   << member_l2_addr.ToString();
+        return;
+      }
+      pmd_ports_.emplace_back(std::make_shared<juggler::dpdk::PmdPort>(
+          member_port_id.value(), rx_rings_nr, tx_rings_nr,
+          dpdk::PmdRing::kDefaultRingDescNr,
+          dpdk::PmdRing::kDefaultRingDescNr));
+      pmd_ports_.back()->InitDriver(interface.mtu(), false, interface.tx_uso(),
+                                    kShmZeroCopyEnabled, true);
+      bond_ports.emplace_back(pmd_ports_.back());
+    }
 
     // Create the MachnetEngineShared State.
     auto shared_state = std::make_shared<MachnetEngineSharedState>(
-        pmd_ports_.back()->GetRSSKey(), pmd_ports_.back()->GetL2Addr(),
-        std::vector<net::Ipv4::Address>(1, interface.ip_addr()));
+        pmd_port->GetRSSKey(), pmd_port->GetL2Addr(),
+        std::vector<net::Ipv4::Address>(1, interface.ip_addr()),
+        interface.neighbors());
+    if (interface.af_xdp()) {
+      auto port_map = dpdk::XdpPortMap::Open();
+      if (port_map == nullptr) {
+        LOG(ERROR) << "Cannot steer ports to Machnet on interface "
+                   << interface.af_xdp_iface();
+        return;
+      }
+      shared_state->SetXdpPortMap(std::move(port_map));
+      shared_state->SetKernelNeighbors(interface.af_xdp_iface());
+    }
     // Create the Machnet engines.
     for (size_t i = 0; i < interface.engine_threads(); ++i) {
       engines_.emplace_back(std::make_shared<juggler::MachnetEngine>(
-          pmd_ports_.back(), i, i, shared_state));
-      // Create the CPU mask for the engine threads.
-      cpu_masks.emplace_back(interface.cpu_mask());
+          pmd_port, i, i, shared_state));
+      engines_.back()->SetIdlePolicy(interface.idle_polls(),
+                                     interface.idle_sleep_us());
+      engines_.back()->SetRxZeroCopy(interface.rx_zerocopy());
+      engines_.back()->SetFlowSteering(interface.flow_steering());
+      for (const auto &bond_port : bond_ports) {
+        if (!engines_.back()->AddPort(bond_port, i, i)) {
+          LOG(ERROR) << "Cannot bond port " << bond_port->GetPortId()
+                     << " with interface " << interface.l2_addr().ToString();
+          return;
+        }
+      }
+      engines_.back()->SetCongestionControl(interface.congestion_control());
+      engines_.back()->SetPacing(interface.pacing());
+      engines_.back()->SetMaxWindow(interface.max_window());
+      engines_.back()->SetMultipath(interface.multipath(),
+                                    interface.flowlet_gap_us());
+      engines_.back()->SetEarlyData(interface.early_data());
+      engines_.back()->SetAggregation(interface.aggregation_max_msg(),
+                                      interface.aggregation_hold_us());
+      engines_.back()->SetAckPolicy(interface.ack_every_n(),
+                                    interface.ack_delay_us());
+      engines_.back()->SetPriorityDscp(interface.priority_dscp());
+      engines_.back()->SetKeepAlive(interface.keepalive_us());
+      engines_.back()->SetFlowLatencyStats(interface.flow_latency_stats());
+      engines_.back()->SetCopyOffload(
+          interface.copy_nt_threshold(), interface.copy_dma_threshold(),
+          interface.dma_devices().empty() ? "" : interface.dma_devices()[i]);
+      if (!interface.encryption_key().empty() &&
+          !engines_.back()->SetEncryption(interface.encryption_key(),
+                                          interface.crypto_devices()[i])) {
+        LOG(ERROR) << "Cannot set up encryption on "
+                   << interface.crypto_devices()[i] << " for interface "
+                   << interface.l2_addr().ToString();
+        return;
+      }
+      std::vector<MachnetChannelBufClassConf_t> buf_classes;
+      for (const auto &[buffer_size, buffers_nr] :
+           interface.channel_buffer_classes()) {
+        buf_classes.push_back({buffers_nr, buffer_size});
+      }
+      engines_.back()->SetChannelBufClasses(std::move(buf_classes));
+      // Elastic pools start with a segment of the default size.
+      const size_t buf_segs_max =
+          std::max<size_t>(1, (interface.channel_max_buffers() +
+                               ChannelManager::kDefaultBufferCount - 1) /
+                                  ChannelManager::kDefaultBufferCount);
+      CHECK_LE(buf_segs_max, MACHNET_CHANNEL_BUF_SEGS_MAX)
+          << "channel_max_buffers is too large";
+      engines_.back()->SetChannelBufPoolLimits(buf_segs_max,
+                                               interface.app_max_buffers());
+      // Assign the engine to a worker thread.
+      if (interface.engine_cpus().empty()) {
+        worker_engines.push_back({engines_.back()});
+        cpu_masks.emplace_back(interface.cpu_mask());
+        continue;
+      }
+      const auto cpu = interface.engine_cpus()[i];
+      auto [it, inserted] =
+          core_workers.try_emplace(cpu, worker_engines.size());
+      if (inserted) {
+        worker_engines.emplace_back();
+        cpu_set_t cpu_mask;
+        CPU_ZERO(&cpu_mask);
+        CPU_SET(cpu, &cpu_mask);
+        cpu_masks.emplace_back(cpu_mask);
+      }
+      worker_engines[it->second].emplace_back(engines_.back());
+    }
+
+    // Channels are kept ready for the NIC's NUMA node from the start.
+    if (interface.channel_pool_size() > 0) {
+      const auto port_id = pmd_port->GetPortId();
+      channel_pool_sizes_[port_id] = interface.channel_pool_size();
+      channel_pools_[{port_id, pmd_port->GetNumaNode()}] = {engines_.back(),
+                                                            {}};
     }
   }
 
-  WorkerPool<MachnetEngine> engine_thread_pool{engines_, cpu_masks};
+  WorkerPool<MachnetEngine> engine_thread_pool{std::move(worker_engines),
+                                               cpu_masks};
   engine_thread_pool.Init();
   engine_thread_pool.Launch();
+  RestoreHandOff();
+
+  metrics_running_.store(true);
+  metrics_thread_ = std::thread(&MachnetController::ExportMetrics, this);
+  if (!channel_pool_sizes_.empty()) {
+    channel_pools_running_ = true;
+    channel_pools_thread_ =
+        std::thread(&MachnetController::FillChannelPools, this);
+  }
 
   // Start the controller server, wait and handle connections.
   RunController();
 
   // The previous call will block until the server is stopped (e.g. by SIGINT).
+  metrics_running_.store(false);
+  metrics_thread_.join();
+  if (channel_pools_thread_.joinable()) {
+    {
+      const std::lock_guard<std::mutex> lock(channel_pools_mtx_);
+      channel_pools_running_ = false;
+    }
+    channel_pools_cv_.notify_all();
+    channel_pools_thread_.join();
+  }
+  channel_pools_.clear();
   engine_thread_pool.Pause();
   engine_thread_pool.Terminate();
 
@@ -124,6 +292,10 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
       resp.status =
           ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
       CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+      if (ret) {
+        application_sockets_[juggler::utils::UUIDToString(req->app_uuid)] =
+            s->GetFd();
+      }
 
       // Get client context.
       auto *client_context =
@@ -134,8 +306,9 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
     case MACHNET_CTRL_MSG_TYPE_REQ_CHANNEL: {
       LOG(INFO) << "Request to create new channel: "
                 << juggler::utils::UUIDToString(req->channel_info.channel_uuid);
-      int channel_fd;
-      auto ret = CreateChannel(req->app_uuid, &req->channel_info, &channel_fd);
+      int channel_fd, doorbell_fd, pending_fd, notify_fd;
+      auto ret = CreateChannel(req->app_uuid, &req->channel_info, &channel_fd,
+                               &doorbell_fd, &pending_fd, &notify_fd);
 
       machnet_ctrl_msg_t resp;
       resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
@@ -143,14 +316,29 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
 
       if (ret && channel_fd >= 0) {
         resp.status = MACHNET_CTRL_STATUS_SUCCESS;
-        LOG(INFO) << "Sending channel fd: " << channel_fd << " to client.";
-        CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&resp), sizeof(resp),
-                               channel_fd));
+        LOG(INFO) << "Sending channel fd: " << channel_fd
+                  << " (doorbell fd: " << doorbell_fd << ") to client.";
+        if (doorbell_fd >= 0) {
+          // See `MACHNET_CTRL_MSG_MAX_FDS' for the order of descriptors. Only
+          // the valid ones up to the first missing one are sent; the
+          // application takes the rest as missing.
+          const int fds[] = {channel_fd, doorbell_fd, pending_fd, notify_fd};
+          const size_t fds_nr =
+              std::find(std::begin(fds), std::end(fds), -1) - std::begin(fds);
+          CHECK(s->SendMsgWithFds(reinterpret_cast<char *>(&resp),
+                                  sizeof(resp), fds, fds_nr));
+        } else {
+          CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&resp),
+                                 sizeof(resp), channel_fd));
+        }
       } else {
         resp.status = MACHNET_CTRL_STATUS_FAILURE;
         CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
       }
     } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_HANDOFF:
+      HandOff(s, req);
+      break;
     default:
       LOG(ERROR) << "Invalid message type.";
       break;
@@ -158,6 +346,8 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
 }
 
 void MachnetController::HandlePassiveClose(UDSocket *s) {
+  // The successor serves the applications now.
+  if (handed_off_) return;
   // Get client context.
   auto *client_context =
       reinterpret_cast<MachnetClientContext *>(s->GetUserData());
@@ -209,22 +399,31 @@ void MachnetController::UnregisterApplication(const uuid_t app_uuid) {
   for (const auto &channel_name : app_channels) {
     LOG(INFO) << "Destroying channel: " << channel_name;
     auto channel = channel_manager_.GetChannel(channel_name.c_str());
-    static size_t engine_index =
-        utils::hash<size_t>(channel->GetName().c_str(),
-                            channel->GetName().size()) %
-        engines_.size();
+    const auto engine_it = channel_engines_.find(channel_name);
+    CHECK(engine_it != channel_engines_.end());
+    const size_t engine_index = engine_it->second;
     engines_[engine_index]->RemoveChannel(channel);
     channel_manager_.DestroyChannel(channel_name.c_str());
+    const auto dedicated_it = dedicated_engines_.find(engine_index);
+    if (dedicated_it != dedicated_engines_.end() &&
+        dedicated_it->second == channel_name) {
+      dedicated_engines_.erase(dedicated_it);
+    }
+    channel_engines_.erase(engine_it);
   }
 
   // Unregister the application.
   applications_registered_.erase(app_uuid_str);
+  application_sockets_.erase(app_uuid_str);
+  std::erase_if(app_buf_budgets_, [&app_uuid_str](const auto &entry) {
+    return entry.first.first == app_uuid_str;
+  });
   LOG(INFO) << "Application unregistered: " << app_uuid_str;
 }
 
 bool MachnetController::CreateChannel(
     const uuid_t app_uuid, const machnet_channel_info_t *channel_info,
-    int *fd) {
+    int *fd, int *doorbell_fd, int *pending_fd, int *notify_fd) {
   const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
 
   // Check that this is a registered application.
@@ -242,32 +441,64 @@ bool MachnetController::CreateChannel(
     return false;
   }
 
-  // TODO(ilias): Figure out a way to dynamically infer the buffer size to be
-  // used.
-  const auto channel_buffer_size =
-      juggler::dpdk::PmdRing::kDefaultFrameSize - sizeof(juggler::net::Ipv4) -
-      sizeof(juggler::net::Udp) - sizeof(juggler::net::MachnetPktHdr);
-  if (!channel_manager_.AddChannel(
-          channel_uuid_str.c_str(), ChannelManager::kDefaultRingSize,
-          ChannelManager::kDefaultRingSize, ChannelManager::kDefaultBufferCount,
-          channel_buffer_size) != 0) {
+  if (channel_info->queue_pairs_nr > MACHNET_CHANNEL_QUEUE_PAIRS_MAX) {
+    LOG(ERROR) << "Too many queue pairs requested: "
+               << channel_info->queue_pairs_nr;
+    return false;
+  }
+  if (channel_info->flags & ~MACHNET_CHANNEL_F_MASK) {
+    LOG(ERROR) << "Unknown channel flags requested: " << channel_info->flags;
+    return false;
+  }
+  if (channel_info->numa_node < MACHNET_NUMA_NODE_ANY) {
+    LOG(ERROR) << "Invalid NUMA node requested: " << channel_info->numa_node;
+    return false;
+  }
+
+  bool dedicated = false;
+  const size_t engine_index = PlaceChannel(channel_info->flags, &dedicated);
+  const auto &engine = engines_[engine_index];
+
+  // Place the channel's memory on the requested NUMA node, or else on the
+  // NIC's.
+  const int numa_node = channel_info->numa_node != MACHNET_NUMA_NODE_ANY
+                            ? channel_info->numa_node
+                            : engine->GetPmdPort()->GetNumaNode();
+  // Pooled channels have no queue pairs and MPMC rings; the other flags do not
+  // change the layout of a channel.
+  std::shared_ptr<shm::Channel> channel;
+  if (channel_info->queue_pairs_nr == 0 &&
+      !(channel_info->flags & MACHNET_CHANNEL_F_SPSC)) {
+    channel = TakePooledChannel(engine, numa_node);
+    if (channel != nullptr) {
+      channel->ctx()->data_ctx.flags = channel_info->flags;
+      LOG(INFO) << "Channel " << channel_uuid_str << " taken from the pool ("
+                << channel->GetName() << ").";
+    }
+  }
+  if (channel == nullptr) {
+    channel = NewChannel(channel_uuid_str, engine,
+                         channel_info->queue_pairs_nr, channel_info->flags,
+                         numa_node);
+  }
+  if (channel == nullptr) return false;
+  channel->SetBufBudget(GetAppBufBudget(app_uuid_str, engine));
+  if (!channel_manager_.AdoptChannel(channel_uuid_str.c_str(), channel)) {
     return false;
   }
 
   // Add the channel to the list of channels for this application.
   app_channels.insert(channel_uuid_str);
+  channel_engines_[channel_uuid_str] = engine_index;
+  if (dedicated) dedicated_engines_[engine_index] = channel_uuid_str;
+  LOG(INFO) << "Channel " << channel_uuid_str << " placed on engine "
+            << engine_index << (dedicated ? " (dedicated)." : ".");
 
   // Pass a promise to the Machnet engine and wait for the channel to be
   // activated.
   std::promise<bool> p;
   auto fstatus = p.get_future();
-  static size_t engine_index =
-      utils::hash<size_t>(channel_uuid_str.c_str(), channel_uuid_str.size()) %
-      engines_.size();
-  const auto &engine = engines_[engine_index];
-  engine->AddChannel(
-      CHECK_NOTNULL(channel_manager_.GetChannel(channel_uuid_str.c_str())),
-      std::move(p));
+  engine->AddChannel(channel, std::move(p));
 
   // TODO(ilias): Add a timeout here.
   auto status = fstatus.get();
@@ -275,21 +506,471 @@ bool MachnetController::CreateChannel(
   if (status != true) {
     LOG(ERROR) << "Failed to create channel.";
     *fd = -1;
+    *doorbell_fd = -1;
+    *pending_fd = -1;
+    *notify_fd = -1;
     return false;
   }
 
-  if (kShmZeroCopyEnabled) {
+  *fd = channel->GetFd();
+  *doorbell_fd = channel->GetDoorbellFd();
+  *pending_fd = engine->GetPendingBitmapFd();
+  *notify_fd = channel->GetNotifyFd();
+  return status;
+}
+
+std::shared_ptr<shm::Channel> MachnetController::NewChannel(
+    const std::string &name, const std::shared_ptr<MachnetEngine> &engine,
+    size_t queue_pairs_nr, uint32_t flags, int numa_node) {
+  // Buffers hold the payload of a packet of the MTU of the engine's port.
+  const auto mtu = engine->GetPmdPort()->GetMTU().value_or(
+      juggler::dpdk::PmdRing::kDefaultFrameSize);
+  const auto channel_buffer_size = mtu - sizeof(juggler::net::Ipv4) -
+                                   sizeof(juggler::net::Udp) -
+                                   sizeof(juggler::net::MachnetPktHdr);
+  // Size classes only pay off below the default buffers, which grow with the
+  // MTU of the port.
+  std::vector<MachnetChannelBufClassConf_t> buf_classes;
+  for (const auto &buf_class : engine->GetChannelBufClasses()) {
+    if (buf_class.buffer_size < channel_buffer_size) {
+      buf_classes.push_back(buf_class);
+    }
+  }
+  // Memory registered for DMA stays put: its pool is fixed.
+  const bool dma = kShmZeroCopyEnabled || engine->IsRxZeroCopyEnabled();
+  auto channel = ChannelManager::NewChannel(
+      name.c_str(), ChannelManager::kDefaultRingSize,
+      ChannelManager::kDefaultRingSize, ChannelManager::kDefaultBufferCount,
+      channel_buffer_size, queue_pairs_nr, flags, buf_classes,
+      dma ? 1 : engine->GetChannelBufSegsMax());
+  if (channel == nullptr) return nullptr;
+
+  // Bind the memory before it is registered for DMA (binding moves pages).
+  // This is best effort: a channel on a remote node still works, only slower.
+  if (numa_node != MACHNET_NUMA_NODE_ANY) channel->BindToNumaNode(numa_node);
+
+  // Zero-copy RX needs the memory registered before the engine sees the
+  // channel.
+  if (dma) {
     LOG(INFO) << "Registering channel buffer memory with NIC DPDK driver.";
     // Register channel buffer memory with NIC DPDK driver.
     auto device = engine->GetPmdPort()->GetDevice();
-    CHECK(channel_manager_.GetChannel(channel_uuid_str.c_str())
-              ->RegisterMemForDMA(device));
+    CHECK(channel->RegisterMemForDMA(device));
   } else {
     LOG(INFO) << "Not registering channel buffer memory with NIC DPDK driver.";
   }
+  return channel;
+}
+
+std::shared_ptr<std::atomic<int64_t>> MachnetController::GetAppBufBudget(
+    const std::string &app_uuid_str,
+    const std::shared_ptr<MachnetEngine> &engine) {
+  if (engine->GetAppMaxBuffers() == 0) return nullptr;
+  const auto key =
+      std::make_pair(app_uuid_str, engine->GetPmdPort()->GetPortId());
+  auto &budget = app_buf_budgets_[key];
+  if (budget == nullptr) {
+    budget = std::make_shared<std::atomic<int64_t>>(
+        static_cast<int64_t>(engine->GetAppMaxBuffers()));
+  }
+  return budget;
+}
 
-  *fd = channel_manager_.GetChannel(channel_uuid_str.c_str())->GetFd();
-  return status;
+std::shared_ptr<shm::Channel> MachnetController::TakePooledChannel(
+    const std::shared_ptr<MachnetEngine> &engine, int numa_node) {
+  const auto port_id = engine->GetPmdPort()->GetPortId();
+  if (!channel_pool_sizes_.contains(port_id)) return nullptr;
+
+  const std::lock_guard<std::mutex> lock(channel_pools_mtx_);
+  auto &pool =
+      channel_pools_.try_emplace({port_id, numa_node}, ChannelPool{engine, {}})
+          .first->second;
+  std::shared_ptr<shm::Channel> channel;
+  if (!pool.channels.empty()) {
+    channel = std::move(pool.channels.back());
+    pool.channels.pop_back();
+  }
+  channel_pools_cv_.notify_one();
+  return channel;
+}
+
+void MachnetController::FillChannelPools() {
+  size_t created = 0;
+  std::unique_lock<std::mutex> lock(channel_pools_mtx_);
+  while (channel_pools_running_) {
+    const auto it = std::find_if(
+        channel_pools_.begin(), channel_pools_.end(), [this](const auto &p) {
+          const auto &[key, pool] = p;
+          return pool.channels.size() < channel_pool_sizes_.at(key.first);
+        });
+    if (it == channel_pools_.end()) {
+      channel_pools_cv_.wait(lock);
+      continue;
+    }
+
+    // Channels take long to create; attaching must not wait for the lock
+    // meanwhile. Pools are never removed while the thread runs.
+    const auto [port_id, numa_node] = it->first;
+    const auto engine = it->second.engine;
+    lock.unlock();
+    const auto name =
+        utils::Format("machnet-pool-%d-%zu", getpid(), created++);
+    auto channel = NewChannel(name, engine, 0, 0, numa_node);
+    lock.lock();
+    if (channel == nullptr) {
+      // Try again once a channel is taken, rather than in a loop.
+      LOG(WARNING) << "Failed to create a pooled channel for port " << port_id
+                   << " on NUMA node " << numa_node << ".";
+      channel_pools_cv_.wait(lock);
+      continue;
+    }
+    channel_pools_[{port_id, numa_node}].channels.emplace_back(
+        std::move(channel));
+  }
+}
+
+std::vector<size_t> MachnetController::GetChannelsPerEngine() const {
+  std::vector<size_t> channels_nr(engines_.size(), 0);
+  for (const auto &[_, index] : channel_engines_) channels_nr[index]++;
+  return channels_nr;
+}
+
+std::optional<size_t> MachnetController::GetLeastLoadedEngine(
+    std::optional<size_t> excluded, bool reserved_too) const {
+  const auto channels_nr = GetChannelsPerEngine();
+  // Busy time is noisy, so it only counts in steps of 10%.
+  using Score = std::tuple<uint32_t, size_t, size_t, uint64_t>;
+  std::optional<size_t> best;
+  Score best_score;
+  for (size_t i = 0; i < engines_.size(); i++) {
+    if (i == excluded) continue;
+    if (!reserved_too && dedicated_engines_.contains(i)) continue;
+    const auto load = engines_[i]->GetLoad();
+    const Score score{load.busy_permille / 100, load.flows_nr, channels_nr[i],
+                      load.pps};
+    if (!best.has_value() || score < best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+size_t MachnetController::PlaceChannel(uint32_t flags, bool *dedicated) {
+  *dedicated = false;
+  if (flags & MACHNET_CHANNEL_F_DEDICATED) {
+    const auto channels_nr = GetChannelsPerEngine();
+    for (size_t i = 0; i < engines_.size(); i++) {
+      if (channels_nr[i] != 0) continue;
+      *dedicated = true;
+      return i;
+    }
+    if (const auto vacated = VacateEngine(); vacated.has_value()) {
+      *dedicated = true;
+      return vacated.value();
+    }
+    LOG(WARNING) << "No free engine for a dedicated channel; sharing one.";
+  }
+
+  // All engines may be reserved; then any will do.
+  auto best = GetLeastLoadedEngine();
+  if (!best.has_value()) best = GetLeastLoadedEngine(std::nullopt, true);
+  return best.value();
+}
+
+std::optional<size_t> MachnetController::VacateEngine() {
+  // The engine with the fewest channels, among those not reserved.
+  const auto channels_nr = GetChannelsPerEngine();
+  std::optional<size_t> vacated;
+  for (size_t i = 0; i < engines_.size(); i++) {
+    if (dedicated_engines_.contains(i)) continue;
+    if (!vacated.has_value() || channels_nr[i] < channels_nr[vacated.value()])
+      vacated = i;
+  }
+  if (!vacated.has_value() ||
+      !GetLeastLoadedEngine(vacated.value()).has_value()) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string> channels;
+  for (const auto &[channel, index] : channel_engines_) {
+    if (index == vacated.value()) channels.emplace_back(channel);
+  }
+  LOG(INFO) << "Moving " << channels.size() << " channels off engine "
+            << vacated.value() << " to dedicate it.";
+  for (const auto &channel : channels) {
+    const auto to = GetLeastLoadedEngine(vacated.value());
+    // Channels moved so far stay where they are.
+    if (!MigrateChannel(channel, to.value())) return std::nullopt;
+  }
+  return vacated;
+}
+
+bool MachnetController::MigrateChannel(const std::string &channel_uuid_str,
+                                       size_t engine_index) {
+  const auto it = channel_engines_.find(channel_uuid_str);
+  if (it == channel_engines_.end() || engine_index >= engines_.size()) {
+    LOG(ERROR) << "Cannot migrate channel " << channel_uuid_str
+               << " to engine " << engine_index;
+    return false;
+  }
+  const size_t from = it->second;
+  if (from == engine_index) return true;
+  const auto &src = engines_[from];
+  const auto &dst = engines_[engine_index];
+  if (src->GetPmdPort() != dst->GetPmdPort()) {
+    LOG(ERROR) << "Cannot migrate channel " << channel_uuid_str
+               << " between engines of different ports.";
+    return false;
+  }
+
+  // Take the channel off the source engine, leaving its flows open.
+  const auto channel = channel_manager_.GetChannel(channel_uuid_str.c_str());
+  std::promise<std::optional<MachnetEngine::DetachedChannel>> detach_promise;
+  auto detach_status = detach_promise.get_future();
+  src->DetachChannel(channel, std::move(detach_promise));
+  auto detached = detach_status.get();
+  if (!detached.has_value()) return false;
+
+  auto attach = [](const std::shared_ptr<MachnetEngine> &engine,
+                   MachnetEngine::DetachedChannel detached) {
+    std::promise<bool> p;
+    auto fstatus = p.get_future();
+    engine->AttachChannel(std::move(detached), std::move(p));
+    return fstatus.get();
+  };
+  if (!attach(dst, detached.value())) {
+    // The source engine steered the packets of the flows to itself already.
+    CHECK(attach(src, std::move(detached.value())))
+        << "Failed to move channel " << channel_uuid_str << " back.";
+    return false;
+  }
+
+  it->second = engine_index;
+  if (auto dedicated_it = dedicated_engines_.find(from);
+      dedicated_it != dedicated_engines_.end() &&
+      dedicated_it->second == channel_uuid_str) {
+    dedicated_engines_.erase(dedicated_it);
+    if (GetChannelsPerEngine()[engine_index] == 1)
+      dedicated_engines_[engine_index] = channel_uuid_str;
+  }
+  LOG(INFO) << "Channel " << channel_uuid_str << " migrated from engine "
+            << from << " to engine " << engine_index << ".";
+  return true;
+}
+
+void MachnetController::SamplePorts() {
+  std::vector<MachnetEngine::Stats> stats;
+  for (const auto &engine : engines_) stats.emplace_back(engine->GetStats());
+  port_drops_.resize(pmd_ports_.size());
+  for (size_t i = 0; i < pmd_ports_.size(); i++) {
+    const auto &port = pmd_ports_[i];
+    port->UpdatePortStats();
+    port->UpdateXstats();
+    PortDrops drops{};
+    drops.rx_missed = port->GetPortRxDrops();
+    drops.rx_nombuf = port->GetPortRxNoMbufErr();
+    drops.rx_errors = port->GetPortRxErrors();
+    drops.tx_errors = port->GetPortTxDrops();
+    // Engines count against their own port, for the ports bonded with it too.
+    for (const auto &st : stats) {
+      if (st.port_id != port->GetPortId()) continue;
+      drops.rx_full_bursts += st.rx_full_bursts;
+      drops.tx_alloc_failures += st.tx_alloc_failures;
+      drops.tx_ring_full += st.tx_ring_full;
+    }
+
+    const auto &last = port_drops_[i];
+    const auto nic = (drops.rx_errors - last.rx_errors) +
+                     (drops.tx_errors - last.tx_errors);
+    const auto mbufs = (drops.rx_nombuf - last.rx_nombuf) +
+                       (drops.tx_alloc_failures - last.tx_alloc_failures);
+    const auto engines = drops.rx_missed - last.rx_missed;
+    if (nic + mbufs + engines != 0) {
+      LOG(WARNING) << utils::Format(
+          "Port %hu drops since the last sample: NIC %lu (RX errors %lu, TX "
+          "errors %lu), mbuf pools %lu (RX %lu, TX allocations %lu), engines "
+          "behind %lu (RX ring full; full RX bursts %lu), NIC behind (TX ring "
+          "full %lu)",
+          port->GetPortId(), nic, drops.rx_errors - last.rx_errors,
+          drops.tx_errors - last.tx_errors, mbufs,
+          drops.rx_nombuf - last.rx_nombuf,
+          drops.tx_alloc_failures - last.tx_alloc_failures, engines,
+          drops.rx_full_bursts - last.rx_full_bursts,
+          drops.tx_ring_full - last.tx_ring_full);
+    }
+    port_drops_[i] = drops;
+  }
+}
+
+std::string MachnetController::GetMetrics() {
+  std::vector<MachnetEngine::Stats> stats;
+  for (const auto &engine : engines_) stats.emplace_back(engine->GetStats());
+  auto labels = [&stats](size_t i) {
+    return utils::Format("engine=\"%zu\",port=\"%hu\",queue=\"%hu\"", i,
+                         stats[i].port_id, stats[i].rx_queue_id);
+  };
+
+  std::string s;
+  auto metric = [&](const char *name, const char *type, const char *help,
+                    auto value) {
+    s += utils::Format("# HELP machnet_engine_%s %s\n", name, help);
+    s += utils::Format("# TYPE machnet_engine_%s %s\n", name, type);
+    for (size_t i = 0; i < stats.size(); i++) {
+      s += "machnet_engine_" + std::string(name) + "{" + labels(i) + "} " +
+           std::to_string(value(stats[i])) + "\n";
+    }
+  };
+  using Stats = MachnetEngine::Stats;
+  metric("rx_packets_total", "counter", "Packets received.",
+         [](const Stats &st) { return st.rx_packets; });
+  metric("tx_packets_total", "counter", "Packets sent.",
+         [](const Stats &st) { return st.tx_packets; });
+  metric("tx_bursts_total", "counter", "Packet bursts sent.",
+         [](const Stats &st) { return st.tx_bursts; });
+  metric("idle_sleeps_total", "counter", "Sleeps in the adaptive idle mode.",
+         [](const Stats &st) { return st.idle_sleeps; });
+  metric("busy_permille", "gauge", "Share of the time spent doing work.",
+         [](const Stats &st) { return st.load.busy_permille; });
+  metric("packets_per_second", "gauge", "Packets received and sent per second.",
+         [](const Stats &st) { return st.load.pps; });
+  metric("flows", "gauge", "Active flows.",
+         [](const Stats &st) { return st.load.flows_nr; });
+  metric("channels", "gauge", "Channels served.",
+         [](const Stats &st) { return st.channels_nr; });
+  metric("listeners", "gauge", "Listeners.",
+         [](const Stats &st) { return st.listeners_nr; });
+  metric("rx_full_bursts_total", "counter",
+         "RX bursts that left packets in the ring.",
+         [](const Stats &st) { return st.rx_full_bursts; });
+  metric("tx_alloc_failures_total", "counter",
+         "TX packet allocations that failed as the mbuf pool was empty.",
+         [](const Stats &st) { return st.tx_alloc_failures; });
+  metric("tx_ring_full_total", "counter",
+         "TX bursts retried as the ring was full.",
+         [](const Stats &st) { return st.tx_ring_full; });
+
+  s += "# HELP machnet_engine_cycles_total TSC cycles spent per stage.\n";
+  s += "# TYPE machnet_engine_cycles_total counter\n";
+  for (size_t i = 0; i < stats.size(); i++) {
+    for (size_t stage = 0; stage < MachnetEngine::kStagesNr; stage++) {
+      s += "machnet_engine_cycles_total{" + labels(i) + ",stage=\"" +
+           MachnetEngine::StageToString(
+               static_cast<MachnetEngine::Stage>(stage)) +
+           "\"} " + std::to_string(stats[i].cycles[stage]) + "\n";
+    }
+  }
+
+  // The ports and their queues, as of the last `SamplePorts'.
+  s += "# HELP machnet_port_drops_total Packets dropped by a port, by cause.\n";
+  s += "# TYPE machnet_port_drops_total counter\n";
+  for (size_t i = 0; i < std::min(pmd_ports_.size(), port_drops_.size());
+       i++) {
+    const auto &drops = port_drops_[i];
+    const std::pair<const char *, uint64_t> kCauses[] = {
+        {"rx_missed", drops.rx_missed},
+        {"rx_nombuf", drops.rx_nombuf},
+        {"rx_errors", drops.rx_errors},
+        {"tx_errors", drops.tx_errors},
+        {"tx_alloc_failures", drops.tx_alloc_failures},
+    };
+    for (const auto &[cause, value] : kCauses) {
+      s += utils::Format(
+          "machnet_port_drops_total{port=\"%hu\",cause=\"%s\"} %lu\n",
+          pmd_ports_[i]->GetPortId(), cause, value);
+    }
+  }
+  s += "# HELP machnet_port_queue_packets_total Packets of a queue.\n";
+  s += "# TYPE machnet_port_queue_packets_total counter\n";
+  s += "# HELP machnet_port_queue_drops_total Packets dropped by a RX queue, "
+       "on drivers that count them per queue.\n";
+  s += "# TYPE machnet_port_queue_drops_total counter\n";
+  for (const auto &port : pmd_ports_) {
+    const auto port_id = port->GetPortId();
+    const uint16_t kStatsQueuesNr = RTE_ETHDEV_QUEUE_STAT_CNTRS;
+    for (uint16_t q = 0; q < std::min(port->GetRxQueuesNr(), kStatsQueuesNr);
+         q++) {
+      const auto labels =
+          utils::Format("port=\"%hu\",queue=\"%hu\"", port_id, q);
+      s += utils::Format(
+          "machnet_port_queue_packets_total{%s,direction=\"rx\"} %lu\n",
+          labels.c_str(), port->GetPortQueueRxPkts(q));
+      s += utils::Format("machnet_port_queue_drops_total{%s} %lu\n",
+                         labels.c_str(), port->GetPortQueueRxDrops(q));
+    }
+    for (uint16_t q = 0; q < std::min(port->GetTxQueuesNr(), kStatsQueuesNr);
+         q++) {
+      s += utils::Format(
+          "machnet_port_queue_packets_total{port=\"%hu\",queue=\"%hu\","
+          "direction=\"tx\"} %lu\n",
+          port_id, q, port->GetPortQueueTxPkts(q));
+    }
+  }
+  s += "# HELP machnet_port_xstat Extended statistics of the NIC driver.\n";
+  s += "# TYPE machnet_port_xstat untyped\n";
+  for (const auto &port : pmd_ports_) {
+    for (const auto &[name, value] : port->GetXstats()) {
+      s += utils::Format("machnet_port_xstat{port=\"%hu\",name=\"%s\"} %lu\n",
+                         port->GetPortId(), name.c_str(), value);
+    }
+  }
+
+  // The latency histograms of the channels, and of all of them merged.
+  using Hist = MachnetLatencyHist_t MachnetLatencyStats_t::*;
+  const std::pair<const char *, Hist> kHists[] = {
+      {"tx_queue", &MachnetLatencyStats_t::tx_queue},
+      {"rtt", &MachnetLatencyStats_t::rtt},
+      {"rx_delivery", &MachnetLatencyStats_t::rx_delivery},
+  };
+  auto summary = [&s, &kHists](const std::string &channel,
+                               const MachnetLatencyStats_t &latency) {
+    for (const auto &[kind, hist] : kHists) {
+      const auto labels =
+          utils::Format("channel=\"%s\",kind=\"%s\"", channel.c_str(), kind);
+      for (const double quantile : {0.5, 0.9, 0.99, 0.999}) {
+        s += utils::Format(
+            "machnet_channel_latency_ns{%s,quantile=\"%g\"} %lu\n",
+            labels.c_str(), quantile,
+            __machnet_latency_hist_quantile(&(latency.*hist), quantile));
+      }
+      s += utils::Format("machnet_channel_latency_ns_count{%s} %lu\n",
+                         labels.c_str(),
+                         __machnet_latency_hist_count(&(latency.*hist)));
+    }
+  };
+  s += "# HELP machnet_channel_latency_ns Latencies measured by the engines.\n";
+  s += "# TYPE machnet_channel_latency_ns summary\n";
+  MachnetLatencyStats_t merged{};
+  for (const auto &channel : channel_manager_.GetAllChannels()) {
+    const MachnetLatencyStats_t latency = channel->GetEngineStats()->latency;
+    for (const auto &[_, hist] : kHists) {
+      for (size_t b = 0; b < MACHNET_LATENCY_HIST_BUCKETS; b++) {
+        (merged.*hist).buckets[b] += (latency.*hist).buckets[b];
+      }
+    }
+    summary(channel->GetName(), latency);
+  }
+  summary("all", merged);
+  return s;
+}
+
+void MachnetController::ExportMetrics() {
+  const std::string tmp_path = std::string(kMetricsPath) + ".tmp";
+  while (metrics_running_.load()) {
+    SamplePorts();
+    std::ofstream out(tmp_path, std::ios::trunc);
+    out << GetMetrics();
+    out.close();
+    if (out.fail() || std::rename(tmp_path.c_str(), kMetricsPath) != 0) {
+      LOG_EVERY_N(WARNING, 60) << "Failed to export metrics to "
+                               << kMetricsPath;
+    }
+    // Stop promptly.
+    for (uint32_t ms = 0; ms < kMetricsIntervalMs && metrics_running_.load();
+         ms += 100) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
 }
 
 void MachnetController::RunController() {
@@ -313,12 +994,297 @@ void MachnetController::RunController() {
     this->HandleTimeout(socket);
   };
 
-  server_ = std::make_unique<UDServer>(socket_path, on_connect_cb, on_close_cb,
-                                       on_message_cb, on_timeout_cb);
+  if (!handoff_.has_value()) {
+    server_ = std::make_unique<UDServer>(socket_path, on_connect_cb,
+                                         on_close_cb, on_message_cb,
+                                         on_timeout_cb);
+    server_->Run();
+    return;
+  }
 
+  // Serve the applications of the previous Machnet, on its socket.
+  server_ = std::make_unique<UDServer>(handoff_->listen_fd, on_connect_cb,
+                                       on_close_cb, on_message_cb,
+                                       on_timeout_cb);
+  for (const auto &[app_uuid_str, fd] : handoff_->app_sockets) {
+    auto *socket = server_->AdoptClient(fd);
+    if (socket == nullptr) {
+      LOG(ERROR) << "Cannot serve application " << app_uuid_str << ".";
+      continue;
+    }
+    auto *client_context =
+        reinterpret_cast<MachnetClientContext *>(socket->GetUserData());
+    client_context->registered = true;
+    uuid_parse(app_uuid_str.c_str(), client_context->uuid);
+    application_sockets_[app_uuid_str] = fd;
+  }
+  handoff_.reset();
   server_->Run();
 }
 
+bool MachnetController::TakeOver() {
+  UDSocket socket;
+  if (!socket.Connect(MACHNET_CONTROLLER_DEFAULT_PATH)) {
+    LOG(WARNING) << "No Machnet to take over from; starting afresh.";
+    return false;
+  }
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_HANDOFF;
+  req.msg_id = getpid();
+  if (!socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return false;
+  }
+
+  // Receives the next message of the handoff, of the given type, with its
+  // descriptors.
+  machnet_ctrl_msg_t msg;
+  int fds[MACHNET_CTRL_MSG_MAX_FDS];
+  size_t fds_nr;
+  auto receive = [&](uint16_t type) {
+    fds_nr = MACHNET_CTRL_MSG_MAX_FDS;
+    const auto nbytes = socket.RecvMsgWithFds(reinterpret_cast<char *>(&msg),
+                                              sizeof(msg), fds, &fds_nr);
+    if (nbytes == static_cast<int>(sizeof(msg)) && msg.type == type &&
+        msg.status == MACHNET_CTRL_STATUS_SUCCESS) {
+      return true;
+    }
+    for (size_t i = 0; i < fds_nr; i++) close(fds[i]);
+    return false;
+  };
+  if (!receive(MACHNET_CTRL_MSG_TYPE_RESPONSE) || fds_nr != 1) {
+    LOG(ERROR) << "The running Machnet refused to hand over.";
+    return false;
+  }
+  const pid_t pid = msg.handoff_info.pid;
+  const size_t channels_nr = msg.handoff_info.channels_nr;
+  const size_t apps_nr = msg.handoff_info.apps_nr;
+  HandOffState state{fds[0], -1, {}, {}};
+
+  // From now on the running Machnet is stopping: whatever is not received is
+  // lost.
+  for (size_t i = 0; i < channels_nr; i++) {
+    if (!receive(MACHNET_CTRL_MSG_TYPE_HANDOFF_CHANNEL)) break;
+    std::array<int, 3> channel_fds{-1, -1, -1};
+    size_t next = 0;
+    for (size_t j = 0; j < channel_fds.size() && next < fds_nr; j++) {
+      if (msg.handoff_info.fds_mask & (1u << j)) channel_fds[j] = fds[next++];
+    }
+    state.channel_fds.emplace_back(channel_fds);
+  }
+  for (size_t i = 0; i < apps_nr; i++) {
+    if (!receive(MACHNET_CTRL_MSG_TYPE_HANDOFF_APP)) break;
+    if (fds_nr != 1) continue;
+    state.app_sockets.emplace_back(juggler::utils::UUIDToString(msg.app_uuid),
+                                   fds[0]);
+  }
+  if (state.channel_fds.size() != channels_nr ||
+      state.app_sockets.size() != apps_nr ||
+      !receive(MACHNET_CTRL_MSG_TYPE_HANDOFF_LISTEN) || fds_nr != 1) {
+    LOG(ERROR) << "The handoff was cut short; starting afresh.";
+    close(state.checkpoint_fd);
+    for (const auto &channel_fds : state.channel_fds) {
+      for (const int fd : channel_fds) {
+        if (fd >= 0) close(fd);
+      }
+    }
+    for (const auto &[_, fd] : state.app_sockets) close(fd);
+    return false;
+  }
+  state.listen_fd = fds[0];
+
+  // The NICs are free once the previous Machnet is gone.
+  LOG(INFO) << "Waiting for Machnet (pid " << pid << ") to exit.";
+  while (kill(pid, 0) == 0 || errno != ESRCH) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  LOG(INFO) << "Took over " << channels_nr << " channels of " << apps_nr
+            << " applications.";
+  handoff_ = std::move(state);
+  return true;
+}
+
+void MachnetController::HandOff(UDSocket *s, const machnet_ctrl_msg_t *req) {
+  machnet_ctrl_msg_t resp = {};
+  resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+  resp.msg_id = req->msg_id;
+  const auto uid = s->GetPeerUid();
+  if (!uid.has_value() || (uid.value() != 0 && uid.value() != geteuid())) {
+    LOG(ERROR) << "Refusing to hand over to a process of another user.";
+    resp.status = MACHNET_CTRL_STATUS_FAILURE;
+    CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+    return;
+  }
+  LOG(INFO) << "Handing " << channel_engines_.size()
+            << " channels over to the successor.";
+
+  std::unordered_map<std::string, std::string> channel_apps;
+  for (const auto &[app_uuid_str, app_channels] : applications_registered_) {
+    for (const auto &name : app_channels) channel_apps[name] = app_uuid_str;
+  }
+
+  // Take every channel off its engine; the engines never touch it again.
+  utils::CheckpointWriter writer;
+  writer.Put(kCheckpointMagic);
+  writer.Put(kCheckpointVersion);
+  writer.Put<uint64_t>(channel_engines_.size());
+  std::vector<std::pair<std::string, std::shared_ptr<shm::Channel>>> channels;
+  for (const auto &[name, engine_index] : channel_engines_) {
+    const auto channel = channel_manager_.GetChannel(name.c_str());
+    std::promise<std::optional<MachnetEngine::DetachedChannel>> p;
+    auto fstatus = p.get_future();
+    engines_[engine_index]->DetachChannel(channel, std::move(p));
+    const auto detached = fstatus.get();
+    CHECK(detached.has_value())
+        << "Channel " << name << " is not on engine " << engine_index;
+    writer.Put(name);
+    writer.Put(channel->GetShmName());
+    writer.Put(channel_apps[name]);
+    writer.Put<uint64_t>(engine_index);
+    MachnetEngine::HandOffChannel(detached.value(), &writer);
+    channel->HandOff();
+    channels.emplace_back(name, channel);
+  }
+  const int checkpoint_fd = writer.ToFd();
+  CHECK_GE(checkpoint_fd, 0) << "Failed to write the checkpoint.";
+
+  resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+  resp.handoff_info.pid = getpid();
+  resp.handoff_info.channels_nr = channels.size();
+  resp.handoff_info.apps_nr = application_sockets_.size();
+  CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&resp), sizeof(resp),
+                         checkpoint_fd));
+  close(checkpoint_fd);
+
+  for (const auto &[name, channel] : channels) {
+    machnet_ctrl_msg_t msg = {};
+    msg.type = MACHNET_CTRL_MSG_TYPE_HANDOFF_CHANNEL;
+    msg.msg_id = req->msg_id;
+    msg.status = MACHNET_CTRL_STATUS_SUCCESS;
+    uuid_parse(name.c_str(), msg.handoff_info.channel_uuid);
+    // See `MACHNET_HANDOFF_FD_*' for the order of descriptors; only the
+    // valid ones are sent.
+    const int channel_fds[] = {channel->GetFd(), channel->GetDoorbellFd(),
+                               channel->GetNotifyFd()};
+    int fds[std::size(channel_fds)];
+    size_t fds_nr = 0;
+    for (size_t i = 0; i < std::size(channel_fds); i++) {
+      if (channel_fds[i] < 0) continue;
+      fds[fds_nr++] = channel_fds[i];
+      msg.handoff_info.fds_mask |= 1u << i;
+    }
+    CHECK(s->SendMsgWithFds(reinterpret_cast<char *>(&msg), sizeof(msg), fds,
+                            fds_nr));
+  }
+  for (const auto &[app_uuid_str, fd] : application_sockets_) {
+    machnet_ctrl_msg_t msg = {};
+    msg.type = MACHNET_CTRL_MSG_TYPE_HANDOFF_APP;
+    msg.msg_id = req->msg_id;
+    msg.status = MACHNET_CTRL_STATUS_SUCCESS;
+    uuid_parse(app_uuid_str.c_str(), msg.app_uuid);
+    CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&msg), sizeof(msg), fd));
+  }
+  machnet_ctrl_msg_t msg = {};
+  msg.type = MACHNET_CTRL_MSG_TYPE_HANDOFF_LISTEN;
+  msg.msg_id = req->msg_id;
+  msg.status = MACHNET_CTRL_STATUS_SUCCESS;
+  CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&msg), sizeof(msg),
+                         server_->GetListenFd()));
+
+  LOG(INFO) << "Handed over to the successor; stopping.";
+  handed_off_ = true;
+  server_->Stop();
+}
+
+void MachnetController::RestoreHandOff() {
+  if (!handoff_.has_value()) return;
+  auto &state = handoff_.value();
+  utils::CheckpointReader reader(state.checkpoint_fd);
+  close(state.checkpoint_fd);
+  state.checkpoint_fd = -1;
+  for (const auto &[app_uuid_str, _] : state.app_sockets) {
+    applications_registered_.insert({app_uuid_str, {}});
+  }
+
+  uint32_t magic, version;
+  uint64_t channels_nr;
+  if (!reader.Get(&magic) || magic != kCheckpointMagic ||
+      !reader.Get(&version) || version != kCheckpointVersion ||
+      !reader.Get(&channels_nr) || channels_nr != state.channel_fds.size()) {
+    LOG(ERROR) << "Invalid checkpoint; dropping the channels handed over.";
+    channels_nr = 0;
+  }
+
+  size_t restored_nr = 0;
+  for (size_t i = 0; i < state.channel_fds.size(); i++) {
+    const auto [fd, doorbell_fd, notify_fd] = state.channel_fds[i];
+    std::string name, shm_name, app_uuid_str;
+    uint64_t engine_index;
+    if (i >= channels_nr || !reader.Get(&name) || !reader.Get(&shm_name) ||
+        !reader.Get(&app_uuid_str) || !reader.Get(&engine_index)) {
+      for (const int channel_fd : state.channel_fds[i]) {
+        if (channel_fd >= 0) close(channel_fd);
+      }
+      continue;
+    }
+    // The state of a channel is only read through the channel: once one is
+    // lost, so are the ones after it.
+    auto channel = ChannelManager::MapChannel(shm_name.c_str(), fd,
+                                              doorbell_fd, notify_fd);
+    if (channel == nullptr) {
+      LOG(ERROR) << "Cannot map channel " << name << ".";
+      channels_nr = i;
+      continue;
+    }
+    if (engine_index >= engines_.size()) {
+      bool dedicated;
+      engine_index = PlaceChannel(0, &dedicated);
+    }
+    const auto &engine = engines_[engine_index];
+    auto restored = engine->RestoreChannel(channel, &reader);
+    if (!restored.has_value()) {
+      LOG(ERROR) << "Invalid checkpoint of channel " << name << ".";
+      channels_nr = i;
+      continue;
+    }
+    if ((kShmZeroCopyEnabled || engine->IsRxZeroCopyEnabled()) &&
+        !channel->RegisterMemForDMA(engine->GetPmdPort()->GetDevice())) {
+      LOG(ERROR) << "Cannot register channel " << name << " for DMA.";
+      continue;
+    }
+    if (!channel_manager_.AdoptChannel(name.c_str(), channel)) continue;
+    // Segments the channel grew by are charged to the budget anew.
+    channel->SetBufBudget(GetAppBufBudget(app_uuid_str, engine));
+
+    // Any engine of the port serves the flows of the channel, provided their
+    // packets can be steered to it.
+    auto attach = [&](size_t index) {
+      std::promise<bool> p;
+      auto fstatus = p.get_future();
+      engines_[index]->AttachChannel(
+          MachnetEngine::DetachedChannel(restored.value()), std::move(p));
+      return fstatus.get();
+    };
+    std::optional<size_t> attached;
+    if (attach(engine_index)) attached = engine_index;
+    for (size_t j = 0; j < engines_.size() && !attached.has_value(); j++) {
+      if (j != engine_index &&
+          engines_[j]->GetPmdPort() == engine->GetPmdPort() && attach(j)) {
+        attached = j;
+      }
+    }
+    if (!attached.has_value()) {
+      LOG(ERROR) << "No engine takes channel " << name << "; dropping it.";
+      channel_manager_.DestroyChannel(name.c_str());
+      continue;
+    }
+    applications_registered_[app_uuid_str].insert(name);
+    channel_engines_[name] = attached.value();
+    restored_nr++;
+  }
+  LOG(INFO) << "Restored " << restored_nr << " of "
+            << state.channel_fds.size() << " channels handed over.";
+}
+
 void MachnetController::Stop() {
   CHECK_NOTNULL(server_);
   server_->Stop();
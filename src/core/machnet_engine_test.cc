@@ -9,10 +9,14 @@
 #include <gtest/gtest.h>
 #include <machnet_engine.h>
 #include <packet.h>
+#include <packet_pool.h>
 #include <pmd.h>
 
+#include <future>
 #include <memory>
 #include <numeric>
+#include <optional>
+#include <vector>
 
 constexpr const char *file_name(const char *path) {
   const char *file = path;
@@ -26,6 +30,21 @@ constexpr const char *file_name(const char *path) {
 
 const char *fname = file_name(__FILE__);
 
+// Lets tests reach the path keys of multipath flows (see
+// `Flow::SetMultipath').
+class MultipathTestEngine : public juggler::MachnetEngine {
+ public:
+  using MachnetEngine::InsertPathKeys;
+  using MachnetEngine::MachnetEngine;
+  using MachnetEngine::RemovePathKeys;
+
+  // The flow that `pkt', with flow key `key', goes to; nullptr if none.
+  juggler::net::flow::Flow *FindFlow(const juggler::dpdk::Packet *pkt,
+                                     const juggler::net::flow::Key &key) {
+    return find_rx_flow(pkt, key, flow_hash(key));
+  }
+};
+
 TEST(BasicMachnetEngineSharedStateTest, SrcPortAlloc) {
   using EthAddr = juggler::net::Ethernet::Address;
   using Ipv4Addr = juggler::net::Ipv4::Address;
@@ -86,6 +105,80 @@ TEST(BasicMachnetEngineSharedStateTest, SrcPortAlloc) {
   EXPECT_FALSE(port.has_value());
 }
 
+TEST(BasicMachnetEngineSharedStateTest, SrcPortAllocCandidates) {
+  using EthAddr = juggler::net::Ethernet::Address;
+  using Ipv4Addr = juggler::net::Ipv4::Address;
+  using UdpPort = juggler::net::Udp::Port;
+  using MachnetEngineSharedState = juggler::MachnetEngineSharedState;
+
+  EthAddr test_mac{"00:00:00:00:00:01"};
+  Ipv4Addr test_ip;
+  test_ip.FromString("10.0.0.1");
+
+  MachnetEngineSharedState state({}, {test_mac}, {test_ip});
+  std::vector<uint64_t> candidates(MachnetEngineSharedState::kSrcPortBitmapSize,
+                                   0);
+  for (uint16_t port : {2000, 3000}) candidates[port / 64] |= 1ULL << port % 64;
+
+  EXPECT_EQ(state.SrcPortAlloc(test_ip, candidates), UdpPort(2000));
+  EXPECT_EQ(state.SrcPortAlloc(test_ip, candidates), UdpPort(3000));
+  EXPECT_FALSE(state.SrcPortAlloc(test_ip, candidates).has_value());
+  state.SrcPortRelease(test_ip, UdpPort(2000));
+  EXPECT_EQ(state.SrcPortAlloc(test_ip, candidates), UdpPort(2000));
+}
+
+TEST(BasicMachnetEngineSharedStateTest, RssPortHashes) {
+  using EthAddr = juggler::net::Ethernet::Address;
+  using Ipv4Addr = juggler::net::Ipv4::Address;
+  using MachnetEngineSharedState = juggler::MachnetEngineSharedState;
+
+  EthAddr test_mac{"00:00:00:00:00:01"};
+  Ipv4Addr test_ip;
+  test_ip.FromString("10.0.0.1");
+  std::vector<uint8_t> rss_key(40);
+  std::iota(rss_key.begin(), rss_key.end(), 0x5a);
+
+  MachnetEngineSharedState state(rss_key, {test_mac}, {test_ip});
+  const auto &port_hashes = state.GetRssPortHashes();
+  ASSERT_EQ(port_hashes.size(), MachnetEngineSharedState::kSrcPortMax + 1);
+
+  rte_thash_tuple tuple{};
+  tuple.v4.src_addr = 0x0a000002;
+  tuple.v4.dst_addr = test_ip.address.value();
+  tuple.v4.sport = 888;
+  const auto hash = rte_softrss(reinterpret_cast<uint32_t *>(&tuple),
+                                RTE_THASH_V4_L4_LEN, rss_key.data());
+  for (uint16_t port : {1, 1024, 4567, 65535}) {
+    tuple.v4.dport = port;
+    EXPECT_EQ(rte_softrss(reinterpret_cast<uint32_t *>(&tuple),
+                          RTE_THASH_V4_L4_LEN, rss_key.data()),
+              hash ^ port_hashes[port]);
+  }
+}
+
+TEST(BasicMachnetEngineSharedStateTest, StaticNeighbors) {
+  using EthAddr = juggler::net::Ethernet::Address;
+  using Ipv4Addr = juggler::net::Ipv4::Address;
+  using MachnetEngineSharedState = juggler::MachnetEngineSharedState;
+
+  EthAddr test_mac{"00:00:00:00:00:01"};
+  Ipv4Addr test_ip, neighbor_ip;
+  test_ip.FromString("10.0.0.1");
+  neighbor_ip.FromString("10.0.0.2");
+  EthAddr neighbor_mac{"00:00:00:00:00:02"};
+
+  MachnetEngineSharedState empty_state({}, {test_mac}, {test_ip});
+  EXPECT_TRUE(empty_state.GetArpTable().second.empty());
+
+  MachnetEngineSharedState state({}, {test_mac}, {test_ip},
+                                 {{neighbor_ip, neighbor_mac}});
+  const auto [version, arp_table] = state.GetArpTable();
+  EXPECT_NE(version, empty_state.GetArpVersion());
+  EXPECT_EQ(version, state.GetArpVersion());
+  ASSERT_EQ(arp_table.size(), 1);
+  EXPECT_EQ(arp_table.at(neighbor_ip), neighbor_mac);
+}
+
 TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
   using PmdPort = juggler::dpdk::PmdPort;
   using MachnetEngine = juggler::MachnetEngine;
@@ -110,6 +203,135 @@ TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
   EXPECT_EQ(engine.GetChannelCount(), 1);
 }
 
+TEST(BasicMachnetEngineTest, ChannelMigration) {
+  using PmdPort = juggler::dpdk::PmdPort;
+  using MachnetEngine = juggler::MachnetEngine;
+
+  const uint32_t kChannelRingSize = 1024;
+  juggler::shm::ChannelManager channel_mgr;
+  channel_mgr.AddChannel(fname, kChannelRingSize, kChannelRingSize,
+                         kChannelRingSize, kChannelRingSize);
+  auto channel = channel_mgr.GetChannel(fname);
+
+  juggler::net::Ethernet::Address test_mac("00:00:00:00:00:01");
+  juggler::net::Ipv4::Address test_ip;
+  test_ip.FromString("10.0.0.1");
+  std::vector<uint8_t> rss_key = {};
+  std::vector<juggler::net::Ipv4::Address> test_ips = {test_ip};
+  auto shared_state = std::make_shared<juggler::MachnetEngineSharedState>(
+      rss_key, test_mac, test_ips);
+  const uint32_t kRingDescNr = 1024;
+  auto pmd_port = std::make_shared<PmdPort>(0, 2, 2, kRingDescNr, kRingDescNr);
+  pmd_port->InitDriver();
+  MachnetEngine engine_a(pmd_port, 0, 0, shared_state, {channel});
+  MachnetEngine engine_b(pmd_port, 1, 1, shared_state);
+
+  // Detaching takes effect on the next engine cycle.
+  std::promise<std::optional<MachnetEngine::DetachedChannel>> detach_promise;
+  auto detach_status = detach_promise.get_future();
+  engine_a.DetachChannel(channel, std::move(detach_promise));
+  EXPECT_EQ(engine_a.GetChannelCount(), 1);
+  engine_a.Run(juggler::time::rdtsc());
+  auto detached = detach_status.get();
+  ASSERT_TRUE(detached.has_value());
+  EXPECT_EQ(detached->channel, channel);
+  EXPECT_EQ(engine_a.GetChannelCount(), 0);
+
+  std::promise<bool> attach_promise;
+  auto attach_status = attach_promise.get_future();
+  engine_b.AttachChannel(std::move(detached.value()),
+                         std::move(attach_promise));
+  engine_b.Run(juggler::time::rdtsc());
+  EXPECT_TRUE(attach_status.get());
+  EXPECT_EQ(engine_b.GetChannelCount(), 1);
+
+  // The channel is no longer on the first engine.
+  std::promise<std::optional<MachnetEngine::DetachedChannel>> again_promise;
+  auto again_status = again_promise.get_future();
+  engine_a.DetachChannel(channel, std::move(again_promise));
+  engine_a.Run(juggler::time::rdtsc());
+  EXPECT_FALSE(again_status.get().has_value());
+}
+
+TEST(BasicMachnetEngineTest, MultipathPathKeys) {
+  using PmdPort = juggler::dpdk::PmdPort;
+  using Flow = juggler::net::flow::Flow;
+  using Key = juggler::net::flow::Key;
+  using UdpPort = juggler::net::Udp::Port;
+
+  const uint32_t kChannelRingSize = 1024;
+  juggler::shm::ChannelManager channel_mgr;
+  channel_mgr.AddChannel(fname, kChannelRingSize, kChannelRingSize,
+                         kChannelRingSize, kChannelRingSize);
+  auto channel = channel_mgr.GetChannel(fname);
+
+  juggler::net::Ethernet::Address test_mac("00:00:00:00:00:01");
+  juggler::net::Ipv4::Address test_ip, remote_ip;
+  test_ip.FromString("10.0.0.1");
+  remote_ip.FromString("10.0.0.2");
+  std::vector<uint8_t> rss_key = {};
+  std::vector<juggler::net::Ipv4::Address> test_ips = {test_ip};
+  auto shared_state = std::make_shared<juggler::MachnetEngineSharedState>(
+      rss_key, test_mac, test_ips);
+  const uint32_t kRingDescNr = 1024;
+  auto pmd_port = std::make_shared<PmdPort>(0, 1, 1, kRingDescNr, kRingDescNr);
+  pmd_port->InitDriver();
+  MultipathTestEngine engine(pmd_port, 0, 0, shared_state, {channel});
+  juggler::dpdk::TxBatch txbatch(pmd_port->GetRing<juggler::dpdk::TxRing>(0));
+  juggler::dpdk::PacketPool pkt_pool(64);
+  auto *pkt = CHECK_NOTNULL(pkt_pool.PacketAlloc());
+
+  // A flow initiated over 3 paths, with ports allocated like its own.
+  auto alloc_port = [&shared_state, &test_ip]() {
+    return shared_state->SrcPortAlloc(test_ip, [](uint16_t) { return true; })
+        .value();
+  };
+  const UdpPort local_port = alloc_port();
+  const std::vector<UdpPort> path_ports = {alloc_port(), alloc_port()};
+  const UdpPort remote_port(888);
+  auto create_flow = [&](const UdpPort &port) {
+    return std::make_unique<Flow>(
+        test_ip, port, remote_ip, remote_port, test_mac, test_mac, &txbatch,
+        [](juggler::shm::Channel *, bool, const Key &) {},
+        juggler::net::swift::Algorithm::kSwift, channel.get());
+  };
+  auto path_key = [&](const UdpPort &port) {
+    return Key(test_ip, port, remote_ip, remote_port);
+  };
+  auto flow = create_flow(local_port);
+  flow->SetMultipath(3, 0, path_ports);
+
+  // Packets of the paths beyond the first find the flow; the flow key is
+  // inserted on its own.
+  engine.InsertPathKeys(flow.get());
+  EXPECT_EQ(engine.FindFlow(pkt, path_key(local_port)), nullptr);
+  for (const auto &port : path_ports) {
+    EXPECT_EQ(engine.FindFlow(pkt, path_key(port)), flow.get());
+  }
+
+  // A path taken already stays with its flow, and so does its port.
+  const UdpPort other_port = alloc_port();
+  auto other = create_flow(other_port);
+  other->SetMultipath(2, 0, {path_ports[0]});
+  engine.InsertPathKeys(other.get());
+  EXPECT_EQ(engine.FindFlow(pkt, path_key(path_ports[0])), flow.get());
+  engine.RemovePathKeys(other.get());
+  EXPECT_EQ(engine.FindFlow(pkt, path_key(path_ports[0])), flow.get());
+  EXPECT_FALSE(shared_state->SrcPortClaim(test_ip, path_ports[0]));
+
+  // Removing the paths releases their ports, but not the flow's.
+  engine.RemovePathKeys(flow.get());
+  for (const auto &port : path_ports) {
+    EXPECT_EQ(engine.FindFlow(pkt, path_key(port)), nullptr);
+    EXPECT_TRUE(shared_state->SrcPortClaim(test_ip, port));
+    shared_state->SrcPortRelease(test_ip, port);
+  }
+  EXPECT_FALSE(shared_state->SrcPortClaim(test_ip, local_port));
+  shared_state->SrcPortRelease(test_ip, local_port);
+  shared_state->SrcPortRelease(test_ip, other_port);
+  juggler::dpdk::Packet::Free(pkt);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
 
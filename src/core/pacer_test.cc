@@ -0,0 +1,122 @@
+/**
+ * @file pacer_test.cc
+ *
+ * Unit tests for the engine's pacing timing wheel.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <pacer.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class PacerTest : public ::testing::Test {
+ protected:
+  static constexpr uint64_t kSlotCycles = 100;
+  static constexpr size_t kSlotsNr = 16;
+
+  // The pacer never dereferences flows.
+  static Flow *FakeFlow(size_t i) {
+    return reinterpret_cast<Flow *>((i + 1) * sizeof(void *));
+  }
+
+  // Advances the pacer to `now', and returns the flows released.
+  std::vector<Flow *> Advance(uint64_t now) {
+    std::vector<Flow *> released;
+    pacer_.Advance(now, [&released](Flow *flow) { released.push_back(flow); });
+    return released;
+  }
+
+  Pacer pacer_{kSlotCycles, kSlotsNr};
+};
+
+TEST_F(PacerTest, ReleaseOrder) {
+  pacer_.Schedule(FakeFlow(0), 250);
+  pacer_.Schedule(FakeFlow(1), 120);
+  pacer_.Schedule(FakeFlow(2), 300);
+  EXPECT_EQ(pacer_.size(), 3);
+
+  // Flows are not released before their time, and at most a slot after it.
+  EXPECT_TRUE(Advance(119).empty());
+  EXPECT_EQ(Advance(200), std::vector<Flow *>{FakeFlow(1)});
+  EXPECT_TRUE(Advance(299).empty());
+  const auto released = Advance(300);
+  EXPECT_EQ(released, (std::vector<Flow *>{FakeFlow(0), FakeFlow(2)}));
+  EXPECT_TRUE(pacer_.empty());
+}
+
+TEST_F(PacerTest, PastDeadline) {
+  Advance(1000);
+  pacer_.Schedule(FakeFlow(0), 10);
+  EXPECT_EQ(Advance(1000), std::vector<Flow *>{FakeFlow(0)});
+}
+
+TEST_F(PacerTest, Horizon) {
+  // Beyond the horizon: released early, on the last slot.
+  const uint64_t horizon = kSlotCycles * kSlotsNr;
+  pacer_.Schedule(FakeFlow(0), 10 * horizon);
+  EXPECT_TRUE(Advance(horizon - 2 * kSlotCycles).empty());
+  EXPECT_EQ(Advance(horizon), std::vector<Flow *>{FakeFlow(0)});
+
+  // After a long pause, everything is due.
+  for (size_t i = 0; i < kSlotsNr; i++) {
+    pacer_.Schedule(FakeFlow(i), horizon + i * kSlotCycles);
+  }
+  EXPECT_EQ(Advance(100 * horizon).size(), kSlotsNr);
+  EXPECT_TRUE(pacer_.empty());
+}
+
+TEST_F(PacerTest, Reschedule) {
+  // A flow released may schedule itself again; it is not released twice in
+  // the same call, even if it is due, but on the next slot.
+  pacer_.Schedule(FakeFlow(0), 100);
+  size_t releases = 0;
+  pacer_.Advance(100, [this, &releases](Flow *flow) {
+    releases++;
+    pacer_.Schedule(flow, 0);
+  });
+  EXPECT_EQ(releases, 1);
+  EXPECT_TRUE(Advance(100).empty());
+  EXPECT_EQ(Advance(200), std::vector<Flow *>{FakeFlow(0)});
+}
+
+TEST_F(PacerTest, RemoveAndDrain) {
+  for (size_t i = 0; i < 4; i++) pacer_.Schedule(FakeFlow(i), i * kSlotCycles);
+  pacer_.Remove(FakeFlow(1));
+  EXPECT_EQ(pacer_.size(), 3);
+
+  std::vector<Flow *> drained;
+  pacer_.Drain([&drained](Flow *flow) { drained.push_back(flow); });
+  std::sort(drained.begin(), drained.end());
+  EXPECT_EQ(drained,
+            (std::vector<Flow *>{FakeFlow(0), FakeFlow(2), FakeFlow(3)}));
+  EXPECT_TRUE(pacer_.empty());
+  EXPECT_TRUE(Advance(100 * kSlotCycles).empty());
+}
+
+TEST_F(PacerTest, PriorityOrder) {
+  // Flows due on the same slot are released by class, then in schedule order.
+  pacer_.Schedule(FakeFlow(0), 150, 2);
+  pacer_.Schedule(FakeFlow(1), 120, 1);
+  pacer_.Schedule(FakeFlow(2), 180, 0);
+  pacer_.Schedule(FakeFlow(3), 110, 1);
+  pacer_.Schedule(FakeFlow(4), 50, 2);
+  EXPECT_EQ(Advance(200), (std::vector<Flow *>{FakeFlow(4), FakeFlow(2),
+                                               FakeFlow(1), FakeFlow(3),
+                                               FakeFlow(0)}));
+  EXPECT_TRUE(pacer_.empty());
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
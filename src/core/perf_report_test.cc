@@ -0,0 +1,133 @@
+/**
+ * @file perf_report_test.cc
+ *
+ * Unit tests for the machine-readable reports of the benchmarks.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <perf_report.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace perf {
+
+static Result MakeResult(double ops_per_sec, double p99_ns) {
+  Result result;
+  result.name = "ping_pong";
+  result.Param("msg_size", 64).Param("mode", "rr");
+  result.OpsPerSec(ops_per_sec)
+      .Latency(p99_ns / 2, p99_ns, p99_ns * 2)
+      .Set("flows", 16, Better::kNone);
+  return result;
+}
+
+TEST(PerfReportTest, WriteAndLoad) {
+  Report report("perf_report_test");
+  report.Add(MakeResult(1e6, 1000));
+  Result other;
+  other.name = "other";
+  report.Add(other);
+  // Same name and parameters: replaces the first result.
+  report.Add(MakeResult(2e6, 1000));
+  ASSERT_EQ(report.results().size(), 2);
+
+  const std::string path = testing::TempDir() + "perf_report_test.json";
+  ASSERT_TRUE(report.Write(path));
+  const auto loaded = Report::Load(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(loaded.has_value());
+
+  EXPECT_EQ(loaded->benchmark(), "perf_report_test");
+  ASSERT_EQ(loaded->results().size(), 2);
+  const auto *result = loaded->Find("ping_pong/mode:rr/msg_size:64");
+  ASSERT_NE(result, nullptr);
+  EXPECT_EQ(result->params.at("msg_size"), "64");
+  EXPECT_EQ(result->metrics.at(kOpsPerSec).value, 2e6);
+  EXPECT_EQ(result->metrics.at(kOpsPerSec).better, Better::kHigher);
+  EXPECT_EQ(result->metrics.at(kP999Ns).value, 2000);
+  EXPECT_EQ(result->metrics.at(kP999Ns).better, Better::kLower);
+  EXPECT_EQ(result->metrics.at("flows").better, Better::kNone);
+  EXPECT_NE(loaded->Find("other"), nullptr);
+}
+
+TEST(PerfReportTest, Compare) {
+  Report baseline("perf_report_test");
+  baseline.Add(MakeResult(1e6, 1000));
+
+  // Within the tolerance, or better: no regressions.
+  Report current("perf_report_test");
+  current.Add(MakeResult(0.96e6, 1040));
+  EXPECT_TRUE(current.Compare(baseline, 0.05).empty());
+  current.Add(MakeResult(2e6, 10));
+  EXPECT_TRUE(current.Compare(baseline, 0.05).empty());
+
+  // Fewer ops/s, and higher latency, are regressions.
+  current.Add(MakeResult(0.5e6, 1000).Set("flows", 1, Better::kNone));
+  auto regressions = current.Compare(baseline, 0.05);
+  ASSERT_EQ(regressions.size(), 1);
+  EXPECT_EQ(regressions[0].metric, kOpsPerSec);
+  EXPECT_DOUBLE_EQ(regressions[0].change, -0.5);
+
+  current.Add(MakeResult(1e6, 1100));
+  regressions = current.Compare(baseline, 0.05);
+  ASSERT_EQ(regressions.size(), 3);  // p50, p99 and p999.
+  for (const auto &r : regressions) {
+    EXPECT_EQ(r.key, "ping_pong/mode:rr/msg_size:64");
+    EXPECT_DOUBLE_EQ(r.change, -0.1);
+  }
+  EXPECT_TRUE(current.Compare(baseline, 0.2).empty());
+
+  // Results missing from the baseline are not compared.
+  Result other = MakeResult(1, 1e9);
+  other.Param("msg_size", 1024);
+  Report unrelated("perf_report_test");
+  unrelated.Add(other);
+  EXPECT_TRUE(unrelated.Compare(baseline, 0.05).empty());
+}
+
+TEST(PerfReportTest, LoadRejectsOtherFiles) {
+  const std::string path = testing::TempDir() + "perf_report_bogus.json";
+  for (const char *contents :
+       {"not json", "[1, 2]", R"({"results": {}})",
+        R"({"results": [{"name": "a", "metrics": {"x": "fast"}}]})"}) {
+    auto *file = std::fopen(path.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    std::fputs(contents, file);
+    std::fclose(file);
+    EXPECT_FALSE(Report::Load(path).has_value()) << contents;
+  }
+  std::remove(path.c_str());
+  EXPECT_FALSE(Report::Load(path).has_value());
+}
+
+TEST(PerfReportTest, ParseOptions) {
+  std::vector<std::string> args = {"bench", "--benchmark_filter=BM_x",
+                                   "--perf_json=/tmp/out.json",
+                                   "--perf_baseline=/tmp/base.json",
+                                   "--perf_tolerance=0.1", "--v=1"};
+  std::vector<char *> argv;
+  for (auto &arg : args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  int argc = args.size();
+
+  const auto options = Options::Parse(&argc, argv.data());
+  EXPECT_EQ(options.json_path, "/tmp/out.json");
+  EXPECT_EQ(options.baseline_path, "/tmp/base.json");
+  EXPECT_DOUBLE_EQ(options.tolerance, 0.1);
+  ASSERT_EQ(argc, 3);
+  EXPECT_STREQ(argv[1], "--benchmark_filter=BM_x");
+  EXPECT_STREQ(argv[2], "--v=1");
+  EXPECT_EQ(argv[3], nullptr);
+}
+
+}  // namespace perf
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+/**
+ * @file scoreboard_test.cc
+ *
+ * Unit tests for the sender-side scoreboard and RACK loss detection.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <scoreboard.h>
+
+#include <optional>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class ScoreboardTest : public ::testing::Test {
+ protected:
+  static constexpr uint32_t kFirstSeqno = 1000;
+
+  // Sends `nr' packets, the i-th at TSC `i * 10'; the cookie is the seqno.
+  void Send(uint32_t nr) {
+    for (uint32_t i = 0; i < nr; i++) {
+      const uint32_t seqno = kFirstSeqno + sent_nr_;
+      scoreboard_.OnSend(seqno, seqno, sent_nr_ * 10);
+      sent_nr_++;
+    }
+  }
+
+  // SACKs the packets at the given offsets from `ackno', in a bitmap from
+  // `base' on.
+  void Sack(uint32_t ackno, const std::vector<uint32_t> &offsets,
+            uint32_t base = 0) {
+    Scoreboard::SackBitmap bitmap{};
+    for (auto offset : offsets) {
+      offset -= base;
+      bitmap[offset / 64] |= uint64_t{1} << (offset % 64);
+    }
+    scoreboard_.OnSack(ackno, base, bitmap);
+  }
+
+  // Retransmits all the lost packets at `tx_tsc', and returns their seqnos.
+  std::vector<uint32_t> RetransmitLost(uint64_t tx_tsc) {
+    std::vector<uint32_t> seqnos;
+    while (auto seqno = scoreboard_.RetransmitLost(tx_tsc)) {
+      seqnos.push_back(*seqno);
+    }
+    return seqnos;
+  }
+
+  Scoreboard scoreboard_;
+  uint32_t sent_nr_{0};
+};
+
+TEST_F(ScoreboardTest, SendAndAck) {
+  Send(10);
+  EXPECT_EQ(scoreboard_.size(), 10);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 10);
+  EXPECT_EQ(scoreboard_.room(), Scoreboard::kDefaultCapacity - 10);
+  EXPECT_EQ(scoreboard_.cookie(kFirstSeqno + 3), kFirstSeqno + 3);
+
+  // Old and duplicate ACKs change nothing.
+  scoreboard_.OnAck(kFirstSeqno - 1);
+  scoreboard_.OnAck(kFirstSeqno);
+  EXPECT_EQ(scoreboard_.size(), 10);
+
+  scoreboard_.OnAck(kFirstSeqno + 4);
+  EXPECT_EQ(scoreboard_.size(), 6);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 6);
+  scoreboard_.OnAck(kFirstSeqno + 10);
+  EXPECT_TRUE(scoreboard_.empty());
+  EXPECT_EQ(scoreboard_.inflight_nr(), 0);
+}
+
+TEST_F(ScoreboardTest, SackAndDetectLosses) {
+  Send(10);
+  Sack(kFirstSeqno, {3, 4, 5});
+  EXPECT_EQ(scoreboard_.sacked_nr(), 3);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 7);
+
+  // Packets 0-2 were sent before the packets SACKed, and are overdue; the
+  // ones sent after are not judged.
+  EXPECT_EQ(scoreboard_.DetectLosses(100, 20, 5), 0);
+  EXPECT_EQ(scoreboard_.lost_nr(), 3);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 4);
+
+  EXPECT_EQ(RetransmitLost(200),
+            (std::vector<uint32_t>{kFirstSeqno, kFirstSeqno + 1,
+                                   kFirstSeqno + 2}));
+  EXPECT_EQ(scoreboard_.lost_nr(), 0);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 7);
+  EXPECT_EQ(scoreboard_.size(), 10);
+}
+
+TEST_F(ScoreboardTest, ReorderWindow) {
+  Send(4);
+  Sack(kFirstSeqno, {2});
+  // Packet 0 (sent at 0) is lost at 0 + rtt + reo_wnd; until then, it may
+  // only have been reordered.
+  EXPECT_EQ(scoreboard_.DetectLosses(20, 20, 5), 25);
+  EXPECT_EQ(scoreboard_.lost_nr(), 0);
+  EXPECT_EQ(scoreboard_.DetectLosses(25, 20, 5), 35);
+  EXPECT_EQ(scoreboard_.lost_nr(), 1);
+
+  // A late delivery of packet 1 is not a loss.
+  Sack(kFirstSeqno, {1, 2});
+  EXPECT_EQ(scoreboard_.DetectLosses(1000, 20, 5), 0);
+  EXPECT_EQ(scoreboard_.lost_nr(), 1);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 2);
+}
+
+TEST_F(ScoreboardTest, AckShiftsSacks) {
+  Send(200);
+  Sack(kFirstSeqno, {70, 130});
+  EXPECT_EQ(scoreboard_.sacked_nr(), 2);
+
+  // Packet 70 is acknowledged cumulatively; 130 is now at offset 30.
+  scoreboard_.OnAck(kFirstSeqno + 100);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 1);
+  Sack(kFirstSeqno + 100, {30});
+  EXPECT_EQ(scoreboard_.sacked_nr(), 1);
+  Sack(kFirstSeqno + 100, {30, 31, 99});
+  EXPECT_EQ(scoreboard_.sacked_nr(), 3);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 97);
+
+  // Bits beyond the packets sent, or relative to another ACK, are ignored.
+  Sack(kFirstSeqno + 100, {100, 200});
+  Sack(kFirstSeqno + 99, {10});
+  EXPECT_EQ(scoreboard_.sacked_nr(), 3);
+}
+
+TEST_F(ScoreboardTest, RetransmitTimeout) {
+  Send(6);
+  Sack(kFirstSeqno, {2, 4});
+  scoreboard_.MarkAllLost();
+  EXPECT_EQ(scoreboard_.lost_nr(), 4);
+  EXPECT_EQ(scoreboard_.inflight_nr(), 0);
+  EXPECT_EQ(RetransmitLost(100),
+            (std::vector<uint32_t>{kFirstSeqno, kFirstSeqno + 1,
+                                   kFirstSeqno + 3, kFirstSeqno + 5}));
+
+  // Deliveries of retransmitted packets are ambiguous, and do not reveal
+  // losses.
+  Sack(kFirstSeqno, {1, 2, 4, 5});
+  EXPECT_EQ(scoreboard_.DetectLosses(10'000, 20, 5), 0);
+  EXPECT_EQ(scoreboard_.lost_nr(), 0);
+}
+
+TEST_F(ScoreboardTest, TailLossProbe) {
+  Send(3);
+  EXPECT_EQ(scoreboard_.RetransmitNewest(100), kFirstSeqno + 2);
+  // The probe is in flight again, at the end of the transmission order.
+  EXPECT_EQ(scoreboard_.inflight_nr(), 3);
+  Send(1);
+  EXPECT_EQ(scoreboard_.RetransmitNewest(200), kFirstSeqno + 3);
+
+  scoreboard_.OnAck(kFirstSeqno + 4);
+  EXPECT_EQ(scoreboard_.RetransmitNewest(300), std::nullopt);
+}
+
+TEST_F(ScoreboardTest, Wraparound) {
+  // Seqnos wrap around 2^32 and around the ring.
+  const uint32_t first = UINT32_MAX - 10;
+  for (uint32_t i = 0; i < Scoreboard::kDefaultCapacity; i++) {
+    scoreboard_.OnSend(first + i, i, i);
+  }
+  EXPECT_EQ(scoreboard_.room(), 0);
+  Sack(first, {20, 255});
+  scoreboard_.OnAck(first + 100);
+  EXPECT_EQ(scoreboard_.size(), Scoreboard::kDefaultCapacity - 100);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 1);
+  const uint32_t next = first + uint32_t{Scoreboard::kDefaultCapacity};
+  for (uint32_t i = 0; i < 100; i++) scoreboard_.OnSend(next + i, i, 1000 + i);
+  EXPECT_EQ(scoreboard_.cookie(next), 0);
+  EXPECT_EQ(scoreboard_.DetectLosses(10'000, 20, 5), 0);
+  // All the packets in flight sent before packet 255 are lost.
+  EXPECT_EQ(scoreboard_.lost_nr(), 155);
+}
+
+TEST_F(ScoreboardTest, LargeWindow) {
+  scoreboard_.Resize(1024);
+  EXPECT_EQ(scoreboard_.room(), 1024);
+  Send(1000);
+  // Bitmaps at an offset SACK the packets beyond the first 256.
+  Sack(kFirstSeqno, {300, 301, 511}, 256);
+  Sack(kFirstSeqno, {960, 999}, 768);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 5);
+  // Offsets that are not 64-aligned are ignored.
+  Sack(kFirstSeqno, {500}, 480);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 5);
+
+  scoreboard_.OnAck(kFirstSeqno + 400);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 3);
+  Send(400);
+  EXPECT_EQ(scoreboard_.room(), 24);
+  // The ring wraps around: packet 1100 sits where packet 76 was.
+  Sack(kFirstSeqno + 400, {560, 599, 700}, 512);
+  EXPECT_EQ(scoreboard_.sacked_nr(), 4);
+  EXPECT_EQ(scoreboard_.DetectLosses(100'000, 20, 5), 0);
+  // All the packets in flight sent before packet 1100 are lost.
+  EXPECT_EQ(scoreboard_.lost_nr(), 700 - 3);
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
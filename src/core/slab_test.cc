@@ -0,0 +1,89 @@
+/**
+ * @file slab_test.cc
+ *
+ * Unit tests for the slab allocator.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <slab.h>
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+
+struct Object {
+  explicit Object(int *live, uint32_t value) : live(live), value(value) {
+    (*live)++;
+  }
+  ~Object() { (*live)--; }
+  int *live;
+  uint32_t value;
+  uint8_t payload[100];
+};
+
+TEST(SlabTest, NewAndFree) {
+  int live = 0;
+  auto slab = std::make_shared<Slab<Object>>();
+  std::vector<Slab<Object>::Ptr> objects;
+  const size_t n = 3 * Slab<Object>::kSlotsPerChunk + 1;
+  for (size_t i = 0; i < n; i++) {
+    objects.emplace_back(slab->New(&live, i));
+    ASSERT_NE(objects.back(), nullptr);
+  }
+  EXPECT_EQ(live, n);
+  EXPECT_EQ(slab->size(), n);
+  EXPECT_EQ(slab->capacity(), 4 * Slab<Object>::kSlotsPerChunk);
+
+  // Slots are aligned to cache lines and do not overlap.
+  std::set<uintptr_t> addrs;
+  for (size_t i = 0; i < n; i++) {
+    const auto addr = reinterpret_cast<uintptr_t>(objects[i].get());
+    EXPECT_EQ(addr % hardware_constructive_interference_size, 0);
+    EXPECT_EQ(objects[i]->value, i);
+    addrs.insert(addr);
+  }
+  ASSERT_EQ(addrs.size(), n);
+  for (auto it = addrs.begin(); std::next(it) != addrs.end(); ++it) {
+    EXPECT_GE(*std::next(it) - *it, Slab<Object>::SlotSize());
+  }
+
+  // The slot freed last is reused first, and the slab does not grow.
+  auto *freed = objects[7].get();
+  objects[7].reset();
+  EXPECT_EQ(live, n - 1);
+  objects[7] = slab->New(&live, 42);
+  EXPECT_EQ(objects[7].get(), freed);
+  EXPECT_EQ(objects[7]->value, 42);
+  EXPECT_EQ(slab->capacity(), 4 * Slab<Object>::kSlotsPerChunk);
+
+  objects.clear();
+  EXPECT_EQ(live, 0);
+  EXPECT_EQ(slab->size(), 0);
+}
+
+TEST(SlabTest, ObjectsOutliveOwner) {
+  int live = 0;
+  Slab<Object>::Ptr object;
+  {
+    auto slab = std::make_shared<Slab<Object>>();
+    object = slab->New(&live, 1);
+  }
+  // The object keeps the slab, and its memory, alive.
+  ASSERT_NE(object, nullptr);
+  EXPECT_EQ(object->value, 1);
+  object.reset();
+  EXPECT_EQ(live, 0);
+}
+
+}  // namespace utils
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,151 @@
+/**
+ * @file timer_wheel_test.cc
+ *
+ * Unit tests for the hierarchical timer wheel.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <timer_wheel.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+struct FakeOwner {
+  explicit FakeOwner(uint64_t deadline = 0) : deadline(deadline) {}
+  TimerWheel<FakeOwner>::Timer timer{this};
+  uint64_t deadline;
+  // TSC at which the timer expired; zero if it did not.
+  uint64_t expired_at{0};
+};
+
+class TimerWheelTest : public ::testing::Test {
+ protected:
+  using Wheel = TimerWheel<FakeOwner>;
+  static constexpr uint64_t kTickCycles = 10;
+
+  // Advances the wheel to `now', recording expiries; returns their number.
+  size_t Advance(uint64_t now) {
+    size_t expired_nr = 0;
+    wheel_.Advance(now, [now, &expired_nr](FakeOwner *owner) {
+      owner->expired_at = now;
+      expired_nr++;
+    });
+    return expired_nr;
+  }
+
+  Wheel wheel_{kTickCycles};
+};
+
+TEST_F(TimerWheelTest, ScheduleAndExpire) {
+  FakeOwner a, b;
+  wheel_.Schedule(&a.timer, 105);
+  wheel_.Schedule(&b.timer, 50);
+  EXPECT_TRUE(a.timer.armed());
+  EXPECT_EQ(wheel_.size(), 2);
+
+  EXPECT_EQ(Advance(49), 0);
+  EXPECT_EQ(Advance(50), 1);
+  EXPECT_EQ(b.expired_at, 50);
+  EXPECT_FALSE(b.timer.armed());
+  // Not before the deadline, at most a tick after it.
+  EXPECT_EQ(Advance(109), 0);
+  EXPECT_EQ(Advance(110), 1);
+  EXPECT_TRUE(wheel_.empty());
+}
+
+TEST_F(TimerWheelTest, RearmAndCancel) {
+  FakeOwner a;
+  wheel_.Schedule(&a.timer, 100);
+  wheel_.Schedule(&a.timer, 300);
+  EXPECT_EQ(wheel_.size(), 1);
+  EXPECT_EQ(Advance(200), 0);
+  wheel_.Cancel(&a.timer);
+  EXPECT_FALSE(a.timer.armed());
+  EXPECT_EQ(Advance(1000), 0);
+  EXPECT_TRUE(wheel_.empty());
+}
+
+TEST_F(TimerWheelTest, UpperLevels) {
+  // Expiries across all levels, checked against their deadlines.
+  std::mt19937_64 rng(42);
+  std::vector<std::unique_ptr<FakeOwner>> owners;
+  const uint64_t kRangeTicks = uint64_t{1} << (Wheel::kSlotsBits * 4);
+  for (size_t i = 0; i < 1000; i++) {
+    const auto deadline = rng() % (kRangeTicks * kTickCycles / 2);
+    owners.emplace_back(std::make_unique<FakeOwner>(deadline));
+    wheel_.Schedule(&owners.back()->timer, deadline);
+  }
+
+  // Advance in uneven steps.
+  uint64_t now = 0;
+  size_t expired_nr = 0;
+  while (!wheel_.empty()) {
+    now += rng() % (kTickCycles * 5000);
+    expired_nr += Advance(now);
+  }
+  EXPECT_EQ(expired_nr, owners.size());
+  for (const auto &owner : owners) {
+    EXPECT_GE(owner->expired_at, owner->deadline);
+  }
+}
+
+TEST_F(TimerWheelTest, Precision) {
+  // Ticking through the range, each timer expires within a tick.
+  std::vector<std::unique_ptr<FakeOwner>> owners;
+  for (uint64_t deadline :
+       {1, 639, 641, 40'960, 41'000, 2'621'440, 2'700'000}) {
+    owners.emplace_back(std::make_unique<FakeOwner>(deadline));
+    wheel_.Schedule(&owners.back()->timer, deadline);
+  }
+  for (uint64_t now = 0; !wheel_.empty(); now += kTickCycles) Advance(now);
+  for (const auto &owner : owners) {
+    EXPECT_GE(owner->expired_at, owner->deadline);
+    EXPECT_LT(owner->expired_at, owner->deadline + kTickCycles);
+  }
+}
+
+TEST_F(TimerWheelTest, BeyondRange) {
+  // Timers beyond the range expire early, at its end.
+  const uint64_t kRangeTicks = uint64_t{1} << (Wheel::kSlotsBits * 4);
+  FakeOwner a;
+  wheel_.Schedule(&a.timer, 10 * kRangeTicks * kTickCycles);
+  EXPECT_EQ(Advance(kRangeTicks * kTickCycles), 1);
+}
+
+TEST_F(TimerWheelTest, ExpireCallback) {
+  // The callback may re-arm the timer; it then expires on a later tick.
+  FakeOwner a;
+  wheel_.Schedule(&a.timer, 10);
+  size_t expired_nr = 0;
+  wheel_.Advance(100, [this, &expired_nr](FakeOwner *owner) {
+    if (++expired_nr < 3) wheel_.Schedule(&owner->timer, 0);
+  });
+  EXPECT_EQ(expired_nr, 3);
+  EXPECT_TRUE(wheel_.empty());
+}
+
+TEST_F(TimerWheelTest, Clear) {
+  FakeOwner a, b;
+  wheel_.Schedule(&a.timer, 10);
+  wheel_.Schedule(&b.timer, 1'000'000);
+  wheel_.Clear();
+  EXPECT_TRUE(wheel_.empty());
+  EXPECT_FALSE(a.timer.armed());
+  EXPECT_FALSE(b.timer.armed());
+  EXPECT_EQ(Advance(10'000'000), 0);
+}
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,89 @@
+/**
+ * @file trace_test.cc
+ *
+ * Unit tests for the engine's dataplane event trace.
+ */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <trace.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace trace {
+
+TEST(TracerTest, WrapAround) {
+  if constexpr (!kEnabled) GTEST_SKIP() << "Tracing is compiled out.";
+  Tracer tracer(5);
+  EXPECT_EQ(tracer.capacity(), 8);
+  EXPECT_TRUE(tracer.Snapshot().empty());
+
+  for (uint32_t i = 0; i < 10; i++) {
+    tracer.Record(Event::kRtoRetransmit, 42, i, 2 * i);
+  }
+  EXPECT_EQ(tracer.recorded(), 10);
+
+  // The oldest records were overwritten.
+  const auto records = tracer.Snapshot();
+  ASSERT_EQ(records.size(), 8);
+  for (uint32_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(records[i].event, static_cast<uint16_t>(Event::kRtoRetransmit));
+    EXPECT_EQ(records[i].flow, 42);
+    EXPECT_EQ(records[i].seqno, i + 2);
+    EXPECT_EQ(records[i].arg, 2 * (i + 2));
+    if (i > 0) {
+      EXPECT_GE(records[i].tsc, records[i - 1].tsc);
+    }
+  }
+}
+
+TEST(TracerTest, DumpAndLoad) {
+  if constexpr (!kEnabled) GTEST_SKIP() << "Tracing is compiled out.";
+  Tracer tracer(4);
+  for (uint32_t i = 0; i < 6; i++) {
+    tracer.Record(i % 2 ? Event::kFastRetransmit : Event::kDropBadState, i, i);
+  }
+
+  const std::string path = testing::TempDir() + "machnet_trace_test.bin";
+  ASSERT_TRUE(tracer.Dump(path, 1, 3));
+  const auto trace = Tracer::Load(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(trace.has_value());
+
+  const auto &[header, records] = trace.value();
+  EXPECT_EQ(header.port_id, 1);
+  EXPECT_EQ(header.rx_queue_id, 3);
+  EXPECT_EQ(header.records_nr, 4);
+  EXPECT_EQ(header.lost_nr, 2);
+  EXPECT_NE(header.tsc_hz, 0U);
+  const auto expected = tracer.Snapshot();
+  ASSERT_EQ(records.size(), expected.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(records[i].tsc, expected[i].tsc);
+    EXPECT_EQ(records[i].event, expected[i].event);
+    EXPECT_EQ(records[i].flow, expected[i].flow);
+    EXPECT_EQ(records[i].seqno, expected[i].seqno);
+  }
+}
+
+TEST(TracerTest, LoadRejectsOtherFiles) {
+  const std::string path = testing::TempDir() + "machnet_trace_bogus.bin";
+  auto *file = std::fopen(path.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  std::fputs("not a trace, but long enough to hold a trace header...", file);
+  std::fclose(file);
+  EXPECT_FALSE(Tracer::Load(path).has_value());
+  std::remove(path.c_str());
+  EXPECT_FALSE(Tracer::Load(path).has_value());
+}
+
+}  // namespace trace
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
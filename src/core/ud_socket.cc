@@ -9,7 +9,9 @@
 #include <unistd.h>
 #include <utils.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <optional>
 #include <thread>
 
 namespace juggler {
@@ -160,6 +162,13 @@ bool UDSocket::SendMsg(const char *msg, size_t len) {
 }
 
 bool UDSocket::SendMsgWithFd(const char *msg, size_t len, int fd) {
+  return SendMsgWithFds(msg, len, &fd, 1);
+}
+
+bool UDSocket::SendMsgWithFds(const char *msg, size_t len, const int *fds,
+                              size_t fds_nr) {
+  constexpr size_t kMaxFdsNr = 4;
+  CHECK_LE(fds_nr, kMaxFdsNr);
   msghdr msg_hdr;
   memset(&msg_hdr, 0, sizeof(msg_hdr));
   iovec iov;
@@ -167,15 +176,15 @@ bool UDSocket::SendMsgWithFd(const char *msg, size_t len, int fd) {
   iov.iov_len = len;
   msg_hdr.msg_iov = &iov;
   msg_hdr.msg_iovlen = 1;
-  char buf[CMSG_SPACE(sizeof(int))];
+  char buf[CMSG_SPACE(kMaxFdsNr * sizeof(int))];
   memset(buf, 0, sizeof(buf));
   msg_hdr.msg_control = buf;
-  msg_hdr.msg_controllen = sizeof(buf);
+  msg_hdr.msg_controllen = CMSG_SPACE(fds_nr * sizeof(int));
   cmsghdr *cmsg = CMSG_FIRSTHDR(&msg_hdr);
-  cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+  cmsg->cmsg_len = CMSG_LEN(fds_nr * sizeof(int));
   cmsg->cmsg_level = SOL_SOCKET;
   cmsg->cmsg_type = SCM_RIGHTS;
-  *(reinterpret_cast<int *>(CMSG_DATA(cmsg))) = fd;
+  memcpy(CMSG_DATA(cmsg), fds, fds_nr * sizeof(int));
   if (sendmsg(socket_fd_, &msg_hdr, 0) == -1) {
     LOG(ERROR) << "Failed to send message";
     return false;
@@ -184,7 +193,18 @@ bool UDSocket::SendMsgWithFd(const char *msg, size_t len, int fd) {
 }
 
 int UDSocket::RecvMsgWithFd(char *msg, size_t len, int *fd) {
-  *fd = -1;  // Set to invalid fd.
+  size_t fds_nr = 1;
+  const auto nbytes = RecvMsgWithFds(msg, len, fd, &fds_nr);
+  if (fds_nr == 0) *fd = -1;  // Set to invalid fd.
+  return nbytes;
+}
+
+int UDSocket::RecvMsgWithFds(char *msg, size_t len, int *fds,
+                             size_t *fds_nr) {
+  constexpr size_t kMaxFdsNr = 4;
+  CHECK_LE(*fds_nr, kMaxFdsNr);
+  const size_t fds_max = *fds_nr;
+  *fds_nr = 0;
 
   msghdr msg_hdr;
   memset(&msg_hdr, 0, sizeof(msg_hdr));
@@ -193,19 +213,19 @@ int UDSocket::RecvMsgWithFd(char *msg, size_t len, int *fd) {
   iov.iov_len = len;
   msg_hdr.msg_iov = &iov;
   msg_hdr.msg_iovlen = 1;
-  char buf[CMSG_SPACE(sizeof(int))];
+  char buf[CMSG_SPACE(kMaxFdsNr * sizeof(int))];
   memset(buf, 0, sizeof(buf));
   msg_hdr.msg_control = buf;
-  msg_hdr.msg_controllen = sizeof(buf);
+  msg_hdr.msg_controllen = CMSG_SPACE(fds_max * sizeof(int));
 
-  int nbytes = recvmsg(socket_fd_, &msg_hdr, 0);
+  int nbytes = recvmsg(socket_fd_, &msg_hdr, MSG_CMSG_CLOEXEC);
   if (nbytes == -1) {
     LOG(ERROR) << "Failed to receive message";
     return nbytes;
   }
 
   cmsghdr *cmsg = CMSG_FIRSTHDR(&msg_hdr);
-  if (cmsg && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+  if (cmsg && cmsg->cmsg_len > CMSG_LEN(0)) {
     if (cmsg->cmsg_level != SOL_SOCKET) {
       LOG(ERROR) << "Invalid cmsg_level " << cmsg->cmsg_level;
       return nbytes;
@@ -214,12 +234,23 @@ int UDSocket::RecvMsgWithFd(char *msg, size_t len, int *fd) {
       LOG(ERROR) << "Invalid cmsg_type " << cmsg->cmsg_type;
       return nbytes;
     }
-    *fd = *(reinterpret_cast<int *>(CMSG_DATA(cmsg)));
+    *fds_nr = std::min((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int), fds_max);
+    memcpy(fds, CMSG_DATA(cmsg), *fds_nr * sizeof(int));
   }
 
   return nbytes;
 }
 
+std::optional<uid_t> UDSocket::GetPeerUid() const {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(socket_fd_, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    LOG(ERROR) << "Failed to get the credentials of the peer.";
+    return std::nullopt;
+  }
+  return cred.uid;
+}
+
 bool UDSocket::AllocateUserData(size_t size) {
   if (user_data_ != nullptr) {
     LOG(ERROR) << "User data already allocated";
@@ -257,6 +288,25 @@ UDServer::UDServer(const std::string &path, on_connect_cb_t on_connect,
   }
 }
 
+UDServer::UDServer(int listen_fd, on_connect_cb_t on_connect,
+                   on_close_cb_t on_close, on_message_cb_t on_message,
+                   on_timeout_cb_t on_timeout)
+    : on_connect_(CHECK_NOTNULL(on_connect)),
+      on_close_(CHECK_NOTNULL(on_close)),
+      on_message_(CHECK_NOTNULL(on_message)),
+      on_timeout_(CHECK_NOTNULL(on_timeout)),
+      keep_running_(false),
+      listen_socket_(listen_fd),
+      connected_clients_() {}
+
+UDSocket *UDServer::AdoptClient(int fd) {
+  auto client = std::make_unique<UDSocket>(fd);
+  if (!on_connect_(client.get())) return nullptr;
+  auto *socket = client.get();
+  connected_clients_.insert({fd, std::move(client)});
+  return socket;
+}
+
 UDServer::~UDServer() {
   // No need to close the listen or connected sockets; they will be closed when
   // the object is destroyed.
@@ -279,6 +329,15 @@ void UDServer::Run() {
                                 strerror(errno));
     // Program will exit here.
   }
+  // Clients adopted before the server started (see `AdoptClient').
+  for (const auto &[fd, _] : connected_clients_) {
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      LOG(FATAL) << utils::Format("Failed to add connection to epoll (%s)",
+                                  strerror(errno));
+    }
+  }
   const size_t kMaxEvents = 16;
   std::vector<struct epoll_event> event_list(kMaxEvents);
   const size_t kMaxBufferSize = 4096;
@@ -295,7 +354,7 @@ void UDServer::Run() {
       // Program will exit here.
     }
 
-    for (int i = 0; i < nfds; ++i) {
+    for (int i = 0; i < nfds && keep_running_.load(); ++i) {
       if (event_list[i].data.fd == listen_socket_.GetFd()) {
         // New connection.
         int new_fd = accept(listen_socket_.GetFd(), nullptr, nullptr);
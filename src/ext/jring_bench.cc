@@ -1,6 +1,7 @@
 #include <benchmark/benchmark.h>
 #include <glog/logging.h>
 #include <jring2.h>
+#include <perf_benchmark.h>
 #include <utils.h>
 
 #include <thread>
@@ -100,4 +101,6 @@ BENCHMARK_REGISTER_F(ProducerConsumerBenchmark, ProducerBenchmark)
     ->Args({2048, 1 << 24})  // msg_size = 1024, num_messages = 16M
     ->Iterations(10);  // number of iterations for each case
 
-BENCHMARK_MAIN();
+int main(int argc, char **argv) {
+  return juggler::perf::BenchmarkMain("jring_bench", argc, argv);
+}
@@ -11,10 +11,13 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "machnet_ctrl.h"
@@ -41,14 +44,17 @@ static uint32_t msg_id_counter;
  * @param req  Pointer to the request message (will be sent to the controller).
  * @param resp Pointer to the response message buffer; response will be copied
  * there.
- * @param fd   Pointer to the file descriptor location (provided by the caller)
- * ; if the response message carries a file descriptor.
+ * @param fds  Array of file descriptor locations (provided by the caller), for
+ * the file descriptors the response message may carry; unused ones are set to
+ * -1. Can be NULL.
+ * @param fds_nr Number of elements in `fds'.
  * @return 0 on success.
  * @attention The caller is responsible for allocating the request and response
  * buffers. This function is thread-safe.
  */
 static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
-                                 machnet_ctrl_msg_t *resp, int *fd) {
+                                 machnet_ctrl_msg_t *resp, int *fds,
+                                 size_t fds_nr) {
   // We do maintain a global socket to the controller for the duration of the
   // application's lifetime, but we rather open a new connection to the
   // controller for each request. The reason for this is to achieve thread
@@ -97,7 +103,7 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
   msg.msg_iov = iov;
   msg.msg_iovlen = 1;
   // We need to allocate a buffer for the ancillary data.
-  char buf[CMSG_SPACE(sizeof(int))];
+  char buf[CMSG_SPACE(MACHNET_CTRL_MSG_MAX_FDS * sizeof(int))];
   memset(buf, 0, sizeof(buf));
   msg.msg_control = buf;
   msg.msg_controllen = sizeof(buf);
@@ -111,16 +117,21 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
     return -1;
   }
 
-  if (fd != NULL) {
-    *fd = -1;
-    fprintf(stderr, "Checking for file descriptor...\n");
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
-        cmsg->cmsg_type == SCM_RIGHTS) {
-      fprintf(stderr, "Got a file descriptor!\n");
-      assert(cmsg->cmsg_len == CMSG_LEN(sizeof(int)));
-      // We got a file descriptor.
-      *fd = *((int *)CMSG_DATA(cmsg));
+  for (size_t i = 0; fds != NULL && i < fds_nr; i++) fds[i] = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    // We got one or more file descriptors.
+    const size_t received_nr = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    assert(received_nr <= MACHNET_CTRL_MSG_MAX_FDS);
+    for (size_t i = 0; i < received_nr; i++) {
+      int received_fd;
+      memcpy(&received_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      if (fds != NULL && i < fds_nr) {
+        fds[i] = received_fd;
+      } else {
+        close(received_fd);
+      }
     }
   }
 
@@ -128,79 +139,367 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
 }
 
 /**
- * @brief Allocates a specified number of buffers for use, either directly from
- * the global pool or from the application's buffer cache.
+ * @brief Notifies the Machnet engine serving the channel of pending work, and
+ * wakes it up if it sleeps waiting on the channel's doorbell. To be called
+ * after enqueueing to the channel.
+ * @param ctx Pointer to the channel context.
+ */
+static inline void _machnet_doorbell_ring(const MachnetChannelCtx_t *ctx) {
+  if (likely(!__machnet_channel_notify(ctx))) return;
+  if (ctx->doorbell.app_fd < 0) return;
+  const uint64_t value = 1;
+  // A failure (i.e., counter overflow) means that the engine is being woken up
+  // anyway.
+  ssize_t ret = write(ctx->doorbell.app_fd, &value, sizeof(value));
+  (void)ret;
+}
+
+/*
+ * Per-thread state of the application for a channel. Each thread caches a few
+ * free buffers of the channel's global pool, of each size class, refilled from
+ * and flushed to it in bulk, so that threads sharing a channel neither contend
+ * on the pool nor on a shared cache. It also holds a table of buffer indices,
+ * with room for the whole pool, as scratch space for the messages being sent or
+ * received, and the queue pair of the channel the thread is bound to, if any.
+ */
+struct MachnetChannelAppBufferCache {
+  uint32_t count;
+  MachnetRingSlot_t indices[NUM_CACHED_BUFS];
+};
+typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
+
+struct MachnetThreadCache {
+  const MachnetChannelCtx_t *ctx;
+  MachnetRingSlot_t *buffer_index_table;
+  MachnetChannelAppBufferCache_t buffer_cache[MACHNET_CHANNEL_BUF_CLASSES_MAX];
+  uint32_t queue;  // `MACHNET_CHANNEL_QUEUE_SHARED' if not bound.
+};
+typedef struct MachnetThreadCache MachnetThreadCache_t;
+
+// Maximum number of channels a thread holds state for; beyond that, the state
+// of the least recently added channel is flushed and dropped.
+#define MACHNET_THREAD_CACHES_MAX 8
+struct MachnetThreadCaches {
+  uint32_t count;
+  MachnetThreadCache_t caches[MACHNET_THREAD_CACHES_MAX];
+};
+typedef struct MachnetThreadCaches MachnetThreadCaches_t;
+
+// The calling thread's state (NULL until first used), and the key whose
+// destructor flushes it when the thread exits.
+static __thread MachnetThreadCaches_t *tls_thread_caches = NULL;
+static pthread_key_t g_thread_caches_key;
+static int g_thread_caches_key_valid = 0;
+static pthread_once_t g_thread_caches_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Returns the buffers cached by a thread to the channel's global pool.
+ *
+ * @param tc Pointer to the thread's state for the channel.
+ *
+ * @warning If the function fails to free the buffers to the global pool, it
+ *          will output an error message to stderr and call abort() to terminate
+ *          program execution.
+ */
+static void _machnet_thread_cache_flush(MachnetThreadCache_t *tc) {
+  for (uint32_t c = 0; c < MACHNET_CHANNEL_BUF_CLASSES_MAX; c++) {
+    MachnetChannelAppBufferCache_t *cache = &tc->buffer_cache[c];
+    if (cache->count == 0) continue;
+    if (__machnet_channel_buf_free_bulk(tc->ctx, cache->count,
+                                        cache->indices) != cache->count) {
+      fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+      abort();
+    }
+    cache->count = 0;
+  }
+}
+
+/**
+ * @brief Tears down a thread's state for a channel: flushes its buffer cache,
+ * and releases its queue pair.
+ *
+ * @param tc Pointer to the thread's state for the channel.
+ */
+static void _machnet_thread_cache_destroy(MachnetThreadCache_t *tc) {
+  _machnet_thread_cache_flush(tc);
+  free(tc->buffer_index_table);
+  if (tc->queue != MACHNET_CHANNEL_QUEUE_SHARED)
+    __machnet_channel_queue_release(tc->ctx, tc->queue);
+}
+
+static void _machnet_thread_caches_destroy(void *arg) {
+  MachnetThreadCaches_t *caches = (MachnetThreadCaches_t *)arg;
+  for (uint32_t i = 0; i < caches->count; i++) {
+    _machnet_thread_cache_destroy(&caches->caches[i]);
+  }
+  free(caches);
+  tls_thread_caches = NULL;
+}
+
+static void _machnet_thread_caches_exit(void) {
+  // The key destructor does not run for the thread calling exit().
+  if (tls_thread_caches == NULL) return;
+  if (g_thread_caches_key_valid) pthread_setspecific(g_thread_caches_key, NULL);
+  _machnet_thread_caches_destroy(tls_thread_caches);
+}
+
+static void _machnet_thread_caches_init(void) {
+  if (pthread_key_create(&g_thread_caches_key,
+                         _machnet_thread_caches_destroy) == 0) {
+    g_thread_caches_key_valid = 1;
+  } else {
+    fprintf(stderr,
+            "WARNING: Buffers cached by exiting threads will not be freed.\n");
+  }
+  atexit(_machnet_thread_caches_exit);
+}
+
+/**
+ * @brief Sets up the calling thread's state for a channel. Slow path of
+ * `_machnet_thread_cache()`.
+ *
+ * @param ctx Pointer to the channel context.
+ * @return A pointer to the thread's state for the channel, or `NULL` on
+ * allocation failure.
+ */
+static MachnetThreadCache_t *_machnet_thread_cache_add(
+    const MachnetChannelCtx_t *ctx) {
+  pthread_once(&g_thread_caches_once, _machnet_thread_caches_init);
+  if (tls_thread_caches == NULL) {
+    tls_thread_caches =
+        (MachnetThreadCaches_t *)calloc(1, sizeof(*tls_thread_caches));
+    if (tls_thread_caches == NULL) return NULL;
+    if (g_thread_caches_key_valid)
+      pthread_setspecific(g_thread_caches_key, tls_thread_caches);
+  }
+  MachnetThreadCaches_t *caches = tls_thread_caches;
+
+  MachnetRingSlot_t *buffer_index_table = (MachnetRingSlot_t *)malloc(
+      __machnet_channel_buf_count(ctx) * sizeof(MachnetRingSlot_t));
+  if (buffer_index_table == NULL) return NULL;
+
+  if (caches->count == MACHNET_THREAD_CACHES_MAX) {
+    // Drop the state of the least recently added channel.
+    _machnet_thread_cache_destroy(&caches->caches[0]);
+    memmove(&caches->caches[0], &caches->caches[1],
+            (MACHNET_THREAD_CACHES_MAX - 1) * sizeof(caches->caches[0]));
+    caches->count--;
+  }
+
+  MachnetThreadCache_t *tc = &caches->caches[caches->count++];
+  tc->ctx = ctx;
+  tc->buffer_index_table = buffer_index_table;
+  for (uint32_t c = 0; c < MACHNET_CHANNEL_BUF_CLASSES_MAX; c++)
+    tc->buffer_cache[c].count = 0;
+  tc->queue = MACHNET_CHANNEL_QUEUE_SHARED;
+  return tc;
+}
+
+/**
+ * @brief Returns the calling thread's state for a channel, setting it up on
+ * first use.
+ *
+ * @param ctx Pointer to the channel context.
+ * @return A pointer to the thread's state for the channel, or `NULL` on
+ * allocation failure.
+ */
+static inline MachnetThreadCache_t *_machnet_thread_cache(
+    const MachnetChannelCtx_t *ctx) {
+  MachnetThreadCaches_t *caches = tls_thread_caches;
+  if (likely(caches != NULL)) {
+    for (uint32_t i = 0; i < caches->count; i++) {
+      if (likely(caches->caches[i].ctx == ctx)) return &caches->caches[i];
+    }
+  }
+  return _machnet_thread_cache_add(ctx);
+}
+
+/**
+ * @brief Returns the calling thread's scratch table of buffer indices for a
+ * channel, with room for all the buffers of the channel.
+ *
+ * @param ctx Pointer to the channel context.
+ * @return A pointer to the table, or `NULL` on allocation failure.
+ */
+static inline MachnetRingSlot_t *_machnet_buffer_index_table(
+    const MachnetChannelCtx_t *ctx) {
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  return likely(tc != NULL) ? tc->buffer_index_table : NULL;
+}
+
+/**
+ * @brief Returns the queue pair of a channel the calling thread is bound to
+ * (see `machnet_queue_bind()`).
+ *
+ * @param ctx Pointer to the channel context.
+ * @return The index of the queue pair, or `MACHNET_CHANNEL_QUEUE_SHARED` if the
+ * thread uses the shared rings of the channel.
+ */
+static inline uint32_t _machnet_thread_queue(const MachnetChannelCtx_t *ctx) {
+  if (likely(ctx->data_ctx.queue_pairs_nr == 0))
+    return MACHNET_CHANNEL_QUEUE_SHARED;
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  return likely(tc != NULL) ? tc->queue : MACHNET_CHANNEL_QUEUE_SHARED;
+}
+
+/**
+ * @brief Enqueues messages to the Machnet engine, on the calling thread's queue
+ * pair, or on the shared ring if it is not bound to one.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param n Maximum number of messages to enqueue.
+ * @param heads Indices of the first buffers of the messages.
+ * @return The number of messages enqueued, the first ones of `heads'.
+ */
+static inline uint32_t _machnet_app_enqueue(const MachnetChannelCtx_t *ctx,
+                                            uint32_t n,
+                                            const MachnetRingSlot_t *heads) {
+  const uint32_t queue = _machnet_thread_queue(ctx);
+  if (likely(queue == MACHNET_CHANNEL_QUEUE_SHARED))
+    return __machnet_channel_app_ring_enqueue_burst(ctx, n, heads);
+  return __machnet_channel_queue_app_enqueue(ctx, queue, n, heads);
+}
+
+/**
+ * @brief Dequeues messages from the Machnet engine, from the calling thread's
+ * queue pair first, if it is bound to one, and then from the shared ring.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param n Maximum number of messages to dequeue.
+ * @param heads Table to store the indices of the first buffers of the messages.
+ * @return The number of messages dequeued.
+ */
+static inline uint32_t _machnet_app_dequeue(const MachnetChannelCtx_t *ctx,
+                                            uint32_t n,
+                                            MachnetRingSlot_t *heads) {
+  const uint32_t queue = _machnet_thread_queue(ctx);
+  uint32_t ret = 0;
+  if (queue != MACHNET_CHANNEL_QUEUE_SHARED)
+    ret = __machnet_channel_queue_machnet_dequeue(ctx, queue, n, heads);
+  if (ret < n)
+    ret += __machnet_channel_machnet_ring_dequeue(ctx, n - ret, heads + ret);
+  return ret;
+}
+
+/**
+ * @brief Whether messages from the Machnet engine are pending for the calling
+ * thread (see `_machnet_app_dequeue()`), or TX completions for any.
+ *
+ * @param ctx Pointer to the channel context.
+ * @return Non-zero if messages or completions are pending.
+ */
+static inline int _machnet_app_pending(const MachnetChannelCtx_t *ctx) {
+  const uint32_t queue = _machnet_thread_queue(ctx);
+  if (queue != MACHNET_CHANNEL_QUEUE_SHARED &&
+      __machnet_channel_queue_ring_pending(
+          __machnet_channel_queue_machnet_ring(ctx, queue)))
+    return 1;
+  return __machnet_channel_machnet_ring_pending(ctx) != 0 ||
+         __machnet_channel_tx_compl_pending(ctx) != 0;
+}
+
+/**
+ * @brief Allocates a specified number of buffers of a size class for use,
+ * either directly from the global pool or from the calling thread's buffer
+ * cache.
  *
  * This function allocates `cnt` number of buffers for the Machnet channel. If
  * the count exceeds the number of cached buffers (`NUM_CACHED_BUFS`), the
  * allocation is made directly from the global pool. For smaller allocations, it
- * tries to fulfill the request from the application's buffer cache. If the
- * cache is empty, it refills the cache from the global pool. If allocation from
- * the global pool fails at any point, the function returns `NULL`.
+ * tries to fulfill the request from the thread's buffer cache. If the cache is
+ * empty, it refills the cache from the global pool. If allocation from the
+ * global pool fails at any point, the function returns `NULL`.
  *
  * @param ctx Pointer to the MachnetChannelCtx_t structure that holds channel
- * context information, including the application buffer cache.
+ * context information.
+ * @param cls The size class of the buffers (0 for the default one).
  * @param cnt The number of buffers to allocate.
  * @return A pointer to the first MachnetRingSlot_t element of an array
  * containing the allocated buffer indices if the allocation is successful;
- * otherwise, `NULL`.
+ * otherwise, `NULL`. The array is the thread's scratch table (see
+ * `_machnet_buffer_index_table()`).
  */
 static inline MachnetRingSlot_t *_machnet_buffers_alloc(
-    MachnetChannelCtx_t *ctx, uint32_t cnt) {
-  MachnetRingSlot_t *buffer_indices = __machnet_channel_buffer_index_table(ctx);
+    MachnetChannelCtx_t *ctx, uint32_t cls, uint32_t cnt) {
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  if (unlikely(tc == NULL)) return NULL;
+  MachnetRingSlot_t *buffer_indices = tc->buffer_index_table;
+  MachnetChannelAppBufferCache_t *cache = &tc->buffer_cache[cls];
 
   if (cnt > NUM_CACHED_BUFS) {
-    // This is a large bulk allocation, so we can bypass the application cache.
-    uint32_t ret =
-        __machnet_channel_buf_alloc_bulk(ctx, cnt, buffer_indices, NULL);
+    // This is a large bulk allocation, so we can bypass the thread's cache.
+    uint32_t ret = __machnet_channel_buf_class_alloc_bulk(ctx, cls, cnt,
+                                                          buffer_indices, NULL);
     if (ret != cnt) {
       return NULL;
     }
     return buffer_indices;
   }
 
-  // Try to allocate from the application cache.
+  // Try to allocate from the thread's cache.
   uint32_t index = 0;
   while (index < cnt) {
-    if (unlikely(ctx->app_buffer_cache.count == 0)) {
+    if (unlikely(cache->count == 0)) {
       // The cache is empty, so we need to allocate from the global pool.
-      ctx->app_buffer_cache.count += __machnet_channel_buf_alloc_bulk(
-          ctx, NUM_CACHED_BUFS, ctx->app_buffer_cache.indices, NULL);
-      if (unlikely(ctx->app_buffer_cache.count == 0)) {
+      cache->count += __machnet_channel_buf_class_alloc_bulk(
+          ctx, cls, NUM_CACHED_BUFS, cache->indices, NULL);
+      if (unlikely(cache->count == 0)) {
         // We failed to allocate from the global pool.
         goto fail;
       }
     }
 
-    buffer_indices[index++] =
-        ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count];
+    buffer_indices[index++] = cache->indices[--cache->count];
   }
 
   return buffer_indices;
 
 fail:
-  // Bulk allocation has failed; return partial allocation to the application
+  // Bulk allocation has failed; return partial allocation to the thread's
   // cache.
   for (uint32_t i = 0; i < index; i++) {
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[i];
+    cache->indices[cache->count++] = buffer_indices[i];
   }
 
   return NULL;
 }
 
+/**
+ * @brief Allocates the buffers of a message. A message that fits in a single
+ * buffer takes one of the smallest size class that holds it, or of a larger
+ * one if that class runs out; longer messages take default buffers.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param msg_size The size of the message.
+ * @param buffers_nr The number of default buffers to hold the message.
+ * @return As `_machnet_buffers_alloc()`.
+ */
+static inline MachnetRingSlot_t *_machnet_msg_buffers_alloc(
+    MachnetChannelCtx_t *ctx, uint32_t msg_size, uint32_t buffers_nr) {
+  if (buffers_nr == 1) {
+    const uint32_t classes_nr = ctx->data_ctx.buf_classes_nr;
+    for (uint32_t c = __machnet_channel_buf_class_for(ctx, msg_size); c != 0;
+         c = (c + 1) % classes_nr) {
+      MachnetRingSlot_t *buf_index_table = _machnet_buffers_alloc(ctx, c, 1);
+      if (buf_index_table != NULL) return buf_index_table;
+    }
+  }
+  return _machnet_buffers_alloc(ctx, 0, buffers_nr);
+}
+
 /**
  * @brief Releases a given number of buffers by either caching them or freeing
  * them to the global pool.
  *
  * This function attempts to release a specified count of buffers back into the
- * Machnet channel context's application buffer cache. If the cache is full,
- * it will free half of the cached buffers to the global buffer pool. If after
- * several retries it is unable to free buffers to the global pool, the function
- * aborts the program execution.
+ * calling thread's buffer cache of their size class. If the count exceeds the
+ * number of cached buffers (`NUM_CACHED_BUFS`), the buffers are freed directly
+ * to the global pool. If a cache is full, it will free half of the cached
+ * buffers to the global buffer pool. If after several retries it is unable to
+ * free buffers to the global pool, the function aborts the program execution.
  *
  * @param ctx Pointer to the MachnetChannelCtx_t structure that represents the
- *        channel context which holds the application buffer cache.
+ *        channel context.
  * @param cnt The number of buffers to be released.
  * @param buffer_indices Array of MachnetRingSlot_t that contains the indices of
  * the buffers that need to be released.
@@ -212,19 +511,37 @@ fail:
 static inline void _machnet_buffers_release(MachnetChannelCtx_t *ctx,
                                             uint32_t cnt,
                                             MachnetRingSlot_t *buffer_indices) {
+  if (cnt > NUM_CACHED_BUFS &&
+      __machnet_channel_buf_free_bulk(ctx, cnt, buffer_indices) == cnt) {
+    // This is a large bulk release, so we can bypass the thread's cache.
+    return;
+  }
+
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  if (unlikely(tc == NULL)) {
+    // Without a cache, free straight to the global pool.
+    if (__machnet_channel_buf_free_bulk(ctx, cnt, buffer_indices) == cnt)
+      return;
+    fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+    abort();
+  }
+
   uint32_t index = 0;
   while (index < cnt) {
+    MachnetChannelAppBufferCache_t *cache =
+        &tc->buffer_cache[__machnet_channel_buf_class_of(
+                              ctx, buffer_indices[index]) -
+                          ctx->data_ctx.buf_classes];
     uint32_t retries = 5;
-    while (unlikely(ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
+    while (unlikely(cache->count == NUM_CACHED_BUFS)) {
       // The cache is full, free to global pool.
-      uint32_t elements_to_free = ctx->app_buffer_cache.count / 2;
+      uint32_t elements_to_free = cache->count / 2;
       MachnetRingSlot_t *indices_to_free =
-          ctx->app_buffer_cache.indices + (NUM_CACHED_BUFS - elements_to_free);
-      ctx->app_buffer_cache.count -= __machnet_channel_buf_free_bulk(
-          ctx, elements_to_free, indices_to_free);
+          cache->indices + (NUM_CACHED_BUFS - elements_to_free);
+      cache->count -= __machnet_channel_buf_free_bulk(ctx, elements_to_free,
+                                                      indices_to_free);
 
-      if (unlikely(retries-- == 0 &&
-                   ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
+      if (unlikely(retries-- == 0 && cache->count == NUM_CACHED_BUFS)) {
         /*
          * XXX (ilias): If we reach here, we have failed to free the buffers to
          * the global pool and we are going to leak them. Terminate execution.
@@ -234,8 +551,34 @@ static inline void _machnet_buffers_release(MachnetChannelCtx_t *ctx,
       }
     }
 
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[index++];
+    cache->indices[cache->count++] = buffer_indices[index++];
+  }
+}
+
+/**
+ * @brief Releases the buffers of a message, following its chain from the
+ * buffer given.
+ *
+ * @param ctx Pointer to the MachnetChannelCtx_t structure that represents the
+ *        channel context.
+ * @param buffer_index Index of the first buffer of the chain.
+ */
+static inline void _machnet_buffers_chain_release(
+    MachnetChannelCtx_t *ctx, MachnetRingSlot_t buffer_index) {
+  const uint32_t kBufferBatchSize = 16;
+  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
+  uint32_t buffer_indices_index = 0;
+
+  while (1) {
+    const MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+    const int more = buffer->flags & MACHNET_MSGBUF_FLAGS_SG;
+    buffer_indices[buffer_indices_index++] = buffer_index;
+    buffer_index = buffer->next;
+    if (!more || buffer_indices_index == kBufferBatchSize) {
+      _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+      buffer_indices_index = 0;
+    }
+    if (!more) break;
   }
 }
 
@@ -342,10 +685,10 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size) {
   }
 
   // Map the shared memory segment into the address space of the process.
-  shm_flags = MAP_SHARED | MAP_POPULATE;
+  shm_flags = MAP_SHARED;
   if (stat_buf.st_blksize > getpagesize()) {
     /* TODO(ilias): Hack to detect if mapping is huge page backed. */
-    shm_flags |= MAP_HUGETLB;
+    shm_flags |= MAP_HUGETLB | MAP_NORESERVE;
   }
   channel = (MachnetChannelCtx_t *)mmap(
       NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, shm_flags, shm_fd, 0);
@@ -359,6 +702,13 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size) {
     goto fail;
   }
 
+  // Fault in the memory, but for the segments of buffers Machnet has not
+  // attached (yet); those that it attaches later are faulted in on use.
+  size_t hole_ofs, hole_len;
+  __machnet_channel_buf_hole(channel, &hole_ofs, &hole_len);
+  __machnet_channel_mem_populate(channel, stat_buf.st_size, hole_ofs, hole_len,
+                                 0);
+
   // Success.
   if (channel_size != NULL) *channel_size = stat_buf.st_size;
 
@@ -369,7 +719,9 @@ fail:
   return NULL;
 }
 
-void *machnet_attach() {
+void *machnet_attach() { return machnet_attach_opts(NULL); }
+
+void *machnet_attach_opts(const MachnetAttachOpts_t *opts) {
   uuid_t uuid;        // UUID for the shared memory channel.
   char uuid_str[37];  // 36 chars + null terminator for UUID string.
 
@@ -385,14 +737,23 @@ void *machnet_attach() {
   /* Request the default. */
   req.channel_info.desc_ring_size = MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT;
   req.channel_info.buffer_count = MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT;
-
-  // Send the request to the Machnet control plane.
-  int channel_fd;
+  req.channel_info.queue_pairs_nr = opts != NULL ? opts->queue_pairs_nr : 0;
+  req.channel_info.flags = opts != NULL ? opts->flags : 0;
+  req.channel_info.numa_node =
+      opts != NULL ? opts->numa_node : MACHNET_NUMA_NODE_ANY;
+
+  // Send the request to the Machnet control plane. The response carries the
+  // channel's descriptor, and optionally the channel's doorbell, the pending
+  // bitmap of the engine serving the channel, and the channel's notification
+  // (see `MachnetChannelDoorbell_t').
+  int fds[MACHNET_CTRL_MSG_MAX_FDS];
   machnet_ctrl_msg_t resp;
-  if (_machnet_ctrl_request(&req, &resp, &channel_fd) != 0) {
+  if (_machnet_ctrl_request(&req, &resp, fds, MACHNET_CTRL_MSG_MAX_FDS) != 0) {
     fprintf(stderr, "ERROR: Failed to send request to controller.");
     return NULL;
   }
+  const int channel_fd = fds[0], doorbell_fd = fds[1], pending_fd = fds[2],
+            notify_fd = fds[3];
 
   // Check the response from the Machnet control plane.
   if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
@@ -401,18 +762,151 @@ void *machnet_attach() {
     return NULL;
   }
 
+  MachnetChannelCtx_t *ctx = NULL;
   if (resp.status != MACHNET_CTRL_STATUS_SUCCESS || channel_fd < 0) {
     fprintf(stderr, "Failure %d.\n", channel_fd);
+  } else {
+    ctx = machnet_bind(channel_fd, NULL);
+  }
+  if (ctx == NULL) {
+    if (doorbell_fd >= 0) close(doorbell_fd);
+    if (pending_fd >= 0) close(pending_fd);
+    if (notify_fd >= 0) close(notify_fd);
     return NULL;
   }
 
-  return machnet_bind(channel_fd, NULL);
+  // The following are only valid in this process; the channel is not shared
+  // with other applications.
+  ctx->doorbell.app_fd = doorbell_fd;
+  ctx->doorbell.app_notify_fd = notify_fd;
+  if (pending_fd >= 0 &&
+      ctx->doorbell.pending_slot < MACHNET_PENDING_BITMAP_BITS) {
+    MachnetPendingBitmap_t *bitmap = (MachnetPendingBitmap_t *)mmap(
+        NULL, sizeof(*bitmap), PROT_READ | PROT_WRITE, MAP_SHARED, pending_fd,
+        0);
+    if (bitmap != MAP_FAILED) {
+      // Without the bitmap the engine polls the channel on every cycle.
+      ctx->doorbell.app_pending =
+          &bitmap->words[ctx->doorbell.pending_slot / 64];
+    } else {
+      perror("mmap()");
+    }
+  }
+  if (pending_fd >= 0) close(pending_fd);
+  return ctx;
 }
 
-int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
-                    uint16_t dst_port, MachnetFlow_t *flow) {
-  assert(flow != NULL);
-  MachnetChannelCtx_t *ctx = channel_ctx;
+/*
+ * Flows released by the application (`machnet_flow_release') for reuse by
+ * `machnet_connect_pooled'. Pooled flows are kept alive by the engine, which
+ * reports the ones that go away on the completion queue of their channel;
+ * those are evicted before the pool is searched.
+ */
+#define MACHNET_FLOW_POOL_SIZE 256
+typedef struct {
+  const MachnetChannelCtx_t *ctx;  // NULL if the slot is free.
+  MachnetFlow_t flow;
+} MachnetPooledFlow_t;
+static MachnetPooledFlow_t g_flow_pool[MACHNET_FLOW_POOL_SIZE];
+static pthread_mutex_t g_flow_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int _machnet_flow_pool_take(const MachnetChannelCtx_t *ctx,
+                                   uint32_t src_ip, uint32_t dst_ip,
+                                   uint16_t dst_port, MachnetFlow_t *flow) {
+  int found = 0;
+  pthread_mutex_lock(&g_flow_pool_lock);
+  for (size_t i = 0; i < MACHNET_FLOW_POOL_SIZE; i++) {
+    MachnetPooledFlow_t *entry = &g_flow_pool[i];
+    if (entry->ctx != ctx || entry->flow.src_ip != src_ip ||
+        entry->flow.dst_ip != dst_ip || entry->flow.dst_port != dst_port)
+      continue;
+    *flow = entry->flow;
+    entry->ctx = NULL;
+    found = 1;
+    break;
+  }
+  pthread_mutex_unlock(&g_flow_pool_lock);
+  return found;
+}
+
+static int _machnet_flow_pool_put(const MachnetChannelCtx_t *ctx,
+                                  const MachnetFlow_t *flow) {
+  int added = 0;
+  pthread_mutex_lock(&g_flow_pool_lock);
+  for (size_t i = 0; i < MACHNET_FLOW_POOL_SIZE; i++) {
+    MachnetPooledFlow_t *entry = &g_flow_pool[i];
+    if (entry->ctx != NULL) continue;
+    entry->ctx = ctx;
+    entry->flow = *flow;
+    added = 1;
+    break;
+  }
+  pthread_mutex_unlock(&g_flow_pool_lock);
+  return added;
+}
+
+static void _machnet_flow_pool_evict(const MachnetChannelCtx_t *ctx,
+                                     const MachnetFlow_t *flow) {
+  pthread_mutex_lock(&g_flow_pool_lock);
+  for (size_t i = 0; i < MACHNET_FLOW_POOL_SIZE; i++) {
+    MachnetPooledFlow_t *entry = &g_flow_pool[i];
+    if (entry->ctx == ctx && entry->flow.src_ip == flow->src_ip &&
+        entry->flow.src_port == flow->src_port &&
+        entry->flow.dst_ip == flow->dst_ip &&
+        entry->flow.dst_port == flow->dst_port)
+      entry->ctx = NULL;
+  }
+  pthread_mutex_unlock(&g_flow_pool_lock);
+}
+
+/*
+ * The application waits up to `MACHNET_CTRL_TIMEOUT_US` for the engine to
+ * complete a control request. It polls the completion queue, backing off
+ * exponentially between polls: the engine serves control requests within
+ * microseconds, unless it has to resolve an L2 address first.
+ */
+#define MACHNET_CTRL_TIMEOUT_US (10 * 1000 * 1000)
+#define MACHNET_CTRL_POLL_MIN_US 1u
+#define MACHNET_CTRL_POLL_MAX_US 1000u
+
+/**
+ * Waits for the completion of a control request sent to the engine.
+ *
+ * @param ctx  Pointer to the channel context.
+ * @param resp Set to the completion.
+ * @return 1 if a completion was received, 0 on timeout.
+ */
+static uint32_t _machnet_ctrl_wait(const MachnetChannelCtx_t *ctx,
+                                   MachnetCtrlQueueEntry_t *resp) {
+  uint64_t waited_us = 0;
+  uint32_t poll_us = MACHNET_CTRL_POLL_MIN_US;
+  for (;;) {
+    while (__machnet_channel_ctrl_cq_dequeue(ctx, 1, resp) == 1) {
+      if (resp->opcode != MACHNET_CTRL_OP_FLOW_CLOSED) return 1;
+      _machnet_flow_pool_evict(ctx, &resp->flow_info);
+    }
+    if (waited_us >= MACHNET_CTRL_TIMEOUT_US) return 0;
+    usleep(poll_us);
+    waited_us += poll_us;
+    poll_us = MIN(2 * poll_us, MACHNET_CTRL_POLL_MAX_US);
+  }
+}
+
+/**
+ * Drains the engine's notifications from the completion queue of a channel.
+ * Only called when no control request is outstanding.
+ */
+static void _machnet_ctrl_drain(const MachnetChannelCtx_t *ctx) {
+  MachnetCtrlQueueEntry_t notice;
+  while (__machnet_channel_ctrl_cq_dequeue(ctx, 1, &notice) == 1) {
+    if (notice.opcode == MACHNET_CTRL_OP_FLOW_CLOSED)
+      _machnet_flow_pool_evict(ctx, &notice.flow_info);
+  }
+}
+
+static int _machnet_connect(MachnetChannelCtx_t *ctx, const char *src_ip,
+                            const char *dst_ip, uint16_t dst_port,
+                            uint32_t flags, MachnetFlow_t *flow) {
 
   if (inet_addr(src_ip) == INADDR_NONE || inet_addr(dst_ip) == INADDR_ANY) {
     fprintf(stderr,
@@ -429,23 +923,19 @@ int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
   req.flow_info.src_ip = ntohl(inet_addr(src_ip));
   req.flow_info.dst_ip = ntohl(inet_addr(dst_ip));
   req.flow_info.dst_port = dst_port;
+  req.cc = ctx->cc;
+  req.flags = flags;
 
   // Send the request to the Machnet control plane.
   if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, &req) != 1) {
     fprintf(stderr, "ERROR: Failed to enqueue request to control queue.\n");
     return -1;
   }
+  _machnet_doorbell_ring(ctx);
 
   MachnetCtrlQueueEntry_t resp;
   memset(&resp, 0, sizeof(resp));
-  uint32_t ret = 0;
-  int max_tries = 10;
-  do {
-    ret = __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp);
-    if (ret != 0) break;
-    sleep(1);
-  } while (max_tries-- > 0);
-  if (ret == 0) {
+  if (!_machnet_ctrl_wait(ctx, &resp)) {
     fprintf(stderr, "ERROR: Failed to dequeue response from control queue.\n");
     return -1;
   }
@@ -465,6 +955,60 @@ int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
   return 0;
 }
 
+int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
+                    uint16_t dst_port, MachnetFlow_t *flow) {
+  assert(flow != NULL);
+  return _machnet_connect(channel_ctx, src_ip, dst_ip, dst_port, 0, flow);
+}
+
+int machnet_connect_pooled(void *channel_ctx, const char *src_ip,
+                           const char *dst_ip, uint16_t dst_port,
+                           MachnetFlow_t *flow) {
+  assert(flow != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (inet_addr(src_ip) != INADDR_NONE && inet_addr(dst_ip) != INADDR_ANY) {
+    _machnet_ctrl_drain(ctx);
+    if (_machnet_flow_pool_take(ctx, ntohl(inet_addr(src_ip)),
+                                ntohl(inet_addr(dst_ip)), dst_port, flow))
+      return 0;
+  }
+  return _machnet_connect(ctx, src_ip, dst_ip, dst_port,
+                          MACHNET_CTRL_FLAG_KEEPALIVE, flow);
+}
+
+int machnet_flow_release(const void *channel_ctx, const MachnetFlow_t *flow) {
+  assert(channel_ctx != NULL);
+  assert(flow != NULL);
+  return _machnet_flow_pool_put(channel_ctx, flow) ? 0 : -1;
+}
+
+int machnet_set_cc(void *channel_ctx, uint16_t cc) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (cc > MACHNET_CC_FIXED) {
+    fprintf(stderr, "machnet_set_cc: Invalid congestion control: %hu\n", cc);
+    return -EINVAL;
+  }
+  ctx->cc = cc;
+  return 0;
+}
+
+int machnet_set_priority(void *channel_ctx, uint16_t prio) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = channel_ctx;
+
+  if (prio >= MACHNET_PRIO_CLASSES_NR) {
+    fprintf(stderr, "machnet_set_priority: Invalid priority class: %hu\n",
+            prio);
+    return -EINVAL;
+  }
+  // The engine polls the class of the channel now and then.
+  __atomic_store_n(&ctx->prio, prio, __ATOMIC_RELAXED);
+  return 0;
+}
+
 int machnet_listen(void *channel_ctx, const char *local_ip,
                    uint16_t local_port) {
   assert(channel_ctx != NULL);
@@ -481,23 +1025,18 @@ int machnet_listen(void *channel_ctx, const char *local_ip,
   req.opcode = MACHNET_CTRL_OP_LISTEN;
   req.listener_info.ip = ntohl(inet_addr(local_ip));
   req.listener_info.port = local_port;
+  req.cc = ctx->cc;
 
   // Send the request to the Machnet control plane.
   if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, &req) != 1) {
     fprintf(stderr, "ERROR: Failed to enqueue request to control queue.\n");
     return -1;
   }
+  _machnet_doorbell_ring(ctx);
 
   MachnetCtrlQueueEntry_t resp;
   memset(&resp, 0, sizeof(resp));
-  uint32_t ret = 0;
-  int max_tries = 10;
-  do {
-    ret = __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp);
-    if (ret != 0) break;
-    sleep(1);
-  } while (max_tries-- > 0);
-  if (ret == 0) {
+  if (!_machnet_ctrl_wait(ctx, &resp)) {
     fprintf(stderr, "ERROR: Failed to dequeue response from control queue.\n");
     return -1;
   }
@@ -531,30 +1070,42 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
   return machnet_sendmsg(channel_ctx, &msghdr);
 }
 
-int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
-  assert(channel_ctx != NULL);
-  assert(msghdr != NULL);
-  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
-
+/**
+ * @brief Returns the number of buffers needed to hold a message, or 0 if the
+ * message size is invalid.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param msghdr The message descriptor.
+ */
+static inline uint32_t _machnet_msg_buffers_nr(const MachnetChannelCtx_t *ctx,
+                                               const MachnetMsgHdr_t *msghdr) {
   // Sanity checks on the full message size.
   if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
-    return -1;
+    return 0;
+
+  return machnet_msg_iovlen(ctx, msghdr->msg_size);
+}
 
+/**
+ * @brief Gathers the segments of a message into buffers allocated for it, and
+ * marks them as a message ready to be enqueued, headed by `buf_index_table[0]`.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param msghdr The message descriptor.
+ * @param buf_index_table Indices of the `buffers_nr` buffers allocated.
+ * @param buffers_nr Number of buffers to hold the message; as returned by
+ * `_machnet_msg_buffers_nr()`.
+ */
+static inline void _machnet_msg_gather(const MachnetChannelCtx_t *ctx,
+                                       const MachnetMsgHdr_t *msghdr,
+                                       const MachnetRingSlot_t *buf_index_table,
+                                       uint32_t buffers_nr) {
   // Get the maximum payload size of a message buffer.
   // This is dictated by the stack, during the channel creation.
   const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
 
-  // Calculate how many buffers we need to hold the message, and bulk allocate
-  // them.
-  const uint32_t buffers_nr =
-      (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
-  MachnetRingSlot_t *buf_index_table = _machnet_buffers_alloc(ctx, buffers_nr);
-  if (buf_index_table == NULL) {
-    // We failed to allocate the buffers.
-    return -1;
-  }
-
   // Gather all message segments.
+  assert(msghdr->msg_iov != NULL);
   uint32_t buffer_cur_index = 0;
   uint32_t total_bytes_copied = 0;
   uint32_t new_buffer = 1;
@@ -575,7 +1126,7 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
       }
       // Copy the data.
       uint32_t nbytes_to_copy =
-          MIN(seg_bytes, __machnet_channel_buf_tailroom(buffer));
+          MIN(seg_bytes, kMsgBufPayloadMax - buffer->data_len);
       uchar_t *buf_data = __machnet_channel_buf_append(buffer, nbytes_to_copy);
       memcpy(buf_data, seg_data, nbytes_to_copy);
       buffer->flags |= MACHNET_MSGBUF_FLAGS_SG;
@@ -584,7 +1135,7 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
       seg_bytes -= nbytes_to_copy;
       total_bytes_copied += nbytes_to_copy;
 
-      if ((__machnet_channel_buf_tailroom(buffer) == 0) && seg_bytes) {
+      if ((buffer->data_len == kMsgBufPayloadMax) && seg_bytes) {
         // The buffer is full, and we still have data to copy.
         buffer_cur_index++;  // Get the next buffer index.
         new_buffer = 1;
@@ -614,30 +1165,348 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
   first->flow = msghdr->flow_info;
   first->msg_len = msghdr->msg_size;
   first->last = buf_index_table[buffers_nr - 1];  // Link to the last buffer.
+  first->tsc_stamp = __machnet_tsc_stamp();
+}
+
+int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Calculate how many buffers we need to hold the message, and bulk allocate
+  // them.
+  const uint32_t buffers_nr = _machnet_msg_buffers_nr(ctx, msghdr);
+  if (unlikely(buffers_nr == 0)) return -1;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_buffers_alloc(ctx, msghdr->msg_size, buffers_nr);
+  if (buf_index_table == NULL) {
+    // We failed to allocate the buffers.
+    return -1;
+  }
+
+  _machnet_msg_gather(ctx, msghdr, buf_index_table, buffers_nr);
 
   // Finally, send the message.
   // TODO(ilias): Add retries if the ring is full, and add statistics.
-  if (__machnet_channel_app_ring_enqueue(ctx, 1, buf_index_table) != 1) {
+  if (_machnet_app_enqueue(ctx, 1, buf_index_table) != 1) {
+    _machnet_buffers_chain_release(ctx, buf_index_table[0]);
     return -1;
   }
+  _machnet_doorbell_ring(ctx);
 
   return 0;
 }
 
 int machnet_sendmmsg(const void *channel_ctx,
                      const MachnetMsgHdr_t *msghdr_iovec, int vlen) {
+  assert(channel_ctx != NULL);
+  assert(msghdr_iovec != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  const uint32_t kMsgBatchSize = 32;
   int msg_sent = 0;
 
-  for (int msg_index = 0; msg_index < vlen; msg_index++) {
-    const MachnetMsgHdr_t *msghdr = &msghdr_iovec[msg_index];
-    assert(msghdr->msg_iov != NULL);
-    if (machnet_sendmsg(channel_ctx, msghdr) != 0) return msg_sent;
-    msg_sent++;
+  while (msg_sent < vlen) {
+    // Size up a batch of messages, up to the first invalid one.
+    const MachnetMsgHdr_t *batch = &msghdr_iovec[msg_sent];
+    uint32_t buffers_nr[kMsgBatchSize];
+    uint32_t msgs_nr = 0;
+    uint32_t total_buffers_nr = 0;
+    while (msgs_nr < kMsgBatchSize && msgs_nr < (uint32_t)(vlen - msg_sent)) {
+      const uint32_t nr = _machnet_msg_buffers_nr(ctx, &batch[msgs_nr]);
+      if (unlikely(nr == 0)) break;
+      buffers_nr[msgs_nr++] = nr;
+      total_buffers_nr += nr;
+    }
+    if (unlikely(msgs_nr == 0)) break;
+
+    // Allocate the buffers of the whole batch at once, of the default size.
+    MachnetRingSlot_t *buf_index_table =
+        _machnet_buffers_alloc(ctx, 0, total_buffers_nr);
+    if (unlikely(buf_index_table == NULL)) {
+      // There are not enough buffers for the whole batch; send as many of its
+      // messages as possible, one by one.
+      for (uint32_t i = 0; i < msgs_nr; i++) {
+        if (machnet_sendmsg(ctx, &batch[i]) != 0) return msg_sent;
+        msg_sent++;
+      }
+      continue;
+    }
+
+    MachnetRingSlot_t heads[kMsgBatchSize];
+    for (uint32_t i = 0; i < msgs_nr; i++) {
+      heads[i] = buf_index_table[0];
+      _machnet_msg_gather(ctx, &batch[i], buf_index_table, buffers_nr[i]);
+      buf_index_table += buffers_nr[i];
+    }
+
+    // Enqueue as many messages of the batch as the ring has room for, and
+    // drop the rest.
+    const uint32_t enqueued = _machnet_app_enqueue(ctx, msgs_nr, heads);
+    if (likely(enqueued > 0)) _machnet_doorbell_ring(ctx);
+    msg_sent += enqueued;
+    if (unlikely(enqueued < msgs_nr)) {
+      for (uint32_t i = enqueued; i < msgs_nr; i++) {
+        _machnet_buffers_chain_release(ctx, heads[i]);
+      }
+      break;
+    }
   }
 
   return msg_sent;
 }
 
+/**
+ * @brief Drops references to the payload buffers of a fan-out send, freeing
+ * those left without any.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param buffer_index Index of the first payload buffer.
+ * @param n Number of references to drop from each buffer.
+ */
+static inline void _machnet_fanout_payload_unref(
+    MachnetChannelCtx_t *ctx, MachnetRingSlot_t buffer_index, uint32_t n) {
+  while (1) {
+    MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+    // Read the chain first: once the buffer is unreferenced, the engine may
+    // free it.
+    const int more = buffer->flags & MACHNET_MSGBUF_FLAGS_SG;
+    const MachnetRingSlot_t next = buffer->next;
+    if (__machnet_channel_buf_unref(buffer, n) == 0)
+      _machnet_buffers_release(ctx, 1, &buffer_index);
+    if (!more) break;
+    buffer_index = next;
+  }
+}
+
+/**
+ * @brief Builds, for each of a number of flows, a message of alias buffers that
+ * stand for the payload buffers of a fan-out send (see
+ * `MACHNET_MSGBUF_FLAGS_ALIAS'). Aliases hold no data, so they come from the
+ * smallest size class, if it has any left.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param msghdr The message descriptor.
+ * @param payload Index of the first payload buffer.
+ * @param buffers_nr Number of payload buffers.
+ * @param flows The flows of the messages.
+ * @param flows_nr Number of flows.
+ * @param heads Table to store the indices of the first buffers of the messages.
+ * @return 0 on success, -1 if the channel is out of buffers.
+ */
+static inline int _machnet_fanout_aliases_build(
+    MachnetChannelCtx_t *ctx, const MachnetMsgHdr_t *msghdr,
+    MachnetRingSlot_t payload, uint32_t buffers_nr, const MachnetFlow_t *flows,
+    uint32_t flows_nr, MachnetRingSlot_t *heads) {
+  const uint32_t aliases_nr = flows_nr * buffers_nr;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_buffers_alloc(ctx, __machnet_channel_buf_class_for(ctx, 0),
+                             aliases_nr);
+  if (buf_index_table == NULL)
+    buf_index_table = _machnet_buffers_alloc(ctx, 0, aliases_nr);
+  if (buf_index_table == NULL) return -1;
+
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    const MachnetRingSlot_t *aliases = &buf_index_table[i * buffers_nr];
+    MachnetRingSlot_t target_index = payload;
+    for (uint32_t j = 0; j < buffers_nr; j++) {
+      const MachnetMsgBuf_t *target = __machnet_channel_buf(ctx, target_index);
+      MachnetMsgBuf_t *alias = __machnet_channel_buf(ctx, aliases[j]);
+      __machnet_channel_buf_init(alias);
+      *(uint32_t *)__machnet_channel_buf_base(alias) = target_index;
+      alias->flags = MACHNET_MSGBUF_FLAGS_ALIAS |
+                     (target->flags & (MACHNET_MSGBUF_FLAGS_SG |
+                                       MACHNET_MSGBUF_FLAGS_FIN));
+      alias->data_len = target->data_len;
+      if (j + 1 < buffers_nr) alias->next = aliases[j + 1];
+      target_index = target->next;
+    }
+
+    MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, aliases[0]);
+    first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
+    first->flags |= (msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+    first->flow = flows[i];
+    first->msg_len = msghdr->msg_size;
+    first->last = aliases[buffers_nr - 1];
+    first->tsc_stamp = __machnet_tsc_stamp();
+    heads[i] = aliases[0];
+  }
+  return 0;
+}
+
+int machnet_sendmsg_fanout(const void *channel_ctx,
+                           const MachnetMsgHdr_t *msghdr,
+                           const MachnetFlow_t *flows, uint32_t flows_nr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  assert(flows != NULL || flows_nr == 0);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  if (unlikely(flows_nr == 0)) return 0;
+
+  // Copy the message once, into the payload buffers.
+  const uint32_t buffers_nr = _machnet_msg_buffers_nr(ctx, msghdr);
+  if (unlikely(buffers_nr == 0)) return -1;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_buffers_alloc(ctx, 0, buffers_nr);
+  if (buf_index_table == NULL) return -1;
+  _machnet_msg_gather(ctx, msghdr, buf_index_table, buffers_nr);
+  const MachnetRingSlot_t payload = buf_index_table[0];
+
+  // Every flow holds a reference to each payload buffer, until it is done
+  // with it; the references of the flows the message is not sent on are
+  // dropped at the end.
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    __machnet_channel_buf(ctx, buf_index_table[i])->refcnt = flows_nr;
+  }
+
+  const uint32_t kFlowBatchSize = 32;
+  uint32_t flows_sent = 0;
+  while (flows_sent < flows_nr) {
+    const uint32_t batch_nr = MIN(kFlowBatchSize, flows_nr - flows_sent);
+    MachnetRingSlot_t heads[kFlowBatchSize];
+    if (_machnet_fanout_aliases_build(ctx, msghdr, payload, buffers_nr,
+                                      &flows[flows_sent], batch_nr,
+                                      heads) != 0) {
+      break;
+    }
+
+    const uint32_t enqueued = _machnet_app_enqueue(ctx, batch_nr, heads);
+    if (likely(enqueued > 0)) _machnet_doorbell_ring(ctx);
+    flows_sent += enqueued;
+    if (unlikely(enqueued < batch_nr)) {
+      for (uint32_t i = enqueued; i < batch_nr; i++) {
+        _machnet_buffers_chain_release(ctx, heads[i]);
+      }
+      break;
+    }
+  }
+
+  if (unlikely(flows_sent < flows_nr))
+    _machnet_fanout_payload_unref(ctx, payload, flows_nr - flows_sent);
+  return flows_sent == 0 ? -1 : (int)flows_sent;
+}
+
+size_t machnet_msg_iovlen(const void *channel_ctx, uint32_t msg_size) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  const size_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+  return (msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
+}
+
+int machnet_msg_alloc(const void *channel_ctx, uint32_t msg_size,
+                      MachnetMsg_t *msg) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Sanity checks on the full message size.
+  if (unlikely(msg_size > MACHNET_MSG_MAX_LEN || msg_size == 0)) return -1;
+
+  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
+  const uint32_t buffers_nr = machnet_msg_iovlen(ctx, msg_size);
+  if (unlikely(buffers_nr > msg->msg_iovlen)) return -1;
+  assert(msg->msg_iov != NULL);
+
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_buffers_alloc(ctx, msg_size, buffers_nr);
+  if (buf_index_table == NULL) {
+    // We failed to allocate the buffers.
+    return -1;
+  }
+
+  // Chain the buffers, all of them full but the last, and expose their data
+  // areas to the application.
+  uint32_t remaining_bytes = msg_size;
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buf_index_table[i]);
+    if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) abort();
+    __machnet_channel_buf_init(buffer);
+    const uint32_t nbytes = MIN(remaining_bytes, kMsgBufPayloadMax);
+    msg->msg_iov[i].base = __machnet_channel_buf_append(buffer, nbytes);
+    msg->msg_iov[i].len = nbytes;
+    remaining_bytes -= nbytes;
+    if (i + 1 < buffers_nr) {
+      buffer->flags |= MACHNET_MSGBUF_FLAGS_SG;
+      buffer->next = buf_index_table[i + 1];
+    }
+  }
+
+  msg->msg_size = msg_size;
+  msg->msg_iovlen = buffers_nr;
+  msg->head = buf_index_table[0];
+
+  return 0;
+}
+
+int machnet_msg_send(const void *channel_ctx, MachnetMsg_t *msg) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  if (unlikely(msg->msg_size == 0)) return -1;
+  MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, msg->head);
+  if (unlikely(first->magic != MACHNET_MSGBUF_MAGIC)) abort();
+
+  // Find the buffer the message ends in.
+  MachnetRingSlot_t buffer_index = msg->head;
+  MachnetMsgBuf_t *buffer = first;
+  uint32_t remaining_bytes = msg->msg_size;
+  size_t segments_nr = 1;
+  while (remaining_bytes > __machnet_channel_buf_data_len(buffer)) {
+    // The message cannot grow past the buffers allocated.
+    if (unlikely(!(buffer->flags & MACHNET_MSGBUF_FLAGS_SG))) return -1;
+    remaining_bytes -= __machnet_channel_buf_data_len(buffer);
+    buffer_index = buffer->next;
+    buffer = __machnet_channel_buf(ctx, buffer_index);
+    segments_nr++;
+  }
+
+  // Free the buffers past the end of the message, if it was shrunk.
+  if (buffer->flags & MACHNET_MSGBUF_FLAGS_SG) {
+    _machnet_buffers_chain_release(ctx, buffer->next);
+    buffer->flags &= ~(MACHNET_MSGBUF_FLAGS_SG);
+    buffer->next = UINT32_MAX;
+  }
+  buffer->data_len = remaining_bytes;
+  msg->msg_iov[segments_nr - 1].len = remaining_bytes;
+  msg->msg_iovlen = segments_nr;
+
+  // Mark the head and the tail of the message, as `machnet_sendmsg' does.
+  buffer->flags |= MACHNET_MSGBUF_FLAGS_FIN;
+  first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
+  first->flags |= (msg->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  first->flow = msg->flow_info;
+  first->msg_len = msg->msg_size;
+  first->last = buffer_index;
+  first->tsc_stamp = __machnet_tsc_stamp();
+
+  if (_machnet_app_enqueue(ctx, 1, &msg->head) != 1) {
+    return -1;
+  }
+  _machnet_doorbell_ring(ctx);
+
+  return 0;
+}
+
+void machnet_msg_free(const void *channel_ctx, MachnetMsg_t *msg) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  _machnet_buffers_chain_release(ctx, msg->head);
+  msg->msg_size = 0;
+  msg->msg_iovlen = 0;
+}
+
+int machnet_tx_completions(const void *channel_ctx,
+                           MachnetTxCompletion_t *compls, int nr) {
+  assert(channel_ctx != NULL);
+  assert(compls != NULL);
+  if (nr <= 0) return 0;
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  return __machnet_channel_tx_compl_dequeue(ctx, nr, compls);
+}
+
 ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
                      MachnetFlow_t *flow) {
   MachnetMsgHdr_t msghdr;
@@ -654,18 +1523,45 @@ ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
   return msghdr.msg_size;
 }
 
-int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
-  assert(channel_ctx != NULL);
-  assert(msghdr != NULL);
-  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
-
-  const uint32_t kBufferBatchSize = 16;
-
-  // Deque a message from the ring.
-  MachnetRingSlot_t buffer_index;
-  uint32_t n = __machnet_channel_machnet_ring_dequeue(ctx, 1, &buffer_index);
-  if (n != 1) return 0;  // No message available.
+/**
+ * @brief Tracks the buffers of a received message for later release, from one
+ * of them on.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param buffer_index Index of the buffer to start from.
+ * @param buffer_indices Table the indices of the buffers are appended to.
+ * @param buffer_indices_nr Number of entries in `buffer_indices`; updated.
+ */
+static inline void _machnet_msg_buffers_track(const MachnetChannelCtx_t *ctx,
+                                              MachnetRingSlot_t buffer_index,
+                                              MachnetRingSlot_t *buffer_indices,
+                                              uint32_t *buffer_indices_nr) {
+  const MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+  while (1) {
+    buffer_indices[(*buffer_indices_nr)++] = buffer_index;
+    if (!(buffer->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+    buffer_index = buffer->next;
+    buffer = __machnet_channel_buf(ctx, buffer_index);
+  }
+}
 
+/**
+ * @brief Copies a received message out of its buffers into the segments of a
+ * message descriptor, and tracks the buffers consumed for later release.
+ *
+ * @param ctx Pointer to the channel context.
+ * @param buffer_index Index of the first buffer of the message.
+ * @param msghdr The message descriptor to fill in.
+ * @param buffer_indices Table the indices of the message's buffers are appended
+ * to; all of them, even if the message does not fit the segments provided.
+ * @param buffer_indices_nr Number of entries in `buffer_indices`; updated.
+ * @return 0 on success, -1 if the message does not fit the segments provided.
+ */
+static inline int _machnet_msg_scatter(const MachnetChannelCtx_t *ctx,
+                                       MachnetRingSlot_t buffer_index,
+                                       MachnetMsgHdr_t *msghdr,
+                                       MachnetRingSlot_t *buffer_indices,
+                                       uint32_t *buffer_indices_nr) {
   MachnetMsgBuf_t *buffer;
   buffer = __machnet_channel_buf(ctx, buffer_index);
   MachnetFlow_t flow_info = buffer->flow;
@@ -673,11 +1569,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
   size_t iov_index = 0;
   uint32_t seg_data_ofs = 0;
   uint32_t total_bytes_copied = 0;
-
-  // `buffer_indices' array is being used to track used buffers, for later
-  // release.
-  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
-  uint32_t buffer_indices_index = 0;
+  uint32_t buffer_indices_index = *buffer_indices_nr;
 
   while (buffer != NULL &&
          __machnet_channel_buf_data_len(buffer) > buf_data_ofs) {
@@ -726,13 +1618,6 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
         buffer = __machnet_channel_buf(ctx, buffer_index);
         buf_data_ofs = 0;
       }
-
-      // Do a batch buffer release if we reached the threshold.
-      if (buffer_indices_index == kBufferBatchSize) {
-        // release to the buf_ring
-        _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
-        buffer_indices_index = 0;
-      }
     }
 
     // Grab the next segment, if no space in this one.
@@ -745,29 +1630,495 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
   // We have finished copying over the message. Now add the control data.
   msghdr->msg_size = total_bytes_copied;
   msghdr->flow_info = flow_info;
+  *buffer_indices_nr = buffer_indices_index;
+
+  // Success.
+  return 0;
+
+fail:
+  *buffer_indices_nr = buffer_indices_index;
+  _machnet_msg_buffers_track(ctx, buffer_index, buffer_indices,
+                             buffer_indices_nr);
+
+  return -1;
+}
+
+int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // `buffer_indices' array is being used to track used buffers, for later
+  // release. The thread's index table can hold all the buffers of the pool.
+  MachnetRingSlot_t *buffer_indices = _machnet_buffer_index_table(ctx);
+  if (unlikely(buffer_indices == NULL)) return -1;
+
+  // Deque a message from the ring.
+  MachnetRingSlot_t buffer_index;
+  uint32_t n = _machnet_app_dequeue(ctx, 1, &buffer_index);
+  if (n != 1) return 0;  // No message available.
+
+  uint32_t buffer_indices_nr = 0;
+  const int ret = _machnet_msg_scatter(ctx, buffer_index, msghdr,
+                                       buffer_indices, &buffer_indices_nr);
 
-  // Free up any remaining buffers.
-  _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+  // Free up the buffers of the message.
+  _machnet_buffers_release(ctx, buffer_indices_nr, buffer_indices);
+
+  return ret == 0 ? 1 : -1;
+}
+
+int machnet_recvmmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr_iovec,
+                     int vlen) {
+  assert(channel_ctx != NULL);
+  assert(msghdr_iovec != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  const uint32_t kMsgBatchSize = 32;
+  MachnetRingSlot_t *buffer_indices = _machnet_buffer_index_table(ctx);
+  if (unlikely(buffer_indices == NULL)) return -1;
+  int msg_received = 0;
+  int msg_dropped = 0;
+
+  while (msg_received < vlen) {
+    // Deque a batch of messages from the ring.
+    MachnetRingSlot_t heads[kMsgBatchSize];
+    const uint32_t msgs_nr = _machnet_app_dequeue(
+        ctx, MIN(kMsgBatchSize, (uint32_t)(vlen - msg_received)), heads);
+    if (msgs_nr == 0) break;  // No more messages available.
+
+    // Copy the messages out, tracking the buffers of all of them. A message
+    // that does not fit its descriptor is dropped, and the descriptor is used
+    // for the next one.
+    uint32_t buffer_indices_nr = 0;
+    for (uint32_t i = 0; i < msgs_nr; i++) {
+      if (_machnet_msg_scatter(ctx, heads[i], &msghdr_iovec[msg_received],
+                               buffer_indices, &buffer_indices_nr) == 0) {
+        msg_received++;
+      } else {
+        msg_dropped++;
+      }
+    }
+
+    // Free up the buffers of the whole batch at once.
+    _machnet_buffers_release(ctx, buffer_indices_nr, buffer_indices);
+  }
+
+  if (unlikely(msg_received == 0 && msg_dropped > 0)) return -1;
+  return msg_received;
+}
+
+int machnet_recvmsg_zc(const void *channel_ctx, MachnetMsg_t *msg) {
+  assert(channel_ctx != NULL);
+  assert(msg != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Deque a message from the ring.
+  MachnetRingSlot_t buffer_index;
+  uint32_t n = _machnet_app_dequeue(ctx, 1, &buffer_index);
+  if (n != 1) return 0;  // No message available.
+
+  const MachnetRingSlot_t head = buffer_index;
+  const MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+  const MachnetFlow_t flow_info = buffer->flow;
+  uint32_t total_bytes = 0;
+  size_t iov_index = 0;
+
+  // Describe the buffers of the message, in place.
+  while (1) {
+    if (unlikely(iov_index >= msg->msg_iovlen)) {
+      // There are more buffers in this message than segments provided.
+      _machnet_buffers_chain_release(ctx, head);
+      return -1;
+    }
+    assert(msg->msg_iov != NULL);
+    msg->msg_iov[iov_index].base = __machnet_channel_buf_data(buffer);
+    msg->msg_iov[iov_index].len = __machnet_channel_buf_data_len(buffer);
+    total_bytes += __machnet_channel_buf_data_len(buffer);
+    iov_index++;
+
+    if (!(buffer->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+    buffer_index = buffer->next;
+    buffer = __machnet_channel_buf(ctx, buffer_index);
+  }
+
+  msg->msg_size = total_bytes;
+  msg->flow_info = flow_info;
+  msg->msg_iovlen = iov_index;
+  msg->flags = 0;
+  msg->head = head;
 
   // Success.
   return 1;
+}
 
-fail:
-  while (buffer != NULL) {
-    buffer_indices[buffer_indices_index++] = buffer_index;
-    if (buffer->flags & MACHNET_MSGBUF_FLAGS_SG) {
-      buffer_index = buffer->next;
-      buffer = __machnet_channel_buf(ctx, buffer_index);
-    } else {
-      buffer = NULL;
+void machnet_msg_release(const void *channel_ctx, MachnetMsg_t *msg) {
+  // Received messages are released the same way as unsent loans.
+  machnet_msg_free(channel_ctx, msg);
+}
+
+const MachnetChannelStats_t *machnet_channel_stats(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  return __machnet_channel_stats((const MachnetChannelCtx_t *)channel_ctx);
+}
+
+int machnet_notify_fd(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  return ctx->doorbell.app_notify_fd;
+}
+
+int machnet_notify_arm(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  if (ctx->doorbell.app_notify_fd < 0) return -1;
+
+  // Arm, then re-check the ring: a message delivered before the notification
+  // was armed does not signal it.
+  __machnet_channel_notify_set(ctx, 1);
+  if (!_machnet_app_pending(ctx)) return 0;
+  __machnet_channel_notify_set(ctx, 0);
+  return 1;
+}
+
+void machnet_notify_disarm(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  __machnet_channel_notify_set(ctx, 0);
+  if (ctx->doorbell.app_notify_fd < 0) return;
+  uint64_t value;
+  // The descriptor is non-blocking; nothing to read is not an error.
+  ssize_t ret = read(ctx->doorbell.app_notify_fd, &value, sizeof(value));
+  (void)ret;
+}
+
+int machnet_wait(const void *channel_ctx, int timeout_ms) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  if (_machnet_app_pending(ctx)) return 1;
+
+  const int armed = machnet_notify_arm(channel_ctx);
+  if (armed != 0) return armed;
+
+  struct pollfd pfd = {.fd = ctx->doorbell.app_notify_fd, .events = POLLIN};
+  const int ret = poll(&pfd, 1, timeout_ms);
+  machnet_notify_disarm(channel_ctx);
+  if (ret < 0) return -1;
+  return _machnet_app_pending(ctx);
+}
+
+int machnet_queue_bind(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  if (unlikely(tc == NULL)) return -1;
+  if (tc->queue == MACHNET_CHANNEL_QUEUE_SHARED) {
+    tc->queue = __machnet_channel_queue_claim(ctx);
+    if (tc->queue == MACHNET_CHANNEL_QUEUE_SHARED) return -1;
+  }
+  return tc->queue;
+}
+
+void machnet_queue_unbind(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  if (ctx->data_ctx.queue_pairs_nr == 0) return;
+  MachnetThreadCache_t *tc = _machnet_thread_cache(ctx);
+  if (tc == NULL || tc->queue == MACHNET_CHANNEL_QUEUE_SHARED) return;
+  __machnet_channel_queue_release(ctx, tc->queue);
+  tc->queue = MACHNET_CHANNEL_QUEUE_SHARED;
+}
+
+void machnet_cache_flush(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  MachnetThreadCaches_t *caches = tls_thread_caches;
+  if (caches == NULL) return;
+  for (uint32_t i = 0; i < caches->count; i++) {
+    if (caches->caches[i].ctx == channel_ctx) {
+      _machnet_thread_cache_flush(&caches->caches[i]);
+      return;
     }
-    if (buffer == NULL || buffer_indices_index == kBufferBatchSize) {
-      _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
-      buffer_indices_index = 0;
+  }
+}
+
+/*
+ * RPC layer. A client keeps its calls in flight in a table of slots, allocated
+ * upfront, and encodes the slot of each call in the ID of its request, along
+ * with the generation of the slot (bumped whenever the slot is freed, so that
+ * late responses do not match the next call) and the ID of the client:
+ *
+ *     req_id = client (16 bits) | generation (24 bits) | slot (24 bits)
+ */
+#define MACHNET_RPC_SLOT_BITS 24
+#define MACHNET_RPC_SLOT_MASK ((1ULL << MACHNET_RPC_SLOT_BITS) - 1)
+#define MACHNET_RPC_GEN_MASK ((1U << 24) - 1)
+#define MACHNET_RPC_NO_DEADLINE UINT64_MAX
+
+typedef struct {
+  uint32_t gen;
+  uint32_t busy;
+  uint64_t deadline_ns;
+  void *resp_buf;
+  size_t resp_len;
+  void *cookie;
+} MachnetRpcSlot_t;
+
+struct MachnetRpcClient {
+  MachnetChannelCtx_t *ctx;
+  uint16_t id;
+  uint32_t slots_nr;
+  uint32_t free_nr;
+  uint32_t busy_nr;
+  uint64_t next_deadline_ns;  // Earliest deadline of the calls in flight.
+  uint32_t *free_slots;       // Stack of the free slots.
+  MachnetRpcSlot_t *slots;
+};
+
+static uint16_t g_rpc_client_ids;
+
+static inline uint64_t _machnet_rpc_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t _machnet_rpc_req_id(const MachnetRpcClient_t *rpc,
+                                           uint32_t slot) {
+  return (uint64_t)rpc->id << 48 |
+         (uint64_t)rpc->slots[slot].gen << MACHNET_RPC_SLOT_BITS | slot;
+}
+
+/**
+ * @brief Returns the slot of the call in flight a response answers, or
+ * `UINT32_MAX` if none does (e.g., the call timed out).
+ */
+static inline uint32_t _machnet_rpc_match(const MachnetRpcClient_t *rpc,
+                                          const MachnetRpcHdr_t *hdr) {
+  if (hdr->magic != MACHNET_RPC_MAGIC || hdr->type != MACHNET_RPC_TYPE_RESPONSE)
+    return UINT32_MAX;
+  const uint32_t slot = hdr->req_id & MACHNET_RPC_SLOT_MASK;
+  if (slot >= rpc->slots_nr || !rpc->slots[slot].busy ||
+      hdr->req_id != _machnet_rpc_req_id(rpc, slot))
+    return UINT32_MAX;
+  return slot;
+}
+
+static inline void _machnet_rpc_slot_free(MachnetRpcClient_t *rpc,
+                                          uint32_t slot) {
+  MachnetRpcSlot_t *s = &rpc->slots[slot];
+  s->busy = 0;
+  s->gen = (s->gen + 1) & MACHNET_RPC_GEN_MASK;
+  rpc->free_slots[rpc->free_nr++] = slot;
+  rpc->busy_nr--;
+}
+
+MachnetRpcClient_t *machnet_rpc_client_create(void *channel_ctx,
+                                              uint32_t max_calls) {
+  assert(channel_ctx != NULL);
+  if (max_calls == 0 || max_calls > MACHNET_RPC_SLOT_MASK + 1) return NULL;
+
+  MachnetRpcClient_t *rpc = (MachnetRpcClient_t *)calloc(1, sizeof(*rpc));
+  if (rpc == NULL) return NULL;
+  rpc->slots = (MachnetRpcSlot_t *)calloc(max_calls, sizeof(*rpc->slots));
+  rpc->free_slots = (uint32_t *)malloc(max_calls * sizeof(*rpc->free_slots));
+  if (rpc->slots == NULL || rpc->free_slots == NULL) {
+    machnet_rpc_client_destroy(rpc);
+    return NULL;
+  }
+  rpc->ctx = (MachnetChannelCtx_t *)channel_ctx;
+  rpc->id = __atomic_fetch_add(&g_rpc_client_ids, 1, __ATOMIC_RELAXED);
+  rpc->slots_nr = max_calls;
+  // Hand out the lowest slots first.
+  for (uint32_t i = 0; i < max_calls; i++)
+    rpc->free_slots[i] = max_calls - 1 - i;
+  rpc->free_nr = max_calls;
+  rpc->next_deadline_ns = MACHNET_RPC_NO_DEADLINE;
+  return rpc;
+}
+
+void machnet_rpc_client_destroy(MachnetRpcClient_t *rpc) {
+  if (rpc == NULL) return;
+  free(rpc->free_slots);
+  free(rpc->slots);
+  free(rpc);
+}
+
+int machnet_rpc_call(MachnetRpcClient_t *rpc, MachnetFlow_t flow,
+                     const void *req, size_t req_len, void *resp_buf,
+                     size_t resp_len, uint32_t timeout_us, void *cookie) {
+  assert(rpc != NULL);
+  if (unlikely(rpc->free_nr == 0)) return -1;
+  if (unlikely(req_len > MACHNET_MSG_MAX_LEN - sizeof(MachnetRpcHdr_t)))
+    return -1;
+
+  const uint32_t slot = rpc->free_slots[rpc->free_nr - 1];
+  MachnetRpcHdr_t hdr = {.magic = MACHNET_RPC_MAGIC,
+                         .type = MACHNET_RPC_TYPE_REQUEST,
+                         .req_id = _machnet_rpc_req_id(rpc, slot)};
+  MachnetIovec_t iov[2] = {{.base = &hdr, .len = sizeof(hdr)},
+                           {.base = (void *)req, .len = req_len}};
+  MachnetMsgHdr_t msghdr = {.msg_size = (uint32_t)(sizeof(hdr) + req_len),
+                            .flow_info = flow,
+                            .msg_iov = iov,
+                            .msg_iovlen = 2,
+                            .flags = 0};
+  if (machnet_sendmsg(rpc->ctx, &msghdr) != 0) return -1;
+
+  MachnetRpcSlot_t *s = &rpc->slots[slot];
+  s->busy = 1;
+  s->deadline_ns = timeout_us == 0
+                       ? MACHNET_RPC_NO_DEADLINE
+                       : _machnet_rpc_now_ns() + timeout_us * 1000ULL;
+  s->resp_buf = resp_buf;
+  s->resp_len = resp_len;
+  s->cookie = cookie;
+  rpc->free_nr--;
+  rpc->busy_nr++;
+  rpc->next_deadline_ns = MIN(rpc->next_deadline_ns, s->deadline_ns);
+  return 0;
+}
+
+/**
+ * @brief Completes the calls of an RPC client that timed out, up to `nr`, and
+ * updates the earliest deadline of the others. The slot table is only scanned
+ * once the earliest deadline has passed.
+ *
+ * @return The number of calls completed.
+ */
+static int _machnet_rpc_expire(MachnetRpcClient_t *rpc,
+                               MachnetRpcCompletion_t *compls, int nr) {
+  const uint64_t now = _machnet_rpc_now_ns();
+  if (rpc->busy_nr == 0 || now < rpc->next_deadline_ns) return 0;
+
+  int done = 0;
+  uint64_t next_deadline_ns = MACHNET_RPC_NO_DEADLINE;
+  for (uint32_t slot = 0; slot < rpc->slots_nr; slot++) {
+    MachnetRpcSlot_t *s = &rpc->slots[slot];
+    if (!s->busy) continue;
+    if (s->deadline_ns > now || done == nr) {
+      next_deadline_ns = MIN(next_deadline_ns, s->deadline_ns);
+      continue;
     }
+    compls[done++] = (MachnetRpcCompletion_t){
+        .cookie = s->cookie, .resp_len = 0, .status = MACHNET_RPC_TIMEOUT};
+    _machnet_rpc_slot_free(rpc, slot);
   }
+  rpc->next_deadline_ns = next_deadline_ns;
+  return done;
+}
 
-  return -1;
+int machnet_rpc_poll(MachnetRpcClient_t *rpc, MachnetRpcCompletion_t *compls,
+                     int nr) {
+  assert(rpc != NULL);
+  assert(compls != NULL);
+  MachnetChannelCtx_t *ctx = rpc->ctx;
+
+  const uint32_t kMsgBatchSize = 32;
+  MachnetRingSlot_t *buffer_indices = _machnet_buffer_index_table(ctx);
+  if (unlikely(buffer_indices == NULL)) return -1;
+  int done = 0;
+
+  while (done < nr) {
+    // Deque a batch of responses from the ring, as `machnet_recvmmsg`.
+    MachnetRingSlot_t heads[kMsgBatchSize];
+    const uint32_t msgs_nr = _machnet_app_dequeue(
+        ctx, MIN(kMsgBatchSize, (uint32_t)(nr - done)), heads);
+    if (msgs_nr == 0) break;
+
+    uint32_t buffer_indices_nr = 0;
+    for (uint32_t i = 0; i < msgs_nr; i++) {
+      // The header is at the start of the first buffer.
+      const MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, heads[i]);
+      MachnetRpcHdr_t hdr;
+      uint32_t slot = UINT32_MAX;
+      if (likely(__machnet_channel_buf_data_len(first) >= sizeof(hdr))) {
+        memcpy(&hdr, __machnet_channel_buf_data(first), sizeof(hdr));
+        slot = _machnet_rpc_match(rpc, &hdr);
+      }
+      if (unlikely(slot == UINT32_MAX)) {
+        _machnet_msg_buffers_track(ctx, heads[i], buffer_indices,
+                                   &buffer_indices_nr);
+        continue;
+      }
+
+      // Copy the response out, past the header.
+      MachnetRpcSlot_t *s = &rpc->slots[slot];
+      MachnetIovec_t iov[2] = {{.base = &hdr, .len = sizeof(hdr)},
+                               {.base = s->resp_buf, .len = s->resp_len}};
+      MachnetMsgHdr_t msghdr = {.msg_iov = iov, .msg_iovlen = 2};
+      const int ret = _machnet_msg_scatter(ctx, heads[i], &msghdr,
+                                           buffer_indices, &buffer_indices_nr);
+      compls[done++] = (MachnetRpcCompletion_t){
+          .cookie = s->cookie,
+          .resp_len = ret == 0 ? msghdr.msg_size - (uint32_t)sizeof(hdr) : 0,
+          .status = ret == 0 ? MACHNET_RPC_OK : MACHNET_RPC_OVERFLOW};
+      _machnet_rpc_slot_free(rpc, slot);
+    }
+
+    // Free up the buffers of the whole batch at once.
+    _machnet_buffers_release(ctx, buffer_indices_nr, buffer_indices);
+  }
+
+  return done + _machnet_rpc_expire(rpc, compls + done, nr - done);
+}
+
+int machnet_rpc_serve(const void *channel_ctx, MachnetRpcHandler_t handler,
+                      void *arg, void *buf, size_t buf_len, int max_reqs) {
+  assert(channel_ctx != NULL);
+  assert(handler != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  const uint32_t kMsgBatchSize = 32;
+  MachnetRingSlot_t *buffer_indices = _machnet_buffer_index_table(ctx);
+  if (unlikely(buffer_indices == NULL)) return -1;
+  int served = 0;
+
+  while (served < max_reqs) {
+    // Deque a batch of requests from the ring, as `machnet_recvmmsg`.
+    MachnetRingSlot_t heads[kMsgBatchSize];
+    const uint32_t msgs_nr = _machnet_app_dequeue(
+        ctx, MIN(kMsgBatchSize, (uint32_t)(max_reqs - served)), heads);
+    if (msgs_nr == 0) break;
+
+    for (uint32_t i = 0; i < msgs_nr; i++) {
+      MachnetRpcHdr_t hdr;
+      MachnetIovec_t iov[2] = {{.base = &hdr, .len = sizeof(hdr)},
+                               {.base = buf, .len = buf_len}};
+      MachnetMsgHdr_t msghdr = {.msg_iov = iov, .msg_iovlen = 2};
+      uint32_t buffer_indices_nr = 0;
+      const int ret = _machnet_msg_scatter(ctx, heads[i], &msghdr,
+                                           buffer_indices, &buffer_indices_nr);
+      // The buffers go back before the response is sent, which takes the
+      // scratch table of buffer indices over.
+      _machnet_buffers_release(ctx, buffer_indices_nr, buffer_indices);
+      if (unlikely(ret != 0 || msghdr.msg_size < sizeof(hdr) ||
+                   hdr.magic != MACHNET_RPC_MAGIC ||
+                   hdr.type != MACHNET_RPC_TYPE_REQUEST))
+        continue;
+
+      served++;
+      MachnetIovec_t resp = {.base = NULL, .len = 0};
+      if (handler(arg, &msghdr.flow_info, buf, msghdr.msg_size - sizeof(hdr),
+                  &resp) != 0)
+        continue;
+
+      // Answer on the flow the request came from.
+      hdr.type = MACHNET_RPC_TYPE_RESPONSE;
+      iov[1] = resp;
+      msghdr.msg_size = (uint32_t)(sizeof(hdr) + resp.len);
+      const MachnetFlow_t rx_flow = msghdr.flow_info;
+      msghdr.flow_info.src_ip = rx_flow.dst_ip;
+      msghdr.flow_info.dst_ip = rx_flow.src_ip;
+      msghdr.flow_info.src_port = rx_flow.dst_port;
+      msghdr.flow_info.dst_port = rx_flow.src_port;
+      msghdr.flags = 0;
+      // A response that cannot be sent is lost, as the request would be; the
+      // client times the call out.
+      machnet_sendmsg(ctx, &msghdr);
+    }
+  }
+
+  return served;
 }
 
 void machnet_detach(const MachnetChannelCtx_t *ctx) {}
@@ -38,7 +38,8 @@ typedef struct MachnetIovec MachnetIovec_t;
  *    sender of the message (depending on the direction).
  * - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.
  * - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.
- * - `flags` is the message flags.
+ * - `flags` is the message flags; on send, `MACHNET_MSGBUF_NOTIFY_DELIVERY`
+ *    asks for a completion (see `machnet_tx_completions`).
  */
 struct MachnetMsgHdr {
   uint32_t msg_size;
@@ -49,6 +50,55 @@ struct MachnetMsgHdr {
 };
 typedef struct MachnetMsgHdr MachnetMsgHdr_t;
 
+/**
+ * @brief Descriptor for a message held in place in the buffers of a channel,
+ * for zero-copy transmission and reception.
+ *
+ * Each of the `msg_iovlen` segments in `msg_iov` is the data area of one
+ * channel buffer; the application writes the message payload directly into
+ * them, or reads it directly out of them. Fields:
+ * - `msg_size` is the total size of the message payload.
+ * - `flow_info` is the flow the message is sent on, or was received from.
+ * - `msg_iov` is an application-provided vector of `MachnetIovec_t`
+ *    structures, filled by Machnet.
+ * - `msg_iovlen` is the capacity of `msg_iov` on input, and the number of
+ *    segments of the message on output.
+ * - `flags` is the message flags.
+ * - `head` is the index of the first buffer of the message, and is NOT to be
+ *    touched by the application.
+ */
+struct MachnetMsg {
+  uint32_t msg_size;
+  MachnetFlow_t flow_info;
+  MachnetIovec_t *msg_iov;
+  size_t msg_iovlen;
+  uint16_t flags;
+  MachnetRingSlot_t head;
+};
+typedef struct MachnetMsg MachnetMsg_t;
+
+/**
+ * @brief Options of a new channel (see `machnet_attach_opts`).
+ *
+ * - `queue_pairs_nr` is the number of per-thread queue pairs of the channel
+ *    (see `machnet_queue_bind`), up to `MACHNET_CHANNEL_QUEUE_PAIRS_MAX`.
+ * - `flags` are the channel creation flags (`MACHNET_CHANNEL_F_*`). With
+ *    `MACHNET_CHANNEL_F_SPSC`, the application promises to use the channel
+ *    from a single thread, and gets cheaper SPSC rings in exchange. With
+ *    `MACHNET_CHANNEL_F_DEDICATED`, the channel is latency-critical and gets
+ *    an engine to itself if one is free; otherwise it shares the least loaded
+ *    one, like any other channel.
+ * - `numa_node` is the NUMA node to place the channel's memory on, typically
+ *    the one the application runs on. `MACHNET_NUMA_NODE_ANY` (not 0) leaves
+ *    the choice to the controller, which picks the node of the NIC.
+ */
+struct MachnetAttachOpts {
+  uint32_t queue_pairs_nr;
+  uint32_t flags;
+  int32_t numa_node;
+};
+typedef struct MachnetAttachOpts MachnetAttachOpts_t;
+
 /// @brief Persistent connection between the application and the Machnet
 /// controller.
 extern int g_ctrl_socket;
@@ -85,6 +135,37 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size);
  */
 void *machnet_attach();
 
+/**
+ * @brief Like `machnet_attach`, but creates a channel with the given options.
+ *
+ * @param[in] opts The options of the channel; NULL picks the defaults.
+ * @return A pointer to the channel context on success, NULL otherwise.
+ */
+void *machnet_attach_opts(const MachnetAttachOpts_t *opts);
+
+/**
+ * @brief Selects the congestion control of the flows a channel creates from
+ * now on, by connecting or listening. Flows that already exist keep theirs.
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[in] cc          One of the `MACHNET_CC_*' constants;
+ *                        `MACHNET_CC_DEFAULT' picks the engine's default.
+ * @return 0 on success, -EINVAL if `cc' is unknown.
+ */
+int machnet_set_cc(void *channel_ctx, uint16_t cc);
+
+/**
+ * @brief Sets the priority class of a channel, and of the flows it creates
+ * from now on, by connecting or listening; flows that already exist keep
+ * theirs. The engine serves the messages of higher classes first, and shares
+ * the rest among the channels and flows of a class in proportion to the
+ * weight of the class; with DSCP marking configured, the packets of a flow
+ * carry its class too. Channels start in `MACHNET_PRIO_NORMAL'.
+ * @param[in] channel_ctx The Machnet channel context.
+ * @param[in] prio        One of the `MACHNET_PRIO_*' constants.
+ * @return 0 on success, -EINVAL if `prio' is unknown.
+ */
+int machnet_set_priority(void *channel_ctx, uint16_t prio);
+
 /**
  * @brief Listens for incoming messages on a specific IP and port.
  * @param[in] channel The channel associated to the listener.
@@ -109,6 +190,33 @@ int machnet_connect(void *channel_ctx, const char *local_ip,
                     const char *remote_ip, uint16_t remote_port,
                     MachnetFlow_t *flow);
 
+/**
+ * @brief Like `machnet_connect', but reuses a flow to the same peer released
+ * with `machnet_flow_release', if there is one, without a round trip to the
+ * engine. Flows created by this function are kept alive by the engine while
+ * idle, and leave the pool when the peer stops answering.
+ * @param[in] channel     The channel associated with the connection.
+ * @param[in] local_ip    The local IP address.
+ * @param[in] remote_ip   The remote IP address.
+ * @param[in] remote_port The remote port.
+ * @param[out] flow       Filled with the flow information on success.
+ * @return  0 on success, -1 on failure.
+ * @attention Not thread-safe with other control calls on the same channel.
+ */
+int machnet_connect_pooled(void *channel_ctx, const char *local_ip,
+                           const char *remote_ip, uint16_t remote_port,
+                           MachnetFlow_t *flow);
+
+/**
+ * @brief Returns a flow created by `machnet_connect_pooled' to the pool, for
+ * reuse by a later `machnet_connect_pooled' to the same peer. The flow stays
+ * open either way.
+ * @param[in] channel_ctx The channel associated with the flow.
+ * @param[in] flow        The flow to release.
+ * @return 0 on success, -1 if the pool is full.
+ */
+int machnet_flow_release(const void *channel_ctx, const MachnetFlow_t *flow);
+
 /**
  * Enqueue one message for transmission to a remote peer over the network.
  *
@@ -123,10 +231,10 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
 /**
  * This function enqueues one message for transmission to a remote peer over
  * the network. The application needs to provide the destination's (remote
- * peer) address. Machnet is responsible for end-to-end encrypted, reliable
- * delivery of each message to the relevant receiver. This function supports
- * SG collection of a message's buffers from the application's address
- * space.
+ * peer) address. Machnet is responsible for reliable delivery of each
+ * message to the relevant receiver, encrypted if the interface is configured
+ * with an encryption key. This function supports SG collection of a message's
+ * buffers from the application's address space.
  *
  * @param[in] channel_ctx        The Machnet channel context
  * @param[in] msghdr             An `MachnetMsgHdr' descriptor
@@ -137,9 +245,10 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr);
 /**
  * This function sends one or more messages to a remote peer over the network.
  * The application needs to provide the destination's (remote peer) address.
- * Machnet is responsible for end-to-end encrypted, reliable delivery of each
- * message to the relevant receiver. This function supports SG collection of a
- * message's buffers from the application's address space.
+ * Machnet is responsible for reliable delivery of each message to the
+ * relevant receiver, encrypted if the interface is configured with an
+ * encryption key. This function supports SG collection of a message's buffers
+ * from the application's address space.
  *
  * @param[in] channel_ctx        The Machnet channel context
  * @param[in] msghdr_iovec       An array of `MachnetMsgHdr' descriptors, each
@@ -151,6 +260,96 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr);
 int machnet_sendmmsg(const void *channel_ctx,
                      const MachnetMsgHdr_t *msghdr_iovec, int vlen);
 
+/**
+ * This function sends one message to several remote peers, copying its data
+ * into the channel only once: the copy is shared by all the flows, and freed
+ * once every peer has acknowledged it. The cost of the send beyond the copy
+ * depends on the number of flows, not on the size of the message. The
+ * `flow_info` of `msghdr` is ignored.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msghdr             An `MachnetMsgHdr' descriptor
+ * @param[in] flows              The flows to send the message on
+ * @param[in] flows_nr           Number of flows
+ * @return                       # of flows the message was sent on, from the
+ *                               first one on (fewer than `flows_nr` if the
+ *                               channel ran out of buffers or ring slots), or
+ *                               -1 if the message was not sent at all.
+ */
+int machnet_sendmsg_fanout(const void *channel_ctx,
+                           const MachnetMsgHdr_t *msghdr,
+                           const MachnetFlow_t *flows, uint32_t flows_nr);
+
+/**
+ * Returns the number of segments (i.e., the `msg_iovlen` needed) of a message
+ * of `msg_size` bytes, when held in the buffers of a channel.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msg_size           Size of the message, in bytes
+ * @return                       # of segments of the message.
+ */
+size_t machnet_msg_iovlen(const void *channel_ctx, uint32_t msg_size);
+
+/**
+ * This function loans the application channel buffers to hold a message of
+ * `msg_size` bytes, so that the message can be written in place and sent with
+ * `machnet_msg_send` without being copied. The buffers are owned by the
+ * application until the message is sent, or returned with `machnet_msg_free`.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] msg_size           Size of the message, in bytes
+ * @param[in, out] msg           An `MachnetMsg' descriptor. The application
+ *                               needs to fill in the `msg_iov` and
+ *                               `msg_iovlen` members, with room for
+ *                               `machnet_msg_iovlen()` segments; Machnet fills
+ *                               in the segments, and sets `msg_size` and
+ *                               `msg_iovlen`.
+ * @return                       0 on success, -1 on failure
+ */
+int machnet_msg_alloc(const void *channel_ctx, uint32_t msg_size,
+                      MachnetMsg_t *msg);
+
+/**
+ * This function enqueues a message loaned with `machnet_msg_alloc` for
+ * transmission, handing its buffers over to Machnet. The application sets the
+ * `flow_info` and `flags` of the message beforehand, and may lower its
+ * `msg_size` (e.g., if the size of the message was only bounded when it was
+ * allocated); buffers past the new size are freed.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msg           An `MachnetMsg' descriptor
+ * @return                       0 on success, -1 on failure (the buffers are
+ *                               still owned by the application)
+ */
+int machnet_msg_send(const void *channel_ctx, MachnetMsg_t *msg);
+
+/**
+ * This function returns the buffers of a message loaned with
+ * `machnet_msg_alloc`, and not sent, to the channel.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msg           An `MachnetMsg' descriptor
+ */
+void machnet_msg_free(const void *channel_ctx, MachnetMsg_t *msg);
+
+/**
+ * This function polls the completions of the messages sent with the
+ * `MACHNET_MSGBUF_NOTIFY_DELIVERY` flag: Machnet posts one when the peer has
+ * acknowledged the whole message (`MACHNET_TX_COMPL_DELIVERED`), or when it
+ * drops the message (`MACHNET_TX_COMPL_DROPPED`). The completions of a flow
+ * come in the order its messages were sent. Completions that find the ring
+ * full are lost, and counted in `e_stats.tx_compl_drops` (see
+ * `machnet_channel_stats`); the ring has as many slots as the ring of received
+ * messages.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[out] compls            An array of `MachnetTxCompletion_t`
+ * @param[in] nr                 Length of the `compls` array
+ * @return                       # of completions polled, up to `nr`.
+ */
+int machnet_tx_completions(const void *channel_ctx,
+                           MachnetTxCompletion_t *compls, int nr);
+
 /**
  * Receive a pending message from some remote peer over the network.
  *
@@ -184,6 +383,282 @@ ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
  */
 int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr);
 
+/**
+ * This function receives one or more pending messages (destined to the
+ * application) from the Machnet Channel, dequeuing them in batches. Each
+ * message is copied to the buffers described by the next `MachnetMsgHdr'
+ * descriptor of the array, as with `machnet_recvmsg`. A message that does not
+ * fit its descriptor is dropped, and the descriptor is used for the next one.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msghdr_iovec  An array of `MachnetMsgHdr' descriptors, each
+ *                               one prepared as for `machnet_recvmsg`.
+ * @param[in] vlen               Length of the `msghdr_iovec' array (maximum
+ *                               number of messages to be received).
+ * @return                       # of messages received (the first ones of
+ *                               `msghdr_iovec'), or -1 if messages were
+ *                               pending but all of them were dropped.
+ */
+int machnet_recvmmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr_iovec,
+                     int vlen);
+
+/**
+ * This function receives a pending message (destined to the application) from
+ * the Machnet Channel without copying it: the message is left in place, in the
+ * channel buffers, and described by the segments of an `MachnetMsg'
+ * descriptor. The buffers are owned by the application until it releases them
+ * with `machnet_msg_release`.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msg           An `MachnetMsg' descriptor. The application
+ *                               needs to fill in the `msg_iov` and
+ *                               `msg_iovlen` members, with room for the
+ *                               segments of the message (at most
+ *                               `machnet_msg_iovlen(MACHNET_MSG_MAX_LEN)`).
+ *                               Machnet fills in the segments, and sets
+ *                               `msg_size`, `msg_iovlen` and `flow_info`.
+ * @return                       0 if no pending message, 1 if a message is
+ *                               received, -1 on failure (the message is
+ *                               dropped, as with `machnet_recvmsg`)
+ */
+int machnet_recvmsg_zc(const void *channel_ctx, MachnetMsg_t *msg);
+
+/**
+ * This function returns the buffers of a message received with
+ * `machnet_recvmsg_zc` to the channel; its segments must not be accessed
+ * afterwards.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msg           An `MachnetMsg' descriptor
+ */
+void machnet_msg_release(const void *channel_ctx, MachnetMsg_t *msg);
+
+/**
+ * This function binds the calling thread to a free queue pair of the Machnet
+ * Channel: a pair of single-producer, single-consumer rings to and from
+ * Machnet, that the thread does not share with any other. From then on, the
+ * thread sends its messages on the queue pair, and Machnet delivers the
+ * messages of a flow to the queue pair of the thread that last sent on the
+ * flow. The thread receives from its queue pair first, and then from the
+ * shared ring of the channel (where messages of flows not sent on yet land).
+ * The binding is undone when the thread exits.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @return                       The index of the queue pair on success (also
+ *                               if the thread was already bound), -1 if none
+ *                               is free
+ */
+int machnet_queue_bind(const void *channel_ctx);
+
+/**
+ * This function releases the queue pair of the Machnet Channel that the
+ * calling thread is bound to, if any (see `machnet_queue_bind`). Machnet
+ * delivers the messages of its flows to the shared ring from then on; messages
+ * already pending on the queue pair wait for the next thread to bind it.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ */
+void machnet_queue_unbind(const void *channel_ctx);
+
+/**
+ * This function returns the free buffers cached by the calling thread for the
+ * Machnet Channel to the channel's pool; e.g., before the thread stops using
+ * the channel for a while. Each thread caches a few buffers of every channel
+ * it sends or receives on, and returns them when it exits.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ */
+void machnet_cache_flush(const void *channel_ctx);
+
+/**
+ * This function returns the statistics of the Machnet Channel, which live in
+ * the channel's shared memory. The engine updates its counters (`e_stats`) as
+ * it goes; reading them takes no locks and no calls into Machnet. They include
+ * latency histograms (`e_stats.latency`), which the `__machnet_latency_hist_*`
+ * helpers read.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @return                       A pointer to the statistics
+ */
+const MachnetChannelStats_t *machnet_channel_stats(const void *channel_ctx);
+
+/**
+ * This function returns the notification descriptor of the Machnet Channel: an
+ * eventfd that becomes readable when Machnet delivers messages (or TX
+ * completions) to the channel while the notification is armed (see
+ * `machnet_notify_arm`). Applications can wait on it with `epoll`, `poll` or
+ * `select`, alongside other descriptors.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @return                       The descriptor, or -1 if the channel has none
+ */
+int machnet_notify_fd(const void *channel_ctx);
+
+/**
+ * This function arms the notification of the Machnet Channel, before the
+ * application waits on its descriptor. The notification is one-shot: Machnet
+ * disarms it when it signals the descriptor. Wake-ups may be spurious.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @return                       0 if the notification is armed (the
+ *                               application may wait), 1 if messages are
+ *                               already pending (it is not armed), -1 if the
+ *                               channel has no notification
+ */
+int machnet_notify_arm(const void *channel_ctx);
+
+/**
+ * This function disarms the notification of the Machnet Channel, and consumes
+ * any signal pending on its descriptor. To be called after waiting.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ */
+void machnet_notify_disarm(const void *channel_ctx);
+
+/**
+ * This function blocks until messages are pending in the Machnet Channel (to
+ * be received with `machnet_recv` and friends), or TX completions (see
+ * `machnet_tx_completions`), or the timeout expires.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] timeout_ms         Maximum time to wait in milliseconds; -1 waits
+ *                               indefinitely
+ * @return                       1 if messages are pending, 0 on timeout (or
+ *                               a spurious wake-up), -1 on failure (e.g., the
+ *                               channel has no notification, or the wait was
+ *                               interrupted)
+ */
+int machnet_wait(const void *channel_ctx, int timeout_ms);
+
+/**
+ * @brief Header of the messages of the RPC layer (see `machnet_rpc_call` and
+ * `machnet_rpc_serve`), ahead of the payload of each request and response.
+ * Both ends of a flow carrying RPCs must speak it; other messages received on
+ * the channel are dropped.
+ *
+ * - `req_id` identifies the request; the response echoes it. Clients encode
+ *    their slot table in it; servers treat it as opaque.
+ */
+struct MachnetRpcHdr {
+#define MACHNET_RPC_MAGIC 0x52504331  // "RPC1"
+  uint32_t magic;
+#define MACHNET_RPC_TYPE_REQUEST 0x0001
+#define MACHNET_RPC_TYPE_RESPONSE 0x0002
+  uint32_t type;
+  uint64_t req_id;
+};
+typedef struct MachnetRpcHdr MachnetRpcHdr_t;
+
+/**
+ * @brief Completion of an RPC (see `machnet_rpc_poll`).
+ *
+ * - `cookie` is the one the call was made with.
+ * - `resp_len` is the length of the response, in the buffer the call was made
+ *    with (0 unless `status` is `MACHNET_RPC_OK`).
+ * - `status` is one of `MACHNET_RPC_*`.
+ */
+struct MachnetRpcCompletion {
+  void *cookie;
+  uint32_t resp_len;
+#define MACHNET_RPC_OK 0
+#define MACHNET_RPC_TIMEOUT 1   // No response within the timeout of the call.
+#define MACHNET_RPC_OVERFLOW 2  // The response did not fit its buffer.
+  int32_t status;
+};
+typedef struct MachnetRpcCompletion MachnetRpcCompletion_t;
+
+/// @brief Client side of the RPC layer over a channel (opaque).
+typedef struct MachnetRpcClient MachnetRpcClient_t;
+
+/**
+ * This function creates an RPC client over the Machnet Channel, with a table of
+ * `max_calls` slots for the calls in flight, allocated upfront. A client is
+ * used by a single thread. The responses to a client's calls must come back to
+ * that thread: several threads with a client each bind a queue pair (see
+ * `machnet_queue_bind`), and do not share flows.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] max_calls          Maximum number of calls in flight (at most
+ *                               2^24)
+ * @return                       The client, or NULL on failure
+ */
+MachnetRpcClient_t *machnet_rpc_client_create(void *channel_ctx,
+                                              uint32_t max_calls);
+
+/**
+ * This function destroys an RPC client. Calls still in flight are abandoned;
+ * their responses are dropped.
+ *
+ * @param[in] rpc                The RPC client
+ */
+void machnet_rpc_client_destroy(MachnetRpcClient_t *rpc);
+
+/**
+ * This function sends a request on a flow, and returns without waiting for the
+ * response: `machnet_rpc_poll` completes the call when the response comes
+ * back, copied into `resp_buf`, or when `timeout_us` expires. The request is
+ * copied out before the function returns; `resp_buf` must stay valid until the
+ * call completes.
+ *
+ * @param[in] rpc                The RPC client
+ * @param[in] flow               The flow to the server
+ * @param[in] req                The payload of the request
+ * @param[in] req_len            The length of the request, in bytes
+ * @param[out] resp_buf          The buffer for the payload of the response
+ * @param[in] resp_len           The length of `resp_buf`, in bytes
+ * @param[in] timeout_us         Timeout of the call in microseconds; 0 waits
+ *                               indefinitely
+ * @param[in] cookie             Application data, handed back on completion
+ * @return                       0 on success, -1 on failure (no free slot, or
+ *                               the request could not be sent)
+ */
+int machnet_rpc_call(MachnetRpcClient_t *rpc, MachnetFlow_t flow,
+                     const void *req, size_t req_len, void *resp_buf,
+                     size_t resp_len, uint32_t timeout_us, void *cookie);
+
+/**
+ * This function completes the calls of an RPC client whose responses came back
+ * (received in batches, as with `machnet_recvmmsg`), and then those that timed
+ * out. Responses to calls no longer in flight (e.g., that timed out) are
+ * dropped.
+ *
+ * @param[in] rpc                The RPC client
+ * @param[out] compls            An array of `MachnetRpcCompletion_t`
+ * @param[in] nr                 Length of the `compls` array
+ * @return                       # of calls completed, -1 on failure
+ */
+int machnet_rpc_poll(MachnetRpcClient_t *rpc, MachnetRpcCompletion_t *compls,
+                     int nr);
+
+/**
+ * @brief Handler of the requests served with `machnet_rpc_serve`: sets `resp`
+ * to the payload of the response, which must stay valid until the handler is
+ * called again, or `machnet_rpc_serve` returns.
+ *
+ * @return 0 to send the response, -1 to send none.
+ */
+typedef int (*MachnetRpcHandler_t)(void *arg, const MachnetFlow_t *flow,
+                                   const void *req, size_t req_len,
+                                   MachnetIovec_t *resp);
+
+/**
+ * This function serves the pending requests of the Machnet Channel, received
+ * in batches as with `machnet_recvmmsg`: each is copied into `buf`, handed to
+ * `handler`, and answered on the flow it came from, with the response the
+ * handler sets. Requests that do not fit `buf` are dropped.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] handler            The request handler
+ * @param[in] arg                Argument passed to `handler`
+ * @param[in] buf                Buffer for the payload of a request
+ * @param[in] buf_len            The length of `buf`, in bytes
+ * @param[in] max_reqs           Maximum number of requests to serve
+ * @return                       # of requests served (0 if none is pending),
+ *                               -1 on failure
+ */
+int machnet_rpc_serve(const void *channel_ctx, MachnetRpcHandler_t handler,
+                      void *arg, void *buf, size_t buf_len, int max_reqs);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,7 @@
 #include <benchmark/benchmark.h>
 #include <machnet.h>
 #include <machnet_private.h>
+#include <perf_benchmark.h>
 #include <utils.h>
 
 #include <iostream>
@@ -82,8 +83,9 @@ static void BM_machnet_sendmsg(benchmark::State &state) {  // NOLINT
   int is_posix_shm;
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
-      channel_name, kRingSlotEntries, kRingSlotEntries, kRingSlotEntries,
-      kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      channel_name, kRingSlotEntries, kRingSlotEntries, kRingSlotEntries, 1,
+      kBufferSize, nullptr, 0, 0, 0, &channel_size, &is_posix_shm,
+      &channel_fd);
   if (channel_ctx == nullptr) {
     state.SkipWithError("Failed to create channel.");
     return;
@@ -173,4 +175,6 @@ static void CustomArguments(benchmark::internal::Benchmark *b) {
 BENCHMARK(BM_machnet_sendmsg)->Apply(CustomArguments);
 
 // Run the benchmark
-BENCHMARK_MAIN();
+int main(int argc, char **argv) {
+  return juggler::perf::BenchmarkMain("machnet_bench", argc, argv);
+}
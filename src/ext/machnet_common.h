@@ -21,13 +21,21 @@ extern "C" {
  *     [ControlRing: CompletionQueue]
  *     [Ring0: Stack->Application]
  *     [Ring1: Application->Stack]
+ *     [TxCompletionRing: Stack->Application]
  *     [Ring2: FreeBuffers]
- *     [BufferIndexTable]
+ *     [Ring2#1: FreeBuffers of size class 1]
+ *     [...]
+ *     [Ring2#K]
+ *     [QueuePair#0: Header, Stack->Application, Application->Stack]
+ *     [...]
+ *     [QueuePair#M]
  *     [HUGE_PAGE_2M_SIZE aligned]
  *     [Buf#0]
  *     [Buf#1]
  *     [...]
  *     [Buf#N]
+ *     [Buf#N+1: first buffer of size class 1]
+ *     [...]
  *
  *     ControlRing(SQ) is used for communicating control messages from the
  *     application to the stack; completions are emitted by the stack in the
@@ -36,12 +44,29 @@ extern "C" {
  *
  *     Ring0 is used for communicating received messages from the stack to the
  *     application, and Ring1 for the opposite direction.
- *     Ring2 serves as the global pool of buffers.
+ *     The TxCompletionRing carries a `MachnetTxCompletion' for each message
+ *     sent with `MACHNET_MSGBUF_NOTIFY_DELIVERY', once the peer acknowledged
+ *     all of it (or the stack dropped it).
+ *     Ring2 serves as the global pool of buffers. Each application thread
+ *     caches a few free buffers of it (see `machnet.c').
  *
- *     [BufferIndexTable] is a table of `MachnetRingSlot`-wide objects to be
- *     used as a temporary/scratch space for the application to allocate
- * (dequeue) buffers. It is used to avoid the need for the application to
- * allocate such table on each `send` request.
+ *     Besides the default buffers, sized for a packet of the MTU, a channel
+ *     may hold pools of smaller buffers (size classes), each with a free
+ *     buffer ring of its own. Their buffers follow the default ones in memory
+ *     and in index space, so that the pool stays contiguous: a message that
+ *     fits in a single smaller buffer takes one, and leaves the larger ones to
+ *     the messages that need them.
+ *
+ *     Ring0 and Ring1 are MP/MC `jring_t' rings, unless the channel is created
+ *     with `MACHNET_CHANNEL_F_SPSC' (the application is single-threaded), in
+ *     which case they are SPSC `jring2_t' rings.
+ *
+ *     A channel may optionally hold a number of queue pairs: SPSC rings (see
+ *     `jring2.h') in both directions, each claimed by a single application
+ *     thread, that share the buffer pool and the flows of the channel. The
+ *     engine polls them round-robin along with Ring1, and delivers the
+ *     messages of a flow to the queue pair the application last sent on the
+ *     flow from (to Ring0 until then, or if the queue pair is released).
  */
 
 #include <assert.h>
@@ -50,6 +75,7 @@ extern "C" {
 #include <sys/stat.h> /* For mode constants */
 
 #include "jring.h"
+#include "jring2.h"
 
 #define KB (1 << 10)
 #define MB (KB * KB)
@@ -93,21 +119,90 @@ struct MachnetListenerInfo {
 };
 typedef struct MachnetListenerInfo MachnetListenerInfo_t;
 
+/*
+ * A pool of buffers of one size: the indices from `first_index' on, at
+ * `pool_ofs', whose free buffers are in the ring at `ring_ofs'. Class 0 holds
+ * the default buffers; the others are smaller, in increasing size.
+ */
+#define MACHNET_CHANNEL_BUF_CLASSES_MAX 4
+struct MachnetChannelBufClass {
+  size_t ring_ofs;
+  size_t pool_ofs;
+  uint32_t first_index;
+  uint32_t buf_nr;
+  uint32_t buf_size;  // Total size of each buffer (incl. metadata).
+  uint32_t buf_mss;   // Usable size of each buffer.
+};
+typedef struct MachnetChannelBufClass MachnetChannelBufClass_t;
+
+// A size class requested at channel creation: the number of buffers + 1 (a
+// power of 2) and their usable size.
+struct MachnetChannelBufClassConf {
+  uint32_t buf_ring_slot_nr;
+  uint32_t buffer_size;
+};
+typedef struct MachnetChannelBufClassConf MachnetChannelBufClassConf_t;
+
 struct MachnetChannelDataCtx {
   size_t stats_ofs;
   size_t ctrl_sq_ring_ofs;
   size_t ctrl_cq_ring_ofs;
   size_t machnet_ring_ofs;
   size_t app_ring_ofs;
+  size_t tx_compl_ring_ofs;
   size_t buf_ring_ofs;
-  size_t buffer_index_table_ofs;
   size_t buf_pool_ofs;
   size_t buf_pool_mask;
   uint32_t buf_size;
   uint32_t buf_mss;
+  // The size classes, the default one (described above too) first.
+  uint32_t buf_classes_nr;
+  MachnetChannelBufClass_t buf_classes[MACHNET_CHANNEL_BUF_CLASSES_MAX];
+  // The default buffers come in `buf_segs_max' segments of `buf_seg_nr'
+  // buffers. Only the first `buf_segs_nr' segments are backed by memory, and
+  // have their buffers in the ring; Machnet attaches and releases the others
+  // with the load (see `__machnet_channel_buf_hole').
+#define MACHNET_CHANNEL_BUF_SEGS_MAX 64
+  uint32_t buf_seg_nr;
+  uint32_t buf_segs_max;
+  uint32_t buf_segs_nr;
+  size_t queue_pairs_ofs;
+  size_t queue_pair_size;
+  uint32_t queue_pairs_nr;
+  uint32_t flags;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelDataCtx MachnetChannelDataCtx_t;
 
+// Channel creation flags (`MachnetChannelDataCtx_t::flags').
+// The application has a single thread: Ring0 and Ring1 are SPSC.
+#define MACHNET_CHANNEL_F_SPSC (1 << 0)
+// The channel is latency-critical: the controller serves it from an engine of
+// its own, if one is free.
+#define MACHNET_CHANNEL_F_DEDICATED (1 << 1)
+#define MACHNET_CHANNEL_F_MASK \
+  (MACHNET_CHANNEL_F_SPSC | MACHNET_CHANNEL_F_DEDICATED)
+
+// No NUMA node preference for the memory of a channel: the controller picks
+// the node of the NIC that the engine serving the channel uses.
+#define MACHNET_NUMA_NODE_ANY (-1)
+
+/*
+ * Header of a queue pair of a channel, followed by its rings: the
+ * Stack->Application ring at `machnet_ring_ofs', and the Application->Stack
+ * ring at `app_ring_ofs' (offsets from the header). An application thread
+ * claims the queue pair by setting `owner', and is then the only consumer and
+ * producer of the rings on the application side.
+ */
+#define MACHNET_CHANNEL_QUEUE_PAIRS_MAX 16
+// Queue index standing for the shared rings of a channel (Ring0, Ring1).
+#define MACHNET_CHANNEL_QUEUE_SHARED UINT32_MAX
+struct MachnetQueuePair {
+  uint32_t owner;  // Non-zero while claimed by an application thread.
+  uint32_t machnet_ring_ofs;
+  uint32_t app_ring_ofs;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetQueuePair MachnetQueuePair_t;
+
 struct MachnetChannelCtrlCtx {
   // Mutex for protecting the control queue.
   size_t req_id;
@@ -115,15 +210,46 @@ struct MachnetChannelCtrlCtx {
 typedef struct MachnetChannelCtrlCtx MachnetChannelCtrlCtx_t;
 
 /*
- * This data structure is used to implement a small cache of buffer indices
- * used exclusively by the application. This reduces contention on the global
- * buffer pool (which uses atomic operations for MP-safety).
+ * Bitmap of channels with pending work, one per Machnet engine and shared with
+ * all the applications whose channels the engine serves. Each channel is
+ * assigned one bit (slot) by the engine. After enqueueing to its channel, the
+ * application sets the channel's bit; the engine atomically collects and clears
+ * the bits, and only polls the channels that had theirs set.
  */
-struct MachnetChannelAppBufferCache {
-  uint32_t count;
-  MachnetRingSlot_t indices[NUM_CACHED_BUFS];
-};
-typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
+#define MACHNET_PENDING_BITMAP_BITS 1024
+#define MACHNET_PENDING_BITMAP_INVALID_SLOT UINT32_MAX
+struct MachnetPendingBitmap {
+  uint64_t words[MACHNET_PENDING_BITMAP_BITS / 64];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetPendingBitmap MachnetPendingBitmap_t;
+
+/*
+ * Per-channel notification state.
+ *
+ * - `pending_slot' is the channel's bit in the engine's pending bitmap. The
+ *   application maps the bitmap when attaching to the channel and stores the
+ *   location of its word in `app_pending'.
+ * - The doorbell wakes up the engine, when the engine sleeps in its adaptive
+ *   idle mode. The engine sets `armed' before going to sleep. After enqueueing
+ *   to a ring of the channel, the application checks `armed' and, if set,
+ *   writes to the doorbell eventfd it received when attaching to the channel.
+ * - The notification works the other way around, and wakes up the application
+ *   when it waits for messages. The application sets `notify_armed' before
+ *   waiting on the notification eventfd it received when attaching to the
+ *   channel. After delivering messages to the channel, the engine clears
+ *   `notify_armed' and, if it was set, writes to the eventfd.
+ *
+ * The `app_*' fields are only meaningful in the application's process.
+ */
+struct MachnetChannelDoorbell {
+  uint32_t armed;         // Written by the engine.
+  uint32_t pending_slot;  // Written by the engine.
+  int32_t app_fd;         // Application-local doorbell descriptor (or -1).
+  int32_t app_notify_fd;  // Application-local notification descriptor (or -1).
+  uint64_t *app_pending;  // Application-local pointer to the bitmap word.
+  uint32_t notify_armed;  // Set by the application, cleared by the engine.
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+typedef struct MachnetChannelDoorbell MachnetChannelDoorbell_t;
 
 /**
  * The `MachnetChannelCtx' holds all the metadata information (context) of an
@@ -134,14 +260,21 @@ typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
 struct MachnetChannelCtx {
 #define MACHNET_CHANNEL_CTX_MAGIC 0xA5A5A5A5
   uint32_t magic;  // Magic value tagged after initialization.
-#define MACHNET_CHANNEL_VERSION 0x01
+#define MACHNET_CHANNEL_VERSION 0x0A
   uint16_t version;
+  uint16_t cc;  // Congestion control of new flows (`MACHNET_CC_*').
   uint64_t size;  // Size of the Channel's memory, including this context.
+  // Priority class of the channel and of its new flows, one of:
+#define MACHNET_PRIO_HIGH 0x0000    // Latency-sensitive (e.g., RPCs).
+#define MACHNET_PRIO_NORMAL 0x0001  // The default.
+#define MACHNET_PRIO_BULK 0x0002    // Throughput-bound transfers.
+#define MACHNET_PRIO_CLASSES_NR 3
+  uint16_t prio;
 #define MACHNET_CHANNEL_NAME_MAX_LEN 256
   char name[MACHNET_CHANNEL_NAME_MAX_LEN];
   MachnetChannelCtrlCtx_t ctrl_ctx;  // Control channel's specific metadata.
   MachnetChannelDataCtx_t data_ctx;  // Dataplane channel's specific metadata.
-  MachnetChannelAppBufferCache_t app_buffer_cache;
+  MachnetChannelDoorbell_t doorbell;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelCtx MachnetChannelCtx_t;
 
@@ -156,12 +289,109 @@ struct MachnetChannelAppStats {
 typedef struct MachnetChannelAppStats MachnetChannelAppStats_t;
 
 /**
- * Machnet channel statistics.
- *
- * TODO(ilias): At the moment it contains statistics for the application side.
+ * Latency histogram, in nanoseconds: log-linear, with 4 buckets per power of
+ * two (so within 25% of the values they count), up to ~8.6s; larger values
+ * land in the last bucket. Histograms (e.g., of several channels or engines)
+ * merge by adding up their buckets.
+ */
+#define MACHNET_LATENCY_HIST_BUCKETS 128
+struct MachnetLatencyHist {
+  uint64_t buckets[MACHNET_LATENCY_HIST_BUCKETS];
+};
+typedef struct MachnetLatencyHist MachnetLatencyHist_t;
+
+// Returns the bucket of a latency value.
+static inline uint32_t __machnet_latency_hist_bucket(uint64_t ns) {
+  if (ns < 4) return (uint32_t)ns;
+  const uint32_t msb = 63 - __builtin_clzll(ns);
+  const uint64_t bucket = ((uint64_t)(msb - 1) << 2) | ((ns >> (msb - 2)) & 3);
+  return bucket < MACHNET_LATENCY_HIST_BUCKETS
+             ? (uint32_t)bucket
+             : MACHNET_LATENCY_HIST_BUCKETS - 1;
+}
+
+// Returns the smallest latency value a bucket counts.
+static inline uint64_t __machnet_latency_hist_bucket_min(uint32_t bucket) {
+  if (bucket < 4) return bucket;
+  return (uint64_t)(4 | (bucket & 3)) << ((bucket >> 2) - 1);
+}
+
+static inline void __machnet_latency_hist_record(MachnetLatencyHist_t *hist,
+                                                 uint64_t ns) {
+  hist->buckets[__machnet_latency_hist_bucket(ns)]++;
+}
+
+// Returns the number of values a histogram counts.
+static inline uint64_t __machnet_latency_hist_count(
+    const MachnetLatencyHist_t *hist) {
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < MACHNET_LATENCY_HIST_BUCKETS; i++)
+    count += hist->buckets[i];
+  return count;
+}
+
+/**
+ * Returns the `quantile' (in [0, 1]) of the values a histogram counts, as the
+ * smallest value of its bucket; 0 if the histogram is empty.
+ */
+static inline uint64_t __machnet_latency_hist_quantile(
+    const MachnetLatencyHist_t *hist, double quantile) {
+  const uint64_t count = __machnet_latency_hist_count(hist);
+  if (count == 0) return 0;
+  uint64_t rank = (uint64_t)(quantile * (double)count);
+  if (rank >= count) rank = count - 1;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < MACHNET_LATENCY_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen > rank) return __machnet_latency_hist_bucket_min(i);
+  }
+  return __machnet_latency_hist_bucket_min(MACHNET_LATENCY_HIST_BUCKETS - 1);
+}
+
+/**
+ * Latencies the Machnet engine measures, per channel, and per flow on demand
+ * (see `MachnetEngine::SetFlowLatencyStats').
+ */
+struct MachnetLatencyStats {
+  // From the application sending a message to the engine first transmitting
+  // it: queueing in the channel, and in the flow's window.
+  MachnetLatencyHist_t tx_queue;
+  // Round-trip times, from the timestamps echoed by ACKs.
+  MachnetLatencyHist_t rtt;
+  // From the first packet of a message arriving to its delivery to the
+  // application's ring: reassembly, and waits for room in the ring.
+  MachnetLatencyHist_t rx_delivery;
+};
+typedef struct MachnetLatencyStats MachnetLatencyStats_t;
+
+/**
+ * Statistics of the Machnet engine for a channel. The engine thread serving
+ * the channel is their only writer, and updates them with plain stores; they
+ * can be read lock-free from anywhere the channel is mapped, and might be
+ * slightly stale.
+ */
+struct MachnetChannelEngineStats {
+  uint64_t rx_msgs;            // Messages delivered to the application.
+  uint64_t rx_bytes;           // Bytes of the messages delivered.
+  uint64_t rx_alloc_failures;  // Packets dropped for lack of buffers.
+  uint64_t tx_retransmits;     // Packets retransmitted (losses, probes).
+  uint64_t rx_ring_full;       // Messages held back for a full ring to the
+                               // application.
+  uint64_t rx_queue_delay_ns;  // Total time messages were held back for.
+  uint64_t tx_compl_drops;     // TX completions lost to a full ring.
+  uint64_t reserved[1];
+  MachnetLatencyStats_t latency;
+};
+typedef struct MachnetChannelEngineStats MachnetChannelEngineStats_t;
+
+/**
+ * Machnet channel statistics: the ones of the application side, and the ones
+ * of the engine, in separate cache lines.
  */
 struct MachnetChannelStats {
   MachnetChannelAppStats_t a_stats;
+  MachnetChannelEngineStats_t e_stats
+      __attribute__((aligned(CACHE_LINE_SIZE)));
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelStats MachnetChannelStats_t;
 
@@ -171,19 +401,51 @@ struct MachnetCtrlQueueEntry {
 #define MACHNET_CTRL_OP_DESTROY_FLOW 0x0002
 #define MACHNET_CTRL_OP_LISTEN 0x0003
 #define MACHNET_CTRL_OP_STATUS 0x0004;
+// Engine to application, unsolicited: a flow created with
+// `MACHNET_CTRL_FLAG_KEEPALIVE' went away (`flow_info').
+#define MACHNET_CTRL_OP_FLOW_CLOSED 0x0005
   uint32_t opcode;
 #define MACHNET_CTRL_STATUS_OK 0x0000
 #define MACHNET_CTRL_STATUS_ERROR 0x0001
   uint16_t status;
+  // CREATE_FLOW and LISTEN: congestion control of the flow(s), one of:
+#define MACHNET_CC_DEFAULT 0x0000  // The engine's default.
+#define MACHNET_CC_SWIFT 0x0001    // Delay-based (Swift).
+#define MACHNET_CC_ECN 0x0002      // ECN-based (DCTCP-style).
+#define MACHNET_CC_FIXED 0x0003    // Fixed window, no congestion control.
+  uint16_t cc;
   union {
     MachnetFlow_t flow_info;
     MachnetListenerInfo_t listener_info;
   };
+  // CREATE_FLOW: the engine probes the peer while the flow is idle, and
+  // reports the flow with `MACHNET_CTRL_OP_FLOW_CLOSED' when it goes away.
+#define MACHNET_CTRL_FLAG_KEEPALIVE (1 << 0)
+  uint32_t flags;
 };
 typedef struct MachnetCtrlQueueEntry MachnetCtrlQueueEntry_t;
 static_assert(sizeof(MachnetCtrlQueueEntry_t) % 4 == 0,
               "MachnetCtrlSqEntry_t must be 32-bit aligned");
 
+/**
+ * Completion of a message sent with `MACHNET_MSGBUF_NOTIFY_DELIVERY' (Machnet
+ * to application, in the TxCompletionRing). The completions of a flow come in
+ * the order its messages were sent.
+ */
+struct MachnetTxCompletion {
+  MachnetFlow_t flow;  // Flow the message was sent on.
+  uint32_t msg_len;    // Length of the message.
+// The peer acknowledged the whole message.
+#define MACHNET_TX_COMPL_DELIVERED 0x0000
+// Machnet dropped the message (e.g., its flow does not exist).
+#define MACHNET_TX_COMPL_DROPPED 0x0001
+  uint16_t status;
+  uint16_t reserved;
+};
+typedef struct MachnetTxCompletion MachnetTxCompletion_t;
+static_assert(sizeof(MachnetTxCompletion_t) % 4 == 0,
+              "MachnetTxCompletion_t must be 32-bit aligned");
+
 /**
  * Message Buffer Header: This header is carried at the beginning of every
  * buffer of an Machnet dataplane channel.
@@ -193,11 +455,20 @@ struct MachnetMsgBuf {
   const uint32_t magic;  // Magic value tagged after initialization.
   const uint32_t index;  // Index of the buffer in the buffer pool.
   const uint32_t size;   // Absolute static size of the buffer.
+  // In the first buffer of a message: when it was sent by the application,
+  // or when its first packet arrived, as a TSC stamp (see
+  // `__machnet_tsc_stamp'); 0 if unknown.
+  uint32_t tsc_stamp;
   const uintptr_t iova;  // IOVA address of the buffer.
 #define MACHNET_MSGBUF_FLAGS_SYN (1 << 0)
 #define MACHNET_MSGBUF_FLAGS_SG (1 << 1)
 #define MACHNET_MSGBUF_FLAGS_FIN (1 << 2)
 #define MACHNET_MSGBUF_FLAGS_CHAIN (1 << 3)
+// The buffer stands for a payload buffer of a fan-out send (see below).
+#define MACHNET_MSGBUF_FLAGS_ALIAS (1 << 4)
+// Set by the engine on buffers that pack several small messages of a flow
+// into one packet; applications never see it.
+#define MACHNET_MSGBUF_FLAGS_AGGREGATE (1 << 5)
 #define MACHNET_MSGBUF_NOTIFY_DELIVERY (1 << 7)
   uint8_t flags;
   MachnetFlow_t flow;  // Network flow info.
@@ -210,7 +481,14 @@ struct MachnetMsgBuf {
   // If multi-buffer message (SG), last points to the last buffer index.
   // This is only set in the first buffer of the message.
   uint32_t last;
-  uint32_t reserved1[1];
+  union {
+    // Queue pair the message was sent on (`MACHNET_CHANNEL_QUEUE_SHARED' for
+    // the shared ring). Set by the engine, in the first buffer of the message.
+    uint32_t queue;
+    // In the payload buffers of a fan-out send: number of aliases that still
+    // refer to the buffer.
+    uint32_t refcnt;
+  };
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetMsgBuf MachnetMsgBuf_t;
 #define MACHNET_MSGBUF_SPACE_RESERVED (sizeof(MachnetMsgBuf_t))
@@ -218,9 +496,54 @@ static_assert(MACHNET_MSGBUF_SPACE_RESERVED == CACHE_LINE_SIZE,
               "MachnetMsgBuf_t is not aligned");
 #define MACHNET_MSGBUF_HEADROOM_MAX (2 * CACHE_LINE_SIZE)
 
+/*
+ * A fan-out send (see `machnet_sendmsg_fanout') copies a message once, into
+ * payload buffers that are never enqueued themselves. Each destination flow
+ * gets a chain of alias buffers instead, one per payload buffer: an alias
+ * carries the flags, flow and lengths of a buffer of its message, but its data
+ * is in the payload buffer, whose index is stored at the base of the alias.
+ * Whoever releases the last alias of a payload buffer (see `refcnt') frees it.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buf_alias_target(const MachnetMsgBuf_t *alias) {
+  assert(alias->flags & MACHNET_MSGBUF_FLAGS_ALIAS);
+  return *(const uint32_t *)((const uchar_t *)alias +
+                             MACHNET_MSGBUF_SPACE_RESERVED);
+}
+
+/**
+ * Drop references to a payload buffer of a fan-out send.
+ *
+ * @param buf                A pointer to the payload buffer.
+ * @param n                  Number of references to drop.
+ * @return                   The number of references left; at 0, the caller
+ *                           must free the buffer.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buf_unref(MachnetMsgBuf_t *buf, uint32_t n) {
+  return __atomic_sub_fetch(&buf->refcnt, n, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * TSC stamps of message buffers keep 32 bits of the TSC, at a resolution of
+ * 2^MACHNET_MSGBUF_TSC_SHIFT cycles (~0.3us at 3GHz), so that they wrap every
+ * few minutes, well past any latency worth measuring.
+ */
+#define MACHNET_MSGBUF_TSC_SHIFT 10
+static inline __attribute__((always_inline)) uint32_t __machnet_tsc_stamp(
+    void) {
+#if defined(__x86_64__) || defined(__i386__)
+  // Never 0, which stands for no stamp.
+  return (uint32_t)(__builtin_ia32_rdtsc() >> MACHNET_MSGBUF_TSC_SHIFT) | 1;
+#else
+  return 0;
+#endif
+}
+
 static inline __attribute__((always_inline)) void __machnet_channel_buf_init(
     MachnetMsgBuf_t *buf) {
   // Do not set the magic here. Should be set in initialization only.
+  buf->tsc_stamp = 0;
   buf->flags = 0;
   buf->flow.src_ip = 0;
   buf->flow.dst_ip = 0;
@@ -246,6 +569,18 @@ static inline __attribute__((always_inline)) uchar_t *__machnet_channel_mem_ofs(
   return (__DECONST(uchar_t *, ctx) + offset);
 }
 
+/**
+ * Get a pointer to the statistics of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the statistics.
+ */
+static inline __attribute__((always_inline)) MachnetChannelStats_t *
+__machnet_channel_stats(const MachnetChannelCtx_t *ctx) {
+  return (MachnetChannelStats_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.stats_ofs);
+}
+
 /**
  * Get a pointer to the control submission queue. (Application->Machnet)
  *
@@ -293,6 +628,69 @@ __machnet_channel_app_ring(const MachnetChannelCtx_t *ctx) {
   return (jring_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.app_ring_ofs);
 }
 
+/**
+ * Get a pointer to the TX completion ring (Machnet->Application).
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the TX completion ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_tx_compl_ring(const MachnetChannelCtx_t *ctx) {
+  return (jring_t *)__machnet_channel_mem_ofs(ctx,
+                                              ctx->data_ctx.tx_compl_ring_ofs);
+}
+
+/**
+ * Whether the `Machnet' and `App' rings of the channel are SPSC `jring2_t'
+ * rings (see `MACHNET_CHANNEL_F_SPSC').
+ *
+ * @param ctx                Channel's context.
+ * @return                   Non-zero if the rings are SPSC.
+ */
+static inline __attribute__((always_inline)) int __machnet_channel_is_spsc(
+    const MachnetChannelCtx_t *ctx) {
+  return ctx->data_ctx.flags & MACHNET_CHANNEL_F_SPSC;
+}
+
+/**
+ * Get a pointer to the `Machnet' ring of an SPSC channel.
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the Machnet Ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_machnet_ring2(const MachnetChannelCtx_t *ctx) {
+  return (jring2_t *)__machnet_channel_mem_ofs(ctx,
+                                               ctx->data_ctx.machnet_ring_ofs);
+}
+
+/**
+ * Get a pointer to the `App' ring of an SPSC channel.
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the Application Ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_app_ring2(const MachnetChannelCtx_t *ctx) {
+  return (jring2_t *)__machnet_channel_mem_ofs(ctx,
+                                               ctx->data_ctx.app_ring_ofs);
+}
+
+/**
+ * Return the number of entries in an SPSC ring. Unlike `jring2_count', it does
+ * not touch the producer's state, so either side may call it. The count might
+ * be stale.
+ *
+ * @param ring               An SPSC ring.
+ * @return                   Number of entries in the ring.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_ring2_count(const jring2_t *ring) {
+  return (__atomic_load_n(&ring->write_idx, __ATOMIC_RELAXED) -
+          ring->read_idx) &
+         ring->mask;
+}
+
 /**
  * Get a pointer to the `MsgBuf' ring (allocator pool).
  *
@@ -314,12 +712,6 @@ static inline __attribute__((always_inline)) uchar_t *__machnet_channel_end(
   return __machnet_channel_mem_ofs(ctx, ctx->size);
 }
 
-static inline MachnetRingSlot_t *__machnet_channel_buffer_index_table(
-    const MachnetChannelCtx_t *ctx) {
-  return (MachnetRingSlot_t *)__machnet_channel_mem_ofs(
-      ctx, ctx->data_ctx.buffer_index_table_ofs);
-}
-
 /**
  * Get a pointer to the beginning of the buffer pool (i.e., the first MsgBuf).
  * @param ctx                Channel's context.
@@ -330,9 +722,132 @@ __machnet_channel_buf_pool(const MachnetChannelCtx_t *ctx) {
   return (uchar_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.buf_pool_ofs);
 }
 
+/**
+ * Get the size in bytes of the buffer pool, the buffers of all size classes
+ * included.
+ * @param ctx                Channel's context.
+ * @return                   The size of the buffer pool.
+ */
 static inline __attribute__((always_inline)) size_t
 __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
-  return ctx->data_ctx.buf_pool_mask * ctx->data_ctx.buf_size;
+  const MachnetChannelBufClass_t *last =
+      &ctx->data_ctx.buf_classes[ctx->data_ctx.buf_classes_nr - 1];
+  return last->pool_ofs + (size_t)last->buf_nr * last->buf_size -
+         ctx->data_ctx.buf_pool_ofs;
+}
+
+/**
+ * Get the part of the buffer pool that is not backed by memory: the segments
+ * of default buffers past the active ones. It is empty unless the pool is
+ * elastic.
+ * @param ctx                Channel's context.
+ * @param[out] ofs           Offset of the hole in the channel's memory.
+ * @param[out] len           Size of the hole in bytes (possibly 0).
+ */
+static inline void __machnet_channel_buf_hole(const MachnetChannelCtx_t *ctx,
+                                              size_t *ofs, size_t *len) {
+  const MachnetChannelDataCtx_t *data_ctx = &ctx->data_ctx;
+  const size_t seg_size =
+      (size_t)data_ctx->buf_seg_nr * data_ctx->buf_classes[0].buf_size;
+  const uint32_t segs_nr =
+      __atomic_load_n(&data_ctx->buf_segs_nr, __ATOMIC_ACQUIRE);
+  *ofs = data_ctx->buf_classes[0].pool_ofs + segs_nr * seg_size;
+  *len = (data_ctx->buf_segs_max - segs_nr) * seg_size;
+}
+
+/**
+ * Fault in the memory of a channel, but for a hole, so that the datapath does
+ * not take page faults; lock it in RAM too if `lock'.
+ * @param mem                The channel's memory.
+ * @param size               Size of the memory.
+ * @param hole_ofs           Offset of the hole (see
+ *                           `__machnet_channel_buf_hole').
+ * @param hole_len           Size of the hole (possibly 0).
+ * @param lock               1 to lock the memory in RAM, 0 otherwise.
+ * @return                   0 on success, -1 if locking failed (the
+ *                           faulting in is best effort).
+ */
+static inline int __machnet_channel_mem_populate(void *mem, size_t size,
+                                                 size_t hole_ofs,
+                                                 size_t hole_len, int lock) {
+  const size_t hole_end = hole_ofs + hole_len;
+  const size_t ranges[2][2] = {{0, hole_ofs}, {hole_end, size - hole_end}};
+  for (size_t i = 0; i < 2; i++) {
+    uchar_t *start = (uchar_t *)mem + ranges[i][0];
+    if (ranges[i][1] == 0) continue;
+    if (lock) {
+      if (mlock(start, ranges[i][1]) != 0) return -1;
+      continue;
+    }
+#ifdef MADV_POPULATE_WRITE
+    madvise(start, ranges[i][1], MADV_POPULATE_WRITE);
+#else
+    madvise(start, ranges[i][1], MADV_WILLNEED);
+#endif
+  }
+  return 0;
+}
+
+/**
+ * Get the number of buffers of the channel, of all size classes.
+ * @param ctx                Channel's context.
+ * @return                   The number of buffers.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buf_count(const MachnetChannelCtx_t *ctx) {
+  const MachnetChannelBufClass_t *last =
+      &ctx->data_ctx.buf_classes[ctx->data_ctx.buf_classes_nr - 1];
+  return last->first_index + last->buf_nr;
+}
+
+/**
+ * Get the size class of the buffer at a particular index.
+ *
+ * @param ctx                Channel's context.
+ * @param index              Index of the buffer.
+ * @return                   A pointer to the size class.
+ */
+static inline __attribute__((always_inline)) const MachnetChannelBufClass_t *
+__machnet_channel_buf_class_of(const MachnetChannelCtx_t *ctx,
+                               uint32_t index) {
+  const MachnetChannelBufClass_t *cls = &ctx->data_ctx.buf_classes[0];
+  // The default buffers come first, so that they take a single comparison.
+  while (index - cls->first_index >= cls->buf_nr) {
+    cls++;
+    assert(cls < &ctx->data_ctx.buf_classes[ctx->data_ctx.buf_classes_nr]);
+  }
+  return cls;
+}
+
+/**
+ * Get the smallest size class whose buffers hold `len' bytes, or the default
+ * one (0) if none of the smaller classes does.
+ *
+ * @param ctx                Channel's context.
+ * @param len                Number of bytes to hold.
+ * @return                   The index of the size class.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buf_class_for(const MachnetChannelCtx_t *ctx, uint32_t len) {
+  for (uint32_t c = 1; c < ctx->data_ctx.buf_classes_nr; c++) {
+    if (len <= ctx->data_ctx.buf_classes[c].buf_mss) return c;
+  }
+  return 0;
+}
+
+/**
+ * Get a pointer to the free buffer ring of a size class.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                Index of the size class.
+ * @return                   A pointer to the ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_buf_class_ring(const MachnetChannelCtx_t *ctx,
+                                 uint32_t cls) {
+  assert(cls < ctx->data_ctx.buf_classes_nr);
+  return (jring_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.buf_classes[cls].ring_ofs);
 }
 
 /**
@@ -344,8 +859,10 @@ __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
  */
 static inline __attribute__((always_inline)) MachnetMsgBuf_t *
 __machnet_channel_buf(const MachnetChannelCtx_t *ctx, uint32_t index) {
+  const MachnetChannelBufClass_t *cls =
+      __machnet_channel_buf_class_of(ctx, index);
   size_t buf_ofs =
-      ctx->data_ctx.buf_pool_ofs + (size_t)index * ctx->data_ctx.buf_size;
+      cls->pool_ofs + (size_t)(index - cls->first_index) * cls->buf_size;
   return (MachnetMsgBuf_t *)__machnet_channel_mem_ofs(ctx, buf_ofs);
 }
 
@@ -362,14 +879,13 @@ __machnet_channel_buf_index(const MachnetChannelCtx_t *ctx,
                             const MachnetMsgBuf_t *buf) {
   assert(ctx != NULL);
   assert(buf != NULL);
-  const uint32_t buf_size = ctx->data_ctx.buf_size;
-  const size_t buf_pool_ofs = ctx->data_ctx.buf_pool_ofs;
-  MachnetRingSlot_t index =
-      ((uintptr_t)buf -
-       (uintptr_t)__machnet_channel_mem_ofs(ctx, buf_pool_ofs)) /
-      buf_size;
-  assert(index <= ctx->data_ctx.buf_pool_mask);
-  return index;
+  const size_t buf_ofs = (uintptr_t)buf - (uintptr_t)ctx;
+  const MachnetChannelBufClass_t *cls = &ctx->data_ctx.buf_classes[0];
+  while (buf_ofs - cls->pool_ofs >= (size_t)cls->buf_nr * cls->buf_size) {
+    cls++;
+    assert(cls < &ctx->data_ctx.buf_classes[ctx->data_ctx.buf_classes_nr]);
+  }
+  return cls->first_index + (buf_ofs - cls->pool_ofs) / cls->buf_size;
 }
 
 /**
@@ -490,9 +1006,11 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
 }
 
 /**
- * Allocate a number of `MsgBuf' buffers from the channel's pool.
+ * Allocate a number of `MsgBuf' buffers of a size class from the channel's
+ * pool.
  *
  * @param ctx                Channel's context.
+ * @param cls                Index of the size class.
  * @param n                  Number of buffers to allocate.
  * @param indices            Pointer to an array that can hold at least `n'
  *                           `MachnetRingSlot_t'-sized objects to store the
@@ -503,19 +1021,21 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
  * @return                   Number of buffers allocated, either 0 or `n'.
  */
 static inline __attribute__((always_inline)) unsigned int
-__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
-                                 MachnetRingSlot_t *indices,
-                                 MachnetMsgBuf_t **bufs) {
+__machnet_channel_buf_class_alloc_bulk(const MachnetChannelCtx_t *ctx,
+                                       uint32_t cls, uint32_t n,
+                                       MachnetRingSlot_t *indices,
+                                       MachnetMsgBuf_t **bufs) {
   assert(ctx != NULL);
   assert(indices != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
+  jring_t *buf_ring = __machnet_channel_buf_class_ring(ctx, cls);
 
   // Both sides can allocate buffers concurrently, so use directly the
   // multi-consumer function.
   uint32_t ret = jring_mc_dequeue_bulk(buf_ring, indices, n, NULL);
   for (uint32_t i = 0; i < ret; i++) {
-    assert(indices[i] < buf_ring->capacity);
+    assert(indices[i] - ctx->data_ctx.buf_classes[cls].first_index <
+           ctx->data_ctx.buf_classes[cls].buf_nr);
     // Initialize all buffers in the allocated batch.
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx, indices[i]);
     __machnet_channel_buf_init(msg_buf);
@@ -526,14 +1046,26 @@ __machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
 }
 
 /**
- * Release a number of `MsgBuf' buffers back to the channel's pool.
+ * Allocate a number of default `MsgBuf' buffers (of size class 0) from the
+ * channel's pool; see `__machnet_channel_buf_class_alloc_bulk'.
+ */
+static inline __attribute__((always_inline)) unsigned int
+__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
+                                 MachnetRingSlot_t *indices,
+                                 MachnetMsgBuf_t **bufs) {
+  return __machnet_channel_buf_class_alloc_bulk(ctx, 0, n, indices, bufs);
+}
+
+/**
+ * Release a number of `MsgBuf' buffers, of any size classes, back to the
+ * channel's pool. Runs of buffers of the same class go to its ring at once.
  *
  * @param ctx                Channel's context.
  * @param n                  Number of buffers to release.
  * @param bufs               Pointer to an array of `n'
  * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
  *                           be freed.
- * @return                   Number of buffers freed, either 0 or `n'.
+ * @return                   Number of buffers freed, from the first one on.
  *                           NOTE: With correct use, this fuction must always
  *                           succeed (i.e, return `n').
  */
@@ -543,20 +1075,30 @@ __machnet_channel_buf_free_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-
-#ifndef NDEBUG
-  for (uint32_t i = 0; i < n; i++) {
-    assert(bufs[i] < buf_ring->capacity);
+  uint32_t freed = 0;
+  while (freed < n) {
+    const MachnetChannelBufClass_t *cls =
+        __machnet_channel_buf_class_of(ctx, bufs[freed]);
+    uint32_t run = 1;
+    while (freed + run < n &&
+           bufs[freed + run] - cls->first_index < cls->buf_nr) {
+      run++;
+    }
+    jring_t *buf_ring =
+        (jring_t *)__machnet_channel_mem_ofs(ctx, cls->ring_ofs);
+    // Both sides can release buffers concurrently, so use directly the
+    // multi-producer function.
+    const uint32_t ret =
+        jring_mp_enqueue_bulk(buf_ring, bufs + freed, run, NULL);
+    freed += ret;
+    if (ret != run) break;
   }
-#endif
-  // Both sides can release buffers concurrently, so use directly the
-  // multi-consumer function.
-  return jring_mp_enqueue_bulk(buf_ring, bufs, n, NULL);
+  return freed;
 }
 
 /**
- * Return the number of free buffers in the channel's pool.
+ * Return the number of free buffers in the channel's pool. Buffers cached by
+ * application threads are not accounted for.
  *
  * @param ctx                Channel's context.
  * @return                   Number of items free.
@@ -565,8 +1107,11 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_buffers_avail(const MachnetChannelCtx_t *ctx) {
   assert(ctx != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  return ctx->app_buffer_cache.count + jring_count(buf_ring);
+  uint32_t avail = 0;
+  for (uint32_t c = 0; c < ctx->data_ctx.buf_classes_nr; c++) {
+    avail += jring_count(__machnet_channel_buf_class_ring(ctx, c));
+  }
+  return avail;
 }
 
 /**
@@ -579,10 +1124,24 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_machnet_ring_pending(const MachnetChannelCtx_t *ctx) {
   assert(ctx != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return __machnet_channel_ring2_count(__machnet_channel_machnet_ring2(ctx));
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
   return jring_count(machnet_ring);
 }
 
+/**
+ * Return the number of pending TX completions.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of completions pending.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_tx_compl_pending(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+  return jring_count(__machnet_channel_tx_compl_ring(ctx));
+}
+
 /**
  * Return the number of pending items in the application ring.
  *
@@ -593,6 +1152,8 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_app_ring_pending(const MachnetChannelCtx_t *ctx) {
   assert(ctx != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return __machnet_channel_ring2_count(__machnet_channel_app_ring2(ctx));
   jring_t *app_ring = __machnet_channel_app_ring(ctx);
   return jring_count(app_ring);
 }
@@ -678,6 +1239,49 @@ __machnet_channel_ctrl_cq_dequeue(const MachnetChannelCtx_t *ctx,
   return jring_dequeue_burst(ctrl_cq, op, n, NULL);
 }
 
+/**
+ * Enqueue a number of TX completions (Machnet->Application), as many as there
+ * is room for in the ring.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Maximum number of completions to enqueue.
+ * @param compls             Pointer to an array of `n' `MachnetTxCompletion_t'.
+ * @return                   Number of completions enqueued, ranging [0, n];
+ *                           the first ones of `compls'.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_tx_compl_enqueue(const MachnetChannelCtx_t *ctx,
+                                   unsigned int n,
+                                   const MachnetTxCompletion_t *compls) {
+  assert(ctx != NULL);
+  assert(compls != NULL);
+
+  // Only the engine serving the channel enqueues.
+  jring_t *ring = __machnet_channel_tx_compl_ring(ctx);
+  return jring_enqueue_burst(ring, compls, n, NULL);
+}
+
+/**
+ * Dequeue up to `n' TX completions destined for the application.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Maximum number of completions to dequeue.
+ * @param compls             Pointer to an array that can hold up to `n'
+ *                           `MachnetTxCompletion_t'.
+ * @return                   Number of completions dequeued, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_tx_compl_dequeue(const MachnetChannelCtx_t *ctx,
+                                   unsigned int n,
+                                   MachnetTxCompletion_t *compls) {
+  assert(ctx != NULL);
+  assert(compls != NULL);
+
+  // Multi-consumer, unless the application is single-threaded.
+  jring_t *ring = __machnet_channel_tx_compl_ring(ctx);
+  return jring_dequeue_burst(ring, compls, n, NULL);
+}
+
 /**
  * Enqueue a number of messages/`MsgBuf' buffers sent from the application to
  * the Machnet.
@@ -698,12 +1302,47 @@ __machnet_channel_app_ring_enqueue(const MachnetChannelCtx_t *ctx,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_bulk(__machnet_channel_app_ring2(ctx), bufs, n);
+
   jring_t *app_ring = __machnet_channel_app_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
   return jring_mp_enqueue_bulk(app_ring, bufs, n, NULL);
 }
 
+/**
+ * Enqueue up to a number of messages/`MsgBuf' buffers sent from the
+ * application to the Machnet, as many as there is room for in the ring.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Maximum number of buffers to enqueue.
+ * @param bufs               Pointer to an array of `n'
+ * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
+ *                           be sent.
+ * @return                   Number of buffers sent, ranging [0, n]; the first
+ *                           ones of `bufs'.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_ring_enqueue_burst(const MachnetChannelCtx_t *ctx,
+                                         unsigned int n,
+                                         const MachnetRingSlot_t *bufs) {
+  assert(ctx != NULL);
+  assert(bufs != NULL);
+
+  if (__machnet_channel_is_spsc(ctx)) {
+    jring2_t *app_ring = __machnet_channel_app_ring2(ctx);
+    uint32_t i = 0;
+    while (i < n && jring2_enqueue(app_ring, &bufs[i])) i++;
+    return i;
+  }
+
+  jring_t *app_ring = __machnet_channel_app_ring(ctx);
+
+  // Multiple application threads might be enqueuing concurrently.
+  return jring_mp_enqueue_burst(app_ring, bufs, n, NULL);
+}
+
 /**
  * Dequeue a number of pending messages/`MsgBuf' buffers destined for the
  * application.
@@ -718,6 +1357,9 @@ __machnet_channel_app_ring_enqueue(const MachnetChannelCtx_t *ctx,
 static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_app_ring_dequeue(const MachnetChannelCtx_t *ctx,
                                    unsigned int n, MachnetRingSlot_t *bufs) {
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_dequeue_burst(__machnet_channel_app_ring2(ctx), bufs, n);
+
   jring_t *app_ring = __machnet_channel_app_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
@@ -746,6 +1388,9 @@ __machnet_channel_machnet_ring_enqueue(const MachnetChannelCtx_t *ctx,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_bulk(__machnet_channel_machnet_ring2(ctx), bufs, n);
+
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
@@ -767,6 +1412,9 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_machnet_ring_dequeue(const MachnetChannelCtx_t *ctx,
                                        unsigned int n,
                                        MachnetRingSlot_t *bufs) {
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_dequeue_burst(__machnet_channel_machnet_ring2(ctx), bufs, n);
+
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
 
   // Multiple application threads might be enqueuing concurrently.
@@ -774,6 +1422,285 @@ __machnet_channel_machnet_ring_dequeue(const MachnetChannelCtx_t *ctx,
   return jring_sc_dequeue_burst(machnet_ring, bufs, n, NULL);
 }
 
+/**
+ * Get a pointer to the header of a queue pair of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @return                   A pointer to the header of the queue pair.
+ */
+static inline __attribute__((always_inline)) MachnetQueuePair_t *
+__machnet_channel_queue_pair(const MachnetChannelCtx_t *ctx, uint32_t queue) {
+  assert(queue < ctx->data_ctx.queue_pairs_nr);
+  return (MachnetQueuePair_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.queue_pairs_ofs +
+               (size_t)queue * ctx->data_ctx.queue_pair_size);
+}
+
+/**
+ * Get a pointer to the `Machnet' ring (Machnet->Application) of a queue pair.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @return                   A pointer to the ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_queue_machnet_ring(const MachnetChannelCtx_t *ctx,
+                                     uint32_t queue) {
+  MachnetQueuePair_t *qp = __machnet_channel_queue_pair(ctx, queue);
+  return (jring2_t *)((uchar_t *)qp + qp->machnet_ring_ofs);
+}
+
+/**
+ * Get a pointer to the `App' ring (Application->Machnet) of a queue pair.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @return                   A pointer to the ring.
+ */
+static inline __attribute__((always_inline)) jring2_t *
+__machnet_channel_queue_app_ring(const MachnetChannelCtx_t *ctx,
+                                 uint32_t queue) {
+  MachnetQueuePair_t *qp = __machnet_channel_queue_pair(ctx, queue);
+  return (jring2_t *)((uchar_t *)qp + qp->app_ring_ofs);
+}
+
+/**
+ * Whether a queue pair is claimed by an application thread.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @return                   Non-zero if the queue pair is claimed.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_owned(const MachnetChannelCtx_t *ctx, uint32_t queue) {
+  return __atomic_load_n(&__machnet_channel_queue_pair(ctx, queue)->owner,
+                         __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Claims a free queue pair of the channel (application side).
+ *
+ * @param ctx                Channel's context.
+ * @return                   Index of the queue pair claimed, or
+ *                           `MACHNET_CHANNEL_QUEUE_SHARED' if none is free.
+ */
+static inline uint32_t __machnet_channel_queue_claim(
+    const MachnetChannelCtx_t *ctx) {
+  for (uint32_t q = 0; q < ctx->data_ctx.queue_pairs_nr; q++) {
+    uint32_t expected = 0;
+    if (__atomic_compare_exchange_n(
+            &__machnet_channel_queue_pair(ctx, q)->owner, &expected, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return q;
+  }
+  return MACHNET_CHANNEL_QUEUE_SHARED;
+}
+
+/**
+ * Releases a queue pair claimed with `__machnet_channel_queue_claim'. Messages
+ * pending in its rings stay there, for the next thread to claim it.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ */
+static inline void __machnet_channel_queue_release(
+    const MachnetChannelCtx_t *ctx, uint32_t queue) {
+  __atomic_store_n(&__machnet_channel_queue_pair(ctx, queue)->owner, 0,
+                   __ATOMIC_RELEASE);
+}
+
+/**
+ * Whether the consumer of an SPSC ring of a queue pair has entries pending.
+ * Unlike `jring2_count', it does not touch the producer's state, so it is
+ * safe to call from the consumer side.
+ *
+ * @param ring               A ring of a queue pair.
+ * @return                   Non-zero if the ring is not empty.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_ring_pending(jring2_t *ring) {
+  return __atomic_load_n(&__jring2_get_slot(ring, ring->read_idx)->dd,
+                         __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Enqueue up to a number of messages to the `App' ring of a queue pair, as many
+ * as there is room for. Only the thread that claimed the queue pair may call
+ * this.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @param n                  Maximum number of buffers to enqueue.
+ * @param bufs               Pointer to an array of `n' indices of the first
+ *                           buffers of the messages.
+ * @return                   Number of buffers sent, ranging [0, n]; the first
+ *                           ones of `bufs'.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_app_enqueue(const MachnetChannelCtx_t *ctx,
+                                    uint32_t queue, unsigned int n,
+                                    const MachnetRingSlot_t *bufs) {
+  jring2_t *ring = __machnet_channel_queue_app_ring(ctx, queue);
+  uint32_t i = 0;
+  while (i < n && jring2_enqueue(ring, &bufs[i])) i++;
+  return i;
+}
+
+/**
+ * Dequeue up to a number of messages from the `App' ring of a queue pair
+ * (engine side).
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @param n                  Maximum number of buffers to dequeue.
+ * @param bufs               Pointer to an array that can hold up to `n'
+ *                           indices.
+ * @return                   Number of buffers received, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_app_dequeue(const MachnetChannelCtx_t *ctx,
+                                    uint32_t queue, unsigned int n,
+                                    MachnetRingSlot_t *bufs) {
+  return jring2_dequeue_burst(__machnet_channel_queue_app_ring(ctx, queue),
+                              bufs, n);
+}
+
+/**
+ * Enqueue a number of messages to the `Machnet' ring of a queue pair (engine
+ * side).
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @param n                  Number of buffers to enqueue.
+ * @param bufs               Pointer to an array of `n' indices.
+ * @return                   Number of buffers sent, either 0 or `n'.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_machnet_enqueue(const MachnetChannelCtx_t *ctx,
+                                        uint32_t queue, unsigned int n,
+                                        const MachnetRingSlot_t *bufs) {
+  return jring2_enqueue_bulk(__machnet_channel_queue_machnet_ring(ctx, queue),
+                             bufs, n);
+}
+
+/**
+ * Dequeue up to a number of messages from the `Machnet' ring of a queue pair.
+ * Only the thread that claimed the queue pair may call this.
+ *
+ * @param ctx                Channel's context.
+ * @param queue              Index of the queue pair.
+ * @param n                  Maximum number of buffers to dequeue.
+ * @param bufs               Pointer to an array that can hold up to `n'
+ *                           indices.
+ * @return                   Number of buffers received, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_queue_machnet_dequeue(const MachnetChannelCtx_t *ctx,
+                                        uint32_t queue, unsigned int n,
+                                        MachnetRingSlot_t *bufs) {
+  return jring2_dequeue_burst(__machnet_channel_queue_machnet_ring(ctx, queue),
+                              bufs, n);
+}
+
+/**
+ * Arms or disarms the channel's doorbell (engine side).
+ *
+ * The store is sequentially consistent; once the doorbell is armed the engine
+ * must re-check the channel's rings before it goes to sleep (see
+ * `__machnet_channel_notify').
+ *
+ * @param ctx                Channel's context.
+ * @param armed              Non-zero to arm the doorbell.
+ */
+static inline __attribute__((always_inline)) void
+__machnet_channel_doorbell_set(MachnetChannelCtx_t *ctx, uint32_t armed) {
+  assert(ctx != NULL);
+  __atomic_store_n(&ctx->doorbell.armed, armed, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Notifies the engine serving the channel of pending work (application side).
+ * To be called after enqueueing to a ring of the channel: sets the channel's
+ * bit in the engine's pending bitmap, and checks whether the engine waits on
+ * the doorbell.
+ *
+ * The full barrier orders the enqueue before both checks. It pairs with the
+ * engine clearing the bitmap before it dequeues, and with the store in
+ * `__machnet_channel_doorbell_set'.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Non-zero if the doorbell must be rung.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_notify(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint64_t *pending = ctx->doorbell.app_pending;
+  if (likely(pending != NULL)) {
+    const uint64_t mask = 1ULL << (ctx->doorbell.pending_slot % 64);
+    // Avoid the atomic operation on the shared cache line when possible.
+    if (!(__atomic_load_n(pending, __ATOMIC_RELAXED) & mask))
+      __atomic_fetch_or(pending, mask, __ATOMIC_RELEASE);
+  }
+  return __atomic_load_n(&ctx->doorbell.armed, __ATOMIC_RELAXED);
+}
+
+/**
+ * Arms or disarms the channel's notification (application side).
+ *
+ * The store is sequentially consistent; once the notification is armed the
+ * application must re-check the Machnet ring before it waits (see
+ * `__machnet_channel_app_wakeup').
+ *
+ * @param ctx                Channel's context.
+ * @param armed              Non-zero to arm the notification.
+ */
+static inline __attribute__((always_inline)) void
+__machnet_channel_notify_set(MachnetChannelCtx_t *ctx, uint32_t armed) {
+  assert(ctx != NULL);
+  __atomic_store_n(&ctx->doorbell.notify_armed, armed, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Checks whether the application waits for messages on the channel (engine
+ * side), and disarms the notification if so. To be called after enqueueing to
+ * the Machnet ring of the channel, and after a full barrier that orders the
+ * enqueue before the check; the barrier pairs with the store in
+ * `__machnet_channel_notify_set', and may be shared by several channels.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Non-zero if the notification must be signaled.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_app_wakeup(MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+  // Avoid the atomic operation on the shared cache line when possible.
+  if (likely(!__atomic_load_n(&ctx->doorbell.notify_armed, __ATOMIC_RELAXED)))
+    return 0;
+  return __atomic_exchange_n(&ctx->doorbell.notify_armed, 0, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Return the number of pending items destined for the Machnet engine, in the
+ * application ring and the control submission queue, plus one for each queue
+ * pair with pending messages.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of items pending.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_engine_pending(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+  uint32_t pending = __machnet_channel_app_ring_pending(ctx) +
+                     jring_count(__machnet_channel_ctrl_sq_ring(ctx));
+  for (uint32_t q = 0; q < ctx->data_ctx.queue_pairs_nr; q++) {
+    pending += __machnet_channel_queue_ring_pending(
+        __machnet_channel_queue_app_ring(ctx, q));
+  }
+  return pending;
+}
+
 #ifdef __cplusplus
 }
 #endif
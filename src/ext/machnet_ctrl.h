@@ -31,6 +31,12 @@ typedef struct machnet_app_info machnet_app_info_t;
  * @var machnet_channel_info::desc_ring_size   The depth of the descriptor rings
  * (Machnet, App).
  * @var machnet_channel_info::buffer_count     The size of the buffer pool.
+ * @var machnet_channel_info::queue_pairs_nr   The number of per-thread queue
+ * pairs (see `MachnetQueuePair_t').
+ * @var machnet_channel_info::flags            Channel creation flags
+ * (`MACHNET_CHANNEL_F_*').
+ * @var machnet_channel_info::numa_node        The NUMA node to place the
+ * channel's memory on, or `MACHNET_NUMA_NODE_ANY'.
  */
 struct machnet_channel_info {
   uuid_t channel_uuid;
@@ -38,9 +44,44 @@ struct machnet_channel_info {
   uint32_t desc_ring_size;
 #define MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT 4096
   uint32_t buffer_count;
+  uint32_t queue_pairs_nr;
+  uint32_t flags;
+  int32_t numa_node;
 } __attribute__((packed));
 typedef struct machnet_channel_info machnet_channel_info_t;
 
+/**
+ * @struct machnet_handoff_info
+ * @brief The state of a running controller handed off to its successor, on a
+ * hot restart. The successor sends a handoff request; the controller answers
+ * with its pid, the numbers of channels and applications it hands off, and,
+ * as the response's descriptor, its checkpoint. One message per channel
+ * (`MACHNET_CTRL_MSG_TYPE_HANDOFF_CHANNEL'), per application
+ * (`MACHNET_CTRL_MSG_TYPE_HANDOFF_APP') and one for the listening socket
+ * (`MACHNET_CTRL_MSG_TYPE_HANDOFF_LISTEN') follow, each with its descriptors.
+ *
+ * @var machnet_handoff_info::pid          The pid of the controller; its
+ * successor takes over the NICs once it is gone.
+ * @var machnet_handoff_info::channels_nr  The number of channels handed off.
+ * @var machnet_handoff_info::apps_nr      The number of applications.
+ * @var machnet_handoff_info::fds_mask     Of a channel message, which of the
+ * channel's shared memory (bit 0), doorbell (bit 1) and notification (bit 2)
+ * descriptors the message carries, in this order.
+ * @var machnet_handoff_info::channel_uuid Of a channel message, the UUID of
+ * the channel.
+ */
+struct machnet_handoff_info {
+  int32_t pid;
+  uint32_t channels_nr;
+  uint32_t apps_nr;
+#define MACHNET_HANDOFF_FD_CHANNEL (1 << 0)
+#define MACHNET_HANDOFF_FD_DOORBELL (1 << 1)
+#define MACHNET_HANDOFF_FD_NOTIFY (1 << 2)
+  uint32_t fds_mask;
+  uuid_t channel_uuid;
+} __attribute__((packed));
+typedef struct machnet_handoff_info machnet_handoff_info_t;
+
 /**
  * @struct machnet_ctrl_resp
  */
@@ -60,7 +101,11 @@ struct machnet_ctrl_msg {
 #define MACHNET_CTRL_MSG_TYPE_REQ_CHANNEL 0x02
 #define MACHNET_CTRL_MSG_TYPE_REQ_FLOW 0x03
 #define MACHNET_CTRL_MSG_TYPE_REQ_LISTEN 0x04
+#define MACHNET_CTRL_MSG_TYPE_REQ_HANDOFF 0x05
 #define MACHNET_CTRL_MSG_TYPE_RESPONSE 0x10
+#define MACHNET_CTRL_MSG_TYPE_HANDOFF_CHANNEL 0x11
+#define MACHNET_CTRL_MSG_TYPE_HANDOFF_APP 0x12
+#define MACHNET_CTRL_MSG_TYPE_HANDOFF_LISTEN 0x13
   uint16_t type;
   uint32_t msg_id;
   uuid_t app_uuid;
@@ -68,10 +113,17 @@ struct machnet_ctrl_msg {
   union {
     machnet_app_info_t app_info;
     machnet_channel_info_t channel_info;
+    machnet_handoff_info_t handoff_info;
   };
 } __attribute__((packed));
 typedef struct machnet_ctrl_msg machnet_ctrl_msg_t;
 
+// Maximum number of file descriptors a response message carries. The response
+// to a channel request carries, in this order, the channel's shared memory
+// descriptor, the channel's doorbell, the engine's pending bitmap, and the
+// channel's notification (the last three being optional).
+#define MACHNET_CTRL_MSG_MAX_FDS 4
+
 extern uuid_t g_app_uuid;
 
 #ifdef __cplusplus
@@ -15,6 +15,7 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -34,44 +35,120 @@ extern "C" {
 #define ROUNDUP_U64_POW2(x) (1ULL << (64 - __builtin_clzll(((uint64_t)x) - 1)))
 
 /**
- * Calculate the memory size needed for an Machnet Dataplane channel.
+ * Calculate the memory size of a queue pair of a channel: its header, and its
+ * two SPSC rings.
  *
- * An Machnet Dataplane channel contains two rings for message passing in each
- * direction (Machnet -> Application, Application -> NSaas), and one ring that
- * holds free buffers (used for allocations).
+ * @param machnet_ring_slot_nr The number of Machnet->App ring slots.
+ * @param app_ring_slot_nr   The number of App->Machnet ring slots.
+ * @return The size in bytes, or (size_t)-1 if some ring size is invalid.
+ */
+static inline size_t __machnet_channel_queue_pair_size(
+    size_t machnet_ring_slot_nr, size_t app_ring_slot_nr) {
+  const size_t machnet_ring_size =
+      jring2_get_buf_ring_size(sizeof(MachnetRingSlot_t), machnet_ring_slot_nr);
+  const size_t app_ring_size =
+      jring2_get_buf_ring_size(sizeof(MachnetRingSlot_t), app_ring_slot_nr);
+  if (machnet_ring_size == (size_t)-1 || app_ring_size == (size_t)-1)
+    return -1;
+  return sizeof(MachnetQueuePair_t) + machnet_ring_size + app_ring_size;
+}
+
+/**
+ * Calculate the memory size needed for a `Machnet' or `App' ring of a channel.
  *
- * This function returns the number of bytes needed for the channel area, given
- * the number of elements in each of the rings of the channel and the desired
- * buffer size.
+ * @param ring_slot_nr       The number of ring slots.
+ * @param flags              The channel's creation flags (`MACHNET_CHANNEL_F_*').
+ * @return The size in bytes, or (size_t)-1 if the ring size is invalid.
+ */
+static inline size_t __machnet_channel_data_ring_size(size_t ring_slot_nr,
+                                                      uint32_t flags) {
+  if (flags & MACHNET_CHANNEL_F_SPSC)
+    return jring2_get_buf_ring_size(sizeof(MachnetRingSlot_t), ring_slot_nr);
+  return jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), ring_slot_nr);
+}
+
+/**
+ * Calculate the total size of each buffer (incl. metadata) of a channel.
  *
- * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
- * (must be power of 2).
- * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
- * (must be power of 2).
- * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
- *                           power of 2).
  * @param buffer_size        The usable size of each buffer.
- * @param is_posix_shm       Whether the channel will be a POSIX shared memory.
- * @return
- *   - The memory size in bytes needed for the Machnet channel on success.
- *   - (size_t)-1 - Some parameter is not a power of 2, or the buffer size is
- *                  bad (too big).
+ * @return The size in bytes.
  */
-static inline size_t __machnet_channel_dataplane_calculate_size(
+static inline size_t __machnet_channel_buf_total_size(size_t buffer_size) {
+  return ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
+                          MACHNET_MSGBUF_HEADROOM_MAX);
+}
+
+/**
+ * Calculate the number of default buffers per segment of a channel.
+ *
+ * @param buf_ring_slot_nr   The number of buffer ring slots requested.
+ * @param buf_segs_max       The maximum number of segments of the pool.
+ * @return The number of buffers: one less than the slots for a fixed pool,
+ *         as many for an elastic one, so that segments fill whole pages.
+ */
+static inline size_t __machnet_channel_buf_seg_nr(size_t buf_ring_slot_nr,
+                                                  size_t buf_segs_max) {
+  return buf_segs_max == 1 ? buf_ring_slot_nr - 1 : buf_ring_slot_nr;
+}
+
+/**
+ * Calculate the number of slots of the ring of default buffers of a channel,
+ * which holds the buffers of all the segments.
+ *
+ * @param buf_ring_slot_nr   The number of buffer ring slots requested.
+ * @param buf_segs_max       The maximum number of segments of the pool.
+ * @return The number of slots.
+ */
+static inline size_t __machnet_channel_buf_ring_slot_nr(size_t buf_ring_slot_nr,
+                                                        size_t buf_segs_max) {
+  if (buf_segs_max == 1) return buf_ring_slot_nr;
+  return ROUNDUP_U64_POW2(buf_ring_slot_nr * buf_segs_max + 1);
+}
+
+/**
+ * Calculate the memory layout of a Machnet Dataplane channel (see
+ * `__machnet_channel_dataplane_calculate_size').
+ *
+ * @param[out] buf_pool_ofs  Offset of the buffer pool (may be NULL).
+ * @param[out] buf_seg_size  Size of each segment of default buffers (may be
+ *                           NULL).
+ * @return The memory size in bytes, or (size_t)-1 on bad parameters.
+ */
+static inline size_t __machnet_channel_dataplane_layout(
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_posix_shm) {
+    size_t buf_ring_slot_nr, size_t buf_segs_max, size_t buffer_size,
+    const MachnetChannelBufClassConf_t *buf_classes, size_t buf_classes_nr,
+    size_t queue_pairs_nr, uint32_t flags, int is_posix_shm,
+    size_t *buf_pool_ofs, size_t *buf_seg_size) {
   // Check that all parameters are power of 2.
   if (!IS_POW2(machnet_ring_slot_nr) || !IS_POW2(app_ring_slot_nr) ||
       !IS_POW2(buf_ring_slot_nr))
     return -1;
+  if (buf_segs_max == 0 || buf_segs_max > MACHNET_CHANNEL_BUF_SEGS_MAX)
+    return -1;
+  if (buf_classes_nr >= MACHNET_CHANNEL_BUF_CLASSES_MAX) return -1;
+  if (buf_classes_nr > 0 && buf_classes == NULL) return -1;
+  for (size_t c = 0; c < buf_classes_nr; c++) {
+    if (!IS_POW2(buf_classes[c].buf_ring_slot_nr)) return -1;
+    if (buf_classes[c].buffer_size >= buffer_size) return -1;
+    if (c > 0 && buf_classes[c].buffer_size <= buf_classes[c - 1].buffer_size)
+      return -1;
+  }
+  if (queue_pairs_nr > MACHNET_CHANNEL_QUEUE_PAIRS_MAX) return -1;
+  if (flags & ~MACHNET_CHANNEL_F_MASK) return -1;
 
   const size_t total_buffer_size =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
+      __machnet_channel_buf_total_size(buffer_size);
 
   const size_t kPageSize = (is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE);
   if (buffer_size > kPageSize) return -1;
 
+  // Segments are attached and released a page at a time.
+  const size_t seg_size =
+      __machnet_channel_buf_seg_nr(buf_ring_slot_nr, buf_segs_max) *
+      total_buffer_size;
+  if (buf_segs_max > 1 && seg_size % kPageSize != 0) return -1;
+
   // Add the size of the channel's header.
   size_t total_size = sizeof(MachnetChannelCtx_t);
 
@@ -88,26 +165,49 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
     total_size += acc;
   }
 
-  // Add the size of the rings (Machnet, Application, BufferRing).
-  size_t data_ring_sizes[] = {machnet_ring_slot_nr, app_ring_slot_nr,
-                              buf_ring_slot_nr};
+  // Add the size of the rings (Machnet, Application, TX completions,
+  // BufferRing). There are as many TX completion slots as Machnet ring slots.
+  size_t data_ring_sizes[] = {
+      __machnet_channel_data_ring_size(machnet_ring_slot_nr, flags),
+      __machnet_channel_data_ring_size(app_ring_slot_nr, flags),
+      jring_get_buf_ring_size(sizeof(MachnetTxCompletion_t),
+                              machnet_ring_slot_nr),
+      jring_get_buf_ring_size(
+          sizeof(MachnetRingSlot_t),
+          __machnet_channel_buf_ring_slot_nr(buf_ring_slot_nr, buf_segs_max))};
   for (size_t i = 0; i < COUNT_OF(data_ring_sizes); i++) {
-    size_t acc =
-        jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), data_ring_sizes[i]);
+    if (data_ring_sizes[i] == (size_t)-1) return -1;
+    total_size += data_ring_sizes[i];
+  }
+
+  // Add the size of the buffer rings of the other size classes.
+  for (size_t c = 0; c < buf_classes_nr; c++) {
+    size_t acc = jring_get_buf_ring_size(sizeof(MachnetRingSlot_t),
+                                         buf_classes[c].buf_ring_slot_nr);
     if (acc == (size_t)-1) return -1;
     total_size += acc;
   }
 
-  // Align to cache line boundary, and add the size of the scratch buffer index
-  // table.
-  total_size = ALIGN_TO_BOUNDARY(total_size, CACHE_LINE_SIZE);
-  total_size += buf_ring_slot_nr * sizeof(MachnetRingSlot_t);
+  // Add the size of the queue pairs.
+  if (queue_pairs_nr > 0) {
+    size_t acc = __machnet_channel_queue_pair_size(machnet_ring_slot_nr,
+                                                   app_ring_slot_nr);
+    if (acc == (size_t)-1) return -1;
+    total_size += queue_pairs_nr * acc;
+  }
 
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
-
-  // Add the size of the buffers.
-  total_size += buf_ring_slot_nr * total_buffer_size;
+  if (buf_pool_ofs != NULL) *buf_pool_ofs = total_size;
+  if (buf_seg_size != NULL) *buf_seg_size = seg_size;
+
+  // Add the size of the buffers, of all size classes.
+  total_size += buf_segs_max == 1 ? buf_ring_slot_nr * total_buffer_size
+                                  : buf_segs_max * seg_size;
+  for (size_t c = 0; c < buf_classes_nr; c++) {
+    total_size += buf_classes[c].buf_ring_slot_nr *
+                  __machnet_channel_buf_total_size(buf_classes[c].buffer_size);
+  }
 
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
@@ -115,6 +215,97 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
   return total_size;
 }
 
+/**
+ * Calculate the memory size needed for an Machnet Dataplane channel.
+ *
+ * An Machnet Dataplane channel contains two rings for message passing in each
+ * direction (Machnet -> Application, Application -> NSaas), one for TX
+ * completions (Machnet -> Application), and one ring that holds free buffers
+ * (used for allocations). Optionally, it also contains a
+ * number of queue pairs, with one SPSC ring in each direction.
+ *
+ * This function returns the number of bytes needed for the channel area, given
+ * the number of elements in each of the rings of the channel and the desired
+ * buffer size.
+ *
+ * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
+ * (must be power of 2).
+ * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
+ * (must be power of 2).
+ * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
+ *                           power of 2).
+ * @param buf_segs_max       1 for a fixed pool. Otherwise, the pool is elastic:
+ *                           it holds up to as many segments of
+ *                           `buf_ring_slot_nr' buffers, of which only the first
+ *                           is backed by memory at creation.
+ * @param buffer_size        The usable size of each buffer.
+ * @param buf_classes        The size classes of smaller buffers, in increasing
+ *                           size, besides the default ones (may be NULL).
+ * @param buf_classes_nr     The number of such size classes (less than
+ *                           `MACHNET_CHANNEL_BUF_CLASSES_MAX').
+ * @param queue_pairs_nr     The number of queue pairs (at most
+ *                           `MACHNET_CHANNEL_QUEUE_PAIRS_MAX'); their rings
+ *                           have as many slots as the ones above.
+ * @param flags              The channel's creation flags (`MACHNET_CHANNEL_F_*').
+ * @param is_posix_shm       Whether the channel will be a POSIX shared memory.
+ * @return
+ *   - The memory size in bytes needed for the Machnet channel on success.
+ *   - (size_t)-1 - Some parameter is not a power of 2, the buffer size is bad
+ *                  (too big), the segments are bad (too many, or not a
+ *                  multiple of the page size), the size classes are bad
+ *                  (too many, or not
+ *                  smaller than the default buffers, in increasing size),
+ *                  there are too many queue pairs, or some flag is unknown.
+ */
+static inline size_t __machnet_channel_dataplane_calculate_size(
+    size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+    size_t buf_ring_slot_nr, size_t buf_segs_max, size_t buffer_size,
+    const MachnetChannelBufClassConf_t *buf_classes, size_t buf_classes_nr,
+    size_t queue_pairs_nr, uint32_t flags, int is_posix_shm) {
+  return __machnet_channel_dataplane_layout(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buf_segs_max,
+      buffer_size, buf_classes, buf_classes_nr, queue_pairs_nr, flags,
+      is_posix_shm, NULL, NULL);
+}
+
+/**
+ * Initialize the headers of a range of buffers of a size class, and make them
+ * available in the ring of the class.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                Index of the size class.
+ * @param first              Index of the first buffer.
+ * @param nr                 Number of buffers.
+ * @return                   '0' on success, '-1' if the ring has no room.
+ */
+static inline int __machnet_channel_buf_init_range(MachnetChannelCtx_t *ctx,
+                                                   uint32_t cls,
+                                                   uint32_t first,
+                                                   uint32_t nr) {
+  const MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  jring_t *ring = __machnet_channel_buf_class_ring(ctx, cls);
+  MachnetRingSlot_t indices[NUM_CACHED_BUFS];
+  uint32_t i = first;
+  while (i < first + nr) {
+    unsigned int n = 0;
+    for (; n < COUNT_OF(indices) && i < first + nr; n++, i++) {
+      MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, i);
+      __machnet_channel_buf_init(buf);
+      // The following fields should only be initialized once here.
+      *__DECONST(uint32_t *, &buf->magic) = MACHNET_MSGBUF_MAGIC;
+      *__DECONST(uint32_t *, &buf->index) = i;
+      // The whole buffer is usable; the space past the headroom and the MSS
+      // lets the NIC receive a full frame (headers included) directly into it.
+      *__DECONST(uint32_t *, &buf->size) =
+          buf_class->buf_size - MACHNET_MSGBUF_SPACE_RESERVED;
+      indices[n] = i;
+    }
+    // Make these buffers available.
+    if (jring_enqueue_bulk(ring, indices, n, NULL) != n) return -1;
+  }
+  return 0;
+}
+
 /**
  * Initialiaze an Machnet Dataplane channel.
  *
@@ -131,7 +322,15 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
  * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots.
  * @param buf_ring_slot_nr   The number of buffers + 1 to be used in this
  *                           channel (must sum up to a power of 2).
+ * @param buf_segs_max       The maximum number of segments of default buffers
+ *                           (1 for a fixed pool); only the first is
+ *                           initialized, the memory of the others need not be
+ *                           backed.
  * @param buffer_size        The size of each buffer.
+ * @param buf_classes        The size classes of smaller buffers (may be NULL).
+ * @param buf_classes_nr     The number of such size classes.
+ * @param queue_pairs_nr     The number of queue pairs.
+ * @param flags              The channel's creation flags (`MACHNET_CHANNEL_F_*').
  * @param is_multithread     1 if Machnet is using multiple threads per channel,
  * 0 otherwise.
  * @return                   '0' on success, '-1' on failure.
@@ -139,12 +338,17 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
 static inline int __machnet_channel_dataplane_init(
     uchar_t *shm, size_t shm_size, int is_posix_shm, const char *name,
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_multithread) {
+    size_t buf_ring_slot_nr, size_t buf_segs_max, size_t buffer_size,
+    const MachnetChannelBufClassConf_t *buf_classes, size_t buf_classes_nr,
+    size_t queue_pairs_nr, uint32_t flags, int is_multithread) {
   size_t total_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buf_segs_max,
+      buffer_size, buf_classes, buf_classes_nr, queue_pairs_nr, flags,
       is_posix_shm);
   // Guard against mismatches.
   if (total_size > shm_size || total_size == (size_t)-1) return -1;
+  // SPSC rings need a single Machnet thread on the other side too.
+  if ((flags & MACHNET_CHANNEL_F_SPSC) && is_multithread) return -1;
 
   // TODO(ilias): Check that we can always accomodate an MACHNET_MSG_MAX_LEN
   // sized mesage with the number of buffers and buffer_size provided here.
@@ -153,6 +357,8 @@ static inline int __machnet_channel_dataplane_init(
   // Initialize the channel context.
   MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)shm;
   ctx->version = MACHNET_CHANNEL_VERSION;
+  ctx->cc = MACHNET_CC_DEFAULT;
+  ctx->prio = MACHNET_PRIO_NORMAL;
   ctx->size = total_size;
   strncpy(ctx->name, name, sizeof(ctx->name));
   ctx->name[sizeof(ctx->name) - 1] = '\0';
@@ -160,14 +366,19 @@ static inline int __machnet_channel_dataplane_init(
   // Initiliaze the ctrl context.
   ctx->ctrl_ctx.req_id = 0;
 
-  // Initialize buffer cache
-  ctx->app_buffer_cache.count = 0;
+  // The doorbell is disarmed until the engine goes to sleep, the notification
+  // until the application waits, and the channel has no pending bitmap slot
+  // until an engine serves it.
+  ctx->doorbell.armed = 0;
+  ctx->doorbell.pending_slot = MACHNET_PENDING_BITMAP_INVALID_SLOT;
+  ctx->doorbell.app_fd = -1;
+  ctx->doorbell.app_notify_fd = -1;
+  ctx->doorbell.app_pending = NULL;
+  ctx->doorbell.notify_armed = 0;
 
   // Clear out statatistics.
   ctx->data_ctx.stats_ofs = sizeof(*ctx);
-  MachnetChannelStats_t *stats =
-      (MachnetChannelStats_t *)__machnet_channel_mem_ofs(
-          ctx, ctx->data_ctx.stats_ofs);
+  MachnetChannelStats_t *stats = __machnet_channel_stats(ctx);
   memset(stats, 0, sizeof(*stats));
 
   const int kMultiThread = 1;  // Assume the application always multithreaded.
@@ -195,81 +406,137 @@ static inline int __machnet_channel_dataplane_init(
       jring_get_buf_ring_size(sizeof(MachnetCtrlQueueEntry_t),
                               MACHNET_CHANNEL_CTRL_CQ_SLOT_NR);
 
-  jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
-  ret = jring_init(machnet_ring, machnet_ring_slot_nr,
-                   sizeof(MachnetRingSlot_t), is_multithread, kMultiThread);
+  // Ring0 and Ring1 are SPSC if the application is single-threaded.
+  ctx->data_ctx.flags = flags;
+  if (flags & MACHNET_CHANNEL_F_SPSC) {
+    ret = jring2_init(__machnet_channel_machnet_ring2(ctx),
+                      machnet_ring_slot_nr, sizeof(MachnetRingSlot_t));
+  } else {
+    ret = jring_init(__machnet_channel_machnet_ring(ctx), machnet_ring_slot_nr,
+                     sizeof(MachnetRingSlot_t), is_multithread, kMultiThread);
+  }
   if (ret != 0) return ret;
 
   // App->Machnet ring follows immediately after the Machnet->App ring.
   ctx->data_ctx.app_ring_ofs =
       ctx->data_ctx.machnet_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), machnet_ring_slot_nr);
-  jring_t *app_ring = __machnet_channel_app_ring(ctx);
-  ret = jring_init(app_ring, app_ring_slot_nr, sizeof(MachnetRingSlot_t),
-                   kMultiThread, is_multithread);
+      __machnet_channel_data_ring_size(machnet_ring_slot_nr, flags);
+  if (flags & MACHNET_CHANNEL_F_SPSC) {
+    ret = jring2_init(__machnet_channel_app_ring2(ctx), app_ring_slot_nr,
+                      sizeof(MachnetRingSlot_t));
+  } else {
+    ret = jring_init(__machnet_channel_app_ring(ctx), app_ring_slot_nr,
+                     sizeof(MachnetRingSlot_t), kMultiThread, is_multithread);
+  }
   if (ret != 0) return ret;
 
-  // jring_get_buf_ring_size() cannot fail here.
-  ctx->data_ctx.buf_ring_ofs =
+  // The TX completion ring follows. Only the engine produces.
+  // __machnet_channel_data_ring_size() cannot fail here.
+  ctx->data_ctx.tx_compl_ring_ofs =
       ctx->data_ctx.app_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), app_ring_slot_nr);
+      __machnet_channel_data_ring_size(app_ring_slot_nr, flags);
+  ret = jring_init(__machnet_channel_tx_compl_ring(ctx), machnet_ring_slot_nr,
+                   sizeof(MachnetTxCompletion_t), 0,
+                   !(flags & MACHNET_CHANNEL_F_SPSC));
+  if (ret != 0) return ret;
 
-  // Initialize the buffer ring.
+  ctx->data_ctx.buf_ring_ofs =
+      ctx->data_ctx.tx_compl_ring_ofs +
+      jring_get_buf_ring_size(sizeof(MachnetTxCompletion_t),
+                              machnet_ring_slot_nr);
+
+  // Initialize the buffer ring, with room for all the segments.
+  const size_t buf_ring_size =
+      __machnet_channel_buf_ring_slot_nr(buf_ring_slot_nr, buf_segs_max);
   jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  ret = jring_init(buf_ring, buf_ring_slot_nr, sizeof(MachnetRingSlot_t),
+  ret = jring_init(buf_ring, buf_ring_size, sizeof(MachnetRingSlot_t),
                    kMultiThread, kMultiThread);
   if (ret != 0) return ret;
 
-  // Offset in memory channel where the final ring ends (buf_ring).
-  size_t buf_ring_end_ofs =
+  // The buffer rings of the other size classes follow.
+  MachnetChannelBufClass_t *classes = ctx->data_ctx.buf_classes;
+  ctx->data_ctx.buf_classes_nr = 1 + buf_classes_nr;
+  classes[0].ring_ofs = ctx->data_ctx.buf_ring_ofs;
+  size_t ring_ofs =
       ctx->data_ctx.buf_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_slot_nr);
+      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_size);
+  for (size_t c = 1; c <= buf_classes_nr; c++) {
+    const uint32_t slot_nr = buf_classes[c - 1].buf_ring_slot_nr;
+    classes[c].ring_ofs = ring_ofs;
+    ret = jring_init(__machnet_channel_buf_class_ring(ctx, c), slot_nr,
+                     sizeof(MachnetRingSlot_t), kMultiThread, kMultiThread);
+    if (ret != 0) return ret;
+    ring_ofs += jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), slot_nr);
+  }
+
+  // The queue pairs follow immediately after the buffer rings.
+  ctx->data_ctx.queue_pairs_ofs = ring_ofs;
+  ctx->data_ctx.queue_pairs_nr = queue_pairs_nr;
+  ctx->data_ctx.queue_pair_size =
+      queue_pairs_nr > 0 ? __machnet_channel_queue_pair_size(
+                               machnet_ring_slot_nr, app_ring_slot_nr)
+                         : 0;
+  for (uint32_t q = 0; q < queue_pairs_nr; q++) {
+    MachnetQueuePair_t *qp = __machnet_channel_queue_pair(ctx, q);
+    qp->owner = 0;
+    qp->machnet_ring_ofs = sizeof(*qp);
+    qp->app_ring_ofs =
+        qp->machnet_ring_ofs +
+        jring2_get_buf_ring_size(sizeof(MachnetRingSlot_t),
+                                 machnet_ring_slot_nr);
+    ret = jring2_init(__machnet_channel_queue_machnet_ring(ctx, q),
+                      machnet_ring_slot_nr, sizeof(MachnetRingSlot_t));
+    if (ret != 0) return ret;
+    ret = jring2_init(__machnet_channel_queue_app_ring(ctx, q),
+                      app_ring_slot_nr, sizeof(MachnetRingSlot_t));
+    if (ret != 0) return ret;
+  }
 
-  // Offset in memory, of the scratch buffer index table.
-  ctx->data_ctx.buffer_index_table_ofs =
-      ALIGN_TO_BOUNDARY(buf_ring_end_ofs, CACHE_LINE_SIZE);
-  size_t tmp_buffer_index_table_end_ofs =
-      ctx->data_ctx.buffer_index_table_ofs +
-      buf_ring_slot_nr * sizeof(MachnetRingSlot_t);
+  // Offset in memory channel where the final ring ends (the queue pairs').
+  size_t buf_ring_end_ofs = ctx->data_ctx.queue_pairs_ofs +
+                            queue_pairs_nr * ctx->data_ctx.queue_pair_size;
 
   // Calculate the actual buffer size (incl. metadata).
-  const size_t kTotalBufSize =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
+  const size_t kTotalBufSize = __machnet_channel_buf_total_size(buffer_size);
 
   // Initialize the buffers. Note that the buffer pool start is aligned to the
   // page_size boundary.
   const size_t kPageSize = is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE;
   ctx->data_ctx.buf_pool_ofs =
-      ALIGN_TO_BOUNDARY(tmp_buffer_index_table_end_ofs, kPageSize);
+      ALIGN_TO_BOUNDARY(buf_ring_end_ofs, kPageSize);
   ctx->data_ctx.buf_pool_mask = buf_ring->capacity;
   ctx->data_ctx.buf_size = kTotalBufSize;
   ctx->data_ctx.buf_mss = buffer_size;
-
-  // Initialize the message header of each buffer.
-  for (uint32_t i = 0; i < buf_ring->capacity; i++) {
-    MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, i);
-    __machnet_channel_buf_init(buf);
-    // The following fields should only be initialized once here.
-    *__DECONST(uint32_t *, &buf->magic) = MACHNET_MSGBUF_MAGIC;
-    *__DECONST(uint32_t *, &buf->index) = i;
-    *__DECONST(uint32_t *, &buf->size) =
-        buffer_size + MACHNET_MSGBUF_HEADROOM_MAX;
+  ctx->data_ctx.buf_seg_nr =
+      __machnet_channel_buf_seg_nr(buf_ring_slot_nr, buf_segs_max);
+  ctx->data_ctx.buf_segs_max = buf_segs_max;
+  ctx->data_ctx.buf_segs_nr = 1;
+
+  // The buffers of the other size classes follow the default ones, in memory
+  // and in index space.
+  classes[0].pool_ofs = ctx->data_ctx.buf_pool_ofs;
+  classes[0].first_index = 0;
+  classes[0].buf_nr = ctx->data_ctx.buf_seg_nr * buf_segs_max;
+  classes[0].buf_size = kTotalBufSize;
+  classes[0].buf_mss = buffer_size;
+  for (size_t c = 1; c <= buf_classes_nr; c++) {
+    const MachnetChannelBufClass_t *prev = &classes[c - 1];
+    classes[c].pool_ofs =
+        prev->pool_ofs + (size_t)prev->buf_nr * prev->buf_size;
+    classes[c].first_index = prev->first_index + prev->buf_nr;
+    classes[c].buf_nr = __machnet_channel_buf_class_ring(ctx, c)->capacity;
+    classes[c].buf_size =
+        __machnet_channel_buf_total_size(buf_classes[c - 1].buffer_size);
+    classes[c].buf_mss = buf_classes[c - 1].buffer_size;
   }
 
-  // Initialize the buffer index table, and make all these buffers available.
-  MachnetRingSlot_t *buf_index_table = (MachnetRingSlot_t *)malloc(
-      buf_ring->capacity * sizeof(MachnetRingSlot_t));
-  if (buf_index_table == NULL) return -1;
-
-  for (size_t i = 0; i < buf_ring->capacity; i++) buf_index_table[i] = i;
-
-  unsigned int free_space;
-  int enqueued = jring_enqueue_bulk(buf_ring, buf_index_table,
-                                    buf_ring->capacity, &free_space);
-  free(buf_index_table);
-  if (((size_t)enqueued != buf_ring->capacity) || (free_space != 0))
-    return -1;  // Enqueue has failed.
+  // Make the buffers available: those of the first segment only, for the
+  // default ones.
+  for (uint32_t c = 0; c <= buf_classes_nr; c++) {
+    const uint32_t nr = c == 0 ? ctx->data_ctx.buf_seg_nr : classes[c].buf_nr;
+    ret = __machnet_channel_buf_init_range(ctx, c, classes[c].first_index, nr);
+    if (ret != 0) return ret;
+  }
 
   // Set the header magic at the end.
   __sync_synchronize();
@@ -279,6 +546,26 @@ static inline int __machnet_channel_dataplane_init(
   return 0;
 }
 
+/**
+ * Allocate the memory of a shared memory segment, but for a hole, so that
+ * running out of memory fails here rather than on a page fault.
+ *
+ * @param[in] shm_fd                 The file descriptor of the segment.
+ * @param[in] size                   Size of the segment.
+ * @param[in] hole_ofs               Offset of the hole.
+ * @param[in] hole_len               Size of the hole (possibly 0).
+ * @return                           0 on success, -1 otherwise.
+ */
+static inline int __machnet_channel_mem_reserve(int shm_fd, size_t size,
+                                                size_t hole_ofs,
+                                                size_t hole_len) {
+  const size_t hole_end = hole_ofs + hole_len;
+  if (hole_ofs > 0 && fallocate(shm_fd, 0, 0, hole_ofs) != 0) return -1;
+  if (size > hole_end && fallocate(shm_fd, 0, hole_end, size - hole_end) != 0)
+    return -1;
+  return 0;
+}
+
 /**
  * This function creates a POSIX shared memory region to be used as an Machnet
  * channel. The shared memory region is created with the given name and size and
@@ -287,13 +574,17 @@ static inline int __machnet_channel_dataplane_init(
  * @param[in] channel_name           The name of the shared memory segment.
  * @param[in] channel_size           Size of the usable memory area of the
  * channel in bytes.
+ * @param[in] hole_ofs               Offset of a range left without memory
+ * (see `__machnet_channel_buf_hole').
+ * @param[in] hole_len               Size of that range (possibly 0).
  * @param[out] shm_fd             Sets the file descriptor accordingly (-1 on
  *                           failure, >0 on success).
  * @return                   Pointer to channel's memory area on success, NULL
  *                           otherwise.
  */
 static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
-    const char *channel_name, size_t channel_size, int *shm_fd) {
+    const char *channel_name, size_t channel_size, size_t hole_ofs,
+    size_t hole_len, int *shm_fd) {
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
   MachnetChannelCtx_t *channel = NULL;
@@ -311,10 +602,15 @@ static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
     perror("ftruncate()");
     goto fail;
   }
+  if (__machnet_channel_mem_reserve(*shm_fd, channel_size, hole_ofs,
+                                    hole_len) != 0) {
+    perror("fallocate()");
+    goto fail;
+  }
 
   // Map the shared memory segment into the address space of the process.
   prot_flags = PROT_READ | PROT_WRITE;
-  shm_flags = MAP_SHARED | MAP_POPULATE;
+  shm_flags = MAP_SHARED;
   channel = (MachnetChannelCtx_t *)mmap(NULL, channel_size, prot_flags,
                                         shm_flags, *shm_fd, 0);
   if (channel == MAP_FAILED) {
@@ -322,8 +618,9 @@ static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
     goto fail;
   }
 
-  // Lock the memory segment in RAM.
-  if (mlock((void *)channel, channel_size) != 0) {
+  // Lock the memory segment in RAM, but for the hole.
+  if (__machnet_channel_mem_populate(channel, channel_size, hole_ofs, hole_len,
+                                     1) != 0) {
     perror("mlock()");
     goto fail;
   }
@@ -349,13 +646,17 @@ fail:
  * @param[in] channel_name           The name of the shared memory segment.
  * @param[in]  channel_size          Size of the usable memory area of the
  * channel (in bytes, huge pages aligned)
+ * @param[in] hole_ofs               Offset of a range left without memory
+ * (see `__machnet_channel_buf_hole').
+ * @param[in] hole_len               Size of that range (possibly 0).
  * @param[out] shm_fd                Sets the file descriptor accordingly (-1 on
  * failure, >0 on success).
  * @return                   Pointer to channel's memory area on success, NULL
  *                           otherwise.
  */
 static inline MachnetChannelCtx_t *__machnet_channel_hugetlbfs_create(
-    const char *channel_name, size_t channel_size, int *shm_fd) {
+    const char *channel_name, size_t channel_size, size_t hole_ofs,
+    size_t hole_len, int *shm_fd) {
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
   MachnetChannelCtx_t *channel = NULL;
@@ -383,9 +684,15 @@ static inline MachnetChannelCtx_t *__machnet_channel_hugetlbfs_create(
             __FILE__, strerror(errno));
     goto fail;
   }
+  if (__machnet_channel_mem_reserve(*shm_fd, channel_size, hole_ofs,
+                                    hole_len) != 0) {
+    fprintf(stderr, "fallocate() failed, error = %s\n", strerror(errno));
+    goto fail;
+  }
 
-  // Map the shared memory segment into the address space of the process.
-  shm_flags = MAP_SHARED | MAP_POPULATE | MAP_HUGETLB;
+  // Map the shared memory segment into the address space of the process. The
+  // huge pages were allocated above; none is reserved for the hole.
+  shm_flags = MAP_SHARED | MAP_HUGETLB | MAP_NORESERVE;
   channel = (MachnetChannelCtx_t *)mmap(
       NULL, channel_size, PROT_READ | PROT_WRITE, shm_flags, *shm_fd, 0);
   if (channel == MAP_FAILED) {
@@ -393,8 +700,9 @@ static inline MachnetChannelCtx_t *__machnet_channel_hugetlbfs_create(
     goto fail;
   }
 
-  // Lock the memory segment in RAM.
-  if (mlock((void *)channel, channel_size) != 0) {
+  // Lock the memory segment in RAM, but for the hole.
+  if (__machnet_channel_mem_populate(channel, channel_size, hole_ofs, hole_len,
+                                     1) != 0) {
     fprintf(stderr, "mlock() failed, error = %s\n", strerror(errno));
     goto fail;
   }
@@ -452,6 +760,16 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
  * @param[in] machnet_ring_slot_nr     Number of slots in the Machnet ring.
  * @param[in] app_ring_slot_nr       Number of slots in the application ring.
  * @param[in] buf_ring_slot_nr       Number of slots in the buffer ring.
+ * @param[in] buf_segs_max           Maximum number of segments of default
+ * buffers, 1 for a fixed pool (see
+ * `__machnet_channel_dataplane_calculate_size'). Only the first one is backed
+ * by memory.
+ * @param[in] buffer_size            The usable size of each buffer.
+ * @param[in] buf_classes            The size classes of smaller buffers, in
+ * increasing size (may be NULL).
+ * @param[in] buf_classes_nr         Number of such size classes.
+ * @param[in] queue_pairs_nr         Number of queue pairs.
+ * @param[in] flags                  Creation flags (`MACHNET_CHANNEL_F_*').
  * @param[out] channel_mem_size      (ptr) The real size of the underlying
  * shared memory segment. Can differ from `channel_size` because of alignment
  * reasons (e.g, 4K or 2MB).
@@ -464,7 +782,9 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
  */
 static inline MachnetChannelCtx_t *__machnet_channel_create(
     const char *channel_name, size_t machnet_ring_slot_nr,
-    size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buffer_size,
+    size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buf_segs_max,
+    size_t buffer_size, const MachnetChannelBufClassConf_t *buf_classes,
+    size_t buf_classes_nr, size_t queue_pairs_nr, uint32_t flags,
     size_t *channel_mem_size, int *is_posix_shm, int *shm_fd) {
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
@@ -472,15 +792,21 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   assert(is_posix_shm != NULL);
   assert(shm_fd != NULL);
   MachnetChannelCtx_t *channel;
+  size_t buf_pool_ofs, buf_seg_size;
 
   *is_posix_shm = 0;
-  *channel_mem_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
-      *is_posix_shm);
-  // Try creating and mapping a hugetlbfs backed shared memory segment.
-  channel = __machnet_channel_hugetlbfs_create(channel_name, *channel_mem_size,
-                                               shm_fd);
-  if (channel != NULL) goto out;
+  *channel_mem_size = __machnet_channel_dataplane_layout(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buf_segs_max,
+      buffer_size, buf_classes, buf_classes_nr, queue_pairs_nr, flags,
+      *is_posix_shm, &buf_pool_ofs, &buf_seg_size);
+  // Try creating and mapping a hugetlbfs backed shared memory segment. Its
+  // segments of default buffers but the first are left without memory.
+  if (*channel_mem_size != (size_t)-1) {
+    channel = __machnet_channel_hugetlbfs_create(
+        channel_name, *channel_mem_size, buf_pool_ofs + buf_seg_size,
+        (buf_segs_max - 1) * buf_seg_size, shm_fd);
+    if (channel != NULL) goto out;
+  }
 
   fprintf(stderr,
           "Failed to create hugetlbfs backed shared memory segment; falling "
@@ -489,11 +815,14 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   // Hugetlbfs backed shared memory segment creation failed. Fallback to a
   // regular POSIX shm segment.
   *is_posix_shm = 1;
-  *channel_mem_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
-      *is_posix_shm);
-  channel =
-      __machnet_channel_posix_create(channel_name, *channel_mem_size, shm_fd);
+  *channel_mem_size = __machnet_channel_dataplane_layout(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buf_segs_max,
+      buffer_size, buf_classes, buf_classes_nr, queue_pairs_nr, flags,
+      *is_posix_shm, &buf_pool_ofs, &buf_seg_size);
+  if (*channel_mem_size == (size_t)-1) return NULL;
+  channel = __machnet_channel_posix_create(
+      channel_name, *channel_mem_size, buf_pool_ofs + buf_seg_size,
+      (buf_segs_max - 1) * buf_seg_size, shm_fd);
   if (channel != NULL) goto out;
 
   // Failed to create shared memory segment.
@@ -503,7 +832,8 @@ out:
   // The shared memory segment is created and mapped. Initialize it.
   int ret = __machnet_channel_dataplane_init(
       (uchar_t *)channel, *channel_mem_size, *is_posix_shm, channel_name,
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size, 0);
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buf_segs_max,
+      buffer_size, buf_classes, buf_classes_nr, queue_pairs_nr, flags, 0);
   if (ret != 0) {
     __machnet_channel_destroy((void *)channel, *channel_mem_size, shm_fd,
                               *is_posix_shm, channel_name);
@@ -515,10 +845,169 @@ out:
   return channel;
 }
 
+/**
+ * This function maps an existing Machnet channel, e.g., one handed over by
+ * another process, given the descriptor of its shared memory segment. The
+ * descriptor stays open, on failure too.
+ *
+ * @param[in] shm_fd                 The file descriptor of the segment.
+ * @param[out] channel_mem_size      (ptr) The size of the segment.
+ * @param[out] is_posix_shm          (ptr) Set to 1 if this is a POSIX shared
+ * memory segment (not backed by hugetlbfs).
+ * @return                           Pointer to channel's memory area on
+ * success, NULL otherwise.
+ */
+static inline MachnetChannelCtx_t *__machnet_channel_map(
+    int shm_fd, size_t *channel_mem_size, int *is_posix_shm) {
+  assert(channel_mem_size != NULL);
+  assert(is_posix_shm != NULL);
+  MachnetChannelCtx_t *channel;
+  struct stat stat_buf;
+  int shm_flags;
+
+  if (fstat(shm_fd, &stat_buf) == -1) {
+    perror("fstat()");
+    return NULL;
+  }
+
+  // Segments on hugetlbfs report the huge page size as their block size.
+  *is_posix_shm = stat_buf.st_blksize <= getpagesize();
+  shm_flags = MAP_SHARED;
+  if (!*is_posix_shm) shm_flags |= MAP_HUGETLB | MAP_NORESERVE;
+  channel = (MachnetChannelCtx_t *)mmap(
+      NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, shm_flags, shm_fd, 0);
+  if (channel == MAP_FAILED) {
+    perror("mmap()");
+    return NULL;
+  }
+
+  if (channel->magic != MACHNET_CHANNEL_CTX_MAGIC ||
+      channel->size > (size_t)stat_buf.st_size) {
+    fprintf(stderr, "Invalid channel in shared memory segment %d.\n", shm_fd);
+    munmap(channel, stat_buf.st_size);
+    return NULL;
+  }
+
+  // Lock the memory segment in RAM, but for the segments of buffers that are
+  // not attached.
+  size_t hole_ofs, hole_len;
+  __machnet_channel_buf_hole(channel, &hole_ofs, &hole_len);
+  if (__machnet_channel_mem_populate(channel, stat_buf.st_size, hole_ofs,
+                                     hole_len, 1) != 0) {
+    perror("mlock()");
+    munmap(channel, stat_buf.st_size);
+    return NULL;
+  }
+
+  *channel_mem_size = stat_buf.st_size;
+  return channel;
+}
+
+/**
+ * Attach the next segment of default buffers of an elastic channel: allocate
+ * its memory, lock it in RAM, and make its buffers available. Only Machnet
+ * resizes the pool, from a single thread.
+ *
+ * @param[in] ctx                    Channel's context.
+ * @param[in] shm_fd                 The file descriptor of the channel's shared
+ * memory segment.
+ * @return                           0 on success, -1 if the pool has all its
+ * segments already, or there is no memory for another.
+ */
+static inline int __machnet_channel_buf_grow(MachnetChannelCtx_t *ctx,
+                                             int shm_fd) {
+  MachnetChannelDataCtx_t *data_ctx = &ctx->data_ctx;
+  const MachnetChannelBufClass_t *cls = &data_ctx->buf_classes[0];
+  const uint32_t segs_nr = data_ctx->buf_segs_nr;
+  if (segs_nr >= data_ctx->buf_segs_max) return -1;
+
+  const size_t seg_size = (size_t)data_ctx->buf_seg_nr * cls->buf_size;
+  const size_t seg_ofs = cls->pool_ofs + segs_nr * seg_size;
+  if (fallocate(shm_fd, 0, seg_ofs, seg_size) != 0) return -1;
+  if (mlock(__machnet_channel_mem_ofs(ctx, seg_ofs), seg_size) != 0) {
+    fallocate(shm_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, seg_ofs,
+              seg_size);
+    return -1;
+  }
+
+  // The ring has room for the buffers of all the segments.
+  __atomic_store_n(&data_ctx->buf_segs_nr, segs_nr + 1, __ATOMIC_RELEASE);
+  return __machnet_channel_buf_init_range(
+      ctx, 0, cls->first_index + segs_nr * data_ctx->buf_seg_nr,
+      data_ctx->buf_seg_nr);
+}
+
+/**
+ * Release the last segment of default buffers of an elastic channel, if all
+ * its buffers are free in the ring: take them out of it, and give the memory
+ * back. Buffers cached by application threads, or in use, keep the segment.
+ * Only Machnet resizes the pool, from a single thread.
+ *
+ * @param[in] ctx                    Channel's context.
+ * @param[in] shm_fd                 The file descriptor of the channel's shared
+ * memory segment.
+ * @return                           0 on success, -1 if the pool has a single
+ * segment, or some buffer of the last one is not free.
+ */
+static inline int __machnet_channel_buf_shrink(MachnetChannelCtx_t *ctx,
+                                               int shm_fd) {
+  MachnetChannelDataCtx_t *data_ctx = &ctx->data_ctx;
+  const MachnetChannelBufClass_t *cls = &data_ctx->buf_classes[0];
+  const uint32_t segs_nr = data_ctx->buf_segs_nr;
+  const uint32_t seg_nr = data_ctx->buf_seg_nr;
+  if (segs_nr <= 1) return -1;
+  jring_t *ring = __machnet_channel_buf_class_ring(ctx, 0);
+  const uint32_t count = jring_count(ring);
+  if (count < seg_nr) return -1;
+
+  MachnetRingSlot_t *seg_bufs =
+      (MachnetRingSlot_t *)malloc(seg_nr * sizeof(MachnetRingSlot_t));
+  if (seg_bufs == NULL) return -1;
+
+  // Go through the ring once, and set the buffers of the last segment aside.
+  // The application keeps allocating and freeing meanwhile.
+  const uint32_t seg_first = cls->first_index + (segs_nr - 1) * seg_nr;
+  uint32_t found = 0;
+  MachnetRingSlot_t indices[NUM_CACHED_BUFS];
+  for (uint32_t seen = 0; seen < count;) {
+    unsigned int n = count - seen;
+    if (n > COUNT_OF(indices)) n = COUNT_OF(indices);
+    n = jring_mc_dequeue_burst(ring, indices, n, NULL);
+    if (n == 0) break;
+    seen += n;
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      if (indices[i] - seg_first < seg_nr)
+        seg_bufs[found++] = indices[i];
+      else
+        indices[kept++] = indices[i];
+    }
+    // There is room for what was just dequeued.
+    jring_mp_enqueue_bulk(ring, indices, kept, NULL);
+  }
+
+  if (found < seg_nr) {
+    jring_mp_enqueue_bulk(ring, seg_bufs, found, NULL);
+    free(seg_bufs);
+    return -1;
+  }
+  free(seg_bufs);
+
+  const size_t seg_size = (size_t)seg_nr * cls->buf_size;
+  const size_t seg_ofs = cls->pool_ofs + (segs_nr - 1) * seg_size;
+  __atomic_store_n(&data_ctx->buf_segs_nr, segs_nr - 1, __ATOMIC_RELEASE);
+  munlock(__machnet_channel_mem_ofs(ctx, seg_ofs), seg_size);
+  fallocate(shm_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, seg_ofs,
+            seg_size);
+  return 0;
+}
+
 static inline __attribute__((always_inline)) uint32_t __machnet_channel_enqueue(
     const MachnetChannelCtx_t *ctx, unsigned int n,
     const MachnetRingSlot_t *bufs) {
   assert(ctx != NULL);
+  if (__machnet_channel_is_spsc(ctx))
+    return jring2_enqueue_bulk(__machnet_channel_machnet_ring2(ctx), bufs, n);
   jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
 
   return jring_enqueue_bulk(machnet_ring, bufs, n, NULL);
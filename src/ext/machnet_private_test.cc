@@ -11,7 +11,8 @@ TEST(MachnetPrivateTest, NSaasChannelCalcShMemSize) {
   auto calc_func = [](size_t machnet_r_slots, size_t app_r_slots,
                       size_t buf_r_slots, size_t buffer_size) {
     return __machnet_channel_dataplane_calculate_size(
-        machnet_r_slots, app_r_slots, buf_r_slots, buffer_size, 0);
+        machnet_r_slots, app_r_slots, buf_r_slots, 1, buffer_size, nullptr, 0,
+        0, 0, 0);
   };
 
   const uint32_t kMaxCount = std::min(65536u, RING_SZ_MASK);
@@ -41,7 +42,8 @@ TEST(MachnetPrivateTest, NSaasChannelCreateDestroy) {
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, 1, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel_ctx, nullptr);
 
   // Destroy the channel (should succeed).
@@ -61,7 +63,8 @@ TEST(MachnetPrivateTest, NSaasChannelDataplaneInit) {
   int channel_fd;
   MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, 1, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel_ctx, nullptr);
   EXPECT_EQ(channel_ctx->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel_ctx->name), channel_name);
@@ -72,6 +75,47 @@ TEST(MachnetPrivateTest, NSaasChannelDataplaneInit) {
   EXPECT_EQ(channel_fd, -1);
 }
 
+TEST(MachnetPrivateTest, NSaasChannelMap) {
+  const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
+  const std::string channel_name = "test_channel";
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
+      channel_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, 1, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
+  ASSERT_NE(channel_ctx, nullptr);
+
+  // A second mapping, as another process would make from the descriptor,
+  // shares the channel's memory.
+  size_t mapped_size;
+  int mapped_is_posix_shm;
+  auto *mapped_ctx =
+      __machnet_channel_map(channel_fd, &mapped_size, &mapped_is_posix_shm);
+  ASSERT_NE(mapped_ctx, nullptr);
+  EXPECT_NE(mapped_ctx, channel_ctx);
+  EXPECT_EQ(mapped_size, channel_size);
+  EXPECT_EQ(mapped_is_posix_shm, is_posix_shm);
+  EXPECT_EQ(std::string(mapped_ctx->name), channel_name);
+  channel_ctx->ctrl_ctx.req_id = 42;
+  EXPECT_EQ(mapped_ctx->ctrl_ctx.req_id, 42u);
+  munmap(mapped_ctx, mapped_size);
+
+  // Segments that do not hold a channel are refused.
+  const int other_fd = memfd_create("test_not_a_channel", 0);
+  ASSERT_GE(other_fd, 0);
+  ASSERT_EQ(ftruncate(other_fd, channel_size), 0);
+  EXPECT_EQ(__machnet_channel_map(other_fd, &mapped_size, &mapped_is_posix_shm),
+            nullptr);
+  close(other_fd);
+
+  __machnet_channel_destroy(channel_ctx, channel_size, &channel_fd,
+                            is_posix_shm, channel_name.c_str());
+}
+
 TEST(MachnetPrivateTest, NSaasChannelBufAllocFree) {
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
   const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
@@ -84,7 +128,8 @@ TEST(MachnetPrivateTest, NSaasChannelBufAllocFree) {
   int channel_fd;
   auto *channel = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, 1, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel, nullptr);
   EXPECT_EQ(channel->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel->name), channel_name);
@@ -149,7 +194,8 @@ TEST(MachnetBufferPool, Concurrency) {
   int channel_fd;
   auto *channel = __machnet_channel_create(
       channel_name.c_str(), kChannelRingSize, kChannelRingSize,
-      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+      kChannelRingSize, 1, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
   EXPECT_NE(channel, nullptr);
   EXPECT_EQ(channel->magic, MACHNET_CHANNEL_CTX_MAGIC);
   EXPECT_EQ(std::string(channel->name), channel_name);
@@ -244,6 +290,221 @@ TEST(MachnetBufferPool, Concurrency) {
   EXPECT_EQ(channel_fd, -1);
 }
 
+TEST(MachnetPrivateTest, NSaasChannelBufClasses) {
+  const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
+  const MachnetChannelBufClassConf_t kBufClasses[] = {{1 << 8, 200},
+                                                      {1 << 9, 1000}};
+
+  // Classes are smaller than the default buffers, in increasing size.
+  const MachnetChannelBufClassConf_t kUnsorted[] = {{1 << 8, 1000},
+                                                    {1 << 8, 200}};
+  const MachnetChannelBufClassConf_t kTooLarge[] = {{1 << 8, kBufferSize}};
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size(
+                kChannelRingSize, kChannelRingSize, kChannelRingSize, 1,
+                kBufferSize, kUnsorted, 2, 0, 0, 1),
+            std::size_t(-1));
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size(
+                kChannelRingSize, kChannelRingSize, kChannelRingSize, 1,
+                kBufferSize, kTooLarge, 1, 0, 0, 1),
+            std::size_t(-1));
+
+  const std::string channel_name = "test_channel_buf_classes";
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  auto *channel = __machnet_channel_create(
+      channel_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, 1, kBufferSize, kBufClasses, 2, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
+  ASSERT_NE(channel, nullptr);
+  ASSERT_EQ(channel->data_ctx.buf_classes_nr, 3);
+  const uint32_t kTotalBufs =
+      kChannelRingSize - 1 + ((1 << 8) - 1) + ((1 << 9) - 1);
+  EXPECT_EQ(__machnet_channel_buf_count(channel), kTotalBufs);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), kTotalBufs);
+
+  // A length takes the smallest class that holds it.
+  EXPECT_EQ(__machnet_channel_buf_class_for(channel, 1), 1);
+  EXPECT_EQ(__machnet_channel_buf_class_for(channel, 200), 1);
+  EXPECT_EQ(__machnet_channel_buf_class_for(channel, 201), 2);
+  EXPECT_EQ(__machnet_channel_buf_class_for(channel, 1001), 0);
+
+  // Allocate all the buffers of each class.
+  std::vector<MachnetRingSlot_t> all_indices;
+  const uchar_t *pool_end =
+      __machnet_channel_buf_pool(channel) +
+      __machnet_channel_buf_pool_size(channel);
+  for (uint32_t c = 0; c < channel->data_ctx.buf_classes_nr; c++) {
+    const MachnetChannelBufClass_t *cls = &channel->data_ctx.buf_classes[c];
+    if (c > 0) {
+      // Pools and indices of classes follow each other.
+      const MachnetChannelBufClass_t *prev = cls - 1;
+      EXPECT_EQ(cls->pool_ofs, prev->pool_ofs + prev->buf_nr * prev->buf_size);
+      EXPECT_EQ(cls->first_index, prev->first_index + prev->buf_nr);
+      EXPECT_EQ(cls->buf_mss, kBufClasses[c - 1].buffer_size);
+    }
+    std::vector<MachnetRingSlot_t> indices(cls->buf_nr);
+    std::vector<MachnetMsgBuf_t *> bufs(cls->buf_nr);
+    uint32_t n = __machnet_channel_buf_class_alloc_bulk(
+        channel, c, indices.size(), indices.data(), bufs.data());
+    ASSERT_EQ(n, indices.size());
+    for (uint32_t i = 0; i < n; i++) {
+      EXPECT_GE(indices[i], cls->first_index);
+      EXPECT_LT(indices[i], cls->first_index + cls->buf_nr);
+      EXPECT_EQ(bufs[i]->index, indices[i]);
+      EXPECT_EQ(__machnet_channel_buf_index(channel, bufs[i]), indices[i]);
+      EXPECT_GE(__machnet_channel_buf_size(bufs[i]), cls->buf_mss);
+      EXPECT_LE((const uchar_t *)bufs[i] + cls->buf_size, pool_end);
+    }
+    // The class is exhausted, the others are not.
+    EXPECT_EQ(__machnet_channel_buf_class_alloc_bulk(channel, c, 1,
+                                                     indices.data(), nullptr),
+              0);
+    all_indices.insert(all_indices.end(), indices.begin(), indices.end());
+  }
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), 0);
+
+  // Buffers of all classes are freed at once, each to its own class.
+  std::shuffle(all_indices.begin(), all_indices.end(), std::mt19937());
+  EXPECT_EQ(__machnet_channel_buf_free_bulk(channel, all_indices.size(),
+                                            all_indices.data()),
+            kTotalBufs);
+  for (uint32_t c = 0; c < channel->data_ctx.buf_classes_nr; c++) {
+    EXPECT_EQ(jring_count(__machnet_channel_buf_class_ring(channel, c)),
+              channel->data_ctx.buf_classes[c].buf_nr);
+  }
+
+  __machnet_channel_destroy(channel, channel_size, &channel_fd, is_posix_shm,
+                            channel_name.c_str());
+  EXPECT_EQ(channel_fd, -1);
+}
+
+TEST(MachnetPrivateTest, NSaasChannelElasticBufPool) {
+  const uint32_t kChannelRingSize = 1 << 9;  // 512 buffers per segment.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const uint32_t kSegsMax = 4;
+
+  const std::string channel_name = "test_channel_elastic";
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  auto *channel = __machnet_channel_create(
+      channel_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kSegsMax, kBufferSize, nullptr, 0, 0, 0, &channel_size,
+      &is_posix_shm, &channel_fd);
+  ASSERT_NE(channel, nullptr);
+  const uint32_t kSegNr = channel->data_ctx.buf_seg_nr;
+  EXPECT_EQ(kSegNr, kChannelRingSize);
+  EXPECT_EQ(__machnet_channel_buf_count(channel), kSegsMax * kSegNr);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), kSegNr);
+
+  // Only the first segment is backed by memory.
+  const size_t seg_size = kSegNr * channel->data_ctx.buf_size;
+  size_t hole_ofs, hole_len;
+  __machnet_channel_buf_hole(channel, &hole_ofs, &hole_len);
+  EXPECT_EQ(hole_ofs, channel->data_ctx.buf_pool_ofs + seg_size);
+  EXPECT_EQ(hole_len, (kSegsMax - 1) * seg_size);
+  auto backed_size = [channel_fd]() {
+    struct stat st;
+    EXPECT_EQ(fstat(channel_fd, &st), 0);
+    return static_cast<size_t>(st.st_blocks) * 512;
+  };
+  const size_t initial_backed = backed_size();
+  EXPECT_LE(initial_backed, channel_size - hole_len);
+
+  // The single segment stays.
+  EXPECT_EQ(__machnet_channel_buf_shrink(channel, channel_fd), -1);
+
+  // A new segment brings its buffers, and its memory.
+  ASSERT_EQ(__machnet_channel_buf_grow(channel, channel_fd), 0);
+  EXPECT_EQ(channel->data_ctx.buf_segs_nr, 2);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), 2 * kSegNr);
+  EXPECT_EQ(backed_size(), initial_backed + seg_size);
+  std::vector<MachnetRingSlot_t> indices(2 * kSegNr);
+  std::vector<MachnetMsgBuf_t *> bufs(indices.size());
+  ASSERT_EQ(__machnet_channel_buf_alloc_bulk(channel, indices.size(),
+                                             indices.data(), bufs.data()),
+            indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    EXPECT_LT(indices[i], 2 * kSegNr);
+    EXPECT_EQ(bufs[i]->magic, MACHNET_MSGBUF_MAGIC);
+    EXPECT_EQ(bufs[i]->index, indices[i]);
+  }
+
+  // A buffer of the last segment in use keeps it.
+  std::sort(indices.begin(), indices.end());
+  const MachnetRingSlot_t in_use = indices.back();
+  indices.pop_back();
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(channel, indices.size(),
+                                            indices.data()),
+            indices.size());
+  EXPECT_EQ(__machnet_channel_buf_shrink(channel, channel_fd), -1);
+  EXPECT_EQ(channel->data_ctx.buf_segs_nr, 2);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), 2 * kSegNr - 1);
+
+  // Once it is freed, the segment goes, and so does its memory.
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(channel, 1, &in_use), 1);
+  EXPECT_EQ(__machnet_channel_buf_shrink(channel, channel_fd), 0);
+  EXPECT_EQ(channel->data_ctx.buf_segs_nr, 1);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), kSegNr);
+  EXPECT_EQ(backed_size(), initial_backed);
+  indices.resize(kSegNr);
+  ASSERT_EQ(__machnet_channel_buf_alloc_bulk(channel, indices.size(),
+                                             indices.data(), nullptr),
+            indices.size());
+  for (const auto index : indices) EXPECT_LT(index, kSegNr);
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(channel, indices.size(),
+                                            indices.data()),
+            indices.size());
+
+  // The pool grows up to its maximum.
+  for (uint32_t s = 1; s < kSegsMax; s++) {
+    EXPECT_EQ(__machnet_channel_buf_grow(channel, channel_fd), 0);
+  }
+  EXPECT_EQ(__machnet_channel_buf_grow(channel, channel_fd), -1);
+  EXPECT_EQ(__machnet_channel_buffers_avail(channel), kSegsMax * kSegNr);
+  __machnet_channel_buf_hole(channel, &hole_ofs, &hole_len);
+  EXPECT_EQ(hole_len, 0u);
+
+  // Segments must fill whole pages.
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size(
+                kChannelRingSize, kChannelRingSize, 2, kSegsMax, 1 << 8,
+                nullptr, 0, 0, 0, 1),
+            std::size_t(-1));
+
+  __machnet_channel_destroy(channel, channel_size, &channel_fd, is_posix_shm,
+                            channel_name.c_str());
+}
+
+TEST(MachnetLatencyHist, Buckets) {
+  // Buckets are contiguous and increasing, within 25% of their values.
+  for (uint32_t b = 1; b < MACHNET_LATENCY_HIST_BUCKETS; b++) {
+    const uint64_t min = __machnet_latency_hist_bucket_min(b);
+    EXPECT_GT(min, __machnet_latency_hist_bucket_min(b - 1));
+    EXPECT_EQ(__machnet_latency_hist_bucket(min), b);
+    EXPECT_EQ(__machnet_latency_hist_bucket(min - 1), b - 1);
+    if (b >= 4 && b + 1 < MACHNET_LATENCY_HIST_BUCKETS) {
+      EXPECT_LE(__machnet_latency_hist_bucket_min(b + 1), min * 5 / 4);
+    }
+  }
+  EXPECT_EQ(__machnet_latency_hist_bucket(UINT64_MAX),
+            MACHNET_LATENCY_HIST_BUCKETS - 1);
+
+  MachnetLatencyHist_t hist = {};
+  EXPECT_EQ(__machnet_latency_hist_quantile(&hist, 0.5), 0);
+  for (uint64_t ns = 1; ns <= 1000; ns++) {
+    __machnet_latency_hist_record(&hist, ns);
+  }
+  EXPECT_EQ(__machnet_latency_hist_count(&hist), 1000u);
+  const uint64_t p50 = __machnet_latency_hist_quantile(&hist, 0.5);
+  const uint64_t p99 = __machnet_latency_hist_quantile(&hist, 0.99);
+  EXPECT_GE(p50, 500u * 3 / 4);
+  EXPECT_LE(p50, 500u);
+  EXPECT_GE(p99, 990u * 3 / 4);
+  EXPECT_LE(p99, 990u);
+}
+
 int main(int argc, char **argv) {
   ::google::InitGoogleLogging(argv[0]);
   testing::InitGoogleTest(&argc, argv);
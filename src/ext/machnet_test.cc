@@ -8,10 +8,16 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <utils.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <random>
+#include <string>
+#include <thread>
 #include <unordered_set>
 
 #include "machnet_private.h"
@@ -31,6 +37,7 @@ DEFINE_uint64(machnet_slots_nr, 1 << 9, "Number of slots in the Machnet ring.");
 DEFINE_uint64(app_slots_nr, 1 << 9, "Number of slots in the app ring.");
 DEFINE_uint64(buffers_nr, 1 << 13, "Number of message buffers available.");
 DEFINE_uint64(buffer_size, 1 << 11, "Size of each message buffer.");
+DEFINE_uint64(queue_pairs_nr, 4, "Number of per-thread queue pairs.");
 
 // Machnet channel context used
 MachnetChannelCtx_t *g_channel_ctx = nullptr;
@@ -167,13 +174,8 @@ uint32_t bounce_machnet_to_app(const MachnetChannelCtx_t *ctx) {
 // Could be called after each test round, to validate that the buffer pool is in
 // a valid state.
 bool check_buffer_pool(const MachnetChannelCtx_t *ctx) {
-  // Release cached buffers to the pool
-  if (__machnet_channel_buf_free_bulk(ctx, ctx->app_buffer_cache.count,
-                                      ctx->app_buffer_cache.indices) !=
-      ctx->app_buffer_cache.count) {
-    return false;
-  }
-  *__DECONST(uint32_t *, &ctx->app_buffer_cache.count) = 0;
+  // Release the buffers cached by this thread to the pool.
+  machnet_cache_flush(ctx);
 
   jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
   auto nbuffers = buf_ring->capacity;
@@ -224,10 +226,10 @@ TEST(MachnetTest, Bind) {
 
   // Create a POSIX shm channel.
   size_t expected_channel_size = __machnet_channel_dataplane_calculate_size(
-      FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, FLAGS_buffers_nr,
-      FLAGS_buffer_size, 1);
-  ctx = __machnet_channel_posix_create(channel_name, expected_channel_size,
-                                       &shm_fd);
+      FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, FLAGS_buffers_nr, 1,
+      FLAGS_buffer_size, nullptr, 0, FLAGS_queue_pairs_nr, 0, 1);
+  ctx = __machnet_channel_posix_create(channel_name, expected_channel_size, 0,
+                                       0, &shm_fd);
   EXPECT_NE(ctx, nullptr);
   EXPECT_GT(shm_fd, 0);
 
@@ -376,6 +378,800 @@ TEST(MachnetTest, MultiBufferSGSendRecvMsg) {
   }
 }
 
+TEST(MachnetTest, SendMMsg) {
+  std::uniform_int_distribution<uint32_t> msg_len{64, 1 << 14};
+  const uint32_t segments_nr_max = 4;
+
+  // Sends `msgs_nr' messages in one call, with the `invalid'-th being too
+  // large, and checks the ones sent.
+  auto send_and_check = [&](size_t msgs_nr, size_t invalid) {
+    std::vector<std::vector<std::vector<uint8_t>>> tx_segments(msgs_nr);
+    std::vector<std::vector<MachnetIovec_t>> tx_iov(msgs_nr);
+    std::vector<MachnetMsgHdr_t> tx_msghdrs(msgs_nr);
+    MachnetFlow_t flow;
+    for (size_t i = 0; i < msgs_nr; i++) {
+      const uint32_t msg_size = msg_len(mersenne_engine);
+      std::uniform_int_distribution<uint32_t> seg_nr{
+          1, std::min(segments_nr_max, msg_size)};
+      prepare_segments(msg_size, seg_nr(mersenne_engine), &tx_segments[i]);
+      prepare_tx_msg(&flow, &tx_iov[i], &tx_msghdrs[i], &tx_segments[i],
+                     msg_size);
+      if (i == invalid) tx_msghdrs[i].msg_size = MACHNET_MSG_MAX_LEN + 1;
+    }
+    const int sent = machnet_sendmmsg(g_channel_ctx, tx_msghdrs.data(),
+                                      static_cast<int>(msgs_nr));
+    EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), sent);
+    if (sent > 0) {
+      EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), sent);
+    }
+
+    // The messages are received in order.
+    for (int i = 0; i < sent; i++) {
+      std::vector<uint8_t> rx_msg_data(tx_msghdrs[i].msg_size);
+      MachnetFlow_t rx_flow;
+      EXPECT_EQ(machnet_recv(g_channel_ctx, rx_msg_data.data(),
+                             rx_msg_data.size(), &rx_flow),
+                static_cast<ssize_t>(rx_msg_data.size()));
+      std::vector<uint8_t> tx_msg_data;
+      for (const auto &seg : tx_segments[i]) {
+        tx_msg_data.insert(tx_msg_data.end(), seg.begin(), seg.end());
+      }
+      EXPECT_EQ(rx_msg_data, tx_msg_data) << "Msg index: " << i;
+    }
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+    EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+    return sent;
+  };
+
+  for (size_t i = 0; i < 16; i++) EXPECT_EQ(send_and_check(100, 100), 100);
+  // Sending stops at the first invalid message.
+  EXPECT_EQ(send_and_check(100, 40), 40);
+  EXPECT_EQ(send_and_check(100, 0), 0);
+  // Sending stops when the ring is full.
+  const auto app_ring_capacity =
+      __machnet_channel_app_ring(g_channel_ctx)->capacity;
+  EXPECT_EQ(send_and_check(app_ring_capacity + 10, SIZE_MAX),
+            static_cast<int>(app_ring_capacity));
+}
+
+TEST(MachnetTest, RecvMMsg) {
+  const uint32_t kRxMsgSizeMax = 1 << 14;
+  std::uniform_int_distribution<uint32_t> msg_len{2, kRxMsgSizeMax};
+
+  // Sends `msgs_nr' messages, with the `oversized'-th being too large for its
+  // receive descriptor, and receives them with calls of up to `vlen' messages.
+  // Returns the number of calls that failed.
+  auto send_and_check = [&](size_t msgs_nr, size_t oversized, int vlen) {
+    std::vector<std::vector<std::vector<uint8_t>>> tx_segments(msgs_nr);
+    std::vector<std::vector<MachnetIovec_t>> tx_iov(msgs_nr);
+    std::vector<MachnetMsgHdr_t> tx_msghdrs(msgs_nr);
+    MachnetFlow_t flow;
+    for (size_t i = 0; i < msgs_nr; i++) {
+      const uint32_t msg_size =
+          i == oversized ? kRxMsgSizeMax + 1 : msg_len(mersenne_engine);
+      prepare_segments(msg_size, 1, &tx_segments[i]);
+      prepare_tx_msg(&flow, &tx_iov[i], &tx_msghdrs[i], &tx_segments[i],
+                     msg_size);
+    }
+    EXPECT_EQ(machnet_sendmmsg(g_channel_ctx, tx_msghdrs.data(),
+                               static_cast<int>(msgs_nr)),
+              static_cast<int>(msgs_nr));
+    EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), msgs_nr);
+
+    std::vector<std::vector<uint8_t>> rx_bufs(vlen);
+    std::vector<MachnetIovec_t> rx_iov(vlen);
+    std::vector<MachnetMsgHdr_t> rx_msghdrs(vlen);
+    size_t tx_index = 0;
+    int failed_calls = 0;
+    int ret;
+    do {
+      for (int i = 0; i < vlen; i++) {
+        rx_bufs[i].assign(kRxMsgSizeMax, 0);
+        rx_iov[i] = {.base = rx_bufs[i].data(), .len = rx_bufs[i].size()};
+        rx_msghdrs[i].msg_iov = &rx_iov[i];
+        rx_msghdrs[i].msg_iovlen = 1;
+      }
+      ret = machnet_recvmmsg(g_channel_ctx, rx_msghdrs.data(), vlen);
+      EXPECT_LE(ret, vlen);
+      if (ret < 0) failed_calls++;
+
+      // The messages are received in order, skipping the oversized one.
+      for (int i = 0; i < ret; i++, tx_index++) {
+        if (tx_index == oversized) tx_index++;
+        if (tx_index >= msgs_nr) break;
+        const auto &tx_msg = tx_segments[tx_index][0];
+        EXPECT_EQ(rx_msghdrs[i].msg_size, tx_msg.size());
+        rx_bufs[i].resize(rx_msghdrs[i].msg_size);
+        EXPECT_EQ(rx_bufs[i], tx_msg) << "Msg index: " << tx_index;
+        EXPECT_EQ(memcmp(&rx_msghdrs[i].flow_info, &flow, sizeof(flow)), 0);
+      }
+    } while (ret != 0);
+    if (tx_index == oversized) tx_index++;
+    EXPECT_EQ(tx_index, msgs_nr);
+    EXPECT_EQ(__machnet_channel_machnet_ring_pending(g_channel_ctx), 0);
+
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+    EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+    return failed_calls;
+  };
+
+  for (size_t i = 0; i < 16; i++) {
+    EXPECT_EQ(send_and_check(100, SIZE_MAX, 100), 0);
+  }
+  EXPECT_EQ(send_and_check(100, SIZE_MAX, 7), 0);
+  EXPECT_EQ(send_and_check(100, 50, 32), 0);
+  EXPECT_EQ(send_and_check(100, 99, 100), 0);
+
+  // A call whose messages are all dropped fails.
+  EXPECT_EQ(send_and_check(1, 0, 1), 1);
+}
+
+TEST(MachnetTest, ZeroCopySendMsg) {
+  std::uniform_int_distribution<uint32_t> msg_len{1, MACHNET_MSG_MAX_LEN};
+
+  const size_t nr_msgs = 128;
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t alloc_size = msg_len(mersenne_engine);
+    std::vector<MachnetIovec_t> tx_iov(
+        machnet_msg_iovlen(g_channel_ctx, alloc_size));
+    MachnetMsg_t msg;
+    msg.msg_iov = tx_iov.data();
+    msg.msg_iovlen = tx_iov.size() - 1;
+    // Too few segments for the message.
+    EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, alloc_size, &msg), -1);
+    msg.msg_iovlen = tx_iov.size();
+    EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, alloc_size, &msg), 0)
+        << "Msg size: " << alloc_size;
+    EXPECT_EQ(msg.msg_size, alloc_size);
+    EXPECT_EQ(msg.msg_iovlen, tx_iov.size());
+
+    // Write the message in place; every other message is shrunk before being
+    // sent.
+    const uint32_t msg_size =
+        i % 2 ? alloc_size
+              : std::uniform_int_distribution<uint32_t>{1, alloc_size}(
+                    mersenne_engine);
+    std::vector<uint8_t> tx_msg_data(msg_size);
+    std::iota(tx_msg_data.begin(), tx_msg_data.end(), i);
+    uint32_t ofs = 0;
+    for (size_t j = 0; j < msg.msg_iovlen && ofs < msg_size; j++) {
+      const uint32_t nbytes = std::min<size_t>(msg.msg_iov[j].len,
+                                               msg_size - ofs);
+      memcpy(msg.msg_iov[j].base, tx_msg_data.data() + ofs, nbytes);
+      ofs += nbytes;
+    }
+    msg.msg_size = msg_size;
+    msg.flow_info = {.src_ip = UINT32_MAX,
+                     .dst_ip = UINT32_MAX,
+                     .src_port = UINT16_MAX,
+                     .dst_port = UINT16_MAX};
+    msg.flags = 0;
+    EXPECT_EQ(machnet_msg_send(g_channel_ctx, &msg), 0)
+        << "Msg size: " << msg_size;
+    EXPECT_EQ(msg.msg_iovlen, machnet_msg_iovlen(g_channel_ctx, msg_size));
+
+    // Bounce the message back to the application, and check its content.
+    EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+    std::vector<uint8_t> rx_msg_data(msg_size);
+    MachnetIovec_t rx_iov{.base = rx_msg_data.data(), .len = msg_size};
+    MachnetMsgHdr_t rx_msghdr;
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_msghdr.msg_size, msg_size);
+    EXPECT_EQ(rx_msg_data, tx_msg_data) << "Msg size: " << msg_size;
+    EXPECT_EQ(rx_msghdr.flow_info.src_ip, UINT32_MAX);
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx)) << "Msg size: " << msg_size;
+  }
+}
+
+TEST(MachnetTest, ZeroCopyFreeMsg) {
+  const uint32_t msg_size = MACHNET_MSG_MAX_LEN;
+  std::vector<MachnetIovec_t> iov(machnet_msg_iovlen(g_channel_ctx, msg_size));
+  MachnetMsg_t msg;
+  msg.msg_iov = iov.data();
+  msg.msg_iovlen = iov.size();
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, 0, &msg), -1);
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, msg_size + 1, &msg), -1);
+  ASSERT_EQ(machnet_msg_alloc(g_channel_ctx, msg_size, &msg), 0);
+
+  // The message cannot grow past its buffers.
+  msg.msg_size = msg_size + 1;
+  EXPECT_EQ(machnet_msg_send(g_channel_ctx, &msg), -1);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 0);
+  machnet_msg_free(g_channel_ctx, &msg);
+  EXPECT_EQ(msg.msg_iovlen, 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+}
+
+TEST(MachnetTest, MultiThreadedBufferCaches) {
+  const size_t kThreadsNr = 8;
+  const size_t kIterationsNr = 1 << 14;
+  const size_t kMsgsInFlightMax = 4;
+  const uint32_t kMsgSizeMax = 4 * g_channel_ctx->data_ctx.buf_mss;
+
+  // Each thread allocates messages, fills them with its own pattern, and checks
+  // that the pattern is intact before freeing them: no buffer may be handed out
+  // to two threads at a time.
+  auto worker = [&](uint8_t pattern, bool *ok) {
+    std::mt19937 rng(pattern);
+    std::uniform_int_distribution<uint32_t> msg_len{1, kMsgSizeMax};
+    const size_t iovlen = machnet_msg_iovlen(g_channel_ctx, kMsgSizeMax);
+    std::vector<std::vector<MachnetIovec_t>> iov(
+        kMsgsInFlightMax, std::vector<MachnetIovec_t>(iovlen));
+    std::vector<MachnetMsg_t> msgs(kMsgsInFlightMax);
+    *ok = true;
+    for (size_t i = 0; i < kIterationsNr; i++) {
+      auto &msg = msgs[i % kMsgsInFlightMax];
+      if (msg.msg_iovlen != 0) {
+        for (size_t j = 0; j < msg.msg_iovlen; j++) {
+          const auto *data = static_cast<uint8_t *>(msg.msg_iov[j].base);
+          *ok &= std::all_of(data, data + msg.msg_iov[j].len,
+                             [pattern](uint8_t b) { return b == pattern; });
+        }
+        machnet_msg_free(g_channel_ctx, &msg);
+      }
+      msg.msg_iov = iov[i % kMsgsInFlightMax].data();
+      msg.msg_iovlen = iovlen;
+      if (machnet_msg_alloc(g_channel_ctx, msg_len(rng), &msg) != 0) {
+        *ok = false;
+        msg.msg_iovlen = 0;
+        continue;
+      }
+      for (size_t j = 0; j < msg.msg_iovlen; j++) {
+        memset(msg.msg_iov[j].base, pattern, msg.msg_iov[j].len);
+      }
+    }
+    for (auto &msg : msgs) {
+      if (msg.msg_iovlen != 0) machnet_msg_free(g_channel_ctx, &msg);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  bool ok[kThreadsNr];
+  for (size_t i = 0; i < kThreadsNr; i++) {
+    threads.emplace_back(worker, static_cast<uint8_t>(i + 1), &ok[i]);
+  }
+  for (size_t i = 0; i < kThreadsNr; i++) {
+    threads[i].join();
+    EXPECT_TRUE(ok[i]) << "Thread: " << i;
+  }
+
+  // The buffers cached by the threads were returned when they exited.
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+}
+
+TEST(MachnetTest, QueuePairs) {
+  const uint32_t kQueuePairsNr = g_channel_ctx->data_ctx.queue_pairs_nr;
+  ASSERT_GT(kQueuePairsNr, 0u);
+  const MachnetFlow_t kQueueFlow = {.src_ip = 1, .dst_ip = 2, .src_port = 3};
+  const MachnetFlow_t kSharedFlow = {.src_ip = 1, .dst_ip = 2, .src_port = 4};
+  const char kPayload[] = "payload";
+
+  // A bound thread sends on its queue pair.
+  const int queue = machnet_queue_bind(g_channel_ctx);
+  ASSERT_GE(queue, 0);
+  EXPECT_EQ(machnet_queue_bind(g_channel_ctx), queue);
+  EXPECT_EQ(machnet_send(g_channel_ctx, kQueueFlow, kPayload, sizeof(kPayload)),
+            0);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 0);
+  EXPECT_NE(__machnet_channel_engine_pending(g_channel_ctx), 0u);
+
+  // An unbound one on the shared ring.
+  std::thread([&] {
+    EXPECT_EQ(
+        machnet_send(g_channel_ctx, kSharedFlow, kPayload, sizeof(kPayload)),
+        0);
+  }).join();
+  EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 1);
+
+  // Bounce both messages back the way they came.
+  MachnetRingSlot_t head;
+  ASSERT_EQ(
+      __machnet_channel_queue_app_dequeue(g_channel_ctx, queue, 1, &head), 1);
+  EXPECT_EQ(
+      __machnet_channel_queue_machnet_enqueue(g_channel_ctx, queue, 1, &head),
+      1);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  EXPECT_EQ(__machnet_channel_engine_pending(g_channel_ctx), 0);
+
+  // The bound thread receives from its queue pair first, then from the shared
+  // ring.
+  char buf[sizeof(kPayload)];
+  MachnetFlow_t flow;
+  EXPECT_EQ(machnet_recv(g_channel_ctx, buf, sizeof(buf), &flow),
+            static_cast<ssize_t>(sizeof(kPayload)));
+  EXPECT_EQ(flow.src_port, kQueueFlow.src_port);
+  EXPECT_EQ(machnet_recv(g_channel_ctx, buf, sizeof(buf), &flow),
+            static_cast<ssize_t>(sizeof(kPayload)));
+  EXPECT_EQ(flow.src_port, kSharedFlow.src_port);
+  EXPECT_EQ(machnet_recv(g_channel_ctx, buf, sizeof(buf), &flow), 0);
+
+  // Every queue pair goes to one thread at a time, until it exits.
+  std::vector<std::thread> threads;
+  std::vector<int> queues(kQueuePairsNr, -1);
+  std::atomic<uint32_t> bound{0};
+  std::atomic<bool> release{false};
+  for (uint32_t i = 0; i + 1 < kQueuePairsNr; i++) {
+    threads.emplace_back([&, i] {
+      queues[i] = machnet_queue_bind(g_channel_ctx);
+      bound++;
+      while (!release) std::this_thread::yield();
+    });
+  }
+  while (bound != kQueuePairsNr - 1) std::this_thread::yield();
+  std::thread([] { EXPECT_EQ(machnet_queue_bind(g_channel_ctx), -1); }).join();
+  release = true;
+  for (auto &thread : threads) thread.join();
+  queues.back() = queue;
+  std::sort(queues.begin(), queues.end());
+  for (int i = 0; i < static_cast<int>(kQueuePairsNr); i++) {
+    EXPECT_EQ(queues[i], i);
+  }
+  for (uint32_t q = 0; q < kQueuePairsNr; q++) {
+    EXPECT_EQ(__machnet_channel_queue_owned(g_channel_ctx, q) != 0,
+              q == static_cast<uint32_t>(queue));
+  }
+
+  machnet_queue_unbind(g_channel_ctx);
+  EXPECT_EQ(__machnet_channel_queue_owned(g_channel_ctx, queue), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, SpscChannel) {
+  // Create a channel for a single-threaded application.
+  const std::string spsc_channel_name = std::string(channel_name) + ".spsc";
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *ctx = __machnet_channel_create(
+      spsc_channel_name.c_str(), FLAGS_machnet_slots_nr, FLAGS_app_slots_nr,
+      FLAGS_buffers_nr, 1, FLAGS_buffer_size, nullptr, 0, 0,
+      MACHNET_CHANNEL_F_SPSC, &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(ctx, nullptr);
+  EXPECT_TRUE(__machnet_channel_is_spsc(ctx));
+
+  const uint32_t kMsgsNr = 8;
+  const uint32_t kMsgSize = 3 * FLAGS_buffer_size;
+  std::vector<uint8_t> orig_data(kMsgSize);
+  std::iota(orig_data.begin(), orig_data.end(), 0);
+  MachnetIovec_t iov;
+  MachnetMsgHdr_t msghdr;
+  msghdr.flow_info = {.src_ip = 1, .dst_ip = 2, .src_port = 3, .dst_port = 4};
+  msghdr.msg_iov = &iov;
+  msghdr.msg_iovlen = 1;
+  for (uint32_t i = 0; i < kMsgsNr; i++) {
+    iov.base = orig_data.data();
+    iov.len = orig_data.size();
+    msghdr.msg_size = orig_data.size();
+    EXPECT_EQ(machnet_sendmsg(ctx, &msghdr), 0);
+  }
+  EXPECT_EQ(__machnet_channel_app_ring_pending(ctx), kMsgsNr);
+  EXPECT_EQ(__machnet_channel_engine_pending(ctx), kMsgsNr);
+
+  // Bounce the messages back to the application.
+  EXPECT_EQ(bounce_machnet_to_app(ctx), kMsgsNr);
+  EXPECT_EQ(__machnet_channel_app_ring_pending(ctx), 0);
+  EXPECT_EQ(__machnet_channel_machnet_ring_pending(ctx), kMsgsNr);
+
+  std::vector<uint8_t> recv_data(orig_data.size());
+  for (uint32_t i = 0; i < kMsgsNr; i++) {
+    iov.base = recv_data.data();
+    iov.len = recv_data.size();
+    msghdr.msg_size = 0;
+    EXPECT_EQ(machnet_recvmsg(ctx, &msghdr), 1);
+    EXPECT_EQ(msghdr.msg_size, orig_data.size());
+    EXPECT_EQ(recv_data, orig_data);
+  }
+  EXPECT_EQ(machnet_recvmsg(ctx, &msghdr), 0);
+  EXPECT_TRUE(check_buffer_pool(ctx));
+
+  __machnet_channel_destroy(ctx, channel_size, &channel_fd, is_posix_shm,
+                            spsc_channel_name.c_str());
+}
+
+TEST(MachnetTest, ZeroCopyRecvMsg) {
+  std::uniform_int_distribution<uint32_t> msg_len{1, MACHNET_MSG_MAX_LEN};
+  std::vector<MachnetIovec_t> rx_iov(
+      machnet_msg_iovlen(g_channel_ctx, MACHNET_MSG_MAX_LEN));
+  MachnetMsg_t rx_msg;
+  rx_msg.msg_iov = rx_iov.data();
+  rx_msg.msg_iovlen = rx_iov.size();
+  EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &rx_msg), 0);
+
+  const size_t nr_msgs = 128;
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t msg_size = msg_len(mersenne_engine);
+    const uint32_t segments_nr_max = 64;
+    std::uniform_int_distribution<uint32_t> seg_nr{
+        1, std::min(segments_nr_max, msg_size)};
+    std::vector<std::vector<uint8_t>> tx_segments;
+    prepare_segments(msg_size, seg_nr(mersenne_engine), &tx_segments);
+    std::vector<MachnetIovec_t> tx_iov;
+    MachnetFlow_t flow;
+    MachnetMsgHdr_t tx_msghdr;
+    prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, msg_size);
+    EXPECT_EQ(machnet_sendmsg(g_channel_ctx, &tx_msghdr), 0);
+    EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+
+    // Receive the message in place, and check its content.
+    rx_msg.msg_iovlen = rx_iov.size();
+    EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &rx_msg), 1)
+        << "Msg size: " << msg_size;
+    EXPECT_EQ(rx_msg.msg_size, msg_size);
+    EXPECT_EQ(rx_msg.msg_iovlen, machnet_msg_iovlen(g_channel_ctx, msg_size));
+    EXPECT_EQ(memcmp(&rx_msg.flow_info, &flow, sizeof(flow)), 0);
+    std::vector<uint8_t> tx_msg_data, rx_msg_data;
+    for (const auto &seg : tx_segments) {
+      tx_msg_data.insert(tx_msg_data.end(), seg.begin(), seg.end());
+    }
+    for (size_t j = 0; j < rx_msg.msg_iovlen; j++) {
+      const auto *data = static_cast<uint8_t *>(rx_msg.msg_iov[j].base);
+      rx_msg_data.insert(rx_msg_data.end(), data,
+                         data + rx_msg.msg_iov[j].len);
+    }
+    EXPECT_EQ(rx_msg_data, tx_msg_data) << "Msg size: " << msg_size;
+    machnet_msg_release(g_channel_ctx, &rx_msg);
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx)) << "Msg size: " << msg_size;
+  }
+
+  // A message with more buffers than segments provided is dropped.
+  std::vector<uint8_t> data(MACHNET_MSG_MAX_LEN);
+  EXPECT_EQ(machnet_send(g_channel_ctx, {}, data.data(), data.size()), 0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  rx_msg.msg_iovlen = rx_iov.size() - 1;
+  EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &rx_msg), -1);
+  EXPECT_EQ(__machnet_channel_machnet_ring_pending(g_channel_ctx), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+}
+
+TEST(MachnetTest, NotifyWait) {
+  // The channel has no notification.
+  EXPECT_EQ(machnet_notify_fd(g_channel_ctx), -1);
+  EXPECT_EQ(machnet_notify_arm(g_channel_ctx), -1);
+  EXPECT_EQ(machnet_wait(g_channel_ctx, 0), -1);
+
+  const int notify_fd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_GE(notify_fd, 0);
+  g_channel_ctx->doorbell.app_notify_fd = notify_fd;
+  EXPECT_EQ(machnet_notify_fd(g_channel_ctx), notify_fd);
+  auto signaled = [notify_fd]() {
+    struct pollfd pfd = {.fd = notify_fd, .events = POLLIN, .revents = 0};
+    return poll(&pfd, 1, 0) == 1;
+  };
+
+  // Nothing is pending.
+  EXPECT_EQ(machnet_wait(g_channel_ctx, 0), 0);
+  EXPECT_EQ(g_channel_ctx->doorbell.notify_armed, 0);
+
+  // The engine signals the armed notification once, after a delivery.
+  EXPECT_EQ(__machnet_channel_app_wakeup(g_channel_ctx), 0);
+  EXPECT_EQ(machnet_notify_arm(g_channel_ctx), 0);
+  std::vector<uint8_t> tx_msg(64, 0xAB);
+  MachnetFlow_t flow = {};
+  EXPECT_EQ(machnet_send(g_channel_ctx, flow, tx_msg.data(), tx_msg.size()),
+            0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  EXPECT_NE(__machnet_channel_app_wakeup(g_channel_ctx), 0u);
+  EXPECT_EQ(__machnet_channel_app_wakeup(g_channel_ctx), 0);
+  const uint64_t value = 1;
+  EXPECT_EQ(write(notify_fd, &value, sizeof(value)),
+            static_cast<ssize_t>(sizeof(value)));
+  EXPECT_TRUE(signaled());
+  machnet_notify_disarm(g_channel_ctx);
+  EXPECT_FALSE(signaled());
+
+  // The notification is not armed while messages are pending.
+  EXPECT_EQ(machnet_notify_arm(g_channel_ctx), 1);
+  EXPECT_EQ(g_channel_ctx->doorbell.notify_armed, 0);
+  EXPECT_EQ(machnet_wait(g_channel_ctx, -1), 1);
+
+  std::vector<uint8_t> rx_msg(tx_msg.size());
+  EXPECT_EQ(machnet_recv(g_channel_ctx, rx_msg.data(), rx_msg.size(), &flow),
+            static_cast<ssize_t>(rx_msg.size()));
+  EXPECT_EQ(rx_msg, tx_msg);
+  EXPECT_EQ(machnet_wait(g_channel_ctx, 0), 0);
+
+  g_channel_ctx->doorbell.app_notify_fd = -1;
+  close(notify_fd);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, TxCompletions) {
+  MachnetTxCompletion_t compls[8];
+  EXPECT_EQ(machnet_tx_completions(g_channel_ctx, compls, 8), 0);
+
+  // The engine posts completions, which are polled in batches.
+  MachnetTxCompletion_t posted[5] = {};
+  for (uint16_t i = 0; i < 5; i++) {
+    posted[i].flow.dst_port = i;
+    posted[i].msg_len = 100 + i;
+  }
+  posted[4].status = MACHNET_TX_COMPL_DROPPED;
+  EXPECT_EQ(__machnet_channel_tx_compl_enqueue(g_channel_ctx, 5, posted), 5);
+  // Pending completions end waits.
+  EXPECT_EQ(machnet_wait(g_channel_ctx, 0), 1);
+  ASSERT_EQ(machnet_tx_completions(g_channel_ctx, compls, 3), 3);
+  ASSERT_EQ(machnet_tx_completions(g_channel_ctx, compls + 3, 8), 2);
+  for (uint16_t i = 0; i < 5; i++) {
+    EXPECT_EQ(compls[i].flow.dst_port, i);
+    EXPECT_EQ(compls[i].msg_len, 100 + i);
+  }
+  EXPECT_EQ(compls[0].status, MACHNET_TX_COMPL_DELIVERED);
+  EXPECT_EQ(compls[4].status, MACHNET_TX_COMPL_DROPPED);
+  EXPECT_EQ(machnet_tx_completions(g_channel_ctx, compls, 8), 0);
+}
+
+TEST(MachnetTest, FanoutSend) {
+  const uint32_t msg_size = 3 * g_channel_ctx->data_ctx.buf_mss + 100;
+  std::vector<std::vector<uint8_t>> tx_segments;
+  prepare_segments(msg_size, 2, &tx_segments);
+  std::vector<MachnetIovec_t> tx_iov;
+  MachnetFlow_t flow;
+  MachnetMsgHdr_t tx_msghdr;
+  prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, msg_size);
+  std::vector<uint8_t> tx_msg;
+  for (const auto &seg : tx_segments)
+    tx_msg.insert(tx_msg.end(), seg.begin(), seg.end());
+
+  const uint32_t flows_nr = 3;
+  MachnetFlow_t flows[flows_nr];
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    flows[i] = flow;
+    flows[i].dst_port = i;
+  }
+  EXPECT_EQ(machnet_sendmsg_fanout(g_channel_ctx, &tx_msghdr, flows, 0), 0);
+  ASSERT_EQ(machnet_sendmsg_fanout(g_channel_ctx, &tx_msghdr, flows, flows_nr),
+            static_cast<int>(flows_nr));
+
+  // Each flow gets its own message, of aliases of the same payload buffers.
+  MachnetRingSlot_t heads[flows_nr];
+  ASSERT_EQ(__machnet_channel_app_ring_dequeue(g_channel_ctx, flows_nr, heads),
+            flows_nr);
+  std::vector<MachnetRingSlot_t> payload;
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    auto *alias = __machnet_channel_buf(g_channel_ctx, heads[i]);
+    EXPECT_NE(alias->flags & MACHNET_MSGBUF_FLAGS_SYN, 0);
+    EXPECT_EQ(alias->flow.dst_port, i);
+    EXPECT_EQ(alias->msg_len, msg_size);
+    std::vector<uint8_t> rx_msg;
+    std::vector<MachnetRingSlot_t> targets;
+    while (true) {
+      ASSERT_NE(alias->flags & MACHNET_MSGBUF_FLAGS_ALIAS, 0);
+      const auto target_index = __machnet_channel_buf_alias_target(alias);
+      const auto *target = __machnet_channel_buf(g_channel_ctx, target_index);
+      EXPECT_EQ(alias->data_len, target->data_len);
+      EXPECT_EQ(target->refcnt, flows_nr);
+      const auto *data = __machnet_channel_buf_data(target);
+      rx_msg.insert(rx_msg.end(), data, data + target->data_len);
+      targets.push_back(target_index);
+      if (!(alias->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+      alias = __machnet_channel_buf(g_channel_ctx, alias->next);
+    }
+    EXPECT_NE(alias->flags & MACHNET_MSGBUF_FLAGS_FIN, 0);
+    EXPECT_EQ(rx_msg, tx_msg);
+    if (i == 0) payload = targets;
+    EXPECT_EQ(targets, payload);
+  }
+  EXPECT_EQ(payload.size(), 4);
+
+  // Release the aliases as the engine does: the last one of each payload
+  // buffer frees it.
+  for (uint32_t i = 0; i < flows_nr; i++) {
+    MachnetRingSlot_t index = heads[i];
+    while (true) {
+      auto *alias = __machnet_channel_buf(g_channel_ctx, index);
+      auto *target = __machnet_channel_buf(
+          g_channel_ctx, __machnet_channel_buf_alias_target(alias));
+      const bool last_ref = __machnet_channel_buf_unref(target, 1) == 0;
+      EXPECT_EQ(last_ref, i == flows_nr - 1);
+      if (last_ref) {
+        const MachnetRingSlot_t target_index = target->index;
+        ASSERT_EQ(__machnet_channel_buf_free_bulk(g_channel_ctx, 1,
+                                                  &target_index),
+                  1);
+      }
+      const bool more = alias->flags & MACHNET_MSGBUF_FLAGS_SG;
+      const MachnetRingSlot_t next = alias->next;
+      ASSERT_EQ(__machnet_channel_buf_free_bulk(g_channel_ctx, 1, &index), 1);
+      if (!more) break;
+      index = next;
+    }
+  }
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+}
+
+// Echoes requests back, upper-cased.
+int rpc_echo(void *arg, const MachnetFlow_t *flow, const void *req,
+             size_t req_len, MachnetIovec_t *resp) {
+  auto *resp_buf = static_cast<std::string *>(arg);
+  resp_buf->assign(static_cast<const char *>(req), req_len);
+  for (auto &c : *resp_buf) c = toupper(c);
+  resp->base = resp_buf->data();
+  resp->len = resp_buf->size();
+  return 0;
+}
+
+TEST(MachnetTest, RpcCallServe) {
+  MachnetRpcClient_t *rpc = machnet_rpc_client_create(g_channel_ctx, 2);
+  ASSERT_NE(rpc, nullptr);
+  MachnetFlow_t flow = {};
+  std::string echo;
+  char req_buf[64];
+  char resp_bufs[2][16];
+  MachnetRpcCompletion_t compls[4];
+  int cookies[3] = {};
+
+  // Requests and responses loop back through the channel.
+  ASSERT_EQ(machnet_rpc_call(rpc, flow, "hello", 5, resp_bufs[0], 16, 0,
+                             &cookies[0]),
+            0);
+  ASSERT_EQ(machnet_rpc_call(rpc, flow, "rpc over machnet", 16, resp_bufs[1],
+                             8, 0, &cookies[1]),
+            0);
+  // No slot is left.
+  EXPECT_EQ(machnet_rpc_call(rpc, flow, "x", 1, resp_bufs[0], 16, 0, nullptr),
+            -1);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 2);
+  EXPECT_EQ(machnet_rpc_serve(g_channel_ctx, rpc_echo, &echo, req_buf,
+                              sizeof(req_buf), 8),
+            2);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 2);
+  ASSERT_EQ(machnet_rpc_poll(rpc, compls, 4), 2);
+  EXPECT_EQ(compls[0].cookie, &cookies[0]);
+  EXPECT_EQ(compls[0].status, MACHNET_RPC_OK);
+  EXPECT_EQ(std::string(resp_bufs[0], compls[0].resp_len), "HELLO");
+  // The second response did not fit its buffer.
+  EXPECT_EQ(compls[1].cookie, &cookies[1]);
+  EXPECT_EQ(compls[1].status, MACHNET_RPC_OVERFLOW);
+  EXPECT_EQ(compls[1].resp_len, 0);
+
+  // A call times out, and its late response is dropped.
+  ASSERT_EQ(machnet_rpc_call(rpc, flow, "late", 4, resp_bufs[0], 16, 1000,
+                             &cookies[2]),
+            0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  EXPECT_EQ(machnet_rpc_serve(g_channel_ctx, rpc_echo, &echo, req_buf,
+                              sizeof(req_buf), 8),
+            1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  ASSERT_EQ(machnet_rpc_poll(rpc, compls, 4), 1);
+  EXPECT_EQ(compls[0].cookie, &cookies[2]);
+  EXPECT_EQ(compls[0].status, MACHNET_RPC_TIMEOUT);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  ASSERT_EQ(machnet_rpc_call(rpc, flow, "next", 4, resp_bufs[0], 16, 0,
+                             &cookies[0]),
+            0);
+  EXPECT_EQ(machnet_rpc_poll(rpc, compls, 4), 0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+
+  // Plain messages are dropped by servers.
+  MachnetFlow_t plain_flow = {};
+  ASSERT_EQ(machnet_send(g_channel_ctx, plain_flow, "plain", 5), 0);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  EXPECT_EQ(machnet_rpc_serve(g_channel_ctx, rpc_echo, &echo, req_buf,
+                              sizeof(req_buf), 8),
+            1);
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+  ASSERT_EQ(machnet_rpc_poll(rpc, compls, 4), 1);
+  EXPECT_EQ(compls[0].cookie, &cookies[0]);
+  EXPECT_EQ(std::string(resp_bufs[0], compls[0].resp_len), "NEXT");
+
+  machnet_rpc_client_destroy(rpc);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, ControlRequests) {
+  // A thread plays the engine, completing control requests as they come.
+  std::atomic<bool> stop{false};
+  std::thread engine([&stop]() {
+    while (!stop.load()) {
+      MachnetCtrlQueueEntry_t req;
+      if (__machnet_channel_ctrl_sq_dequeue(g_channel_ctx, 1, &req) != 1)
+        continue;
+      MachnetCtrlQueueEntry_t resp = {};
+      resp.id = req.id;
+      resp.opcode = MACHNET_CTRL_OP_STATUS;
+      resp.status = MACHNET_CTRL_STATUS_OK;
+      if (req.opcode == MACHNET_CTRL_OP_CREATE_FLOW) {
+        resp.flow_info = req.flow_info;
+        resp.flow_info.src_port = 1234;
+      }
+      while (__machnet_channel_ctrl_cq_enqueue(g_channel_ctx, 1, &resp) != 1) {
+      }
+    }
+  });
+
+  // Requests complete as soon as the engine serves them.
+  const auto start = std::chrono::steady_clock::now();
+  MachnetFlow_t flow;
+  EXPECT_EQ(machnet_connect(g_channel_ctx, "10.0.0.1", "10.0.0.2", 888, &flow),
+            0);
+  EXPECT_EQ(flow.dst_port, 888);
+  EXPECT_EQ(flow.src_port, 1234);
+  EXPECT_EQ(machnet_listen(g_channel_ctx, "10.0.0.1", 888), 0);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+  stop.store(true);
+  engine.join();
+}
+
+TEST(MachnetTest, PooledFlows) {
+  // A thread plays the engine, creating flows with increasing source ports.
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> created{0};
+  std::thread engine([&stop, &created]() {
+    while (!stop.load()) {
+      MachnetCtrlQueueEntry_t req;
+      if (__machnet_channel_ctrl_sq_dequeue(g_channel_ctx, 1, &req) != 1)
+        continue;
+      MachnetCtrlQueueEntry_t resp = {};
+      resp.id = req.id;
+      resp.opcode = MACHNET_CTRL_OP_STATUS;
+      resp.status = MACHNET_CTRL_STATUS_ERROR;
+      if (req.opcode == MACHNET_CTRL_OP_CREATE_FLOW &&
+          (req.flags & MACHNET_CTRL_FLAG_KEEPALIVE)) {
+        resp.status = MACHNET_CTRL_STATUS_OK;
+        resp.flow_info = req.flow_info;
+        resp.flow_info.src_port = 1000 + created.fetch_add(1);
+      }
+      while (__machnet_channel_ctrl_cq_enqueue(g_channel_ctx, 1, &resp) != 1) {
+      }
+    }
+  });
+
+  MachnetFlow_t flow, other_flow;
+  EXPECT_EQ(machnet_connect_pooled(g_channel_ctx, "10.0.0.1", "10.0.0.2", 888,
+                                   &flow),
+            0);
+  EXPECT_EQ(created.load(), 1);
+
+  // A released flow is reused, without a request to the engine, only for the
+  // same peer.
+  EXPECT_EQ(machnet_flow_release(g_channel_ctx, &flow), 0);
+  EXPECT_EQ(machnet_connect_pooled(g_channel_ctx, "10.0.0.1", "10.0.0.2", 999,
+                                   &other_flow),
+            0);
+  EXPECT_EQ(created.load(), 2);
+  EXPECT_EQ(machnet_connect_pooled(g_channel_ctx, "10.0.0.1", "10.0.0.2", 888,
+                                   &other_flow),
+            0);
+  EXPECT_EQ(created.load(), 2);
+  EXPECT_EQ(other_flow.src_port, flow.src_port);
+
+  // A flow the engine reports closed leaves the pool. No request is pending,
+  // so the engine thread does not write to the completion queue meanwhile.
+  EXPECT_EQ(machnet_flow_release(g_channel_ctx, &flow), 0);
+  MachnetCtrlQueueEntry_t notice = {};
+  notice.opcode = MACHNET_CTRL_OP_FLOW_CLOSED;
+  notice.flow_info = flow;
+  EXPECT_EQ(__machnet_channel_ctrl_cq_enqueue(g_channel_ctx, 1, &notice), 1);
+  EXPECT_EQ(machnet_connect_pooled(g_channel_ctx, "10.0.0.1", "10.0.0.2", 888,
+                                   &other_flow),
+            0);
+  EXPECT_EQ(created.load(), 3);
+  EXPECT_NE(other_flow.src_port, flow.src_port);
+
+  stop.store(true);
+  engine.join();
+}
+
+TEST(MachnetTest, Priority) {
+  auto *ctx = static_cast<MachnetChannelCtx_t *>(g_channel_ctx);
+  EXPECT_EQ(ctx->prio, MACHNET_PRIO_NORMAL);
+  EXPECT_EQ(machnet_set_priority(g_channel_ctx, MACHNET_PRIO_CLASSES_NR),
+            -EINVAL);
+  EXPECT_EQ(ctx->prio, MACHNET_PRIO_NORMAL);
+  EXPECT_EQ(machnet_set_priority(g_channel_ctx, MACHNET_PRIO_BULK), 0);
+  EXPECT_EQ(ctx->prio, MACHNET_PRIO_BULK);
+  EXPECT_EQ(machnet_set_priority(g_channel_ctx, MACHNET_PRIO_NORMAL), 0);
+}
+
 TEST(MachnetTest, InvalidSendRecv) {
   // Message length generator.
   std::uniform_int_distribution<uint32_t> invalid_msg_len{
@@ -445,10 +1241,10 @@ int main(int argc, char **argv) {
   size_t channel_size;
   int is_posix_shm;
   int channel_fd;
-  g_channel_ctx = __machnet_channel_create(channel_name, FLAGS_machnet_slots_nr,
-                                           FLAGS_app_slots_nr, FLAGS_buffers_nr,
-                                           FLAGS_buffer_size, &channel_size,
-                                           &is_posix_shm, &channel_fd);
+  g_channel_ctx = __machnet_channel_create(
+      channel_name, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr,
+      FLAGS_buffers_nr, 1, FLAGS_buffer_size, nullptr, 0, FLAGS_queue_pairs_nr,
+      0, &channel_size, &is_posix_shm, &channel_fd);
   if (g_channel_ctx == nullptr) return -1;
 
   int ret = RUN_ALL_TESTS();
@@ -0,0 +1,145 @@
+/**
+ * @file af_xdp.h
+ * @brief Ports on AF_XDP sockets, through DPDK's `net_af_xdp' driver, for
+ * hosts where no NIC can be handed to DPDK (e.g., VMs without SR-IOV
+ * passthrough, or containers): the kernel side of such ports.
+ */
+#ifndef SRC_INCLUDE_AF_XDP_H_
+#define SRC_INCLUDE_AF_XDP_H_
+
+#include <ether.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief Helpers for ports on AF_XDP sockets. The NIC stays with its kernel
+ * driver, and so do the traffic of the host and its control protocols (e.g.,
+ * ARP): an XDP program (see `machnet_xdp.c') redirects the UDP packets to the
+ * ports Machnet uses (see `XdpPortMap') to the AF_XDP socket of their RX
+ * queue, one per engine, and passes everything else to the kernel.
+ *
+ * The sockets share their memory (UMEM) with the packet pools of the RX
+ * queues, so packets are received without copies, and are busy-polled from
+ * the engines' threads. Channel buffers cannot back the UMEM, which is fixed
+ * once the sockets are bound, so zero-copy RX into channels (see
+ * `MachnetEngine::SetRxZeroCopy') is not available; TX packets that carry
+ * channel buffers are copied into the UMEM by the driver.
+ *
+ * All methods are static, and most need `CAP_NET_ADMIN'.
+ */
+class AfXdp {
+ public:
+  using Neighbors = std::vector<std::pair<net::Ipv4::Address,
+                                          net::Ethernet::Address>>;
+  static constexpr char kDriverName[] = "net_af_xdp";
+  // File of the XDP program, next to the Machnet executable by default.
+  static constexpr char kProgName[] = "machnet_xdp.o";
+  // The map of the ports the XDP program steers, pinned by name on load.
+  static constexpr char kPortMapPath[] = "/sys/fs/bpf/machnet_ports";
+  // NAPI settings under which the kernel defers to busy polling (see the
+  // kernel's "preferred busy polling"): interrupts stay masked for a few
+  // empty polls, and for up to the timeout.
+  static constexpr uint32_t kNapiDeferHardIrqs = 2;
+  static constexpr uint32_t kGroFlushTimeoutNs = 200000;
+
+  /**
+   * @brief Returns the EAL `--vdev' argument of a port on the interface
+   * `ifname', with a socket on each of its first `queues_nr' queues.
+   *
+   * @param busy_budget Packets a busy poll processes at most; 0 disables
+   *                    busy polling.
+   * @param prog_path   The XDP program (see `GetDefaultProgPath').
+   */
+  static std::string GetVdevArgs(const std::string &ifname,
+                                 uint16_t queues_nr, uint32_t busy_budget,
+                                 const std::string &prog_path);
+
+  // Path of `kProgName' in the directory of the running executable.
+  static std::string GetDefaultProgPath();
+
+  /**
+   * @brief Prepares the interface `ifname' before its port starts: RSS spreads
+   * packets over the first `queues_nr' queues only (those with a socket), and
+   * hashes UDP packets on their ports as well, so that the engines can pick
+   * the local ports of their flows (see `PmdPort::GetRSSReta'); the NAPI
+   * settings favor busy polling; the XDP program of a previous run, if any,
+   * is detached.
+   *
+   * @return False if RSS cannot be set up so; the other steps are best
+   * effort.
+   */
+  static bool PrepareInterface(const std::string &ifname, uint16_t queues_nr);
+
+  /**
+   * @brief Reads the RSS configuration of the interface from the kernel,
+   * where the driver hashes with Toeplitz.
+   *
+   * @param key  The RSS key.
+   * @param reta The RX queue of each RSS hash bucket.
+   * @return False if the configuration cannot be read, or the hash is not
+   * Toeplitz.
+   */
+  static bool GetRssConf(const std::string &ifname, std::vector<uint8_t> *key,
+                         std::vector<uint16_t> *reta);
+
+  // Returns the neighbors the kernel resolved on the interface.
+  static Neighbors GetNeighbors(const std::string &ifname);
+  // Parses the neighbors on `ifname' from a table in `/proc/net/arp' format.
+  static Neighbors ParseNeighbors(std::istream *arp_table,
+                                  const std::string &ifname);
+
+  /**
+   * @brief Has the kernel resolve the L2 address of `ip_addr' on the
+   * interface, asynchronously, as if it were to send it a packet; the address
+   * shows up in `GetNeighbors' once resolved.
+   * @return False if the request failed.
+   */
+  static bool ResolveNeighbor(const std::string &ifname,
+                              const net::Ipv4::Address &ip_addr);
+};
+
+/**
+ * @brief The map of the UDP ports whose packets the XDP program of AF_XDP
+ * ports steers to Machnet (see `AfXdp'), shared by all of them. Ports are
+ * added as listeners and flows take them, and removed when released (see
+ * `MachnetEngineSharedState::SetXdpPortMap'); packets to other ports go to
+ * the kernel.
+ *
+ * Thread-safe: updates are single system calls.
+ */
+class XdpPortMap {
+ public:
+  /**
+   * @brief Opens the map pinned at `path', once the XDP program is loaded
+   * (i.e., the port started).
+   * @return The map, or nullptr on failure.
+   */
+  static std::unique_ptr<XdpPortMap> Open(
+      const std::string &path = AfXdp::kPortMapPath);
+
+  explicit XdpPortMap(int fd) : fd_(fd) {}
+  XdpPortMap(const XdpPortMap &) = delete;
+  XdpPortMap &operator=(const XdpPortMap &) = delete;
+  ~XdpPortMap();
+
+  // Steers the packets to `port' to Machnet, or to the kernel.
+  bool Set(uint16_t port, bool steer);
+
+ private:
+  const int fd_;
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_AF_XDP_H_
@@ -12,7 +12,10 @@
 #include <ipv4.h>
 #include <packet.h>
 #include <pmd.h>
+#include <ttime.h>
 
+#include <functional>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace juggler {
@@ -69,6 +72,9 @@ static_assert(sizeof(Arp) == 28, "Arp size mismatch");
  * @brief This class implements a minimal ARP layer. It is used to resolve IP
  * addresses to MAC addresses.
  *
+ * Learned entries age (see `Age'); static entries (see `AddStaticEntry') do
+ * not, and replies never override them.
+ *
  * This class is not thread-safe.
  *
  * NOTE: No IPv6 support yet.
@@ -101,6 +107,30 @@ class ArpHandler {
     local_ip_addrs_.insert(ip_addr);
   }
 
+  /**
+   * @brief Adds a static entry to the cache, for a neighbor that is not (or
+   * slowly) resolved with ARP. Static entries never expire.
+   *
+   * @param ip_addr The IP address of the neighbor.
+   * @param l2addr  The MAC address of the neighbor.
+   */
+  void AddStaticEntry(const Ipv4::Address &ip_addr,
+                      const Ethernet::Address &l2addr) {
+    arp_table_[ip_addr] = {l2addr, Ipv4::Address(), kStatic, 0};
+    version_++;
+  }
+
+  /**
+   * @brief Adds or renews a learned entry, resolved by other means than the
+   * ARP packets of the handler (e.g., by the kernel); it ages as any other.
+   *
+   * @param local_ip The local IP address to refresh the entry from.
+   */
+  void AddEntry(const Ipv4::Address &ip_addr, const Ethernet::Address &l2addr,
+                const Ipv4::Address &local_ip) {
+    Learn(ip_addr, l2addr, local_ip);
+  }
+
   /**
    * @brief This method is called to issue an ARP who-has request in the LAN.
    * The system owning the remote IP needs to respond with an ARP reply.
@@ -180,6 +210,21 @@ class ArpHandler {
     LOG_IF(WARNING, nb_tx != 1) << "Failed to send ARP reply";
   }
 
+  /**
+   * @brief Looks up a target IP's MAC address in the cache, without issuing a
+   * request if it is missing (see `GetL2Addr').
+   *
+   * @param target_ip The IP address of the target machine.
+   * @return The MAC address of the target machine, if found in the cache, or
+   *        `std::nullopt` otherwise.
+   */
+  std::optional<Ethernet::Address> LookupL2Addr(
+      const Ipv4::Address &target_ip) const {
+    const auto it = arp_table_.find(target_ip);
+    if (it == arp_table_.end()) return std::nullopt;
+    return it->second.l2addr;
+  }
+
   /**
    * @brief This method is being called to resolve a target IP's MAC address.
    *
@@ -193,8 +238,8 @@ class ArpHandler {
   std::optional<Ethernet::Address> GetL2Addr(const dpdk::TxRing *txring,
                                              const Ipv4::Address &local_ip,
                                              const Ipv4::Address &target_ip) {
-    if (arp_table_.find(target_ip) != arp_table_.end()) {
-      return arp_table_[target_ip];
+    if (auto l2addr = LookupL2Addr(target_ip); l2addr.has_value()) {
+      return l2addr;
     }
 
     // Destination L2 Adress not found in the cache; issue an ARP who-has
@@ -242,12 +287,14 @@ class ArpHandler {
         // Check if this request is for us.
         if (local_ip_addrs_.find(target_ip) == local_ip_addrs_.end()) break;
         Reply(txring, arph, target_ip);
+        // The sender is likely to be talked to next; learn its address too.
+        Learn(arph->ipv4_data.spa, arph->ipv4_data.sha, target_ip);
         break;
       case Arp::ArpOp::kReply:
         // Check if the ARP reply is for us.
         if (local_ip_addrs_.find(target_ip) == local_ip_addrs_.end()) break;
         // Update the cache.
-        arp_table_[arph->ipv4_data.spa] = arph->ipv4_data.sha;
+        Learn(arph->ipv4_data.spa, arph->ipv4_data.sha, target_ip);
         break;
       default:
         LOG(WARNING) << "Received ARP packet with unsupported operation.";
@@ -255,11 +302,77 @@ class ArpHandler {
     }
   }
 
+  /**
+   * @brief Ages the learned entries of the cache: refreshes those about to
+   * expire with an ARP request, ahead of their expiry, and drops those that
+   * expired.
+   *
+   * @param txring         The Tx ring to use for sending ARP requests.
+   * @param now            The current TSC.
+   * @param refresh_cycles Age (in TSC cycles) from which an entry is
+   *                       refreshed; a refresh is retried every quarter of the
+   *                       time left until expiry.
+   * @param expiry_cycles  Age (in TSC cycles) at which an entry expires.
+   * @param refresh        Refreshes an entry, from its local IP address,
+   *                       instead of an ARP request (e.g., through the
+   *                       kernel).
+   */
+  void Age(const dpdk::TxRing *txring, uint64_t now, uint64_t refresh_cycles,
+           uint64_t expiry_cycles,
+           const std::function<void(const Ipv4::Address &local_ip,
+                                    const Ipv4::Address &target_ip)>
+               &refresh = nullptr) {
+    DCHECK_LT(refresh_cycles, expiry_cycles);
+    const auto retry_cycles = (expiry_cycles - refresh_cycles) / 4;
+    for (auto it = arp_table_.begin(); it != arp_table_.end();) {
+      auto &entry = it->second;
+      const auto age = now - entry.updated;
+      if (entry.updated == kStatic || age < refresh_cycles) {
+        it++;
+        continue;
+      }
+      if (age >= expiry_cycles) {
+        LOG(INFO) << "ARP entry " << it->first.ToString() << " -> "
+                  << entry.l2addr.ToString() << " expired";
+        it = arp_table_.erase(it);
+        version_++;
+        continue;
+      }
+      if (now - entry.refreshed >= retry_cycles) {
+        if (refresh) {
+          refresh(entry.local_ip, it->first);
+        } else {
+          RequestL2Addr(txring, entry.local_ip, it->first);
+        }
+        entry.refreshed = now;
+      }
+      it++;
+    }
+  }
+
+  /**
+   * @brief Returns the version of the cache, which changes whenever an entry
+   * is added, changed or removed.
+   */
+  uint64_t GetVersion() const { return version_; }
+
+  /**
+   * @brief Returns a copy of the cache (IP to MAC address).
+   */
+  std::unordered_map<Ipv4::Address, Ethernet::Address> GetL2Addrs() const {
+    std::unordered_map<Ipv4::Address, Ethernet::Address> l2addrs;
+    for (const auto &[ip_addr, entry] : arp_table_) {
+      l2addrs.emplace(ip_addr, entry.l2addr);
+    }
+    return l2addrs;
+  }
+
   std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() const {
     std::vector<std::tuple<std::string, std::string>> arp_table;
     for (auto &kv : arp_table_) {
       std::string ip_addr = kv.first.ToString();
-      std::string l2_addr = kv.second.ToString();
+      std::string l2_addr = kv.second.l2addr.ToString();
+      if (kv.second.updated == kStatic) l2_addr += " (static)";
       arp_table.emplace_back(ip_addr, l2_addr);
     }
     return arp_table;
@@ -268,9 +381,35 @@ class ArpHandler {
   size_t GetArpTableSize() const { return arp_table_.size(); }
 
  private:
+  // Update time of the static entries.
+  static constexpr uint64_t kStatic = 0;
+  struct Entry {
+    Ethernet::Address l2addr;
+    // The local IP address the entry was learned on, to refresh it from.
+    Ipv4::Address local_ip;
+    // TSC of the last update of the entry, or `kStatic'.
+    uint64_t updated;
+    // TSC of the last refresh request for the entry (see `Age').
+    uint64_t refreshed;
+  };
+
+  /**
+   * @brief Adds or renews a learned entry, unless the IP address has a static
+   * entry.
+   */
+  void Learn(const Ipv4::Address &ip_addr, const Ethernet::Address &l2addr,
+             const Ipv4::Address &local_ip) {
+    auto [it, inserted] = arp_table_.try_emplace(ip_addr);
+    auto &entry = it->second;
+    if (!inserted && entry.updated == kStatic) return;
+    if (inserted || entry.l2addr != l2addr) version_++;
+    entry = {l2addr, local_ip, time::rdtsc(), 0};
+  }
+
   const Ethernet::Address local_l2addr_;
   std::unordered_set<Ipv4::Address> local_ip_addrs_;
-  std::unordered_map<Ipv4::Address, Ethernet::Address> arp_table_{};
+  std::unordered_map<Ipv4::Address, Entry> arp_table_{};
+  uint64_t version_{0};
 };
 
 }  // namespace juggler
@@ -5,8 +5,17 @@
 #ifndef SRC_INCLUDE_CC_H_
 #define SRC_INCLUDE_CC_H_
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
 #include <vector>
 
 #include "utils.h"
@@ -32,21 +41,536 @@ constexpr bool seqno_gt(uint32_t a, uint32_t b) {
 }
 
 /**
- * @brief Swift Congestion Control (SWCC) protocol control block.
+ * @brief Congestion control algorithms a flow may use. The values match the
+ * `MACHNET_CC_*' constants applications select them with.
+ */
+enum class Algorithm : uint16_t {
+  kSwift = 1,
+  kEcn = 2,
+  kFixedWindow = 3,
+};
+
+/**
+ * @brief Looks up an algorithm by its name ("swift", "ecn" or "fixed").
+ * @return The algorithm, or std::nullopt if the name is unknown.
+ */
+inline std::optional<Algorithm> AlgorithmFromString(std::string_view name) {
+  if (name == "swift") return Algorithm::kSwift;
+  if (name == "ecn") return Algorithm::kEcn;
+  if (name == "fixed") return Algorithm::kFixedWindow;
+  return std::nullopt;
+}
+
+inline const char *AlgorithmToString(Algorithm algorithm) {
+  switch (algorithm) {
+    case Algorithm::kSwift:
+      return "swift";
+    case Algorithm::kEcn:
+      return "ecn";
+    case Algorithm::kFixedWindow:
+      return "fixed";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief What a flow learns from an ACK, for congestion control.
+ */
+struct AckSample {
+  // Current time (ns).
+  uint64_t now_ns;
+  // Number of packets newly acknowledged (0 for a duplicate ACK).
+  uint32_t acked_nr;
+  // Number of acknowledged packets that arrived with an ECN CE mark.
+  uint32_t ce_nr;
+  // Whether the delays below are valid, i.e., the ACK echoed a timestamp.
+  bool has_delay;
+  // Round-trip time, and the parts of it spent in the network and queued at
+  // the hosts (ns).
+  uint64_t rtt_ns;
+  uint64_t fabric_ns;
+  uint64_t endpoint_ns;
+  // Number of hops on the path.
+  uint32_t hops;
+};
+
+/**
+ * @brief Interface of a congestion control policy: it is fed the ACKs and
+ * losses of a flow, and decides how many packets the flow may have in flight
+ * and how far apart to send them.
+ */
+template <typename T>
+concept CongestionControl = requires(T cc, const T &ccc,
+                                     const AckSample &sample, uint64_t now_ns,
+                                     uint32_t window) {
+  // Packets that may be in flight (at least one).
+  { ccc.GetWindow() } -> std::same_as<uint32_t>;
+  // Minimum time between packet transmissions (ns); zero if unpaced.
+  { ccc.GetPacingDelayNs() } -> std::same_as<uint64_t>;
+  // Average time between packets at the rate of the policy, one window per
+  // RTT (ns); zero if unknown. Used to pace flows whose window is not small.
+  { ccc.GetPacingIntervalNs() } -> std::same_as<uint64_t>;
+  // Whether data packets should be sent ECN-capable.
+  { ccc.UsesEcn() } -> std::same_as<bool>;
+  cc.OnAck(sample);
+  cc.OnFastRetransmit(now_ns);
+  cc.OnRetransmitTimeout(now_ns);
+  // Caps the window, e.g., to the window negotiated with the receiver.
+  cc.SetMaxWindow(window);
+  { ccc.ToString() } -> std::same_as<std::string>;
+};
+
+/**
+ * @brief Swift delay-based congestion control (Kumar et al., "Swift: Delay is
+ * Simple and Effective for Congestion Control in the Datacenter", SIGCOMM
+ * 2020).
+ *
+ * Every ACK carries a delay sample, taken from the timestamp of the data
+ * packet it acknowledges. Swift keeps two windows and uses the smaller one:
+ *  - A fabric window, driven by the network delay (RTT minus the time spent at
+ *    either end). Its target grows with the number of hops on the path, and
+ *    is larger for small windows (flow scaling), so that many flows converge
+ *    to a fair share in incast.
+ *  - An endpoint window, driven by the time packets waited at the hosts, with
+ *    a fixed target.
+ * Below its target, a window grows additively by `ai' packets per RTT. Above
+ * it, the window shrinks in proportion to the excess delay, by at most
+ * `max_mdf', and at most once per RTT. Retransmissions also shrink the
+ * window; repeated timeouts reset it to the minimum.
+ *
+ * Windows may drop below one packet. The sender then has at most one packet
+ * in flight, and sends packets `GetPacingDelayNs()' apart.
+ *
+ * All times are in nanoseconds. This class is not thread-safe.
+ */
+class Swift {
+ public:
+  struct Params {
+    double initial_cwnd = 32;
+    double min_cwnd = 0.001;
+    // Default cap of the window, i.e., the default receive window of a flow;
+    // `SetMaxWindow' replaces it with the window the flow negotiated.
+    double max_cwnd = 256;
+    // Additive increase, in packets per RTT.
+    double ai = 1;
+    // Multiplicative decrease: the gain on the excess delay, and the maximum
+    // decrease (as a fraction of the window) on any single event.
+    double beta = 0.8;
+    double max_mdf = 0.5;
+    // Fabric delay target: base plus a per-hop allowance, plus up to
+    // `fs_range_ns' for windows between `fs_max_cwnd' and `fs_min_cwnd'.
+    uint64_t fabric_base_target_ns = 50'000;
+    uint64_t hop_scale_ns = 1'000;
+    uint64_t fs_range_ns = 50'000;
+    double fs_min_cwnd = 0.1;
+    double fs_max_cwnd = 100;
+    // Endpoint delay target.
+    uint64_t endpoint_target_ns = 25'000;
+    // Consecutive timeouts after which the window is reset to the minimum.
+    uint32_t retx_reset_threshold = 5;
+  };
+
+  Swift() : Swift(Params()) {}
+  explicit Swift(const Params &params)
+      : params_(params),
+        fabric_cwnd_(params.initial_cwnd),
+        endpoint_cwnd_(params.initial_cwnd),
+        max_cwnd_(params.max_cwnd),
+        fs_alpha_(params.fs_range_ns / (1 / std::sqrt(params.fs_min_cwnd) -
+                                        1 / std::sqrt(params.fs_max_cwnd))),
+        fs_beta_(-fs_alpha_ / std::sqrt(params.fs_max_cwnd)) {}
+
+  const Params &GetParams() const { return params_; }
+
+  // The congestion window, in packets (may be fractional).
+  double GetCwnd() const { return std::min(fabric_cwnd_, endpoint_cwnd_); }
+
+  // The window as a number of packets that may be in flight (at least one).
+  uint32_t GetWindow() const {
+    return std::max(static_cast<uint32_t>(GetCwnd()), 1u);
+  }
+
+  // Time between packet transmissions when the window is below one packet;
+  // zero otherwise.
+  uint64_t GetPacingDelayNs() const {
+    const auto cwnd = GetCwnd();
+    if (cwnd >= 1 || srtt_ns_ == 0) return 0;
+    return static_cast<uint64_t>(srtt_ns_ / cwnd);
+  }
+  uint64_t GetPacingIntervalNs() const {
+    return static_cast<uint64_t>(srtt_ns_ / GetCwnd());
+  }
+
+  uint64_t GetSmoothedRttNs() const { return srtt_ns_; }
+
+  // The current fabric delay target, for a path of `hops' hops.
+  uint64_t GetFabricTargetNs(uint32_t hops) const {
+    const double fs = std::clamp(fs_alpha_ / std::sqrt(fabric_cwnd_) + fs_beta_,
+                                 0.0, static_cast<double>(params_.fs_range_ns));
+    return params_.fabric_base_target_ns + hops * params_.hop_scale_ns +
+           static_cast<uint64_t>(fs);
+  }
+
+  bool UsesEcn() const { return false; }
+
+  /**
+   * @brief Updates the windows on an ACK. ACKs without a delay sample (e.g.,
+   * from a peer that does not timestamp packets) only grow the windows.
+   */
+  void OnAck(const AckSample &sample) {
+    retransmits_nr_ = 0;
+    if (!sample.has_delay) {
+      Increase(&fabric_cwnd_, sample.acked_nr);
+      Increase(&endpoint_cwnd_, sample.acked_nr);
+      return;
+    }
+    srtt_ns_ =
+        srtt_ns_ == 0 ? sample.rtt_ns : (7 * srtt_ns_ + sample.rtt_ns) / 8;
+    const bool can_decrease = CanDecrease(sample.now_ns);
+    bool decreased =
+        Update(&fabric_cwnd_, sample.acked_nr, sample.fabric_ns,
+               GetFabricTargetNs(sample.hops), can_decrease);
+    decreased |= Update(&endpoint_cwnd_, sample.acked_nr, sample.endpoint_ns,
+                        params_.endpoint_target_ns, can_decrease);
+    if (decreased) last_decrease_ns_ = sample.now_ns;
+  }
+
+  // Fast retransmission: a packet was lost.
+  void OnFastRetransmit(uint64_t now_ns) {
+    retransmits_nr_ = 0;
+    if (!CanDecrease(now_ns)) return;
+    Decrease(1 - params_.max_mdf);
+    last_decrease_ns_ = now_ns;
+  }
+
+  // Retransmission timeout.
+  void OnRetransmitTimeout(uint64_t now_ns) {
+    if (++retransmits_nr_ >= params_.retx_reset_threshold) {
+      fabric_cwnd_ = endpoint_cwnd_ = params_.min_cwnd;
+    } else if (CanDecrease(now_ns)) {
+      Decrease(1 - params_.max_mdf);
+    }
+    last_decrease_ns_ = now_ns;
+  }
+
+  void SetMaxWindow(uint32_t window) {
+    max_cwnd_ = std::max<double>(window, params_.min_cwnd);
+    fabric_cwnd_ = std::min(fabric_cwnd_, max_cwnd_);
+    endpoint_cwnd_ = std::min(endpoint_cwnd_, max_cwnd_);
+  }
+
+  std::string ToString() const {
+    return utils::Format(
+        "[Swift] cwnd: %.3f (fabric: %.3f, endpoint: %.3f), srtt: %lu ns",
+        GetCwnd(), fabric_cwnd_, endpoint_cwnd_, srtt_ns_);
+  }
+
+ private:
+  // The window is decreased at most once per (smoothed) RTT.
+  bool CanDecrease(uint64_t now_ns) const {
+    return now_ns - last_decrease_ns_ >= srtt_ns_;
+  }
+
+  void Increase(double *cwnd, uint32_t acked_nr) const {
+    *cwnd += *cwnd >= 1 ? params_.ai / *cwnd * acked_nr : params_.ai * acked_nr;
+    *cwnd = std::min(*cwnd, max_cwnd_);
+  }
+
+  void Decrease(double factor) {
+    fabric_cwnd_ = std::max(fabric_cwnd_ * factor, params_.min_cwnd);
+    endpoint_cwnd_ = std::max(endpoint_cwnd_ * factor, params_.min_cwnd);
+  }
+
+  // Returns true if the window was decreased.
+  bool Update(double *cwnd, uint32_t acked_nr, uint64_t delay_ns,
+              uint64_t target_ns, bool can_decrease) const {
+    if (delay_ns < target_ns) {
+      Increase(cwnd, acked_nr);
+      return false;
+    }
+    if (!can_decrease) return false;
+    const double excess = static_cast<double>(delay_ns - target_ns) / delay_ns;
+    *cwnd *= std::max(1 - params_.beta * excess, 1 - params_.max_mdf);
+    *cwnd = std::max(*cwnd, params_.min_cwnd);
+    return true;
+  }
+
+  const Params params_;
+  double fabric_cwnd_;
+  double endpoint_cwnd_;
+  // `max_cwnd', unless capped by `SetMaxWindow'.
+  double max_cwnd_;
+  // Flow scaling coefficients of the fabric target.
+  const double fs_alpha_;
+  const double fs_beta_;
+  uint64_t srtt_ns_{0};
+  uint64_t last_decrease_ns_{0};
+  uint32_t retransmits_nr_{0};
+};
+
+/**
+ * @brief ECN-based congestion control, after DCTCP (Alizadeh et al., "Data
+ * Center TCP (DCTCP)", SIGCOMM 2010): switches mark packets (CE) when their
+ * queues build up, and the sender shrinks its window in proportion to the
+ * fraction of marked packets.
+ *
+ * `alpha', the estimated fraction of marked packets, is updated once per
+ * window of data. In a window with marks the window is reduced by `alpha'/2,
+ * otherwise it grows by `ai' packets. Losses halve the window, at most once per
+ * window; a retransmission timeout resets it to the minimum.
+ *
+ * This is the window-based counterpart of rate-based ECN schemes such as
+ * DCQCN, which need NIC rate limiters. This class is not thread-safe.
+ */
+class Ecn {
+ public:
+  struct Params {
+    double initial_cwnd = 32;
+    double min_cwnd = 1;
+    // Default cap of the window, i.e., the default receive window of a flow;
+    // `SetMaxWindow' replaces it with the window the flow negotiated.
+    double max_cwnd = 256;
+    // Additive increase, in packets per window.
+    double ai = 1;
+    // Gain of the `alpha' moving average.
+    double g = 1.0 / 16;
+  };
+
+  Ecn() : Ecn(Params()) {}
+  explicit Ecn(const Params &params)
+      : params_(params),
+        cwnd_(params.initial_cwnd),
+        max_cwnd_(params.max_cwnd) {}
+
+  const Params &GetParams() const { return params_; }
+  double GetCwnd() const { return cwnd_; }
+  double GetAlpha() const { return alpha_; }
+  uint32_t GetWindow() const {
+    return std::max(static_cast<uint32_t>(cwnd_), 1u);
+  }
+  uint64_t GetPacingDelayNs() const { return 0; }
+  uint64_t GetPacingIntervalNs() const {
+    return static_cast<uint64_t>(srtt_ns_ / cwnd_);
+  }
+  bool UsesEcn() const { return true; }
+
+  void OnAck(const AckSample &sample) {
+    if (sample.has_delay) {
+      srtt_ns_ =
+          srtt_ns_ == 0 ? sample.rtt_ns : (7 * srtt_ns_ + sample.rtt_ns) / 8;
+    }
+    window_acked_nr_ += sample.acked_nr;
+    window_ce_nr_ += std::min(sample.ce_nr, sample.acked_nr);
+    if (sample.ce_nr == 0) {
+      cwnd_ = std::min(cwnd_ + params_.ai / cwnd_ * sample.acked_nr,
+                       max_cwnd_);
+    }
+    if (window_acked_nr_ < cwnd_) return;
+
+    // End of a window of data.
+    const double fraction =
+        static_cast<double>(window_ce_nr_) / window_acked_nr_;
+    alpha_ = (1 - params_.g) * alpha_ + params_.g * fraction;
+    if (window_ce_nr_ != 0) {
+      cwnd_ = std::max(cwnd_ * (1 - alpha_ / 2), params_.min_cwnd);
+    }
+    window_acked_nr_ = 0;
+    window_ce_nr_ = 0;
+    recovered_ = true;
+  }
+
+  // Fast retransmission: a packet was lost.
+  void OnFastRetransmit(uint64_t) {
+    if (!recovered_) return;
+    cwnd_ = std::max(cwnd_ / 2, params_.min_cwnd);
+    recovered_ = false;
+  }
+
+  // Retransmission timeout.
+  void OnRetransmitTimeout(uint64_t) {
+    cwnd_ = params_.min_cwnd;
+    recovered_ = false;
+  }
+
+  void SetMaxWindow(uint32_t window) {
+    max_cwnd_ = std::max<double>(window, params_.min_cwnd);
+    cwnd_ = std::min(cwnd_, max_cwnd_);
+  }
+
+  std::string ToString() const {
+    return utils::Format("[ECN] cwnd: %.3f, alpha: %.3f", cwnd_, alpha_);
+  }
+
+ private:
+  const Params params_;
+  double cwnd_;
+  // `max_cwnd', unless capped by `SetMaxWindow'.
+  double max_cwnd_;
+  double alpha_{0};
+  // Packets acknowledged, and CE-marked, in the current window.
+  uint32_t window_acked_nr_{0};
+  uint32_t window_ce_nr_{0};
+  // Smoothed RTT, for pacing.
+  uint64_t srtt_ns_{0};
+  // Whether a window has been acknowledged since the last loss.
+  bool recovered_{true};
+};
+
+/**
+ * @brief A fixed congestion window; e.g., for a dedicated fabric where the
+ * window is sized to the bandwidth-delay product.
+ */
+class FixedWindow {
+ public:
+  static constexpr uint32_t kDefaultWindow = 32;
+
+  explicit FixedWindow(uint32_t window = kDefaultWindow)
+      : window_(std::max(window, 1u)), max_window_(UINT32_MAX) {}
+
+  uint32_t GetWindow() const { return std::min(window_, max_window_); }
+  uint64_t GetPacingDelayNs() const { return 0; }
+  uint64_t GetPacingIntervalNs() const { return 0; }
+  bool UsesEcn() const { return false; }
+  void OnAck(const AckSample &) {}
+  void OnFastRetransmit(uint64_t) {}
+  void OnRetransmitTimeout(uint64_t) {}
+  void SetMaxWindow(uint32_t window) { max_window_ = std::max(window, 1u); }
+
+  std::string ToString() const {
+    return utils::Format("[Fixed] cwnd: %u", GetWindow());
+  }
+
+ private:
+  const uint32_t window_;
+  uint32_t max_window_;
+};
+
+/**
+ * @brief The congestion control of a flow: one of the policies above, chosen
+ * when the flow is created (see `Algorithm').
+ *
+ * Each policy is a concrete class, so calls are resolved at compile time;
+ * selecting the policy of a flow costs a switch on its tag, not a virtual call.
+ */
+class CongestionController {
+ public:
+  explicit CongestionController(Algorithm algorithm = Algorithm::kSwift)
+      : policy_(MakePolicy(algorithm)) {}
+
+  Algorithm GetAlgorithm() const {
+    return std::visit(
+        [](const auto &policy) {
+          using T = std::decay_t<decltype(policy)>;
+          if constexpr (std::is_same_v<T, Swift>) return Algorithm::kSwift;
+          if constexpr (std::is_same_v<T, Ecn>) return Algorithm::kEcn;
+          return Algorithm::kFixedWindow;
+        },
+        policy_);
+  }
+
+  // The policy, if it is a `T'; nullptr otherwise.
+  template <CongestionControl T>
+  const T *Get() const {
+    return std::get_if<T>(&policy_);
+  }
+
+  uint32_t GetWindow() const {
+    return std::visit([](const auto &p) { return p.GetWindow(); }, policy_);
+  }
+  uint64_t GetPacingDelayNs() const {
+    return std::visit([](const auto &p) { return p.GetPacingDelayNs(); },
+                      policy_);
+  }
+  uint64_t GetPacingIntervalNs() const {
+    return std::visit([](const auto &p) { return p.GetPacingIntervalNs(); },
+                      policy_);
+  }
+  bool UsesEcn() const {
+    return std::visit([](const auto &p) { return p.UsesEcn(); }, policy_);
+  }
+  void OnAck(const AckSample &sample) {
+    std::visit([&sample](auto &p) { p.OnAck(sample); }, policy_);
+  }
+  void OnFastRetransmit(uint64_t now_ns) {
+    std::visit([now_ns](auto &p) { p.OnFastRetransmit(now_ns); }, policy_);
+  }
+  void OnRetransmitTimeout(uint64_t now_ns) {
+    std::visit([now_ns](auto &p) { p.OnRetransmitTimeout(now_ns); }, policy_);
+  }
+  void SetMaxWindow(uint32_t window) {
+    std::visit([window](auto &p) { p.SetMaxWindow(window); }, policy_);
+  }
+  std::string ToString() const {
+    return std::visit([](const auto &p) { return p.ToString(); }, policy_);
+  }
+
+ private:
+  using Policy = std::variant<Swift, Ecn, FixedWindow>;
+
+  static Policy MakePolicy(Algorithm algorithm) {
+    switch (algorithm) {
+      case Algorithm::kEcn:
+        return Ecn();
+      case Algorithm::kFixedWindow:
+        return FixedWindow();
+      case Algorithm::kSwift:
+        [[fallthrough]];
+      default:
+        return Swift();
+    }
+  }
+
+  Policy policy_;
+};
+
+static_assert(CongestionControl<Swift>);
+static_assert(CongestionControl<Ecn>);
+static_assert(CongestionControl<FixedWindow>);
+static_assert(CongestionControl<CongestionController>);
+
+/**
+ * @brief Protocol control block of a flow: sequence numbers, SACK state and
+ * retransmission timeout. The congestion window comes from a
+ * `CongestionController'.
+ *
+ * The retransmission timeout (RTO) is computed from the measured RTT as in RFC
+ * 6298, but with bounds suited to datacenter RTTs, and backed off
+ * exponentially on consecutive timeouts. The flow owns the timer itself.
  */
-// TODO(ilias): First-cut implementation. Needs a lot of work.
 struct Pcb {
-  static constexpr std::size_t kInitialCwnd = 32;
+  // Bits of the SACK bitmap a packet carries, and the default window; flows
+  // may negotiate windows up to `kMaxWindow' (see `sack_bitmap_resize').
   static constexpr std::size_t kSackBitmapSize = 256;
-  static constexpr std::size_t kRexmitThreshold = 3;
-  static constexpr int kRtoThresholdInTicks = 3;  // in slow timer ticks.
-  static constexpr int kRtoDisabled = -1;
+  static constexpr std::size_t kMaxWindow = 16384;
+  // Consecutive RTOs after which the flow is given up; with the backoff, this
+  // is a few seconds.
+  static constexpr std::size_t kRexmitThreshold = 15;
+  static constexpr uint64_t kInitialRtoNs = 1'000'000;
+  static constexpr uint64_t kMinRtoNs = 200'000;
+  static constexpr uint64_t kMaxRtoNs = 1'000'000'000;
   Pcb() {}
 
-  // Return the sender effective window in # of packets.
-  uint32_t effective_wnd() const {
-    uint32_t effective_wnd = cwnd - (snd_nxt - snd_una - snd_ooo_acks);
-    return effective_wnd > cwnd ? 0 : effective_wnd;
+  // Return the number of packets the congestion window `cwnd' allows to send,
+  // given the number `left_nr' of packets sent that are no longer in flight,
+  // although not cumulatively acknowledged (i.e., SACKed or lost).
+  uint32_t congestion_wnd(uint32_t cwnd, uint32_t left_nr) const {
+    uint32_t congestion_wnd = cwnd - (snd_nxt - snd_una - left_nr);
+    return congestion_wnd > cwnd ? 0 : congestion_wnd;
+  }
+
+  // Return the number of new packets the receive window of the peer allows to
+  // send: the peer buffers up to `snd_wnd' packets from `snd_una' on, whether
+  // SACKed or not.
+  uint32_t receive_wnd() const {
+    const uint32_t outstanding = snd_nxt - snd_una;
+    return snd_wnd > outstanding ? snd_wnd - outstanding : 0;
+  }
+
+  // Return the sender effective window in # of packets, within both the
+  // congestion window (see `congestion_wnd') and the receive window of the
+  // peer (see `receive_wnd').
+  uint32_t effective_wnd(uint32_t cwnd, uint32_t left_nr) const {
+    return std::min(congestion_wnd(cwnd, left_nr), receive_wnd());
   }
 
   uint32_t seqno() const { return snd_nxt; }
@@ -60,77 +584,145 @@ struct Pcb {
     std::string s;
     s += "[CC] snd_nxt: " + std::to_string(snd_nxt) +
          ", snd_una: " + std::to_string(snd_una) +
+         ", snd_wnd: " + std::to_string(snd_wnd) +
          ", rcv_nxt: " + std::to_string(rcv_nxt) +
-         ", cwnd: " + std::to_string(cwnd) +
          ", fast_rexmits: " + std::to_string(fast_rexmits) +
          ", rto_rexmits: " + std::to_string(rto_rexmits) +
-         ", effective_wnd: " + std::to_string(effective_wnd());
+         ", srtt_ns: " + std::to_string(srtt_ns) +
+         ", rto_ns: " + std::to_string(rto_ns);
     return s;
   }
 
   uint32_t ackno() const { return rcv_nxt; }
   bool max_rexmits_reached() const { return rto_rexmits >= kRexmitThreshold; }
-  bool rto_disabled() const { return rto_timer == kRtoDisabled; }
-  bool rto_expired() const { return rto_timer >= kRtoThresholdInTicks; }
 
   uint32_t get_rcv_nxt() const { return rcv_nxt; }
   void advance_rcv_nxt() { rcv_nxt++; }
-  void rto_enable() { rto_timer = 0; }
-  void rto_disable() { rto_timer = kRtoDisabled; }
-  void rto_reset() { rto_enable(); }
-  void rto_maybe_reset() {
-    if (snd_una == snd_nxt)
-      rto_disable();
-    else
-      rto_reset();
-  }
-  void rto_advance() { rto_timer++; }
-
-  void sack_bitmap_shift_right_one() {
-    constexpr size_t sack_bitmap_bucket_max_idx =
-        kSackBitmapSize / sizeof(sack_bitmap[0]) - 1;
-
-    for (size_t i = sack_bitmap_bucket_max_idx; i > 0; --i) {
-      // Shift the current each bucket to the right by 1 and take the most
-      // significant bit from the previous bucket
-      const uint64_t sack_bitmap_left_bucket = sack_bitmap[i - 1];
-      uint64_t &sack_bitmap_right_bucket = sack_bitmap[i];
-
-      sack_bitmap_right_bucket =
-          (sack_bitmap_right_bucket >> 1) | (sack_bitmap_left_bucket << 63);
+  // Whether the timer should run, i.e., there is unacknowledged data.
+  bool rto_needed() const { return snd_una != snd_nxt; }
+
+  // Updates the RTO with an RTT sample (RFC 6298, section 2).
+  void rtt_sample(uint64_t rtt_ns) {
+    latest_rtt_ns = rtt_ns;
+    min_rtt_ns = min_rtt_ns == 0 ? rtt_ns : std::min(min_rtt_ns, rtt_ns);
+    if (srtt_ns == 0) {
+      srtt_ns = rtt_ns;
+      rttvar_ns = rtt_ns / 2;
+    } else {
+      const uint64_t delta =
+          srtt_ns > rtt_ns ? srtt_ns - rtt_ns : rtt_ns - srtt_ns;
+      rttvar_ns = (3 * rttvar_ns + delta) / 4;
+      srtt_ns = (7 * srtt_ns + rtt_ns) / 8;
     }
+    rto_ns = std::clamp(srtt_ns + 4 * rttvar_ns, kMinRtoNs, kMaxRtoNs);
+  }
+  // Doubles the RTO after a timeout (RFC 6298, section 5.5).
+  void rto_backoff() { rto_ns = std::min(2 * rto_ns, kMaxRtoNs); }
 
-    // Special handling for the left most bucket
-    uint64_t &sack_bitmap_left_most_bucket = sack_bitmap[0];
-    sack_bitmap_left_most_bucket >>= 1;
+  // The SACK bitmap covers the receive window: it has bit `i' set if the
+  // packet `rcv_nxt + i' was received. It is a ring of `sack_window()' bits
+  // that starts at bit `sack_head', so that moving `rcv_nxt' forward only
+  // clears the bits of the packets delivered. Packets carry a slice of
+  // `kSackBitmapSize' bits of it (see `sack_offset').
 
-    sack_bitmap_count--;
+  // Resizes the bitmap to a window of `window' packets; it must be empty.
+  void sack_bitmap_resize(const size_t window) {
+    CHECK_EQ(sack_bitmap_count, 0);
+    CHECK(window >= kSackBitmapSize && window <= kMaxWindow &&
+          (window & (window - 1)) == 0)
+        << "Invalid window: " << window;
+    sack_bitmap.assign(window / 64, 0);
+    sack_head = 0;
+    sack_last = 0;
   }
+  size_t sack_window() const { return sack_bitmap.size() * 64; }
 
-  void sack_bitmap_bit_set(const size_t index) {
-    constexpr size_t sack_bitmap_bucket_size = sizeof(sack_bitmap[0]);
-    const size_t sack_bitmap_bucket_idx = index / sack_bitmap_bucket_size;
-    const size_t sack_bitmap_idx_in_bucket = index % sack_bitmap_bucket_size;
+  // The 64 bits of the bitmap from bit `index' on.
+  uint64_t sack_bitmap_word(const size_t index) const {
+    const size_t pos = (sack_head + index) & (sack_window() - 1);
+    const size_t w = pos / 64;
+    const size_t bits = pos % 64;
+    uint64_t word = sack_bitmap[w] >> bits;
+    // Take the low bits of the next word.
+    if (bits != 0) {
+      word |= sack_bitmap[(w + 1) % sack_bitmap.size()] << (64 - bits);
+    }
+    return word;
+  }
+
+  // Offset of the slice of the bitmap that packets carry: the first
+  // `kSackBitmapSize' bits, unless the packet received last is beyond them;
+  // then the slice ends with the 64 bits around it, where the sender is most
+  // likely to learn of deliveries. A multiple of 64.
+  uint16_t sack_offset() const {
+    if (sack_last < kSackBitmapSize) return 0;
+    const size_t offset = sack_last / 64 * 64 - (kSackBitmapSize - 64);
+    DCHECK_LE(offset, sack_window() - kSackBitmapSize);
+    return offset;
+  }
 
-    LOG_IF(FATAL, index >= kSackBitmapSize) << "Index out of bounds: " << index;
+  // Shifts the bitmap as `rcv_nxt' moves forward by `n' packets, all of which
+  // were received.
+  void sack_bitmap_shift_right(size_t n) {
+    DCHECK_LE(n, sack_bitmap_count);
+    sack_bitmap_count -= n;
+    sack_last = sack_last > n ? sack_last - n : 0;
+    while (n != 0) {
+      const size_t bits = sack_head % 64;
+      const size_t len = std::min(64 - bits, n);
+      const uint64_t mask = len == 64 ? ~0ULL : ((1ULL << len) - 1) << bits;
+      sack_bitmap[sack_head / 64] &= ~mask;
+      sack_head = (sack_head + len) & (sack_window() - 1);
+      n -= len;
+    }
+  }
+
+  // Number of consecutive packets received from `rcv_nxt' on.
+  size_t sack_bitmap_leading_nr() const {
+    size_t n = 0;
+    while (n < sack_window()) {
+      const auto ones = std::countr_one(sack_bitmap_word(n));
+      n += ones;
+      if (ones != 64) break;
+    }
+    return std::min(n, sack_window());
+  }
+
+  bool sack_bitmap_bit_test(const size_t index) const {
+    const size_t pos = (sack_head + index) & (sack_window() - 1);
+    return (sack_bitmap[pos / 64] >> (pos % 64)) & 1;
+  }
+
+  void sack_bitmap_bit_set(const size_t index) {
+    LOG_IF(FATAL, index >= sack_window()) << "Index out of bounds: " << index;
 
-    sack_bitmap[sack_bitmap_bucket_idx] |= (1ULL << sack_bitmap_idx_in_bucket);
+    const size_t pos = (sack_head + index) & (sack_window() - 1);
+    sack_bitmap[pos / 64] |= (1ULL << (pos % 64));
 
     sack_bitmap_count++;
+    sack_last = index;
   }
 
-  uint32_t target_delay{0};
   uint32_t snd_nxt{0};
   uint32_t snd_una{0};
-  uint32_t snd_ooo_acks{0};
   uint32_t rcv_nxt{0};
-  uint64_t sack_bitmap[kSackBitmapSize / sizeof(uint64_t)]{0};
-  uint8_t sack_bitmap_count{0};
-  uint16_t cwnd{kInitialCwnd};
-  uint16_t duplicate_acks{0};
-  int rto_timer{kRtoDisabled};
+  // Receive window last advertised by the peer (see `receive_wnd').
+  uint32_t snd_wnd{kSackBitmapSize};
+  std::vector<uint64_t> sack_bitmap =
+      std::vector<uint64_t>(kSackBitmapSize / 64, 0);
+  size_t sack_head{0};
+  // Index of the packet received last, relative to `rcv_nxt'.
+  size_t sack_last{0};
+  uint16_t sack_bitmap_count{0};
   uint16_t fast_rexmits{0};
   uint16_t rto_rexmits{0};
+  // Latest and minimum RTT samples (for loss detection), smoothed RTT, its
+  // variation, and the current RTO.
+  uint64_t latest_rtt_ns{0};
+  uint64_t min_rtt_ns{0};
+  uint64_t srtt_ns{0};
+  uint64_t rttvar_ns{0};
+  uint64_t rto_ns{kInitialRtoNs};
 };
 
 }  // namespace swift
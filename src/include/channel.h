@@ -13,16 +13,27 @@
 #include <machnet_common.h>
 #include <machnet_private.h>
 #include <rte_eal.h>
+#include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
-
+#include <slab.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <iterator>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace juggler {
 class MachnetEngine;  // forward declaration
@@ -32,6 +43,8 @@ namespace juggler {
 namespace net {
 namespace flow {
 class Flow;  // forward declaration
+// Flows are allocated from a slab of their engine (see `Channel::CreateFlow').
+using FlowSlab = utils::Slab<Flow>;
 }  // namespace flow
 }  // namespace net
 }  // namespace juggler
@@ -49,7 +62,11 @@ namespace shm {
 class ShmChannel {
  public:
   using Flow = juggler::net::flow::Flow;
+  using FlowSlab = juggler::net::flow::FlowSlab;
   using Listener = juggler::net::flow::Listener;
+  // Periodic processings with plenty of free buffers before an elastic pool
+  // shrinks (see `AdaptBufPool').
+  static constexpr uint32_t kBufPoolShrinkTicks = 10;
   ShmChannel() = delete;
   ShmChannel(const ShmChannel &) = delete;
   /**
@@ -67,6 +84,19 @@ class ShmChannel {
              const MachnetChannelCtx_t *channel_ctx,
              const size_t channel_mem_size, const bool is_posix_shm,
              int channel_fd);
+  /**
+   * @brief `ShmChannel' Constructor, for a channel whose doorbell and
+   * notification exist already (e.g., one handed over by another process, see
+   * `ChannelManager::MapChannel'); the channel owns them from now on. The
+   * other parameters are those of the constructor above.
+   *
+   * @param doorbell_fd   The file descriptor of the doorbell, or -1.
+   * @param notify_fd     The file descriptor of the notification, or -1.
+   */
+  ShmChannel(const std::string channel_name,
+             const MachnetChannelCtx_t *channel_ctx,
+             const size_t channel_mem_size, const bool is_posix_shm,
+             int channel_fd, int doorbell_fd, int notify_fd);
   ~ShmChannel();
   ShmChannel &operator=(const ShmChannel &) = delete;
 
@@ -78,9 +108,114 @@ class ShmChannel {
   // Get the channel's file descriptor.
   int GetFd() const { return channel_fd_; }
 
+  /**
+   * @brief Binds the channel's memory to a NUMA node. Pages already allocated
+   * elsewhere are moved, so this should be done before the memory is
+   * registered for DMA, or mapped by the application.
+   *
+   * @param node        The NUMA node.
+   * @return True on success, false otherwise.
+   */
+  bool BindToNumaNode(int node);
+
+  // Get the NUMA node the channel's memory is bound to, or
+  // `MACHNET_NUMA_NODE_ANY' if it is not bound to any.
+  int GetNumaNode() const { return numa_node_; }
+
+  // Get the engine's statistics of the channel, in its shared memory. Only
+  // the engine thread serving the channel may update them.
+  MachnetChannelEngineStats_t *GetEngineStats() const {
+    return &__machnet_channel_stats(ctx_)->e_stats;
+  }
+
+  // Get the file descriptor of the channel's doorbell (an eventfd that the
+  // application writes to, to wake the engine up), or -1 if there is none.
+  int GetDoorbellFd() const { return doorbell_fd_; }
+
+  /**
+   * @brief Arms the channel's doorbell, before the engine goes to sleep. From
+   * this point on, the application rings the doorbell whenever it enqueues
+   * messages or control requests to the channel.
+   *
+   * @return True if nothing is pending for the engine in the channel, i.e.,
+   * the engine may go to sleep; false otherwise.
+   */
+  bool ArmDoorbell() {
+    __machnet_channel_doorbell_set(ctx(), 1);
+    return __machnet_channel_engine_pending(ctx_) == 0;
+  }
+
+  // Whether the application notifies the engine of pending work through the
+  // engine's pending bitmap (see `PendingBitmap'). If not, the engine has to
+  // poll the channel on every cycle.
+  bool UsesPendingBitmap() const {
+    return __atomic_load_n(&ctx_->doorbell.app_pending, __ATOMIC_ACQUIRE) !=
+           nullptr;
+  }
+
+  // Assigns the channel's slot in the engine's pending bitmap.
+  void SetPendingSlot(uint32_t slot) { ctx()->doorbell.pending_slot = slot; }
+
+  /**
+   * @brief Disarms the channel's doorbell, and consumes any pending rings.
+   */
+  void DisarmDoorbell() {
+    __machnet_channel_doorbell_set(ctx(), 0);
+    if (doorbell_fd_ < 0) return;
+    uint64_t value;
+    // The descriptor is non-blocking; nothing to read is not an error.
+    [[maybe_unused]] auto ret = read(doorbell_fd_, &value, sizeof(value));
+  }
+
+  // Get the file descriptor of the channel's notification (an eventfd that the
+  // engine writes to, to wake the application up), or -1 if there is none.
+  int GetNotifyFd() const { return notify_fd_; }
+
+  // Whether messages have been delivered to the channel since the last
+  // `WakeUpApp'.
+  bool HasDelivered() const { return delivered_; }
+
+  /**
+   * @brief Wakes the application up, if it waits for messages on the channel.
+   *
+   * To be called after a full barrier that follows the deliveries (see
+   * `__machnet_channel_app_wakeup'); the engine issues one for all its channels.
+   *
+   * @return True if the application was woken up, false otherwise.
+   */
+  bool WakeUpApp() {
+    delivered_ = false;
+    if (!__machnet_channel_app_wakeup(ctx())) return false;
+    if (notify_fd_ < 0) return false;
+    const uint64_t value = 1;
+    // A failure (i.e., counter overflow) means that the application is being
+    // woken up anyway.
+    [[maybe_unused]] auto ret = write(notify_fd_, &value, sizeof(value));
+    return true;
+  }
+
   // Get the name of this channel.
   std::string GetName() const { return name_; }
 
+  // Get the name the channel's shared memory segment was created with.
+  std::string GetShmName() const { return shm_name_; }
+
+  /**
+   * @brief Gives the channel up to another process, which maps it from its
+   * descriptors (see `ChannelManager::MapChannel'), e.g., a Machnet restarted
+   * in place: the buffers the engine cached go back to the channel's pool, and
+   * the shared memory segment is not removed when this object goes away. The
+   * channel must not be used afterwards.
+   */
+  void HandOff();
+
+  /**
+   * @brief Names the channel anew, e.g., when a channel created ahead of time
+   * is handed out (see `ChannelManager::AdoptChannel'). Its shared memory
+   * segment keeps the name it was created with.
+   */
+  void Rename(const std::string &name);
+
   // Get the address of the channel's buffer pool.
   template <typename T = uchar_t *>
   const T GetBufPoolAddr() const {
@@ -98,22 +233,107 @@ class ShmChannel {
   // Size of the channel in bytes.
   uint64_t GetSize() const { return ctx_->size; }
 
-  // Total size of each channel's buffer in bytes.
+  // Priority class of the channel and of its new flows (`MACHNET_PRIO_*'),
+  // set by the application (see `machnet_set_priority').
+  uint32_t GetPriority() const {
+    const uint32_t prio = __atomic_load_n(&ctx_->prio, __ATOMIC_RELAXED);
+    return std::min<uint32_t>(prio, MACHNET_PRIO_CLASSES_NR - 1);
+  }
+
+  // Total size of each channel's (default) buffer in bytes.
   uint32_t GetTotalBufSize() const { return ctx_->data_ctx.buf_size; }
 
   // Machnet channel `MsgBuf' have reserved space for headers.
-  // This method returns the space in the `MsgBuf' that can be used to store the
-  // payload. There is still headroom for possible packet headers.
+  // This method returns the space in the (default) `MsgBuf' that can be used
+  // to store the payload. There is still headroom for possible packet headers.
   uint32_t GetUsableBufSize() const { return ctx_->data_ctx.buf_mss; }
 
-  // Total amount of buffers in the channel.
+  // Total amount of buffers in the channel, of all size classes.
   uint32_t GetTotalBufCount() const {
-    return __machnet_channel_buf_ring(ctx_)->capacity;
+    return __machnet_channel_buf_count(ctx_);
   }
 
+  // Number of buffer size classes of the channel, the default one included.
+  uint32_t GetBufClassCount() const { return ctx_->data_ctx.buf_classes_nr; }
+
+  // Whether the pool of default buffers grows and shrinks with the load, a
+  // segment at a time (see `GrowBufPool').
+  bool IsBufPoolElastic() const { return ctx_->data_ctx.buf_segs_max > 1; }
+
+  // Number of segments of default buffers attached to the pool.
+  uint32_t GetBufSegCount() const {
+    return __atomic_load_n(&ctx_->data_ctx.buf_segs_nr, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * @brief Sets the budget the pool of default buffers grows from, in
+   * buffers, shared by the channels of an application; the segments attached
+   * already are charged to it. Without a budget, the pool grows up to its
+   * maximum.
+   */
+  void SetBufBudget(std::shared_ptr<std::atomic<int64_t>> budget);
+
+  /**
+   * @brief Attaches another segment of default buffers to an elastic pool,
+   * within its maximum and the budget (see `SetBufBudget').
+   * @return True on success, false otherwise.
+   */
+  bool GrowBufPool();
+
+  /**
+   * @brief Releases the last segment of default buffers of an elastic pool,
+   * if all its buffers are free; the buffers the engine cached go back to the
+   * pool first.
+   * @return True on success, false otherwise.
+   */
+  bool ShrinkBufPool();
+
+  /**
+   * @brief Resizes an elastic pool with the load, on each periodic processing
+   * of the engine: grows it when its free default buffers run low, and
+   * shrinks it when they have been plenty for `kBufPoolShrinkTicks' in a row.
+   */
+  void AdaptBufPool();
+
   // Get the number of buffers that are currently available (i.e., not in use).
   uint32_t GetFreeBufCount() const {
-    return cached_buf_count + __machnet_channel_buffers_avail(ctx_);
+    uint32_t cached = 0;
+    for (const auto &cache : buf_caches_) cached += cache.count;
+    return cached + __machnet_channel_buffers_avail(ctx_);
+  }
+
+  // Get the number of per-thread queue pairs of the channel (see
+  // `MachnetQueuePair_t').
+  uint32_t GetQueuePairCount() const { return ctx_->data_ctx.queue_pairs_nr; }
+
+  /**
+   * @brief Resolves the queue pair messages are delivered to: the one given,
+   * if an application thread has claimed it, or the shared ring otherwise.
+   *
+   * @param queue       Index of a queue pair, or `MACHNET_CHANNEL_QUEUE_SHARED'.
+   * @return The index of the queue pair, or `MACHNET_CHANNEL_QUEUE_SHARED'.
+   */
+  uint32_t GetDeliveryQueue(uint32_t queue) const {
+    if (queue == MACHNET_CHANNEL_QUEUE_SHARED) [[likely]]
+      return queue;
+    if (queue >= GetQueuePairCount() ||
+        !__machnet_channel_queue_owned(ctx_, queue))
+      return MACHNET_CHANNEL_QUEUE_SHARED;
+    return queue;
+  }
+
+  // Get the number of messages that can be enqueued to the application on a
+  // queue pair (see `EnqueueMessages') before its ring is full.
+  uint32_t GetEnqueueRoom(uint32_t queue = MACHNET_CHANNEL_QUEUE_SHARED) const {
+    queue = GetDeliveryQueue(queue);
+    if (queue == MACHNET_CHANNEL_QUEUE_SHARED) [[likely]] {
+      if (!__machnet_channel_is_spsc(ctx_))
+        return jring_free_count(__machnet_channel_machnet_ring(ctx_));
+      auto *ring = __machnet_channel_machnet_ring2(ctx_);
+      return ring->mask - jring2_count(ring);
+    }
+    auto *ring = __machnet_channel_queue_machnet_ring(ctx_, queue);
+    return ring->mask - jring2_count(ring);
   }
 
   /**
@@ -164,18 +384,44 @@ class ShmChannel {
     return __machnet_channel_ctrl_cq_enqueue(ctx_, nb_entries, ctrl_entries);
   }
 
+  /**
+   * @brief Posts completions of messages sent with
+   * `MACHNET_MSGBUF_NOTIFY_DELIVERY' to the application. Those that do not fit
+   * in the ring are dropped, and counted.
+   *
+   * @param compls      A pointer to the array of completions.
+   * @param nb_compls   The number of completions in the array above.
+   */
+  void PostTxCompletions(const MachnetTxCompletion_t *compls,
+                         uint32_t nb_compls) {
+    if (nb_compls == 0) return;
+    const auto ret =
+        __machnet_channel_tx_compl_enqueue(ctx_, nb_compls, compls);
+    GetEngineStats()->tx_compl_drops += nb_compls - ret;
+    delivered_ |= ret != 0;
+  }
+
   /**
    * @brief Enqueues a batch of messages to the channel (destined to the
    * application).
    *
    * @param msgbuf_indices   A pointer to the array of `MsgBuf' indices.
    * @param nb_msgs          The number of entries in the array above.
+   * @param queue            The queue pair to deliver to (see
+   *                         `GetDeliveryQueue').
    * @return                 The number of messages enqueued.
    */
-  uint32_t EnqueueMessages(MachnetRingSlot_t *msgbuf_indices,
-                           uint32_t nb_msgs) {
-    return __machnet_channel_machnet_ring_enqueue(ctx_, nb_msgs,
-                                                  msgbuf_indices);
+  uint32_t EnqueueMessages(MachnetRingSlot_t *msgbuf_indices, uint32_t nb_msgs,
+                           uint32_t queue = MACHNET_CHANNEL_QUEUE_SHARED) {
+    queue = GetDeliveryQueue(queue);
+    const auto ret =
+        queue == MACHNET_CHANNEL_QUEUE_SHARED
+            ? __machnet_channel_machnet_ring_enqueue(ctx_, nb_msgs,
+                                                     msgbuf_indices)
+            : __machnet_channel_queue_machnet_enqueue(ctx_, queue, nb_msgs,
+                                                      msgbuf_indices);
+    delivered_ |= ret != 0;
+    return ret;
   }
 
   /**
@@ -186,9 +432,11 @@ class ShmChannel {
    *                    enqueued.
    * @param nb_msgs     The number of messages enqueued (Limited to
    *                    `MsgBufBatch::kMaxBurst')
+   * @param queue       The queue pair to deliver to (see `GetDeliveryQueue').
    * @return           The number of messages enqueued.
    */
-  uint32_t EnqueueMessages(MsgBuf *const *msgs, uint32_t nb_msgs) {
+  uint32_t EnqueueMessages(MsgBuf *const *msgs, uint32_t nb_msgs,
+                           uint32_t queue = MACHNET_CHANNEL_QUEUE_SHARED) {
     MachnetRingSlot_t slots[MsgBufBatch::kMaxBurst];
     auto nmsgs = std::min(nb_msgs, MsgBufBatch::kMaxBurst);
 
@@ -197,7 +445,7 @@ class ShmChannel {
           ctx_, reinterpret_cast<const MachnetMsgBuf_t *>(msgs[i]));
     }
 
-    return EnqueueMessages(slots, nmsgs);
+    return EnqueueMessages(slots, nmsgs, queue);
   }
 
   /**
@@ -213,7 +461,11 @@ class ShmChannel {
 
   /**
    * @brief Dequeues a number of messages from the channel (destined to the
-   * Machnet stack).
+   * Machnet stack). The queue pairs and the shared ring are polled
+   * round-robin, starting after the last one polled by the previous call;
+   * fewer than `nb_msgs' messages means that all of them are drained. Each
+   * message is tagged with the queue pair it was dequeued from (see
+   * `MsgBuf::queue').
    *
    * @param msg_indices        A pointer to the array of `MachnetRingSlot_t'
    *                           objects (indices of buffers).
@@ -223,11 +475,25 @@ class ShmChannel {
    */
   uint32_t DequeueMessages(MachnetRingSlot_t *msg_indices, MsgBuf **msgs,
                            uint32_t nb_msgs) {
-    uint32_t ret =
-        __machnet_channel_app_ring_dequeue(ctx_, nb_msgs, msg_indices);
-    for (uint32_t i = 0; i < ret; i++) {
-      msgs[i] = reinterpret_cast<MsgBuf *>(
-          __machnet_channel_buf(ctx_, msg_indices[i]));
+    // The shared ring is polled as the last queue pair.
+    const uint32_t queues_nr = GetQueuePairCount() + 1;
+    uint32_t ret = 0;
+    for (uint32_t i = 0; i < queues_nr && ret < nb_msgs; i++) {
+      const uint32_t q = next_queue_;
+      next_queue_ = (next_queue_ + 1 == queues_nr) ? 0 : next_queue_ + 1;
+      const bool shared = q + 1 == queues_nr;
+      const uint32_t queue = shared ? MACHNET_CHANNEL_QUEUE_SHARED : q;
+      const uint32_t n =
+          shared ? __machnet_channel_app_ring_dequeue(ctx_, nb_msgs - ret,
+                                                      msg_indices + ret)
+                 : __machnet_channel_queue_app_dequeue(
+                       ctx_, q, nb_msgs - ret, msg_indices + ret);
+      for (uint32_t j = ret; j < ret + n; j++) {
+        msgs[j] = reinterpret_cast<MsgBuf *>(
+            __machnet_channel_buf(ctx_, msg_indices[j]));
+        msgs[j]->set_queue(queue);
+      }
+      ret += n;
     }
 
     return ret;
@@ -251,20 +517,28 @@ class ShmChannel {
   }
 
   /**
-   * @brief Allocates a single message buffer from the channel.
+   * @brief Allocates a single (default) message buffer from the channel.
    *
    * @return - pointer to the buffer on success, nullptr otherwise.
    */
-  MsgBuf *MsgBufAlloc() {
-    if (cached_buf_count == 0) {
-      uint32_t ret = __machnet_channel_buf_alloc_bulk(
-          ctx_, NUM_CACHED_BUFS, cached_buf_indices.data(), cached_bufs.data());
-      if (ret != NUM_CACHED_BUFS) return nullptr;
-      cached_buf_count += NUM_CACHED_BUFS;
+  MsgBuf *MsgBufAlloc() { return MsgBufClassAlloc(0); }
+
+  /**
+   * @brief Allocates a single message buffer to hold `len' bytes, from the
+   * smallest size class whose buffers fit them; if that class runs out, from
+   * the next larger ones.
+   *
+   * @param len     The number of bytes the buffer is to hold.
+   * @return - pointer to the buffer on success, nullptr otherwise.
+   */
+  MsgBuf *MsgBufAlloc(uint32_t len) {
+    const uint32_t classes_nr = ctx_->data_ctx.buf_classes_nr;
+    for (auto c = __machnet_channel_buf_class_for(ctx_, len); c != 0;
+         c = (c + 1) % classes_nr) {
+      auto *msgbuf = MsgBufClassAlloc(c);
+      if (msgbuf != nullptr) return msgbuf;
     }
-    MachnetMsgBuf_t *buf = cached_bufs[--cached_buf_count];
-    __machnet_channel_buf_init(buf);
-    return reinterpret_cast<MsgBuf *>(buf);
+    return MsgBufClassAlloc(0);
   }
 
   /**
@@ -279,10 +553,11 @@ class ShmChannel {
         ctx_, reinterpret_cast<const MachnetMsgBuf_t *>(buf))};
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, index[0]);
 
-    if (cached_buf_count < NUM_CACHED_BUFS) {
-      cached_buf_indices[cached_buf_count] = index[0];
-      cached_bufs[cached_buf_count] = msg_buf;
-      cached_buf_count++;
+    auto &cache = buf_caches_[GetBufClass(index[0])];
+    if (cache.count < NUM_CACHED_BUFS) {
+      cache.indices[cache.count] = index[0];
+      cache.bufs[cache.count] = msg_buf;
+      cache.count++;
       return true;
     }
 
@@ -296,7 +571,30 @@ class ShmChannel {
   }
 
   /**
-   * @brief Allocates a batch of message buffers from the channel.
+   * @brief Gets the buffer that holds the data of a message buffer: the buffer
+   * itself, or the payload buffer of an alias (see
+   * `MACHNET_MSGBUF_FLAGS_ALIAS').
+   */
+  const MsgBuf *GetPayloadMsgBuf(const MsgBuf *msg_buf) {
+    if (!msg_buf->is_alias()) [[likely]]
+      return msg_buf;
+    return GetMsgBuf(msg_buf->alias_target());
+  }
+
+  /**
+   * @brief Releases the reference of an alias to its payload buffer, and frees
+   * the latter if it was the last one. The alias itself is left to the caller
+   * to free.
+   *
+   * @param alias   The alias buffer.
+   */
+  void MsgBufAliasRelease(const MsgBuf *alias) {
+    auto *payload = GetMsgBuf(alias->alias_target());
+    if (payload->unref() == 0) CHECK(MsgBufFree(payload));
+  }
+
+  /**
+   * @brief Allocates a batch of (default) message buffers from the channel.
    *
    * @param batch       A pointer to an empty `MsgBufBatch' object to hold the
    *                    allocated buffers.
@@ -306,10 +604,14 @@ class ShmChannel {
   bool MsgBufBulkAlloc(MsgBufBatch *batch,
                        uint32_t cnt = MsgBufBatch::kMaxBurst) {
     (void)DCHECK_NOTNULL(batch);
+    cnt = std::min(cnt, static_cast<uint32_t>(batch->GetRoom()));
+    auto **bufs = reinterpret_cast<MachnetMsgBuf_t **>(batch->bufs());
     uint32_t ret = __machnet_channel_buf_alloc_bulk(
-        ctx_, std::min(cnt, static_cast<uint32_t>(batch->GetRoom())),
-        batch->buf_indices(),
-        reinterpret_cast<MachnetMsgBuf_t **>(batch->bufs()));
+        ctx_, cnt, batch->buf_indices(), bufs);
+    if (ret == 0 && GrowBufPool()) [[unlikely]] {
+      ret = __machnet_channel_buf_alloc_bulk(ctx_, cnt, batch->buf_indices(),
+                                             bufs);
+    }
     batch->IncrCount(ret);
     if (ret == 0) [[unlikely]]
       return false;
@@ -339,17 +641,15 @@ class ShmChannel {
   bool MsgBufBulkFree(MachnetRingSlot_t *indices, uint32_t cnt) {
     int retries = 5;
     uint32_t freed;
-    const uint32_t cache_free_slots = NUM_CACHED_BUFS - cached_buf_count;
-    const uint32_t to_cache =
-        (cnt <= cache_free_slots) ? cnt : cache_free_slots;
-
-    for (freed = 0; freed < to_cache; freed++) {
-      cached_buf_indices[cached_buf_count] = indices[freed];
-      MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, indices[freed]);
-      cached_bufs[cached_buf_count] = msg_buf;
-      cached_buf_count++;
+    // Cache buffers up to the first one whose class cache is full.
+    for (freed = 0; freed < cnt; freed++) {
+      auto &cache = buf_caches_[GetBufClass(indices[freed])];
+      if (cache.count == NUM_CACHED_BUFS) break;
+      cache.indices[cache.count] = indices[freed];
+      cache.bufs[cache.count] = __machnet_channel_buf(ctx_, indices[freed]);
+      cache.count++;
     }
-    if (cnt > cache_free_slots) {
+    if (freed < cnt) {
       do {
         freed +=
             __machnet_channel_buf_free_bulk(ctx_, cnt - freed, indices + freed);
@@ -362,22 +662,71 @@ class ShmChannel {
   }
 
   uint32_t GetAllCachedBufferIndices(std::vector<MachnetRingSlot_t> *indices) {
-    indices->insert(indices->end(), cached_buf_indices.begin(),
-                    cached_buf_indices.begin() + cached_buf_count);
-    uint32_t ret = cached_buf_count;
-    cached_buf_count = 0;
+    uint32_t ret = 0;
+    for (auto &cache : buf_caches_) {
+      indices->insert(indices->end(), cache.indices.begin(),
+                      cache.indices.begin() + cache.count);
+      ret += cache.count;
+      cache.count = 0;
+    }
     return ret;
   }
 
  private:
-  const std::string name_;
+  // The size class of the buffer at an index.
+  uint32_t GetBufClass(MachnetRingSlot_t index) const {
+    return __machnet_channel_buf_class_of(ctx_, index) -
+           ctx_->data_ctx.buf_classes;
+  }
+
+  // Allocates a single message buffer of a size class, from its cache.
+  MsgBuf *MsgBufClassAlloc(uint32_t cls) {
+    auto &cache = buf_caches_[cls];
+    if (cache.count == 0) {
+      uint32_t ret = __machnet_channel_buf_class_alloc_bulk(
+          ctx_, cls, NUM_CACHED_BUFS, cache.indices.data(), cache.bufs.data());
+      // Out of default buffers, an elastic pool grows at once.
+      if (ret != NUM_CACHED_BUFS && cls == 0 && GrowBufPool()) [[unlikely]] {
+        ret = __machnet_channel_buf_class_alloc_bulk(
+            ctx_, cls, NUM_CACHED_BUFS, cache.indices.data(),
+            cache.bufs.data());
+      }
+      if (ret != NUM_CACHED_BUFS) return nullptr;
+      cache.count += NUM_CACHED_BUFS;
+    }
+    MachnetMsgBuf_t *buf = cache.bufs[--cache.count];
+    __machnet_channel_buf_init(buf);
+    return reinterpret_cast<MsgBuf *>(buf);
+  }
+
+  std::string name_;
+  // The name the shared memory segment was created with.
+  const std::string shm_name_;
   const MachnetChannelCtx_t *ctx_;
   const size_t mem_size_;
   const bool is_posix_shm_;
+  // Whether another process took the channel over (see `HandOff').
+  bool handed_off_;
   int channel_fd_;
-  std::array<MachnetRingSlot_t, NUM_CACHED_BUFS> cached_buf_indices;
-  std::array<MachnetMsgBuf_t *, NUM_CACHED_BUFS> cached_bufs;
-  uint32_t cached_buf_count;
+  int doorbell_fd_;
+  int notify_fd_;
+  int numa_node_;
+  // Whether messages have been delivered since the last `WakeUpApp'.
+  bool delivered_;
+  // The queue pair `DequeueMessages' polls first (the shared ring comes after
+  // the last one).
+  uint32_t next_queue_;
+  // Free buffers cached by the engine, per size class.
+  struct BufCache {
+    std::array<MachnetRingSlot_t, NUM_CACHED_BUFS> indices;
+    std::array<MachnetMsgBuf_t *, NUM_CACHED_BUFS> bufs;
+    uint32_t count;
+  };
+  std::array<BufCache, MACHNET_CHANNEL_BUF_CLASSES_MAX> buf_caches_;
+  // The budget an elastic pool grows from (see `SetBufBudget'), if any.
+  std::shared_ptr<std::atomic<int64_t>> buf_budget_;
+  // Consecutive periodic processings with plenty of free buffers.
+  uint32_t buf_pool_idle_ticks_;
 };
 
 /**
@@ -405,14 +754,51 @@ class Channel : public ShmChannel {
   Channel(const std::string &name, const MachnetChannelCtx_t *ctx,
           const size_t channel_mem_size, const bool is_posix_shm,
           int channel_fd);
+  // As above, with the channel's doorbell and notification (see
+  // `ShmChannel').
+  Channel(const std::string &name, const MachnetChannelCtx_t *ctx,
+          const size_t channel_mem_size, const bool is_posix_shm,
+          int channel_fd, int doorbell_fd, int notify_fd);
   ~Channel();
   Channel &operator=(const Channel &) = delete;
 
   /**
-   * @brief Get a pointer to mbuf shinfo structure for this channel's buffers.
-   * @return A pointer to the mbuf shinfo structure.
+   * @brief Takes a reference to a message buffer that is about to be attached
+   * to a packet as an external buffer, and returns the mbuf shinfo to attach
+   * it with.
+   *
+   * Each buffer has its own shinfo, whose refcount is the number of packets
+   * the buffer is attached to, plus one held by the owner of the buffer (i.e.,
+   * the flow tracking it for retransmission) from the first attachment on. The
+   * buffer is freed when both the owner has released it (see
+   * `MsgBufExtRelease') and the NIC is done with every packet.
+   *
+   * @param msg_buf The message buffer to attach.
+   * @return A pointer to the mbuf shinfo of the buffer.
+   */
+  rte_mbuf_ext_shared_info *MsgBufExtAttach(const MsgBuf *msg_buf) {
+    auto *shinfo = &ext_shinfo_[msg_buf->index()];
+    if (rte_mbuf_ext_refcnt_read(shinfo) == 0) {
+      rte_mbuf_ext_refcnt_set(shinfo, 2);
+    } else {
+      rte_mbuf_ext_refcnt_update(shinfo, 1);
+    }
+    return shinfo;
+  }
+
+  /**
+   * @brief Releases the owner's reference to a message buffer (see
+   * `MsgBufExtAttach').
+   * @param msg_buf The message buffer to release.
+   * @return True if the buffer is not attached to any packet and can be freed
+   * by the caller; false if packets still hold it, in which case it is freed
+   * when the last of them is.
    */
-  rte_mbuf_ext_shared_info *GetMbufExtShinfo() { return &sh_info_; }
+  bool MsgBufExtRelease(const MsgBuf *msg_buf) {
+    auto *shinfo = &ext_shinfo_[msg_buf->index()];
+    if (rte_mbuf_ext_refcnt_read(shinfo) == 0) return true;
+    return rte_mbuf_ext_refcnt_update(shinfo, -1) == 0;
+  }
 
   /**
    * @brief Register `Channel' memory as DPDK external memory.
@@ -425,12 +811,40 @@ class Channel : public ShmChannel {
    */
   void UnregisterDMAMem();
 
+  /**
+   * @brief Checks if the channel memory is registered for DMA access.
+   */
+  bool IsDMARegistered() const { return attached_dev_ != nullptr; }
+
+  /**
+   * @brief Gets the message buffer whose base (see `MsgBuf::base') is at
+   * `buf_va'. This is how the engine finds the message buffer a packet was
+   * received into, when the NIC receives directly into channel buffers.
+   * @param buf_va Start address of the data buffer of a packet.
+   * @return A pointer to the message buffer, or nullptr if `buf_va' is not the
+   * base of one of this channel's buffers.
+   */
+  MsgBuf *GetMsgBufByBase(const void *buf_va) {
+    const auto *addr = static_cast<const uchar_t *>(buf_va);
+    const auto *pool = GetBufPoolAddr();
+    if (addr < pool + MACHNET_MSGBUF_SPACE_RESERVED ||
+        addr >= pool + GetBufPoolSize()) {
+      return nullptr;
+    }
+    // Buffers of any size class.
+    auto *msgbuf = GetMsgBuf(__machnet_channel_buf_index(
+        ctx(), reinterpret_cast<const MachnetMsgBuf_t *>(
+                   addr - MACHNET_MSGBUF_SPACE_RESERVED)));
+    if (msgbuf->base<const uchar_t *>() != addr) return nullptr;
+    return msgbuf;
+  }
+
  protected:
   /**
    * @brief Gets the list of active flows.
    * @return A reference to the list of active flows.
    */
-  std::list<std::unique_ptr<Flow>> &GetActiveFlows() { return active_flows_; }
+  std::list<FlowSlab::Ptr> &GetActiveFlows() { return active_flows_; }
 
   /**
    * @brief Gets the list of listeners associated with the channel.
@@ -440,19 +854,26 @@ class Channel : public ShmChannel {
 
   /**
    * @brief Creates a new flow associated with `this' channel object.
+   * @param slab   The slab to allocate the flow from (the engine's).
    * @param params The parameters pack to be forwarded to the constructor of the
    *               Flow.
    * @return A const iterator to the newly created flow.
    */
-  const std::list<std::unique_ptr<Flow>>::const_iterator CreateFlow(
-      auto &&...params) {
-    active_flows_.emplace_back(std::make_unique<Flow>(
-        std::forward<decltype(params)>(params)..., this));
+  const std::list<FlowSlab::Ptr>::const_iterator CreateFlow(
+      const std::shared_ptr<FlowSlab> &slab, auto &&...params) {
+    auto flow = slab->New(std::forward<decltype(params)>(params)..., this);
+    CHECK(flow != nullptr) << "Out of memory for flows of " << GetName();
+    active_flows_.emplace_back(std::move(flow));
     return std::prev(active_flows_.end());
   }
 
-  void RemoveFlow(
-      const std::list<std::unique_ptr<Flow>>::const_iterator &flow_it);
+  void RemoveFlow(const std::list<FlowSlab::Ptr>::const_iterator &flow_it);
+
+  /**
+   * @brief Removes (and destroys) a flow associated with `this' channel.
+   * @param flow Pointer to the flow to be removed.
+   */
+  void RemoveFlow(const Flow *flow);
 
   /**
    * @brief Adds a listener to the channel (i.e., an IP address and port pair).
@@ -467,28 +888,26 @@ class Channel : public ShmChannel {
   }
 
  private:
-  static void free_ext_buf_cb(void *arg, void *opaque) {
-    // Empty callback.
-
-    // DPDK requires a callback to be registered with the mbuf shinfo in the
-    // case of external buffers. The purpose of this callback is to do any post
-    // mbuf release cleanup.
+  static void free_ext_buf_cb(void *addr, void *opaque) {
+    // Called by DPDK when the last packet a message buffer is attached to is
+    // freed, after its owner released it (see `MsgBufExtAttach').
 
     // There is a caveat with this mechanism: The callback is only called by
-    // DPDK if the `FAST_FREE' offload is not set and the reference count has
-    // reached zero. With `FAST_FREE' offload enabled, the mbuf is simply put
-    // back to the relevant pool with only minimal initialization. We do not
-    // need this callback to re-initialize mbufs; we explicitly initialize them
-    // in the stack and no further book-keeping is required for channel buffers.
+    // DPDK if the `FAST_FREE' offload is not set. With `FAST_FREE' offload
+    // enabled, the mbuf is simply put back to the relevant pool with only
+    // minimal initialization, and the buffer would never be freed; packets
+    // must not carry channel buffers then (see `PmdPort::IsTxFastFreeEnabled').
+    auto *channel = static_cast<Channel *>(opaque);
+    CHECK(channel->MsgBufFree(CHECK_NOTNULL(channel->GetMsgBufByBase(addr))));
   }
 
-  rte_mbuf_ext_shared_info sh_info_{
-      .free_cb = free_ext_buf_cb, .fcb_opaque = nullptr, .refcnt = 0};
+  // Per message buffer mbuf shinfo, to attach buffers to packets.
+  std::vector<rte_mbuf_ext_shared_info> ext_shinfo_;
 
   // List of listeners associated with this channel.
   std::unordered_set<Listener> listeners_;
   // List of active flows associated with this channel.
-  std::list<std::unique_ptr<Flow>> active_flows_;
+  std::list<FlowSlab::Ptr> active_flows_;
 
   // DPDK external memory region.
   rte_device *attached_dev_{nullptr};
@@ -500,6 +919,92 @@ class Channel : public ShmChannel {
   class ChannelManager;
 };
 
+/**
+ * @brief Class `PendingBitmap' holds the shared-memory bitmap of channels with
+ * pending work of one Machnet engine (see `MachnetPendingBitmap_t'), and the
+ * allocation of its slots to channels.
+ *
+ * The bitmap is backed by an anonymous memory file whose descriptor is passed
+ * to the applications, which set their channel's bit after enqueueing to it.
+ * All the applications of the engine map the same bitmap. A misbehaving
+ * application can only cause spurious polls of other channels.
+ *
+ * This class is non-copyable and not thread-safe.
+ */
+class PendingBitmap {
+ public:
+  static constexpr size_t kSlotsNr = MACHNET_PENDING_BITMAP_BITS;
+  static constexpr size_t kWordsNr = kSlotsNr / 64;
+
+  PendingBitmap() : fd_(-1), bitmap_(nullptr), slots_{} {
+    fd_ = memfd_create("machnet_pending_bitmap", MFD_CLOEXEC);
+    CHECK_GE(fd_, 0) << "memfd_create() failed: " << strerror(errno);
+    CHECK_EQ(ftruncate(fd_, sizeof(*bitmap_)), 0);
+    void *mem = mmap(nullptr, sizeof(*bitmap_), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd_, 0);
+    CHECK(mem != MAP_FAILED) << "mmap() failed: " << strerror(errno);
+    bitmap_ = static_cast<MachnetPendingBitmap_t *>(mem);
+    std::memset(bitmap_, 0, sizeof(*bitmap_));
+  }
+  PendingBitmap(const PendingBitmap &) = delete;
+  PendingBitmap &operator=(const PendingBitmap &) = delete;
+  ~PendingBitmap() {
+    munmap(bitmap_, sizeof(*bitmap_));
+    close(fd_);
+  }
+
+  // Get the file descriptor of the bitmap's memory.
+  int GetFd() const { return fd_; }
+
+  /**
+   * @brief Allocates a free slot.
+   * @return The slot index, or `std::nullopt' if all slots are in use.
+   */
+  std::optional<uint32_t> AllocSlot() {
+    for (size_t w = 0; w < kWordsNr; w++) {
+      if (~slots_[w] == 0) continue;
+      const uint32_t bit = __builtin_ctzll(~slots_[w]);
+      slots_[w] |= 1ULL << bit;
+      return w * 64 + bit;
+    }
+    return std::nullopt;
+  }
+
+  // Releases a slot allocated with `AllocSlot'.
+  void FreeSlot(uint32_t slot) {
+    DCHECK_LT(slot, kSlotsNr);
+    slots_[slot / 64] &= ~(1ULL << (slot % 64));
+  }
+
+  // Returns the number of words holding allocated slots (i.e., the words worth
+  // scanning).
+  size_t GetActiveWordsNr() const {
+    for (size_t w = kWordsNr; w > 0; w--) {
+      if (slots_[w - 1] != 0) return w;
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Collects and clears the pending bits of one word of the bitmap.
+   * Must be called before dequeueing from the respective channels.
+   *
+   * @param word Index of the word.
+   * @return The bits that were set.
+   */
+  uint64_t Collect(size_t word) {
+    auto *p = &bitmap_->words[word];
+    // Avoid the atomic operation on the shared cache line when possible.
+    if (__atomic_load_n(p, __ATOMIC_RELAXED) == 0) return 0;
+    return __atomic_exchange_n(p, 0, __ATOMIC_SEQ_CST);
+  }
+
+ private:
+  int fd_;
+  MachnetPendingBitmap_t *bitmap_;
+  std::array<uint64_t, kWordsNr> slots_;
+};
+
 /**
  * @brief Class `ChannelManager' is a class that can be used to manage channels.
  * A `ChannelManager' provides method to create, destroy and access the
@@ -511,7 +1016,7 @@ template <class T = Channel,
                                       std::is_same<T, ShmChannel>::value>::type>
 class ChannelManager {
  public:
-  static constexpr size_t kMaxChannelNr = 32;
+  static constexpr size_t kMaxChannelNr = 1024;
   static constexpr size_t kDefaultRingSize = 256;
   static constexpr size_t kDefaultBufferCount = 4096;
   ChannelManager() {}
@@ -530,13 +1035,25 @@ class ChannelManager {
    * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
    *                           power of 2).
    * @param buffer_size        The size of each buffer (power of 2).
+   * @param queue_pairs_nr     The number of per-thread queue pairs, with rings
+   *                           of the sizes above.
+   * @param flags              The creation flags (`MACHNET_CHANNEL_F_*').
+   * @param buf_classes        Size classes of smaller buffers, besides the
+   *                           default ones, in increasing size.
+   * @param buf_segs_max       1 for a fixed pool of default buffers; more for
+   *                           an elastic one, of up to as many segments of
+   *                           `buf_ring_slot_nr' buffers (see
+   *                           `ShmChannel::GrowBufPool').
    * @return
    *   - `true` if the channel was successfully created.
    *   - `false` otherwise.
    */
-  bool AddChannel(const char *name, size_t machnet_ring_slot_nr,
-                  size_t app_ring_slot_nr, size_t buf_ring_slot_nr,
-                  size_t buffer_size) {
+  bool AddChannel(
+      const char *name, size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+      size_t buf_ring_slot_nr, size_t buffer_size, size_t queue_pairs_nr = 0,
+      uint32_t flags = 0,
+      const std::vector<MachnetChannelBufClassConf_t> &buf_classes = {},
+      size_t buf_segs_max = 1) {
     const std::lock_guard<std::mutex> lock(mtx_);
     if (channels_.size() >= kMaxChannelNr) {
       LOG(WARNING) << "Too many channels.";
@@ -548,21 +1065,102 @@ class ChannelManager {
       return false;
     }
 
+    auto channel =
+        NewChannel(name, machnet_ring_slot_nr, app_ring_slot_nr,
+                   buf_ring_slot_nr, buffer_size, queue_pairs_nr, flags,
+                   buf_classes, buf_segs_max);
+    if (channel == nullptr) return false;
+
+    channels_.insert(std::make_pair(name, std::move(channel)));
+    return true;
+  }
+
+  /**
+   * @brief Creates a channel without adding it to any manager, e.g., to keep
+   * it ready until it is asked for (see `AdoptChannel'). The parameters are
+   * those of `AddChannel'.
+   *
+   * @return A smart pointer to the channel (nullptr on failure).
+   */
+  static std::shared_ptr<T> NewChannel(
+      const char *name, size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+      size_t buf_ring_slot_nr, size_t buffer_size, size_t queue_pairs_nr = 0,
+      uint32_t flags = 0,
+      const std::vector<MachnetChannelBufClassConf_t> &buf_classes = {},
+      size_t buf_segs_max = 1) {
     int channel_fd;
     size_t shm_segment_size;
     int is_posix_shm;
     auto *ctx = __machnet_channel_create(
         name, machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
-        buffer_size, &shm_segment_size, &is_posix_shm, &channel_fd);
+        buf_segs_max, buffer_size, buf_classes.data(), buf_classes.size(),
+        queue_pairs_nr, flags, &shm_segment_size, &is_posix_shm, &channel_fd);
     if (ctx == nullptr) {
       LOG(WARNING) << "Failed to create channel " << name
                    << " with requested size " << shm_segment_size << ".";
+      return nullptr;
+    }
+
+    return std::make_shared<T>(name, ctx, shm_segment_size, is_posix_shm,
+                               channel_fd);
+  }
+
+  /**
+   * @brief Maps a channel created by another process, given its descriptors,
+   * without adding it to any manager; e.g., the channels a Machnet hands over
+   * to its successor (see `ShmChannel::HandOff'). The channel takes the
+   * descriptors over, and closes them when it goes away; on failure, they
+   * are closed at once.
+   *
+   * @param shm_name    Name of the channel's shared memory segment, to
+   *                    remove it along with the channel.
+   * @param channel_fd  Descriptor of the shared memory segment.
+   * @param doorbell_fd Descriptor of the channel's doorbell, or -1.
+   * @param notify_fd   Descriptor of the channel's notification, or -1.
+   * @return A smart pointer to the channel (nullptr on failure).
+   */
+  static std::shared_ptr<T> MapChannel(const char *shm_name, int channel_fd,
+                                       int doorbell_fd, int notify_fd) {
+    size_t shm_segment_size;
+    int is_posix_shm;
+    auto *ctx =
+        __machnet_channel_map(channel_fd, &shm_segment_size, &is_posix_shm);
+    if (ctx == nullptr) {
+      LOG(WARNING) << "Failed to map channel " << shm_name << ".";
+      for (const int fd : {channel_fd, doorbell_fd, notify_fd}) {
+        if (fd >= 0) close(fd);
+      }
+      return nullptr;
+    }
+
+    return std::make_shared<T>(shm_name, ctx, shm_segment_size, is_posix_shm,
+                               channel_fd, doorbell_fd, notify_fd);
+  }
+
+  /**
+   * @brief Adds a channel created with `NewChannel' to the manager, under a
+   * (new) name.
+   *
+   * @param name    Name of the channel in the manager.
+   * @param channel The channel; renamed to `name'.
+   * @return
+   *   - `true` if the channel was added.
+   *   - `false` otherwise (e.g., a channel of that name exists already).
+   */
+  bool AdoptChannel(const char *name, std::shared_ptr<T> channel) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    if (channels_.size() >= kMaxChannelNr) {
+      LOG(WARNING) << "Too many channels.";
+      return false;
+    }
+
+    if (channels_.find(name) != channels_.end()) {
+      LOG(WARNING) << "Channel " << name << " already exists.";
       return false;
     }
 
-    channels_.insert(
-        std::make_pair(name, std::make_shared<T>(name, ctx, shm_segment_size,
-                                                 is_posix_shm, channel_fd)));
+    channel->Rename(name);
+    channels_.insert(std::make_pair(name, std::move(channel)));
     return true;
   }
 
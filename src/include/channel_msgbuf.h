@@ -11,6 +11,8 @@
 #include <udp.h>
 #include <utils.h>
 
+#include <optional>
+
 namespace juggler {
 namespace shm {
 
@@ -74,6 +76,26 @@ class MsgBuf {
   bool is_first() const { return (flags() & MACHNET_MSGBUF_FLAGS_SYN) != 0; }
   // Returns true if the `MachnetMsgBuf_t' is the last in a message.
   bool is_last() const { return (flags() & MACHNET_MSGBUF_FLAGS_FIN) != 0; }
+  // Returns the TSC cycles from the stamp of the message (see
+  // `set_tsc_stamp') to `now', if it has one.
+  std::optional<uint64_t> stamp_age(uint64_t now) const {
+    if (msg_buf_.tsc_stamp == 0) return std::nullopt;
+    const uint32_t ticks =
+        static_cast<uint32_t>(now >> MACHNET_MSGBUF_TSC_SHIFT) -
+        msg_buf_.tsc_stamp;
+    // Stamps round up by a tick.
+    if (ticks > UINT32_MAX / 2) return 0;
+    return static_cast<uint64_t>(ticks) << MACHNET_MSGBUF_TSC_SHIFT;
+  }
+  // Returns true if the `MachnetMsgBuf_t' stands for a payload buffer of a
+  // fan-out send (see `MACHNET_MSGBUF_FLAGS_ALIAS').
+  bool is_alias() const {
+    return (flags() & MACHNET_MSGBUF_FLAGS_ALIAS) != 0;
+  }
+  // Returns the index of the payload buffer an alias stands for.
+  uint32_t alias_target() const {
+    return __machnet_channel_buf_alias_target(&msg_buf_);
+  }
   // Returns true if the `MachnetMsgBuf_t' is the last in a message.
   bool is_sg() const { return (flags() & MACHNET_MSGBUF_FLAGS_SG) != 0; }
 
@@ -107,13 +129,25 @@ class MsgBuf {
   // Returns the last message buffer index in the chain.
   uint32_t last() const { return msg_buf_.last; }
 
+  // Returns the queue pair of the channel the message was sent on.
+  uint32_t queue() const { return msg_buf_.queue; }
+
+  // Re-initializes the buffer: no data, flags or flow, and default headroom.
+  void reset() { __machnet_channel_buf_init(&msg_buf_); }
+
   // Setters.
   void set_iova(uintptr_t iova) {
     *const_cast<uintptr_t *>(&msg_buf_.iova) = iova;
   }
   void set_length(uint32_t len) { msg_buf_.data_len = len; }
+  void set_data_offset(uint32_t ofs) { msg_buf_.data_ofs = ofs; }
   void set_msg_length(uint32_t len) { msg_buf_.msg_len = len; }
   void set_flags(uint16_t flags) { msg_buf_.flags = flags; }
+  // Stamps the message with a TSC (see `MachnetMsgBuf_t::tsc_stamp').
+  void set_tsc_stamp(uint64_t tsc) {
+    msg_buf_.tsc_stamp =
+        static_cast<uint32_t>(tsc >> MACHNET_MSGBUF_TSC_SHIFT) | 1;
+  }
   void add_flags(uint16_t flags) { msg_buf_.flags |= flags; }
   void set_src_ip(uint32_t ip) { msg_buf_.flow.src_ip = ip; }
   void set_src_port(uint16_t port) { msg_buf_.flow.src_port = port; }
@@ -125,6 +159,10 @@ class MsgBuf {
   }
   void set_next(MsgBuf *next) { set_next(next->index()); }
   void set_last(uint32_t last) { msg_buf_.last = last; }
+  void set_queue(uint32_t queue) { msg_buf_.queue = queue; }
+  // Drops a reference to a payload buffer of a fan-out send, and returns the
+  // number left.
+  uint32_t unref() { return __machnet_channel_buf_unref(&msg_buf_, 1); }
   void mark_first() { add_flags(MACHNET_MSGBUF_FLAGS_SYN); }
   void mark_last() { add_flags(MACHNET_MSGBUF_FLAGS_FIN); }
 
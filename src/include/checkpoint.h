@@ -0,0 +1,163 @@
+/**
+ * @file checkpoint.h
+ * @brief Serialization of the state a Machnet hands over to its successor on
+ * a hot restart (see `MachnetController::TakeOver'), through an anonymous
+ * memory file.
+ */
+#ifndef SRC_INCLUDE_CHECKPOINT_H_
+#define SRC_INCLUDE_CHECKPOINT_H_
+
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+
+/**
+ * @brief Writes values, as laid out in memory, one after the other. Only the
+ * same build of Machnet may read them back (see `CheckpointReader'); the
+ * checkpoint starts with a version to tell.
+ */
+class CheckpointWriter {
+ public:
+  CheckpointWriter() = default;
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  template <typename T>
+  void Put(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+    data_.insert(data_.end(), bytes, bytes + sizeof(T));
+  }
+  // Vectors and strings are preceded by their number of elements.
+  template <typename T>
+  void Put(const std::vector<T> &values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Put<uint64_t>(values.size());
+    const auto *bytes = reinterpret_cast<const uint8_t *>(values.data());
+    data_.insert(data_.end(), bytes, bytes + values.size() * sizeof(T));
+  }
+  void Put(const std::string &value) {
+    Put<uint64_t>(value.size());
+    data_.insert(data_.end(), value.begin(), value.end());
+  }
+
+  size_t size() const { return data_.size(); }
+
+  /**
+   * @brief Writes the checkpoint to a new anonymous memory file, to be passed
+   * to another process.
+   * @return The descriptor of the file, or -1 on failure.
+   */
+  int ToFd() const {
+    const int fd = memfd_create("machnet-checkpoint", MFD_CLOEXEC);
+    if (fd < 0) {
+      PLOG(ERROR) << "Failed to create a checkpoint file";
+      return -1;
+    }
+    size_t written = 0;
+    while (written < data_.size()) {
+      const auto ret =
+          write(fd, data_.data() + written, data_.size() - written);
+      if (ret <= 0) {
+        PLOG(ERROR) << "Failed to write the checkpoint file";
+        close(fd);
+        return -1;
+      }
+      written += ret;
+    }
+    return fd;
+  }
+
+ private:
+  std::vector<uint8_t> data_{};
+};
+
+/**
+ * @brief Reads back the values of a `CheckpointWriter', in the same order.
+ * Reads past the end fail, and so do all the reads after them.
+ */
+class CheckpointReader {
+ public:
+  // Reads the whole checkpoint file; the descriptor stays open.
+  explicit CheckpointReader(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      PLOG(ERROR) << "Failed to stat the checkpoint file";
+      ok_ = false;
+      return;
+    }
+    data_.resize(st.st_size);
+    size_t read_nr = 0;
+    while (read_nr < data_.size()) {
+      const auto ret =
+          pread(fd, data_.data() + read_nr, data_.size() - read_nr, read_nr);
+      if (ret <= 0) {
+        PLOG(ERROR) << "Failed to read the checkpoint file";
+        ok_ = false;
+        return;
+      }
+      read_nr += ret;
+    }
+  }
+  CheckpointReader(const CheckpointReader &) = delete;
+  CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+  template <typename T>
+  bool Get(T *value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (!Has(sizeof(T))) return false;
+    std::memcpy(value, data_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+  template <typename T>
+  bool Get(std::vector<T> *values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    uint64_t size;
+    // Bounds `size' first, so that the product cannot overflow.
+    if (!Get(&size) || !Has(size) || !Has(size * sizeof(T))) return false;
+    values->resize(size);
+    std::memcpy(values->data(), data_.data() + offset_, size * sizeof(T));
+    offset_ += size * sizeof(T);
+    return true;
+  }
+  bool Get(std::string *value) {
+    uint64_t size;
+    if (!Get(&size) || !Has(size)) return false;
+    value->assign(reinterpret_cast<const char *>(data_.data() + offset_),
+                  size);
+    offset_ += size;
+    return true;
+  }
+
+  // Whether all the reads so far succeeded.
+  bool ok() const { return ok_; }
+  // Whether everything was read.
+  bool AtEnd() const { return ok_ && offset_ == data_.size(); }
+
+ private:
+  bool Has(uint64_t size) {
+    if (ok_ && size <= data_.size() - offset_) return true;
+    ok_ = false;
+    return false;
+  }
+
+  std::vector<uint8_t> data_{};
+  size_t offset_{0};
+  bool ok_{true};
+};
+
+}  // namespace utils
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CHECKPOINT_H_
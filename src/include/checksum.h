@@ -0,0 +1,230 @@
+/**
+ * @file checksum.h
+ * @brief The Internet checksum (RFC 1071): vectorized kernels picked at
+ * runtime for the CPU (AVX-512, AVX2, or NEON on ARM), and helpers to update a
+ * checksum incrementally on header rewrites (RFC 1624).
+ *
+ * Sums are kept in memory order: words are summed as they are laid out in
+ * memory, so the 16-bit results can be stored into headers as they are, on
+ * any host. The ones' complement sum of 32-bit (or 64-bit) words folded to 16
+ * bits equals that of the 16-bit words, so kernels sum wide words.
+ */
+#ifndef SRC_INCLUDE_CHECKSUM_H_
+#define SRC_INCLUDE_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace juggler {
+namespace utils {
+
+/**
+ * @brief Folds a sum of words into 16 bits, with end-around carries.
+ */
+[[maybe_unused]] static inline uint16_t ChecksumFold(uint64_t sum) {
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(sum);
+}
+
+// The ones' complement sum of two folded sums.
+[[maybe_unused]] static inline uint16_t ChecksumAdd(uint16_t a, uint16_t b) {
+  return ChecksumFold(static_cast<uint32_t>(a) + b);
+}
+
+/**
+ * @brief Sums the bytes that follow the last full 8-byte word of a buffer; an
+ * odd trailing byte is padded with a zero byte, as RFC 1071 prescribes.
+ */
+[[maybe_unused]] static inline uint64_t ChecksumTail(const uint8_t *data,
+                                                    size_t length) {
+  uint64_t sum = 0;
+  if (length >= 4) {
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+    data += 4;
+    length -= 4;
+  }
+  if (length >= 2) {
+    uint16_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+    data += 2;
+    length -= 2;
+  }
+  if (length == 1) {
+    uint16_t word = 0;
+    std::memcpy(&word, data, 1);
+    sum += word;
+  }
+  return sum;
+}
+
+/**
+ * @brief The portable kernel: sums 32-bit words into a 64-bit accumulator,
+ * which cannot overflow for any buffer that fits in memory.
+ * @return The unfolded sum (see `ChecksumFold').
+ */
+[[maybe_unused]] static inline uint64_t ChecksumSumScalar(const uint8_t *data,
+                                                         size_t length) {
+  uint64_t sum0 = 0, sum1 = 0;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint32_t words[2];
+    std::memcpy(words, data, sizeof(words));
+    sum0 += words[0];
+    sum1 += words[1];
+  }
+  return sum0 + sum1 + ChecksumTail(data, length);
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief AVX2 kernel: 32-bit words are zero-extended to 64-bit lanes and
+ * summed, two vectors of 32 bytes per iteration.
+ */
+__attribute__((target("avx2"))) static inline uint64_t ChecksumSumAvx2(
+    const uint8_t *data, size_t length) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  for (; length >= 64; data += 64, length -= 64) {
+    const __m256i v0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    const __m256i v1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+  }
+  alignas(32) uint64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes),
+                     _mm256_add_epi64(acc0, acc1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         ChecksumSumScalar(data, length);
+}
+
+/**
+ * @brief AVX-512 kernel: the low and high 32-bit halves of 64-bit lanes are
+ * summed apart, two vectors of 64 bytes per iteration. Lanes are handled as
+ * generic vectors: the unpack and shift intrinsics trip -Wmaybe-uninitialized
+ * in some versions of GCC.
+ */
+__attribute__((target("avx512f"))) static inline uint64_t ChecksumSumAvx512(
+    const uint8_t *data, size_t length) {
+  using u64x8 = uint64_t __attribute__((vector_size(64)));
+  u64x8 acc0 = {}, acc1 = {};
+  for (; length >= 128; data += 128, length -= 128) {
+    const auto v0 = reinterpret_cast<u64x8>(_mm512_loadu_si512(data));
+    const auto v1 = reinterpret_cast<u64x8>(_mm512_loadu_si512(data + 64));
+    acc0 += (v0 & 0xFFFFFFFF) + (v1 & 0xFFFFFFFF);
+    acc1 += (v0 >> 32) + (v1 >> 32);
+  }
+  const u64x8 acc = acc0 + acc1;
+  uint64_t sum = 0;
+  for (int i = 0; i < 8; i++) sum += acc[i];
+  return sum + ChecksumSumScalar(data, length);
+}
+#elif defined(__aarch64__)
+/**
+ * @brief NEON kernel: pairs of 32-bit words are added into 64-bit lanes.
+ */
+static inline uint64_t ChecksumSumNeon(const uint8_t *data, size_t length) {
+  uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+  for (; length >= 32; data += 32, length -= 32) {
+    const auto *words = reinterpret_cast<const uint32_t *>(data);
+    acc0 = vpadalq_u32(acc0, vld1q_u32(words));
+    acc1 = vpadalq_u32(acc1, vld1q_u32(words + 4));
+  }
+  return vaddvq_u64(vaddq_u64(acc0, acc1)) + ChecksumSumScalar(data, length);
+}
+#endif
+
+using ChecksumKernel = uint64_t (*)(const uint8_t *, size_t);
+
+/**
+ * @brief Picks the fastest kernel the CPU supports.
+ */
+[[maybe_unused]] static inline ChecksumKernel SelectChecksumKernel() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return ChecksumSumAvx512;
+  if (__builtin_cpu_supports("avx2")) return ChecksumSumAvx2;
+  return ChecksumSumScalar;
+#elif defined(__aarch64__)
+  return ChecksumSumNeon;
+#else
+  return ChecksumSumScalar;
+#endif
+}
+
+// The kernel for large buffers, picked at startup.
+[[maybe_unused]] static const ChecksumKernel kChecksumKernel =
+    SelectChecksumKernel();
+// Below this length (e.g., headers), the portable kernel is faster.
+inline constexpr size_t kChecksumVectorMinLength = 128;
+
+/**
+ * @brief Computes the ones' complement sum of a buffer (not complemented).
+ *
+ * @param data    The buffer; no alignment is required.
+ * @param length  Length of the buffer in bytes; an odd trailing byte is padded
+ *                with a zero byte.
+ * @param initial A sum to add to, e.g., of a pseudo-header, or of the
+ *                preceding part of a buffer of even length.
+ * @return The sum, folded to 16 bits, in memory order.
+ */
+[[maybe_unused]] static inline uint16_t RawChecksum(const void *data,
+                                                    size_t length,
+                                                    uint16_t initial = 0) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  const uint64_t sum = length < kChecksumVectorMinLength
+                           ? ChecksumSumScalar(bytes, length)
+                           : kChecksumKernel(bytes, length);
+  return ChecksumFold(sum + initial);
+}
+
+/**
+ * @brief Updates a checksum as a 16-bit word it covers changes (RFC 1624,
+ * eqn. 3): HC' = ~(~HC + ~m + m'). All values are in memory order.
+ *
+ * @param cksum    The checksum, as stored in the header.
+ * @param old_word The word before the change.
+ * @param new_word The word after the change.
+ * @return The new checksum.
+ */
+[[maybe_unused]] static inline uint16_t ChecksumUpdate16(uint16_t cksum,
+                                                         uint16_t old_word,
+                                                         uint16_t new_word) {
+  const uint32_t sum = static_cast<uint32_t>(static_cast<uint16_t>(~cksum)) +
+                       static_cast<uint16_t>(~old_word) + new_word;
+  return static_cast<uint16_t>(~ChecksumFold(sum));
+}
+
+/**
+ * @brief Updates a checksum as a 32-bit word it covers changes (e.g., an IPv4
+ * address, which is also in the pseudo-header of UDP). The word must be at an
+ * even offset of the checksummed data.
+ */
+[[maybe_unused]] static inline uint16_t ChecksumUpdate32(uint16_t cksum,
+                                                         uint32_t old_word,
+                                                         uint32_t new_word) {
+  cksum = ChecksumUpdate16(cksum, static_cast<uint16_t>(old_word),
+                           static_cast<uint16_t>(new_word));
+  return ChecksumUpdate16(cksum, static_cast<uint16_t>(old_word >> 16),
+                          static_cast<uint16_t>(new_word >> 16));
+}
+
+}  // namespace utils
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CHECKSUM_H_
@@ -0,0 +1,168 @@
+/**
+ * @file copy_engine.h
+ * @brief Tiered copies of message payloads: inline `memcpy' for small copies,
+ * non-temporal stores for mid-size ones, and a DMA engine (e.g., Intel DSA or
+ * IOAT, through DPDK's `dmadev') for large ones, asynchronously.
+ */
+#ifndef SRC_INCLUDE_COPY_ENGINE_H_
+#define SRC_INCLUDE_COPY_ENGINE_H_
+
+#include <glog/logging.h>
+#include <rte_dmadev.h>
+#include <utils.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief Copies payloads with the cheapest mechanism for their size. Copies of
+ * at least `nt_threshold' bytes use non-temporal stores, so that payloads
+ * headed to the NIC or to an application do not evict the engine's working
+ * set; copies of at least `dma_threshold' bytes are handed to a DMA device,
+ * if one is attached, and complete asynchronously (see `CopyAsync').
+ *
+ * A threshold of 0 disables its tier; by default every copy is a `memcpy'.
+ * Not thread-safe: each engine thread owns its own instance.
+ */
+class CopyEngine {
+ public:
+  static constexpr uint16_t kDefaultRingDescNr = 1024;
+
+  struct Stats {
+    uint64_t inline_nr;      // Copies with `memcpy'.
+    uint64_t nt_nr;          // Copies with non-temporal stores.
+    uint64_t dma_nr;         // Copies by the DMA device.
+    uint64_t dma_full_nr;    // DMA copies done on the CPU: the ring was full.
+    uint64_t dma_errors_nr;  // DMA copies that failed and were redone.
+  };
+
+  CopyEngine() = default;
+  CopyEngine(const CopyEngine &) = delete;
+  CopyEngine &operator=(const CopyEngine &) = delete;
+  ~CopyEngine() { DetachDmaDevice(); }
+
+  /**
+   * @brief Sets the minimum copy sizes of the non-temporal and DMA tiers, in
+   * bytes; 0 disables a tier.
+   */
+  void SetThresholds(size_t nt_threshold, size_t dma_threshold) {
+    nt_threshold_ = nt_threshold == 0 ? SIZE_MAX : nt_threshold;
+    dma_threshold_ = dma_threshold == 0 ? SIZE_MAX : dma_threshold;
+  }
+
+  /**
+   * @brief Configures and starts a DMA device, with one memory-to-memory
+   * virtual channel, for the copies of the DMA tier.
+   *
+   * @param name DPDK name of the device (e.g., its PCIe address, or a DSA work
+   * queue such as "wq0.0").
+   * @param ring_size Number of descriptors of the virtual channel.
+   * @return True on success; on failure, large copies stay on the CPU.
+   */
+  bool AttachDmaDevice(const std::string &name,
+                       uint16_t ring_size = kDefaultRingDescNr);
+
+  // Stops the DMA device, after waiting for pending copies.
+  void DetachDmaDevice();
+
+  bool HasDmaDevice() const { return dma_dev_id_.has_value(); }
+  const Stats &GetStats() const { return stats_; }
+
+  /**
+   * @brief Copies synchronously, on the CPU: with `memcpy', or non-temporal
+   * stores at or above the non-temporal threshold.
+   */
+  void Copy(void *__restrict__ dest, const void *__restrict__ src,
+            size_t len) {
+    if (len >= nt_threshold_) {
+      stats_.nt_nr++;
+      utils::CopyNonTemporal(dest, src, len);
+    } else {
+      stats_.inline_nr++;
+      utils::Copy(dest, src, len);
+    }
+  }
+
+  /**
+   * @brief Copies at or above the DMA threshold are submitted to the DMA
+   * device and complete by the next `Wait()'; the others are done as with
+   * `Copy'. Neither buffer may be touched until `Wait()' returns.
+   *
+   * @param dest      Destination of the copy.
+   * @param dest_iova IO address of `dest', for the DMA device.
+   * @param src       Source of the copy.
+   * @param src_iova  IO address of `src'.
+   * @param len       Number of bytes to copy.
+   */
+  void CopyAsync(void *dest, rte_iova_t dest_iova, const void *src,
+                 rte_iova_t src_iova, size_t len) {
+    if (len < dma_threshold_ || !HasDmaDevice()) {
+      Copy(dest, src, len);
+      return;
+    }
+    const int ret = rte_dma_copy(*dma_dev_id_, kVchan, src_iova, dest_iova,
+                                 len, RTE_DMA_OP_FLAG_SUBMIT);
+    if (ret < 0) [[unlikely]] {
+      // The ring is full (-ENOSPC): copy on the CPU rather than wait.
+      stats_.dma_full_nr++;
+      Copy(dest, src, len);
+      return;
+    }
+    stats_.dma_nr++;
+    pending_.push_back({dest, src, len});
+  }
+
+  // True if DMA copies were submitted since the last `Wait()'.
+  bool HasPending() const { return !pending_.empty(); }
+
+  /**
+   * @brief Waits for all the DMA copies submitted so far. Copies the device
+   * fails are redone on the CPU, so that every copy is done on return.
+   */
+  void Wait() {
+    if (pending_.empty()) return;
+    size_t done = 0;
+    while (done < pending_.size()) {
+      uint16_t last_idx;
+      bool has_error = false;
+      done += rte_dma_completed(*dma_dev_id_, kVchan, pending_.size() - done,
+                                &last_idx, &has_error);
+      if (has_error) [[unlikely]] {
+        RecoverFrom(done);
+        break;
+      }
+    }
+    pending_.clear();
+  }
+
+ private:
+  static constexpr uint16_t kVchan = 0;
+
+  struct PendingCopy {
+    void *dest;
+    const void *src;
+    size_t len;
+  };
+
+  // Drains the completions of a failed batch, then redoes on the CPU every
+  // copy from the first failed one on; redoing a copy that did succeed is
+  // harmless, as its source is unchanged.
+  void RecoverFrom(size_t failed);
+
+  size_t nt_threshold_{SIZE_MAX};
+  size_t dma_threshold_{SIZE_MAX};
+  std::optional<int16_t> dma_dev_id_{std::nullopt};
+  std::vector<PendingCopy> pending_{};
+  Stats stats_{};
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_COPY_ENGINE_H_
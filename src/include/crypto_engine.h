@@ -0,0 +1,249 @@
+/**
+ * @file crypto_engine.h
+ * @brief Encryption of flow payloads with AES-GCM, on a DPDK crypto device
+ * (`cryptodev'): an accelerator (e.g., Intel QAT), or AES-NI on the CPU
+ * through the "crypto_aesni_gcm" virtual device.
+ */
+#ifndef SRC_INCLUDE_CRYPTO_ENGINE_H_
+#define SRC_INCLUDE_CRYPTO_ENGINE_H_
+
+#include <glog/logging.h>
+#include <packet.h>
+#include <rte_cryptodev.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief Encrypts and authenticates packet payloads with AES-GCM, in the
+ * layout of Machnet's encrypted data packets: the authenticated header (e.g.,
+ * the Machnet header), an explicit IV, the ciphertext, and the tag.
+ *
+ * Encryption is asynchronous, batched with the transmissions (see
+ * `EncryptAsync'); decryption is synchronous, one RX burst at a time (see
+ * `Decrypt'). Keys are per flow and direction, derived from a master key the
+ * peers share (see `DeriveKey'), each with a session on the device (see
+ * `CryptoKey').
+ *
+ * Not thread-safe: each engine thread owns its own instance, and device.
+ */
+class CryptoEngine {
+ public:
+  using Session = struct rte_cryptodev_sym_session;
+
+  // Nonce of AES-GCM: 4 zero bytes, then the explicit IV of the packet.
+  static constexpr size_t kNonceLen = 12;
+  static constexpr size_t kIvLen = 8;
+  static constexpr size_t kTagLen = 16;
+  // Bytes an encrypted packet carries on top of its plaintext.
+  static constexpr size_t kOverhead = kIvLen + kTagLen;
+  static constexpr size_t kMaxKeyLen = 32;
+  static constexpr uint32_t kDefaultSessionsNr = 8192;
+  static constexpr uint32_t kDefaultOpsNr = 2048;
+
+  struct Stats {
+    uint64_t encrypted_nr;      // Packets encrypted.
+    uint64_t decrypted_nr;      // Packets decrypted and authenticated.
+    uint64_t auth_failures_nr;  // Packets received that failed to.
+    uint64_t errors_nr;         // Packets the device failed to encrypt.
+  };
+
+  CryptoEngine() = default;
+  CryptoEngine(const CryptoEngine &) = delete;
+  CryptoEngine &operator=(const CryptoEngine &) = delete;
+  ~CryptoEngine() { DetachDevice(); }
+
+  /**
+   * @brief Configures and starts a crypto device, with one queue pair, for
+   * AES-GCM with keys as long as `master_key'.
+   *
+   * @param name       DPDK name of the device (e.g., "crypto_aesni_gcm0", or
+   *                   the PCIe address of an accelerator).
+   * @param master_key Key the peers share, of 16 or 32 bytes.
+   * @param aad_len    Length of the header authenticated with the payload.
+   * @param sessions_nr Maximum number of sessions, two per flow.
+   * @return True on success.
+   */
+  bool AttachDevice(const std::string &name,
+                    const std::vector<uint8_t> &master_key, uint16_t aad_len,
+                    uint32_t sessions_nr = kDefaultSessionsNr);
+
+  // Stops the device, after waiting for pending encryptions. Sessions must be
+  // destroyed first.
+  void DetachDevice();
+
+  bool HasDevice() const { return dev_id_.has_value(); }
+  // Whether the device runs on the CPU, and so reads any memory of the
+  // process, not only memory registered for DMA.
+  bool IsCpuDevice() const { return cpu_device_; }
+  // Whether the device writes the ciphertext to another buffer than the
+  // plaintext (see `EncryptAsync').
+  bool SupportsOutOfPlace() const { return out_of_place_; }
+  size_t GetKeyLen() const { return key_len_; }
+  const Stats &GetStats() const { return stats_; }
+
+  /**
+   * @brief Derives the key of one direction of a flow from the master key and
+   * the random nonces of both ends, of `kNonceLen' bytes each. AES in counter
+   * mode serves as a pseudo-random function, cascaded: the keystream of the
+   * master key for the initiator's nonce keys the one for the responder's
+   * nonce, tweaked with the direction. The key is thus fresh as long as
+   * either nonce is, whatever the other end (or an attacker) sends.
+   *
+   * @param key Buffer of `GetKeyLen()' bytes for the key.
+   * @return False if the device fails.
+   */
+  bool DeriveKey(const uint8_t *initiator_nonce,
+                 const uint8_t *responder_nonce, uint8_t direction,
+                 uint8_t *key);
+
+  /**
+   * @brief Creates a session that encrypts, or decrypts, with `key', of
+   * `GetKeyLen()' bytes.
+   * @return The session, or nullptr if out of sessions.
+   */
+  Session *CreateSession(const uint8_t *key, bool encrypt);
+  // Destroys a session, after waiting for its pending encryptions.
+  void DestroySession(Session *session);
+
+  /**
+   * @brief Stages the encryption of a packet, done by the next `Wait()'; the
+   * TX batch waits before sending (see `TxBatch::Flush'). Neither packet may
+   * be touched until then. Packets the device fails to encrypt have their
+   * payload and tag zeroed: plaintext never leaves.
+   *
+   * @param session Encrypting session.
+   * @param dst     Packet laid out as the header, authenticated from
+   *                `aad_offset' on, the IV, `len' bytes of payload and the
+   *                tag. Takes the ciphertext and the tag.
+   * @param src     Packet with the plaintext at the same offset as in `dst',
+   *                freed once encrypted; nullptr to encrypt `dst' in place.
+   * @param aad_offset Offset of the authenticated header.
+   * @param len     Length of the payload.
+   * @param iv      Explicit IV, already written to `dst'; unique per key.
+   */
+  void EncryptAsync(Session *session, Packet *dst, Packet *src,
+                    uint16_t aad_offset, uint16_t len, uint64_t iv);
+
+  // True if encryptions were staged since the last `Wait()'.
+  bool HasPending() const { return !pending_.empty(); }
+
+  // Runs the encryptions staged so far to completion.
+  void Wait();
+
+  /**
+   * @brief Decrypts and authenticates packets in place, laid out as in
+   * `EncryptAsync'. The payload of those that fail is garbage.
+   *
+   * @param session    Decrypting session.
+   * @param pkts       Array of up to 64 packets.
+   * @param nb_pkts    Number of packets in the array.
+   * @param aad_offset Offset of the authenticated header.
+   * @return Bitmap of the packets authenticated: bit `i' for `pkts[i]'.
+   */
+  uint64_t Decrypt(Session *session, Packet *const *pkts, uint16_t nb_pkts,
+                   uint16_t aad_offset);
+
+ private:
+  static constexpr uint16_t kQp = 0;
+  static constexpr uint16_t kBurst = 64;
+  // The nonce of an operation follows its symmetric part.
+  static constexpr uint32_t kNonceOffset =
+      sizeof(struct rte_crypto_op) + sizeof(struct rte_crypto_sym_op);
+
+  // Fills in an AEAD operation on `len' bytes at `offset' in `dst' (and
+  // `src'), with the header at `aad_offset' and the tag right after.
+  void PrepareOp(struct rte_crypto_op *op, Session *session,
+                 struct rte_mbuf *dst, struct rte_mbuf *src,
+                 uint16_t aad_offset, uint16_t offset, uint16_t len,
+                 uint64_t iv);
+  // Runs operations to completion.
+  void Run(struct rte_crypto_op **ops, uint16_t nb_ops);
+  // Writes `GetKeyLen()' bytes of the keystream of `session' for `nonce'.
+  bool Keystream(Session *session, const uint8_t *nonce, uint8_t *out);
+  // Releases the pools of the device.
+  void FreePools();
+
+  std::optional<uint8_t> dev_id_{std::nullopt};
+  bool cpu_device_{false};
+  bool out_of_place_{false};
+  size_t key_len_{0};
+  uint16_t aad_len_{0};
+  struct rte_mempool *session_pool_{nullptr};
+  struct rte_mempool *session_priv_pool_{nullptr};
+  struct rte_mempool *op_pool_{nullptr};
+  // Buffers of key derivations.
+  struct rte_mempool *kdf_pool_{nullptr};
+  Session *master_session_{nullptr};
+  std::vector<struct rte_crypto_op *> pending_{};
+  Stats stats_{};
+};
+
+/**
+ * @brief A key of one direction of a flow, with its session on the crypto
+ * engine the flow is attached to (see `Bind').
+ */
+class CryptoKey {
+ public:
+  CryptoKey() = default;
+  CryptoKey(const CryptoKey &) = delete;
+  CryptoKey &operator=(const CryptoKey &) = delete;
+  ~CryptoKey() {
+    Unbind();
+    explicit_bzero(key_.data(), key_.size());
+  }
+
+  // Sets the key, unbound, for encryption or decryption.
+  void Set(const uint8_t *key, size_t len, bool encrypt) {
+    CHECK_LE(len, CryptoEngine::kMaxKeyLen);
+    Unbind();
+    std::memcpy(key_.data(), key, len);
+    len_ = len;
+    encrypt_ = encrypt;
+  }
+  bool IsSet() const { return len_ != 0; }
+  const uint8_t *data() const { return key_.data(); }
+  size_t size() const { return len_; }
+
+  /**
+   * @brief Creates the session of the key on `engine', after destroying the
+   * one on the previous engine, if any; nullptr only destroys it.
+   * @return False if the key is set and gets no session on `engine'.
+   */
+  bool Bind(CryptoEngine *engine) {
+    Unbind();
+    if (engine == nullptr || !IsSet()) return true;
+    if (engine->GetKeyLen() != len_) return false;
+    session_ = engine->CreateSession(key_.data(), encrypt_);
+    if (session_ == nullptr) return false;
+    engine_ = engine;
+    return true;
+  }
+  void Unbind() {
+    if (session_ != nullptr) engine_->DestroySession(session_);
+    session_ = nullptr;
+    engine_ = nullptr;
+  }
+  // Session of the key; nullptr if unbound.
+  CryptoEngine::Session *session() const { return session_; }
+
+ private:
+  std::array<uint8_t, CryptoEngine::kMaxKeyLen> key_{};
+  size_t len_{0};
+  bool encrypt_{false};
+  CryptoEngine *engine_{nullptr};
+  CryptoEngine::Session *session_{nullptr};
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CRYPTO_ENGINE_H_
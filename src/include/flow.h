@@ -9,7 +9,10 @@
 #include <cc.h>
 #include <channel.h>
 #include <channel_msgbuf.h>
+#include <checkpoint.h>
 #include <common.h>
+#include <copy_engine.h>
+#include <crypto_engine.h>
 #include <dpdk.h>
 #include <ether.h>
 #include <flow_key.h>
@@ -17,24 +20,154 @@
 #include <ipv4.h>
 #include <machnet_common.h>
 #include <machnet_pkthdr.h>
+#include <pacer.h>
 #include <packet.h>
 #include <packet_pool.h>
 #include <pmd.h>
+#include <scoreboard.h>
+#include <sys/random.h>
+#include <timer_wheel.h>
+#include <trace.h>
 #include <types.h>
 #include <udp.h>
 #include <utils.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <optional>
 #include <queue>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 namespace net {
 namespace flow {
 
+/**
+ * @brief Records a latency in one of the histograms of the latency stats
+ * (e.g., `&MachnetLatencyStats_t::rtt') of a channel, and of a flow, if it
+ * keeps its own (see `Flow::SetLatencyStats').
+ */
+inline void RecordLatency(shm::Channel* channel,
+                          MachnetLatencyStats_t* flow_stats,
+                          MachnetLatencyHist_t MachnetLatencyStats_t::*hist,
+                          uint64_t ns) {
+  __machnet_latency_hist_record(&(channel->GetEngineStats()->latency.*hist),
+                                ns);
+  if (flow_stats != nullptr) {
+    __machnet_latency_hist_record(&(flow_stats->*hist), ns);
+  }
+}
+
+/**
+ * @brief The completion of a message sent with `MACHNET_MSGBUF_NOTIFY_DELIVERY'
+ * (see `Channel::PostTxCompletions'), from its first buffer.
+ */
+inline MachnetTxCompletion_t TxCompletion(const shm::MsgBuf* msg,
+                                          uint16_t status) {
+  DCHECK(msg->is_first());
+  return {*msg->flow(), msg->msg_length(), status, 0};
+}
+
+/**
+ * @brief The state of an established flow that another process takes over on
+ * a hot restart (see `Flow::HandOff' and `Flow::Restore'): its protocol state,
+ * and its message buffers, by index in the channel, which the new process
+ * maps as is.
+ */
+struct FlowCheckpoint {
+  // No buffer (e.g., nothing in flight).
+  static constexpr uint32_t kNoBuf = UINT32_MAX;
+
+  struct Header {
+    // Flow key, in host byte order, and MAC address of the peer.
+    uint32_t local_addr;
+    uint32_t remote_addr;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint8_t remote_l2_addr[Ethernet::Address::kSize];
+    uint8_t cc;  // `swift::Algorithm'.
+    uint8_t path_ports_local;
+    uint8_t peer_splits;  // See `Flow::SetAggregation'.
+    uint32_t snd_una;
+    uint32_t snd_wnd;
+    uint32_t rcv_nxt;
+    uint32_t rcv_window;
+    uint32_t tx_window;  // Capacity of the scoreboard.
+    uint32_t mss;
+    uint32_t queue;  // Queue pair messages are delivered to.
+    uint64_t srtt_ns;
+    uint64_t rttvar_ns;
+    uint64_t min_rtt_ns;
+    uint64_t latest_rtt_ns;
+    uint64_t rto_ns;
+    uint64_t keepalive_ns;
+    uint64_t flowlet_gap_ns;
+    uint32_t paths_nr;
+    uint32_t max_paths_nr;
+    // Chain of the buffers sent and not acknowledged, then not sent.
+    uint32_t tx_first;
+    uint32_t tx_last;
+    uint32_t tx_tracked_nr;
+    // Completion due when the oldest message unacknowledged is, if its first
+    // buffer is acknowledged already (see `TXTracking::ReceiveAcks').
+    MachnetTxCompletion_t tx_compl;
+    uint32_t tx_compl_pending;
+    // Message being reassembled, and its length so far.
+    uint32_t rx_train_head;
+    uint32_t rx_train_tail;
+    uint32_t rx_train_len;
+    // Encryption (see `Flow::SetEncryption'): the keys of both directions,
+    // and the IV of the next packet sent.
+    uint8_t encrypted;
+    uint8_t key_len;
+    uint8_t tx_key[dpdk::CryptoEngine::kMaxKeyLen];
+    uint8_t rx_key[dpdk::CryptoEngine::kMaxKeyLen];
+    uint64_t tx_iv;
+  };
+  // A buffer received out of order, `distance' packets after `rcv_nxt'.
+  struct OutOfOrderBuf {
+    uint32_t distance;
+    uint32_t index;
+  };
+  // A complete message not delivered yet, for lack of room in the ring.
+  struct UndeliveredMsg {
+    uint32_t index;
+    uint32_t len;
+  };
+
+  void Write(utils::CheckpointWriter* writer) const {
+    writer->Put(hdr);
+    writer->Put(path_ports);
+    writer->Put(ooo_bufs);
+    writer->Put(undelivered);
+  }
+  bool Read(utils::CheckpointReader* reader) {
+    return reader->Get(&hdr) && reader->Get(&path_ports) &&
+           reader->Get(&ooo_bufs) && reader->Get(&undelivered);
+  }
+
+  Header hdr{};
+  std::vector<uint16_t> path_ports{};
+  std::vector<OutOfOrderBuf> ooo_bufs{};
+  std::vector<UndeliveredMsg> undelivered{};
+};
+
 class TXTracking {
  public:
+  // How many message buffers ahead of the one at hand to prefetch, when
+  // walking the chain of buffers of the flow.
+  static constexpr uint32_t kPrefetchDistance = 4;
+  // Most TX completions posted to the channel at once.
+  static constexpr uint32_t kTxComplBurst = 16;
+
   TXTracking() = delete;
   explicit TXTracking(shm::Channel* channel)
       : channel_(CHECK_NOTNULL(channel)),
@@ -42,14 +175,91 @@ class TXTracking {
         oldest_unsent_msgbuf_(nullptr),
         last_msgbuf_(nullptr),
         num_unsent_msgbufs_(0),
-        num_tracked_msgbufs_(0) {}
+        num_tracked_msgbufs_(0),
+        mss_(channel_->GetUsableBufSize()) {}
 
   const uint32_t NumUnsentMsgbufs() const { return num_unsent_msgbufs_; }
+
+  /**
+   * @brief Maximum payload of the packets of the flow: the size of the buffers
+   * of the channel, unless the peer takes less (see `Append').
+   */
+  uint32_t GetMss() const { return mss_; }
+  void SetMss(uint32_t mss) {
+    mss_ = std::clamp<uint32_t>(mss, 1, channel_->GetUsableBufSize());
+  }
   shm::MsgBuf* GetOldestUnackedMsgBuf() const { return oldest_unacked_msgbuf_; }
 
+  /**
+   * @brief Packs messages of up to `max_len' bytes, queued behind one another,
+   * into shared buffers of up to `GetMss()' bytes, hence packets (see
+   * `Aggregate'); 0 stops. The peer must split them (see
+   * `Flow::SetAggregation').
+   */
+  void SetAggregation(uint32_t max_len) {
+    agg_max_len_ = max_len;
+    if (max_len == 0) agg_msgbuf_ = nullptr;
+  }
+
+  // The last buffer queued, if it is not sent yet and the next small messages
+  // may join it (see `Aggregate'); nullptr otherwise.
+  const shm::MsgBuf* GetOpenAggregate() const { return agg_msgbuf_; }
+
+  /**
+   * @brief The scoreboard of the packets sent and not acknowledged yet.
+   */
+  Scoreboard* scoreboard() { return &scoreboard_; }
+  const Scoreboard* scoreboard() const { return &scoreboard_; }
+
+  /**
+   * @brief Records the first transmission of a message buffer, taken with
+   * `GetAndUpdateOldestUnsent', on the scoreboard, and how long the message
+   * waited for it.
+   */
+  void OnTransmit(uint32_t seqno, const shm::MsgBuf* msgbuf, uint64_t tx_tsc) {
+    scoreboard_.OnSend(seqno, msgbuf->index(), tx_tsc);
+    if (!msgbuf->is_first()) return;
+    if (const auto age = msgbuf->stamp_age(tx_tsc); age.has_value()) {
+      RecordLatency(channel_, flow_latency_, &MachnetLatencyStats_t::tx_queue,
+                    time::cycles_to_ns(age.value()));
+    }
+  }
+
+  // Sets the latency stats of the flow, if it keeps its own.
+  void SetLatencyStats(MachnetLatencyStats_t* stats) { flow_latency_ = stats; }
+
+  /**
+   * @brief The message buffer sent with `seqno', which the scoreboard tracks.
+   */
+  shm::MsgBuf* GetSentMsgBuf(uint32_t seqno) const {
+    return channel_->GetMsgBuf(scoreboard_.cookie(seqno));
+  }
+
+  /**
+   * @brief Releases the `num_acked_pkts' oldest message buffers sent, which
+   * the peer acknowledged; call before the scoreboard stops tracking them.
+   *
+   * The buffers are linked in a chain through shared memory, each likely a
+   * cache miss. Their indices are also in the scoreboard, by seqno, so the
+   * buffers are prefetched `kPrefetchDistance' ahead of the walk.
+   *
+   * Messages sent with `MACHNET_MSGBUF_NOTIFY_DELIVERY' complete when their
+   * last buffer is released; the completions are posted in batches.
+   */
   void ReceiveAcks(uint32_t num_acked_pkts) {
     shm::MsgBufBatch to_free;
-    while (num_acked_pkts) {
+    MachnetTxCompletion_t compls[kTxComplBurst];
+    uint32_t compls_nr = 0;
+    const uint32_t tracked_nr = std::min(num_acked_pkts, scoreboard_.size());
+    const uint32_t first_seqno = scoreboard_.una();
+    for (uint32_t i = 0; i < std::min(tracked_nr, kPrefetchDistance); i++) {
+      PrefetchMsgBuf(channel_->GetMsgBuf(scoreboard_.cookie(first_seqno + i)));
+    }
+    for (uint32_t i = 0; num_acked_pkts; i++) {
+      if (i + kPrefetchDistance < tracked_nr) {
+        PrefetchMsgBuf(channel_->GetMsgBuf(
+            scoreboard_.cookie(first_seqno + i + kPrefetchDistance)));
+      }
       auto msgbuf = oldest_unacked_msgbuf_;
       DCHECK(msgbuf != nullptr);
       if (msgbuf != last_msgbuf_) {
@@ -60,20 +270,58 @@ class TXTracking {
         oldest_unacked_msgbuf_ = nullptr;
         last_msgbuf_ = nullptr;
       }
+      // The first buffer of a message is gone by the time its last one is
+      // acknowledged, possibly on a later call.
+      if (msgbuf->is_first() &&
+          (msgbuf->flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY)) [[unlikely]] {
+        pending_compl_ = TxCompletion(msgbuf, MACHNET_TX_COMPL_DELIVERED);
+      }
+      if (msgbuf->is_last() && pending_compl_.has_value()) [[unlikely]] {
+        compls[compls_nr++] = *pending_compl_;
+        pending_compl_.reset();
+        if (compls_nr == kTxComplBurst) {
+          channel_->PostTxCompletions(compls, compls_nr);
+          compls_nr = 0;
+        }
+      }
+      // Buffers still attached to packets in flight are freed when the NIC is
+      // done with them (see `Channel::MsgBufExtAttach'); aliases never are.
+      num_acked_pkts--;
+      if (msgbuf->is_alias()) [[unlikely]]
+        channel_->MsgBufAliasRelease(msgbuf);
+      if (!channel_->MsgBufExtRelease(msgbuf)) {
+        num_tracked_msgbufs_--;
+        continue;
+      }
       to_free.Append(msgbuf, msgbuf->index());
       if (to_free.IsFull()) {
         num_tracked_msgbufs_ -= to_free.GetSize();
         CHECK(channel_->MsgBufBulkFree(&to_free));
       }
-      num_acked_pkts--;
     }
 
     num_tracked_msgbufs_ -= to_free.GetSize();
     CHECK(channel_->MsgBufBulkFree(&to_free));
+    channel_->PostTxCompletions(compls, compls_nr);
   }
 
-  void Append(shm::MsgBuf* msgbuf) {
+  /**
+   * @brief Queues a message for transmission, one packet per message buffer.
+   * If the MSS of the flow is below the size of the channel buffers, the
+   * message is copied into buffers of at most `GetMss()' bytes first. Small
+   * messages may be packed into the last buffer queued instead (see
+   * `Aggregate').
+   *
+   * @return False if the channel ran out of buffers to copy the message; it is
+   * then left untouched.
+   */
+  bool Append(shm::MsgBuf* msgbuf) {
     DCHECK(msgbuf->is_first());
+    if (agg_msgbuf_ != nullptr && Aggregate(msgbuf)) return true;
+    if (mss_ < channel_->GetUsableBufSize()) [[unlikely]] {
+      msgbuf = Resegment(msgbuf);
+      if (msgbuf == nullptr) return false;
+    }
     // Append the message at the end of the chain of buffers, if any.
     if (last_msgbuf_ == nullptr) {
       // This is the first pending message buffer in the flow.
@@ -93,11 +341,28 @@ class TXTracking {
     }
 
     const auto msg_length = msgbuf->msg_length();
-    const auto effective_buffer_size = channel_->GetUsableBufSize();
+    const auto effective_buffer_size = mss_;
     const auto msg_buffers_nr =
         (msg_length + effective_buffer_size - 1) / effective_buffer_size;
     num_unsent_msgbufs_ += msg_buffers_nr;
     num_tracked_msgbufs_ += msg_buffers_nr;
+    // A small message may take in the next ones.
+    agg_msgbuf_ = CanAggregate(msgbuf) ? msgbuf : nullptr;
+    return true;
+  }
+
+  /**
+   * @brief Frees the buffers of a message that is not queued, e.g., one that
+   * `Append' failed to queue.
+   */
+  void FreeMessage(shm::MsgBuf* msgbuf) {
+    while (msgbuf != nullptr) {
+      auto* next = msgbuf->has_next() ? channel_->GetMsgBuf(msgbuf->next())
+                                      : nullptr;
+      if (msgbuf->is_alias()) channel_->MsgBufAliasRelease(msgbuf);
+      CHECK(channel_->MsgBufFree(msgbuf));
+      msgbuf = next;
+    }
   }
 
   std::optional<shm::MsgBuf*> GetAndUpdateOldestUnsent() {
@@ -112,13 +377,187 @@ class TXTracking {
           channel_->GetMsgBuf(oldest_unsent_msgbuf_->next());
     } else {
       oldest_unsent_msgbuf_ = nullptr;
+      // Packets are not touched once sent.
+      agg_msgbuf_ = nullptr;
     }
 
     num_unsent_msgbufs_--;
+    PrefetchUnsent();
     return msgbuf;
   }
 
+  /**
+   * @brief Gives up the chain of buffers of the flow, without freeing any, for
+   * another process to take over (see `Flow::HandOff').
+   */
+  void HandOff(FlowCheckpoint* cp) {
+    auto* hdr = &cp->hdr;
+    hdr->tx_first = oldest_unacked_msgbuf_ != nullptr
+                        ? oldest_unacked_msgbuf_->index()
+                        : FlowCheckpoint::kNoBuf;
+    hdr->tx_last = last_msgbuf_ != nullptr ? last_msgbuf_->index()
+                                           : FlowCheckpoint::kNoBuf;
+    hdr->tx_tracked_nr = num_tracked_msgbufs_;
+    hdr->tx_compl_pending = pending_compl_.has_value();
+    if (pending_compl_.has_value()) hdr->tx_compl = *pending_compl_;
+    pending_compl_.reset();
+    oldest_unacked_msgbuf_ = nullptr;
+    oldest_unsent_msgbuf_ = nullptr;
+    last_msgbuf_ = nullptr;
+    agg_msgbuf_ = nullptr;
+    prefetch_cursor_ = nullptr;
+    prefetched_nr_ = 0;
+    num_unsent_msgbufs_ = 0;
+    num_tracked_msgbufs_ = 0;
+  }
+
+  /**
+   * @brief Takes over the chain of buffers of a flow handed off (see
+   * `HandOff'). None of them counts as sent: the flow sends them all again.
+   */
+  void Restore(const FlowCheckpoint& cp) {
+    DCHECK(last_msgbuf_ == nullptr);
+    if (cp.hdr.tx_compl_pending) pending_compl_ = cp.hdr.tx_compl;
+    if (cp.hdr.tx_first == FlowCheckpoint::kNoBuf) return;
+    oldest_unacked_msgbuf_ = channel_->GetMsgBuf(cp.hdr.tx_first);
+    oldest_unsent_msgbuf_ = oldest_unacked_msgbuf_;
+    last_msgbuf_ = channel_->GetMsgBuf(cp.hdr.tx_last);
+    num_unsent_msgbufs_ = cp.hdr.tx_tracked_nr;
+    num_tracked_msgbufs_ = cp.hdr.tx_tracked_nr;
+  }
+
  private:
+  static void PrefetchMsgBuf(const shm::MsgBuf* msgbuf) {
+    __builtin_prefetch(msgbuf, 1);
+  }
+
+  /**
+   * @brief Keeps the unsent message buffers up to `kPrefetchDistance' past
+   * the oldest one prefetched: `prefetch_cursor_' moves ahead along the chain,
+   * one buffer per buffer sent in the steady state. Following its links hits
+   * buffers prefetched on earlier calls, so sending a buffer rarely waits for
+   * shared memory.
+   */
+  void PrefetchUnsent() {
+    if (oldest_unsent_msgbuf_ == nullptr) {
+      prefetch_cursor_ = nullptr;
+      prefetched_nr_ = 0;
+      return;
+    }
+    // The buffer just sent was among the ones prefetched.
+    if (prefetched_nr_ != 0) prefetched_nr_--;
+    while (prefetched_nr_ < kPrefetchDistance) {
+      if (prefetched_nr_ == 0) {
+        prefetch_cursor_ = oldest_unsent_msgbuf_;
+      } else if (prefetch_cursor_ != last_msgbuf_) {
+        prefetch_cursor_ = channel_->GetMsgBuf(prefetch_cursor_->next());
+      } else {
+        break;
+      }
+      PrefetchMsgBuf(prefetch_cursor_);
+      prefetched_nr_++;
+    }
+  }
+
+  // Whether a message may be packed with others (see `Aggregate'): small
+  // enough, in a single buffer of its own, and not asking for a completion,
+  // which is per packet.
+  bool CanAggregate(const shm::MsgBuf* msg) const {
+    return msg->is_last() && msg->length() != 0 &&
+           msg->length() <= agg_max_len_ && !msg->is_alias() &&
+           !(msg->flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  }
+
+  /**
+   * @brief Packs a small message into the last buffer queued, not sent yet, if
+   * it has room left within the MSS. The buffer then holds each of its
+   * messages behind a `net::MachnetAggHdr', and is flagged
+   * `MACHNET_MSGBUF_FLAGS_AGGREGATE' for the peer to split it (see
+   * `RXTracking::Split'). It stays one packet, so the scoreboard,
+   * retransmissions and ACKs are unaffected; it is closed once sent.
+   *
+   * @return True if the message was packed, and freed.
+   */
+  bool Aggregate(shm::MsgBuf* msg) {
+    constexpr uint32_t kHdrLen = sizeof(net::MachnetAggHdr);
+    auto* agg = agg_msgbuf_;
+    DCHECK_EQ(agg, last_msgbuf_);
+    if (!CanAggregate(msg)) return false;
+    const bool packed = agg->flags() & MACHNET_MSGBUF_FLAGS_AGGREGATE;
+    const uint32_t len = msg->length();
+    const uint32_t hdrs_len = packed ? kHdrLen : 2 * kHdrLen;
+    if (agg->length() + hdrs_len + len > mss_ ||
+        agg->tailroom() < kHdrLen + len ||
+        (!packed && agg->headroom() < kHdrLen)) {
+      return false;
+    }
+    if (!packed) {
+      // The message alone in the buffer so far becomes the first one.
+      auto* hdr = reinterpret_cast<net::MachnetAggHdr*>(
+          agg->prepend<uint8_t*>(kHdrLen));
+      hdr->len = be16_t(agg->length() - kHdrLen);
+      agg->add_flags(MACHNET_MSGBUF_FLAGS_AGGREGATE);
+    }
+    auto* hdr = reinterpret_cast<net::MachnetAggHdr*>(
+        agg->append<uint8_t*>(kHdrLen + len));
+    hdr->len = be16_t(len);
+    utils::Copy(hdr + 1, msg->head_data<const uint8_t*>(), len);
+    agg->set_msg_length(agg->length());
+    FreeMessage(msg);
+    return true;
+  }
+
+  // Copies a message into a new chain of buffers of at most `mss_' bytes each,
+  // and frees the original buffers. Returns the first buffer of the new chain,
+  // or nullptr if the channel is out of buffers.
+  shm::MsgBuf* Resegment(shm::MsgBuf* msg) {
+    shm::MsgBuf* first = nullptr;
+    shm::MsgBuf* tail = nullptr;
+    const auto* src = msg;
+    uint32_t src_ofs = 0;
+    for (uint32_t left = msg->msg_length(); left != 0;) {
+      auto* msgbuf = channel_->MsgBufAlloc();
+      if (msgbuf == nullptr) {
+        FreeMessage(first);
+        return nullptr;
+      }
+      if (first == nullptr) {
+        first = msgbuf;
+      } else {
+        tail->set_next(msgbuf);
+      }
+      tail = msgbuf;
+      for (uint32_t room = std::min(mss_, left); room != 0;) {
+        if (src_ofs == src->length()) {
+          src = channel_->GetMsgBuf(src->next());
+          src_ofs = 0;
+        }
+        const auto len = std::min(room, src->length() - src_ofs);
+        const auto* payload = channel_->GetPayloadMsgBuf(src);
+        utils::Copy(CHECK_NOTNULL(msgbuf->append<uint8_t*>(len)),
+                    payload->head_data<const uint8_t*>(src_ofs), len);
+        src_ofs += len;
+        room -= len;
+        left -= len;
+      }
+    }
+
+    // The first buffer carries the flags, flow and length of the message.
+    constexpr uint16_t kChainFlags =
+        MACHNET_MSGBUF_FLAGS_SG | MACHNET_MSGBUF_FLAGS_FIN |
+        MACHNET_MSGBUF_FLAGS_CHAIN | MACHNET_MSGBUF_FLAGS_ALIAS;
+    first->add_flags(msg->flags() & ~kChainFlags);
+    first->set_src_ip(msg->flow()->src_ip);
+    first->set_src_port(msg->flow()->src_port);
+    first->set_dst_ip(msg->flow()->dst_ip);
+    first->set_dst_port(msg->flow()->dst_port);
+    first->set_msg_length(msg->msg_length());
+    first->set_last(tail->index());
+    tail->mark_last();
+    FreeMessage(msg);
+    return first;
+  }
+
   const uint32_t NumTrackedMsgbufs() const { return num_tracked_msgbufs_; }
   const shm::MsgBuf* GetLastMsgBuf() const { return last_msgbuf_; }
   const shm::MsgBuf* GetOldestUnsentMsgBuf() const {
@@ -126,6 +565,8 @@ class TXTracking {
   }
 
   shm::Channel* channel_;
+  // Latency stats of the flow, if it keeps its own (see `SetLatencyStats').
+  MachnetLatencyStats_t* flow_latency_{nullptr};
 
   /*
    * For the linked list of shm::MsgBufs in the channel (chain going downwards),
@@ -144,6 +585,22 @@ class TXTracking {
 
   uint32_t num_unsent_msgbufs_;
   uint32_t num_tracked_msgbufs_;
+  // The furthest unsent buffer prefetched, and the number of unsent buffers up
+  // to it (see `PrefetchUnsent').
+  shm::MsgBuf* prefetch_cursor_{nullptr};
+  uint32_t prefetched_nr_{0};
+  // Maximum payload of a packet (see `SetMss').
+  uint32_t mss_;
+  // Largest message packed with others, 0 for none, and the buffer the next
+  // ones may join (see `Aggregate').
+  uint32_t agg_max_len_{0};
+  shm::MsgBuf* agg_msgbuf_{nullptr};
+  // Completion of the oldest message unacknowledged, if it asked for one and
+  // its first buffer was released (see `ReceiveAcks').
+  std::optional<MachnetTxCompletion_t> pending_compl_{std::nullopt};
+
+  // Sender-side state of the packets sent, by seqno (see `OnTransmit').
+  Scoreboard scoreboard_;
 };
 
 /**
@@ -155,20 +612,59 @@ class TXTracking {
 class RXTracking {
  public:
   using MachnetPktHdr = net::MachnetPktHdr;
+  using MachnetAggHdr = net::MachnetAggHdr;
 
-  // 256-bit SACK bitmask => we can track up to 256 packets
+  // 256-bit SACK bitmask => by default we can track up to 256 packets; flows
+  // may negotiate larger windows (see `Flow::SetMaxWindow').
   static constexpr std::size_t kReassemblyMaxSeqnoDistance =
-      sizeof(sizeof(MachnetPktHdr::sack_bitmap)) * 8;
+      sizeof(MachnetPktHdr::sack_bitmap) * 8;
+  static_assert(kReassemblyMaxSeqnoDistance == swift::Pcb::kSackBitmapSize);
+  static_assert(kReassemblyMaxSeqnoDistance == Scoreboard::kDefaultCapacity);
+  static_assert(kReassemblyMaxSeqnoDistance ==
+                MachnetSynOptions::kDefaultWindow);
+  static_assert(swift::Pcb::kMaxWindow == Scoreboard::kMaxCapacity);
 
   static_assert((kReassemblyMaxSeqnoDistance &
                  (kReassemblyMaxSeqnoDistance - 1)) == 0,
                 "kReassemblyMaxSeqnoDistance must be a power of two");
 
-  struct reasm_queue_ent_t {
-    shm::MsgBuf* msgbuf;
-    uint64_t seqno;
+  /**
+   * @brief Reassembly buffer: a ring of the message buffers received and not
+   * delivered yet, indexed by seqno. Which slots are occupied is what the
+   * SACK bitmap of the `Pcb' tells (relative to `rcv_nxt'), so that inserting
+   * a packet is O(1), and in-order delivery finds all the packets it can
+   * deliver with a few bit scans. It has one slot per packet of the receive
+   * window.
+   */
+  class ReassemblyRing {
+   public:
+    ReassemblyRing() { Resize(kReassemblyMaxSeqnoDistance); }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    // Sets the number of slots, a power of two; the ring must be empty.
+    void Resize(size_t window) {
+      CHECK(empty());
+      CHECK_EQ(window & (window - 1), 0) << "Invalid window: " << window;
+      slots_.assign(window, nullptr);
+      mask_ = window - 1;
+    }
+    void Insert(uint32_t seqno, shm::MsgBuf* msgbuf) {
+      DCHECK(slots_[seqno & mask_] == nullptr);
+      slots_[seqno & mask_] = msgbuf;
+      size_++;
+    }
+    shm::MsgBuf* Take(uint32_t seqno) {
+      auto* msgbuf = std::exchange(slots_[seqno & mask_], nullptr);
+      DCHECK(msgbuf != nullptr);
+      size_--;
+      return msgbuf;
+    }
 
-    reasm_queue_ent_t(shm::MsgBuf* m, uint64_t s) : msgbuf(m), seqno(s) {}
+   private:
+    std::vector<shm::MsgBuf*> slots_;
+    uint32_t mask_{0};
+    size_t size_{0};
   };
 
   RXTracking(const RXTracking&) = delete;
@@ -181,9 +677,136 @@ class RXTracking {
         channel_(CHECK_NOTNULL(channel)),
         cur_msg_train_head_(nullptr),
         cur_msg_train_tail_(nullptr) {}
+  ~RXTracking() {
+    for (const auto& msg : undelivered_) {
+      auto* msgbuf = msg.msgbuf;
+      while (msgbuf != nullptr) {
+        auto* next =
+            msgbuf->has_next() ? channel_->GetMsgBuf(msgbuf->next()) : nullptr;
+        CHECK(channel_->MsgBufFree(msgbuf));
+        msgbuf = next;
+      }
+    }
+  }
+
+  // Sizes the reassembly buffer to a receive window of `window' packets (see
+  // `swift::Pcb::sack_bitmap_resize'); nothing must be buffered.
+  void SetWindow(size_t window) { reass_q_.Resize(window); }
+
+  /**
+   * @brief Returns the receive window to advertise: the number of packets from
+   * `rcv_nxt' on the flow has room for. Those are the packets buffered out of
+   * order, plus one per free buffer of the channel, unless the ring to the
+   * application is full: nothing new is taken then, until the application
+   * catches up. The window is at most the one negotiated (see
+   * `swift::Pcb::sack_window').
+   *
+   * Flows of the same channel share its buffers, and may advertise the same
+   * free ones; packets that find no buffer are dropped, and retransmitted.
+   */
+  uint32_t GetWindow(const swift::Pcb* pcb) const {
+    size_t window = reass_q_.size();
+    if (undelivered_.empty() && channel_->GetEnqueueRoom(queue_) != 0) {
+      window += channel_->GetFreeBufCount();
+    }
+    return std::min(window, pcb->sack_window());
+  }
+
+  // Whether complete messages wait for room in the ring to the application
+  // (see `Deliver').
+  bool HasUndelivered() const { return !undelivered_.empty(); }
+
+  // Sets the queue pair of the channel messages are delivered to: the one the
+  // application last sent on the flow from (see `Flow::OutputMessage').
+  void SetQueue(uint32_t queue) { queue_ = queue; }
+
+  /**
+   * @brief Delivers the complete messages that found the ring to the
+   * application full, in order, as room allows.
+   */
+  void Deliver() {
+    while (!undelivered_.empty()) {
+      const auto& msg = undelivered_.front();
+      // The application owns the message once it is in the ring.
+      const auto now = time::rdtsc();
+      const auto age = msg.msgbuf->stamp_age(now);
+      if (channel_->EnqueueMessages(&msg.msgbuf, 1, queue_) != 1) return;
+      channel_->GetEngineStats()->rx_queue_delay_ns +=
+          time::cycles_to_ns(now - msg.tsc);
+      OnDelivered(msg.len, age);
+      undelivered_.pop_front();
+    }
+  }
+
+  // Sets the latency stats of the flow, if it keeps its own.
+  void SetLatencyStats(MachnetLatencyStats_t* stats) { flow_latency_ = stats; }
+
+  // Sets the tracer drops are recorded to (see `Flow::SetTracer').
+  void SetTracer(trace::Tracer* tracer, uint32_t flow_id) {
+    tracer_ = tracer;
+    flow_id_ = flow_id;
+  }
+
+  /**
+   * @brief Gives up the buffers received and not delivered yet, without
+   * freeing any, for another process to take over (see `Flow::HandOff').
+   */
+  void HandOff(const swift::Pcb* pcb, FlowCheckpoint* cp) {
+    auto* hdr = &cp->hdr;
+    for (size_t i = 0; !reass_q_.empty() && i < pcb->sack_window(); i++) {
+      if (!pcb->sack_bitmap_bit_test(i)) continue;
+      cp->ooo_bufs.push_back(
+          {static_cast<uint32_t>(i), reass_q_.Take(pcb->rcv_nxt + i)->index()});
+    }
+    hdr->rx_train_head = cur_msg_train_head_ != nullptr
+                             ? cur_msg_train_head_->index()
+                             : FlowCheckpoint::kNoBuf;
+    hdr->rx_train_tail = cur_msg_train_tail_ != nullptr
+                             ? cur_msg_train_tail_->index()
+                             : FlowCheckpoint::kNoBuf;
+    hdr->rx_train_len = cur_msg_train_len_;
+    for (const auto& msg : undelivered_) {
+      cp->undelivered.push_back({msg.msgbuf->index(), msg.len});
+    }
+    hdr->queue = queue_;
+    cur_msg_train_head_ = nullptr;
+    cur_msg_train_tail_ = nullptr;
+    cur_msg_train_len_ = 0;
+    undelivered_.clear();
+  }
+
+  /**
+   * @brief Takes over the buffers of a flow handed off (see `HandOff'); marks
+   * the ones received out of order in the SACK bitmap of `pcb', whose
+   * `rcv_nxt' is restored already.
+   */
+  void Restore(swift::Pcb* pcb, const FlowCheckpoint& cp) {
+    // In increasing order, so that the bitmap ends up with the furthest one
+    // as the last received (see `swift::Pcb::sack_offset').
+    for (const auto& [distance, index] : cp.ooo_bufs) {
+      reass_q_.Insert(pcb->rcv_nxt + distance, channel_->GetMsgBuf(index));
+      pcb->sack_bitmap_bit_set(distance);
+    }
+    if (cp.hdr.rx_train_head != FlowCheckpoint::kNoBuf) {
+      cur_msg_train_head_ = channel_->GetMsgBuf(cp.hdr.rx_train_head);
+      cur_msg_train_tail_ = channel_->GetMsgBuf(cp.hdr.rx_train_tail);
+      cur_msg_train_len_ = cp.hdr.rx_train_len;
+    }
+    for (const auto& msg : cp.undelivered) {
+      undelivered_.push_back(
+          {channel_->GetMsgBuf(msg.index), msg.len, time::rdtsc()});
+    }
+    queue_ = cp.hdr.queue;
+  }
 
   // If we fail to allocate in the SHM channel, return -1.
-  int Consume(swift::Pcb* pcb, const dpdk::Packet* packet) {
+  // If the packet was received into a channel buffer, that buffer is consumed
+  // and the packet gets a fresh one instead (see `TakeRxBuf').
+  // Aggregated packets are split into their messages (see `Split').
+  // Payloads are copied with `copy_engine', if given; synchronously, as the
+  // packet is freed on return.
+  int Consume(swift::Pcb* pcb, dpdk::Packet* packet,
+              dpdk::CopyEngine* copy_engine = nullptr) {
     const size_t net_hdr_len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
     const auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
     const auto* payload =
@@ -197,48 +820,71 @@ class RXTracking {
     }
 
     const size_t distance = seqno - expected_seqno;
-    if (distance >= kReassemblyMaxSeqnoDistance) {
-      LOG(ERROR) << "Packet too far ahead. Dropping as we can't handle SACK. "
-                 << "seqno: " << seqno << ", expected: " << expected_seqno;
+    if (distance >= pcb->sack_window()) {
+      Trace(trace::Event::kDropTooFarAhead, seqno, expected_seqno);
+      VLOG(1) << "Packet too far ahead. Dropping as we can't handle SACK. "
+              << "seqno: " << seqno << ", expected: " << expected_seqno;
       return 0;
     }
 
-    // Only iterate through the deque if we must, i.e., for ooo packts only
-    auto it = reass_q_.begin();
-    if (seqno != expected_seqno) {
-      it = std::find_if(reass_q_.begin(), reass_q_.end(),
-                        [&seqno](const reasm_queue_ent_t& entry) {
-                          return entry.seqno >= seqno;
-                        });
-      if (it != reass_q_.end() && it->seqno == seqno) {
-        return 0; // Duplicate packet
-      }
+    if (pcb->sack_bitmap_bit_test(distance)) {
+      return 0;  // Duplicate packet
     }
 
+    // Messages held back go first, to make room.
+    Deliver();
+
     // Buffer the packet in the SHM channel. It may be out-of-order.
-    auto* msgbuf = channel_->MsgBufAlloc();
-    if (msgbuf == nullptr) {
-      VLOG(1) << "Failed to allocate a message buffer. Dropping packet.";
-      return -1;
-    }
-    
     const size_t payload_len =
         packet->length() - net_hdr_len - sizeof(MachnetPktHdr);
-    auto* msg_data = msgbuf->append<uint8_t*>(payload_len);
-    utils::Copy(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
-    msgbuf->set_flags(machneth->msg_flags);
+    auto* msgbuf = TakeRxBuf(packet, payload, payload_len);
+    if (msgbuf == nullptr) {
+      if (payload_len > channel_->GetUsableBufSize()) [[unlikely]] {
+        // The peer ignored the MSS advertised in the handshake.
+        Trace(trace::Event::kDropOversized, seqno, payload_len);
+        VLOG(1) << "Packet larger than the MSS. Dropping. seqno: " << seqno
+                << ", length: " << payload_len;
+        return 0;
+      }
+      // Short payloads take a buffer of the smallest size class that fits.
+      msgbuf = channel_->MsgBufAlloc(payload_len);
+      if (msgbuf == nullptr) {
+        VLOG(1) << "Failed to allocate a message buffer. Dropping packet.";
+        channel_->GetEngineStats()->rx_alloc_failures++;
+        return -1;
+      }
+      auto* msg_data = msgbuf->append<uint8_t*>(payload_len);
+      if (copy_engine != nullptr) {
+        copy_engine->Copy(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
+      } else {
+        utils::Copy(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
+      }
+    }
+    // Buffers are linked into a chain on the sender only.
+    msgbuf->set_flags(machneth->msg_flags & ~(MACHNET_MSGBUF_FLAGS_ALIAS |
+                                              MACHNET_MSGBUF_FLAGS_CHAIN));
+    if (msgbuf->is_first()) msgbuf->set_tsc_stamp(time::rdtsc());
     msgbuf->set_src_ip(remote_ip_);
     msgbuf->set_src_port(remote_port_);
     msgbuf->set_dst_ip(local_ip_);
     msgbuf->set_dst_port(local_port_);
     DCHECK(!(msgbuf->is_last() && msgbuf->is_sg()));
-
-    if (seqno == expected_seqno) {
-      reass_q_.emplace_front(msgbuf, seqno);
-    } else {
-      reass_q_.insert(it, reasm_queue_ent_t(msgbuf, seqno));
+    if (msgbuf->flags() & MACHNET_MSGBUF_FLAGS_AGGREGATE) [[unlikely]] {
+      if (!IsValidAggregate(msgbuf)) {
+        VLOG(1) << "Malformed aggregated packet. Dropping. seqno: " << seqno;
+        CHECK(channel_->MsgBufFree(msgbuf));
+        return 0;
+      }
+      if (!Split(msgbuf)) {
+        VLOG(1) << "Failed to allocate message buffers. Dropping packet.";
+        channel_->GetEngineStats()->rx_alloc_failures++;
+        CHECK(channel_->MsgBufFree(msgbuf));
+        return -1;
+      }
     }
 
+    reass_q_.Insert(seqno, msgbuf);
+
     // Update the SACK bitmap for the newly received packet.
     pcb->sack_bitmap_bit_set(distance);
 
@@ -247,48 +893,208 @@ class RXTracking {
   }
 
  private:
+  void Trace(trace::Event event, uint32_t seqno, uint32_t arg) {
+    if constexpr (trace::kEnabled) {
+      if (tracer_ != nullptr) tracer_->Record(event, flow_id_, seqno, arg);
+    }
+  }
+
+  /**
+   * @brief Zero-copy alternative to copying the payload of a packet into a new
+   * message buffer: if the NIC received the packet straight into a buffer of
+   * the channel (see `MachnetEngine::SetRxZeroCopy'), that buffer is taken
+   * over to hold the payload in place, and the packet is given a fresh channel
+   * buffer to be received into next.
+   *
+   * @param packet      The received packet.
+   * @param payload     Pointer to the Machnet payload of the packet.
+   * @param payload_len Length of the payload.
+   * @return The message buffer holding the payload, or nullptr if the packet
+   * is not in a channel buffer or no replacement buffer is available; the
+   * payload must be copied then.
+   */
+  shm::MsgBuf* TakeRxBuf(dpdk::Packet* packet, const uint8_t* payload,
+                         size_t payload_len) {
+    auto* msgbuf = channel_->GetMsgBufByBase(packet->buf_addr());
+    if (msgbuf == nullptr) [[likely]]
+      return nullptr;
+    auto* fresh = channel_->MsgBufAlloc();
+    if (fresh == nullptr) return nullptr;
+    packet->set_buf(fresh->base(), fresh->iova(), fresh->size());
+
+    msgbuf->reset();
+    msgbuf->set_data_offset(payload - msgbuf->base<const uint8_t*>());
+    msgbuf->set_length(payload_len);
+    return msgbuf;
+  }
+
+  // Whether the buffer of an aggregated packet is a sequence of messages,
+  // each a `MachnetAggHdr' and as many bytes as it says.
+  static bool IsValidAggregate(const shm::MsgBuf* msgbuf) {
+    constexpr uint32_t kHdrLen = sizeof(MachnetAggHdr);
+    if (!msgbuf->is_first() || !msgbuf->is_last()) return false;
+    const auto* data = msgbuf->head_data<const uint8_t*>();
+    const uint32_t len = msgbuf->length();
+    uint32_t ofs = 0;
+    while (ofs != len) {
+      if (len - ofs < kHdrLen) return false;
+      const auto* hdr = reinterpret_cast<const MachnetAggHdr*>(data + ofs);
+      const uint32_t msg_len = hdr->len.value();
+      if (msg_len == 0 || len - ofs - kHdrLen < msg_len) return false;
+      ofs += kHdrLen + msg_len;
+    }
+    return ofs != 0;
+  }
+
+  /**
+   * @brief Splits the buffer of an aggregated packet, valid (see
+   * `IsValidAggregate'), into its messages: the first one stays in place,
+   * the others are copied into buffers of their own, linked after it, for
+   * `PushInOrderMsgbufsToShmTrain' to deliver them one by one.
+   *
+   * The receive window counts one buffer per packet (see `GetWindow'), so
+   * aggregated packets may find the channel out of buffers, and be dropped
+   * and retransmitted.
+   *
+   * @return False if the channel is out of buffers; `msgbuf' is left with no
+   * message linked then.
+   */
+  bool Split(shm::MsgBuf* msgbuf) {
+    constexpr uint32_t kHdrLen = sizeof(MachnetAggHdr);
+    const auto* data = msgbuf->head_data<const uint8_t*>();
+    const uint32_t first_len =
+        reinterpret_cast<const MachnetAggHdr*>(data)->len.value();
+    const auto now = time::rdtsc();
+    shm::MsgBuf* tail = msgbuf;
+    for (uint32_t ofs = kHdrLen + first_len; ofs != msgbuf->length();) {
+      const uint32_t len =
+          reinterpret_cast<const MachnetAggHdr*>(data + ofs)->len.value();
+      auto* piece = channel_->MsgBufAlloc(len);
+      if (piece == nullptr) {
+        // Frees the messages copied so far.
+        for (auto* it = msgbuf; it != tail;) {
+          auto* next = channel_->GetMsgBuf(it->next());
+          if (it != msgbuf) CHECK(channel_->MsgBufFree(it));
+          it = next;
+        }
+        if (tail != msgbuf) CHECK(channel_->MsgBufFree(tail));
+        msgbuf->set_flags(msgbuf->flags() & ~MACHNET_MSGBUF_FLAGS_CHAIN);
+        return false;
+      }
+      utils::Copy(CHECK_NOTNULL(piece->append<uint8_t*>(len)),
+                  data + ofs + kHdrLen, len);
+      piece->set_flags(MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN);
+      piece->set_tsc_stamp(now);
+      piece->set_src_ip(remote_ip_);
+      piece->set_src_port(remote_port_);
+      piece->set_dst_ip(local_ip_);
+      piece->set_dst_port(local_port_);
+      tail->link(piece);
+      tail = piece;
+      ofs += kHdrLen + len;
+    }
+    msgbuf->set_data_offset(msgbuf->data_offset() + kHdrLen);
+    msgbuf->set_length(first_len);
+    msgbuf->set_flags(msgbuf->flags() & ~MACHNET_MSGBUF_FLAGS_AGGREGATE);
+    return true;
+  }
+
   void PushInOrderMsgbufsToShmTrain(swift::Pcb* pcb) {
-    while (!reass_q_.empty() && reass_q_.front().seqno == pcb->rcv_nxt) {
-      auto& front = reass_q_.front();
-      auto* msgbuf = front.msgbuf;
-      reass_q_.pop_front();
-
-      if (cur_msg_train_head_ == nullptr) {
-        DCHECK(msgbuf->is_first());
-        cur_msg_train_head_ = msgbuf;
-        cur_msg_train_tail_ = msgbuf;
-      } else {
-        cur_msg_train_tail_->set_next(msgbuf);
-        cur_msg_train_tail_ = msgbuf;
+    // All the packets from `rcv_nxt' up to the first hole.
+    const size_t in_order_nr = pcb->sack_bitmap_leading_nr();
+    if (in_order_nr == 0) return;
+
+    for (size_t i = 0; i < in_order_nr; i++) {
+      auto* msgbuf = reass_q_.Take(pcb->rcv_nxt + i);
+      // The messages of an aggregated packet come linked (see `Split').
+      while (msgbuf->has_chain()) [[unlikely]] {
+        auto* next = channel_->GetMsgBuf(msgbuf->next());
+        msgbuf->set_flags(msgbuf->flags() & ~MACHNET_MSGBUF_FLAGS_CHAIN);
+        PushToShmTrain(msgbuf);
+        msgbuf = next;
       }
+      PushToShmTrain(msgbuf);
+    }
 
-      if (cur_msg_train_tail_->is_last()) {
-        // We have a complete message. Let's deliver it to the application.
-        DCHECK(!cur_msg_train_tail_->is_sg());
-        auto* msgbuf_to_deliver = cur_msg_train_head_;
-        auto nr_delivered = channel_->EnqueueMessages(&msgbuf_to_deliver, 1);
-        if (nr_delivered != 1) {
-          LOG(FATAL) << "SHM channel full, failed to deliver message";
-        }
+    pcb->rcv_nxt += in_order_nr;
+    pcb->sack_bitmap_shift_right(in_order_nr);
+  }
 
-        cur_msg_train_head_ = nullptr;
-        cur_msg_train_tail_ = nullptr;
+  // Adds the buffer of the next packet in order to the message being
+  // reassembled, and delivers the message if it is complete.
+  void PushToShmTrain(shm::MsgBuf* msgbuf) {
+    if (cur_msg_train_head_ == nullptr) {
+      DCHECK(msgbuf->is_first());
+      cur_msg_train_head_ = msgbuf;
+      cur_msg_train_tail_ = msgbuf;
+      cur_msg_train_len_ = 0;
+    } else {
+      cur_msg_train_tail_->set_next(msgbuf);
+      cur_msg_train_tail_ = msgbuf;
+    }
+    cur_msg_train_len_ += msgbuf->length();
+
+    if (cur_msg_train_tail_->is_last()) {
+      // We have a complete message. Let's deliver it to the application.
+      DCHECK(!cur_msg_train_tail_->is_sg());
+      // The message waits if the application does not keep up; the window
+      // closes meanwhile (see `GetWindow').
+      auto* msgbuf_to_deliver = cur_msg_train_head_;
+      const auto age = msgbuf_to_deliver->stamp_age(time::rdtsc());
+      if (undelivered_.empty() &&
+          channel_->EnqueueMessages(&msgbuf_to_deliver, 1, queue_) == 1) {
+        OnDelivered(cur_msg_train_len_, age);
+      } else {
+        VLOG(1) << "SHM channel full, deferring message delivery";
+        channel_->GetEngineStats()->rx_ring_full++;
+        undelivered_.push_back(
+            {msgbuf_to_deliver, cur_msg_train_len_, time::rdtsc()});
       }
 
-      pcb->advance_rcv_nxt();
+      cur_msg_train_head_ = nullptr;
+      cur_msg_train_tail_ = nullptr;
+    }
+  }
 
-      pcb->sack_bitmap_shift_right_one();
+  // Accounts for a message of `len' bytes delivered to the application,
+  // `age' cycles after its first packet arrived.
+  void OnDelivered(uint32_t len, std::optional<uint64_t> age) {
+    auto* stats = channel_->GetEngineStats();
+    stats->rx_msgs++;
+    stats->rx_bytes += len;
+    if (age.has_value()) {
+      RecordLatency(channel_, flow_latency_,
+                    &MachnetLatencyStats_t::rx_delivery,
+                    time::cycles_to_ns(age.value()));
     }
   }
 
+  // A complete message held back for lack of room in the ring.
+  struct UndeliveredMsg {
+    shm::MsgBuf* msgbuf;
+    uint32_t len;  // Bytes of the message.
+    uint64_t tsc;  // When it was held back.
+  };
+
   const uint32_t local_ip_;
   const uint16_t local_port_;
   const uint32_t remote_ip_;
   const uint16_t remote_port_;
   shm::Channel* channel_;
-  std::deque<reasm_queue_ent_t> reass_q_;
+  // Latency stats of the flow, if it keeps its own (see `SetLatencyStats').
+  MachnetLatencyStats_t* flow_latency_{nullptr};
+  // Tracer of the engine, if any, and the flow's id in it (see `SetTracer').
+  trace::Tracer* tracer_{nullptr};
+  uint32_t flow_id_{0};
+  ReassemblyRing reass_q_;
   shm::MsgBuf* cur_msg_train_head_;
   shm::MsgBuf* cur_msg_train_tail_;
+  // Bytes of the message being reassembled.
+  uint32_t cur_msg_train_len_{0};
+  // Complete messages not delivered yet, for lack of room in the ring.
+  std::deque<UndeliveredMsg> undelivered_;
+  // The queue pair of the channel messages are delivered to.
+  uint32_t queue_{MACHNET_CHANNEL_QUEUE_SHARED};
 };
 
 /**
@@ -315,6 +1121,38 @@ class Flow {
   using MachnetPktHdr = net::MachnetPktHdr;
   using ApplicationCallback =
       std::function<void(shm::Channel*, bool, const Key&)>;
+  using Timers = TimerWheel<Flow>;
+  // Default ACK coalescing policy (see `SetAckPolicy'): one cumulative ACK per
+  // RX burst, with no delay past it, and at least one every
+  // `kDefaultAckEveryN' in-order packets.
+  static constexpr uint32_t kDefaultAckEveryN = 16;
+  static constexpr uint64_t kDefaultAckDelayUs = 0;
+  // Maximum number of message buffers sent in one UDP-segmented packet (see
+  // `TransmitSegmentedPackets').
+  static constexpr uint16_t kUsoMaxSegsNr = 64;
+  // Window pacing (see `SetPacer'): flows are paced `kPacingGainPercent'
+  // faster than one window per RTT, so that pacing does not cap them below
+  // their window, and may send up to `kPacingBurstNr' packets back to back
+  // after being idle.
+  static constexpr uint32_t kPacingGainPercent = 125;
+  static constexpr uint32_t kPacingBurstNr = 4;
+  // Packets a flow of each priority class sends at a time before yielding to
+  // the pacer (see `SetPriority'); the top class is not capped.
+  static constexpr std::array<uint32_t, MACHNET_PRIO_CLASSES_NR> kTxQuantum = {
+      UINT32_MAX, 64, 16};
+  // Receive windows (see `SetMaxWindow').
+  static constexpr uint32_t kDefaultWindow = MachnetSynOptions::kDefaultWindow;
+  static constexpr uint32_t kMaxWindow = swift::Pcb::kMaxWindow;
+  // Packet payload with the default MTU, assumed of peers that do not tell
+  // theirs (see `MachnetSynOptions').
+  static constexpr uint32_t kDefaultMss = dpdk::PmdRing::kDefaultFrameSize -
+                                          sizeof(Ipv4) - sizeof(Udp) -
+                                          sizeof(MachnetPktHdr);
+  // Paths a flow may spray its packets over (see `SetMultipath').
+  static constexpr size_t kMaxPaths = MachnetSynOptions::kMaxPaths;
+  // Size of a control packet (e.g., an ACK) without options.
+  static constexpr size_t kControlPacketSize =
+      sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr);
 
   enum class State {
     kClosed,
@@ -348,29 +1186,52 @@ class Flow {
    * @param remote_port Remote UDP port.
    * @param local_l2_addr Local L2 address.
    * @param remote_l2_addr Remote L2 address.
-   * @param txring TX ring to send packets to.
+   * @param txbatch TX batch to stage outgoing packets to.
+   * @param callback Callback invoked when the flow is established or closed.
+   * @param cc Congestion control algorithm of the flow.
    * @param channel Shared memory channel this flow is associated with.
    */
   Flow(const Ipv4::Address& local_addr, const Udp::Port& local_port,
        const Ipv4::Address& remote_addr, const Udp::Port& remote_port,
        const Ethernet::Address& local_l2_addr,
-       const Ethernet::Address& remote_l2_addr, dpdk::TxRing* txring,
-       ApplicationCallback callback, shm::Channel* channel)
-      : key_(local_addr, local_port, remote_addr, remote_port),
-        local_l2_addr_(local_l2_addr),
-        remote_l2_addr_(remote_l2_addr),
-        state_(State::kClosed),
-        txring_(CHECK_NOTNULL(txring)),
-        callback_(std::move(callback)),
+       const Ethernet::Address& remote_l2_addr, dpdk::TxBatch* txbatch,
+       ApplicationCallback callback, swift::Algorithm cc,
+       shm::Channel* channel)
+      : state_(State::kClosed),
+        txbatch_(CHECK_NOTNULL(txbatch)),
         channel_(CHECK_NOTNULL(channel)),
         pcb_(),
+        cc_(cc),
         tx_tracking_(CHECK_NOTNULL(channel)),
         rx_tracking_(local_addr.address.value(), local_port.port.value(),
                      remote_addr.address.value(), remote_port.port.value(),
-                     CHECK_NOTNULL(channel)) {
-    CHECK_NOTNULL(txring_->GetPacketPool());
+                     CHECK_NOTNULL(channel)),
+        key_(local_addr, local_port, remote_addr, remote_port),
+        local_l2_addr_(local_l2_addr),
+        remote_l2_addr_(remote_l2_addr),
+        callback_(std::move(callback)) {
+    CHECK_NOTNULL(txbatch_->GetPacketPool());
+    BuildHeaderTemplate();
+    const auto* pmd_port = txbatch_->GetRing()->GetPmdPort();
+    if (pmd_port != nullptr) {
+      mtu_ = pmd_port->GetMTU().value_or(dpdk::PmdRing::kDefaultFrameSize);
+    }
+    syn_mss_ = GetLocalMss();
+    tx_tracking_.SetMss(syn_mss_);
+    tx_extbuf_ = pmd_port != nullptr && !pmd_port->IsTxFastFreeEnabled();
+    if (pmd_port != nullptr && pmd_port->IsTxUsoEnabled()) {
+      // The whole segmented packet must fit in the IPv4 total length field.
+      const size_t kMaxSegsNr =
+          (UINT16_MAX - sizeof(Ethernet) - sizeof(Ipv4) - sizeof(Udp)) /
+          GetUsoSegmentSize();
+      uso_max_segs_nr_ = std::min<size_t>(
+          {kMaxSegsNr, pmd_port->GetTxMaxSegsNr(), kUsoMaxSegsNr});
+    }
+  }
+  ~Flow() {
+    if (pacer_scheduled_) pacer_->Remove(this);
+    if (timers_ != nullptr) timers_->Cancel(&rto_timer_);
   }
-  ~Flow() {}
   /**
    * @brief Operator to compare if two flows are equal.
    * @param other Other flow to compare to.
@@ -394,13 +1255,54 @@ class Flow {
   State state() const { return state_; }
 
   std::string ToString() const {
-    return utils::Format(
-        "%s [%s] <-> [%s]\n\t\t\t%s\n\t\t\t[TX Queue] Pending "
+    auto s = utils::Format(
+        "%s [%s] <-> [%s]\n\t\t\t%s\n\t\t\t%s\n\t\t\t[TX Queue] Pending "
         "MsgBufs: "
         "%u",
         key_.ToString().c_str(), StateToString(state_),
         channel_->GetName().c_str(), pcb_.ToString().c_str(),
-        tx_tracking_.NumUnsentMsgbufs());
+        cc_.ToString().c_str(), tx_tracking_.NumUnsentMsgbufs());
+    if (latency_stats_ != nullptr) {
+      auto p50_p99 = [](const MachnetLatencyHist_t& hist) {
+        return utils::Format(
+            "%lu/%lu", __machnet_latency_hist_quantile(&hist, 0.5) / 1000,
+            __machnet_latency_hist_quantile(&hist, 0.99) / 1000);
+      };
+      s += utils::Format(
+          "\n\t\t\t[Latency p50/p99 us] TX queue: %s, RTT: %s, RX delivery: "
+          "%s",
+          p50_p99(latency_stats_->tx_queue).c_str(),
+          p50_p99(latency_stats_->rtt).c_str(),
+          p50_p99(latency_stats_->rx_delivery).c_str());
+    }
+    return s;
+  }
+
+  /**
+   * @brief Keeps latency histograms for the flow alone, besides the ones of
+   * its channel (see `MachnetLatencyStats_t'); they show in `ToString'.
+   */
+  void SetLatencyStats(bool enable) {
+    if (enable && latency_stats_ == nullptr) {
+      latency_stats_ = std::make_unique<MachnetLatencyStats_t>();
+    } else if (!enable) {
+      latency_stats_.reset();
+    }
+    tx_tracking_.SetLatencyStats(latency_stats_.get());
+    rx_tracking_.SetLatencyStats(latency_stats_.get());
+  }
+
+  /**
+   * @brief Sets the tracer that retransmissions, state changes and drops of
+   * the flow are recorded to, under the id `trace::FlowId' of its key.
+   *
+   * @param tracer Tracer of the engine, or nullptr; must outlive the flow, or
+   *               be replaced before it goes away.
+   */
+  void SetTracer(trace::Tracer* tracer) {
+    tracer_ = tracer;
+    trace_id_ = trace::FlowId(key_);
+    rx_tracking_.SetTracer(tracer, trace_id_);
   }
 
   bool Match(const dpdk::Packet* packet) const {
@@ -421,128 +1323,565 @@ class Flow {
             flow_info->dst_port == key_.remote_port.port.value());
   }
 
-  void InitiateHandshake() {
+  /**
+   * @brief Sets the receive window of the flow, in packets. Must be called
+   * before the handshake.
+   *
+   * The window is advertised in the SYN or SYN-ACK of the flow (see
+   * `MachnetSynOptions'); each end may then have up to the smaller of both
+   * windows in flight, and its congestion window is capped to it. Windows
+   * larger than the SACK bitmap of the packets (`kDefaultWindow') are
+   * acknowledged in slices of the bitmap, at an offset from the cumulative
+   * ACK. The reassembly buffer and the scoreboard cost about 32 bytes per
+   * packet of window.
+   *
+   * @param window A power of two, from `kDefaultWindow' to `kMaxWindow'.
+   */
+  void SetMaxWindow(uint32_t window) {
     CHECK(state_ == State::kClosed);
-    SendSyn(pcb_.get_snd_nxt());
-    pcb_.rto_reset();
-    state_ = State::kSynSent;
+    pcb_.sack_bitmap_resize(window);
+    rx_tracking_.SetWindow(window);
+    rcv_window_ = window;
+    rcv_wnd_advertised_ = window;
   }
+  uint32_t GetMaxWindow() const { return rcv_window_; }
 
-  void ShutDown() {
-    switch (state_) {
-      case State::kClosed:
-        break;
-      case State::kSynSent:
-        [[fallthrough]];
-      case State::kSynReceived:
-        [[fallthrough]];
-      case State::kEstablished:
-        pcb_.rto_disable();
-        SendRst();
-        state_ = State::kClosed;
-        break;
-      default:
-        LOG(FATAL) << "Unknown state";
+  /**
+   * @brief Lets the flow spray its data packets over up to `paths_nr' paths
+   * of an ECMP fabric, instead of the single path its 5-tuple hashes to. Must
+   * be called before the handshake.
+   *
+   * Paths differ by the UDP port of the end that initiated the flow. That end
+   * passes the ports of the paths beyond the first in `ports' (the engine
+   * allocates them so that they land on its RX queue, like the port of the
+   * flow key), and advertises them in its SYN; the peer uses up to its own
+   * `paths_nr' of them and tells so in its SYN-ACK. Both ends then find the
+   * flow by the keys of all its paths (see `GetPathKeys'). ACKs and other
+   * control packets take the first path.
+   *
+   * A flow moves to the next path once it has not sent for `flowlet_gap_ns',
+   * so that flowlets are not reordered, given a gap above the differences
+   * in delay between paths; or on every packet if zero. This lets large
+   * transfers use the bisection bandwidth of the fabric, at the cost of more
+   * reordering, which the loss detection then tolerates (see `DetectLosses').
+   *
+   * @param paths_nr       Maximum number of paths, 1 (the default) to
+   *                       `kMaxPaths'.
+   * @param flowlet_gap_ns Idle time after which packets take the next path.
+   * @param ports          Initiating end: the UDP ports of the paths beyond
+   *                       the first, at most `paths_nr - 1'.
+   */
+  void SetMultipath(size_t paths_nr, uint64_t flowlet_gap_ns,
+                    std::vector<Udp::Port> ports = {}) {
+    CHECK(state_ == State::kClosed);
+    CHECK(paths_nr >= 1 && paths_nr <= kMaxPaths)
+        << "Invalid number of paths: " << paths_nr;
+    CHECK_LT(ports.size(), paths_nr);
+    max_paths_nr_ = paths_nr;
+    flowlet_gap_cycles_ = time::ns_to_cycles(flowlet_gap_ns);
+    path_ports_ = std::move(ports);
+    path_ports_local_ = !path_ports_.empty();
+  }
+  size_t GetPathsNr() const { return paths_nr_; }
+
+  /**
+   * @brief Returns the keys of the paths of the flow beyond the first (whose
+   * key is `key()'), by which incoming packets find the flow. On the end that
+   * initiated the flow, these are all the ports passed to `SetMultipath',
+   * whether the peer uses them or not; on the other end, the paths in use,
+   * once the SYN is processed.
+   */
+  std::vector<Key> GetPathKeys() const {
+    std::vector<Key> keys;
+    for (const auto& port : path_ports_) {
+      if (path_ports_local_) {
+        keys.emplace_back(key_.local_addr, port, key_.remote_addr,
+                          key_.remote_port);
+      } else {
+        keys.emplace_back(key_.local_addr, key_.local_port, key_.remote_addr,
+                          port);
+      }
     }
+    return keys;
   }
 
   /**
-   * @brief Push the received packet onto the ingress queue of the flow.
-   * Decrypts packet if required, stores the payload in the relevant channel
-   * shared memory space, and if the message is ready for delivery notifies the
-   * application.
+   * @brief Lets data ride right behind the SYN of the flow (0-RTT), instead of
+   * waiting for the handshake to complete. Must be called before the
+   * handshake.
    *
-   * If this is a transport control packet (e.g., ACK) it only updates
-   * transport-related parameters for the flow.
+   * The initiating end reports the flow established to the application as
+   * soon as it sends the SYN, and sends the first messages of the application
+   * right after it, within the initial congestion window and the default
+   * receive window, in packets of the default MSS; the SYN-ACK then brings the
+   * options of the peer, and may acknowledge some of the data already. The
+   * other end takes data packets as soon as it has answered the SYN, instead
+   * of dropping them until the handshake completes. Both ends must enable it:
+   * otherwise, early data is recovered by retransmission after the handshake.
+   * As with TCP Fast Open, the application learns that the peer does not
+   * answer only when the flow goes away, and the peer may get the early data
+   * of a flow whose handshake then fails.
    *
-   * @param packet Pointer to the allocated packet on the rx ring of the driver
+   * @param enable True to send and take early data.
    */
-  void InputPacket(const dpdk::Packet* packet) {
-    // Parse the Machnet header of the packet.
-    const size_t net_hdr_len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
-    auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
+  void SetEarlyData(bool enable) {
+    CHECK(state_ == State::kClosed);
+    // The keys of encrypted flows exist only once the SYN-ACK arrives.
+    early_data_ = enable && !encrypt_;
+  }
 
-    if (machneth->magic.value() != MachnetPktHdr::kMagic) {
-      LOG(ERROR) << "Invalid Machnet header magic: " << machneth->magic;
-      return;
+  /**
+   * @brief Packs the small messages the flow sends into shared packets, up to
+   * the MSS, rather than one packet per message (see `TXTracking::Aggregate'):
+   * under a stream of small messages, fewer packets carry them, with less
+   * header, per-packet and ACK overhead. The peer splits the packets back
+   * into the messages, which it delivers one by one; ends tell whether they
+   * do in the handshake (see `MachnetSynOptions'), and flows towards peers
+   * that do not send one packet per message.
+   *
+   * As with Nagle's algorithm, while data is in flight the last message
+   * queued, if small, is held back for up to `hold_ns' for more to join it;
+   * a flow with nothing in flight sends at once. Messages that span several
+   * buffers, ask for a delivery notification or are fan-out sends are never
+   * packed.
+   *
+   * @param max_msg_len Largest message packed, in bytes; 0 disables
+   *                    aggregation (the default).
+   * @param hold_ns     Longest hold of the last message; 0 packs only the
+   *                    messages that queue up behind the window.
+   */
+  void SetAggregation(uint32_t max_msg_len, uint64_t hold_ns) {
+    agg_max_msg_len_ = max_msg_len;
+    agg_hold_cycles_ = time::ns_to_cycles(hold_ns);
+    agg_deadline_ = 0;
+    tx_tracking_.SetAggregation(peer_splits_ ? agg_max_msg_len_ : 0);
+  }
+
+  /**
+   * @brief Sets the priority class of the flow (`MACHNET_PRIO_*'), and the
+   * DSCP its packets carry.
+   *
+   * Flows below the top class send at most `kTxQuantum' packets at a time,
+   * then yield: the pacer releases them on its next slot, after the flows of
+   * higher classes (see `Pacer'). A bulk transfer with a large window thus
+   * takes turns with the other flows of the engine instead of holding up its
+   * TX queue for a whole window.
+   *
+   * @param prio Priority class, below `MACHNET_PRIO_CLASSES_NR'.
+   * @param dscp Differentiated services code point of the packets, so that
+   *             NICs and switches may map the class to traffic classes of
+   *             their own; zero marks them best-effort.
+   */
+  void SetPriority(uint32_t prio, uint8_t dscp) {
+    CHECK_LT(prio, MACHNET_PRIO_CLASSES_NR);
+    CHECK_LT(dscp, 64);
+    prio_ = prio;
+    dscp_ = dscp;
+    for (auto* hdrs : {&hdr_template_, &ctrl_template_}) {
+      auto& tos = hdrs->ipv4h.type_of_service;
+      tos = (dscp_ << 2) | (tos & Ipv4::kEcnMask);
     }
+  }
+  uint32_t GetPriority() const { return prio_; }
 
-    switch (machneth->net_flags) {
-      case MachnetPktHdr::MachnetFlags::kSyn:
-        // SYN packet received. For this to be valid it has to be an already
-        // established flow with this SYN being a retransmission.
-        if (state_ != State::kSynReceived && state_ != State::kClosed) {
-          LOG(ERROR) << "SYN packet received for flow in state: "
-                     << static_cast<int>(state_);
-          return;
-        }
+  /**
+   * @brief Encrypts the data of the flow with AES-GCM, on `crypto' (see
+   * `dpdk::CryptoEngine'). Must be called before the handshake; an end that
+   * encrypts refuses peers that do not.
+   *
+   * The handshake derives a key per direction from the master key of the
+   * engines and random nonces of both ends, carried in the SYN and SYN-ACK
+   * (see `MachnetSynOptions'). Data packets carry an explicit IV after the
+   * Machnet header, which is authenticated, then the encrypted payload and
+   * the tag; packets that fail authentication are dropped, and recovered as
+   * losses. Control packets carry no data, and go in the clear.
+   *
+   * The MSS leaves room for the IV and the tag. Encryption rules out early
+   * data and UDP segmentation. Transmission stays zero-copy where the device
+   * can read channel memory: it reads the payload from the message buffer,
+   * and writes the ciphertext into the packet.
+   *
+   * @param crypto Crypto engine of the flow's engine; nullptr leaves the flow
+   *               in the clear.
+   */
+  void SetEncryption(dpdk::CryptoEngine* crypto) {
+    CHECK(state_ == State::kClosed);
+    encrypt_ = crypto != nullptr;
+    crypto_ = crypto;
+    if (!encrypt_) return;
+    CHECK_EQ(getrandom(crypto_nonce_.data(), crypto_nonce_.size(), 0),
+             static_cast<ssize_t>(crypto_nonce_.size()));
+    early_data_ = false;
+    uso_max_segs_nr_ = 0;
+    syn_mss_ = std::min(syn_mss_, GetLocalMss());
+    tx_tracking_.SetMss(syn_mss_);
+  }
+  bool IsEncrypted() const { return encrypt_; }
 
-        if (state_ == State::kClosed) {
-          // If the flow is in closed state, we need to send a SYN-ACK packetj
-          // and mark the flow as established.
-          pcb_.rcv_nxt = machneth->seqno.value();
-          pcb_.advance_rcv_nxt();
-          SendSynAck(pcb_.get_snd_nxt());
-          state_ = State::kSynReceived;
-        } else if (state_ == State::kSynReceived) {
-          // If the flow is in SYN-RECEIVED state, our SYN-ACK packet was lost.
-          // We need to retransmit it.
-          SendSynAck(pcb_.snd_una);
-        }
-        break;
-      case MachnetPktHdr::MachnetFlags::kSynAck:
-        // SYN-ACK packet received. For this to be valid it has to be an already
-        // established flow with this SYN-ACK being a retransmission.
-        if (state_ != State::kSynSent && state_ != State::kEstablished) {
-          LOG(ERROR) << "SYN-ACK packet received for flow in state: "
-                     << static_cast<int>(state_);
-          return;
-        }
+  /**
+   * @brief Moves the sessions of the keys of the flow to the crypto engine of
+   * another engine (see `SetEngine'), or destroys them (nullptr), e.g., before
+   * the engine goes away; the keys stay.
+   *
+   * @return False if a key gets no session on `crypto': the flow can no
+   * longer exchange data.
+   */
+  bool SetCryptoEngine(dpdk::CryptoEngine* crypto) {
+    if (!encrypt_) return true;
+    crypto_ = crypto;
+    return tx_key_.Bind(crypto) && rx_key_.Bind(crypto);
+  }
 
-        if (machneth->ackno.value() != pcb_.snd_nxt) {
-          LOG(ERROR) << "SYN-ACK packet received with invalid ackno: "
-                     << machneth->ackno << " snd_una: " << pcb_.snd_una
-                     << " snd_nxt: " << pcb_.snd_nxt;
-          return;
-        }
+  /**
+   * @brief Lets the flow check that its peer is still there while idle (see
+   * `RtoCheck'). Once nothing has been in flight for `interval_ns', the flow
+   * sends keep-alive probes, which the peer answers with an ACK, spaced like
+   * retransmissions with backoff; if the peer answers none of them, the flow
+   * goes away, as with data in flight. This keeps flows that applications
+   * hold on to for reuse from outliving their peer.
+   *
+   * @param interval_ns Idle time before the first probe; zero disables them.
+   */
+  void SetKeepAlive(uint64_t interval_ns) {
+    keepalive_cycles_ = time::ns_to_cycles(interval_ns);
+    if (state_ == State::kEstablished) RtoMaybeReset();
+  }
+  bool IsKeptAlive() const { return keepalive_cycles_ != 0; }
 
-        if (state_ == State::kSynSent) {
-          pcb_.snd_una++;
-          pcb_.rcv_nxt = machneth->seqno.value();
-          pcb_.advance_rcv_nxt();
-          pcb_.rto_maybe_reset();
-          // Mark the flow as established.
-          state_ = State::kEstablished;
-          // Notify the application that the flow is established.
-          callback_(channel(), true, key());
-        }
-        // Send an ACK packet.
-        SendAck();
-        break;
-      case MachnetPktHdr::MachnetFlags::kRst: {
-        const auto seqno = machneth->seqno.value();
-        const auto expected_seqno = pcb_.rcv_nxt;
-        if (swift::seqno_eq(seqno, expected_seqno)) {
-          // If the RST packet is in sequence, we can reset the flow.
-          state_ = State::kClosed;
-        }
-      } break;
-      case MachnetPktHdr::MachnetFlags::kAck:
-        // ACK packet, update the flow.
-        // update_flow(machneth);
-        process_ack(machneth);
+  void InitiateHandshake() {
+    CHECK(state_ == State::kClosed);
+    SendSyn(pcb_.get_snd_nxt());
+    RtoReset();
+    SetState(State::kSynSent);
+    if (early_data_) {
+      // The MSS and window of the peer are unknown until the SYN-ACK, and the
+      // scoreboard cannot be resized once data is in flight: size it for the
+      // largest window the handshake may settle on.
+      tx_tracking_.SetMss(std::min(syn_mss_, kDefaultMss));
+      tx_tracking_.scoreboard()->Resize(rcv_window_);
+      callback_(channel(), true, key());
+    }
+  }
+
+  void ShutDown() {
+    switch (state_) {
+      case State::kClosed:
         break;
-      case MachnetPktHdr::MachnetFlags::kData:
-        if (state_ != State::kEstablished) {
-          LOG(ERROR) << "Data packet received for flow in state: "
-                     << static_cast<int>(state_);
-          return;
-        }
-        // Data packet, process the payload.
-        const int consume_returncode = rx_tracking_.Consume(&pcb_, packet);
-        if (consume_returncode == 0) SendAck();
+      case State::kSynSent:
+        [[fallthrough]];
+      case State::kSynReceived:
+        [[fallthrough]];
+      case State::kEstablished:
+        RtoDisable();
+        SendRst();
+        SetState(State::kClosed);
         break;
+      default:
+        LOG(FATAL) << "Unknown state";
+    }
+  }
+
+  /**
+   * @brief Push the received packet onto the ingress queue of the flow.
+   * Decrypts packet if required, stores the payload in the relevant channel
+   * shared memory space, and if the message is ready for delivery notifies the
+   * application.
+   *
+   * If this is a transport control packet (e.g., ACK) it only updates
+   * transport-related parameters for the flow.
+   *
+   * @param packet Pointer to the allocated packet on the rx ring of the driver
+   * @param now    Current TSC.
+   * @return True if this call armed a timer (see `TimerCheck').
+   */
+  bool InputPacket(dpdk::Packet* packet, uint64_t now) {
+    return InputPackets(&packet, 1, now);
+  }
+
+  /**
+   * @brief Process a group of incoming packets of this flow, as collected by
+   * the engine from one RX burst (see `InputPacket').
+   *
+   * In-order data packets are acknowledged once for the whole group, with a
+   * cumulative ACK carrying the SACK bitmap, unless the ACK policy (see
+   * `SetAckPolicy') asks for a delayed ACK.
+   *
+   * @param packets    Array of packets, in order of arrival.
+   * @param nb_packets Number of packets in the array.
+   * @param now        Current TSC. Packets without an RX timestamp are
+   *                   taken to have arrived at `now'.
+   * @return True if this call armed a timer (see `TimerCheck').
+   */
+  bool InputPackets(dpdk::Packet* const* packets, uint16_t nb_packets,
+                    uint64_t now) {
+    // Encrypted flows decrypt the data packets of a burst at once.
+    constexpr uint16_t kMaxChunk = 64;
+    for (uint16_t first = 0; first < nb_packets; first += kMaxChunk) {
+      const uint16_t nb = std::min<uint16_t>(nb_packets - first, kMaxChunk);
+      const uint64_t valid =
+          encrypt_ ? DecryptPackets(packets + first, nb) : ~0ULL;
+      for (uint16_t i = 0; i < nb; i++) {
+        if (valid & (1ULL << i)) process_rx_packet(packets[first + i], now);
+      }
+    }
+
+    if (pending_acks_ != 0) {
+      if (ack_delay_cycles_ == 0) {
+        SendAck();
+      } else if (ack_deadline_ == 0) {
+        ack_deadline_ = now + ack_delay_cycles_;
+      } else if (now >= ack_deadline_) {
+        SendAck();
+      }
+    }
+    return StartTimerPolling();
+  }
+
+  /**
+   * @brief Fires the timers of the flow that are due, i.e., the delayed ACK
+   * (see `SetAckPolicy') and the hold of small messages (see
+   * `SetAggregation'), and, while the receive window is reduced, delivers
+   * the messages held back and sends a window update once the application
+   * catches up (see `WindowUpdateDue').
+   *
+   * Timers are driven by polling: once a call of `InputPackets' or
+   * `OutputMessage' returns true, the caller must call this method
+   * periodically until it returns false.
+   *
+   * @param now Current TSC.
+   * @return True if a timer is still armed.
+   */
+  bool TimerCheck(uint64_t now) {
+    rx_tracking_.Deliver();
+    if ((ack_deadline_ != 0 && now >= ack_deadline_) || WindowUpdateDue()) {
+      SendAck();
+    }
+    if (agg_deadline_ != 0 && now >= agg_deadline_) {
+      // The message held goes as soon as the window allows.
+      agg_deadline_ = 0;
+      TransmitPackets();
+    }
+    timer_polling_ = TimersPending();
+    return timer_polling_;
+  }
+
+  /**
+   * @brief Sets the pacer that spaces out the transmissions of the flow.
+   *
+   * When the congestion window is below one packet, packets are always sent
+   * one at a time, the pacing delay of the congestion control apart. With
+   * `pace_window', the rest of the time they are spread over the RTT as well,
+   * instead of sending the whole window at line rate: this avoids the
+   * microbursts of many flows starting at once. Without a pacer, the flow
+   * sends whatever its window allows at once.
+   *
+   * @param pacer       Pacer of the engine, or nullptr to disable pacing; must
+   *                    outlive the flow, or be replaced before it goes away.
+   * @param pace_window Whether to pace flows whose window is not small.
+   */
+  void SetPacer(Pacer* pacer, bool pace_window) {
+    if (pacer_scheduled_) pacer_->Remove(this);
+    pacer_scheduled_ = false;
+    pacer_ = pacer;
+    pace_window_ = pace_window;
+  }
+
+  /**
+   * @brief Sets the timer wheel that drives the retransmission timer of the
+   * flow (see `RtoCheck'). Without one, the flow never times out.
+   *
+   * @param timers Timer wheel of the engine, or nullptr; must outlive the
+   *               flow, or be replaced before it goes away.
+   */
+  void SetTimerWheel(Timers* timers) {
+    if (timers_ != nullptr) timers_->Cancel(&rto_timer_);
+    timers_ = timers;
+    if (!RtoDisabled()) ArmRtoTimer(rto_deadline_);
+  }
+
+  /**
+   * @brief Moves the flow to another engine of the same port (or bond),
+   * keeping its protocol state (see `MachnetEngine::AttachChannel'): outgoing
+   * packets are staged to `txbatch', `pacer' and `timers' drive the flow from
+   * now on, and its events go to `tracer'. Transmission resumes where it
+   * stopped.
+   */
+  void SetEngine(dpdk::TxBatch* txbatch, Pacer* pacer, bool pace_window,
+                 Timers* timers, trace::Tracer* tracer) {
+    SetTxBatch(txbatch);
+    SetPacer(pacer, pace_window);
+    SetTimerWheel(timers);
+    SetTracer(tracer);
+    auto* crypto = txbatch->GetCryptoEngine();
+    if (encrypt_ && (crypto == nullptr || !SetCryptoEngine(crypto))) {
+      LOG(ERROR) << "Flow " << key_.ToString()
+                 << " cannot encrypt on its new engine; closing it.";
+      Abort(time::rdtsc());
+      return;
+    }
+    if (state_ == State::kEstablished) TransmitPackets();
+  }
+
+  /**
+   * @brief Moves the transmission of the flow to another port of the engine's
+   * bond (see `MachnetEngine::AddPort'). Packets already staged leave from the
+   * previous port.
+   */
+  void SetTxBatch(dpdk::TxBatch* txbatch) { txbatch_ = CHECK_NOTNULL(txbatch); }
+
+  /**
+   * @brief Hands the flow over to another process on a hot restart (see
+   * `MachnetController::TakeOver'): fills `cp' with its protocol state, and
+   * gives up its message buffers without freeing any, as the channel goes to
+   * the new process with them. The flow must be detached from its engine
+   * (see `MachnetEngine::DetachChannel'), and is closed on return.
+   *
+   * @return False if the flow is not established; it is not carried over, and
+   * is left untouched.
+   */
+  bool HandOff(FlowCheckpoint* cp) {
+    if (state_ != State::kEstablished) return false;
+    auto* hdr = &cp->hdr;
+    hdr->local_addr = key_.local_addr.address.value();
+    hdr->remote_addr = key_.remote_addr.address.value();
+    hdr->local_port = key_.local_port.port.value();
+    hdr->remote_port = key_.remote_port.port.value();
+    std::memcpy(hdr->remote_l2_addr, remote_l2_addr_.bytes,
+                sizeof(hdr->remote_l2_addr));
+    hdr->cc = static_cast<uint8_t>(cc_.GetAlgorithm());
+    hdr->path_ports_local = path_ports_local_;
+    hdr->peer_splits = peer_splits_;
+    hdr->snd_una = pcb_.snd_una;
+    hdr->snd_wnd = pcb_.snd_wnd;
+    hdr->rcv_nxt = pcb_.rcv_nxt;
+    hdr->rcv_window = rcv_window_;
+    hdr->tx_window = tx_tracking_.scoreboard()->capacity();
+    hdr->mss = tx_tracking_.GetMss();
+    hdr->srtt_ns = pcb_.srtt_ns;
+    hdr->rttvar_ns = pcb_.rttvar_ns;
+    hdr->min_rtt_ns = pcb_.min_rtt_ns;
+    hdr->latest_rtt_ns = pcb_.latest_rtt_ns;
+    hdr->rto_ns = pcb_.rto_ns;
+    hdr->keepalive_ns = time::cycles_to_ns(keepalive_cycles_);
+    hdr->flowlet_gap_ns = time::cycles_to_ns(flowlet_gap_cycles_);
+    hdr->paths_nr = paths_nr_;
+    hdr->max_paths_nr = max_paths_nr_;
+    for (const auto& port : path_ports_) {
+      cp->path_ports.emplace_back(port.port.value());
     }
+    hdr->encrypted = encrypt_;
+    hdr->key_len = tx_key_.size();
+    std::memcpy(hdr->tx_key, tx_key_.data(), tx_key_.size());
+    std::memcpy(hdr->rx_key, rx_key_.data(), rx_key_.size());
+    hdr->tx_iv = tx_iv_;
+    tx_tracking_.HandOff(cp);
+    rx_tracking_.HandOff(&pcb_, cp);
+    agg_deadline_ = 0;
+    RtoDisable();
+    SetState(State::kClosed);
+    return true;
+  }
+
+  /**
+   * @brief Takes over a flow handed off by another process (see `HandOff'):
+   * the flow, new and of the same key, resumes established with the sequence
+   * numbers, windows, paths and RTT estimates of `cp'. Congestion control
+   * starts over, and whatever was in flight is sent again (go-back-N); the
+   * peer drops what it has already. Call before attaching the flow to an
+   * engine (see `SetEngine'), which resumes transmission.
+   *
+   * @return False if `cp' does not fit the flow or its channel; nothing
+   * changes then.
+   */
+  bool Restore(const FlowCheckpoint& cp) {
+    CHECK(state_ == State::kClosed);
+    const auto& hdr = cp.hdr;
+    auto valid_window = [](uint32_t window) {
+      return window >= kDefaultWindow && window <= kMaxWindow &&
+             std::has_single_bit(window);
+    };
+    const uint32_t bufs_nr = channel_->GetTotalBufCount();
+    auto valid_buf = [bufs_nr](uint32_t index) {
+      return index == FlowCheckpoint::kNoBuf || index < bufs_nr;
+    };
+    bool valid = valid_window(hdr.rcv_window) && valid_window(hdr.tx_window) &&
+                 hdr.max_paths_nr >= 1 && hdr.max_paths_nr <= kMaxPaths &&
+                 hdr.paths_nr >= 1 && hdr.paths_nr <= hdr.max_paths_nr &&
+                 cp.path_ports.size() < hdr.max_paths_nr &&
+                 valid_buf(hdr.tx_first) && valid_buf(hdr.tx_last) &&
+                 valid_buf(hdr.rx_train_head) && valid_buf(hdr.rx_train_tail) &&
+                 (!hdr.encrypted || hdr.key_len == 16 || hdr.key_len == 32);
+    for (const auto& buf : cp.ooo_bufs) {
+      valid = valid && buf.distance < hdr.rcv_window && buf.index < bufs_nr;
+    }
+    for (const auto& msg : cp.undelivered) {
+      valid = valid && msg.index < bufs_nr;
+    }
+    if (!valid) return false;
+
+    SetMaxWindow(hdr.rcv_window);
+    tx_tracking_.scoreboard()->Resize(hdr.tx_window);
+    cc_.SetMaxWindow(hdr.tx_window);
+    pcb_.snd_una = hdr.snd_una;
+    pcb_.snd_nxt = hdr.snd_una;
+    pcb_.snd_wnd = hdr.snd_wnd;
+    pcb_.rcv_nxt = hdr.rcv_nxt;
+    pcb_.srtt_ns = hdr.srtt_ns;
+    pcb_.rttvar_ns = hdr.rttvar_ns;
+    pcb_.min_rtt_ns = hdr.min_rtt_ns;
+    pcb_.latest_rtt_ns = hdr.latest_rtt_ns;
+    pcb_.rto_ns = hdr.rto_ns;
+    syn_mss_ = hdr.mss;
+    tx_tracking_.SetMss(syn_mss_);
+    max_paths_nr_ = hdr.max_paths_nr;
+    paths_nr_ = hdr.paths_nr;
+    flowlet_gap_cycles_ = time::ns_to_cycles(hdr.flowlet_gap_ns);
+    path_ports_.assign(cp.path_ports.begin(), cp.path_ports.end());
+    path_ports_local_ = hdr.path_ports_local;
+    peer_splits_ = hdr.peer_splits;
+    keepalive_cycles_ = time::ns_to_cycles(hdr.keepalive_ns);
+    if (hdr.encrypted) {
+      // Sessions come with the engine (see `SetEngine').
+      encrypt_ = true;
+      early_data_ = false;
+      uso_max_segs_nr_ = 0;
+      tx_key_.Set(hdr.tx_key, hdr.key_len, true);
+      rx_key_.Set(hdr.rx_key, hdr.key_len, false);
+      tx_iv_ = hdr.tx_iv;
+    }
+    tx_tracking_.Restore(cp);
+    rx_tracking_.Restore(&pcb_, cp);
+    SetState(State::kEstablished);
+    RtoMaybeReset();
+    // Tell the peer where the flow stands as soon as it is polled.
+    ack_deadline_ = time::rdtsc();
+    return true;
+  }
+
+  /**
+   * @brief Resumes transmission once the pacer releases the flow.
+   */
+  void PacerRelease() {
+    pacer_scheduled_ = false;
+    TransmitPackets();
+  }
+
+  /**
+   * @brief Configures acknowledgement coalescing for in-order data.
+   *
+   * @param ack_every_n  Send an ACK at least every `ack_every_n' in-order
+   *                     data packets, even in the middle of an RX burst.
+   * @param ack_delay_us Maximum time an ACK may be held back after the RX
+   *                     burst that triggered it. If zero, an ACK is sent at
+   *                     the end of every RX burst that carried data.
+   *
+   * Out-of-order, duplicate, and hole-filling packets are always acknowledged
+   * immediately, so that fast retransmission on the sender is not delayed.
+   */
+  void SetAckPolicy(uint32_t ack_every_n, uint64_t ack_delay_us) {
+    CHECK_GT(ack_every_n, 0);
+    ack_every_n_ = ack_every_n;
+    ack_delay_cycles_ = time::us_to_cycles(ack_delay_us);
   }
 
   /**
@@ -553,41 +1892,104 @@ class Flow {
    *
    * @param msg Pointer to the first message buffer on a train of buffers,
    * aggregating to a partial or a full Message.
+   * @return True if this call armed a timer (see `TimerCheck').
    */
-  void OutputMessage(shm::MsgBuf* msg) {
-    tx_tracking_.Append(msg);
-
-    // TODO(ilias): We first need to check whether the cwnd is < 1, so that we
-    // fallback to rate-based CC.
-
-    // Calculate the effective window (in # of packets) to check whether we can
-    // send more packets.
+  bool OutputMessage(shm::MsgBuf* msg) {
+    // Replies go to the application thread that sent last.
+    rx_tracking_.SetQueue(msg->queue());
+    const auto* open_agg = tx_tracking_.GetOpenAggregate();
+    if (!tx_tracking_.Append(msg)) [[unlikely]] {
+      LOG(ERROR) << "Out of buffers to segment a message; dropping it. Flow: "
+                 << key_.ToString();
+      if (msg->flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY) {
+        const auto completion = TxCompletion(msg, MACHNET_TX_COMPL_DROPPED);
+        channel()->PostTxCompletions(&completion, 1);
+      }
+      tx_tracking_.FreeMessage(msg);
+      return false;
+    }
+    if (tx_tracking_.GetOpenAggregate() != open_agg) {
+      // A new message others may join: its hold starts (see
+      // `SetAggregation').
+      agg_deadline_ =
+          tx_tracking_.GetOpenAggregate() != nullptr && agg_hold_cycles_ != 0
+              ? time::rdtsc() + agg_hold_cycles_
+              : 0;
+    }
     TransmitPackets();
+    return StartTimerPolling();
   }
 
   /**
-   * @brief Periodically checks the state of the flow and performs necessary
-   * actions.
-   *
-   * This method is called periodically to check the state of the flow, update
-   * the RTO timer, retransmit unacknowledged messages, and potentially remove
-   * the flow or notify the application about the connection state.
+   * @brief Get the congestion control state of the flow.
+   */
+  const swift::CongestionController& cc() const { return cc_; }
+
+  /**
+   * @brief Handles the expiry of the flow's timer (see `SetTimerWheel'):
+   * retransmits the oldest unacknowledged message buffer on a retransmission
+   * timeout, or gives up on the flow after too many of them in a row.
    *
-   * @return Returns true if the flow should continue to be checked
-   * periodically, false if the flow should be removed or closed.
+   * @param now Current TSC.
+   * @return False if the flow should be removed, true otherwise.
    */
-  bool PeriodicCheck() {
+  bool RtoCheck(uint64_t now) {
     // CLOSED state is terminal; the engine might remove the flow.
     if (state_ == State::kClosed) return false;
 
-    if (pcb_.rto_disabled()) return true;
+    if (RtoDisabled()) return true;
+    if (reo_deadline_ != 0 && now >= reo_deadline_) {
+      // A packet sent before one since delivered may be overdue.
+      reo_deadline_ = 0;
+      DetectLosses(now);
+      TransmitPackets();
+    }
+    if (now < rto_deadline_) {
+      // Not an RTO (or the timer expired early, e.g., beyond the range of
+      // the wheel).
+      UpdateTimer();
+      return true;
+    }
+
+    if (keepalive_armed_) {
+      // Idle for long enough: probe the peer (see `SetKeepAlive').
+      if (pcb_.max_rexmits_reached()) {
+        Trace(trace::Event::kKeepAliveTimeout, pcb_.snd_una);
+        VLOG(1) << "Flow " << key_.ToString() << " keep-alive timed out";
+        return false;
+      }
+      SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kKeepAlive);
+      const auto probe_ns = std::min(
+          pcb_.rto_ns << std::min<uint16_t>(pcb_.rto_rexmits, 16),
+          swift::Pcb::kMaxRtoNs);
+      pcb_.rto_rexmits++;
+      rto_deadline_ = now + time::ns_to_cycles(probe_ns);
+      UpdateTimer();
+      return true;
+    }
+
+    if (state_ == State::kEstablished && !pcb_.rto_needed()) {
+      // Nothing in flight: this is the persist timer, armed while the receive
+      // window of the peer is closed (see `TransmitPackets').
+      WindowProbe();
+      return true;
+    }
+
+    if (probe_armed_) {
+      tlp_probed_ = true;
+      if (SendProbe()) {
+        RtoReset();
+        return true;
+      }
+    }
 
-    pcb_.rto_advance();
     if (pcb_.max_rexmits_reached()) {
+      Trace(trace::Event::kFlowFailed, pcb_.snd_una, static_cast<int>(state_));
       if (state_ == State::kSynSent) {
-        // Notify the application that the flow has not been established.
-        LOG(INFO) << "Flow " << this << " failed to establish";
-        callback_(channel(), false, key());
+        // Notify the application that the flow has not been established,
+        // unless it was told otherwise already (see `SetEarlyData').
+        VLOG(1) << "Flow " << this << " failed to establish";
+        if (!early_data_) callback_(channel(), false, key());
       }
       // TODO(ilias): Send RST packet.
 
@@ -595,102 +1997,448 @@ class Flow {
       return false;
     }
 
-    if (pcb_.rto_expired()) {
-      // Retransmit the oldest unacknowledged message buffer.
-      RTORetransmit();
+    RTORetransmit();
+    return true;
+  }
+
+ private:
+  // Records an event of the flow, if it has a tracer (see `SetTracer').
+  void Trace(trace::Event event, uint32_t seqno, uint32_t arg = 0) {
+    if constexpr (trace::kEnabled) {
+      if (tracer_ != nullptr) tracer_->Record(event, trace_id_, seqno, arg);
     }
+  }
+  // Records a packet dropped for arriving in a state that does not expect it.
+  void TraceBadState(const MachnetPktHdr* machneth) {
+    Trace(trace::Event::kDropBadState, machneth->seqno.value(),
+          static_cast<uint32_t>(machneth->net_flags) << 8 |
+              static_cast<uint32_t>(state_));
+  }
+  void SetState(State state) {
+    state_ = state;
+    Trace(trace::Event::kFlowState, pcb_.snd_nxt, static_cast<int>(state));
+  }
 
+  // Retransmission timer: `rto_deadline_' is the TSC at which it expires, or
+  // zero if it is disabled. The flow's timer on the wheel also serves the
+  // RACK reordering timeout (`reo_deadline_', zero if none), and first expires
+  // as a tail loss probe (TLP, RFC 8985) two SRTTs after the last ACK, once
+  // per window and outside of recovery. The timer of the wheel may be armed
+  // earlier than the deadlines, in which case `RtoCheck' re-arms it; this
+  // keeps restarting the timer on every ACK cheap.
+  bool RtoDisabled() const { return rto_deadline_ == 0; }
+  void RtoReset() {
+    keepalive_armed_ = false;
+    probe_armed_ = state_ == State::kEstablished && !tlp_probed_ &&
+                   !in_recovery_ && pcb_.srtt_ns != 0;
+    const auto timeout_ns = probe_armed_
+                                ? std::min(2 * pcb_.srtt_ns, pcb_.rto_ns)
+                                : pcb_.rto_ns;
+    rto_deadline_ = time::rdtsc() + time::ns_to_cycles(timeout_ns);
+    UpdateTimer();
+  }
+  void RtoDisable() {
+    keepalive_armed_ = false;
+    rto_deadline_ = 0;
+    reo_deadline_ = 0;
+    if (timers_ != nullptr) timers_->Cancel(&rto_timer_);
+  }
+  void RtoMaybeReset() {
+    if (pcb_.rto_needed()) {
+      RtoReset();
+    } else if (keepalive_cycles_ != 0 && state_ == State::kEstablished) {
+      KeepAliveReset();
+    } else {
+      RtoDisable();
+    }
+  }
+  // Arms the timer for the first keep-alive probe (see `SetKeepAlive').
+  void KeepAliveReset() {
+    keepalive_armed_ = true;
+    rto_deadline_ = time::rdtsc() + keepalive_cycles_;
+    reo_deadline_ = 0;
+    UpdateTimer();
+  }
+  // Arms the timer for the earliest deadline, unless it is armed earlier.
+  void UpdateTimer() {
+    auto tsc = rto_deadline_;
+    if (reo_deadline_ != 0 && (tsc == 0 || reo_deadline_ < tsc)) {
+      tsc = reo_deadline_;
+    }
+    if (tsc == 0) return;
+    if (!rto_timer_.armed() || rto_timer_tsc_ > tsc) ArmRtoTimer(tsc);
+  }
+  void ArmRtoTimer(uint64_t tsc) {
+    if (timers_ == nullptr) return;
+    timers_->Schedule(&rto_timer_, tsc);
+    rto_timer_tsc_ = tsc;
+  }
+
+  // Receive window growth that warrants a window update (see
+  // `WindowUpdateDue'): a quarter of the window, as in the silly window
+  // syndrome avoidance of TCP (RFC 1122, section 4.2.3.3).
+  uint32_t WindowUpdateThreshold() const {
+    return std::max<uint32_t>(pcb_.sack_window() / 4, 1);
+  }
+  // Whether the receive window grew enough since it was last advertised for
+  // the peer to learn about it before its next ACK, if ever: a sender whose
+  // window is closed only sends window probes.
+  bool WindowUpdateDue() const {
+    return rx_tracking_.GetWindow(&pcb_) >=
+           rcv_wnd_advertised_ + WindowUpdateThreshold();
+  }
+  // Whether the flow needs `TimerCheck' to be polled.
+  bool TimersPending() const {
+    return ack_deadline_ != 0 || agg_deadline_ != 0 ||
+           rx_tracking_.HasUndelivered() || rcv_wnd_reduced_;
+  }
+
+  // Returns true if a timer is armed and the caller does not poll the flow's
+  // timers yet, in which case it has to from now on.
+  bool StartTimerPolling() {
+    if (timer_polling_ || !TimersPending()) {
+      return false;
+    }
+    timer_polling_ = true;
     return true;
   }
 
- private:
-  void PrepareL2Header(dpdk::Packet* packet) const {
-    auto* eh = packet->head_data<Ethernet*>();
-    eh->src_addr = local_l2_addr_;
-    eh->dst_addr = remote_l2_addr_;
-    eh->eth_type = be16_t(Ethernet::kIpv4);
-    packet->set_l2_len(sizeof(*eh));
-  }
-
-  void PrepareL3Header(dpdk::Packet* packet) const {
-    auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
-    ipv4h->version_ihl = 0x45;
-    ipv4h->type_of_service = 0;
-    ipv4h->packet_id = be16_t(0x1513);
-    ipv4h->fragment_offset = be16_t(0);
-    ipv4h->time_to_live = 64;
-    ipv4h->next_proto_id = Ipv4::Proto::kUdp;
-    ipv4h->total_length = be16_t(packet->length() - sizeof(Ethernet));
-    ipv4h->src_addr = key_.local_addr;
-    ipv4h->dst_addr = key_.remote_addr;
-    ipv4h->hdr_checksum = 0;
-    packet->set_l3_len(sizeof(*ipv4h));
-  }
-
-  void PrepareL4Header(dpdk::Packet* packet) const {
-    auto* udph = packet->head_data<Udp*>(sizeof(Ethernet) + sizeof(Ipv4));
-    udph->src_port = key_.local_port;
-    udph->dst_port = key_.remote_port;
-    udph->len = be16_t(packet->length() - sizeof(Ethernet) - sizeof(Ipv4));
-    udph->cksum = be16_t(0);
+  /**
+   * @brief Fills `hdr_template_' with the headers of the flow's packets, as
+   * far as they are the same for every packet: addresses, ports of the flow
+   * key, and the constant IPv4 fields. The Machnet header is that of a data
+   * packet, but for its per-packet fields (see `PrepareDataHdr').
+   */
+  void BuildHeaderTemplate() {
+    auto* hdrs = &hdr_template_;
+    std::memset(hdrs, 0, sizeof(*hdrs));
+    hdrs->eh.src_addr = local_l2_addr_;
+    hdrs->eh.dst_addr = remote_l2_addr_;
+    hdrs->eh.eth_type = be16_t(Ethernet::kIpv4);
+
+    hdrs->ipv4h.version_ihl = 0x45;
+    // ECN-capable transport, if the congestion control reacts to CE marks.
+    hdrs->ipv4h.type_of_service =
+        (dscp_ << 2) | (cc_.UsesEcn() ? Ipv4::kEct0 : Ipv4::kNotEct);
+    hdrs->ipv4h.packet_id = be16_t(0x1513);
+    hdrs->ipv4h.time_to_live = Ipv4::kDefaultTTL;
+    hdrs->ipv4h.next_proto_id = Ipv4::Proto::kUdp;
+    hdrs->ipv4h.src_addr = key_.local_addr;
+    hdrs->ipv4h.dst_addr = key_.remote_addr;
+
+    hdrs->udph.src_port = key_.local_port;
+    hdrs->udph.dst_port = key_.remote_port;
+
+    hdrs->machneth.magic = be16_t(MachnetPktHdr::kMagic);
+    hdrs->machneth.net_flags = MachnetPktHdr::MachnetFlags::kData;
+    hdrs->machneth.ackno = be32_t(UINT32_MAX);
+
+    // Control packets without options are all of the same size.
+    std::memcpy(&ctrl_template_, hdrs, sizeof(ctrl_template_));
+    const uint16_t ipv4_len = kControlPacketSize - sizeof(Ethernet);
+    ctrl_template_.ipv4h.total_length = be16_t(ipv4_len);
+    ctrl_template_.udph.len = be16_t(ipv4_len - sizeof(Ipv4));
+    ctrl_template_.machneth.net_flags = MachnetPktHdr::MachnetFlags::kAck;
+  }
+
+  /**
+   * @brief Writes the headers of a packet of the flow from `hdr_template_',
+   * and patches the lengths (from the packet length) and the UDP ports of the
+   * path. The Machnet header is left for the caller to complete.
+   *
+   * Path 0 is the one of the flow key; see `SetMultipath' for the others.
+   * @return The Machnet header of the packet.
+   */
+  MachnetPktHdr* PrepareHeaders(dpdk::Packet* packet, size_t path = 0) const {
+    auto* hdrs = packet->head_data<PacketHeaders*>();
+    std::memcpy(hdrs, &hdr_template_, sizeof(*hdrs));
+    const uint16_t ipv4_len = packet->length() - sizeof(Ethernet);
+    hdrs->ipv4h.total_length = be16_t(ipv4_len);
+    hdrs->udph.len = be16_t(ipv4_len - sizeof(Ipv4));
+    if (path != 0 && path_ports_local_) [[unlikely]] {
+      hdrs->udph.src_port = path_ports_[path - 1];
+    } else if (path != 0) [[unlikely]] {
+      hdrs->udph.dst_port = path_ports_[path - 1];
+    }
+    packet->set_l2_len(sizeof(Ethernet));
+    packet->set_l3_len(sizeof(Ipv4));
     packet->offload_udpv4_csum();
+    return &hdrs->machneth;
   }
 
-  void PrepareMachnetHdr(dpdk::Packet* packet, uint32_t seqno,
+  // Completes the Machnet header of a control packet (see `PrepareHeaders').
+  void PrepareMachnetHdr(MachnetPktHdr* machneth, uint32_t seqno,
                          const MachnetPktHdr::MachnetFlags& net_flags,
                          uint8_t msg_flags = 0) const {
-    auto* machneth = packet->head_data<MachnetPktHdr*>(
-        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
-    machneth->magic = be16_t(MachnetPktHdr::kMagic);
     machneth->net_flags = net_flags;
     machneth->msg_flags = msg_flags;
     machneth->seqno = be32_t(seqno);
     machneth->ackno = be32_t(pcb_.ackno());
 
+    // The slice of the SACK bitmap most useful to the sender.
+    const auto sack_offset = pcb_.sack_offset();
     for (size_t i = 0; i < sizeof(MachnetPktHdr::sack_bitmap) /
                                sizeof(MachnetPktHdr::sack_bitmap[0]);
          ++i) {
-      machneth->sack_bitmap[i] = be64_t(pcb_.sack_bitmap[i]);
+      machneth->sack_bitmap[i] =
+          be64_t(pcb_.sack_bitmap_word(sack_offset + i * 64));
+    }
+    machneth->sack_offset = be16_t(sack_offset);
+    machneth->ecn_ce_nr = be16_t(std::min<uint32_t>(rx_ce_nr_, UINT16_MAX));
+    machneth->rcv_wnd = be16_t(rx_tracking_.GetWindow(&pcb_));
+
+    // Echo the timestamp of the last data packet received, so that the peer
+    // can measure the RTT.
+    machneth->timestamp1 = rx_echo_timestamp_;
+    if (rx_echo_timestamp_.raw_value() != 0) {
+      const auto delay = time::cycles_to_ns(time::rdtsc() - rx_echo_tsc_);
+      machneth->remote_delay = be32_t(ClampDelayNs(delay));
+      machneth->remote_queuing = be32_t(ClampDelayNs(rx_echo_queuing_ns_));
+    } else {
+      machneth->remote_delay = be32_t(0);
+      machneth->remote_queuing = be32_t(0);
     }
-    machneth->sack_bitmap_count = be16_t(pcb_.sack_bitmap_count);
+  }
 
-    machneth->timestamp1 = be64_t(0);
+  static uint32_t ClampDelayNs(uint64_t delay_ns) {
+    return std::min<uint64_t>(delay_ns, UINT32_MAX);
   }
 
   void SendControlPacket(uint32_t seqno,
-                         const MachnetPktHdr::MachnetFlags& flags) const {
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-    dpdk::Packet::Reset(packet);
-
-    const size_t kControlPacketSize =
-        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr);
+                         const MachnetPktHdr::MachnetFlags& flags,
+                         const MachnetSynOptions* options = nullptr,
+                         uint32_t payload_len = 0) const {
+    // Packets come reset from the TX batch's cache, allocated in bulk.
+    auto* packet = CHECK_NOTNULL(txbatch_->PacketAlloc());
     CHECK_NOTNULL(packet->append(kControlPacketSize));
-    PrepareL2Header(packet);
-    PrepareL3Header(packet);
-    PrepareL4Header(packet);
-    PrepareMachnetHdr(packet, seqno, flags);
+    MachnetPktHdr* machneth;
+    if (options != nullptr) {
+      // The options, padded with zeros to `payload_len' bytes.
+      payload_len = std::max<uint32_t>(payload_len, sizeof(*options));
+      auto* payload = CHECK_NOTNULL(packet->append<uint8_t*>(payload_len));
+      std::memset(payload, 0, payload_len);
+      std::memcpy(payload, options, sizeof(*options));
+      machneth = PrepareHeaders(packet);
+    } else {
+      // ACKs and the like: the headers are prebuilt up to the fields of the
+      // Machnet header that `PrepareMachnetHdr' fills in.
+      auto* hdrs = packet->head_data<PacketHeaders*>();
+      std::memcpy(hdrs, &ctrl_template_, sizeof(*hdrs));
+      packet->set_l2_len(sizeof(Ethernet));
+      packet->set_l3_len(sizeof(Ipv4));
+      packet->offload_udpv4_csum();
+      machneth = &hdrs->machneth;
+    }
+    PrepareMachnetHdr(machneth, seqno, flags);
 
     // Send the packet.
-    txring_->SendPackets(&packet, 1);
+    txbatch_->Append(packet);
+  }
+
+  MachnetSynOptions GetSynOptions() const {
+    MachnetSynOptions options{.window = be32_t(rcv_window_),
+                              .mss = be16_t(syn_mss_),
+                              .paths_nr = 1,
+                              .path_ports = {}};
+    if (path_ports_local_) {
+      // Initiating end: the paths offered.
+      options.paths_nr = 1 + path_ports_.size();
+      for (size_t i = 0; i < path_ports_.size(); i++) {
+        options.path_ports[i] = path_ports_[i].port;
+      }
+    } else {
+      options.paths_nr = paths_nr_;
+    }
+    if (encrypt_) {
+      options.crypto = 1;
+      std::memcpy(options.crypto_nonce, crypto_nonce_.data(),
+                  sizeof(options.crypto_nonce));
+    }
+    // Flows always split aggregated packets (see `SetAggregation').
+    options.aggregation = 1;
+    return options;
+  }
+
+  // SYN and SYN-ACK packets are padded to a full `syn_mss_' payload (and the
+  // room encryption takes) when it is above the default, so that the
+  // handshake completes with that MSS only if the path carries packets that
+  // large (see `HandshakeRetransmit').
+  uint32_t GetSynPayloadLen() const {
+    return syn_mss_ > GetDefaultMss() ? syn_mss_ + GetCryptoOverhead() : 0;
   }
 
   void SendSyn(uint32_t seqno) const {
-    SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn);
+    const auto options = GetSynOptions();
+    SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn, &options,
+                      GetSynPayloadLen());
   }
 
   void SendSynAck(uint32_t seqno) const {
-    SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn |
-                                 MachnetPktHdr::MachnetFlags::kAck);
+    const auto options = GetSynOptions();
+    SendControlPacket(seqno,
+                      MachnetPktHdr::MachnetFlags::kSyn |
+                          MachnetPktHdr::MachnetFlags::kAck,
+                      &options, GetSynPayloadLen());
+  }
+
+  /**
+   * @brief Applies the options the peer sent in its SYN or SYN-ACK, if any:
+   * the flow may have up to the smaller of both windows in flight, and sends
+   * packets of up to the smaller of both MSS. Since the packet arrived, the
+   * path carries packets as large as the MSS of the peer.
+   *
+   * @return False if the flow encrypts and the peer does not, or the keys
+   * cannot be set up (see `ProcessCryptoOptions'); nothing is applied then,
+   * and the flow must be aborted.
+   */
+  bool ProcessSynOptions(const dpdk::Packet* packet) {
+    const size_t offset = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) +
+                          sizeof(MachnetPktHdr);
+    uint32_t window = kDefaultWindow;
+    uint32_t mss = GetDefaultMss();
+    const MachnetSynOptions* options = nullptr;
+    // Options of older peers end before the encryption fields.
+    if (packet->length() >= offset + offsetof(MachnetSynOptions, crypto)) {
+      options = packet->head_data<MachnetSynOptions*>(offset);
+      window = std::bit_floor(std::clamp(options->window.value(),
+                                         kDefaultWindow, kMaxWindow));
+      mss = options->mss.value();
+    }
+    const bool has_crypto =
+        packet->length() >= offset + offsetof(MachnetSynOptions, aggregation);
+    if (!ProcessCryptoOptions(has_crypto ? options : nullptr)) return false;
+    ProcessPathOptions(options);
+    peer_splits_ = packet->length() >= offset + sizeof(MachnetSynOptions) &&
+                   options->aggregation != 0;
+    tx_tracking_.SetAggregation(peer_splits_ ? agg_max_msg_len_ : 0);
+    window = std::min(window, rcv_window_);
+    // With early data in flight, the scoreboard keeps the capacity of the
+    // local window, which is no smaller (see `InitiateHandshake').
+    if (tx_tracking_.scoreboard()->empty()) {
+      tx_tracking_.scoreboard()->Resize(window);
+    }
+    cc_.SetMaxWindow(window);
+    pcb_.snd_wnd = window;
+    syn_mss_ = std::clamp(mss, 1u, syn_mss_);
+    tx_tracking_.SetMss(syn_mss_);
+    return true;
+  }
+
+  /**
+   * @brief Derives the keys of an encrypted flow (see `SetEncryption') from
+   * the nonces of both ends, on the SYN of the peer or its SYN-ACK;
+   * retransmitted SYNs change nothing.
+   * @return False if the flow encrypts and the peer does not, or the keys
+   * cannot be set up.
+   */
+  bool ProcessCryptoOptions(const MachnetSynOptions* options) {
+    if (!encrypt_) return true;
+    if (state_ != State::kClosed && state_ != State::kSynSent) return true;
+    if (options == nullptr || options->crypto == 0 || crypto_ == nullptr) {
+      VLOG(1) << "Flow " << key_.ToString() << ": the peer does not encrypt.";
+      return false;
+    }
+    const bool initiator = state_ == State::kSynSent;
+    const uint8_t* initiator_nonce =
+        initiator ? crypto_nonce_.data() : options->crypto_nonce;
+    const uint8_t* responder_nonce =
+        initiator ? options->crypto_nonce : crypto_nonce_.data();
+    // Direction 0 goes from the initiator to the responder.
+    uint8_t keys[2][dpdk::CryptoEngine::kMaxKeyLen];
+    bool ok = crypto_->DeriveKey(initiator_nonce, responder_nonce, 0,
+                                 keys[0]) &&
+              crypto_->DeriveKey(initiator_nonce, responder_nonce, 1,
+                                 keys[1]);
+    if (ok) {
+      const auto key_len = crypto_->GetKeyLen();
+      tx_key_.Set(keys[initiator ? 0 : 1], key_len, true);
+      rx_key_.Set(keys[initiator ? 1 : 0], key_len, false);
+      ok = tx_key_.Bind(crypto_) && rx_key_.Bind(crypto_);
+    }
+    explicit_bzero(keys, sizeof(keys));
+    if (!ok) {
+      LOG(ERROR) << "Flow " << key_.ToString()
+                 << ": failed to set up its keys.";
+    }
+    return ok;
+  }
+
+  /**
+   * @brief Applies the multipath options of a SYN or SYN-ACK (see
+   * `SetMultipath'), or their absence: on a SYN, takes up to `max_paths_nr_'
+   * of the paths offered; on a SYN-ACK, uses as many of the paths offered as
+   * the peer took. Retransmitted SYNs change nothing.
+   */
+  void ProcessPathOptions(const MachnetSynOptions* options) {
+    const size_t offered_nr =
+        options == nullptr ? 1 : std::clamp<size_t>(options->paths_nr, 1,
+                                                    kMaxPaths);
+    if (state_ == State::kClosed) {
+      DCHECK(path_ports_.empty());
+      paths_nr_ = std::min(offered_nr, max_paths_nr_);
+      for (size_t i = 1; i < paths_nr_; i++) {
+        path_ports_.emplace_back(options->path_ports[i - 1].value());
+      }
+    } else if (state_ == State::kSynSent) {
+      paths_nr_ = std::min(offered_nr, 1 + path_ports_.size());
+    }
+  }
+
+  /**
+   * @brief Picks the path of the next data packet the flow sends at `now' (see
+   * `SetMultipath').
+   */
+  void SelectPath(uint64_t now) {
+    if (paths_nr_ == 1) [[likely]]
+      return;
+    if (now - tx_path_tsc_ >= flowlet_gap_cycles_) {
+      tx_path_ = tx_path_ + 1 == paths_nr_ ? 0 : tx_path_ + 1;
+    }
+    tx_path_tsc_ = now;
+  }
+
+  /**
+   * @brief Retransmits the SYN or SYN-ACK of the flow after a timeout. The
+   * packet may have been lost for being too large for the path, so the flow
+   * falls back to the default MSS.
+   */
+  void HandshakeRetransmit() {
+    syn_mss_ = std::min(syn_mss_, GetDefaultMss());
+    tx_tracking_.SetMss(syn_mss_);
+    if (state_ == State::kSynReceived) {
+      SendSynAck(pcb_.snd_una);
+    } else {
+      Trace(trace::Event::kSynRetransmit, pcb_.snd_una, pcb_.rto_rexmits);
+      VLOG(1) << "RTO retransmitting SYN packet " << pcb_.snd_una;
+      SendSyn(pcb_.snd_una);
+    }
   }
 
-  void SendAck() const {
+  void SendAck() {
     SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kAck);
+    rcv_wnd_advertised_ = rx_tracking_.GetWindow(&pcb_);
+    // A window this small may stall the peer until it reopens, which only a
+    // window update tells (see `WindowUpdateDue'). A larger one leaves the
+    // peer room to send, and get ACKs with the window in turn.
+    rcv_wnd_reduced_ = rcv_wnd_advertised_ < WindowUpdateThreshold();
+    rx_ce_nr_ = 0;
+    pending_acks_ = 0;
+    ack_deadline_ = 0;
   }
 
   void SendRst() const {
     SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kRst);
   }
 
+  // Gives up on the flow: resets the peer, and expires the timer right away,
+  // so that the engine removes the flow.
+  void Abort(uint64_t now) {
+    SendRst();
+    SetState(State::kClosed);
+    RtoDisable();
+    ArmRtoTimer(now);
+  }
+
   /**
    * @brief This helper method prepares a network packet that carries the data
    * of a particular `MachnetMsgBuf_t'.
@@ -699,16 +2447,21 @@ class Flow {
    * @param buf Pointer to the message buffer to be sent.
    * @param packet Pointer to an allocated packet.
    * @param seqno Sequence number of the packet.
+   * @param tx_tsc TSC timestamp of the transmission.
    */
   template <CopyMode copy_mode>
   void PrepareDataPacket(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
-                         uint32_t seqno) const {
+                         uint32_t seqno, uint64_t tx_tsc) {
     DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
+    if (encrypt_) {
+      PrepareEncryptedPacket(msg_buf, packet, seqno, tx_tsc);
+      return;
+    }
     // Header length after before the payload.
     const size_t hdr_length =
         (sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr));
     const uint32_t pkt_len = hdr_length + msg_buf->length();
-    CHECK_LE(pkt_len - sizeof(Ethernet), dpdk::PmdRing::kDefaultFrameSize);
+    CHECK_LE(pkt_len - sizeof(Ethernet), mtu_);
 
     if constexpr (copy_mode == CopyMode::kMemCopy) {
       // In this mode we memory copy the packet payload.
@@ -724,7 +2477,12 @@ class Flow {
       CHECK_NOTNULL(packet->append(pkt_len));
     } else {
       // In this mode we zero-copy the packet payload, by attaching the message
-      // buffer.
+      // buffer. The payload buffers of aliases are shared by several flows,
+      // which cannot all prepend their headers to them: those are copied.
+      if (msg_buf->is_alias()) [[unlikely]] {
+        PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet, seqno, tx_tsc);
+        return;
+      }
 
       // Move the message buffer into the packet.
       auto* buf_va = msg_buf->base();
@@ -734,79 +2492,376 @@ class Flow {
       const auto buf_data_len = msg_buf->length();
 
       packet->attach_extbuf(buf_va, buf_iova, buf_len, buf_data_ofs,
-                            buf_data_len, channel_->GetMbufExtShinfo());
+                            buf_data_len, channel_->MsgBufExtAttach(msg_buf));
       CHECK_NOTNULL(packet->prepend(hdr_length));
     }
 
-    // Prepare network headers.
-    PrepareL2Header(packet);
-    PrepareL3Header(packet);
-    PrepareL4Header(packet);
+    // Prepare the headers.
+    auto* machneth = PrepareHeaders(packet, tx_path_);
+    PrepareDataHdr(machneth, msg_buf, seqno, tx_tsc);
 
-    // Prepare the Machnet-specific header.
-    auto* machneth = packet->head_data<MachnetPktHdr*>(
-        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
-    machneth->magic = be16_t(MachnetPktHdr::kMagic);
-    machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
-    machneth->ackno = be32_t(UINT32_MAX);
-    machneth->msg_flags = msg_buf->flags();
-    DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
+    if constexpr (copy_mode == CopyMode::kMemCopy) {
+      // Copy the payload.
+      CopyPayload(packet, hdr_length, msg_buf);
+    }
+  }
 
-    // machneth->msg_id = be32_t(msg_id_);
-    machneth->seqno = be32_t(seqno);
-    machneth->timestamp1 = be64_t(0);
+  /**
+   * @brief Prepares an encrypted data packet (see `SetEncryption') that
+   * carries the data of a message buffer. Where the crypto device can read
+   * the buffer, it encrypts out of place, from a packet attached to the
+   * buffer; otherwise the payload is copied into the packet and encrypted
+   * there. The encryption completes by the time the TX batch is flushed.
+   * Without keys, the payload is zeroed: no plaintext leaves.
+   *
+   * @param buf Pointer to the message buffer to be sent.
+   * @param packet Pointer to an allocated packet.
+   * @param seqno Sequence number of the packet.
+   * @param tx_tsc TSC timestamp of the transmission.
+   */
+  void PrepareEncryptedPacket(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
+                              uint32_t seqno, uint64_t tx_tsc) {
+    constexpr size_t kAadOffset = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    // Headers, and the IV, before the payload.
+    constexpr size_t kHdrLen =
+        kAadOffset + sizeof(MachnetPktHdr) + dpdk::CryptoEngine::kIvLen;
+    const uint32_t len = msg_buf->length();
+    const uint32_t pkt_len = kHdrLen + len + dpdk::CryptoEngine::kTagLen;
+    CHECK_LE(pkt_len - sizeof(Ethernet), mtu_);
+
+    // See `PrepareDataPacket' on why the packet is reset.
+    dpdk::Packet::Reset(packet);
+    CHECK_NOTNULL(packet->append(pkt_len));
+    auto* machneth = PrepareHeaders(packet, tx_path_);
+    PrepareDataHdr(machneth, msg_buf, seqno, tx_tsc);
+    // Every packet, retransmissions included, takes an IV of its own.
+    const uint64_t iv = tx_iv_++;
+    std::memcpy(machneth + 1, &iv, sizeof(iv));
+
+    auto* session = tx_key_.session();
+    if (session == nullptr) [[unlikely]] {
+      std::memset(packet->head_data(kHdrLen), 0,
+                  len + dpdk::CryptoEngine::kTagLen);
+      return;
+    }
+    dpdk::Packet* src = nullptr;
+    if (!msg_buf->is_alias() && msg_buf->data_offset() >= kHdrLen &&
+        crypto_->SupportsOutOfPlace() &&
+        (crypto_->IsCpuDevice() || channel_->IsDMARegistered())) {
+      src = txbatch_->PacketAlloc();
+    }
+    if (src != nullptr) {
+      // The payload at the same offset as in `packet'; the headers in front
+      // of it are not read.
+      src->attach_extbuf(msg_buf->base(), msg_buf->iova(), msg_buf->size(),
+                         msg_buf->data_offset() - kHdrLen, kHdrLen + len,
+                         channel_->MsgBufExtAttach(msg_buf));
+    } else {
+      CopyPayload(packet, kHdrLen, msg_buf);
+    }
+    crypto_->EncryptAsync(session, packet, src, kAadOffset, len, iv);
+  }
+
+  /**
+   * @brief This helper method prepares a non-head segment of a UDP-segmented
+   * packet (see `TransmitSegmentedPackets'), which carries the data of a
+   * particular `MachnetMsgBuf_t'. The segment holds only the Machnet header
+   * and the payload; the NIC replicates the L2-L4 headers of the head segment.
+   *
+   * @tparam copy_mode Copy mode of the packet. Either kMemCopy or kZeroCopy.
+   * @param buf Pointer to the message buffer to be sent.
+   * @param packet Pointer to an allocated packet.
+   * @param seqno Sequence number of the segment.
+   * @param tx_tsc TSC timestamp of the transmission.
+   */
+  template <CopyMode copy_mode>
+  void PrepareDataSegment(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
+                          uint32_t seqno, uint64_t tx_tsc) const {
+    const uint32_t seg_len = sizeof(MachnetPktHdr) + msg_buf->length();
+    if constexpr (copy_mode == CopyMode::kMemCopy) {
+      // See `PrepareDataPacket' on why the packet is reset.
+      dpdk::Packet::Reset(packet);
+      CHECK_NOTNULL(packet->append(seg_len));
+    } else {
+      // Aliases are copied; see `PrepareDataPacket'.
+      if (msg_buf->is_alias()) [[unlikely]] {
+        PrepareDataSegment<CopyMode::kMemCopy>(msg_buf, packet, seqno, tx_tsc);
+        return;
+      }
+      packet->attach_extbuf(msg_buf->base(), msg_buf->iova(), msg_buf->size(),
+                            msg_buf->data_offset(), msg_buf->length(),
+                            channel_->MsgBufExtAttach(msg_buf));
+      CHECK_NOTNULL(packet->prepend(sizeof(MachnetPktHdr)));
+    }
+
+    auto* machneth = packet->head_data<MachnetPktHdr*>();
+    std::memcpy(machneth, &hdr_template_.machneth, sizeof(*machneth));
+    PrepareDataHdr(machneth, msg_buf, seqno, tx_tsc);
 
     if constexpr (copy_mode == CopyMode::kMemCopy) {
-      // Copy the payload.
-      auto* payload = reinterpret_cast<uint8_t*>(machneth + 1);
+      CopyPayload(packet, sizeof(MachnetPktHdr), msg_buf);
+    }
+  }
+
+  // Copies the payload of a message buffer (or of the payload buffer of an
+  // alias) into a packet, at `offset'. With a copy engine on the TX batch,
+  // large copies may complete asynchronously, by the time the batch is
+  // flushed.
+  void CopyPayload(dpdk::Packet* packet, uint16_t offset,
+                   const shm::MsgBuf* msg_buf) const {
+    msg_buf = channel_->GetPayloadMsgBuf(msg_buf);
+    auto* payload = packet->head_data<uint8_t*>(offset);
+    auto* copy_engine = txbatch_->GetCopyEngine();
+    if (copy_engine == nullptr) {
       utils::Copy(payload, msg_buf->head_data(), msg_buf->length());
+      return;
+    }
+    copy_engine->CopyAsync(payload, packet->head_iova(offset),
+                           msg_buf->head_data(),
+                           msg_buf->iova() + msg_buf->data_offset(),
+                           msg_buf->length());
+  }
+
+  // Patches the per-packet fields of the Machnet header of a data packet,
+  // copied from `hdr_template_'.
+  void PrepareDataHdr(MachnetPktHdr* machneth, const shm::MsgBuf* msg_buf,
+                      uint32_t seqno, uint64_t tx_tsc) const {
+    machneth->msg_flags = msg_buf->flags() & ~MACHNET_MSGBUF_FLAGS_ALIAS;
+    DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
+    machneth->seqno = be32_t(seqno);
+    machneth->timestamp1 = be64_t(tx_tsc);
+  }
+
+  // UDP payload length of each packet the NIC cuts a segmented packet into: a
+  // Machnet header followed by a full message buffer.
+  uint16_t GetUsoSegmentSize() const {
+    return sizeof(MachnetPktHdr) + tx_tracking_.GetMss();
+  }
+
+  // Largest packet payload the flow can take: a channel buffer, within the
+  // MTU of the port, less the room encryption takes.
+  uint32_t GetLocalMss() const {
+    return std::min<uint32_t>(channel_->GetUsableBufSize(),
+                              mtu_ - sizeof(Ipv4) - sizeof(Udp) -
+                                  sizeof(MachnetPktHdr) - GetCryptoOverhead());
+  }
+  // Payload of the packets of the flow with the default MTU.
+  uint32_t GetDefaultMss() const { return kDefaultMss - GetCryptoOverhead(); }
+  // Bytes that encryption adds to data packets (see `SetEncryption').
+  uint32_t GetCryptoOverhead() const {
+    return encrypt_ ? dpdk::CryptoEngine::kOverhead : 0;
+  }
+
+  /**
+   * @brief Prepares a packet that retransmits the data of a message buffer the
+   * flow still tracks. If the NIC can read channel memory, the buffer is
+   * attached to the packet again rather than copied.
+   *
+   * The headers written in front of the payload are the same on every
+   * (re)transmission of a buffer, so rewriting them while the NIC may still
+   * read an earlier packet attached to it is harmless.
+   *
+   * @param msg_buf Pointer to the message buffer to be retransmitted.
+   * @param packet Pointer to an allocated packet.
+   * @param seqno Sequence number of the packet.
+   * @param tx_tsc TSC timestamp of the transmission.
+   */
+  void PrepareRetransmitPacket(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
+                               uint32_t seqno, uint64_t tx_tsc) {
+    if (tx_extbuf_ && channel_->IsDMARegistered()) {
+      PrepareDataPacket<CopyMode::kZeroCopy>(msg_buf, packet, seqno, tx_tsc);
+    } else {
+      PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet, seqno, tx_tsc);
+    }
+  }
+
+  /**
+   * @brief Retransmits up to `max_nr' of the packets the scoreboard deems lost,
+   * oldest first.
+   * @return The number of packets retransmitted.
+   */
+  uint32_t RetransmitLost(uint32_t max_nr) {
+    auto* scoreboard = tx_tracking_.scoreboard();
+    uint32_t sent_nr = 0;
+    while (sent_nr < max_nr && scoreboard->lost_nr() != 0) {
+      const auto tx_tsc = time::rdtsc();
+      const auto seqno = scoreboard->RetransmitLost(tx_tsc).value();
+      auto* packet = CHECK_NOTNULL(txbatch_->GetPacketPool()->PacketAlloc());
+      SelectPath(tx_tsc);
+      PrepareRetransmitPacket(tx_tracking_.GetSentMsgBuf(seqno), packet, seqno,
+                              tx_tsc);
+      txbatch_->Append(packet);
+      VLOG(1) << "Retransmitting lost packet " << seqno;
+      sent_nr++;
+    }
+    channel_->GetEngineStats()->tx_retransmits += sent_nr;
+    return sent_nr;
+  }
+
+  /**
+   * @brief RACK loss detection (RFC 8985): marks lost the packets sent before
+   * one that has since been delivered, once they are overdue by a quarter of
+   * the minimum RTT (half the smoothed RTT with multipath, whose paths reorder
+   * packets), and arms the timer for the next such deadline. The first
+   * loss of a window starts a recovery episode, which reduces the window once.
+   */
+  void DetectLosses(uint64_t now) {
+    // Until there is an RTT sample, the RTO covers losses.
+    if (pcb_.latest_rtt_ns == 0) return;
+    auto* scoreboard = tx_tracking_.scoreboard();
+    const auto lost_nr = scoreboard->lost_nr();
+    // Paths of different delays reorder packets more (see `SetMultipath').
+    const auto reo_wnd_ns = paths_nr_ == 1
+                                ? std::min(pcb_.min_rtt_ns / 4, pcb_.srtt_ns)
+                                : pcb_.srtt_ns / 2;
+    reo_deadline_ =
+        scoreboard->DetectLosses(now, time::ns_to_cycles(pcb_.latest_rtt_ns),
+                                 time::ns_to_cycles(reo_wnd_ns));
+    if (scoreboard->lost_nr() > lost_nr && !in_recovery_) {
+      in_recovery_ = true;
+      recovery_end_ = pcb_.snd_nxt;
+      pcb_.fast_rexmits++;
+      Trace(trace::Event::kFastRetransmit, pcb_.snd_una,
+            scoreboard->lost_nr() - lost_nr);
+      cc_.OnFastRetransmit(time::cycles_to_ns(now));
     }
+    UpdateTimer();
   }
 
-  void FastRetransmit() {
-    // Retransmit the oldest unacknowledged message buffer.
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-    PrepareDataPacket<CopyMode::kMemCopy>(tx_tracking_.GetOldestUnackedMsgBuf(),
-                                          packet, pcb_.snd_una);
-    txring_->SendPackets(&packet, 1);
-    pcb_.rto_reset();
-    pcb_.fast_rexmits++;
-    LOG(INFO) << "Fast retransmitting packet " << pcb_.snd_una;
+  /**
+   * @brief Tail loss probe: retransmits the packet sent last, so that the ACK
+   * it triggers reveals losses at the tail of a window (which no later packet
+   * would) without waiting for the RTO.
+   * @return False if there is no packet in flight to probe with.
+   */
+  bool SendProbe() {
+    const auto tx_tsc = time::rdtsc();
+    const auto seqno = tx_tracking_.scoreboard()->RetransmitNewest(tx_tsc);
+    if (!seqno.has_value()) return false;
+    auto* packet = CHECK_NOTNULL(txbatch_->GetPacketPool()->PacketAlloc());
+    SelectPath(tx_tsc);
+    PrepareRetransmitPacket(tx_tracking_.GetSentMsgBuf(*seqno), packet, *seqno,
+                            tx_tsc);
+    txbatch_->Append(packet);
+    VLOG(1) << "Tail loss probe " << *seqno;
+    channel_->GetEngineStats()->tx_retransmits++;
+    return true;
   }
 
   void RTORetransmit() {
     if (state_ == State::kEstablished) {
-      LOG(INFO) << "RTO retransmitting data packet " << pcb_.snd_una;
-      auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-      PrepareDataPacket<CopyMode::kMemCopy>(
-          tx_tracking_.GetOldestUnackedMsgBuf(), packet, pcb_.snd_una);
-      txring_->SendPackets(&packet, 1);
-    } else if (state_ == State::kSynReceived) {
-      SendSynAck(pcb_.snd_una);
-    } else if (state_ == State::kSynSent) {
-      LOG(INFO) << "RTO retransmitting SYN packet " << pcb_.snd_una;
-      // Retransmit the SYN packet.
-      SendSyn(pcb_.snd_una);
+      Trace(trace::Event::kRtoRetransmit, pcb_.snd_una, pcb_.rto_rexmits);
+      VLOG(1) << "RTO retransmitting data packet " << pcb_.snd_una;
+      // Everything in flight is presumed lost; retransmit the oldest now, and
+      // the rest as the window allows.
+      tx_tracking_.scoreboard()->MarkAllLost();
+      RetransmitLost(1);
+      in_recovery_ = true;
+      recovery_end_ = pcb_.snd_nxt;
+      reo_deadline_ = 0;
+      cc_.OnRetransmitTimeout(time::cycles_to_ns(time::rdtsc()));
+    } else if (state_ == State::kSynReceived || state_ == State::kSynSent) {
+      HandshakeRetransmit();
     }
-    pcb_.rto_reset();
+    // Exponential backoff, until an ACK brings a new RTT sample.
+    pcb_.rto_backoff();
+    RtoReset();
     pcb_.rto_rexmits++;
   }
 
+  /**
+   * @brief Of `packets_nr' packets the window allows to send, returns how many
+   * pacing allows to send now (see `SetPacer'), and schedules the flow on the
+   * pacer for the rest.
+   */
+  uint32_t PacePackets(uint32_t packets_nr, uint64_t now) {
+    uint64_t gap_ns = cc_.GetPacingDelayNs();
+    uint64_t burst_nr = 1;
+    if (gap_ns == 0) [[likely]] {
+      if (!pace_window_) return packets_nr;
+      gap_ns = cc_.GetPacingIntervalNs() * 100 / kPacingGainPercent;
+      if (gap_ns == 0) return packets_nr;
+      burst_nr = kPacingBurstNr;
+    }
+    // Already waiting for the pacer to release the flow.
+    if (pacer_scheduled_) return 0;
+
+    const auto gap = std::max<uint64_t>(time::ns_to_cycles(gap_ns), 1);
+    // While idle, the flow accrues the right to send at most a burst.
+    const auto deadline =
+        std::max(tx_deadline_, now - std::min(now, (burst_nr - 1) * gap));
+    uint32_t sendable_nr = 0;
+    if (deadline <= now) {
+      sendable_nr = std::min<uint64_t>(packets_nr, (now - deadline) / gap + 1);
+    }
+    tx_deadline_ = deadline + sendable_nr * gap;
+    if (sendable_nr < packets_nr) {
+      pacer_->Schedule(this, tx_deadline_, prio_);
+      pacer_scheduled_ = true;
+    }
+    return sendable_nr;
+  }
+
   /**
    * @brief Helper function to transmit a number of packets from the queue of
-   * pending TX data.
+   * pending TX data, as the congestion window and pacing allow.
+   *
+   * If the window is below one packet, at most one packet is in flight, and
+   * packets are sent at least the pacing delay of the congestion control
+   * apart. Packets that pacing holds back are sent when the pacer releases
+   * the flow (see `PacerRelease').
    */
   void TransmitPackets() {
+    const auto* scoreboard = tx_tracking_.scoreboard();
+    const bool was_idle = !pcb_.rto_needed();
+    auto window = pcb_.congestion_wnd(
+        cc_.GetWindow(), scoreboard->sacked_nr() + scoreboard->lost_nr());
+    // Lost packets go first, unpaced. They are within the receive window of
+    // the peer already.
+    if (scoreboard->lost_nr() != 0) [[unlikely]] {
+      const auto retransmitted_nr = RetransmitLost(window);
+      if (retransmitted_nr != 0) RtoReset();
+      window -= retransmitted_nr;
+    }
     auto remaining_packets =
-        std::min(pcb_.effective_wnd(), tx_tracking_.NumUnsentMsgbufs());
-    if (remaining_packets == 0) return;
+        std::min({window, pcb_.receive_wnd(), NumSendableMsgbufs(),
+                  scoreboard->room()});
+    if (remaining_packets == 0) {
+      if (was_idle && pcb_.receive_wnd() == 0 &&
+          (RtoDisabled() || keepalive_armed_) &&
+          tx_tracking_.NumUnsentMsgbufs() != 0) {
+        // The peer has no room: probe its window if no window update comes
+        // before the timer expires (see `WindowProbe').
+        RtoReset();
+      }
+      return;
+    }
+
+    const auto now = time::rdtsc();
+    if (pacer_ != nullptr) {
+      // Flows of lower classes yield after a quantum (see `SetPriority').
+      const bool yield = remaining_packets > kTxQuantum[prio_];
+      if (yield) remaining_packets = kTxQuantum[prio_];
+      remaining_packets = PacePackets(remaining_packets, now);
+      if (yield && !pacer_scheduled_) {
+        pacer_->Schedule(this, now, prio_);
+        pacer_scheduled_ = true;
+      }
+      if (remaining_packets == 0) return;
+    }
+
+    if (uso_max_segs_nr_ > 1) {
+      TransmitSegmentedPackets(remaining_packets, now);
+      if (RtoDisabled() || was_idle) RtoReset();
+      return;
+    }
 
     do {
       // Allocate a packet batch.
       dpdk::PacketBatch batch;
       auto pkt_cnt =
           std::min(remaining_packets, static_cast<uint32_t>(batch.GetRoom()));
-      if (!txring_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt)) {
+      if (!txbatch_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt)) {
         LOG(ERROR) << "Failed to allocate packet batch";
         return;
       }
@@ -817,127 +2872,572 @@ class Flow {
         if (!msg.has_value()) break;
         auto* msg_buf = msg.value();
         auto* packet = batch.pkts()[i];
+        const auto seqno = pcb_.get_snd_nxt();
+        SelectPath(now);
         if (kShmZeroCopyEnabled) {
-          PrepareDataPacket<CopyMode::kZeroCopy>(msg_buf, packet,
-                                                 pcb_.get_snd_nxt());
+          PrepareDataPacket<CopyMode::kZeroCopy>(msg_buf, packet, seqno, now);
         } else {
-          PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet,
-                                                pcb_.get_snd_nxt());
+          PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet, seqno, now);
         }
+        tx_tracking_.OnTransmit(seqno, msg_buf, now);
       }
 
       // TX.
-      txring_->SendPackets(&batch);
+      txbatch_->Append(&batch);
       remaining_packets -= pkt_cnt;
     } while (remaining_packets);
 
-    if (pcb_.rto_disabled()) pcb_.rto_enable();
+    if (RtoDisabled() || was_idle) RtoReset();
   }
 
-  void process_ack(const MachnetPktHdr* machneth) {
-    auto ackno = machneth->ackno.value();
-    if (swift::seqno_lt(ackno, pcb_.snd_una)) {
+  /**
+   * @brief Returns the number of message buffers not sent yet that may be:
+   * all of them, but for the last one while it is held for more small
+   * messages to join it (see `SetAggregation').
+   */
+  uint32_t NumSendableMsgbufs() const {
+    const auto unsent_nr = tx_tracking_.NumUnsentMsgbufs();
+    if (agg_deadline_ == 0 || tx_tracking_.GetOpenAggregate() == nullptr ||
+        tx_tracking_.scoreboard()->empty()) [[likely]] {
+      return unsent_nr;
+    }
+    return time::rdtsc() < agg_deadline_ ? unsent_nr - 1 : unsent_nr;
+  }
+
+  /**
+   * @brief Sends a window probe: a new packet past the closed receive window
+   * of the peer, as in TCP. Its ACK advertises the window again, in case a
+   * window update was lost; the peer drops the packet if it still has no
+   * room. Probes back off like retransmissions.
+   */
+  void WindowProbe() {
+    RtoDisable();
+    pcb_.rto_backoff();
+    if (pcb_.receive_wnd() == 0) pcb_.snd_wnd = pcb_.snd_nxt - pcb_.snd_una + 1;
+    TransmitPackets();
+  }
+
+  /**
+   * @brief Transmits a number of message buffers from the queue of pending TX
+   * data with UDP segmentation offload.
+   *
+   * Consecutive message buffers are chained into one large packet, one mbuf
+   * segment each. The head segment is what `PrepareDataPacket' would build;
+   * the others carry a Machnet header (with their own seqno) and the payload.
+   * Since all but the last segment hold a full message buffer, and the NIC cuts
+   * the UDP payload every `GetUsoSegmentSize()' bytes, each packet on the wire
+   * is the one the per-buffer path would have sent. A packet ends after a
+   * message buffer that is not full, or after `uso_max_segs_nr_' segments.
+   *
+   * @param msgbufs_nr Number of message buffers to send.
+   * @param tx_tsc TSC timestamp of the transmission.
+   */
+  void TransmitSegmentedPackets(uint32_t msgbufs_nr, uint64_t tx_tsc) {
+    constexpr auto kCopyMode =
+        kShmZeroCopyEnabled ? CopyMode::kZeroCopy : CopyMode::kMemCopy;
+    const auto kFullBufSize = tx_tracking_.GetMss();
+    dpdk::Packet* head = nullptr;
+
+    do {
+      // Allocate a packet batch; one packet per message buffer.
+      dpdk::PacketBatch batch;
+      auto pkt_cnt =
+          std::min(msgbufs_nr, static_cast<uint32_t>(batch.GetRoom()));
+      if (!txbatch_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt)) {
+        LOG(ERROR) << "Failed to allocate packet batch";
+        break;
+      }
+
+      for (uint16_t i = 0; i < batch.GetSize(); i++) {
+        auto* msg_buf = tx_tracking_.GetAndUpdateOldestUnsent().value();
+        auto* packet = batch.pkts()[i];
+        const auto seqno = pcb_.get_snd_nxt();
+        if (head == nullptr) {
+          SelectPath(tx_tsc);
+          PrepareDataPacket<kCopyMode>(msg_buf, packet, seqno, tx_tsc);
+          head = packet;
+        } else {
+          PrepareDataSegment<kCopyMode>(msg_buf, packet, seqno, tx_tsc);
+          CHECK(head->chain(packet));
+        }
+        tx_tracking_.OnTransmit(seqno, msg_buf, tx_tsc);
+
+        if (msg_buf->length() != kFullBufSize ||
+            head->segments_nr() == uso_max_segs_nr_) {
+          AppendSegmentedPacket(head);
+          head = nullptr;
+        }
+      }
+      msgbufs_nr -= pkt_cnt;
+    } while (msgbufs_nr);
+
+    if (head != nullptr) AppendSegmentedPacket(head);
+  }
+
+  /**
+   * @brief Fixes up the L3/L4 headers of a (possibly) segmented packet to
+   * cover all its segments, and stages it for transmission.
+   */
+  void AppendSegmentedPacket(dpdk::Packet* packet) {
+    if (packet->segments_nr() > 1) {
+      auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
+      ipv4h->total_length = be16_t(packet->length() - sizeof(Ethernet));
+      auto* udph = packet->head_data<Udp*>(sizeof(Ethernet) + sizeof(Ipv4));
+      udph->len = be16_t(packet->length() - sizeof(Ethernet) - sizeof(Ipv4));
+      packet->offload_udpv4_seg(sizeof(Udp), GetUsoSegmentSize());
+    }
+    txbatch_->Append(packet);
+  }
+
+  /**
+   * @brief Decrypts, in place, the data packets among `packets' (at most 64)
+   * of an encrypted flow (see `SetEncryption'), and strips their IV and tag,
+   * so that they look as if sent in the clear.
+   * @return Bitmap of the packets to process: bit `i' for `packets[i]'. Data
+   * packets that fail authentication, or arrive before the keys, are left
+   * out.
+   */
+  uint64_t DecryptPackets(dpdk::Packet* const* packets, uint16_t nb_packets) {
+    constexpr size_t kAadOffset = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    constexpr size_t kHdrLen = kAadOffset + sizeof(MachnetPktHdr);
+    dpdk::Packet* data[64];
+    uint16_t data_idx[64];
+    uint16_t data_nr = 0;
+    uint64_t valid = 0;
+    for (uint16_t i = 0; i < nb_packets; i++) {
+      const auto* machneth =
+          packets[i]->head_data<const MachnetPktHdr*>(kAadOffset);
+      if (machneth->net_flags != MachnetPktHdr::MachnetFlags::kData) {
+        valid |= 1ULL << i;
+        continue;
+      }
+      data_idx[data_nr] = i;
+      data[data_nr++] = packets[i];
+    }
+    auto* session = rx_key_.session();
+    if (data_nr == 0 || session == nullptr) return valid;
+
+    const uint64_t authentic =
+        crypto_->Decrypt(session, data, data_nr, kAadOffset);
+    for (uint16_t i = 0; i < data_nr; i++) {
+      if (!(authentic & (1ULL << i))) {
+        VLOG(1) << "Flow " << key_.ToString()
+                << ": dropping a packet that failed authentication.";
+        continue;
+      }
+      // Move the headers over the IV, and drop the tag.
+      auto* packet = data[i];
+      auto* hdrs = packet->head_data<uint8_t*>();
+      std::memmove(hdrs + dpdk::CryptoEngine::kIvLen, hdrs, kHdrLen);
+      packet->adj(dpdk::CryptoEngine::kIvLen);
+      packet->trim(dpdk::CryptoEngine::kTagLen);
+      valid |= 1ULL << data_idx[i];
+    }
+    return valid;
+  }
+
+  /**
+   * @brief Process one incoming packet (see `InputPacket'). ACKs for in-order
+   * data are not sent here, but accounted in `pending_acks_'.
+   */
+  void process_rx_packet(dpdk::Packet* packet, uint64_t now) {
+    // Parse the Machnet header of the packet.
+    const size_t net_hdr_len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
+
+    if (machneth->magic.value() != MachnetPktHdr::kMagic) {
+      Trace(trace::Event::kDropBadMagic, 0, machneth->magic.value());
+      VLOG(1) << "Invalid Machnet header magic: " << machneth->magic;
       return;
-    } else if (swift::seqno_eq(ackno, pcb_.snd_una)) {
-      // Duplicate ACK.
-      pcb_.duplicate_acks++;
-      // Update the number of out-of-order acknowledgements.
-      pcb_.snd_ooo_acks = machneth->sack_bitmap_count.value();
-
-      if (pcb_.duplicate_acks < swift::Pcb::kRexmitThreshold) {
-        // We have not reached the threshold yet, so we do not do anything.
-      } else if (pcb_.duplicate_acks == swift::Pcb::kRexmitThreshold) {
-        // Fast retransmit.
-        FastRetransmit();
-      } else {
-        // We have already done the fast retransmit, so we are now in the
-        // fast recovery phase. We need to send a new packet for every ACK we
-        // get.
-        auto sack_bitmap_count = machneth->sack_bitmap_count.value();
-        // First we check the SACK bitmap to see if there are more undelivered
-        // packets. In fast recovery mode we get after a fast retransmit, and
-        // for every new ACKnowledgement we get, we send a new packet.
-        // Up until we get the first new acknowledgement, for the next in-order
-        // packet, the SACK bitmap will likely keep expanding.
-        // In order to avoid retransmitting multiple times other missing packets
-        // in the bitmap, we skip holes: we use the number of duplicate ACKs to
-        // skip previous holes.
-        auto* msgbuf = tx_tracking_.GetOldestUnackedMsgBuf();
-        size_t holes_to_skip =
-            pcb_.duplicate_acks - swift::Pcb::kRexmitThreshold;
-        size_t index = 0;
-        while (sack_bitmap_count) {
-          constexpr size_t sack_bitmap_bucket_size =
-              sizeof(machneth->sack_bitmap[0]);
-          constexpr size_t sack_bitmap_max_bucket_idx =
-              sizeof(machneth->sack_bitmap) / sizeof(machneth->sack_bitmap[0]) -
-              1;
-          const size_t sack_bitmap_bucket_idx =
-              sack_bitmap_max_bucket_idx - index / sack_bitmap_bucket_size;
-          const size_t sack_bitmap_idx_in_bucket =
-              index % sack_bitmap_bucket_size;
-          auto sack_bitmap =
-              machneth->sack_bitmap[sack_bitmap_bucket_idx].value();
-          if ((sack_bitmap & (1ULL << sack_bitmap_idx_in_bucket)) == 0) {
-            // We found a missing packet.
-            // We skip holes in the SACK bitmap that have already been
-            // retransmitted.
-            if (holes_to_skip-- == 0) {
-              auto seqno = pcb_.snd_una + index;
-              auto* packet_pool = txring_->GetPacketPool();
-              auto* packet = CHECK_NOTNULL(packet_pool->PacketAlloc());
-              PrepareDataPacket<CopyMode::kMemCopy>(msgbuf, packet, seqno);
-              txring_->SendPackets(&packet, 1);
-              pcb_.rto_reset();
-              return;
-            }
+    }
+
+    // Arrival time of the packet; the engine converts NIC timestamps to TSC.
+    const auto rx_tsc = packet->has_rx_timestamp()
+                            ? std::min(packet->rx_timestamp(), now)
+                            : now;
+
+    switch (machneth->net_flags) {
+      case MachnetPktHdr::MachnetFlags::kSyn:
+        // SYN packet received. For this to be valid it has to be an already
+        // established flow with this SYN being a retransmission.
+        if (state_ != State::kSynReceived && state_ != State::kClosed) {
+          TraceBadState(machneth);
+          VLOG(1) << "SYN packet received for flow in state: "
+                  << static_cast<int>(state_);
+          return;
+        }
+
+        if (state_ == State::kClosed) {
+          // If the flow is in closed state, we need to send a SYN-ACK packetj
+          // and mark the flow as established.
+          pcb_.rcv_nxt = machneth->seqno.value();
+          pcb_.advance_rcv_nxt();
+          if (!ProcessSynOptions(packet)) {
+            Abort(now);
+            return;
+          }
+          SendSynAck(pcb_.get_snd_nxt());
+          SetState(State::kSynReceived);
+        } else if (state_ == State::kSynReceived) {
+          // If the flow is in SYN-RECEIVED state, our SYN-ACK packet was lost.
+          // We need to retransmit it, with the options of the new SYN: the
+          // peer may have fallen back to the default MSS.
+          ProcessSynOptions(packet);
+          SendSynAck(pcb_.snd_una);
+        }
+        break;
+      case MachnetPktHdr::MachnetFlags::kSynAck:
+        // SYN-ACK packet received. For this to be valid it has to be an already
+        // established flow with this SYN-ACK being a retransmission.
+        if (state_ != State::kSynSent && state_ != State::kEstablished) {
+          TraceBadState(machneth);
+          VLOG(1) << "SYN-ACK packet received for flow in state: "
+                  << static_cast<int>(state_);
+          return;
+        }
+
+        // The SYN-ACK acknowledges the SYN, and with early data (see
+        // `SetEarlyData') maybe some of the data sent after it.
+        if (swift::seqno_lt(machneth->ackno.value(),
+                            early_data_ ? pcb_.snd_una + 1 : pcb_.snd_nxt) ||
+            swift::seqno_gt(machneth->ackno.value(), pcb_.snd_nxt)) {
+          Trace(trace::Event::kDropBadAckno, pcb_.snd_una,
+                machneth->ackno.value());
+          VLOG(1) << "SYN-ACK packet received with invalid ackno: "
+                  << machneth->ackno << " snd_una: " << pcb_.snd_una
+                  << " snd_nxt: " << pcb_.snd_nxt;
+          return;
+        }
+
+        if (state_ == State::kSynSent) {
+          pcb_.snd_una++;
+          pcb_.rcv_nxt = machneth->seqno.value();
+          pcb_.advance_rcv_nxt();
+          if (!ProcessSynOptions(packet)) {
+            // Encryption rules out early data: the application waits.
+            callback_(channel(), false, key());
+            Abort(now);
+            return;
+          }
+          RtoMaybeReset();
+          // Mark the flow as established.
+          SetState(State::kEstablished);
+          if (early_data_) {
+            // The application knows already; account for the early data
+            // acknowledged, and send what the window held back.
+            const auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
+            process_ack(machneth, ipv4h->time_to_live, rx_tsc, now);
           } else {
-            sack_bitmap_count--;
+            // Notify the application that the flow is established.
+            callback_(channel(), true, key());
           }
-          index++;
-          msgbuf = channel_->GetMsgBuf(msgbuf->next());
         }
-        // There is no other missing segment to retransmit, so we could send new
-        // packets.
-      }
+        // Send an ACK packet.
+        SendAck();
+        break;
+      case MachnetPktHdr::MachnetFlags::kRst: {
+        const auto seqno = machneth->seqno.value();
+        const auto expected_seqno = pcb_.rcv_nxt;
+        if (swift::seqno_eq(seqno, expected_seqno)) {
+          // If the RST packet is in sequence, we can reset the flow.
+          SetState(State::kClosed);
+          // Expire the timer right away, so that the engine removes the flow.
+          RtoDisable();
+          ArmRtoTimer(now);
+        }
+      } break;
+      case MachnetPktHdr::MachnetFlags::kAck: {
+        // An ACK of early data that overtook the SYN-ACK; the SYN-ACK (or a
+        // later ACK) will tell the same.
+        if (state_ == State::kSynSent) return;
+        // ACK packet, update the flow.
+        const auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
+        process_ack(machneth, ipv4h->time_to_live, rx_tsc, now);
+      } break;
+      case MachnetPktHdr::MachnetFlags::kKeepAlive:
+        // The peer checks that the flow is alive (see `SetKeepAlive').
+        if (state_ == State::kEstablished || state_ == State::kSynReceived) {
+          SendAck();
+        }
+        break;
+      case MachnetPktHdr::MachnetFlags::kData:
+        if (state_ != State::kEstablished &&
+            !(state_ == State::kSynReceived && early_data_)) {
+          TraceBadState(machneth);
+          VLOG(1) << "Data packet received for flow in state: "
+                  << static_cast<int>(state_);
+          return;
+        }
+        // Data packet, process the payload.
+        {
+          const bool in_order =
+              swift::seqno_eq(machneth->seqno.value(), pcb_.rcv_nxt);
+          const bool had_holes = pcb_.sack_bitmap_count != 0;
+          // The next ACK echoes the timestamp and congestion mark of this
+          // packet.
+          const auto* ipv4h = packet->head_data<Ipv4*>(sizeof(Ethernet));
+          if ((ipv4h->type_of_service & Ipv4::kEcnMask) == Ipv4::kCe) {
+            rx_ce_nr_++;
+          }
+          rx_echo_timestamp_ = machneth->timestamp1;
+          rx_echo_tsc_ = rx_tsc;
+          rx_echo_queuing_ns_ = time::cycles_to_ns(now - rx_tsc);
+          const int consume_returncode = rx_tracking_.Consume(
+              &pcb_, packet, txbatch_->GetCopyEngine());
+          if (consume_returncode != 0) {
+            // Out of buffers: tell the sender what room is left.
+            SendAck();
+            break;
+          }
+          if ((!in_order || had_holes) && paths_nr_ == 1) {
+            // Out-of-order, duplicate or hole-filling packet; do not delay
+            // the ACK, the sender relies on it for fast retransmission. With
+            // multipath, reordering is the norm, and losses are detected by
+            // time rather than by the next ACK (see `DetectLosses').
+            SendAck();
+          } else if (++pending_acks_ >= ack_every_n_) {
+            SendAck();
+          }
+        }
+        break;
+    }
+  }
+
+  /**
+   * @brief Feeds the delay sample of an ACK, if any, to congestion control.
+   *
+   * @param machneth Machnet header of the ACK.
+   * @param acked_nr Number of packets newly acknowledged.
+   * @param ttl      TTL of the ACK packet; hops are counted from the initial
+   *                 TTL (see `BuildHeaderTemplate').
+   * @param rx_tsc   TSC when the ACK arrived.
+   * @param now      Current TSC.
+   */
+  void UpdateCongestionWindow(const MachnetPktHdr* machneth, uint32_t acked_nr,
+                              uint8_t ttl, uint64_t rx_tsc, uint64_t now) {
+    swift::AckSample sample = {
+        .now_ns = time::cycles_to_ns(now),
+        .acked_nr = acked_nr,
+        .ce_nr = machneth->ecn_ce_nr.value(),
+        .has_delay = false,
+    };
+    const auto tx_tsc = machneth->timestamp1.value();
+    if (tx_tsc != 0 && tx_tsc < rx_tsc) {
+      const auto rtt_ns = time::cycles_to_ns(now - tx_tsc);
+      const auto local_queuing_ns = time::cycles_to_ns(now - rx_tsc);
+      const uint64_t remote_ns = machneth->remote_delay.value();
+      sample.has_delay = true;
+      sample.rtt_ns = rtt_ns;
+      pcb_.rtt_sample(rtt_ns);
+      RecordLatency(channel_, latency_stats_.get(), &MachnetLatencyStats_t::rtt,
+                    rtt_ns);
+      sample.endpoint_ns = machneth->remote_queuing.value() + local_queuing_ns;
+      sample.fabric_ns =
+          rtt_ns - std::min(rtt_ns, remote_ns + local_queuing_ns);
+      sample.hops = ttl < Ipv4::kDefaultTTL ? Ipv4::kDefaultTTL - ttl : 0;
+    }
+    cc_.OnAck(sample);
+  }
+
+  void process_ack(const MachnetPktHdr* machneth, uint8_t ttl, uint64_t rx_tsc,
+                   uint64_t now) {
+    auto ackno = machneth->ackno.value();
+    if (swift::seqno_lt(ackno, pcb_.snd_una)) {
+      return;
     } else if (swift::seqno_gt(ackno, pcb_.snd_nxt)) {
-      LOG(ERROR) << "ACK received for untransmitted data.";
-    } else {
+      Trace(trace::Event::kDropBadAckno, pcb_.snd_una, ackno);
+      VLOG(1) << "ACK received for untransmitted data.";
+      TransmitPackets();
+      return;
+    }
+
+    auto* scoreboard = tx_tracking_.scoreboard();
+    size_t num_acked_packets = 0;
+    const bool new_ack = swift::seqno_gt(ackno, pcb_.snd_una);
+    if (new_ack) {
       // This is a valid ACK, acknowledging new data.
-      size_t num_acked_packets = ackno - pcb_.snd_una;
+      num_acked_packets = ackno - pcb_.snd_una;
       if (state_ == State::kSynReceived) {
-        state_ = State::kEstablished;
+        SetState(State::kEstablished);
         num_acked_packets--;
       }
 
       tx_tracking_.ReceiveAcks(num_acked_packets);
+      scoreboard->OnAck(ackno);
 
       pcb_.snd_una = ackno;
-      pcb_.duplicate_acks = 0;
-      pcb_.snd_ooo_acks = 0;
       pcb_.rto_rexmits = 0;
-      pcb_.rto_maybe_reset();
+      tlp_probed_ = false;
+      if (in_recovery_ && !swift::seqno_lt(ackno, recovery_end_)) {
+        in_recovery_ = false;
+      }
+    }
+
+    // SACKs of packets past a hole; on a duplicate ACK, that is all there is.
+    Scoreboard::SackBitmap sack_bitmap;
+    static_assert(sizeof(machneth->sack_bitmap) == sizeof(sack_bitmap));
+    for (size_t i = 0; i < sack_bitmap.size(); i++) {
+      sack_bitmap[i] = machneth->sack_bitmap[i].value();
+    }
+    scoreboard->OnSack(ackno, machneth->sack_offset.value(), sack_bitmap);
+
+    // The receive window of the peer, from `ackno' (`snd_una') on, within the
+    // window negotiated. An ACK that closes the window on packets in flight
+    // shows the peer is alive, only short of buffers: its drops do not count
+    // towards giving up the flow (see `RtoCheck').
+    pcb_.snd_wnd = std::min<uint32_t>(machneth->rcv_wnd.value(),
+                                      scoreboard->capacity());
+    if (pcb_.snd_wnd < pcb_.snd_nxt - pcb_.snd_una) pcb_.rto_rexmits = 0;
+
+    if (keepalive_armed_) {
+      // Nothing in flight: the answer to a keep-alive probe, or a window
+      // update. Its timestamp echo is stale, so it carries no delay sample.
+      pcb_.rto_rexmits = 0;
+      KeepAliveReset();
+      TransmitPackets();
+      return;
     }
 
+    UpdateCongestionWindow(machneth, num_acked_packets, ttl, rx_tsc, now);
+    if (new_ack) RtoMaybeReset();
+    DetectLosses(now);
+
     TransmitPackets();
   }
 
-  const Key key_;
-  // A flow is identified by the 5-tuple (Proto is always UDP).
-  const Ethernet::Address local_l2_addr_;
-  const Ethernet::Address remote_l2_addr_;
+  // Members are laid out by how often the datapath touches them: first the
+  // state every packet reads or writes, then the header template, copied into
+  // every packet sent, then the tracking of messages, and last the state of
+  // setup, teardown and timers, which packets do not touch.
+
   // Flow state.
   State state_;
-  // Pointer to the TX ring for the flow to send packets on.
-  dpdk::TxRing* txring_;
-  // Callback to be invoked when the flow is either established or closed.
-  ApplicationCallback callback_;
+  // Pointer to the (engine's) TX batch for the flow to stage packets on.
+  dpdk::TxBatch* txbatch_;
   // Shared pointer to the channel attached to this flow.
   shm::Channel* channel_;
   // Swift CC protocol control block.
   swift::Pcb pcb_;
+  // Receive window, advertised to the peer (see `SetMaxWindow'), the room
+  // for packets advertised in the last ACK, and whether that was small enough
+  // to warrant a window update (see `WindowUpdateDue').
+  uint32_t rcv_window_{kDefaultWindow};
+  uint32_t rcv_wnd_advertised_{kDefaultWindow};
+  bool rcv_wnd_reduced_{false};
+  // ACK coalescing policy (see `SetAckPolicy').
+  uint32_t ack_every_n_{kDefaultAckEveryN};
+  uint64_t ack_delay_cycles_{time::us_to_cycles(kDefaultAckDelayUs)};
+  // Number of in-order data packets received but not acknowledged yet.
+  uint32_t pending_acks_{0};
+  // TSC deadline for a delayed ACK; zero if no ACK timer is armed.
+  uint64_t ack_deadline_{0};
+  // Timestamp of the last data packet received (as received), its arrival
+  // TSC, and the time it was queued before the flow processed it; echoed in
+  // ACKs (see `PrepareMachnetHdr').
+  be64_t rx_echo_timestamp_{0};
+  uint64_t rx_echo_tsc_{0};
+  uint64_t rx_echo_queuing_ns_{0};
+  // Data packets received with an ECN CE mark since the last ACK.
+  uint32_t rx_ce_nr_{0};
+  // Loss recovery (see `DetectLosses'): the window is reduced once until the
+  // packets in flight when the first loss was detected are acknowledged.
+  bool in_recovery_{false};
+  uint32_t recovery_end_{0};
+  // Pacing (see `SetPacer'): the TSC at which the next packet may be sent,
+  // and whether the flow waits on the pacer to reach it.
+  Pacer* pacer_{nullptr};
+  bool pace_window_{false};
+  bool pacer_scheduled_{false};
+  uint64_t tx_deadline_{0};
+  // Deadlines of the retransmission timer (see `RtoReset'), and the TSC it is
+  // armed for.
+  uint64_t rto_deadline_{0};
+  uint64_t reo_deadline_{0};
+  uint64_t rto_timer_tsc_{0};
+  // Whether the timer is armed as a tail loss probe, and whether a probe was
+  // sent since the last new ACK.
+  bool probe_armed_{false};
+  bool tlp_probed_{false};
+  // Multipath (see `SetMultipath'): the number of paths in use, and the path
+  // of the data packets with the TSC of the last one sent (see `SelectPath').
+  size_t paths_nr_{1};
+  uint64_t flowlet_gap_cycles_{0};
+  size_t tx_path_{0};
+  uint64_t tx_path_tsc_{0};
+  // Maximum segments per UDP-segmented packet; 0 if UDP segmentation offload
+  // is not available, in which case one packet is sent per message buffer.
+  uint16_t uso_max_segs_nr_{0};
+  // Whether packets may carry message buffers as external buffers, i.e., the
+  // driver detaches them when it frees sent packets (no `FAST_FREE').
+  bool tx_extbuf_{false};
+  // MTU of the port, and the MSS advertised in (and probed with) the SYN or
+  // SYN-ACK (see `GetSynPayloadLen').
+  uint16_t mtu_{dpdk::PmdRing::kDefaultFrameSize};
+  uint32_t syn_mss_{kDefaultMss};
+  // The headers of the flow's packets, as laid out on the wire.
+  struct __attribute__((packed)) PacketHeaders {
+    Ethernet eh;
+    Ipv4 ipv4h;
+    Udp udph;
+    MachnetPktHdr machneth;
+  };
+  // Prebuilt headers, copied in front of every packet (see `PrepareHeaders'),
+  // and those of control packets without options (see `SendControlPacket').
+  alignas(hardware_constructive_interference_size) PacketHeaders hdr_template_;
+  PacketHeaders ctrl_template_;
+  // Congestion control policy (window and pacing).
+  swift::CongestionController cc_;
   TXTracking tx_tracking_;
   RXTracking rx_tracking_;
+
+  // Cold: flow setup and teardown, and timers.
+  const Key key_;
+  // A flow is identified by the 5-tuple (Proto is always UDP).
+  const Ethernet::Address local_l2_addr_;
+  const Ethernet::Address remote_l2_addr_;
+  // Callback to be invoked when the flow is either established or closed.
+  ApplicationCallback callback_;
+  // Multipath: the ports of the paths beyond the first, local on the end that
+  // initiated the flow and remote on the other, and the number of paths
+  // allowed.
+  std::vector<Udp::Port> path_ports_;
+  bool path_ports_local_{false};
+  size_t max_paths_nr_{1};
+  // Whether data may go before the handshake completes (see `SetEarlyData').
+  bool early_data_{false};
+  // Aggregation of small messages (see `SetAggregation'): the largest packed,
+  // whether the peer splits aggregated packets, and how long the last
+  // message may be held, with the TSC it is held until; zero if not held.
+  uint32_t agg_max_msg_len_{0};
+  bool peer_splits_{false};
+  uint64_t agg_hold_cycles_{0};
+  uint64_t agg_deadline_{0};
+  // Encryption (see `SetEncryption'): the crypto engine of the engine, the
+  // nonce of this end for the handshake, the keys of both directions, and
+  // the IV of the next packet sent.
+  bool encrypt_{false};
+  dpdk::CryptoEngine* crypto_{nullptr};
+  std::array<uint8_t, dpdk::CryptoEngine::kNonceLen> crypto_nonce_{};
+  dpdk::CryptoKey tx_key_{};
+  dpdk::CryptoKey rx_key_{};
+  uint64_t tx_iv_{0};
+  // Priority class, and DSCP of the packets (see `SetPriority').
+  uint32_t prio_{MACHNET_PRIO_NORMAL};
+  uint8_t dscp_{0};
+  // Idle time before keep-alive probes, zero if disabled, and whether the
+  // flow's timer stands for them (see `SetKeepAlive').
+  uint64_t keepalive_cycles_{0};
+  bool keepalive_armed_{false};
+  // Tracer of the engine, if any, and the flow's id in it (see `SetTracer').
+  trace::Tracer* tracer_{nullptr};
+  uint32_t trace_id_{0};
+  // Latency stats of the flow, if it keeps its own (see `SetLatencyStats').
+  std::unique_ptr<MachnetLatencyStats_t> latency_stats_;
+  // Retransmission timer (see `RtoReset'), in the engine's timer wheel.
+  Timers* timers_{nullptr};
+  Timers::Timer rto_timer_{this};
+  // Whether the caller polls the timers of the flow (see `TimerCheck').
+  bool timer_polling_{false};
 };
 
 }  // namespace flow
@@ -0,0 +1,205 @@
+/**
+ * @file flow_steering.h
+ * @brief Hardware steering of Machnet traffic to RX queues with `rte_flow'
+ * rules, as an alternative to relying on RSS.
+ */
+#ifndef SRC_INCLUDE_FLOW_STEERING_H_
+#define SRC_INCLUDE_FLOW_STEERING_H_
+
+#include <flow_key.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <rte_flow.h>
+#include <udp.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief Class `FlowSteering' installs `rte_flow' rules that direct the packets
+ * of listeners and connected flows to a given RX queue of a port.
+ *
+ * Without steering, the packets of a flow land on the queue RSS picks from its
+ * 4-tuple, so the engine owning the flow has to choose a local port that hashes
+ * to its own queue. With steering, a listener rule sends everything towards a
+ * local address and port to the queue of the listening engine (this covers the
+ * flows it accepts too), and a flow rule sends the packets of a flow the
+ * engine initiated to its queue. Flow rules take precedence over listener
+ * rules. Packets that match no rule are still spread with RSS.
+ *
+ * Each engine owns its instance; rules are removed when it is destroyed.
+ * This class is not thread-safe, but different instances may be used
+ * concurrently on the same port.
+ */
+class FlowSteering {
+ public:
+  using Ipv4 = net::Ipv4;
+  using Udp = net::Udp;
+  using Key = net::flow::Key;
+  using Listener = net::flow::Listener;
+
+  /**
+   * @brief Construct a new FlowSteering object.
+   * @param port_id  The DPDK port to install rules on.
+   * @param queue_id The RX queue to steer packets to.
+   */
+  FlowSteering(uint16_t port_id, uint16_t queue_id)
+      : port_id_(port_id), queue_id_(queue_id) {}
+  FlowSteering(const FlowSteering &) = delete;
+  FlowSteering &operator=(const FlowSteering &) = delete;
+  ~FlowSteering() {
+    for (const auto &[_, rule] : listener_rules_) Destroy(rule);
+    for (const auto &[_, rule] : flow_rules_) Destroy(rule);
+  }
+
+  /**
+   * @brief Checks whether the port accepts the rules this class installs.
+   * @param port_id  The DPDK port.
+   * @param queue_id An RX queue of the port.
+   */
+  static bool IsSupported(uint16_t port_id, uint16_t queue_id) {
+    const Key key(Ipv4::Address(0x0a000001), Udp::Port(kSrcPortProbe),
+                  Ipv4::Address(0x0a000002), Udp::Port(kSrcPortProbe));
+    RulePattern listener_rule(key, false);
+    RulePattern flow_rule(key, true);
+    return listener_rule.Validate(port_id, queue_id) &&
+           flow_rule.Validate(port_id, queue_id);
+  }
+
+  /**
+   * @brief Steers all packets towards a local address and UDP port to the
+   * queue.
+   * @return True on success, false if the rule could not be installed.
+   */
+  bool AddListener(const Ipv4::Address &addr, const Udp::Port &port) {
+    const Listener listener(addr, port);
+    if (listener_rules_.find(listener) != listener_rules_.end()) return true;
+    const Key key(addr, port, Ipv4::Address(0u), Udp::Port(0));
+    auto *rule = RulePattern(key, false).Create(port_id_, queue_id_);
+    if (rule == nullptr) return false;
+    listener_rules_.emplace(listener, rule);
+    return true;
+  }
+
+  void RemoveListener(const Ipv4::Address &addr, const Udp::Port &port) {
+    auto it = listener_rules_.find(Listener(addr, port));
+    if (it == listener_rules_.end()) return;
+    Destroy(it->second);
+    listener_rules_.erase(it);
+  }
+
+  /**
+   * @brief Steers the incoming packets of a flow to the queue.
+   * @return True on success, false if the rule could not be installed.
+   */
+  bool AddFlow(const Key &key) {
+    if (flow_rules_.find(key) != flow_rules_.end()) return true;
+    auto *rule = RulePattern(key, true).Create(port_id_, queue_id_);
+    if (rule == nullptr) return false;
+    flow_rules_.emplace(key, rule);
+    return true;
+  }
+
+  /**
+   * @brief Removes the rule of a flow, if any (flows accepted by a listener
+   * have none).
+   */
+  void RemoveFlow(const Key &key) {
+    auto it = flow_rules_.find(key);
+    if (it == flow_rules_.end()) return;
+    Destroy(it->second);
+    flow_rules_.erase(it);
+  }
+
+  size_t GetListenerRulesCount() const { return listener_rules_.size(); }
+  size_t GetFlowRulesCount() const { return flow_rules_.size(); }
+
+ private:
+  // Arbitrary port for the rules probed by `IsSupported'.
+  static constexpr uint16_t kSrcPortProbe = 1024;
+  // Rule priorities (lower is higher); flow rules are more specific.
+  static constexpr uint32_t kFlowRulePriority = 0;
+  static constexpr uint32_t kListenerRulePriority = 1;
+
+  /**
+   * @brief The pattern and actions of a rule that matches IPv4/UDP packets
+   * towards the local end of `key' and, for flow rules, from its remote end.
+   */
+  struct RulePattern {
+    RulePattern(const Key &key, bool match_remote) {
+      attr.ingress = 1;
+      attr.priority = match_remote ? kFlowRulePriority : kListenerRulePriority;
+      ipv4_spec.hdr.dst_addr = key.local_addr.address.raw_value();
+      ipv4_mask.hdr.dst_addr = UINT32_MAX;
+      udp_spec.hdr.dst_port = key.local_port.port.raw_value();
+      udp_mask.hdr.dst_port = UINT16_MAX;
+      if (match_remote) {
+        ipv4_spec.hdr.src_addr = key.remote_addr.address.raw_value();
+        ipv4_mask.hdr.src_addr = UINT32_MAX;
+        udp_spec.hdr.src_port = key.remote_port.port.raw_value();
+        udp_mask.hdr.src_port = UINT16_MAX;
+      }
+      pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+      pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
+      pattern[1].spec = &ipv4_spec;
+      pattern[1].mask = &ipv4_mask;
+      pattern[2].type = RTE_FLOW_ITEM_TYPE_UDP;
+      pattern[2].spec = &udp_spec;
+      pattern[2].mask = &udp_mask;
+      pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+    }
+
+    bool Validate(uint16_t port_id, uint16_t queue_id) {
+      const rte_flow_action_queue queue = {.index = queue_id};
+      const rte_flow_action actions[] = {
+          {.type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &queue},
+          {.type = RTE_FLOW_ACTION_TYPE_END, .conf = nullptr}};
+      rte_flow_error error;
+      const int ret =
+          rte_flow_validate(port_id, &attr, pattern, actions, &error);
+      LOG_IF(WARNING, ret != 0)
+          << "Flow steering rule not supported on port " << port_id << ": "
+          << (error.message != nullptr ? error.message : "unknown error");
+      return ret == 0;
+    }
+
+    rte_flow *Create(uint16_t port_id, uint16_t queue_id) {
+      const rte_flow_action_queue queue = {.index = queue_id};
+      const rte_flow_action actions[] = {
+          {.type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &queue},
+          {.type = RTE_FLOW_ACTION_TYPE_END, .conf = nullptr}};
+      rte_flow_error error;
+      auto *rule = rte_flow_create(port_id, &attr, pattern, actions, &error);
+      LOG_IF(ERROR, rule == nullptr)
+          << "Failed to install flow steering rule on port " << port_id
+          << ": "
+          << (error.message != nullptr ? error.message : "unknown error");
+      return rule;
+    }
+
+    rte_flow_attr attr{};
+    rte_flow_item_ipv4 ipv4_spec{}, ipv4_mask{};
+    rte_flow_item_udp udp_spec{}, udp_mask{};
+    rte_flow_item pattern[4]{};
+  };
+
+  void Destroy(rte_flow *rule) const {
+    rte_flow_error error;
+    LOG_IF(ERROR, rte_flow_destroy(port_id_, rule, &error) != 0)
+        << "Failed to remove flow steering rule on port " << port_id_ << ": "
+        << (error.message != nullptr ? error.message : "unknown error");
+  }
+
+  const uint16_t port_id_;
+  const uint16_t queue_id_;
+  std::unordered_map<Listener, rte_flow *> listener_rules_;
+  std::unordered_map<Key, rte_flow *> flow_rules_;
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_FLOW_STEERING_H_
@@ -0,0 +1,299 @@
+/**
+ * @file flow_table.h
+ * @brief Open-addressing flow table used by the Machnet engine to map flow keys
+ * to flows on the datapath.
+ */
+#ifndef SRC_INCLUDE_FLOW_TABLE_H_
+#define SRC_INCLUDE_FLOW_TABLE_H_
+
+#include <common.h>
+#include <emmintrin.h>
+#include <flow_key.h>
+#include <glog/logging.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class Flow;  // forward declaration
+
+/**
+ * @brief Class `FlowTable' is a cache-friendly, open-addressing hash table that
+ * maps a flow `Key' to a (non-owning) `Flow' pointer.
+ *
+ * The table does not hash the key itself; the caller passes the 32-bit hash
+ * along with the key. On the RX path this is the RSS hash that the NIC already
+ * computed for the packet, so a lookup costs no hashing at all.
+ *
+ * Slots are organized in groups of `kGroupSize'. Each group has one control
+ * byte per slot, holding either a state marker (empty/deleted) or a 7-bit tag
+ * derived from the hash. A lookup loads the 16 control bytes of a group and
+ * compares them with the tag in one SSE2 instruction; only slots whose tag
+ * matches have their (inline) key compared. For a hit this usually means
+ * touching two cache lines: the control bytes and the slot.
+ *
+ * Deletion leaves a tombstone so that probe sequences stay intact. Lookups
+ * and erasures never move entries, so it is safe to call `Erase' from within
+ * `ForEach'. Inserting may rehash the table and invalidates any iteration in
+ * progress.
+ *
+ * This class is not thread-safe.
+ */
+class FlowTable {
+ public:
+  static constexpr size_t kGroupSize = 16;
+  static constexpr size_t kDefaultCapacity = 1024;
+  // Maximum load factor (live + deleted slots), expressed as x/8.
+  static constexpr size_t kMaxLoadFactorEighths = 7;
+
+  /**
+   * @brief Construct a new FlowTable object.
+   * @param capacity Initial number of slots; rounded up to a power of two and
+   *                 to at least one group.
+   */
+  explicit FlowTable(size_t capacity = kDefaultCapacity)
+      : groups_nr_(0), size_(0), tombstones_(0), shift_(0) {
+    Allocate(capacity);
+  }
+  FlowTable(const FlowTable &) = delete;
+  FlowTable &operator=(const FlowTable &) = delete;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return groups_nr_ * kGroupSize; }
+
+  /**
+   * @brief Looks up a flow.
+   * @param key  The flow key.
+   * @param hash The 32-bit hash of the key (e.g., the NIC RSS hash).
+   * @return A pointer to the flow, or nullptr if not found.
+   */
+  Flow *Find(const Key &key, uint32_t hash) const {
+    size_t g, pos;
+    if (!FindPos(key, hash, &g, &pos)) return nullptr;
+    return groups_[g].slots[pos].flow;
+  }
+
+  /**
+   * @brief Prefetches the control bytes of the first group a lookup for
+   * `hash' will probe. Useful to overlap the table miss with other work on a
+   * burst of packets.
+   */
+  void Prefetch(uint32_t hash) const {
+    const auto mix = Mix(hash);
+    __builtin_prefetch(&groups_[GroupIndex(mix)].ctrl);
+  }
+
+  /**
+   * @brief Inserts a flow in the table.
+   * @param key  The flow key.
+   * @param hash The 32-bit hash of the key. All subsequent lookups for this
+   *             key must use the same hash value.
+   * @param flow Non-owning pointer to the flow.
+   * @return True on success, false if the key is already present.
+   */
+  bool Insert(const Key &key, uint32_t hash, Flow *flow) {
+    CHECK_NOTNULL(flow);
+    size_t g, pos;
+    if (FindPos(key, hash, &g, &pos)) return false;
+    if ((size_ + tombstones_ + 1) * 8 > capacity() * kMaxLoadFactorEighths) {
+      // Grow only if live entries dominate; otherwise rehashing in place at
+      // the same capacity is enough to purge the tombstones.
+      const auto new_capacity =
+          (size_ + 1) * 2 * 8 > capacity() * kMaxLoadFactorEighths
+              ? capacity() * 2
+              : capacity();
+      Rehash(new_capacity);
+    }
+    InsertUnchecked(key, hash, flow);
+    return true;
+  }
+
+  /**
+   * @brief Removes a flow from the table.
+   * @param key  The flow key.
+   * @param hash The 32-bit hash of the key that was used on insertion.
+   * @return True if the key was found and removed, false otherwise.
+   */
+  bool Erase(const Key &key, uint32_t hash) {
+    size_t g, pos;
+    if (!FindPos(key, hash, &g, &pos)) return false;
+    auto &group = groups_[g];
+    // A slot can go straight back to empty if its group was never full, as no
+    // probe sequence can have run past this group.
+    group.ctrl[pos] = MatchEmpty(group) ? kCtrlEmpty : kCtrlDeleted;
+    if (group.ctrl[pos] == kCtrlDeleted) tombstones_++;
+    group.slots[pos].flow = nullptr;
+    size_--;
+    return true;
+  }
+
+  /**
+   * @brief Invokes `f(key, hash, flow)' for each flow in the table.
+   * @attention `f' may call `Erase' on the table, but not `Insert'.
+   */
+  template <typename F>
+  void ForEach(F &&f) {
+    for (size_t g = 0; g < groups_nr_; g++) {
+      auto &group = groups_[g];
+      for (size_t pos = 0; pos < kGroupSize; pos++) {
+        if (!IsFull(group.ctrl[pos])) continue;
+        auto &slot = group.slots[pos];
+        f(slot.key(), slot.hash, slot.flow);
+      }
+    }
+  }
+
+  /**
+   * @brief Removes all flows from the table.
+   */
+  void Clear() {
+    for (size_t g = 0; g < groups_nr_; g++) {
+      std::memset(groups_[g].ctrl, kCtrlEmpty, sizeof(groups_[g].ctrl));
+    }
+    size_ = 0;
+    tombstones_ = 0;
+  }
+
+ private:
+  // Control byte values. Full slots have the MSB cleared and store a tag.
+  static constexpr int8_t kCtrlEmpty = static_cast<int8_t>(0x80);
+  static constexpr int8_t kCtrlDeleted = static_cast<int8_t>(0xfe);
+
+  struct Slot {
+    const Key &key() const { return *reinterpret_cast<const Key *>(key_raw); }
+    bool KeyEquals(const Key &other) const {
+      return std::memcmp(key_raw, &other, sizeof(key_raw)) == 0;
+    }
+    // `Key' is not assignable, so it is kept as raw bytes in the slot.
+    uint8_t key_raw[sizeof(Key)];
+    uint32_t hash;
+    Flow *flow;
+  };
+  static_assert(sizeof(Slot) == 24, "Flow table slot size is not 24 bytes.");
+
+  struct alignas(hardware_constructive_interference_size) Group {
+    int8_t ctrl[kGroupSize];
+    Slot slots[kGroupSize];
+  };
+
+  static bool IsFull(int8_t ctrl) { return ctrl >= 0; }
+
+  // RSS hashes of the flows landing on one engine share their low-order bits
+  // (they index the RETA), so the hash is re-mixed before use.
+  static uint64_t Mix(uint32_t hash) {
+    return static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ULL;
+  }
+  size_t GroupIndex(uint64_t mix) const {
+    return (mix >> shift_) & (groups_nr_ - 1);
+  }
+  static int8_t Tag(uint64_t mix) { return (mix >> 32) & 0x7f; }
+
+  static uint32_t Match(const Group &group, int8_t ctrl) {
+    const auto ctrl_vec =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(group.ctrl));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(ctrl), ctrl_vec));
+  }
+  static uint32_t MatchEmpty(const Group &group) {
+    return Match(group, kCtrlEmpty);
+  }
+  static uint32_t MatchEmptyOrDeleted(const Group &group) {
+    // Both markers have the MSB set; full slots do not.
+    const auto ctrl_vec =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(group.ctrl));
+    return _mm_movemask_epi8(ctrl_vec);
+  }
+
+  bool FindPos(const Key &key, uint32_t hash, size_t *group_index,
+               size_t *pos) const {
+    const auto mix = Mix(hash);
+    const auto tag = Tag(mix);
+    auto g = GroupIndex(mix);
+    const auto mask = groups_nr_ - 1;
+    // Triangular probing over groups visits every group exactly once when the
+    // number of groups is a power of two.
+    for (size_t i = 1; i <= groups_nr_; i++) {
+      const auto &group = groups_[g];
+      for (auto m = Match(group, tag); m != 0; m &= m - 1) {
+        const auto &slot = group.slots[__builtin_ctz(m)];
+        if (slot.hash == hash && slot.KeyEquals(key)) [[likely]] {
+          *group_index = g;
+          *pos = __builtin_ctz(m);
+          return true;
+        }
+      }
+      if (MatchEmpty(group) != 0) [[likely]]
+        return false;
+      g = (g + i) & mask;
+    }
+    return false;
+  }
+
+  void InsertUnchecked(const Key &key, uint32_t hash, Flow *flow) {
+    const auto mix = Mix(hash);
+    auto g = GroupIndex(mix);
+    const auto mask = groups_nr_ - 1;
+    for (size_t i = 1; i <= groups_nr_; i++) {
+      auto &group = groups_[g];
+      const auto m = MatchEmptyOrDeleted(group);
+      if (m != 0) {
+        const auto pos = __builtin_ctz(m);
+        if (group.ctrl[pos] == kCtrlDeleted) tombstones_--;
+        group.ctrl[pos] = Tag(mix);
+        auto &slot = group.slots[pos];
+        std::memcpy(slot.key_raw, &key, sizeof(slot.key_raw));
+        slot.hash = hash;
+        slot.flow = flow;
+        size_++;
+        return;
+      }
+      g = (g + i) & mask;
+    }
+    LOG(FATAL) << "Flow table is full (capacity: " << capacity() << ")";
+  }
+
+  void Allocate(size_t capacity) {
+    auto groups_nr = std::max(capacity, kGroupSize) / kGroupSize;
+    if (!utils::is_power_of_two(groups_nr)) {
+      groups_nr = 1ULL << (64 - __builtin_clzll(groups_nr));
+    }
+    groups_ = std::make_unique<Group[]>(groups_nr);
+    groups_nr_ = groups_nr;
+    // Keep the shift in range for a single-group table; `GroupIndex' masks the
+    // result anyway.
+    shift_ = std::min<size_t>(64 - __builtin_ctzll(groups_nr), 63);
+    Clear();
+  }
+
+  void Rehash(size_t new_capacity) {
+    auto old_groups = std::move(groups_);
+    const auto old_groups_nr = groups_nr_;
+    Allocate(new_capacity);
+    for (size_t g = 0; g < old_groups_nr; g++) {
+      const auto &group = old_groups[g];
+      for (size_t pos = 0; pos < kGroupSize; pos++) {
+        if (!IsFull(group.ctrl[pos])) continue;
+        const auto &slot = group.slots[pos];
+        InsertUnchecked(slot.key(), slot.hash, slot.flow);
+      }
+    }
+  }
+
+  std::unique_ptr<Group[]> groups_;
+  size_t groups_nr_;
+  size_t size_;
+  size_t tombstones_;
+  size_t shift_;
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_FLOW_TABLE_H_
@@ -57,6 +57,15 @@ struct __attribute__((packed)) Ipv4 {
     kRaw = 255,
   };
 
+  // ECN codepoints, in the two low bits of `type_of_service' (RFC 3168).
+  enum Ecn : uint8_t {
+    kNotEct = 0b00,
+    kEct1 = 0b01,
+    kEct0 = 0b10,
+    kCe = 0b11,
+    kEcnMask = 0b11,
+  };
+
   std::string ToString() const;
 
   uint8_t version_ihl;
@@ -5,14 +5,21 @@
 
 #include <fstream>
 #define JSON_NOEXCEPTION  // Disable exceptions for nlohmann::json
+#include <cc.h>
 #include <dpdk.h>
 #include <ether.h>
 #include <ipv4.h>
+#include <machnet_common.h>
+#include <machnet_pkthdr.h>
+#include <pmd.h>
 #include <utils.h>
 
 #include <algorithm>
+#include <array>
 #include <nlohmann/json.hpp>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 
@@ -20,16 +27,99 @@ class NetworkInterfaceConfig {
  public:
   inline static const cpu_set_t kDefaultCpuMask =
       utils::calculate_cpu_mask(0xFFFFFFFF);
+  static constexpr uint32_t kDefaultIdleSleepUs = 1000;
+  static constexpr uint32_t kDefaultKeepAliveUs = 1000000;
+  static constexpr uint32_t kDefaultAggregationHoldUs = 10;
+  static constexpr uint32_t kDefaultAckEveryN = 16;
+  static constexpr uint32_t kDefaultMaxWindow =
+      net::swift::Pcb::kSackBitmapSize;
+  inline static const uint16_t kDefaultMtu = dpdk::PmdRing::kDefaultFrameSize;
+  using Neighbors =
+      std::vector<std::pair<net::Ipv4::Address, net::Ethernet::Address>>;
+  // Ports bonded with the interface: their L2 and PCIe addresses.
+  using Bond = std::vector<std::pair<net::Ethernet::Address, std::string>>;
+  // DSCP of the packets of each priority class (`MACHNET_PRIO_*').
+  using PriorityDscp = std::array<uint8_t, MACHNET_PRIO_CLASSES_NR>;
+  // Size classes of channel buffers: their usable size and their number + 1,
+  // in increasing size.
+  using BufClasses = std::vector<std::pair<uint32_t, uint32_t>>;
   explicit NetworkInterfaceConfig(const std::string pcie_addr,
                                   const net::Ethernet::Address &l2_addr,
                                   const net::Ipv4::Address &ip_addr,
                                   size_t engine_threads = 1,
-                                  cpu_set_t cpu_mask = kDefaultCpuMask)
+                                  cpu_set_t cpu_mask = kDefaultCpuMask,
+                                  uint32_t idle_polls = 0,
+                                  uint32_t idle_sleep_us = kDefaultIdleSleepUs,
+                                  bool tx_uso = false,
+                                  bool rx_zerocopy = false,
+                                  bool flow_steering = false,
+                                  net::swift::Algorithm congestion_control =
+                                      net::swift::Algorithm::kSwift,
+                                  bool pacing = false,
+                                  uint32_t max_window = kDefaultMaxWindow,
+                                  uint16_t mtu = kDefaultMtu,
+                                  uint32_t multipath = 1,
+                                  uint32_t flowlet_gap_us = 0,
+                                  Neighbors neighbors = {},
+                                  std::vector<uint32_t> engine_cpus = {},
+                                  Bond bond = {}, bool early_data = false,
+                                  uint32_t keepalive_us = kDefaultKeepAliveUs,
+                                  bool flow_latency_stats = false,
+                                  size_t copy_nt_threshold = 0,
+                                  size_t copy_dma_threshold = 0,
+                                  std::vector<std::string> dma_devices = {},
+                                  BufClasses channel_buffer_classes = {},
+                                  size_t channel_pool_size = 0,
+                                  size_t channel_max_buffers = 0,
+                                  size_t app_max_buffers = 0,
+                                  PriorityDscp priority_dscp = {},
+                                  std::vector<uint8_t> encryption_key = {},
+                                  std::vector<std::string> crypto_devices = {},
+                                  std::string af_xdp_iface = "",
+                                  std::string af_xdp_prog = "",
+                                  uint32_t aggregation_max_msg = 0,
+                                  uint32_t aggregation_hold_us =
+                                      kDefaultAggregationHoldUs,
+                                  uint32_t ack_every_n = kDefaultAckEveryN,
+                                  uint32_t ack_delay_us = 0)
       : pcie_addr_(pcie_addr),
         l2_addr_(l2_addr),
         ip_addr_(ip_addr),
         engine_threads_(engine_threads),
         cpu_mask_(cpu_mask),
+        idle_polls_(idle_polls),
+        idle_sleep_us_(idle_sleep_us),
+        tx_uso_(tx_uso),
+        rx_zerocopy_(rx_zerocopy),
+        flow_steering_(flow_steering),
+        congestion_control_(congestion_control),
+        pacing_(pacing),
+        max_window_(max_window),
+        mtu_(mtu),
+        multipath_(multipath),
+        flowlet_gap_us_(flowlet_gap_us),
+        neighbors_(std::move(neighbors)),
+        engine_cpus_(std::move(engine_cpus)),
+        bond_(std::move(bond)),
+        early_data_(early_data),
+        keepalive_us_(keepalive_us),
+        flow_latency_stats_(flow_latency_stats),
+        copy_nt_threshold_(copy_nt_threshold),
+        copy_dma_threshold_(copy_dma_threshold),
+        dma_devices_(std::move(dma_devices)),
+        channel_buffer_classes_(std::move(channel_buffer_classes)),
+        channel_pool_size_(channel_pool_size),
+        channel_max_buffers_(channel_max_buffers),
+        app_max_buffers_(app_max_buffers),
+        priority_dscp_(priority_dscp),
+        encryption_key_(std::move(encryption_key)),
+        crypto_devices_(std::move(crypto_devices)),
+        af_xdp_iface_(std::move(af_xdp_iface)),
+        af_xdp_prog_(std::move(af_xdp_prog)),
+        aggregation_max_msg_(aggregation_max_msg),
+        aggregation_hold_us_(aggregation_hold_us),
+        ack_every_n_(ack_every_n),
+        ack_delay_us_(ack_delay_us),
         dpdk_port_id_(std::nullopt) {}
   bool operator==(const NetworkInterfaceConfig &other) const {
     return l2_addr_ == other.l2_addr_;
@@ -40,16 +130,83 @@ class NetworkInterfaceConfig {
   const net::Ipv4::Address &ip_addr() const { return ip_addr_; }
   size_t engine_threads() const { return engine_threads_; }
   cpu_set_t cpu_mask() const { return cpu_mask_; }
+  uint32_t idle_polls() const { return idle_polls_; }
+  uint32_t idle_sleep_us() const { return idle_sleep_us_; }
+  bool tx_uso() const { return tx_uso_; }
+  bool rx_zerocopy() const { return rx_zerocopy_; }
+  bool flow_steering() const { return flow_steering_; }
+  net::swift::Algorithm congestion_control() const {
+    return congestion_control_;
+  }
+  bool pacing() const { return pacing_; }
+  uint32_t max_window() const { return max_window_; }
+  uint16_t mtu() const { return mtu_; }
+  uint32_t multipath() const { return multipath_; }
+  uint32_t flowlet_gap_us() const { return flowlet_gap_us_; }
+  const Neighbors &neighbors() const { return neighbors_; }
+  const std::vector<uint32_t> &engine_cpus() const { return engine_cpus_; }
+  const Bond &bond() const { return bond_; }
+  bool early_data() const { return early_data_; }
+  uint32_t keepalive_us() const { return keepalive_us_; }
+  bool flow_latency_stats() const { return flow_latency_stats_; }
+  size_t copy_nt_threshold() const { return copy_nt_threshold_; }
+  size_t copy_dma_threshold() const { return copy_dma_threshold_; }
+  const std::vector<std::string> &dma_devices() const { return dma_devices_; }
+  const BufClasses &channel_buffer_classes() const {
+    return channel_buffer_classes_;
+  }
+  size_t channel_pool_size() const { return channel_pool_size_; }
+  size_t channel_max_buffers() const { return channel_max_buffers_; }
+  size_t app_max_buffers() const { return app_max_buffers_; }
+  const PriorityDscp &priority_dscp() const { return priority_dscp_; }
+  const std::vector<uint8_t> &encryption_key() const { return encryption_key_; }
+  const std::vector<std::string> &crypto_devices() const {
+    return crypto_devices_;
+  }
+  // Whether the port is on AF_XDP sockets, over the kernel's interface.
+  bool af_xdp() const { return !af_xdp_iface_.empty(); }
+  const std::string &af_xdp_iface() const { return af_xdp_iface_; }
+  const std::string &af_xdp_prog() const { return af_xdp_prog_; }
+  uint32_t aggregation_max_msg() const { return aggregation_max_msg_; }
+  uint32_t aggregation_hold_us() const { return aggregation_hold_us_; }
+  uint32_t ack_every_n() const { return ack_every_n_; }
+  uint32_t ack_delay_us() const { return ack_delay_us_; }
   std::optional<uint16_t> dpdk_port_id() const { return dpdk_port_id_; }
   void Dump() const {
     LOG(INFO) << "NetworkInterfaceConfig: "
               << utils::Format(
                      "[PCIe: %s, L2: %s, IP: %s, engine_threads: %zu, "
-                     "cpu_mask: %lu, dpdk_port_id: %d]",
+                     "cpu_mask: %lu, idle_polls: %u, idle_sleep_us: %u, "
+                     "tx_uso: %d, rx_zerocopy: %d, flow_steering: %d, "
+                     "congestion_control: %s, pacing: %d, max_window: %u, "
+                     "mtu: %u, multipath: %u, flowlet_gap_us: %u, "
+                     "neighbors: %zu, engine_cpus: %s, bond: %s, "
+                     "early_data: %d, keepalive_us: %u, "
+                     "flow_latency_stats: %d, copy_nt_threshold: %zu, "
+                     "copy_dma_threshold: %zu, dma_devices: %s, "
+                     "channel_buffer_classes: %s, channel_pool_size: %zu, "
+                     "channel_max_buffers: %zu, app_max_buffers: %zu, "
+                     "priority_dscp: %s, encryption: %d, crypto_devices: %s, "
+                     "af_xdp: %s, aggregation_max_msg: %u, "
+                     "aggregation_hold_us: %u, ack_every_n: %u, "
+                     "ack_delay_us: %u, dpdk_port_id: %d]",
                      pcie_addr_.c_str(), l2_addr_.ToString().c_str(),
                      ip_addr_.ToString().c_str(), engine_threads_,
-                     utils::cpuset_to_sizet(cpu_mask_),
-                     dpdk_port_id_.value_or(-1));
+                     utils::cpuset_to_sizet(cpu_mask_), idle_polls_,
+                     idle_sleep_us_, tx_uso_, rx_zerocopy_, flow_steering_,
+                     net::swift::AlgorithmToString(congestion_control_),
+                     pacing_, max_window_, mtu_, multipath_, flowlet_gap_us_,
+                     neighbors_.size(), EngineCpusToString().c_str(),
+                     BondToString().c_str(), early_data_, keepalive_us_,
+                     flow_latency_stats_, copy_nt_threshold_,
+                     copy_dma_threshold_, DevicesToString(dma_devices_).c_str(),
+                     BufClassesToString().c_str(), channel_pool_size_,
+                     channel_max_buffers_, app_max_buffers_,
+                     PriorityDscpToString().c_str(), !encryption_key_.empty(),
+                     DevicesToString(crypto_devices_).c_str(),
+                     af_xdp() ? af_xdp_iface_.c_str() : "none",
+                     aggregation_max_msg_, aggregation_hold_us_,
+                     ack_every_n_, ack_delay_us_, dpdk_port_id_.value_or(-1));
   }
 
   void set_dpdk_port_id(std::optional<uint16_t> dpdk_port_id) {
@@ -57,11 +214,89 @@ class NetworkInterfaceConfig {
   }
 
  private:
+  std::string EngineCpusToString() const {
+    if (engine_cpus_.empty()) return "none";
+    std::string s;
+    for (const auto &cpu : engine_cpus_) {
+      s += (s.empty() ? "" : ",") + std::to_string(cpu);
+    }
+    return s;
+  }
+
+  static std::string DevicesToString(const std::vector<std::string> &devices) {
+    if (devices.empty()) return "none";
+    std::string s;
+    for (const auto &device : devices) {
+      s += (s.empty() ? "" : ",") + device;
+    }
+    return s;
+  }
+
+  std::string BufClassesToString() const {
+    if (channel_buffer_classes_.empty()) return "none";
+    std::string s;
+    for (const auto &[buffer_size, buffers_nr] : channel_buffer_classes_) {
+      s += (s.empty() ? "" : ",") + std::to_string(buffer_size) + "x" +
+           std::to_string(buffers_nr);
+    }
+    return s;
+  }
+
+  std::string PriorityDscpToString() const {
+    std::string s;
+    for (const auto &dscp : priority_dscp_) {
+      s += (s.empty() ? "" : ",") + std::to_string(dscp);
+    }
+    return s;
+  }
+
+  std::string BondToString() const {
+    if (bond_.empty()) return "none";
+    std::string s;
+    for (const auto &[l2_addr, pcie_addr] : bond_) {
+      s += (s.empty() ? "" : ",") + l2_addr.ToString() + "@" + pcie_addr;
+    }
+    return s;
+  }
+
   const std::string pcie_addr_;
   const net::Ethernet::Address l2_addr_;
   const net::Ipv4::Address ip_addr_;
   const size_t engine_threads_;
   cpu_set_t cpu_mask_;
+  const uint32_t idle_polls_;
+  const uint32_t idle_sleep_us_;
+  const bool tx_uso_;
+  const bool rx_zerocopy_;
+  const bool flow_steering_;
+  const net::swift::Algorithm congestion_control_;
+  const bool pacing_;
+  const uint32_t max_window_;
+  const uint16_t mtu_;
+  const uint32_t multipath_;
+  const uint32_t flowlet_gap_us_;
+  const Neighbors neighbors_;
+  const std::vector<uint32_t> engine_cpus_;
+  const Bond bond_;
+  const bool early_data_;
+  const uint32_t keepalive_us_;
+  const bool flow_latency_stats_;
+  const size_t copy_nt_threshold_;
+  const size_t copy_dma_threshold_;
+  const std::vector<std::string> dma_devices_;
+  const BufClasses channel_buffer_classes_;
+  const size_t channel_pool_size_;
+  const size_t channel_max_buffers_;
+  const size_t app_max_buffers_;
+  const PriorityDscp priority_dscp_;
+  const std::vector<uint8_t> encryption_key_;
+  const std::vector<std::string> crypto_devices_;
+  const std::string af_xdp_iface_;
+  const std::string af_xdp_prog_;
+  const uint32_t aggregation_max_msg_;
+  const uint32_t aggregation_hold_us_;
+  const uint32_t ack_every_n_;
+  const uint32_t ack_delay_us_;
   std::optional<uint16_t> dpdk_port_id_;
 };
 }  // namespace juggler
@@ -96,6 +331,165 @@ namespace juggler {
  *
  * Note that `engine_threads` (decimal) and `cpu_mask` (hex) are optional. If
  * not specified, the default value is 1 and 0xFFFFFFFF respectively.
+ *
+ * The optional `idle_polls` and `idle_sleep_us` (decimal) enable the engines'
+ * adaptive idle mode: after `idle_polls` consecutive empty polls an engine
+ * sleeps on RX interrupts and channel doorbells, for at most `idle_sleep_us`
+ * (default 1000). With `idle_polls` 0 (default), engines always busy-poll.
+ *
+ * The optional `tx_uso` (boolean, default false) lets flows hand multi-buffer
+ * messages to the NIC as large UDP-segmented packets, if the NIC supports UDP
+ * segmentation offload.
+ *
+ * The optional `rx_zerocopy` (boolean, default false) lets an engine that
+ * serves a single channel receive packets straight into the channel's buffers.
+ * Applications then see the raw frames (headers included) that land in their
+ * buffers, so only enable it on hosts that trust their applications.
+ *
+ * The optional `flow_steering` (boolean, default false) makes engines install
+ * NIC flow rules (`rte_flow`) for their listeners and outgoing flows, instead
+ * of relying on RSS to land packets on their queues, if the NIC supports it.
+ *
+ * The optional `congestion_control` ("swift", "ecn" or "fixed"; default
+ * "swift") is the congestion control of flows whose application does not pick
+ * one with `machnet_set_cc`. "ecn" needs switches that mark ECN-capable
+ * packets; "fixed" disables congestion control and is only meant for testing.
+ *
+ * The optional `pacing` (boolean, default false) makes flows spread the
+ * packets of their congestion window over the RTT instead of sending them in
+ * bursts at line rate.
+ *
+ * The optional `max_window` (a power of two from 256 to 16384, in packets;
+ * default 256) is the receive window flows advertise. Larger windows let flows
+ * on long or fast paths keep more data in flight, if their peer supports them
+ * too, at the cost of about 32 bytes of memory per flow per packet of window.
+ *
+ * The optional `mtu` (from 1500 to 8982, in bytes; default 1500) is the MTU of
+ * the port; 8982 is what remains of a 9000-byte jumbo frame after its Ethernet
+ * header and CRC (see `dpdk::PmdRing::kJumboFrameSize`). Channel buffers are
+ * sized to hold a packet of that MTU, and flows use jumbo frames with peers
+ * that do as well, if the path carries them (see `MachnetSynOptions`);
+ * otherwise they fall back to 1500-byte frames.
+ *
+ * The optional `multipath` (from 1 to 8; default 1) is the number of paths of
+ * an ECMP fabric flows may spray their packets over, each with its own UDP
+ * source port, if the peer allows as many. The optional `flowlet_gap_us`
+ * (default 0) is the idle time after which a flow moves to its next path; zero
+ * moves on every packet, while a gap above the difference in delay between
+ * paths avoids reordering.
+ *
+ * The optional `neighbors` (a dictionary of IP to MAC addresses) are static
+ * ARP entries, for fabrics where ARP is slow or filtered. They never expire,
+ * and ARP replies do not override them.
+ *
+ * The optional `engine_cpus` (a list of CPU cores, one per engine) maps the
+ * engines of the interface to cores explicitly. Engines mapped to the same
+ * core, of this or other interfaces, share one worker thread pinned on that
+ * core, which runs them in turn; such engines do not sleep when idle. Without
+ * it, each engine has its own thread, pinned on `cpu_mask`. If
+ * `engine_threads` is missing, it defaults to the length of the list.
+ *
+ * The optional `bond` (a list of MAC addresses) are ports bonded with the
+ * interface, active-active: each engine also polls its queue on every member,
+ * and spreads its flows over the ports whose links are up, moving them to the
+ * others when a link goes down. All ports send with the MAC and IP addresses
+ * of the interface, so the switch must treat them as one link (e.g., a LAG).
+ * Members need the same NIC model as the interface; bonds rule out
+ * `rx_zerocopy` and `flow_steering`.
+ *
+ * The optional `early_data` (boolean, default false) lets flows send their
+ * first messages right behind the SYN, rather than after the handshake, which
+ * saves an RTT on every new connection; `machnet_connect` then returns as soon
+ * as the SYN is sent. Peers must enable it too, or early data is only
+ * recovered after the handshake. Like TCP Fast Open, a peer may get the early
+ * data of a connection that then fails to establish.
+ *
+ * The optional `keepalive_us` (default 1s) is how long flows created by
+ * `machnet_connect_pooled` may stay idle before the engine probes the peer;
+ * the engine closes them, and the application drops them from its pool, when
+ * the probes go unanswered.
+ *
+ * The optional `flow_latency_stats` (boolean, default false) has every flow
+ * keep latency histograms of its own, shown in the engine status dumps;
+ * channels always keep theirs (see `MachnetLatencyStats_t`).
+ *
+ * The optional `copy_nt_threshold` and `copy_dma_threshold` (bytes, default 0,
+ * i.e., disabled) tier the copies of payloads between message buffers and
+ * packets: copies of at least `copy_nt_threshold` bytes use non-temporal
+ * stores, which spare the engine's cache, and TX copies of at least
+ * `copy_dma_threshold` bytes are offloaded to a DMA engine (e.g., Intel DSA or
+ * IOAT), given in `dma_devices` (a list of DPDK device names, one per engine,
+ * e.g., PCIe addresses, which are added to the EAL allowlist). Smaller copies
+ * stay inline. DMA pays off only for payloads of several KB, e.g., with jumbo
+ * frames or USO.
+ *
+ * The optional `channel_buffer_classes` (a dictionary of usable buffer sizes,
+ * in bytes, to numbers of buffers + 1, each a power of two; at most 3) adds
+ * pools of buffers smaller than the default ones to every channel of the
+ * interface. Messages sent and packet payloads received that fit in a single
+ * such buffer take the smallest one that holds them, instead of a buffer
+ * sized for the MTU, e.g., {"256": 8192} for small RPCs. Classes as large as
+ * the default buffers are ignored.
+ *
+ * The optional `channel_pool_size` (default 0) is the number of channels kept
+ * created, bound to their NUMA node and registered for DMA ahead of time, per
+ * NUMA node channels of the interface are placed on, so that attaching takes
+ * one from the pool instead of building a channel on the spot. The pool of the
+ * NIC's node is filled at startup, that of another node on the first request
+ * for it; pools are refilled in the background.
+ *
+ * The optional `channel_max_buffers` (default 0, i.e., fixed) makes the pool
+ * of default buffers of every channel of the interface elastic: it starts
+ * with one segment of 4096 buffers, grows a segment at a time when free
+ * buffers run low, up to `channel_max_buffers` (rounded up to whole
+ * segments), and releases the last segment once it has been idle for a few
+ * seconds. Memory then follows the load of each channel. The optional
+ * `app_max_buffers` (default 0, i.e., unlimited) caps the buffers the channels
+ * of an application on the interface may grow by, all together. Channels
+ * registered for DMA (zero-copy) keep a fixed pool.
+ *
+ * The optional `priority_dscp` (a list of 3 DSCP values, for the high, normal
+ * and bulk priority classes; default all 0) marks the packets of flows with
+ * the DSCP of their class (see `machnet_set_priority`), so that NICs with DCB
+ * and switches may queue the classes apart, e.g., [46, 0, 8].
+ *
+ * The optional `encryption_key_file` (path to a file holding a 16- or 32-byte
+ * master key, shared by the peers) encrypts the data of every flow with
+ * AES-GCM, on the crypto devices given in `crypto_devices` (a list of DPDK
+ * device names, one per engine): accelerators by PCIe address, which are
+ * added to the EAL allowlist, or AES-NI on the engine's core as virtual
+ * devices (e.g., "crypto_aesni_gcm0"), which are created. The keys of each
+ * flow derive from the master key during the handshake; peers without
+ * encryption are refused. Encrypted flows send neither early data nor
+ * segmented packets (`tx_uso`), and lose 24 bytes of every packet to the IV
+ * and the tag.
+ *
+ * The optional `af_xdp` (boolean, default false) runs the interface on AF_XDP
+ * sockets, for hosts where the NIC cannot be handed to DPDK (e.g., VMs
+ * without SR-IOV passthrough): the NIC stays with its kernel driver, which
+ * keeps the host's traffic and resolves neighbors, while an XDP program
+ * steers the UDP ports Machnet uses to the engines' queues (see `AfXdp'). The
+ * interface needs at least `engine_threads` queues (`ethtool -L`), and its
+ * `ip` must be one of the kernel's, which answers ARP for it. The
+ * optional `af_xdp_prog` is the path of the XDP program, by default
+ * `machnet_xdp.o` next to the executable. AF_XDP rules out `rx_zerocopy`,
+ * `flow_steering` and `bond`.
+ *
+ * The optional `aggregation_max_msg` (bytes, default 0, i.e., disabled) packs
+ * the messages of a flow of up to that size, each in a single buffer, into
+ * shared packets of up to the MSS, instead of one packet per message; the
+ * peer splits them back. While a flow has data in flight, its last small
+ * message waits up to `aggregation_hold_us` (default 10, at most 1000) for
+ * others to join it, as with Nagle's algorithm; 0 only packs what queues up
+ * behind the congestion window. Peers that do not split aggregated packets
+ * get one packet per message.
+ *
+ * The optional `ack_every_n` (default 16) and `ack_delay_us` (default 0, at
+ * most 1000) coalesce the ACKs of in-order data: flows acknowledge each RX
+ * burst once, and at least every `ack_every_n` packets; a positive
+ * `ack_delay_us` holds the ACK of a burst back for up to as long, so that
+ * the next bursts share it. Out-of-order packets are always acknowledged at
+ * once, for the sender to recover losses quickly.
  */
 class MachnetConfigProcessor {
  public:
@@ -7,14 +7,25 @@
 #define SRC_INCLUDE_MACHNET_CONTROLLER_H_
 
 #include <channel.h>
+#include <checkpoint.h>
 #include <machnet_config.h>
 #include <machnet_ctrl.h>
 #include <machnet_engine.h>
 #include <ud_socket.h>
 #include <uuid/uuid.h>
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <csignal>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "common.h"
 
@@ -33,6 +44,15 @@ class MachnetController {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::Channel>;
   // Timeout for idle connections in seconds.
   static constexpr uint32_t kConnectionTimeoutInSec = 2;
+  // Where, and how often, the counters of the engines are exported, in the
+  // Prometheus text format (e.g., for the textfile collector of the node
+  // exporter) (see `ExportMetrics').
+  static constexpr const char *kMetricsPath = "/var/run/machnet/metrics.prom";
+  static constexpr uint32_t kMetricsIntervalMs = 1000;
+  // The header of the checkpoint of a hot restart (see `HandOff'); only a
+  // Machnet of the same checkpoint version may take over.
+  static constexpr uint32_t kCheckpointMagic = 0x4d4e4843;  // "MNHC".
+  static constexpr uint32_t kCheckpointVersion = 1;
   MachnetController(const MachnetController &) = delete;
   // Delete constructor and assignment operator.
   MachnetController &operator=(const MachnetController &) = delete;
@@ -57,6 +77,18 @@ class MachnetController {
       LOG(INFO) << "Received SIGINT. Stopping the controller.";
       instance_->Stop();
     }
+    if (signum == SIGUSR1 && instance_ != nullptr) {
+      // Each engine logs its full status on its next periodic processing.
+      for (const auto &engine : instance_->engines_) {
+        engine->RequestStatusDump();
+      }
+    }
+    if (signum == SIGUSR2 && instance_ != nullptr) {
+      // Each engine writes its trace on its next periodic processing.
+      for (const auto &engine : instance_->engines_) {
+        engine->RequestTraceDump();
+      }
+    }
   }
 
   /**
@@ -65,6 +97,17 @@ class MachnetController {
    * requests.
    */
   void Run();
+  /**
+   * @brief Takes over from the Machnet running on this host, for a hot
+   * restart: asks it for its channels, flows, application connections and
+   * listening socket (see `HandOff'), and waits for it to exit and release the
+   * NICs. Call before `Run', which restores what was handed over once the
+   * engines run (see `RestoreHandOff'). Applications keep their channels and
+   * established flows, and pause until then.
+   * @return True if a Machnet handed over, false otherwise (`Run' starts
+   * afresh then).
+   */
+  bool TakeOver();
   /**
    * @brief Check if the controller is running.
    * @return True if the controller is running, false otherwise.
@@ -140,10 +183,57 @@ class MachnetController {
    * @param[in] app_uuid     UUID of the originating application.
    * @param[in] channel_info Information about the channel to be created.
    * @param[out] fd         The file descriptor of the channel (-1 on failure).
+   * @param[out] doorbell_fd The file descriptor of the channel's doorbell (-1
+   *                         on failure, or if the channel has no doorbell).
+   * @param[out] pending_fd  The file descriptor of the pending bitmap of the
+   *                         engine serving the channel (-1 on failure).
+   * @param[out] notify_fd   The file descriptor of the channel's notification
+   *                         (-1 on failure, or if the channel has none).
    * @return True if the channel has been created successfully, false otherwise.
    */
   bool CreateChannel(const uuid_t app_uuid,
-                     const machnet_channel_info_t *channel_info, int *fd);
+                     const machnet_channel_info_t *channel_info, int *fd,
+                     int *doorbell_fd, int *pending_fd, int *notify_fd);
+
+  /**
+   * @brief Creates a channel to be served by an engine, with buffers for the
+   * MTU of its port, bound to a NUMA node, and registered for DMA if the
+   * engine needs it. The channel is not added to the channel manager.
+   * @param[in] name           Name of the channel.
+   * @param[in] engine         An engine of the port that is to serve it.
+   * @param[in] queue_pairs_nr Number of per-thread queue pairs.
+   * @param[in] flags          Creation flags (`MACHNET_CHANNEL_F_*').
+   * @param[in] numa_node      The NUMA node, or `MACHNET_NUMA_NODE_ANY'.
+   * @return The channel, or nullptr on failure.
+   */
+  std::shared_ptr<shm::Channel> NewChannel(
+      const std::string &name, const std::shared_ptr<MachnetEngine> &engine,
+      size_t queue_pairs_nr, uint32_t flags, int numa_node);
+
+  /**
+   * @brief Returns the budget of buffers the channels of an application on
+   * the engine's port grow from (see `ShmChannel::SetBufBudget'), created on
+   * first use.
+   * @return The budget, or nullptr if it is unlimited.
+   */
+  std::shared_ptr<std::atomic<int64_t>> GetAppBufBudget(
+      const std::string &app_uuid_str,
+      const std::shared_ptr<MachnetEngine> &engine);
+
+  /**
+   * @brief Takes a ready channel from the pool of the engine's port and a NUMA
+   * node (see `channel_pool_size' in `MachnetConfigProcessor'), and has the
+   * pool refilled. The pool of a node is set up on the first request for it.
+   * @return The channel, or nullptr if the pool is empty or disabled.
+   */
+  std::shared_ptr<shm::Channel> TakePooledChannel(
+      const std::shared_ptr<MachnetEngine> &engine, int numa_node);
+
+  /**
+   * @brief Keeps the channel pools full, one channel at a time, until
+   * `channel_pools_running_' is cleared. Runs in `channel_pools_thread_'.
+   */
+  void FillChannelPools();
 
   /**
    * @brief The main loop of the controller.
@@ -155,7 +245,112 @@ class MachnetController {
    */
   void StopController();
 
+  /**
+   * @brief Moves a channel to another engine of the same port, flows and
+   * listeners included, without resetting its flows (see
+   * `MachnetEngine::DetachChannel'). The channel pauses for up to two slow
+   * timer intervals of the engines; packets of its flows that arrive
+   * meanwhile are dropped and retransmitted.
+   * @param[in] channel_uuid_str UUID of the channel.
+   * @param[in] engine_index     Index of the destination engine.
+   * @return True if the channel moved, false if it stays on its engine.
+   */
+  bool MigrateChannel(const std::string &channel_uuid_str, size_t engine_index);
+
+  /**
+   * @brief Hands the state of the controller over to a successor, on its
+   * request (see `TakeOver'), and stops the controller. Detaches all channels
+   * from the engines and writes their state to a checkpoint (see
+   * `MachnetEngine::HandOffChannel'). Then it passes on the checkpoint, the
+   * descriptors of the channels, the sockets of the applications and the
+   * listening socket. Only a process of the same user, or root, may take over.
+   * @param s   The socket of the successor.
+   * @param req The handoff request.
+   */
+  void HandOff(UDSocket *s, const machnet_ctrl_msg_t *req);
+
+  /**
+   * @brief Restores what the previous Machnet handed over (see `TakeOver'):
+   * maps its channels and attaches them, flows included, to the engines that
+   * served them, or else to another engine of the same port. Channels no
+   * engine takes are dropped; their applications get errors from then on.
+   */
+  void RestoreHandOff();
+
  private:
+  /**
+   * @brief Picks the engine to serve a new channel (see
+   * `GetLeastLoadedEngine'). Engines reserved for latency-critical channels
+   * are only picked if all engines are.
+   * @param[in] flags      Creation flags of the channel (`MACHNET_CHANNEL_F_*').
+   * @param[out] dedicated Set if the channel is latency-critical
+   *                       (`MACHNET_CHANNEL_F_DEDICATED') and the engine is
+   *                       free, or could be freed (see `VacateEngine'), to be
+   *                       reserved for it.
+   * @return The index of the engine in `engines_'.
+   */
+  size_t PlaceChannel(uint32_t flags, bool *dedicated);
+
+  /**
+   * @brief Returns the least loaded engine, from the live load of the engines
+   * (see `MachnetEngine::GetLoad'): the least busy one, then the one with the
+   * fewest flows, channels and packets per second.
+   * @param[in] excluded     An engine not to pick, if any.
+   * @param[in] reserved_too Whether engines reserved for latency-critical
+   *                         channels may be picked.
+   * @return The index of the engine, or nullopt if there is none to pick.
+   */
+  std::optional<size_t> GetLeastLoadedEngine(
+      std::optional<size_t> excluded = std::nullopt,
+      bool reserved_too = false) const;
+
+  /**
+   * @brief Frees up the engine with the fewest channels among those not
+   * reserved, by migrating its channels to the least loaded other ones.
+   * @return The index of the engine, or nullopt if no engine could be freed.
+   */
+  std::optional<size_t> VacateEngine();
+
+  // Returns the number of channels served by each engine.
+  std::vector<size_t> GetChannelsPerEngine() const;
+
+  /**
+   * @brief Packets a port lost or held back, by where: in the NIC, in the mbuf
+   * pools, or in engines that fall behind. Totals over all the queues of the
+   * port and the engines serving it (see `SamplePorts').
+   */
+  struct PortDrops {
+    uint64_t rx_missed;          // RX ring full: the engines fell behind.
+    uint64_t rx_nombuf;          // RX mbuf pool empty.
+    uint64_t rx_errors;          // Bad packets, dropped by the NIC.
+    uint64_t tx_errors;          // Packets the NIC failed to send.
+    uint64_t rx_full_bursts;     // RX bursts that left packets in the ring.
+    uint64_t tx_alloc_failures;  // TX mbuf pool empty (see `PacketPool').
+    uint64_t tx_ring_full;       // TX bursts retried: the NIC fell behind.
+  };
+
+  /**
+   * @brief Samples the statistics of all ports, extended ones included (see
+   * `PmdPort::UpdateXstats'), and logs where packets were dropped since the
+   * last sample, if anywhere (see `PortDrops').
+   */
+  void SamplePorts();
+
+  /**
+   * @brief Returns the counters of all engines (see
+   * `MachnetEngine::GetStats'), of all ports and their queues as of the last
+   * `SamplePorts', and the latency quantiles of all channels (see
+   * `MachnetLatencyStats_t'), in the Prometheus text format.
+   */
+  std::string GetMetrics();
+
+  /**
+   * @brief Samples the ports (see `SamplePorts') and writes the metrics (see
+   * `GetMetrics') to `kMetricsPath' every `kMetricsIntervalMs', atomically,
+   * until `metrics_running_' is cleared.
+   */
+  void ExportMetrics();
+
   static inline MachnetController *instance_;
   MachnetConfigProcessor config_processor_;
   ChannelManager channel_manager_;
@@ -166,6 +361,52 @@ class MachnetController {
   std::unique_ptr<UDServer> server_{nullptr};
   std::unordered_map<std::string, std::unordered_set<std::string>>
       applications_registered_{};
+  // Budgets of the elastic buffer pools, by application and port id (see
+  // `GetAppBufBudget').
+  std::map<std::pair<std::string, uint16_t>,
+           std::shared_ptr<std::atomic<int64_t>>>
+      app_buf_budgets_{};
+  // Engine serving each channel, by index in `engines_'.
+  std::unordered_map<std::string, size_t> channel_engines_{};
+  // Engines reserved for a latency-critical channel, and the channel.
+  std::unordered_map<size_t, std::string> dedicated_engines_{};
+  // The socket of each registered application, to hand over (see `HandOff').
+  std::unordered_map<std::string, int> application_sockets_{};
+  // Whether the controller handed over to a successor; the channels of its
+  // applications then outlive their connections.
+  bool handed_off_{false};
+  // What the previous Machnet handed over (see `TakeOver'), until restored.
+  struct HandOffState {
+    int checkpoint_fd;
+    int listen_fd;
+    // The shared memory, doorbell and notification descriptors of each
+    // channel, in the order of the checkpoint (-1 if missing).
+    std::vector<std::array<int, 3>> channel_fds;
+    // The socket of each application, by UUID.
+    std::vector<std::pair<std::string, int>> app_sockets;
+  };
+  std::optional<HandOffState> handoff_{};
+  // The thread exporting the metrics (see `ExportMetrics').
+  std::thread metrics_thread_{};
+  std::atomic<bool> metrics_running_{false};
+  // The drops of each port of `pmd_ports_' as of the last `SamplePorts'.
+  std::vector<PortDrops> port_drops_{};
+
+  // Channels created ahead of time, for a port and a NUMA node, and an engine
+  // of the port whose parameters they are created with.
+  struct ChannelPool {
+    std::shared_ptr<MachnetEngine> engine;
+    std::vector<std::shared_ptr<shm::Channel>> channels;
+  };
+  // The size of the pools of each port with pools, by port id.
+  std::unordered_map<uint16_t, size_t> channel_pool_sizes_{};
+  // The pools, by port id and NUMA node; guarded by `channel_pools_mtx_'.
+  std::map<std::pair<uint16_t, int>, ChannelPool> channel_pools_{};
+  std::mutex channel_pools_mtx_{};
+  std::condition_variable channel_pools_cv_{};
+  bool channel_pools_running_{false};
+  // The thread refilling the pools (see `FillChannelPools').
+  std::thread channel_pools_thread_{};
 };
 }  // namespace juggler
 
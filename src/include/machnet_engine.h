@@ -5,25 +5,38 @@
 #ifndef SRC_INCLUDE_MACHNET_ENGINE_H_
 #define SRC_INCLUDE_MACHNET_ENGINE_H_
 
+#include <af_xdp.h>
 #include <arp.h>
 #include <channel.h>
 #include <common.h>
+#include <copy_engine.h>
+#include <crypto_engine.h>
 #include <ether.h>
 #include <flow.h>
+#include <flow_steering.h>
+#include <flow_table.h>
 #include <icmp.h>
 #include <ipv4.h>
 #include <pmd.h>
 #include <rte_thash.h>
+#include <sys/epoll.h>
+#include <trace.h>
 #include <udp.h>
 
+#include <array>
+#include <atomic>
+#include <bit>
 #include <concepts>
 #include <cstddef>
+#include <cstring>
 #include <functional>
 #include <future>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <unordered_set>
 #include <vector>
@@ -41,21 +54,73 @@ class MachnetEngineSharedState {
   static const size_t kSrcPortMax = (1 << 16) - 1;  // 65535
   static constexpr size_t kSrcPortBitmapSize =
       (kSrcPortMax + 1) / sizeof(uint64_t) / 8;
-  explicit MachnetEngineSharedState(std::vector<uint8_t> rss_key,
-                                    net::Ethernet::Address l2addr,
-                                    std::vector<net::Ipv4::Address> ipv4_addrs)
+  // Bitmap of the free UDP ports of an IPv4 address (bit set: port free).
+  using PortBitmap = std::array<std::atomic<uint64_t>, kSrcPortBitmapSize>;
+  // Minimum interval between ARP requests for the same address, and the ages
+  // at which ARP entries are refreshed and expire (see `AgeArpTable').
+  static constexpr uint64_t kArpRequestIntervalUs = 100 * 1000;
+  static constexpr uint64_t kArpRefreshUs = 45 * 1000 * 1000;
+  static constexpr uint64_t kArpExpiryUs = 60 * 1000 * 1000;
+  /**
+   * @param rss_key    The RSS key of the port.
+   * @param l2addr     The MAC address of the port.
+   * @param ipv4_addrs The local IP addresses of the port.
+   * @param neighbors  Static ARP entries (IP to MAC address) of neighbors.
+   */
+  explicit MachnetEngineSharedState(
+      std::vector<uint8_t> rss_key, net::Ethernet::Address l2addr,
+      std::vector<net::Ipv4::Address> ipv4_addrs,
+      const std::vector<std::pair<net::Ipv4::Address, net::Ethernet::Address>>
+          &neighbors = {})
       : rss_key_(rss_key), arp_handler_(l2addr, ipv4_addrs) {
+    for (const auto &[ipv4_addr, neighbor_l2addr] : neighbors) {
+      arp_handler_.AddStaticEntry(ipv4_addr, neighbor_l2addr);
+    }
+    arp_version_.store(arp_handler_.GetVersion(), std::memory_order_relaxed);
     for (const auto &addr : ipv4_addrs) {
       CHECK(ipv4_port_bitmap_.find(addr) == ipv4_port_bitmap_.end());
-      ipv4_port_bitmap_.insert({addr, std::vector<uint64_t>(1, UINT64_MAX)});
+      auto bitmap = std::make_unique<PortBitmap>();
+      for (auto &slot : *bitmap) slot.store(~0ULL, std::memory_order_relaxed);
+      ipv4_port_bitmap_.emplace(addr, std::move(bitmap));
+    }
+    // Toeplitz hashing of a 4-tuple needs 4 key bytes beyond the tuple's.
+    if (rss_key_.size() >= (RTE_THASH_V4_L4_LEN + 1) * sizeof(uint32_t)) {
+      rss_port_hashes_.resize(kSrcPortMax + 1, 0);
+      for (size_t port = 1; port <= kSrcPortMax; port++) {
+        const size_t lowest_bit = port & -port;
+        if (port != lowest_bit) {
+          rss_port_hashes_[port] = rss_port_hashes_[port ^ lowest_bit] ^
+                                   rss_port_hashes_[lowest_bit];
+          continue;
+        }
+        rte_thash_tuple tuple{};
+        tuple.v4.dport = port;
+        rss_port_hashes_[port] =
+            rte_softrss(reinterpret_cast<uint32_t *>(&tuple),
+                        RTE_THASH_V4_L4_LEN, rss_key_.data());
+      }
     }
   }
 
-  const std::unordered_map<net::Ipv4::Address, std::vector<uint64_t>>
+  const std::unordered_map<net::Ipv4::Address, std::unique_ptr<PortBitmap>>
       &GetIpv4PortBitmap() const {
     return ipv4_port_bitmap_;
   }
 
+  /**
+   * @brief Returns, for every UDP port, the Toeplitz hash over the RSS key of
+   * a 4-tuple that is all zeroes but for its destination port (see
+   * `rte_softrss'); empty if the RSS key is unknown.
+   *
+   * Toeplitz hashing is linear: the hash of a 4-tuple with destination port
+   * `p' is the hash of the same 4-tuple with destination port 0, XOR the
+   * hash of `p' here. Finding the local ports that put a flow on an RX queue
+   * thus takes one hash, not one per port.
+   */
+  const std::vector<uint32_t> &GetRssPortHashes() const {
+    return rss_port_hashes_;
+  }
+
   bool IsLocalIpv4Address(const net::Ipv4::Address &ipv4_addr) const {
     return ipv4_port_bitmap_.find(ipv4_addr) != ipv4_port_bitmap_.end();
   }
@@ -68,7 +133,8 @@ class MachnetEngineSharedState {
    * [kSrcPortMin, kSrcPortMax] that satisfies the provided predicate (lambda
    * function). If a suitable port is found, it is marked as used and returned
    * as an std::optional<net::Udp::Port> value. If no suitable port is found,
-   * std::nullopt is returned.
+   * std::nullopt is returned. Lock-free: ports are claimed with atomic
+   * operations on the bitmap.
    *
    * @tparam F A type satisfying the Predicate concept, invocable with a
    * uint16_t argument.
@@ -100,55 +166,70 @@ class MachnetEngineSharedState {
       return std::nullopt;
     }
 
-    // Helper lambda to find a free port.
-    // Given a 64-bit wide slot in a bitmap (vector of uint64_t), find the first
-    // available port that satisfies the lambda condition.
-    auto find_free_port = [&lambda, &bits_per_slot](
-                              auto &bitmap,
-                              size_t index) -> std::optional<net::Udp::Port> {
+    auto &bitmap = *it->second;
+    for (size_t i = kSrcPortMin / bits_per_slot; i < bitmap.size(); i++) {
+      auto free_ports = bitmap[i].load(std::memory_order_relaxed);
+      // The ports of the slot not checked against the lambda condition yet.
       auto mask = ~0ULL;
-      do {
-        auto pos = __builtin_ffsll(bitmap[index] & mask);
-        if (pos == 0) break;  // This slot is fully used.
-        const size_t candidate_port = index * bits_per_slot + pos - 1;
-        if (candidate_port > kSrcPortMax) break;  // Illegal port.
-        if (lambda(candidate_port)) {
-          bitmap[index] &= ~(1ULL << (pos - 1));
-          return net::Udp::Port(candidate_port);
+      while (free_ports & mask) {
+        const auto pos = __builtin_ctzll(free_ports & mask);
+        const size_t candidate_port = i * bits_per_slot + pos;
+        if (!lambda(candidate_port)) {
+          mask &= ~(1ULL << pos);
+          continue;
+        }
+        // On failure, `free_ports' is reloaded and the port checked again.
+        if (bitmap[i].compare_exchange_weak(free_ports,
+                                            free_ports & ~(1ULL << pos),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+          const net::Udp::Port port(candidate_port);
+          UpdateXdpSteering(port);
+          return port;
         }
-        // If we reached the end of the slot and the port is not suitable,
-        // abort.
-        if (pos == sizeof(uint64_t) * 8) break;
-        // Update the mask to skip the bits checked already.
-        mask = (~0ULL) << pos;
-      } while (true);
+      }
+    }
 
-      return std::nullopt;
-    };
+    return std::nullopt;
+  }
 
-    const std::lock_guard<std::mutex> lock(mtx_);
-    auto &bitmap = it->second;
-    // Calculate how many bitmap elements are required to cover port
-    // kSrcPortMin.
-    const size_t first_valid_slot = kSrcPortMin / bits_per_slot;
-    if (bitmap.size() < first_valid_slot + 1) {
-      bitmap.resize(first_valid_slot + 1, ~0ULL);
-    }
-
-    for (size_t i = first_valid_slot; i < bitmap.size(); i++) {
-      if (bitmap[i] == 0) continue;  // This slot is fully used.
-      auto port = find_free_port(bitmap, i);
-      if (port.has_value()) {
-        return port;
-      }
+  /**
+   * @brief Allocates a source UDP port for a given IPv4 address among a set of
+   * candidates, lock-free.
+   *
+   * @param ipv4_addr The net::Ipv4::Address for which the source port is being
+   * allocated.
+   * @param candidates Bitmap of the candidate ports, `kSrcPortBitmapSize'
+   * slots long (bit set: candidate port). Ports below `kSrcPortMin' must not
+   * be candidates.
+   * @return std::optional<net::Udp::Port> containing the allocated source port
+   * if found, or std::nullopt otherwise.
+   */
+  std::optional<net::Udp::Port> SrcPortAlloc(
+      const net::Ipv4::Address &ipv4_addr,
+      const std::vector<uint64_t> &candidates) {
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    auto it = ipv4_port_bitmap_.find(ipv4_addr);
+    if (it == ipv4_port_bitmap_.end()) {
+      return std::nullopt;
     }
 
-    while (bitmap.size() < kSrcPortBitmapSize) {
-      // We have exhausted the current bitmap, but there is still space to
-      // allocate more ports.
-      bitmap.emplace_back(~0ULL);
-      auto port = find_free_port(bitmap, bitmap.size() - 1);
-      if (port.has_value()) return port;
+    auto &bitmap = *it->second;
+    DCHECK_EQ(candidates.size(), bitmap.size());
+    for (size_t i = kSrcPortMin / bits_per_slot; i < bitmap.size(); i++) {
+      if (candidates[i] == 0) continue;
+      auto free_ports = bitmap[i].load(std::memory_order_relaxed);
+      while (free_ports & candidates[i]) {
+        const auto pos = __builtin_ctzll(free_ports & candidates[i]);
+        if (bitmap[i].compare_exchange_weak(free_ports,
+                                            free_ports & ~(1ULL << pos),
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+          const net::Udp::Port port(i * bits_per_slot + pos);
+          UpdateXdpSteering(port);
+          return port;
+        }
+      }
     }
 
     return std::nullopt;
@@ -166,8 +247,7 @@ class MachnetEngineSharedState {
    * @param port The net::Udp::Port instance representing the allocated source
    * port to be released.
    *
-   * @note Thread-safe, as it uses a lock_guard to protect concurrent access to
-   * the shared data.
+   * @note Thread-safe and lock-free.
    *
    * Example usage:
    * @code
@@ -178,8 +258,35 @@ class MachnetEngineSharedState {
    */
   void SrcPortRelease(const net::Ipv4::Address &ipv4_addr,
                       const net::Udp::Port &port) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    SrcPortReleaseLocked(ipv4_addr, port);
+    if (FreePort(ipv4_addr, port)) UpdateXdpSteering(port);
+  }
+
+  /**
+   * @brief Allocates a given UDP source port of an IPv4 address, e.g., that of
+   * a flow taken over from another process (see
+   * `MachnetEngine::RestoreChannel'), so that `SrcPortAlloc' does not hand it
+   * out again.
+   *
+   * @return True if the port was free, false otherwise.
+   * @note Thread-safe and lock-free.
+   */
+  bool SrcPortClaim(const net::Ipv4::Address &ipv4_addr,
+                    const net::Udp::Port &port) {
+    auto it = ipv4_port_bitmap_.find(ipv4_addr);
+    if (it == ipv4_port_bitmap_.end()) {
+      return false;
+    }
+
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    auto p = port.port.value();
+    const auto bit = 1ULL << (p % bits_per_slot);
+    if (!((*it->second)[p / bits_per_slot].fetch_and(
+              ~bit, std::memory_order_acq_rel) &
+          bit)) {
+      return false;
+    }
+    UpdateXdpSteering(port);
+    return true;
   }
 
   /**
@@ -217,26 +324,22 @@ class MachnetEngineSharedState {
   bool RegisterListener(const net::Ipv4::Address &ipv4_addr,
                         const net::Udp::Port &port, size_t rx_queue_id) {
     const std::lock_guard<std::mutex> lock(mtx_);
-    if (ipv4_port_bitmap_.find(ipv4_addr) == ipv4_port_bitmap_.end()) {
+    auto it = ipv4_port_bitmap_.find(ipv4_addr);
+    if (it == ipv4_port_bitmap_.end()) {
       return false;
     }
 
     constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
     auto p = port.port.value();
-    const auto slot = p / bits_per_slot;
-    const auto bit = p % bits_per_slot;
-    auto &bitmap = ipv4_port_bitmap_[ipv4_addr];
-    if (slot >= bitmap.size()) {
-      // Allocate more elements in the bitmap.
-      bitmap.resize(slot + 1, ~0ULL);
-    }
+    const auto bit = 1ULL << (p % bits_per_slot);
     // Check if the port is already in use (i.e, bit is unset).
-    if (!(bitmap[slot] & (1ULL << bit))) return false;
-    bitmap[slot] &= ~(1ULL << bit);
+    auto &slot = (*it->second)[p / bits_per_slot];
+    if (!(slot.fetch_and(~bit, std::memory_order_acq_rel) & bit)) return false;
 
     // Add the port and engine to the listeners.
     DCHECK(listeners_to_rxq.find({ipv4_addr, port}) == listeners_to_rxq.end());
     listeners_to_rxq[{ipv4_addr, port}] = rx_queue_id;
+    UpdateXdpSteeringLocked(port);
 
     return true;
   }
@@ -273,63 +376,200 @@ class MachnetEngineSharedState {
     }
 
     listeners_to_rxq.erase(it);
-    SrcPortReleaseLocked(ipv4_addr, port);
+    FreePort(ipv4_addr, port);
+    UpdateXdpSteeringLocked(port);
   }
 
-  std::optional<net::Ethernet::Address> GetL2Addr(
-      const dpdk::TxRing *txring, const net::Ipv4::Address &local_ip,
-      const net::Ipv4::Address &target_ip) {
+  /**
+   * @brief Steers the ports in use to Machnet through `port_map', for AF_XDP
+   * ports (see `dpdk::XdpPortMap'): ports are steered as they are allocated,
+   * claimed or listened on, and no longer once released. Set before the
+   * engines start.
+   */
+  void SetXdpPortMap(std::unique_ptr<dpdk::XdpPortMap> port_map) {
     const std::lock_guard<std::mutex> lock(mtx_);
-    return arp_handler_.GetL2Addr(txring, local_ip, target_ip);
+    xdp_port_map_ = std::move(port_map);
   }
 
-  void ProcessArpPacket(dpdk::TxRing *txring, net::Arp *arph) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    arp_handler_.ProcessArpPacket(txring, arph);
+  /**
+   * @brief Has the kernel, which owns the interface `ifname' of an AF_XDP port
+   * and its ARP traffic, resolve neighbors: the ARP table learns what the
+   * kernel resolved, and requests and refreshes turn into kernel resolutions
+   * (see `dpdk::AfXdp::ResolveNeighbor'). Set before the engines start.
+   */
+  void SetKernelNeighbors(const std::string &ifname) {
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    kernel_neighbors_ifname_ = ifname;
+    LearnKernelNeighbors();
   }
 
-  std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    return arp_handler_.GetArpTableEntries();
+  /**
+   * @brief Returns the version of the ARP table, which changes whenever the
+   * table does. Engines keep a copy of the table (see `GetArpTable'), and
+   * check this version, lock-free, to know when to renew it.
+   */
+  uint64_t GetArpVersion() const {
+    return arp_version_.load(std::memory_order_acquire);
   }
 
- private:
-  struct hash_ip_port_pair {
-    template <typename T, typename U>
-    std::size_t operator()(const std::pair<T, U> &x) const {
-      return std::hash<T>()(x.first) ^ std::hash<U>()(x.second);
+  /**
+   * @brief Returns a copy of the ARP table (IP to MAC address), with its
+   * version (see `GetArpVersion').
+   */
+  std::pair<uint64_t,
+            std::unordered_map<net::Ipv4::Address, net::Ethernet::Address>>
+  GetArpTable() {
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    return {arp_handler_.GetVersion(), arp_handler_.GetL2Addrs()};
+  }
+
+  /**
+   * @brief Issues an ARP request for `target_ip', unless one was issued less
+   * than `kArpRequestIntervalUs' ago. The reply updates the ARP table
+   * asynchronously.
+   *
+   * @param txring    The Tx ring to use for sending the request.
+   * @param local_ip  The local IP address to send the request from.
+   * @param target_ip The IP address to resolve.
+   */
+  void RequestL2Addr(const dpdk::TxRing *txring,
+                     const net::Ipv4::Address &local_ip,
+                     const net::Ipv4::Address &target_ip) {
+    const auto now = time::rdtsc();
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    if (arp_handler_.LookupL2Addr(target_ip).has_value()) return;
+    auto [it, inserted] = arp_requests_.try_emplace(target_ip, now);
+    if (!inserted) {
+      if (now - it->second < time::us_to_cycles(kArpRequestIntervalUs)) return;
+      it->second = now;
     }
-  };
+    if (!kernel_neighbors_ifname_.empty()) {
+      LearnKernelNeighbors();
+      if (arp_handler_.LookupL2Addr(target_ip).has_value()) return;
+      dpdk::AfXdp::ResolveNeighbor(kernel_neighbors_ifname_, target_ip);
+      return;
+    }
+    arp_handler_.RequestL2Addr(txring, local_ip, target_ip);
+  }
+
+  void ProcessArpPacket(dpdk::TxRing *txring, net::Arp *arph) {
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    arp_handler_.ProcessArpPacket(txring, arph);
+    arp_requests_.erase(arph->ipv4_data.spa);
+    arp_version_.store(arp_handler_.GetVersion(), std::memory_order_release);
+  }
 
   /**
-   * @brief Private method to release a previously allocated UDP source port.
+   * @brief Ages the ARP table (see `ArpHandler::Age'): entries are refreshed
+   * from `kArpRefreshUs', and expire at `kArpExpiryUs'. Static entries never
+   * expire.
    *
-   * @attention This method is not thread-safe, and should only be called when
-   * locked.
+   * @param txring The Tx ring to use for sending refresh requests.
    */
-  void SrcPortReleaseLocked(const net::Ipv4::Address &ipv4_addr,
-                            const net::Udp::Port &port) {
+  void AgeArpTable(const dpdk::TxRing *txring) {
+    const auto now = time::rdtsc();
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    if (!kernel_neighbors_ifname_.empty()) {
+      LearnKernelNeighbors();
+      arp_handler_.Age(txring, now, time::us_to_cycles(kArpRefreshUs),
+                       time::us_to_cycles(kArpExpiryUs),
+                       [this](const auto &, const auto &target_ip) {
+                         dpdk::AfXdp::ResolveNeighbor(kernel_neighbors_ifname_,
+                                                      target_ip);
+                       });
+    } else {
+      arp_handler_.Age(txring, now, time::us_to_cycles(kArpRefreshUs),
+                       time::us_to_cycles(kArpExpiryUs));
+    }
+    std::erase_if(arp_requests_, [now](const auto &request) {
+      return now - request.second >= time::us_to_cycles(kArpExpiryUs);
+    });
+    arp_version_.store(arp_handler_.GetVersion(), std::memory_order_release);
+  }
+
+  std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() {
+    const std::lock_guard<std::mutex> lock(arp_mtx_);
+    return arp_handler_.GetArpTableEntries();
+  }
+
+ private:
+  // Marks a port free; returns false if the IPv4 address is not local.
+  bool FreePort(const net::Ipv4::Address &ipv4_addr,
+                const net::Udp::Port &port) {
     auto it = ipv4_port_bitmap_.find(ipv4_addr);
     if (it == ipv4_port_bitmap_.end()) {
-      return;
+      return false;
     }
 
     constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
     auto p = port.port.value();
-    const auto slot = p / bits_per_slot;
-    const auto bit = p % bits_per_slot;
-    auto &bitmap = ipv4_port_bitmap_[ipv4_addr];
-    bitmap[slot] |= (1ULL << bit);
+    (*it->second)[p / bits_per_slot].fetch_or(1ULL << (p % bits_per_slot),
+                                              std::memory_order_release);
+    return true;
+  }
+
+  // Steers `port' to Machnet if it is in use on any address, or listened on.
+  // Updates are serialized, each from the latest state of the bitmaps, so the
+  // map settles on the state after the last change.
+  void UpdateXdpSteering(const net::Udp::Port &port) {
+    if (xdp_port_map_ == nullptr) return;
+    const std::lock_guard<std::mutex> lock(mtx_);
+    UpdateXdpSteeringLocked(port);
   }
+  void UpdateXdpSteeringLocked(const net::Udp::Port &port) {
+    if (xdp_port_map_ == nullptr) return;
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    const auto p = port.port.value();
+    bool used = false;
+    for (const auto &[ipv4_addr, bitmap] : ipv4_port_bitmap_) {
+      used |= !((*bitmap)[p / bits_per_slot].load(std::memory_order_acquire) &
+                (1ULL << (p % bits_per_slot)));
+      used |= listeners_to_rxq.find({ipv4_addr, port}) !=
+              listeners_to_rxq.end();
+    }
+    LOG_IF(WARNING, !xdp_port_map_->Set(p, used))
+        << "Failed to update the XDP steering of port " << p;
+  }
+
+  // Adds the neighbors the kernel resolved to the ARP table, as learned on
+  // the first local IP address.
+  void LearnKernelNeighbors() {
+    const auto &local_ip = ipv4_port_bitmap_.begin()->first;
+    for (const auto &[ip_addr, l2_addr] :
+         dpdk::AfXdp::GetNeighbors(kernel_neighbors_ifname_)) {
+      arp_handler_.AddEntry(ip_addr, l2_addr, local_ip);
+    }
+    arp_version_.store(arp_handler_.GetVersion(), std::memory_order_release);
+  }
+
+  struct hash_ip_port_pair {
+    template <typename T, typename U>
+    std::size_t operator()(const std::pair<T, U> &x) const {
+      return std::hash<T>()(x.first) ^ std::hash<U>()(x.second);
+    }
+  };
 
   const std::vector<uint8_t> rss_key_;
+  // See `GetRssPortHashes'.
+  std::vector<uint32_t> rss_port_hashes_{};
+  // The ARP table, with its version (see `GetArpVersion') and the pending
+  // requests (see `RequestL2Addr'), behind its own lock.
   ArpHandler arp_handler_;
+  std::atomic<uint64_t> arp_version_{0};
+  std::unordered_map<net::Ipv4::Address, uint64_t> arp_requests_{};
+  // The interface of the kernel that resolves neighbors, if any (see
+  // `SetKernelNeighbors').
+  std::string kernel_neighbors_ifname_{};
+  std::mutex arp_mtx_{};
   std::mutex mtx_{};
-  std::unordered_map<net::Ipv4::Address, std::vector<uint64_t>>
+  // Never modified after construction, so looked up without locking.
+  std::unordered_map<net::Ipv4::Address, std::unique_ptr<PortBitmap>>
       ipv4_port_bitmap_{};
   std::unordered_map<std::pair<net::Ipv4::Address, net::Udp::Port>, size_t,
                      hash_ip_port_pair>
       listeners_to_rxq{};
+  // The ports AF_XDP ports steer to Machnet, if any (see `SetXdpPortMap').
+  std::unique_ptr<dpdk::XdpPortMap> xdp_port_map_{nullptr};
 };
 
 /**
@@ -348,9 +588,96 @@ class MachnetEngine {
   // Slow timer (periodic processing) interval in microseconds.
   const size_t kSlowTimerIntervalUs = 1000000;  // 2ms
   const size_t kPendingRequestTimeoutSlowTicks = 3;
+  // Interval of control request polling in the main engine cycle, and the
+  // maximum number of requests served on each poll (see `Run').
+  static constexpr uint64_t kCtrlPollIntervalUs = 10;
+  static constexpr uint32_t kCtrlRequestsBudget = 8;
+  // Bytes of messages a channel of each priority class may dequeue per visit
+  // while other channels have work (see `ServeChannel').
+  static constexpr std::array<int64_t, MACHNET_PRIO_CLASSES_NR>
+      kChannelQuantum = {1 << 20, 256 << 10, 64 << 10};
+  // Maximum number of destinations the engine keeps the source ports of (see
+  // `RssPortCandidates').
+  static constexpr size_t kRssPortCandidatesMax = 64;
   // Flow creation timeout in slow ticks (# of periodic executions since
   // flow creation request).
   const size_t kFlowCreationTimeoutSlowTicks = 3;
+  // Default maximum sleep time in the adaptive idle mode (see
+  // `SetIdlePolicy').
+  static constexpr uint32_t kDefaultIdleSleepUs = 1000;
+  // Default idle time before keep-alive probes (see `SetKeepAlive').
+  static constexpr uint32_t kDefaultKeepAliveUs = 1000000;
+  // Maximum share (1/x) of a channel's buffers lent to the RX queue for
+  // zero-copy RX (see `SetRxZeroCopy').
+  static constexpr uint32_t kRxZeroCopyMaxBufsShare = 2;
+  /**
+   * @brief Load of an engine over its last slow timer interval, for the
+   * controller to place channels with (see `GetLoad').
+   */
+  struct Load {
+    // Share of the time spent in cycles that did work, in 1/1000ths.
+    uint32_t busy_permille;
+    // Packets received and sent per second.
+    uint64_t pps;
+    // Active flows.
+    size_t flows_nr;
+  };
+  /**
+   * @brief Stages of the engine cycle that its TSC cycles are accounted to
+   * (see `GetCycleStats').
+   */
+  enum Stage : size_t {
+    kStageControl = 0,  // Commands, periodic processing, control requests.
+    kStageRx,           // Receiving and processing packets.
+    kStageChannels,     // Polling channels and processing their messages.
+    kStageTx,           // Flow timers, pacing, TX flushes and app wake-ups.
+    kStageIdle,         // Polling, in cycles that found no packets/messages.
+    kStagesNr,
+  };
+  // TSC cycles spent in each stage since the engine started.
+  using CycleStats = std::array<uint64_t, kStagesNr>;
+  static const char *StageToString(Stage stage) {
+    static constexpr const char *kNames[kStagesNr] = {"control", "rx",
+                                                      "channels", "tx", "idle"};
+    return kNames[stage];
+  }
+  /**
+   * @brief Snapshot of the counters of an engine, published on every
+   * periodic processing for the control plane to export (see `GetStats').
+   * Counters are totals since the engine started.
+   */
+  struct Stats {
+    uint16_t port_id;
+    uint16_t rx_queue_id;
+    Load load;
+    CycleStats cycles;
+    uint64_t rx_packets;
+    // Over all ports, bonded ones included.
+    uint64_t tx_packets;
+    uint64_t tx_bursts;
+    uint64_t idle_sleeps;
+    // Where the engine may lose or hold back packets, to tell its drops from
+    // the NIC's (see `PmdPort::UpdatePortStats'): RX bursts that filled the
+    // batch (the RX ring holds more, i.e., the engine falls behind), TX
+    // packet allocations that failed, and TX bursts retried on a full ring.
+    uint64_t rx_full_bursts;
+    uint64_t tx_alloc_failures;
+    uint64_t tx_ring_full;
+    size_t channels_nr;
+    size_t listeners_nr;
+  };
+  /**
+   * @brief A channel on its way between two engines of the same port (see
+   * `DetachChannel'): the engine state of the channel besides its flows and
+   * listeners, which the channel itself carries.
+   */
+  struct DetachedChannel {
+    std::shared_ptr<shm::Channel> channel;
+    // Congestion control of the flows each listener of the channel accepts.
+    std::unordered_map<net::flow::Listener, net::swift::Algorithm> listener_cc;
+    // Flow creation requests of the channel waiting for ARP resolution.
+    std::vector<MachnetCtrlQueueEntry_t> pending_requests;
+  };
   MachnetEngine() = delete;
   MachnetEngine(MachnetEngine const &) = delete;
 
@@ -373,11 +700,30 @@ class MachnetEngine {
       : pmd_port_(CHECK_NOTNULL(pmd_port)),
         rxring_(pmd_port_->GetRing<dpdk::RxRing>(rx_queue_id)),
         txring_(pmd_port_->GetRing<dpdk::TxRing>(tx_queue_id)),
+        txbatch_(txring_),
         packet_pool_(CHECK_NOTNULL(txring_->GetPacketPool())),
         shared_state_(CHECK_NOTNULL(shared_state)),
         channels_(channels),
         last_periodic_timestamp_(0),
-        periodic_ticks_(0) {
+        periodic_ticks_(0),
+        rss_key_be_(pmd_port_->GetRSSKey().size(), 0),
+        rss_reta_(pmd_port_->GetRSSReta()) {
+    const size_t cmd_ring_size =
+        jring2_get_buf_ring_size(sizeof(Command *), kCommandRingSize);
+    cmd_ring_ = static_cast<jring2_t *>(
+        CHECK_NOTNULL(std::aligned_alloc(CACHELINE_SIZE, cmd_ring_size)));
+    CHECK_EQ(jring2_init(cmd_ring_, kCommandRingSize, sizeof(Command *)), 0);
+    // Keep a copy of the port's RSS key in the format `rte_softrss_be'
+    // expects, to compute flow hashes identical to the NIC's.
+    CHECK_EQ(rss_key_be_.size() % sizeof(uint32_t), 0);
+    rte_convert_rss_key(
+        reinterpret_cast<const uint32_t *>(pmd_port_->GetRSSKey().data()),
+        reinterpret_cast<uint32_t *>(rss_key_be_.data()), rss_key_be_.size());
+    if (pmd_port_->IsRxTimestampEnabled()) {
+      nic_clock_.emplace(pmd_port_->GetPortId());
+      LOG_IF(WARNING, !nic_clock_->Sync())
+          << "Failed to read the clock of port " << pmd_port_->GetPortId();
+    }
     for (const auto &[ipv4_addr, _] : shared_state_->GetIpv4PortBitmap()) {
       listeners_.emplace(
           ipv4_addr,
@@ -385,232 +731,1464 @@ class MachnetEngine {
     }
   }
 
+  ~MachnetEngine() {
+    // Take any channel buffers back from the NIC before channels go away.
+    if (rx_zerocopy_channel_ != nullptr) RxZeroCopyStop();
+    // Channels (and their flows) may outlive the engine.
+    active_flows_.ForEach([](const net::flow::Key &, uint32_t, Flow *flow) {
+      flow->SetPacer(nullptr, false);
+      flow->SetTimerWheel(nullptr);
+      flow->SetTracer(nullptr);
+      flow->SetCryptoEngine(nullptr);
+    });
+    // Drop the commands never applied; their promises break.
+    Command *cmd_ptr;
+    while (jring2_dequeue(cmd_ring_, &cmd_ptr) == 1) delete cmd_ptr;
+    std::free(cmd_ring_);
+  }
+
   /**
    * @brief Get the PMD port used by this engine.
    */
   std::shared_ptr<PmdPort> GetPmdPort() const { return pmd_port_; }
 
-  // Adds a channel to be served by this engine.
+  /**
+   * @brief Get the file descriptor of the engine's pending bitmap, to be
+   * passed to the applications of the channels this engine serves.
+   */
+  int GetPendingBitmapFd() const { return pending_bitmap_.GetFd(); }
+
+  /**
+   * @brief Adds a channel to be served by this engine.
+   *
+   * @param channel The channel.
+   * @param status  Set, on the next engine cycle, to true if the engine serves
+   *                the channel, or false if it has too many channels.
+   */
   void AddChannel(std::shared_ptr<shm::Channel> channel,
                   std::promise<bool> &&status) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    auto channel_info =
-        std::make_tuple(std::move(CHECK_NOTNULL(channel)), std::move(status));
-    channels_to_enqueue_.emplace_back(std::move(channel_info));
+    auto cmd = std::make_unique<Command>(Command::Op::kAddChannel);
+    cmd->channel = std::move(CHECK_NOTNULL(channel));
+    cmd->status = std::move(status);
+    SubmitCommand(std::move(cmd));
   }
 
-  // Removes a channel from the engine.
+  // Removes a channel from the engine, on the next engine cycle.
   void RemoveChannel(std::shared_ptr<shm::Channel> channel) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    channels_to_dequeue_.emplace_back(std::move(channel));
+    auto cmd = std::make_unique<Command>(Command::Op::kRemoveChannel);
+    cmd->channel = std::move(CHECK_NOTNULL(channel));
+    SubmitCommand(std::move(cmd));
   }
 
   /**
-   * @brief This is the main event cycle of the Machnet engine.
-   * It is called repeatedly by the main thread of the Machnet engine.
-   * On each cycle, the engine processes incoming packets in the RX queue and
-   * enqueued messages in all channels that it is responsible for.
-   * This method is not thread-safe.
+   * @brief Stops serving a channel, to move it to another engine of the same
+   * port without resetting its flows (see `AttachChannel'). The engine drops
+   * the channel's flows, listeners and steering rules, but keeps the flows
+   * open and their ports and listeners registered. Until the channel is
+   * attached again, its messages wait in its rings and the packets of its
+   * flows are dropped, to be retransmitted.
    *
-   * @param now The current TSC.
+   * @param channel The channel to detach.
+   * @param status  Set, on the next engine cycle, to the detached channel, or
+   *                to nullopt if the engine does not serve it.
    */
-  void Run(uint64_t now) {
-    // Calculate the time elapsed since the last periodic processing.
-    const auto elapsed = time::cycles_to_us(now - last_periodic_timestamp_);
-    if (elapsed >= kSlowTimerIntervalUs) {
-      // Perform periodic processing.
-      PeriodicProcess(now);
-      last_periodic_timestamp_ = now;
-    }
-
-    juggler::dpdk::PacketBatch rx_packet_batch;
-    const uint16_t nb_pkt_rx = rxring_->RecvPackets(&rx_packet_batch);
-    for (uint16_t i = 0; i < nb_pkt_rx; i++) {
-      const auto *pkt = rx_packet_batch.pkts()[i];
-      process_rx_pkt(pkt, now);
-    }
-
-    // We have processed the RX batch; release it.
-    rx_packet_batch.Release();
-
-    // Process messages from channels.
-    shm::MsgBufBatch msg_buf_batch;
-    for (auto &channel : channels_) {
-      // TODO(ilias): Revisit the number of messages to dequeue.
-      const auto nb_msg_dequeued = channel->DequeueMessages(&msg_buf_batch);
-      for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
-        auto *msg = msg_buf_batch.bufs()[i];
-        process_msg(channel.get(), msg, now);
-      }
-      // We have processed the message batch; reset it.
-      msg_buf_batch.Clear();
-    }
+  void DetachChannel(
+      std::shared_ptr<shm::Channel> channel,
+      std::promise<std::optional<DetachedChannel>> &&status) {
+    auto cmd = std::make_unique<Command>(Command::Op::kDetachChannel);
+    cmd->channel = std::move(CHECK_NOTNULL(channel));
+    cmd->detach_status = std::move(status);
+    SubmitCommand(std::move(cmd));
   }
 
   /**
-   * @brief Method to perform periodic processing. This is called by the main
-   * engine cycle (see method `Run`).
+   * @brief Starts serving a channel detached from another engine of the same
+   * port (see `DetachChannel'), flows and listeners included. The packets of
+   * the flows must land on the engine's RX queue: the engine installs flow
+   * steering rules for them, or, without flow steering, accepts the channel
+   * only if RSS already directs them to its queue (e.g., to move the channel
+   * back). The application keeps signalling the pending bitmap of the engine
+   * it attached to, so the engine polls the channel on every cycle.
    *
-   * @param now The current TSC.
+   * @param detached The detached channel.
+   * @param status   Set, on the next engine cycle, to true if the engine
+   *                 serves the channel, or false if the channel is still
+   *                 detached.
    */
-  void PeriodicProcess(uint64_t now) {
-    // Advance the periodic ticks counter.
-    ++periodic_ticks_;
-    HandleRTO();
-    DumpStatus();
-    ProcessControlRequests();
-    // Continue the rest of management tasks locked to avoid race conditions
-    // with the control plane.
-    const std::lock_guard<std::mutex> lock(mtx_);
-    // Refresh the list of active channels, if needed.
-    ChannelsUpdate();
+  void AttachChannel(DetachedChannel &&detached, std::promise<bool> &&status) {
+    auto cmd = std::make_unique<Command>(Command::Op::kAttachChannel);
+    CHECK_NOTNULL(detached.channel);
+    cmd->detached = std::move(detached);
+    cmd->status = std::move(status);
+    SubmitCommand(std::move(cmd));
   }
 
-  // Return the number of channels served by this engine.
-  size_t GetChannelCount() const { return channels_.size(); }
+  /**
+   * @brief Hands a detached channel (see `DetachChannel') over to another
+   * process on a hot restart (see `MachnetController::TakeOver'): writes its
+   * listeners, its pending flow creation requests and its established flows
+   * to `writer', for `RestoreChannel' to read back, and gives up the buffers
+   * of the flows (see `Flow::HandOff'). Flows not established are not carried
+   * over.
+   */
+  static void HandOffChannel(const DetachedChannel &detached,
+                             utils::CheckpointWriter *writer) {
+    const auto &channel = detached.channel;
+    std::vector<ListenerCheckpoint> listeners;
+    for (const auto &listener : channel->GetListeners()) {
+      const auto cc_it = detached.listener_cc.find(listener);
+      listeners.push_back({listener.addr.address.value(),
+                           listener.port.port.value(),
+                           cc_it != detached.listener_cc.end()
+                               ? static_cast<uint8_t>(cc_it->second)
+                               : UINT8_MAX});
+    }
+    writer->Put(listeners);
+    writer->Put(detached.pending_requests);
 
- protected:
-  void DumpStatus() {
-    std::string s;
-    s += "[Machnet Engine Status]";
-    s += "[PMD Port: " + std::to_string(pmd_port_->GetPortId()) +
-         ", RX_Q: " + std::to_string(rxring_->GetRingId()) +
-         ", TX_Q: " + std::to_string(txring_->GetRingId()) + "]\n";
-    s += "\tLocal L2 address:\n";
-    s += "\t\t" + pmd_port_->GetL2Addr().ToString() + "\n";
-    s += "\tLocal IPv4 addresses:\n";
-    s += "\t\t";
-    for (const auto &[addr, _] : shared_state_->GetIpv4PortBitmap()) {
-      s += addr.ToString();
-      s += ",";
+    std::vector<net::flow::FlowCheckpoint> flows;
+    for (const auto &flow : channel->GetActiveFlows()) {
+      net::flow::FlowCheckpoint cp;
+      if (flow->HandOff(&cp)) flows.emplace_back(std::move(cp));
     }
-    s += "\n";
-    s += "\tActive channels:";
-    for (const auto &channel : channels_) {
-      s += "\n\t\t";
-      s += "[" + channel->GetName() + "]" +
-           " Total buffers: " + std::to_string(channel->GetTotalBufCount()) +
-           ", Free buffers: " + std::to_string(channel->GetFreeBufCount());
+    writer->Put<uint64_t>(flows.size());
+    for (const auto &cp : flows) cp.Write(writer);
+  }
+
+  /**
+   * @brief Reads back a channel handed over by another process (see
+   * `HandOffChannel'), once mapped (see `shm::ChannelManager::MapChannel'),
+   * and restores its listeners and flows, to be attached to an engine of the
+   * port (see `AttachChannel'). Called by the control plane, before the
+   * channel is attached anywhere. Listeners whose port is taken, and flows
+   * whose state does not fit the port or the channel, are dropped.
+   *
+   * @param channel The channel, without listeners or flows.
+   * @param reader  The checkpoint, at the channel's state.
+   * @return The channel, to attach, or nullopt if the checkpoint is corrupt.
+   */
+  std::optional<DetachedChannel> RestoreChannel(
+      const std::shared_ptr<shm::Channel> &channel,
+      utils::CheckpointReader *reader) {
+    DetachedChannel restored{channel, {}, {}};
+    std::vector<ListenerCheckpoint> listeners;
+    uint64_t flows_nr;
+    if (!reader->Get(&listeners) || !reader->Get(&restored.pending_requests) ||
+        !reader->Get(&flows_nr)) {
+      return std::nullopt;
     }
-    s += "\n";
-    s += "\tARP Table:\n";
-    for (const auto &entry : shared_state_->GetArpTableEntries()) {
-      s += "\t\t" + std::get<0>(entry) + " -> " + std::get<1>(entry) + "\n";
+    std::vector<net::flow::FlowCheckpoint> flows;
+    for (uint64_t i = 0; i < flows_nr; i++) {
+      net::flow::FlowCheckpoint cp;
+      if (!cp.Read(reader)) return std::nullopt;
+      flows.emplace_back(std::move(cp));
     }
-    s += "\tListeners:\n";
-    for (const auto &listeners_for_ip : listeners_) {
-      const auto ip = listeners_for_ip.first.ToString();
-      for (const auto &listener : listeners_for_ip.second) {
-        s += "\t\t" + ip + ":" + std::to_string(listener.first.port.value()) +
-             " <-> [" + listener.second->GetName() + "]" + "\n";
+
+    for (const auto &listener : listeners) {
+      const Ipv4::Address addr(listener.addr);
+      const Udp::Port port(listener.port);
+      if (!shared_state_->RegisterListener(addr, port, rxring_->GetRingId())) {
+        LOG(WARNING) << utils::Format(
+            "Dropping listener %s:%hu of channel %s: the port is taken.",
+            addr.ToString().c_str(), listener.port,
+            channel->GetName().c_str());
+        continue;
       }
+      channel->AddListener(addr, port);
+      restored.listener_cc.emplace(net::flow::Listener(addr, port),
+                                   SelectCongestionControl(listener.cc));
     }
-    s += "\tActive flows:\n";
-    for (const auto &[key, flow_it] : active_flows_map_) {
-      s += "\t\t";
-      s += (*flow_it)->ToString();
-      s += "\n";
-    }
-    s += "\n";
-    LOG(INFO) << s;
-  }
 
-  /**
-   * @brief This method curates the list of active channels under this engine.
-   * It enqueues newly added channels to the list of active channels, and
-   * removes/destroys channels pending for removal from the list.
-   * We choose to curate the list in a separate method, so that the caller can
-   * do this operation periodically, amortising the cost of locking.
-   *
-   * @attention This method should be executed periodically at the dataplane,
-   * with the mutex held to achieve synchronization with the control plane
-   * thread.
-   */
-  void ChannelsUpdate() {
-    // TODO(ilias): For now, we assume that added channels do not carry any
-    // flows (i.e., these are newly created channels).
-    // If we want, dynamic load balancing (e.g., moving channels to different
-    // engines, we should take care of flow migrations).
-    for (auto it = channels_to_enqueue_.begin();
-         it != channels_to_enqueue_.end();
-         it = channels_to_enqueue_.erase(it)) {
-      auto &channel_info = *it;
-      const auto &channel = std::get<0>(channel_info);
-      auto &status = std::get<1>(channel_info);
-
-      channels_.emplace_back(std::move(channel));
-      status.set_value(true);
-    }
-
-    // Remove channels pending for removal.
-    for (auto &channel : channels_to_dequeue_) {
-      const auto &it =
-          std::find_if(channels_.begin(), channels_.end(),
-                       [&channel](const auto &c) { return channel == c; });
-      if (it == channels_.end()) {
-        // This channel is not in the list of active channels.
-        LOG(WARNING) << "Channel " << channel->GetName()
-                     << " is not in the list of active channels";
+    auto empty_callback = [](shm::Channel *, bool, const net::flow::Key &) {};
+    for (const auto &cp : flows) {
+      const auto &hdr = cp.hdr;
+      const Ipv4::Address local_addr(hdr.local_addr);
+      const Udp::Port local_port(hdr.local_port);
+      const auto &flow_it = channel->CreateFlow(
+          flow_slab_, local_addr, local_port, Ipv4::Address(hdr.remote_addr),
+          Udp::Port(hdr.remote_port), pmd_port_->GetL2Addr(),
+          Ethernet::Address(hdr.remote_l2_addr), &txbatch_, empty_callback,
+          SelectCongestionControl(hdr.cc));
+      if (!shared_state_->IsLocalIpv4Address(local_addr) ||
+          !(*flow_it)->Restore(cp)) {
+        LOG(WARNING) << "Dropping flow " << (*flow_it)->key().ToString()
+                     << " of channel " << channel->GetName()
+                     << ": its state does not fit.";
+        channel->RemoveFlow(flow_it);
         continue;
       }
-
-      // Remove from the engine all listeners associated with this channel.
-      const auto &channel_listeners = channel->GetListeners();
-      for (const auto &ch_listener : channel_listeners) {
-        const auto &local_ip = ch_listener.addr;
-        const auto &local_port = ch_listener.port;
-
-        if (listeners_.find(local_ip) == listeners_.end()) {
-          LOG(ERROR) << "No listeners for IP " << local_ip.ToString();
-          continue;
+      (*flow_it)->SetLatencyStats(flow_latency_stats_);
+      (*flow_it)->SetAggregation(agg_max_msg_len_, agg_hold_us_ * 1000);
+      (*flow_it)->SetAckPolicy(ack_every_n_, ack_delay_us_);
+      SetFlowPriority(channel.get(), flow_it->get());
+      // Passive flows share the port of their listener, claimed already.
+      shared_state_->SrcPortClaim(local_addr, local_port);
+      if (hdr.path_ports_local) {
+        for (const auto port : cp.path_ports) {
+          shared_state_->SrcPortClaim(local_addr, Udp::Port(port));
         }
-
-        auto &listeners_for_ip = listeners_[local_ip];
-        if (listeners_for_ip.find(local_port) == listeners_for_ip.end()) {
-          LOG(ERROR) << utils::Format("Listener not found %s:%hu",
-                                      local_ip.ToString().c_str(),
-                                      local_port.port.value());
-          continue;
-        }
-
-        shared_state_->UnregisterListener(local_ip, local_port);
-        listeners_for_ip.erase(local_port);
       }
+    }
+    LOG(INFO) << "Channel " << channel->GetName() << " restored with "
+              << channel->GetActiveFlows().size() << " flows and "
+              << channel->GetListeners().size() << " listeners.";
+    return restored;
+  }
 
-      const auto &channel_flows = channel->GetActiveFlows();
-      // Remove from the engine's map all the flows associated with this
-      // channel.
-      for (const auto &flow : channel_flows) {
-        if (active_flows_map_.find(flow->key()) != active_flows_map_.end()) {
-          shared_state_->SrcPortRelease(flow->key().local_addr,
-                                        flow->key().local_port);
-          LOG(INFO) << "Removing flow " << flow->key().ToString();
-          flow->ShutDown();
-          active_flows_map_.erase(flow->key());
-        } else {
-          LOG(WARNING) << "Flow " << flow->key().ToString()
-                       << " is not in the list of active flows";
-        }
-      }
+  /**
+   * @brief Configures the adaptive idle mode of the engine (see `IdleSleep').
+   * Must be called before the engine starts running.
+   *
+   * @param idle_polls   Number of consecutive `Run' cycles without any work
+   *                     after which the engine goes to sleep. Zero disables
+   *                     sleeping (i.e., the engine always busy-polls).
+   * @param max_sleep_us Upper bound on how long the engine sleeps before
+   *                     polling again, even if it is not woken up; rounded up
+   *                     to milliseconds.
+   * @attention The engine's PMD port must have been initialized with RX
+   * interrupts enabled.
+   */
+  void SetIdlePolicy(uint32_t idle_polls,
+                     uint32_t max_sleep_us = kDefaultIdleSleepUs) {
+    CHECK_GT(max_sleep_us, 0);
+    idle_polls_threshold_ = idle_polls;
+    idle_max_sleep_us_ = max_sleep_us;
+  }
 
-      // Finally remove the channel.
-      channels_.erase(it);
-    }
+  /**
+   * @brief Enables or disables zero-copy RX. Must be called before the engine
+   * starts running.
+   *
+   * With zero-copy RX, the packets of the engine's RX queue get buffers of a
+   * channel in place of their own, so the NIC receives data packets straight
+   * into buffers the application can read; the flow hands them over instead
+   * of copying the payload (see `RXTracking::TakeRxBuf'). The replaced
+   * buffers are topped up from the channel as packets are processed, up to
+   * `kRxZeroCopyMaxBufsShare' of its buffers.
+   *
+   * Every frame the queue receives lands in channel memory, so zero-copy RX is
+   * only active while the engine serves a single channel, whose memory is
+   * registered for DMA, and which has buffers large enough to hold a frame.
+   * Otherwise, the payload of packets is copied as usual. The RX queue is
+   * restarted whenever zero-copy RX is deactivated, to reclaim the channel
+   * buffers posted to the NIC; drivers that cannot stop a single RX queue do
+   * not support zero-copy RX.
+   *
+   * @param enable True to enable zero-copy RX.
+   */
+  void SetRxZeroCopy(bool enable) { rx_zerocopy_enabled_ = enable; }
+  bool IsRxZeroCopyEnabled() const { return rx_zerocopy_enabled_; }
 
-    channels_to_dequeue_.clear();
+  /**
+   * @brief Enables or disables hardware flow steering. Must be called before
+   * the engine starts running.
+   *
+   * With flow steering, the engine installs `rte_flow' rules that direct the
+   * packets of its listeners and of the flows it initiates to its RX queue
+   * (see `dpdk::FlowSteering'). Flows can then use any local port: connecting
+   * no longer searches for a port whose RSS hash maps to the engine's queue.
+   * If rules cannot be installed for a flow, the engine falls back to that
+   * search.
+   *
+   * @param enable True to enable flow steering.
+   * @return True if flow steering is enabled, false if it was not requested or
+   * the NIC does not support the rules needed.
+   */
+  bool SetFlowSteering(bool enable) {
+    flow_steering_.reset();
+    if (!enable) return false;
+    if (!dpdk::FlowSteering::IsSupported(pmd_port_->GetPortId(),
+                                         rxring_->GetRingId())) {
+      LOG(WARNING) << "Flow steering is not supported by port "
+                   << pmd_port_->GetPortId() << "; relying on RSS.";
+      return false;
+    }
+    flow_steering_ = std::make_unique<dpdk::FlowSteering>(
+        pmd_port_->GetPortId(), rxring_->GetRingId());
+    return true;
   }
+  bool IsFlowSteeringEnabled() const { return flow_steering_ != nullptr; }
 
   /**
-   * @brief This method polls active channels for all control plane requests and
-   * processes them.
-   * It is called periodically.
+   * @brief Bonds another port with the engine's own, active-active. Must be
+   * called before the engine starts running.
+   *
+   * The engine also polls RX queue `rx_queue_id' of `pmd_port', and spreads
+   * its flows over its TX queues on the ports whose links are up, moving them
+   * when a link goes down or comes back (see `UpdateBondLinks'). All ports
+   * send with the engine's L2 address and share its ARP table, so the switch
+   * must treat them as one link (e.g., a LAG). Since packets reach the engine
+   * on any port, the port must hash them to queues as the engine's own does.
+   *
+   * @param pmd_port    The port to bond.
+   * @param rx_queue_id RX queue of `pmd_port' to poll.
+   * @param tx_queue_id TX queue of `pmd_port' to send on.
+   * @return True if the port is bonded, false if it cannot be: flow steering
+   * or zero-copy RX is enabled, the RSS configuration or TX offloads of the
+   * port differ, or TX packets may carry channel buffers (which are only
+   * registered for DMA with the engine's own port).
    */
-  void ProcessControlRequests() {
+  bool AddPort(std::shared_ptr<PmdPort> pmd_port, uint16_t rx_queue_id,
+               uint16_t tx_queue_id) {
+    CHECK_NOTNULL(pmd_port);
+    if (flow_steering_ != nullptr || rx_zerocopy_enabled_) {
+      LOG(WARNING) << "Cannot bond port " << pmd_port->GetPortId()
+                   << " with flow steering or zero-copy RX.";
+      return false;
+    }
+    if (pmd_port->GetRSSKey() != pmd_port_->GetRSSKey() ||
+        pmd_port->GetRSSReta() != rss_reta_ ||
+        pmd_port->IsTxUsoEnabled() != pmd_port_->IsTxUsoEnabled() ||
+        !pmd_port->IsTxFastFreeEnabled() || !pmd_port_->IsTxFastFreeEnabled()) {
+      LOG(WARNING) << "Cannot bond port " << pmd_port->GetPortId()
+                   << " with port " << pmd_port_->GetPortId()
+                   << ": RSS or TX offloads differ.";
+      return false;
+    }
+    auto &port = bond_ports_.emplace_back(std::make_unique<BondPort>(
+        pmd_port, pmd_port->GetRing<dpdk::RxRing>(rx_queue_id),
+        pmd_port->GetRing<dpdk::TxRing>(tx_queue_id)));
+    port->txbatch.SetCopyEngine(txbatch_.GetCopyEngine());
+    port->txbatch.SetCryptoEngine(txbatch_.GetCryptoEngine());
+    if (pmd_port->IsRxTimestampEnabled()) {
+      port->nic_clock.emplace(pmd_port->GetPortId());
+      LOG_IF(WARNING, !port->nic_clock->Sync())
+          << "Failed to read the clock of port " << pmd_port->GetPortId();
+    }
+    LOG(INFO) << "Port " << pmd_port->GetPortId() << " bonded with port "
+              << pmd_port_->GetPortId()
+              << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    return true;
+  }
+
+  /**
+   * @brief Sets the congestion control of the flows whose application did not
+   * pick one (`MACHNET_CC_DEFAULT'). Must be called before the engine starts
+   * running.
+   *
+   * Applications select the algorithm per channel with `machnet_set_cc'; it
+   * applies to the flows the channel connects and to those accepted by the
+   * listeners it creates.
+   */
+  void SetCongestionControl(net::swift::Algorithm cc) { default_cc_ = cc; }
+  net::swift::Algorithm GetCongestionControl() const { return default_cc_; }
+
+  /**
+   * @brief Enables or disables window pacing. Must be called before the engine
+   * starts running.
+   *
+   * Flows always go through the engine's pacer when their congestion window
+   * is below one packet. With window pacing, they also spread the packets of
+   * their window over the RTT, at the rate their congestion control allows,
+   * instead of sending them at line rate (see `Flow::SetPacer').
+   *
+   * @param enable True to pace all flows.
+   */
+  void SetPacing(bool enable) { pace_window_ = enable; }
+  bool IsPacingEnabled() const { return pace_window_; }
+
+  /**
+   * @brief Sets the receive window of new flows, in packets (see
+   * `Flow::SetMaxWindow'). Must be called before the engine starts running.
+   *
+   * Windows above `Flow::kDefaultWindow' let flows on paths with a large
+   * bandwidth-delay product grow their congestion window beyond it, if the
+   * peer supports them too, at the cost of more memory per flow.
+   *
+   * @param window A power of two, from `Flow::kDefaultWindow' to
+   *               `Flow::kMaxWindow'.
+   */
+  void SetMaxWindow(uint32_t window) {
+    CHECK(window >= Flow::kDefaultWindow && window <= Flow::kMaxWindow &&
+          (window & (window - 1)) == 0)
+        << "Invalid window: " << window;
+    max_window_ = window;
+  }
+  uint32_t GetMaxWindow() const { return max_window_; }
+
+  /**
+   * @brief Lets new flows spray their packets over up to `paths_nr' paths of
+   * an ECMP fabric (see `Flow::SetMultipath'). Must be called before the
+   * engine starts running.
+   *
+   * Flows the engine initiates take `paths_nr - 1' extra source ports, which
+   * land on the RX queue of the engine like the port of the flow; flows
+   * towards listeners use as many of the paths offered as `paths_nr' allows.
+   *
+   * @param paths_nr       Number of paths, 1 (no multipath) to
+   *                       `Flow::kMaxPaths'.
+   * @param flowlet_gap_us Idle time after which a flow moves to the next
+   *                       path; zero to spray every packet.
+   */
+  void SetMultipath(size_t paths_nr, uint32_t flowlet_gap_us) {
+    CHECK(paths_nr >= 1 && paths_nr <= Flow::kMaxPaths)
+        << "Invalid number of paths: " << paths_nr;
+    paths_nr_ = paths_nr;
+    flowlet_gap_us_ = flowlet_gap_us;
+  }
+  size_t GetMultipathPathsNr() const { return paths_nr_; }
+
+  /**
+   * @brief Enables or disables early data (0-RTT) on new flows (see
+   * `Flow::SetEarlyData'). Must be called before the engine starts running.
+   *
+   * Flows the engine initiates are reported connected as soon as their SYN is
+   * sent, and send their first messages right behind it, saving the RTT of
+   * the handshake; flows towards listeners take data before the handshake
+   * completes. Peers must enable it too.
+   *
+   * @param enable True to let new flows send and take early data.
+   */
+  void SetEarlyData(bool enable) { early_data_ = enable; }
+  bool IsEarlyDataEnabled() const { return early_data_; }
+
+  /**
+   * @brief Sets how flows pack small messages into shared packets (see
+   * `Flow::SetAggregation'). Must be called before the engine starts running.
+   *
+   * @param max_msg_len Largest message packed with others, in bytes; 0
+   *                    disables aggregation.
+   * @param hold_us     Longest time the last message of a flow with data in
+   *                    flight waits for others to join it.
+   */
+  void SetAggregation(uint32_t max_msg_len, uint32_t hold_us) {
+    agg_max_msg_len_ = max_msg_len;
+    agg_hold_us_ = hold_us;
+  }
+
+  /**
+   * @brief Sets how new flows coalesce the ACKs of in-order data (see
+   * `Flow::SetAckPolicy'). Must be called before the engine starts running.
+   *
+   * @param ack_every_n  In-order data packets acknowledged by one ACK at most;
+   *                     must be positive.
+   * @param ack_delay_us Longest time an ACK is held back past the RX burst
+   *                     that called for it; 0 acknowledges every burst.
+   */
+  void SetAckPolicy(uint32_t ack_every_n, uint32_t ack_delay_us) {
+    CHECK_GT(ack_every_n, 0);
+    ack_every_n_ = ack_every_n;
+    ack_delay_us_ = ack_delay_us;
+  }
+
+  /**
+   * @brief Sets the DSCP that the packets of new flows carry, per priority
+   * class of their channel (see `Flow::SetPriority'). Must be called before
+   * the engine starts running.
+   *
+   * @param dscp DSCP of each class (`MACHNET_PRIO_*'); zero leaves the
+   *             packets of a class unmarked.
+   */
+  void SetPriorityDscp(
+      const std::array<uint8_t, MACHNET_PRIO_CLASSES_NR> &dscp) {
+    prio_dscp_ = dscp;
+  }
+
+  /**
+   * @brief Sets whether new flows keep latency histograms of their own,
+   * besides the ones of their channel (see `Flow::SetLatencyStats'). Must be
+   * called before the engine starts running.
+   */
+  void SetFlowLatencyStats(bool enable) { flow_latency_stats_ = enable; }
+
+  /**
+   * @brief Sets how flows copy payloads between message buffers and packets
+   * (see `dpdk::CopyEngine'). Must be called before the engine starts
+   * running.
+   *
+   * @param nt_threshold  Minimum size of the copies done with non-temporal
+   *                      stores, in bytes; 0 disables them.
+   * @param dma_threshold Minimum size of the TX copies offloaded to
+   *                      `dma_device', in bytes; 0 disables the offload.
+   * @param dma_device    DPDK name of the DMA device; empty for none.
+   */
+  void SetCopyOffload(size_t nt_threshold, size_t dma_threshold,
+                      const std::string &dma_device) {
+    copy_engine_.SetThresholds(nt_threshold, dma_threshold);
+    if (dma_threshold != 0 && !dma_device.empty() &&
+        !copy_engine_.AttachDmaDevice(dma_device)) {
+      LOG(WARNING) << "Copies stay on the CPU for engine @rx_q_id: "
+                   << rxring_->GetRingId();
+    }
+    // Plain copies do not need the engine.
+    if (nt_threshold == 0 && !copy_engine_.HasDmaDevice()) return;
+    txbatch_.SetCopyEngine(&copy_engine_);
+    for (auto &port : bond_ports_) port->txbatch.SetCopyEngine(&copy_engine_);
+  }
+
+  /**
+   * @brief Encrypts the data of new flows (see `Flow::SetEncryption') on a
+   * crypto device (see `dpdk::CryptoEngine'). Must be called before the
+   * engine starts running; peers must share the master key.
+   *
+   * @param master_key Key of 16 or 32 bytes, for AES-128 or AES-256.
+   * @param device     DPDK name of the crypto device of the engine.
+   * @return False if the device cannot be set up; flows would go in the
+   * clear.
+   */
+  bool SetEncryption(const std::vector<uint8_t> &master_key,
+                     const std::string &device) {
+    if (!crypto_engine_.AttachDevice(device, master_key,
+                                     sizeof(net::MachnetPktHdr))) {
+      return false;
+    }
+    txbatch_.SetCryptoEngine(&crypto_engine_);
+    for (auto &port : bond_ports_) {
+      port->txbatch.SetCryptoEngine(&crypto_engine_);
+    }
+    return true;
+  }
+  bool IsEncryptionEnabled() const { return crypto_engine_.HasDevice(); }
+
+  /**
+   * @brief Sets the idle time after which flows created with
+   * `MACHNET_CTRL_FLAG_KEEPALIVE' (e.g., by `machnet_connect_pooled') probe
+   * their peer (see `Flow::SetKeepAlive'). Must be called before the engine
+   * starts running.
+   *
+   * @param keepalive_us Idle time, in microseconds; must be positive.
+   */
+  void SetKeepAlive(uint32_t keepalive_us) {
+    CHECK_GT(keepalive_us, 0);
+    keepalive_us_ = keepalive_us;
+  }
+  uint32_t GetKeepAlive() const { return keepalive_us_; }
+
+  /**
+   * @brief Sets the size classes of smaller buffers that the channels created
+   * on the engine hold, besides the default buffers (see
+   * `MachnetChannelBufClass_t'). Messages and packet payloads that fit in a
+   * single smaller buffer take one, which spares memory and cache footprint.
+   *
+   * @param buf_classes The size classes, in increasing size.
+   */
+  void SetChannelBufClasses(
+      std::vector<MachnetChannelBufClassConf_t> buf_classes) {
+    CHECK_LT(buf_classes.size(), MACHNET_CHANNEL_BUF_CLASSES_MAX);
+    channel_buf_classes_ = std::move(buf_classes);
+  }
+  const std::vector<MachnetChannelBufClassConf_t> &GetChannelBufClasses()
+      const {
+    return channel_buf_classes_;
+  }
+
+  /**
+   * @brief Sets how far the pools of default buffers of the channels created
+   * on the engine may grow (see `ShmChannel::GrowBufPool').
+   *
+   * @param buf_segs_max    Maximum number of segments of a pool; 1 keeps
+   *                        pools fixed.
+   * @param app_max_buffers Buffers the channels of an application may grow
+   *                        by, all together; 0 for no limit.
+   */
+  void SetChannelBufPoolLimits(size_t buf_segs_max, size_t app_max_buffers) {
+    CHECK_GE(buf_segs_max, 1);
+    CHECK_LE(buf_segs_max, MACHNET_CHANNEL_BUF_SEGS_MAX);
+    channel_buf_segs_max_ = buf_segs_max;
+    app_max_buffers_ = app_max_buffers;
+  }
+  size_t GetChannelBufSegsMax() const { return channel_buf_segs_max_; }
+  size_t GetAppMaxBuffers() const { return app_max_buffers_; }
+
+  /**
+   * @brief Puts the engine to sleep, if it has been idle for long enough (see
+   * `SetIdlePolicy'). Meant to be called by the worker thread after each
+   * `Run' cycle.
+   *
+   * The engine arms the RX queue interrupt and the doorbells of all its
+   * channels, and sleeps until a packet arrives, an application enqueues to a
+   * channel, or the maximum sleep time (bounded by the next periodic
+   * processing) elapses.
+   *
+   * @param now The current TSC.
+   * @return True if the engine went to sleep, false otherwise.
+   */
+  bool IdleSleep(uint64_t now) {
+    if (idle_polls_threshold_ == 0 || idle_polls_ < idle_polls_threshold_)
+        [[likely]]
+      return false;
+    idle_polls_ = 0;
+    // Flow timers and pacing are driven by polling, and so are bonded ports.
+    if (!timer_flows_.empty() || !timers_.empty() || !pacer_.empty() ||
+        !bond_ports_.empty()) {
+      return false;
+    }
+
+    if (!rx_intr_registered_) {
+      // The interrupt must be registered from the engine's thread.
+      if (!rxring_->RegisterInterrupt()) {
+        LOG(WARNING) << "RX interrupts are not available on RX queue "
+                     << rxring_->GetRingId() << "; disabling idle sleep.";
+        idle_polls_threshold_ = 0;
+        return false;
+      }
+      rx_intr_registered_ = true;
+    }
+    for (const auto &channel : channels_) {
+      if (channel->GetDoorbellFd() < 0) continue;
+      auto [it, inserted] = doorbell_events_.try_emplace(channel.get());
+      if (!inserted) continue;
+      it->second.epdata.event = EPOLLIN;
+      if (rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD,
+                        channel->GetDoorbellFd(), &it->second) != 0) {
+        LOG(WARNING) << "Failed to add the doorbell of channel "
+                     << channel->GetName() << " to the epoll instance.";
+      }
+    }
+
+    // Arm everything, then re-check the channels: a message enqueued before
+    // the doorbell was armed does not ring it.
+    if (!rxring_->EnableInterrupt()) return false;
+    bool may_sleep = true;
+    for (const auto &channel : channels_) may_sleep &= channel->ArmDoorbell();
+
+    if (may_sleep) {
+      // Wake up in time for the next periodic processing.
+      const auto elapsed = time::cycles_to_us(now - last_periodic_timestamp_);
+      const auto until_periodic =
+          elapsed < kSlowTimerIntervalUs ? kSlowTimerIntervalUs - elapsed : 0;
+      const auto sleep_us =
+          std::min<uint64_t>(idle_max_sleep_us_, until_periodic);
+      const int timeout_ms = static_cast<int>((sleep_us + 999) / 1000);
+      if (timeout_ms > 0) {
+        struct rte_epoll_event events[kIdleEventsNr];
+        rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, kIdleEventsNr,
+                       timeout_ms);
+        idle_sleeps_++;
+      } else {
+        may_sleep = false;
+      }
+    }
+
+    for (const auto &channel : channels_) channel->DisarmDoorbell();
+    rxring_->DisableInterrupt();
+    return may_sleep;
+  }
+
+  /**
+   * @brief This is the main event cycle of the Machnet engine.
+   * It is called repeatedly by the main thread of the Machnet engine.
+   * On each cycle, the engine processes incoming packets in the RX queue and
+   * enqueued messages in all channels that it is responsible for.
+   * This method is not thread-safe.
+   *
+   * @param now The current TSC.
+   */
+  void Run(uint64_t now) {
+    // Cycle accounting: one TSC read per stage, charged to the engine's
+    // counters once, at the end of the cycle.
+    CycleStats cycles{};
+    uint64_t stage_start = now;
+    auto stage_end = [&cycles, &stage_start](Stage stage) {
+      const auto tsc = time::rdtsc();
+      cycles[stage] += tsc - stage_start;
+      stage_start = tsc;
+    };
+
+    // Apply the commands of the control plane, if any.
+    ProcessCommands();
+
+    // Calculate the time elapsed since the last periodic processing.
+    const auto elapsed = time::cycles_to_us(now - last_periodic_timestamp_);
+    if (elapsed >= kSlowTimerIntervalUs) {
+      // Perform periodic processing.
+      PeriodicProcess(now);
+      last_periodic_timestamp_ = now;
+    }
+    stage_end(kStageControl);
+
+    juggler::dpdk::PacketBatch rx_packet_batch;
+    const uint16_t nb_pkt_rx = rxring_->RecvPackets(&rx_packet_batch);
+    if (nb_pkt_rx > 0) process_rx_burst(rx_packet_batch, now, nic_clock_);
+    rx_packets_ += nb_pkt_rx;
+    if (nb_pkt_rx == dpdk::PacketBatch::kMaxBurst) rx_full_bursts_++;
+    bool idle = nb_pkt_rx == 0;
+    if (rx_zerocopy_channel_ != nullptr && nb_pkt_rx > 0) {
+      RxZeroCopyRefill(&rx_packet_batch);
+    }
+
+    // We have processed the RX batch; release it.
+    rx_packet_batch.Release();
+
+    // Poll the ports bonded with the engine's own, if any.
+    for (const auto &port : bond_ports_) {
+      const uint16_t nb_bond_rx = port->rxring->RecvPackets(&rx_packet_batch);
+      if (nb_bond_rx == 0) continue;
+      process_rx_burst(rx_packet_batch, now, port->nic_clock);
+      rx_packets_ += nb_bond_rx;
+      if (nb_bond_rx == dpdk::PacketBatch::kMaxBurst) rx_full_bursts_++;
+      idle = false;
+      rx_packet_batch.Release();
+    }
+    stage_end(kStageRx);
+
+    // Process messages from channels with pending work, the higher priority
+    // classes first (see `ServeChannel').
+    shm::MsgBufBatch msg_buf_batch;
+    size_t ready_nr = 0;
+    for (size_t w = 0; w < pending_words_nr_; w++) {
+      ready_channels_[w] |= pending_bitmap_.Collect(w) | polled_channels_[w];
+      ready_nr += std::popcount(ready_channels_[w]);
+    }
+    for (const auto &class_channels : class_channels_) {
+      for (size_t w = 0; w < pending_words_nr_; w++) {
+        const auto ready = ready_channels_[w] & class_channels[w];
+        for (auto bits = ready; bits != 0; bits &= bits - 1) {
+          const auto slot = w * 64 + __builtin_ctzll(bits);
+          idle &= !ServeChannel(slot, ready_nr > 1, now, &msg_buf_batch);
+        }
+      }
+    }
+    stage_end(kStageChannels);
+
+    // Serve control requests (e.g., flow creation) as they come, within a
+    // budget, rather than on the next periodic processing.
+    if (now >= ctrl_poll_deadline_) [[unlikely]] {
+      ProcessControlRequests(kCtrlRequestsBudget, false);
+      ctrl_poll_deadline_ = now + time::us_to_cycles(kCtrlPollIntervalUs);
+      stage_end(kStageControl);
+    }
+
+    // Fire any flow timers (delayed ACKs) that are due.
+    if (!timer_flows_.empty()) [[unlikely]] {
+      std::erase_if(timer_flows_,
+                    [now](Flow *flow) { return !flow->TimerCheck(now); });
+    }
+
+    // Handle the retransmission timeouts that are due.
+    timers_.Advance(now, [this, now](Flow *flow) { HandleRTO(flow, now); });
+
+    // Resume the paced flows that are due.
+    pacer_.Advance(now, [](Flow *flow) { flow->PacerRelease(); });
+
+    // Send everything staged for TX during this cycle.
+    txbatch_.Flush();
+    for (const auto &port : bond_ports_) port->txbatch.Flush();
+
+    // Wake up the applications waiting for messages delivered in this cycle.
+    WakeUpApps();
+
+    stage_end(kStageTx);
+
+    idle_polls_ = idle ? idle_polls_ + 1 : 0;
+    if (idle) {
+      // Whatever did not go to control work went to finding nothing to do.
+      cycles[kStageIdle] = stage_start - now - cycles[kStageControl];
+      cycles[kStageRx] = cycles[kStageChannels] = cycles[kStageTx] = 0;
+    } else {
+      busy_cycles_ += stage_start - now;
+    }
+    for (size_t i = 0; i < kStagesNr; i++) stage_cycles_[i] += cycles[i];
+  }
+
+  /**
+   * @brief Method to perform periodic processing. This is called by the main
+   * engine cycle (see method `Run`).
+   *
+   * @param now The current TSC.
+   */
+  void PeriodicProcess(uint64_t now) {
+    // Advance the periodic ticks counter.
+    ++periodic_ticks_;
+    if (nic_clock_.has_value()) nic_clock_->Sync();
+    for (const auto &port : bond_ports_) {
+      if (port->nic_clock.has_value()) port->nic_clock->Sync();
+    }
+    UpdateBondLinks();
+    UpdateLoad(now);
+    for (const auto &channel : channels_) channel->AdaptBufPool();
+    UpdateChannelClasses();
+    if (dump_status_.exchange(false, std::memory_order_relaxed)) DumpStatus();
+    if (dump_trace_.exchange(false, std::memory_order_relaxed)) DumpTrace();
+    shared_state_->AgeArpTable(txring_);
+    ProcessControlRequests(UINT32_MAX, true);
+  }
+
+  // Return the number of channels served by this engine.
+  size_t GetChannelCount() const { return channels_.size(); }
+
+  /**
+   * @brief Returns the load of the engine as of its last periodic processing.
+   * (thread-safe)
+   */
+  Load GetLoad() const { return published_stats_.Load().load; }
+
+  /**
+   * @brief Returns the TSC cycles the engine spent in each stage of its cycle
+   * (see `Stage'), as of its last periodic processing. Time spent outside the
+   * engine cycle (e.g., sleeping, or running other engines of the same worker)
+   * is not accounted. (thread-safe)
+   */
+  CycleStats GetCycleStats() const { return published_stats_.Load().cycles; }
+
+  /**
+   * @brief Returns the counters of the engine as of its last periodic
+   * processing. Never blocks the engine. (thread-safe)
+   */
+  Stats GetStats() const { return published_stats_.Load(); }
+
+  /**
+   * @brief Has the engine log its full status (channels, ARP table,
+   * listeners and flows) on its next periodic processing. That is costly
+   * with many flows, so it only happens on demand. (thread-safe, and
+   * async-signal-safe)
+   */
+  void RequestStatusDump() { dump_status_.store(true); }
+
+  /**
+   * @brief Has the engine write its trace of dataplane events (see
+   * `trace::Tracer') to `trace::kDefaultDir' on its next periodic processing,
+   * as `trace-<port>-<rx queue>.bin'. (thread-safe, and async-signal-safe)
+   */
+  void RequestTraceDump() { dump_trace_.store(true); }
+
+ protected:
+  /**
+   * @brief Wakes up the applications that wait for messages on the channels
+   * that messages have been delivered to (see `ShmChannel::WakeUpApp'). One
+   * full barrier orders all the deliveries of the cycle before the checks, and
+   * none is needed if there were no deliveries.
+   */
+  void WakeUpApps() {
+    bool fenced = false;
+    for (const auto &channel : channels_) {
+      if (!channel->HasDelivered()) continue;
+      if (!fenced) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        fenced = true;
+      }
+      channel->WakeUpApp();
+    }
+  }
+
+  /**
+   * @brief Publishes the load and the counters of the engine since the last
+   * periodic processing (see `GetLoad' and `GetStats').
+   *
+   * @param now The current TSC.
+   */
+  void UpdateLoad(uint64_t now) {
+    stats_.port_id = pmd_port_->GetPortId();
+    stats_.rx_queue_id = rxring_->GetRingId();
+    stats_.tx_packets = txbatch_.GetPacketCount();
+    stats_.tx_bursts = txbatch_.GetBurstCount();
+    stats_.tx_alloc_failures = packet_pool_->GetAllocFailures();
+    stats_.tx_ring_full = txbatch_.GetRingFullCount();
+    for (const auto &port : bond_ports_) {
+      stats_.tx_packets += port->txbatch.GetPacketCount();
+      stats_.tx_bursts += port->txbatch.GetBurstCount();
+      if (port->txbatch.GetPacketPool() != packet_pool_) {
+        stats_.tx_alloc_failures +=
+            port->txbatch.GetPacketPool()->GetAllocFailures();
+      }
+      stats_.tx_ring_full += port->txbatch.GetRingFullCount();
+    }
+    stats_.rx_full_bursts = rx_full_bursts_;
+    const uint64_t packets = rx_packets_ + stats_.tx_packets;
+    if (last_periodic_timestamp_ != 0 && now > last_periodic_timestamp_) {
+      const uint64_t window = now - last_periodic_timestamp_;
+      stats_.load.busy_permille =
+          std::min<uint64_t>(busy_cycles_ * 1000 / window, 1000);
+      stats_.load.pps = (packets - load_packets_) * time::tsc_hz / window;
+    }
+    stats_.load.flows_nr = active_flows_.size();
+    stats_.cycles = stage_cycles_;
+    stats_.rx_packets = rx_packets_;
+    stats_.idle_sleeps = idle_sleeps_;
+    stats_.channels_nr = channels_.size();
+    stats_.listeners_nr = 0;
+    for (const auto &[_, listeners] : listeners_) {
+      stats_.listeners_nr += listeners.size();
+    }
+    published_stats_.Store(stats_);
+    busy_cycles_ = 0;
+    load_packets_ = packets;
+  }
+
+  void DumpTrace() {
+    if constexpr (!trace::kEnabled) {
+      LOG(WARNING) << "Tracing is not compiled in (see MACHNET_TRACE).";
+      return;
+    }
+    const auto path = utils::Format("%s/trace-%hu-%hu.bin", trace::kDefaultDir,
+                                    pmd_port_->GetPortId(),
+                                    rxring_->GetRingId());
+    if (!tracer_.Dump(path, pmd_port_->GetPortId(), rxring_->GetRingId())) {
+      LOG(ERROR) << "Failed to write the trace to " << path;
+      return;
+    }
+    LOG(INFO) << "Wrote " << std::min<uint64_t>(tracer_.recorded(),
+                                                 tracer_.capacity())
+              << " trace records to " << path;
+  }
+
+  void DumpStatus() {
+    std::string s;
+    s += "[Machnet Engine Status]";
+    s += "[PMD Port: " + std::to_string(pmd_port_->GetPortId()) +
+         ", RX_Q: " + std::to_string(rxring_->GetRingId()) +
+         ", TX_Q: " + std::to_string(txring_->GetRingId()) + "]\n";
+    s += "\tNUMA nodes: port " + std::to_string(pmd_port_->GetNumaNode()) +
+         ", packet pool " + std::to_string(packet_pool_->GetSocketId()) + "\n";
+    s += "\tLocal L2 address:\n";
+    s += "\t\t" + pmd_port_->GetL2Addr().ToString() + "\n";
+    s += "\tTX bursts: " + std::to_string(txbatch_.GetBurstCount()) +
+         ", packets: " + std::to_string(txbatch_.GetPacketCount()) +
+         ", avg burst size: " + std::to_string(txbatch_.GetAvgBurstSize()) +
+         "\n";
+    for (const auto &port : bond_ports_) {
+      s += "\tBonded port: " + std::to_string(port->pmd_port->GetPortId()) +
+           " (RX_Q: " + std::to_string(port->rxring->GetRingId()) +
+           ", TX_Q: " + std::to_string(port->txring->GetRingId()) + "), link " +
+           (port->link_up ? "up" : "down") + ", TX packets: " +
+           std::to_string(port->txbatch.GetPacketCount()) + "\n";
+    }
+    if (txbatch_.GetCopyEngine() != nullptr) {
+      const auto &copies = copy_engine_.GetStats();
+      s += "\tCopies: inline " + std::to_string(copies.inline_nr) +
+           ", non-temporal " + std::to_string(copies.nt_nr) + ", DMA " +
+           std::to_string(copies.dma_nr) + " (ring full " +
+           std::to_string(copies.dma_full_nr) + ", errors " +
+           std::to_string(copies.dma_errors_nr) + ")\n";
+    }
+    if (crypto_engine_.HasDevice()) {
+      const auto &crypto = crypto_engine_.GetStats();
+      s += "\tEncryption: encrypted " + std::to_string(crypto.encrypted_nr) +
+           ", decrypted " + std::to_string(crypto.decrypted_nr) +
+           ", authentication failures " +
+           std::to_string(crypto.auth_failures_nr) + ", errors " +
+           std::to_string(crypto.errors_nr) + "\n";
+    }
+    s += "\tIdle sleeps: " + std::to_string(idle_sleeps_) + "\n";
+    const auto stats = GetStats();
+    s += "\tFull RX bursts: " + std::to_string(stats.rx_full_bursts) +
+         ", TX alloc failures: " + std::to_string(stats.tx_alloc_failures) +
+         ", TX ring full: " + std::to_string(stats.tx_ring_full) + "\n";
+    const auto load = GetLoad();
+    s += "\tLoad: busy " + std::to_string(load.busy_permille / 10) + "%, " +
+         std::to_string(load.pps) + " pps, " + std::to_string(load.flows_nr) +
+         " flows\n";
+    s += "\tFlow slab: " + std::to_string(flow_slab_->size()) + " of " +
+         std::to_string(flow_slab_->capacity()) + " slots of " +
+         std::to_string(net::flow::FlowSlab::SlotSize()) + " bytes\n";
+    const auto cycle_stats = GetCycleStats();
+    uint64_t total_cycles = 0;
+    for (const auto c : cycle_stats) total_cycles += c;
+    s += "\tCycles:";
+    for (size_t i = 0; i < kStagesNr; i++) {
+      s += std::string(i == 0 ? " " : ", ") +
+           StageToString(static_cast<Stage>(i)) + " " +
+           std::to_string(total_cycles == 0
+                              ? 0
+                              : cycle_stats[i] * 100 / total_cycles) +
+           "%";
+    }
+    s += "\n";
+    s += "\tLocal IPv4 addresses:\n";
+    s += "\t\t";
+    for (const auto &[addr, _] : shared_state_->GetIpv4PortBitmap()) {
+      s += addr.ToString();
+      s += ",";
+    }
+    s += "\n";
+    s += "\tActive channels:";
+    for (const auto &channel : channels_) {
+      s += "\n\t\t";
+      s += "[" + channel->GetName() + "]" +
+           " Total buffers: " + std::to_string(channel->GetTotalBufCount()) +
+           ", Free buffers: " + std::to_string(channel->GetFreeBufCount()) +
+           ", NUMA node: " +
+           (channel->GetNumaNode() == MACHNET_NUMA_NODE_ANY
+                ? std::string("any")
+                : std::to_string(channel->GetNumaNode()));
+    }
+    s += "\n";
+    s += "\tARP Table:\n";
+    for (const auto &entry : shared_state_->GetArpTableEntries()) {
+      s += "\t\t" + std::get<0>(entry) + " -> " + std::get<1>(entry) + "\n";
+    }
+    s += "\tListeners:\n";
+    for (const auto &listeners_for_ip : listeners_) {
+      const auto ip = listeners_for_ip.first.ToString();
+      for (const auto &listener : listeners_for_ip.second) {
+        s += "\t\t" + ip + ":" + std::to_string(listener.first.port.value()) +
+             " <-> [" + listener.second->GetName() + "]" + "\n";
+      }
+    }
+    s += "\tActive flows:\n";
+    active_flows_.ForEach([&s](const net::flow::Key &, uint32_t, Flow *flow) {
+      s += "\t\t";
+      s += flow->ToString();
+      s += "\n";
+    });
+    s += "\n";
+    LOG(INFO) << s;
+  }
+
+  /**
+   * @brief Submits a command to the engine, through its command ring. The
+   * engine applies it on its next cycle (see `ProcessCommands'), and never
+   * waits for the control plane: only the submitters serialize, and they wait
+   * if the ring is full.
+   */
+  void SubmitCommand(std::unique_ptr<Command> cmd) {
+    const std::lock_guard<std::mutex> lock(cmd_mtx_);
+    Command *cmd_ptr = cmd.release();
+    while (jring2_enqueue(cmd_ring_, &cmd_ptr) != 1) std::this_thread::yield();
+  }
+
+  /**
+   * @brief Applies the commands submitted by the control plane (see
+   * `SubmitCommand'), and fulfils their promises. Channels added are new, and
+   * carry no flows; channels with flows come from other engines through
+   * `AttachChannel'.
+   */
+  void ProcessCommands() {
+    Command *cmd_ptr;
+    while (jring2_dequeue(cmd_ring_, &cmd_ptr) == 1) [[unlikely]] {
+      // The command keeps its channel alive until zero-copy RX returned the
+      // channel's buffers, if it is deactivated.
+      std::unique_ptr<Command> cmd(cmd_ptr);
+      std::optional<DetachedChannel> detached;
+      switch (cmd->op) {
+        case Command::Op::kAddChannel:
+          cmd->status.set_value(ChannelAdd(cmd->channel));
+          break;
+        case Command::Op::kRemoveChannel:
+          ChannelRemove(cmd->channel);
+          break;
+        case Command::Op::kAttachChannel:
+          cmd->status.set_value(ChannelAttach(&cmd->detached));
+          break;
+        case Command::Op::kDetachChannel:
+          detached = ChannelDetach(cmd->channel);
+          break;
+      }
+      RxZeroCopyUpdate();
+      // Detached channels are handed over once their buffers are back.
+      if (cmd->op == Command::Op::kDetachChannel) {
+        cmd->detach_status.set_value(std::move(detached));
+      }
+    }
+  }
+
+  /**
+   * @brief Adds a new channel to the list of active channels.
+   *
+   * @return True on success, false if the engine has too many channels.
+   */
+  bool ChannelAdd(const std::shared_ptr<shm::Channel> &channel) {
+    const auto slot = ChannelSlotAlloc(channel.get());
+    if (!slot.has_value()) return false;
+    // Tell the application which bit of the pending bitmap is its own.
+    channel->SetPendingSlot(slot.value());
+    channels_.emplace_back(channel);
+    return true;
+  }
+
+  /**
+   * @brief Removes a channel from the list of active channels, with its
+   * listeners and flows.
+   */
+  void ChannelRemove(const std::shared_ptr<shm::Channel> &channel) {
+    const auto &it = std::find(channels_.begin(), channels_.end(), channel);
+    if (it == channels_.end()) {
+      // This channel is not in the list of active channels.
+      LOG(WARNING) << "Channel " << channel->GetName()
+                   << " is not in the list of active channels";
+      return;
+    }
+
+    // Remove from the engine all listeners associated with this channel.
+    const auto &channel_listeners = channel->GetListeners();
+    for (const auto &ch_listener : channel_listeners) {
+      const auto &local_ip = ch_listener.addr;
+      const auto &local_port = ch_listener.port;
+
+      if (listeners_.find(local_ip) == listeners_.end()) {
+        LOG(ERROR) << "No listeners for IP " << local_ip.ToString();
+        continue;
+      }
+
+      auto &listeners_for_ip = listeners_[local_ip];
+      if (listeners_for_ip.find(local_port) == listeners_for_ip.end()) {
+        LOG(ERROR) << utils::Format("Listener not found %s:%hu",
+                                    local_ip.ToString().c_str(),
+                                    local_port.port.value());
+        continue;
+      }
+
+      shared_state_->UnregisterListener(local_ip, local_port);
+      if (flow_steering_ != nullptr) {
+        flow_steering_->RemoveListener(local_ip, local_port);
+      }
+      listeners_for_ip.erase(local_port);
+      listener_cc_.erase(ch_listener);
+    }
+
+    const auto &channel_flows = channel->GetActiveFlows();
+    // Remove from the engine's map all the flows associated with this
+    // channel.
+    for (const auto &flow : channel_flows) {
+      const auto &key = flow->key();
+      if (active_flows_.Erase(key, flow_hash(key))) {
+        shared_state_->SrcPortRelease(key.local_addr, key.local_port);
+        if (flow_steering_ != nullptr) flow_steering_->RemoveFlow(key);
+        RemovePathKeys(flow.get());
+        tracer_.Record(trace::Event::kFlowRemoved, trace::FlowId(key), 0);
+        VLOG(1) << "Removing flow " << key.ToString();
+        flow->ShutDown();
+        // The channel (and the flow) may outlive the engine.
+        flow->SetPacer(nullptr, false);
+        flow->SetTimerWheel(nullptr);
+        flow->SetTracer(nullptr);
+        flow->SetCryptoEngine(nullptr);
+        std::erase(timer_flows_, flow.get());
+      } else {
+        LOG(WARNING) << "Flow " << flow->key().ToString()
+                     << " is not in the list of active flows";
+      }
+    }
+
+    ChannelSlotRelease(channel.get());
+
+    // Finally remove the channel.
+    channels_.erase(it);
+  }
+
+  /**
+   * @brief Gives a channel a slot in the pending bitmap, and polls it on every
+   * cycle until its application starts using the bitmap.
+   *
+   * @return The slot, or nullopt if the engine has too many channels.
+   */
+  std::optional<uint32_t> ChannelSlotAlloc(shm::Channel *channel) {
+    const auto slot = pending_bitmap_.AllocSlot();
+    if (!slot.has_value()) {
+      LOG(ERROR) << "Too many channels for engine @rx_q_id: "
+                 << rxring_->GetRingId();
+      return std::nullopt;
+    }
+    channel_slots_[slot.value()] = channel;
+    polled_channels_[slot.value() / 64] |= 1ULL << (slot.value() % 64);
+    SetChannelClass(slot.value(), channel->GetPriority());
+    channel_deficits_[slot.value()] = 0;
+    pending_words_nr_ = pending_bitmap_.GetActiveWordsNr();
+    return slot;
+  }
+
+  /**
+   * @brief Files the channel of a slot under a priority class.
+   */
+  void SetChannelClass(size_t slot, uint32_t prio) {
+    const auto mask = 1ULL << (slot % 64);
+    for (auto &class_channels : class_channels_) {
+      class_channels[slot / 64] &= ~mask;
+    }
+    class_channels_[prio][slot / 64] |= mask;
+    channel_prios_[slot] = prio;
+  }
+
+  /**
+   * @brief Follows the channels whose application changed their priority
+   * class (see `machnet_set_priority').
+   */
+  void UpdateChannelClasses() {
+    for (size_t slot = 0; slot < pending_words_nr_ * 64; slot++) {
+      const auto *channel = channel_slots_[slot];
+      if (channel == nullptr) continue;
+      const auto prio = channel->GetPriority();
+      if (prio != channel_prios_[slot]) SetChannelClass(slot, prio);
+    }
+  }
+
+  /**
+   * @brief Undoes `ChannelSlotAlloc', and stops waiting on the channel's
+   * doorbell.
+   */
+  void ChannelSlotRelease(shm::Channel *channel) {
+    if (auto ev = doorbell_events_.find(channel);
+        ev != doorbell_events_.end()) {
+      rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_DEL,
+                    channel->GetDoorbellFd(), &ev->second);
+      doorbell_events_.erase(ev);
+    }
+
+    const auto slot_it =
+        std::find(channel_slots_.begin(), channel_slots_.end(), channel);
+    if (slot_it == channel_slots_.end()) return;
+    const auto slot = std::distance(channel_slots_.begin(), slot_it);
+    const auto mask = 1ULL << (slot % 64);
+    ready_channels_[slot / 64] &= ~mask;
+    polled_channels_[slot / 64] &= ~mask;
+    adopted_channels_[slot / 64] &= ~mask;
+    for (auto &class_channels : class_channels_) {
+      class_channels[slot / 64] &= ~mask;
+    }
+    *slot_it = nullptr;
+    pending_bitmap_.FreeSlot(slot);
+    pending_words_nr_ = pending_bitmap_.GetActiveWordsNr();
+  }
+
+  /**
+   * @brief Detaches a channel from the engine, leaving its flows open (see
+   * `DetachChannel').
+   *
+   * @return The detached channel, or nullopt if the engine does not serve it.
+   */
+  std::optional<DetachedChannel> ChannelDetach(
+      const std::shared_ptr<shm::Channel> &channel) {
+    const auto it = std::find(channels_.begin(), channels_.end(), channel);
+    if (it == channels_.end()) {
+      LOG(WARNING) << "Channel " << channel->GetName()
+                   << " is not in the list of active channels";
+      return std::nullopt;
+    }
+
+    DetachedChannel detached{channel, {}, {}};
+    for (const auto &listener : channel->GetListeners()) {
+      if (auto cc_it = listener_cc_.find(listener);
+          cc_it != listener_cc_.end()) {
+        detached.listener_cc.emplace(listener, cc_it->second);
+        listener_cc_.erase(cc_it);
+      }
+      if (flow_steering_ != nullptr) {
+        flow_steering_->RemoveListener(listener.addr, listener.port);
+      }
+      if (auto ip_it = listeners_.find(listener.addr);
+          ip_it != listeners_.end()) {
+        ip_it->second.erase(listener.port);
+      }
+    }
+
+    for (const auto &flow : channel->GetActiveFlows()) {
+      const auto &key = flow->key();
+      active_flows_.Erase(key, flow_hash(key));
+      for (const auto &path_key : flow->GetPathKeys()) {
+        if (active_flows_.Find(path_key, flow_hash(path_key)) != flow.get())
+          continue;
+        active_flows_.Erase(path_key, flow_hash(path_key));
+        if (flow_steering_ != nullptr) flow_steering_->RemoveFlow(path_key);
+      }
+      if (flow_steering_ != nullptr) flow_steering_->RemoveFlow(key);
+      flow->SetPacer(nullptr, false);
+      flow->SetTimerWheel(nullptr);
+      flow->SetTracer(nullptr);
+      flow->SetCryptoEngine(nullptr);
+      std::erase(timer_flows_, flow.get());
+    }
+
+    for (auto req_it = pending_requests_.begin();
+         req_it != pending_requests_.end();) {
+      if (std::get<2>(*req_it) != channel) {
+        ++req_it;
+        continue;
+      }
+      detached.pending_requests.emplace_back(std::get<1>(*req_it));
+      req_it = pending_requests_.erase(req_it);
+    }
+
+    ChannelSlotRelease(channel.get());
+    channels_.erase(it);
+    LOG(INFO) << "Channel " << channel->GetName() << " detached with "
+              << channel->GetActiveFlows().size()
+              << " flows (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    return detached;
+  }
+
+  /**
+   * @brief Makes the incoming packets of a flow land on the engine's RX
+   * queue: with a flow steering rule, or, without flow steering, only if RSS
+   * puts them there already.
+   */
+  bool SteerFlow(const net::flow::Key &key) {
+    if (flow_steering_ != nullptr) return flow_steering_->AddFlow(key);
+    return IsRssLocal(flow_hash(key));
+  }
+
+  /**
+   * @brief Attaches a detached channel to the engine, with its flows and
+   * listeners (see `AttachChannel'). Nothing changes on failure.
+   *
+   * @return True on success, false otherwise.
+   */
+  bool ChannelAttach(DetachedChannel *detached) {
+    const auto &channel = detached->channel;
+    // Steer everything first, as this is what can fail.
+    std::vector<net::flow::Key> steered_keys;
+    std::vector<net::flow::Listener> steered_listeners;
+    auto steer_all = [&]() {
+      for (const auto &listener : channel->GetListeners()) {
+        if (flow_steering_ == nullptr) break;
+        if (!flow_steering_->AddListener(listener.addr, listener.port))
+          return false;
+        steered_listeners.emplace_back(listener);
+      }
+      for (const auto &flow : channel->GetActiveFlows()) {
+        if (!SteerFlow(flow->key())) return false;
+        steered_keys.emplace_back(flow->key());
+        for (const auto &key : flow->GetPathKeys()) {
+          if (key.local_port == flow->key().local_port) continue;
+          if (!SteerFlow(key)) return false;
+          steered_keys.emplace_back(key);
+        }
+      }
+      return true;
+    };
+    std::optional<uint32_t> slot;
+    if (steer_all()) slot = ChannelSlotAlloc(channel.get());
+    if (!slot.has_value()) {
+      LOG(ERROR) << "Cannot attach channel " << channel->GetName()
+                 << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+      if (flow_steering_ == nullptr) return false;
+      for (const auto &key : steered_keys) flow_steering_->RemoveFlow(key);
+      for (const auto &listener : steered_listeners) {
+        flow_steering_->RemoveListener(listener.addr, listener.port);
+      }
+      return false;
+    }
+    // The application sets its pending bit in the bitmap of another engine.
+    adopted_channels_[slot.value() / 64] |= 1ULL << (slot.value() % 64);
+
+    for (const auto &listener : channel->GetListeners()) {
+      listeners_[listener.addr].insert_or_assign(listener.port, channel);
+    }
+    for (const auto &[listener, cc] : detached->listener_cc) {
+      listener_cc_.insert_or_assign(listener, cc);
+    }
+    for (const auto &flow : channel->GetActiveFlows()) {
+      const auto &key = flow->key();
+      CHECK(active_flows_.Insert(key, flow_hash(key), flow.get()));
+      InsertPathKeys(flow.get());
+      flow->SetEngine(TxBatchFor(key), &pacer_, pace_window_, &timers_,
+                      &tracer_);
+      // Let the flow re-arm its delayed ACK timer, if any.
+      timer_flows_.emplace_back(flow.get());
+    }
+    for (const auto &req : detached->pending_requests) {
+      pending_requests_.emplace_back(periodic_ticks_, req, channel);
+    }
+
+    channels_.emplace_back(channel);
+    LOG(INFO) << "Channel " << channel->GetName() << " attached with "
+              << channel->GetActiveFlows().size()
+              << " flows (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    return true;
+  }
+
+  /**
+   * @brief Activates or deactivates zero-copy RX (see `SetRxZeroCopy') to
+   * reflect the current set of channels.
+   */
+  void RxZeroCopyUpdate() {
+    shm::Channel *channel = nullptr;
+    if (rx_zerocopy_enabled_ && channels_.size() == 1 &&
+        channels_.front()->IsDMARegistered()) {
+      channel = channels_.front().get();
+    }
+    if (channel == rx_zerocopy_channel_) return;
+    if (rx_zerocopy_channel_ != nullptr) RxZeroCopyStop();
+    if (channel != nullptr) RxZeroCopyStart(channel);
+  }
+
+  void RxZeroCopyStart(shm::Channel *channel) {
+    auto *pool = rxring_->GetPacketPool();
+    const auto kMinBufSize = pool->GetPacketDataRoomSize();
+    if (channel->GetMsgBuf(0)->size() < kMinBufSize) {
+      LOG(WARNING) << "Buffers of channel " << channel->GetName()
+                   << " are too small for zero-copy RX (need " << kMinBufSize
+                   << " bytes)";
+      rx_zerocopy_enabled_ = false;
+      return;
+    }
+    // Deactivation depends on restarting the queue; make sure it works.
+    if (!rxring_->Stop() || !rxring_->Start()) {
+      LOG(WARNING) << "Cannot restart RX queue " << rxring_->GetRingId()
+                   << "; disabling zero-copy RX.";
+      rx_zerocopy_enabled_ = false;
+      return;
+    }
+    LOG(INFO) << "Zero-copy RX into channel " << channel->GetName()
+              << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    rx_zerocopy_channel_ = channel;
+    rx_zerocopy_bufs_max_ =
+        std::min(pool->Capacity(),
+                 channel->GetTotalBufCount() / kRxZeroCopyMaxBufsShare);
+    rx_zerocopy_bufs_nr_ = 0;
+  }
+
+  void RxZeroCopyStop() {
+    auto *channel = rx_zerocopy_channel_;
+    // Stopping the queue gets all its packets back in the pool.
+    CHECK(rxring_->Stop()) << "Failed to stop RX queue "
+                           << rxring_->GetRingId();
+    std::pair<shm::Channel *, uint32_t> arg{channel, 0};
+    rte_mempool_obj_iter(
+        rxring_->GetPacketPool()->GetMemPool(),
+        [](rte_mempool *, void *opaque, void *obj, unsigned int) {
+          auto *arg =
+              static_cast<std::pair<shm::Channel *, uint32_t> *>(opaque);
+          auto *pkt = static_cast<juggler::dpdk::Packet *>(obj);
+          auto *msg_buf = arg->first->GetMsgBufByBase(pkt->buf_addr());
+          if (msg_buf == nullptr) return;
+          arg->first->MsgBufFree(msg_buf);
+          juggler::dpdk::Packet::Reset(pkt);
+          arg->second++;
+        },
+        &arg);
+    LOG_IF(WARNING, arg.second != rx_zerocopy_bufs_nr_)
+        << "Reclaimed " << arg.second << " zero-copy RX buffers, expected "
+        << rx_zerocopy_bufs_nr_;
+    CHECK(rxring_->Start()) << "Failed to restart RX queue "
+                            << rxring_->GetRingId();
+    LOG(INFO) << "Zero-copy RX into channel " << channel->GetName()
+              << " stopped (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+    rx_zerocopy_channel_ = nullptr;
+    rx_zerocopy_bufs_nr_ = 0;
+  }
+
+  /**
+   * @brief Gives channel buffers to received packets that still have their
+   * own, before they are released, so that the NIC receives into channel
+   * memory from now on.
+   *
+   * @param batch The processed burst of received packets.
+   */
+  void RxZeroCopyRefill(juggler::dpdk::PacketBatch *batch) {
+    auto *channel = rx_zerocopy_channel_;
+    for (uint16_t i = 0; i < batch->GetSize(); i++) {
+      if (rx_zerocopy_bufs_nr_ == rx_zerocopy_bufs_max_) return;
+      auto *pkt = batch->pkts()[i];
+      if (channel->GetMsgBufByBase(pkt->buf_addr()) != nullptr) continue;
+      auto *msg_buf = channel->MsgBufAlloc();
+      if (msg_buf == nullptr) return;
+      pkt->set_buf(msg_buf->base(), msg_buf->iova(), msg_buf->size());
+      rx_zerocopy_bufs_nr_++;
+    }
+  }
+
+  /**
+   * @brief This method polls active channels for control plane requests and
+   * processes them, and completes the flow creation requests whose L2 address
+   * got resolved.
+   * It is called on every main engine cycle, with a budget, and periodically
+   * without one.
+   *
+   * @param budget      Maximum number of requests to dequeue; channels take
+   *                    turns to be polled first.
+   * @param arp_request Whether to (re)issue ARP requests for unresolved L2
+   *                    addresses (periodically), or only look them up in the
+   *                    cache.
+   */
+  void ProcessControlRequests(uint32_t budget, bool arp_request) {
     MachnetCtrlQueueEntry_t reqs[MACHNET_CHANNEL_CTRL_SQ_SLOT_NR];
-    for (const auto &channel : channels_) {
+    const size_t channels_nr = channels_.size();
+    for (size_t c = 0; c < channels_nr && budget != 0; c++) {
+      const auto &channel = channels_[(ctrl_poll_first_ + c) % channels_nr];
       // Peek the control SQ.
-      const auto nreqs =
-          channel->DequeueCtrlRequests(reqs, MACHNET_CHANNEL_CTRL_SQ_SLOT_NR);
+      const auto nreqs = channel->DequeueCtrlRequests(
+          reqs, std::min<uint32_t>(budget, MACHNET_CHANNEL_CTRL_SQ_SLOT_NR));
+      budget -= nreqs;
       for (auto i = 0u; i < nreqs; i++) {
         const auto &req = reqs[i];
         auto emit_completion = [&req, &channel](bool success) {
@@ -637,6 +2215,9 @@ class MachnetEngine {
               LOG(INFO) << "Request to create flow " << src_addr.ToString()
                         << " -> "
                         << dst_addr.ToString() << ":" << dst_port.port.value();
+              // Issue an ARP request now if needed; the flow is created below
+              // as soon as the L2 address is known.
+              ResolveL2Addr(src_addr, dst_addr, true);
               pending_requests_.emplace_back(periodic_ticks_, req, channel);
             }
             break;
@@ -672,7 +2253,17 @@ class MachnetEngine {
                 break;
               }
 
+              if (flow_steering_ != nullptr &&
+                  !flow_steering_->AddListener(local_ip, local_port)) {
+                shared_state_->UnregisterListener(local_ip, local_port);
+                emit_completion(false);
+                break;
+              }
+
               listeners_on_ip.emplace(local_port, channel);
+              listener_cc_.insert_or_assign(
+                  net::flow::Listener(local_ip, local_port),
+                  SelectCongestionControl(req.cc));
               channel->AddListener(local_ip, local_port);
               emit_completion(true);
             }
@@ -685,6 +2276,8 @@ class MachnetEngine {
       }
     }
 
+    ctrl_poll_first_++;
+
     for (auto it = pending_requests_.begin(); it != pending_requests_.end();) {
       const auto &[timestamp_, req, channel] = *it;
       if (periodic_ticks_ - timestamp_ > kPendingRequestTimeoutSlowTicks) {
@@ -700,7 +2293,7 @@ class MachnetEngine {
       const Udp::Port dst_port(req.flow_info.dst_port);
 
       auto remote_l2_addr =
-          shared_state_->GetL2Addr(txring_, src_addr, dst_addr);
+          ResolveL2Addr(src_addr, dst_addr, arp_request);
       if (!remote_l2_addr.has_value()) {
         // L2 address has not been resolved yet.
         it++;
@@ -708,52 +2301,23 @@ class MachnetEngine {
       }
 
       // L2 address has been resolved. Allocate a source port.
-      auto rss_lambda = [src_addr, dst_addr, dst_port,
-                         rss_key = pmd_port_->GetRSSKey(), pmd_port = pmd_port_,
-                         rx_queue_id =
-                             rxring_->GetRingId()](uint16_t port) -> bool {
-        rte_thash_tuple ipv4_l3_l4_tuple;
-        ipv4_l3_l4_tuple.v4.src_addr = src_addr.address.value();
-        ipv4_l3_l4_tuple.v4.dst_addr = dst_addr.address.value();
-        ipv4_l3_l4_tuple.v4.sport = port;
-        ipv4_l3_l4_tuple.v4.dport = dst_port.port.value();
-
-        rte_thash_tuple reversed_ipv4_l3_l4_tuple;
-        reversed_ipv4_l3_l4_tuple.v4.src_addr = dst_addr.address.value();
-        reversed_ipv4_l3_l4_tuple.v4.dst_addr = src_addr.address.value();
-        reversed_ipv4_l3_l4_tuple.v4.sport = dst_port.port.value();
-        reversed_ipv4_l3_l4_tuple.v4.dport = port;
-
-        auto rss_hash =
-            rte_softrss(reinterpret_cast<uint32_t *>(&ipv4_l3_l4_tuple),
-                        RTE_THASH_V4_L4_LEN, rss_key.data());
-        auto reversed_rss_hash = rte_softrss(
-            reinterpret_cast<uint32_t *>(&reversed_ipv4_l3_l4_tuple),
-            RTE_THASH_V4_L4_LEN, rss_key.data());
-        if (pmd_port->GetRSSRxQueue(reversed_rss_hash) != rx_queue_id) {
-          return false;
-        }
-
-        if (pmd_port->GetRSSRxQueue(__builtin_bswap32(reversed_rss_hash)) !=
-            rx_queue_id) {
-          return false;
-        }
-
-        LOG(INFO) << "RSS hash for " << src_addr.ToString() << ":" << port
-                  << " -> " << dst_addr.ToString() << ":"
-                  << dst_port.port.value() << " is " << rss_hash
-                  << " and reversed " << reversed_rss_hash
-                  << " (queue: " << rx_queue_id << ")";
-
-        return true;
+      const auto &rss_ports = RssPortCandidates(src_addr, dst_addr, dst_port);
+      auto key_of = [src_addr, dst_addr, dst_port](const Udp::Port &port) {
+        return net::flow::Key(src_addr, port, dst_addr, dst_port);
       };
-
-      auto src_port = shared_state_->SrcPortAlloc(src_addr, rss_lambda);
+      const auto src_port = AllocFlowPort(src_addr, rss_ports, key_of);
       if (!src_port.has_value()) {
         LOG(ERROR) << "Cannot allocate source port for " << src_addr.ToString();
         it = pending_requests_.erase(it);
         continue;
       }
+      // Multipath: the ports of the other paths, as many as available.
+      std::vector<Udp::Port> path_ports;
+      while (path_ports.size() + 1 < paths_nr_) {
+        const auto port = AllocFlowPort(src_addr, rss_ports, key_of);
+        if (!port.has_value()) break;
+        path_ports.emplace_back(port.value());
+      }
 
       auto application_callback = [req_id = req.id](
                                       shm::Channel *channel, bool success,
@@ -770,208 +2334,619 @@ class MachnetEngine {
         channel->EnqueueCtrlCompletions(&resp, 1);
       };
       const auto &flow_it =
-          channel->CreateFlow(src_addr, src_port.value(), dst_addr, dst_port,
-                              pmd_port_->GetL2Addr(), remote_l2_addr.value(),
-                              txring_, application_callback);
+          channel->CreateFlow(flow_slab_, src_addr, src_port.value(), dst_addr,
+                              dst_port, pmd_port_->GetL2Addr(),
+                              remote_l2_addr.value(), &txbatch_,
+                              application_callback,
+                              SelectCongestionControl(req.cc));
+      (*flow_it)->SetTxBatch(TxBatchFor((*flow_it)->key()));
+      (*flow_it)->SetPacer(&pacer_, pace_window_);
+      (*flow_it)->SetTimerWheel(&timers_);
+      (*flow_it)->SetTracer(&tracer_);
+      (*flow_it)->SetMaxWindow(max_window_);
+      (*flow_it)->SetMultipath(paths_nr_, flowlet_gap_us_ * 1000,
+                               std::move(path_ports));
+      (*flow_it)->SetEarlyData(early_data_);
+      (*flow_it)->SetAggregation(agg_max_msg_len_, agg_hold_us_ * 1000);
+      (*flow_it)->SetAckPolicy(ack_every_n_, ack_delay_us_);
+      (*flow_it)->SetEncryption(txbatch_.GetCryptoEngine());
+      (*flow_it)->SetLatencyStats(flow_latency_stats_);
+      SetFlowPriority(channel.get(), flow_it->get());
+      if (req.flags & MACHNET_CTRL_FLAG_KEEPALIVE) {
+        (*flow_it)->SetKeepAlive(keepalive_us_ * 1000);
+      }
       (*flow_it)->InitiateHandshake();
-      active_flows_map_.emplace((*flow_it)->key(), flow_it);
+      const auto &key = (*flow_it)->key();
+      CHECK(active_flows_.Insert(key, flow_hash(key), flow_it->get()));
+      InsertPathKeys(flow_it->get());
       it = pending_requests_.erase(it);
     }
   }
 
   /**
-   * @brief Iterate throught the list of flows, check and handle RTOs.
+   * @brief The congestion control of a flow, given the `MACHNET_CC_*' value
+   * of the control request that creates it.
    */
-  void HandleRTO() {
-    for (auto it = active_flows_map_.begin(); it != active_flows_map_.end();) {
-      const auto &flow_it = it->second;
-      auto is_active_flow = (*flow_it)->PeriodicCheck();
-      if (!is_active_flow) {
-        LOG(INFO) << "Flow " << (*flow_it)->key().ToString()
-                  << " is no longer active. Removing.";
-        auto channel = (*flow_it)->channel();
-        shared_state_->SrcPortRelease((*flow_it)->key().local_addr,
-                                      (*flow_it)->key().local_port);
-        channel->RemoveFlow(flow_it);
-        it = active_flows_map_.erase(it);
-        continue;
+  net::swift::Algorithm SelectCongestionControl(uint16_t cc) const {
+    switch (cc) {
+      case MACHNET_CC_SWIFT:
+      case MACHNET_CC_ECN:
+      case MACHNET_CC_FIXED:
+        return static_cast<net::swift::Algorithm>(cc);
+      default:
+        return default_cc_;
+    }
+  }
+
+  /**
+   * @brief Puts a new flow in the priority class of its channel.
+   */
+  void SetFlowPriority(const shm::Channel *channel, Flow *flow) const {
+    const auto prio = channel->GetPriority();
+    flow->SetPriority(prio, prio_dscp_[prio]);
+  }
+
+  /**
+   * @brief Handles the expiry of the timer of a flow (see `Flow::RtoCheck'),
+   * and removes the flow if it is no longer active.
+   */
+  void HandleRTO(Flow *flow, uint64_t now) {
+    if (flow->RtoCheck(now)) return;
+    // Copy the key: removing the flow destroys it.
+    const auto key = flow->key();
+    tracer_.Record(trace::Event::kFlowRemoved, trace::FlowId(key), 0);
+    VLOG(1) << "Flow " << key.ToString() << " is no longer active. Removing.";
+    auto channel = flow->channel();
+    if (flow->IsKeptAlive()) {
+      // Tell the application, which may hold on to the flow for reuse.
+      MachnetCtrlQueueEntry_t notice = {};
+      notice.opcode = MACHNET_CTRL_OP_FLOW_CLOSED;
+      notice.flow_info.src_ip = key.local_addr.address.value();
+      notice.flow_info.src_port = key.local_port.port.value();
+      notice.flow_info.dst_ip = key.remote_addr.address.value();
+      notice.flow_info.dst_port = key.remote_port.port.value();
+      channel->EnqueueCtrlCompletions(&notice, 1);
+    }
+    shared_state_->SrcPortRelease(key.local_addr, key.local_port);
+    if (flow_steering_ != nullptr) flow_steering_->RemoveFlow(key);
+    active_flows_.Erase(key, flow_hash(key));
+    RemovePathKeys(flow);
+    std::erase(timer_flows_, flow);
+    channel->RemoveFlow(flow);
+  }
+
+  /**
+   * @brief Allocates a source port for a flow from `src_addr', as `AddFlow'
+   * would need it: one a flow steering rule is installed for, if available,
+   * or one of `rss_ports' (i.e., that lands on the RX queue of the engine).
+   *
+   * @param rss_ports The ports RSS puts the flow on the engine's RX queue with
+   *                  (see `RssPortCandidates').
+   * @param key_of    A callable that returns the key of the flow, given a port.
+   */
+  std::optional<Udp::Port> AllocFlowPort(const Ipv4::Address &src_addr,
+                                         const std::vector<uint64_t> &rss_ports,
+                                         auto &&key_of) {
+    // With flow steering any port will do, provided a rule can be installed
+    // for the flow.
+    std::optional<Udp::Port> src_port;
+    if (flow_steering_ != nullptr) {
+      src_port =
+          shared_state_->SrcPortAlloc(src_addr, [](uint16_t) { return true; });
+      if (src_port.has_value() &&
+          !flow_steering_->AddFlow(key_of(src_port.value()))) {
+        shared_state_->SrcPortRelease(src_addr, src_port.value());
+        src_port.reset();
       }
-      ++it;
     }
+    if (!src_port.has_value()) {
+      src_port = shared_state_->SrcPortAlloc(src_addr, rss_ports);
+    }
+    return src_port;
   }
 
   /**
-   * @brief Process an incoming packet.
+   * @brief Looks up the MAC address of `target_ip' in the engine's copy of the
+   * ARP table, lock-free unless the shared table changed since the copy was
+   * taken (see `MachnetEngineSharedState::GetArpVersion').
    *
-   * @param pkt Pointer to the packet.
-   * @param now TSC timestamp.
+   * @param local_ip  The local IP address to send an ARP request from.
+   * @param target_ip The IP address to resolve.
+   * @param request   Whether to issue an ARP request if the address is
+   *                  unknown; the reply is picked up by a later lookup.
    */
-  void process_rx_pkt(const juggler::dpdk::Packet *pkt, uint64_t now) {
-    // Sanity ethernet header check.
-    if (pkt->length() < sizeof(Ethernet)) [[unlikely]]
-      return;
+  std::optional<net::Ethernet::Address> ResolveL2Addr(
+      const Ipv4::Address &local_ip, const Ipv4::Address &target_ip,
+      bool request) {
+    if (shared_state_->GetArpVersion() != arp_version_) [[unlikely]] {
+      std::tie(arp_version_, arp_table_) = shared_state_->GetArpTable();
+    }
+    if (auto it = arp_table_.find(target_ip); it != arp_table_.end()) {
+      return it->second;
+    }
+    if (request) shared_state_->RequestL2Addr(txring_, local_ip, target_ip);
+    return std::nullopt;
+  }
 
-    auto *eh = pkt->head_data<Ethernet *>();
-    switch (eh->eth_type.value()) {
-      // clang-format off
-      case Ethernet::kArp:
-        {
+  /**
+   * @brief Returns whether RSS puts the packets with the given hash on the
+   * engine's RX queue, in either byte order the NIC may use for the hash.
+   * Without an indirection table, all packets land on RX queue 0.
+   */
+  bool IsRssLocal(uint32_t hash) const {
+    const auto rx_queue_id = rxring_->GetRingId();
+    if (rss_reta_.empty()) return rx_queue_id == 0;
+    const auto mask = rss_reta_.size() - 1;
+    return rss_reta_[hash & mask] == rx_queue_id &&
+           rss_reta_[__builtin_bswap32(hash) & mask] == rx_queue_id;
+  }
+
+  /**
+   * @brief Returns the bitmap of the source ports that, from `src_addr', put
+   * the flows to `dst_addr:dst_port' on the engine's RX queue (see
+   * `MachnetEngineSharedState::SrcPortAlloc'). The bitmaps are computed once
+   * per destination, with one hash (see
+   * `MachnetEngineSharedState::GetRssPortHashes'), and kept for the
+   * `kRssPortCandidatesMax' latest destinations.
+   *
+   * @attention The bitmap is valid until the next call.
+   */
+  const std::vector<uint64_t> &RssPortCandidates(const Ipv4::Address &src_addr,
+                                                 const Ipv4::Address &dst_addr,
+                                                 const Udp::Port &dst_port) {
+    constexpr size_t bits_per_slot = sizeof(uint64_t) * 8;
+    const net::flow::Key destination(src_addr, Udp::Port(0), dst_addr,
+                                     dst_port);
+    if (auto it = rss_port_candidates_.find(destination);
+        it != rss_port_candidates_.end()) {
+      return it->second;
+    }
+    if (rss_port_candidates_.size() >= kRssPortCandidatesMax) {
+      rss_port_candidates_.clear();
+    }
+
+    std::vector<uint64_t> candidates(
+        MachnetEngineSharedState::kSrcPortBitmapSize, 0);
+    const auto &port_hashes = shared_state_->GetRssPortHashes();
+    // The hash of the incoming packets of the flows with local port 0.
+    const auto hash = port_hashes.empty() ? 0 : flow_hash(destination);
+    for (size_t port = MachnetEngineSharedState::kSrcPortMin;
+         port <= MachnetEngineSharedState::kSrcPortMax; port++) {
+      const bool local = port_hashes.empty()
+                             ? rss_reta_.empty() && rxring_->GetRingId() == 0
+                             : IsRssLocal(hash ^ port_hashes[port]);
+      if (local) {
+        candidates[port / bits_per_slot] |= 1ULL << (port % bits_per_slot);
+      }
+    }
+    return rss_port_candidates_.emplace(destination, std::move(candidates))
+        .first->second;
+  }
+
+  /**
+   * @brief Makes the paths of a multipath flow beyond the first find the flow
+   * (see `Flow::GetPathKeys').
+   */
+  void InsertPathKeys(Flow *flow) {
+    for (const auto &key : flow->GetPathKeys()) {
+      if (!active_flows_.Insert(key, flow_hash(key), flow)) {
+        LOG(WARNING) << "Path " << key.ToString() << " of flow "
+                     << flow->key().ToString() << " is taken already";
+      }
+    }
+  }
+
+  /**
+   * @brief Undoes `InsertPathKeys', releasing the source ports the engine
+   * allocated for the paths, if any.
+   */
+  void RemovePathKeys(Flow *flow) {
+    for (const auto &key : flow->GetPathKeys()) {
+      if (active_flows_.Find(key, flow_hash(key)) != flow) continue;
+      active_flows_.Erase(key, flow_hash(key));
+      if (key.local_port == flow->key().local_port) continue;
+      shared_state_->SrcPortRelease(key.local_addr, key.local_port);
+      if (flow_steering_ != nullptr) flow_steering_->RemoveFlow(key);
+    }
+  }
+
+  /**
+   * @brief Picks the port a flow sends on (see `AddPort'): one of the ports
+   * whose links are up, by the flow's hash, so that flows spread over the bond
+   * and keep their port as long as links do not change. The low bits of the
+   * hash select the engine's RX queue, so the high ones select the port.
+   */
+  dpdk::TxBatch *TxBatchFor(const net::flow::Key &key) {
+    if (bond_ports_.empty()) [[likely]]
+      return &txbatch_;
+    size_t up_nr = link_up_ ? 1 : 0;
+    for (const auto &port : bond_ports_) up_nr += port->link_up ? 1 : 0;
+    if (up_nr == 0) return &txbatch_;
+    size_t n = (flow_hash(key) >> 16) % up_nr;
+    if (link_up_) {
+      if (n == 0) return &txbatch_;
+      n--;
+    }
+    for (const auto &port : bond_ports_) {
+      if (!port->link_up) continue;
+      if (n == 0) return &port->txbatch;
+      n--;
+    }
+    return &txbatch_;
+  }
+
+  /**
+   * @brief Checks the links of the bonded ports, if any, and moves the flows
+   * to the ports whose links are up when one changes.
+   */
+  void UpdateBondLinks() {
+    if (bond_ports_.empty()) return;
+    bool changed = false;
+    auto check_link = [&changed](const PmdPort &pmd_port, bool *link_up) {
+      const bool up = pmd_port.IsLinkUp();
+      if (up == *link_up) return;
+      LOG(WARNING) << "Link of port " << pmd_port.GetPortId() << " is "
+                   << (up ? "up" : "down");
+      *link_up = up;
+      changed = true;
+    };
+    check_link(*pmd_port_, &link_up_);
+    for (const auto &port : bond_ports_) {
+      check_link(*port->pmd_port, &port->link_up);
+    }
+    if (!changed) return;
+    active_flows_.ForEach([this](const net::flow::Key &, uint32_t, Flow *flow) {
+      flow->SetTxBatch(TxBatchFor(flow->key()));
+    });
+  }
+
+  /**
+   * @brief Computes the hash used to index a flow in the flow table. This is
+   * the Toeplitz hash the NIC computes over the 4-tuple of an incoming packet
+   * of the flow (i.e., remote to local direction).
+   */
+  uint32_t flow_hash(const net::flow::Key &key) const {
+    rte_thash_tuple tuple;
+    tuple.v4.src_addr = key.remote_addr.address.value();
+    tuple.v4.dst_addr = key.local_addr.address.value();
+    tuple.v4.sport = key.remote_port.port.value();
+    tuple.v4.dport = key.local_port.port.value();
+    return rte_softrss_be(reinterpret_cast<uint32_t *>(&tuple),
+                          RTE_THASH_V4_L4_LEN, rss_key_be_.data());
+  }
+
+  /**
+   * @brief Returns the hash to look up the flow of an incoming packet with: the
+   * RSS hash computed by the NIC when available, the software hash otherwise.
+   */
+  uint32_t rx_flow_hash(const juggler::dpdk::Packet *pkt,
+                        const net::flow::Key &key) const {
+    if (rss_hash_offload_ok_ && pkt->has_rss_hash()) [[likely]]
+      return pkt->rss_hash();
+    return flow_hash(key);
+  }
+
+  /**
+   * @brief Looks up the flow an incoming packet belongs to.
+   *
+   * @param pkt  Pointer to the packet.
+   * @param key  The flow key, as derived from the packet's headers.
+   * @param hash The hash returned by `rx_flow_hash' for this packet.
+   * @return A pointer to the flow, or nullptr if there is no such flow.
+   */
+  Flow *find_rx_flow(const juggler::dpdk::Packet *pkt,
+                     const net::flow::Key &key, uint32_t hash) {
+    auto *flow = active_flows_.Find(key, hash);
+    if (flow != nullptr) [[likely]]
+      return flow;
+
+    // On a miss with the NIC-provided hash, retry with the software one (e.g.,
+    // for the first packets of flows we initiated).
+    if (!rss_hash_offload_ok_ || !pkt->has_rss_hash()) return nullptr;
+    const auto sw_hash = flow_hash(key);
+    if (sw_hash == hash) return nullptr;
+    flow = active_flows_.Find(key, sw_hash);
+    if (flow != nullptr) [[unlikely]] {
+      // Some PMDs do not report the Toeplitz hash as we compute it (e.g., a
+      // different byte order). Stop trusting the NIC-provided hash.
+      tracer_.Record(trace::Event::kRssHashMismatch, trace::FlowId(key),
+                     sw_hash, hash);
+      LOG(WARNING) << "NIC RSS hash (" << hash
+                   << ") differs from the software hash (" << sw_hash
+                   << "). Falling back to software flow hashing.";
+      rss_hash_offload_ok_ = false;
+    }
+    return flow;
+  }
+
+  /**
+   * @brief Process a burst of incoming packets.
+   *
+   * The burst is processed in stages; each stage is applied to all packets
+   * before moving on to the next one, so that the memory accesses of a stage
+   * overlap across packets instead of stalling on each one in turn:
+   *  1. Prefetch the headers of all packets.
+   *  2. Validate and classify packets. ARP and ICMP packets are handled here
+   *     and leave the pipeline, and so do malformed or unsupported ones.
+   *     Machnet packets get their flow hash computed and the relevant flow
+   *     table group prefetched.
+   *  3. Look up the flows of all Machnet packets.
+   *  4. Group packets by flow, preserving arrival order, and hand each group
+   *     to its flow in one call. Packets that do not belong to an active flow
+   *     (e.g., SYNs towards a listener) take the slow path.
+   *
+   * @param batch     The burst of received packets.
+   * @param now       TSC of this Run() cycle; flows, including those that the
+   *                  burst creates, time their delayed ACKs from it.
+   * @param nic_clock Clock of the port the burst came from, if any.
+   */
+  void process_rx_burst(const juggler::dpdk::PacketBatch &batch, uint64_t now,
+                        const std::optional<dpdk::NicClock> &nic_clock) {
+    using PacketBatch = juggler::dpdk::PacketBatch;
+    constexpr size_t kMachnetHdrsLen = sizeof(Ethernet) + sizeof(Ipv4) +
+                                       sizeof(Udp) + sizeof(net::MachnetPktHdr);
+    const auto nb_pkts = batch.GetSize();
+    const auto *pkts = batch.pkts();
+
+    // Stage 1: Prefetch. All headers up to the Machnet one span two lines.
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      const auto *hdrs = pkts[i]->head_data<const uint8_t *>();
+      __builtin_prefetch(hdrs);
+      __builtin_prefetch(hdrs + hardware_constructive_interference_size);
+    }
+
+    // Stage 2: Validate and classify.
+    juggler::dpdk::Packet *flow_pkts[PacketBatch::kMaxBurst];
+    uint32_t flow_hashes[PacketBatch::kMaxBurst];
+    uint16_t nb_flow_pkts = 0;
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      auto *pkt = pkts[i];
+      if (pkt->length() < sizeof(Ethernet)) [[unlikely]]
+        continue;
+
+      const auto *eh = pkt->head_data<Ethernet *>();
+      if (eh->eth_type.value() != Ethernet::kIpv4) [[unlikely]] {
+        if (eh->eth_type.value() == Ethernet::kArp) {
           auto *arph = pkt->head_data<Arp *>(sizeof(*eh));
           shared_state_->ProcessArpPacket(txring_, arph);
         }
-      // clang-format on
-      break;
-        // clang-format off
-      [[likely]] case Ethernet::kIpv4:
-          process_rx_ipv4(pkt, now);
-        break;
-      // clang-format on
-      case Ethernet::kIpv6:
         // We do not support IPv6 yet.
-        break;
-      default:
-        break;
+        continue;
+      }
+
+      if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4)) [[unlikely]]
+        continue;
+      const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+      // Check ivp4 header length.
+      // clang-format off
+      if (pkt->length() != sizeof(Ethernet) + ipv4h->total_length.value()) [[unlikely]] { // NOLINT
+        // clang-format on
+        tracer_.Record(trace::Event::kDropIpv4Length, 0, 0,
+                       ipv4h->total_length.value());
+        VLOG(1) << "IPv4 packet length mismatch (expected: "
+                << ipv4h->total_length.value() << ", actual: " << pkt->length()
+                << ")";
+        continue;
+      }
+
+      if (ipv4h->next_proto_id != Ipv4::kUdp) [[unlikely]] {
+        if (ipv4h->next_proto_id == Ipv4::kIcmp) {
+          process_rx_icmp(pkt);
+        } else {
+          tracer_.Record(trace::Event::kDropIpProtocol, 0, 0,
+                         ipv4h->next_proto_id);
+          VLOG(1) << "Unsupported IP protocol: "
+                  << static_cast<uint32_t>(ipv4h->next_proto_id);
+        }
+        continue;
+      }
+
+      if (pkt->length() < kMachnetHdrsLen) [[unlikely]]
+        continue;
+      // Flows take RX timestamps in TSC.
+      if (pkt->has_rx_timestamp()) {
+        if (nic_clock.has_value() && nic_clock->IsSynced()) {
+          pkt->set_rx_timestamp(nic_clock->ToTsc(pkt->rx_timestamp()));
+        } else {
+          pkt->clear_rx_timestamp();
+        }
+      }
+      const auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+      const net::flow::Key pkt_key(ipv4h->dst_addr, udph->dst_port,
+                                   ipv4h->src_addr, udph->src_port);
+      const auto hash = rx_flow_hash(pkt, pkt_key);
+      active_flows_.Prefetch(hash);
+      flow_pkts[nb_flow_pkts] = pkt;
+      flow_hashes[nb_flow_pkts] = hash;
+      nb_flow_pkts++;
+    }
+
+    // Stage 3: Flow lookup.
+    Flow *flows[PacketBatch::kMaxBurst];
+    for (uint16_t i = 0; i < nb_flow_pkts; i++) {
+      const auto *pkt = flow_pkts[i];
+      flows[i] = find_rx_flow(pkt, rx_pkt_key(pkt), flow_hashes[i]);
+    }
+
+    // Stage 4: Group by flow and deliver.
+    juggler::dpdk::Packet *group[PacketBatch::kMaxBurst];
+    bool delivered[PacketBatch::kMaxBurst] = {};
+    for (uint16_t i = 0; i < nb_flow_pkts; i++) {
+      if (delivered[i]) continue;
+      auto *flow = flows[i];
+      if (flow == nullptr) [[unlikely]] {
+        process_rx_new_flow(flow_pkts[i], now);
+        continue;
+      }
+
+      uint16_t group_size = 0;
+      for (uint16_t j = i; j < nb_flow_pkts; j++) {
+        if (delivered[j] || flows[j] != flow) continue;
+        group[group_size++] = flow_pkts[j];
+        delivered[j] = true;
+      }
+      if (flow->InputPackets(group, group_size, now)) [[unlikely]]
+        timer_flows_.emplace_back(flow);
     }
   }
 
-  void process_rx_ipv4(const juggler::dpdk::Packet *pkt, uint64_t now) {
-    // Sanity ipv4 header check.
-    if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4)) [[unlikely]]
-      return;
+  /**
+   * @brief Derives the flow key of an incoming (validated) Machnet packet.
+   */
+  static net::flow::Key rx_pkt_key(const juggler::dpdk::Packet *pkt) {
+    const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+    const auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    return net::flow::Key(ipv4h->dst_addr, udph->dst_port, ipv4h->src_addr,
+                          udph->src_port);
+  }
 
+  /**
+   * @brief Slow path for incoming Machnet packets whose flow was not found in
+   * the flow table. If there is a listener on the destination and the packet
+   * is a SYN, a new flow is created.
+   *
+   * @param pkt Pointer to the (validated) packet.
+   * @param now TSC timestamp.
+   */
+  void process_rx_new_flow(juggler::dpdk::Packet *pkt, uint64_t now) {
     const auto *eh = pkt->head_data<Ethernet *>();
     const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
     const auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    const auto pkt_key = rx_pkt_key(pkt);
 
-    const net::flow::Key pkt_key(ipv4h->dst_addr, udph->dst_port,
-                                 ipv4h->src_addr, udph->src_port);
-    // Check ivp4 header length.
-    // clang-format off
-    if (pkt->length() != sizeof(Ethernet) + ipv4h->total_length.value()) [[unlikely]] { // NOLINT
-      // clang-format on
-      LOG(WARNING) << "IPv4 packet length mismatch (expected: "
-                   << ipv4h->total_length.value()
-                   << ", actual: " << pkt->length() << ")";
+    // An earlier packet of the same burst may have created the flow.
+    if (auto *flow = find_rx_flow(pkt, pkt_key, rx_flow_hash(pkt, pkt_key));
+        flow != nullptr) {
+      if (flow->InputPackets(&pkt, 1, now))
+        timer_flows_.emplace_back(flow);
       return;
     }
 
-    switch (ipv4h->next_proto_id) {
-      // clang-format off
-      [[likely]] case Ipv4::kUdp:
-          // clang-format on
-          if (active_flows_map_.find(pkt_key) != active_flows_map_.end()) {
-        const auto &flow_it = active_flows_map_[pkt_key];
-        (*flow_it)->InputPacket(pkt);
-        return;
-      }
+    // If we reach here, it means that the packet does not belong to any
+    // active flow.
+    // Check if there is a listener on this port.
+    const auto &local_ipv4_addr = ipv4h->dst_addr;
+    const auto &local_udp_port = udph->dst_port;
+    if (listeners_.find(local_ipv4_addr) == listeners_.end()) return;
+
+    // We have a listener on this port.
+    const auto &listeners_on_ip = listeners_[local_ipv4_addr];
+    if (listeners_on_ip.find(local_udp_port) == listeners_on_ip.end()) {
+      tracer_.Record(trace::Event::kDropNoListener, trace::FlowId(pkt_key), 0,
+                     pkt->rss_hash());
+      VLOG(1) << "Dropping packet with RSS hash: " << pkt->rss_hash()
+              << " (be: " << __builtin_bswap32(pkt->rss_hash()) << ")"
+              << " because there is no listener on port "
+              << local_udp_port.port.value()
+              << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
+      return;
+    }
 
-      {
-        // If we reach here, it means that the packet does not belong to any
-        // active flow.
-        // Check if there is a listener on this port.
-        const auto &local_ipv4_addr = ipv4h->dst_addr;
-        const auto &local_udp_port = udph->dst_port;
-        if (listeners_.find(local_ipv4_addr) != listeners_.end()) {
-          // We have a listener on this port.
-          const auto &listeners_on_ip = listeners_[local_ipv4_addr];
-          if (listeners_on_ip.find(local_udp_port) == listeners_on_ip.end()) {
-            LOG(INFO) << "Dropping packet with RSS hash: " << pkt->rss_hash()
-                      << " (be: " << __builtin_bswap32(pkt->rss_hash()) << ")"
-                      << " because there is no listener on port "
-                      << local_udp_port.port.value()
-                      << " (engine @rx_q_id: " << rxring_->GetRingId() << ")";
-            return;
-          }
-
-          // Create a new flow.
-          const auto &channel = listeners_on_ip.at(local_udp_port);
-          const auto &remote_ipv4_addr = ipv4h->src_addr;
-          const auto &remote_udp_port = udph->src_port;
-
-          // Check if it is a SYN packet.
-          const auto *machneth = pkt->head_data<net::MachnetPktHdr *>(
-              sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
-          if (machneth->net_flags != net::MachnetPktHdr::MachnetFlags::kSyn) {
-            LOG(WARNING) << "Received a non-SYN packet on a listening port";
-            break;
-          }
-
-          auto empty_callback = [](shm::Channel *, bool,
-                                   const net::flow::Key &) {};
-          const auto &flow_it = channel->CreateFlow(
-              local_ipv4_addr, local_udp_port, remote_ipv4_addr,
-              remote_udp_port, pmd_port_->GetL2Addr(), eh->src_addr, txring_,
-              empty_callback);
-          active_flows_map_.insert({pkt_key, flow_it});
-
-          // Handle the incoming packet.
-          (*flow_it)->InputPacket(pkt);
-        }
-      }
+    // Create a new flow.
+    const auto &channel = listeners_on_ip.at(local_udp_port);
+    const auto &remote_ipv4_addr = ipv4h->src_addr;
+    const auto &remote_udp_port = udph->src_port;
+
+    // Check if it is a SYN packet.
+    const auto *machneth = pkt->head_data<net::MachnetPktHdr *>(
+        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
+    if (machneth->net_flags != net::MachnetPktHdr::MachnetFlags::kSyn) {
+      tracer_.Record(trace::Event::kDropNotSyn, trace::FlowId(pkt_key),
+                     machneth->seqno.value(),
+                     static_cast<uint32_t>(machneth->net_flags));
+      VLOG(1) << "Received a non-SYN packet on a listening port";
+      return;
+    }
 
-      break;
-      // clang-format off
-      case Ipv4::kIcmp:
-      {
-        if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp))
-          [[unlikely]] return;
-
-        const auto *icmph =
-            pkt->head_data<Icmp *>(sizeof(Ethernet) + sizeof(Ipv4));
-        // Only process ICMP echo requests.
-        if (icmph->type != Icmp::kEchoRequest) [[unlikely]] return;
-
-        // Allocate and construct a new packet for the response, instead of
-        // in-place modification.
-        // If `FAST_FREE' is enabled it's unsafe to use packets from different
-        // pools (the driver may put them in the wrong pool on reclaim).
-        auto *response = CHECK_NOTNULL(packet_pool_->PacketAlloc());
-        auto *response_eh = response->append<Ethernet *>(pkt->length());
-        response_eh->dst_addr = eh->src_addr;
-        response_eh->src_addr = pmd_port_->GetL2Addr();
-        response_eh->eth_type = be16_t(Ethernet::kIpv4);
-        response->set_l2_len(sizeof(*response_eh));
-        auto *response_ipv4h = reinterpret_cast<Ipv4 *>(response_eh + 1);
-        response_ipv4h->version_ihl = 0x45;
-        response_ipv4h->type_of_service = 0;
-        response_ipv4h->packet_id = be16_t(0x1513);
-        response_ipv4h->fragment_offset = be16_t(0);
-        response_ipv4h->time_to_live = 64;
-        response_ipv4h->next_proto_id = Ipv4::Proto::kIcmp;
-        response_ipv4h->total_length = be16_t(pkt->length() - sizeof(Ethernet));
-        response_ipv4h->src_addr = ipv4h->dst_addr;
-        response_ipv4h->dst_addr = ipv4h->src_addr;
-        response_ipv4h->hdr_checksum = 0;
-        response->set_l3_len(sizeof(*response_ipv4h));
-        response->offload_ipv4_csum();
-        auto *response_icmph = reinterpret_cast<Icmp *>(response_ipv4h + 1);
-        response_icmph->type = Icmp::kEchoReply;
-        response_icmph->code = Icmp::kCodeZero;
-        response_icmph->cksum = 0;
-        response_icmph->id = icmph->id;
-        response_icmph->seq = icmph->seq;
-
-        auto *response_data = reinterpret_cast<uint8_t *>(response_icmph + 1);
-        const auto *request_data =
-            reinterpret_cast<const uint8_t *>(icmph + 1);
-        utils::Copy(
-            response_data, request_data,
-            pkt->length() - sizeof(Ethernet) - sizeof(Ipv4) - sizeof(Icmp));
-        response_icmph->cksum = utils::ComputeChecksum16(
-            reinterpret_cast<const uint8_t *>(response_icmph),
-            pkt->length() - sizeof(Ethernet) - sizeof(Ipv4));
-
-        auto nsent = txring_->TrySendPackets(&response, 1);
-        LOG_IF(WARNING, nsent != 1) << "Failed to send ICMP echo reply";
-      }
-      // clang-format on
+    auto empty_callback = [](shm::Channel *, bool, const net::flow::Key &) {};
+    const auto cc_it =
+        listener_cc_.find(net::flow::Listener(local_ipv4_addr, local_udp_port));
+    const auto cc = cc_it != listener_cc_.end() ? cc_it->second : default_cc_;
+    const auto &flow_it = channel->CreateFlow(
+        flow_slab_, local_ipv4_addr, local_udp_port, remote_ipv4_addr,
+        remote_udp_port, pmd_port_->GetL2Addr(), eh->src_addr, &txbatch_,
+        empty_callback, cc);
+    (*flow_it)->SetTxBatch(TxBatchFor(pkt_key));
+    (*flow_it)->SetPacer(&pacer_, pace_window_);
+    (*flow_it)->SetTimerWheel(&timers_);
+    (*flow_it)->SetTracer(&tracer_);
+    (*flow_it)->SetMaxWindow(max_window_);
+    (*flow_it)->SetMultipath(paths_nr_, flowlet_gap_us_ * 1000);
+    (*flow_it)->SetEarlyData(early_data_);
+    (*flow_it)->SetAggregation(agg_max_msg_len_, agg_hold_us_ * 1000);
+    (*flow_it)->SetAckPolicy(ack_every_n_, ack_delay_us_);
+    (*flow_it)->SetEncryption(txbatch_.GetCryptoEngine());
+    (*flow_it)->SetLatencyStats(flow_latency_stats_);
+    SetFlowPriority(channel.get(), flow_it->get());
+    CHECK(active_flows_.Insert(pkt_key, flow_hash(pkt_key), flow_it->get()));
+
+    // Handle the incoming packet; the SYN tells the paths of the flow.
+    if ((*flow_it)->InputPacket(pkt, now))
+      timer_flows_.emplace_back(flow_it->get());
+    InsertPathKeys(flow_it->get());
+  }
 
-      break;
-      default:
-        LOG(WARNING) << "Unsupported IP protocol: "
-                     << static_cast<uint32_t>(ipv4h->next_proto_id);
-        break;
-    }
+  /**
+   * @brief Process an incoming ICMP packet; only echo requests are answered.
+   *
+   * @param pkt Pointer to the packet (with valid Ethernet and IPv4 headers).
+   */
+  void process_rx_icmp(const juggler::dpdk::Packet *pkt) {
+    if (pkt->length() < sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Icmp))
+      [[unlikely]] return;
+
+    const auto *eh = pkt->head_data<Ethernet *>();
+    const auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+    const auto *icmph = pkt->head_data<Icmp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    // Only process ICMP echo requests.
+    if (icmph->type != Icmp::kEchoRequest) [[unlikely]] return;
+
+    // Allocate and construct a new packet for the response, instead of
+    // in-place modification.
+    // If `FAST_FREE' is enabled it's unsafe to use packets from different
+    // pools (the driver may put them in the wrong pool on reclaim).
+    auto *response = CHECK_NOTNULL(packet_pool_->PacketAlloc());
+    auto *response_eh = response->append<Ethernet *>(pkt->length());
+    response_eh->dst_addr = eh->src_addr;
+    response_eh->src_addr = pmd_port_->GetL2Addr();
+    response_eh->eth_type = be16_t(Ethernet::kIpv4);
+    response->set_l2_len(sizeof(*response_eh));
+    auto *response_ipv4h = reinterpret_cast<Ipv4 *>(response_eh + 1);
+    response_ipv4h->version_ihl = 0x45;
+    response_ipv4h->type_of_service = 0;
+    response_ipv4h->packet_id = be16_t(0x1513);
+    response_ipv4h->fragment_offset = be16_t(0);
+    response_ipv4h->time_to_live = 64;
+    response_ipv4h->next_proto_id = Ipv4::Proto::kIcmp;
+    response_ipv4h->total_length = be16_t(pkt->length() - sizeof(Ethernet));
+    response_ipv4h->src_addr = ipv4h->dst_addr;
+    response_ipv4h->dst_addr = ipv4h->src_addr;
+    response_ipv4h->hdr_checksum = 0;
+    response->set_l3_len(sizeof(*response_ipv4h));
+    response->offload_ipv4_csum();
+    auto *response_icmph = reinterpret_cast<Icmp *>(response_ipv4h + 1);
+    response_icmph->type = Icmp::kEchoReply;
+    response_icmph->code = Icmp::kCodeZero;
+    response_icmph->cksum = 0;
+    response_icmph->id = icmph->id;
+    response_icmph->seq = icmph->seq;
+
+    auto *response_data = reinterpret_cast<uint8_t *>(response_icmph + 1);
+    const auto *request_data =
+        reinterpret_cast<const uint8_t *>(icmph + 1);
+    utils::Copy(
+        response_data, request_data,
+        pkt->length() - sizeof(Ethernet) - sizeof(Ipv4) - sizeof(Icmp));
+    // The reply differs from the request only in its type, so its checksum
+    // is updated rather than recomputed over the payload (RFC 1624).
+    uint16_t request_word, response_word;
+    std::memcpy(&request_word, icmph, sizeof(request_word));
+    std::memcpy(&response_word, response_icmph, sizeof(response_word));
+    response_icmph->cksum =
+        utils::ChecksumUpdate16(icmph->cksum, request_word, response_word);
+
+    // Replies are best-effort: drop them rather than wait for a full TX ring.
+    txbatch_.TryAppend(response);
   }
 
   /**
@@ -980,45 +2955,143 @@ class MachnetEngine {
    * @param msg     A pointer to the `MsgBuf` containing the first buffer of the
    *                message.
    */
-  void process_msg(const shm::Channel *channel, shm::MsgBuf *msg,
-                   uint64_t now) {
+  void process_msg(shm::Channel *channel, shm::MsgBuf *msg, uint64_t now) {
     const auto *flow_info = msg->flow();
     const net::flow::Key msg_key(flow_info->src_ip, flow_info->src_port,
                                  flow_info->dst_ip, flow_info->dst_port);
-    if (active_flows_map_.find(msg_key) == active_flows_map_.end()) {
+    auto *flow = active_flows_.Find(msg_key, flow_hash(msg_key));
+    if (flow == nullptr) [[unlikely]] {
+      tracer_.Record(trace::Event::kDropMsgNoFlow, trace::FlowId(msg_key), 0,
+                     msg->msg_length());
       LOG(ERROR) << "Message received for a non-existing flow! "
                  << utils::Format("(Channel: %s, 5-tuple hash: %lu, Flow: %s)",
                                   channel->GetName().c_str(),
                                   std::hash<net::flow::Key>{}(msg_key),
                                   msg_key.ToString().c_str());
+      if (msg->flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY) {
+        const auto completion =
+            net::flow::TxCompletion(msg, MACHNET_TX_COMPL_DROPPED);
+        channel->PostTxCompletions(&completion, 1);
+      }
       return;
     }
-    const auto &flow_it = active_flows_map_[msg_key];
-    (*flow_it)->OutputMessage(msg);
+    if (flow->OutputMessage(msg)) [[unlikely]]
+      timer_flows_.emplace_back(flow);
+  }
+
+  /**
+   * @brief Dequeues a batch of messages from a channel with pending work, and
+   * hands them to their flows.
+   *
+   * The channels of a priority class share the engine in deficit round robin:
+   * every visit credits a channel with the quantum of its class (see
+   * `kChannelQuantum'), and every message dequeued debits it by its length.
+   * While other channels have work too, a channel that overdrew its credit,
+   * e.g., with a large message, sits out visits until it has paid back; the
+   * channels thus get bytes in proportion to the quanta of their classes,
+   * whatever the size of their messages. A channel alone with work is always
+   * served.
+   *
+   * @param slot      Slot of the channel in `pending_bitmap_'.
+   * @param contended Whether other channels have pending work too.
+   * @param now       Current TSC.
+   * @param batch     Empty batch to dequeue messages into; left empty.
+   * @return Whether the channel had messages, served or held back.
+   */
+  bool ServeChannel(size_t slot, bool contended, uint64_t now,
+                    shm::MsgBufBatch *batch) {
+    const auto w = slot / 64;
+    const auto mask = 1ULL << (slot % 64);
+    auto *channel = channel_slots_[slot];
+    auto &deficit = channel_deficits_[slot];
+    // Credit does not build up beyond a quantum.
+    const int64_t quantum = kChannelQuantum[channel_prios_[slot]];
+    deficit = std::min(deficit + quantum, quantum);
+    if (deficit <= 0 && contended) return true;
+
+    // TODO(ilias): Revisit the number of messages to dequeue.
+    const auto nb_msg_dequeued = channel->DequeueMessages(batch);
+    for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
+      auto *msg = batch->bufs()[i];
+      deficit -= msg->msg_length();
+      process_msg(channel, msg, now);
+    }
+    // Keep the channel ready until its ring is drained; a drained channel
+    // keeps its debt, but not its credit.
+    if (batch->GetRoom() != 0) {
+      ready_channels_[w] &= ~mask;
+      deficit = std::min<int64_t>(deficit, 0);
+    }
+    batch->Clear();
+    if ((polled_channels_[w] & mask) && !(adopted_channels_[w] & mask) &&
+        channel->UsesPendingBitmap()) {
+      // From now on the application sets the channel's pending bit.
+      polled_channels_[w] &= ~mask;
+    }
+    return nb_msg_dequeued != 0;
   }
 
  private:
-  using channel_info =
-      std::tuple<std::shared_ptr<shm::Channel>, std::promise<bool>>;
   using flow_info =
       std::tuple<uint64_t, Ipv4::Address, Udp::Port, Ipv4::Address, Udp::Port,
                  std::shared_ptr<shm::Channel>, std::promise<bool>>;
   using listener_info =
       std::tuple<Ipv4::Address, Udp::Port, std::shared_ptr<shm::Channel>,
                  std::promise<bool>>;
+  // A listener of a channel handed over (see `HandOffChannel').
+  struct ListenerCheckpoint {
+    uint32_t addr;  // Host byte order.
+    uint16_t port;
+    uint8_t cc;  // `MACHNET_CC_*' value; the default if unknown.
+  };
+  // A command of the control plane to the engine (see `SubmitCommand').
+  struct Command {
+    enum class Op {
+      kAddChannel,
+      kRemoveChannel,
+      kDetachChannel,
+      kAttachChannel,
+    };
+    explicit Command(Op op) : op(op) {}
+    const Op op;
+    // The channel of add, remove and detach commands.
+    std::shared_ptr<shm::Channel> channel{nullptr};
+    // The channel of attach commands.
+    DetachedChannel detached{};
+    // The outcome of add and attach commands.
+    std::promise<bool> status{};
+    // The outcome of detach commands.
+    std::promise<std::optional<DetachedChannel>> detach_status{};
+  };
+  static_assert(static_cast<uint16_t>(net::swift::Algorithm::kSwift) ==
+                MACHNET_CC_SWIFT);
+  static_assert(static_cast<uint16_t>(net::swift::Algorithm::kEcn) ==
+                MACHNET_CC_ECN);
+  static_assert(static_cast<uint16_t>(net::swift::Algorithm::kFixedWindow) ==
+                MACHNET_CC_FIXED);
   static const size_t kSrcPortMin = (1 << 10);      // 1024
   static const size_t kSrcPortMax = (1 << 16) - 1;  // 65535
   static constexpr size_t kSrcPortBitmapSize =
       ((kSrcPortMax - kSrcPortMin + 1) + sizeof(uint64_t) - 1) /
       sizeof(uint64_t);
-  // A mutex to synchronize control plane operations.
-  std::mutex mtx_;
+  // Commands of the control plane (see `SubmitCommand'): the SPSC ring of
+  // `Command' pointers, and the mutex that serializes submitters.
+  static constexpr uint32_t kCommandRingSize = 64;
+  jring2_t *cmd_ring_{nullptr};
+  std::mutex cmd_mtx_;
   // A shared pointer to the PmdPort instance.
   std::shared_ptr<PmdPort> pmd_port_;
   // Designated RX queue for this engine (not shared).
   juggler::dpdk::RxRing *rxring_;
   // Designated TX queue for this engine (not shared).
   juggler::dpdk::TxRing *txring_;
+  // Copies of payloads (see `SetCopyOffload'); must outlive the TX batches,
+  // which wait for its copies when flushed.
+  dpdk::CopyEngine copy_engine_{};
+  // Encryption of flows (see `SetEncryption'); likewise.
+  dpdk::CryptoEngine crypto_engine_{};
+  // Staging batch for all packets sent on `txring_' during one `Run' cycle.
+  juggler::dpdk::TxBatch txbatch_;
   // The following packet pool is used for all TX packets; should not be shared
   // with other engines/threads.
   dpdk::PacketPool *packet_pool_;
@@ -1030,6 +3103,10 @@ class MachnetEngine {
   std::vector<std::shared_ptr<shm::Channel>> channels_;
   // Timestamp of last periodic process execution.
   uint64_t last_periodic_timestamp_{0};
+  // Next control request polling in the main engine cycle, and the channel to
+  // poll first (see `ProcessControlRequests').
+  uint64_t ctrl_poll_deadline_{0};
+  size_t ctrl_poll_first_{0};
   // Clock ticks for the slow timer.
   uint64_t periodic_ticks_{0};
   // Listeners for incoming packets.
@@ -1037,14 +3114,146 @@ class MachnetEngine {
       Ipv4::Address,
       std::unordered_map<Udp::Port, std::shared_ptr<shm::Channel>>>
       listeners_{};
-  // Unordered map of active flows.
-  std::unordered_map<net::flow::Key,
-                     const std::list<std::unique_ptr<Flow>>::const_iterator>
-      active_flows_map_{};
-  // Vector of channels to be added to the list of active channels.
-  std::vector<channel_info> channels_to_enqueue_{};
-  // Vector of channels to be removed from the list of active channels.
-  std::vector<std::shared_ptr<shm::Channel>> channels_to_dequeue_{};
+  // Congestion control of the flows each listener accepts.
+  std::unordered_map<net::flow::Listener, net::swift::Algorithm>
+      listener_cc_{};
+  // Congestion control of flows that do not select one.
+  net::swift::Algorithm default_cc_{net::swift::Algorithm::kSwift};
+  // Port RSS key, converted for `rte_softrss_be'.
+  std::vector<uint8_t> rss_key_be_;
+  // The RX queue of each RSS hash bucket of the port (see
+  // `PmdPort::GetRSSReta').
+  const std::vector<uint16_t> rss_reta_;
+  // The engine's copy of the shared ARP table, and its version (see
+  // `ResolveL2Addr').
+  uint64_t arp_version_{0};
+  std::unordered_map<Ipv4::Address, net::Ethernet::Address> arp_table_{};
+  // The source ports that put flows on the engine's RX queue, per destination
+  // (see `RssPortCandidates').
+  std::unordered_map<net::flow::Key, std::vector<uint64_t>>
+      rss_port_candidates_{};
+  // Whether the RSS hash reported by the NIC matches `flow_hash'.
+  bool rss_hash_offload_ok_{true};
+  // Table of active flows, indexed by `flow_hash'. Flows are owned by their
+  // channels.
+  net::flow::FlowTable active_flows_{};
+  // Slab the engine allocates its flows from; shared with the flows, which
+  // may outlive the engine (see `utils::Slab').
+  std::shared_ptr<net::flow::FlowSlab> flow_slab_{
+      std::make_shared<net::flow::FlowSlab>()};
+  // Flows with an armed timer (see `Flow::TimerCheck').
+  std::vector<Flow *> timer_flows_{};
+  // Retransmission timers of the flows (see `Flow::SetTimerWheel').
+  Flow::Timers timers_{time::ns_to_cycles(Flow::Timers::kDefaultTickNs)};
+  // Flows waiting for pacing to let them send (see `SetPacing').
+  net::flow::Pacer pacer_{
+      time::ns_to_cycles(net::flow::Pacer::kDefaultSlotNs)};
+  bool pace_window_{false};
+  // Receive window of new flows (see `SetMaxWindow').
+  uint32_t max_window_{Flow::kDefaultWindow};
+  // Multipath policy of new flows (see `SetMultipath').
+  size_t paths_nr_{1};
+  uint32_t flowlet_gap_us_{0};
+  // Whether new flows send and take early data (see `SetEarlyData').
+  bool early_data_{false};
+  // Aggregation of small messages of new flows (see `SetAggregation').
+  uint32_t agg_max_msg_len_{0};
+  uint32_t agg_hold_us_{0};
+  // ACK coalescing of new flows (see `SetAckPolicy').
+  uint32_t ack_every_n_{Flow::kDefaultAckEveryN};
+  uint32_t ack_delay_us_{Flow::kDefaultAckDelayUs};
+  // Whether new flows keep their own latency histograms (see
+  // `SetFlowLatencyStats').
+  bool flow_latency_stats_{false};
+  // Idle time before keep-alive probes (see `SetKeepAlive').
+  uint32_t keepalive_us_{kDefaultKeepAliveUs};
+  // Size classes of the buffers of new channels (see `SetChannelBufClasses').
+  std::vector<MachnetChannelBufClassConf_t> channel_buf_classes_{};
+  // Limits of the buffer pools of new channels (see
+  // `SetChannelBufPoolLimits').
+  size_t channel_buf_segs_max_{1};
+  size_t app_max_buffers_{0};
+  // Bitmap of channels with pending work, shared with the applications.
+  shm::PendingBitmap pending_bitmap_{};
+  // Active channels, indexed by their slot in `pending_bitmap_'.
+  std::array<shm::Channel *, shm::PendingBitmap::kSlotsNr> channel_slots_{};
+  // Channels to poll on the next cycle (has pending or leftover work).
+  std::array<uint64_t, shm::PendingBitmap::kWordsNr> ready_channels_{};
+  // Channels polled on every cycle, as their application does not use the
+  // pending bitmap.
+  std::array<uint64_t, shm::PendingBitmap::kWordsNr> polled_channels_{};
+  // Channels attached from another engine (see `AttachChannel'); they stay in
+  // `polled_channels_'.
+  std::array<uint64_t, shm::PendingBitmap::kWordsNr> adopted_channels_{};
+  // Channels of each priority class, the class of each slot, and the credit
+  // of each channel in bytes (see `ServeChannel').
+  std::array<std::array<uint64_t, shm::PendingBitmap::kWordsNr>,
+             MACHNET_PRIO_CLASSES_NR>
+      class_channels_{};
+  std::array<uint32_t, shm::PendingBitmap::kSlotsNr> channel_prios_{};
+  std::array<int64_t, shm::PendingBitmap::kSlotsNr> channel_deficits_{};
+  // DSCP of the packets of new flows, per class (see `SetPriorityDscp').
+  std::array<uint8_t, MACHNET_PRIO_CLASSES_NR> prio_dscp_{};
+  // Number of words of the bitmaps above that have active channels.
+  size_t pending_words_nr_{0};
+  // Adaptive idle mode (see `IdleSleep').
+  static constexpr int kIdleEventsNr = 8;
+  uint32_t idle_polls_threshold_{0};
+  uint32_t idle_max_sleep_us_{kDefaultIdleSleepUs};
+  uint32_t idle_polls_{0};
+  uint64_t idle_sleeps_{0};
+  bool rx_intr_registered_{false};
+  // Load accounting (see `GetLoad'): TSC cycles spent in busy cycles since the
+  // last periodic processing, packets received, and packets received and sent
+  // as of the last periodic processing.
+  uint64_t busy_cycles_{0};
+  uint64_t rx_packets_{0};
+  uint64_t load_packets_{0};
+  // RX bursts that filled the batch (see `Stats').
+  uint64_t rx_full_bursts_{0};
+  // Cycle accounting (see `GetCycleStats'): TSC cycles spent in each stage.
+  CycleStats stage_cycles_{};
+  // The counters of the engine, and as published for the control plane (see
+  // `GetStats').
+  Stats stats_{};
+  utils::SeqLock<Stats> published_stats_{};
+  // Whether the status is to be logged (see `RequestStatusDump').
+  std::atomic<bool> dump_status_{false};
+  // Dataplane events of the engine and its flows, and whether they are to be
+  // written out (see `RequestTraceDump').
+  trace::Tracer tracer_{};
+  std::atomic<bool> dump_trace_{false};
+  // Hardware flow steering rules of the engine (see `SetFlowSteering'); null
+  // if flow steering is disabled.
+  std::unique_ptr<dpdk::FlowSteering> flow_steering_;
+  // Clock of the NIC, to convert RX timestamps to TSC; set if the port has RX
+  // timestamps enabled.
+  std::optional<dpdk::NicClock> nic_clock_;
+  // A port bonded with the engine's own (see `AddPort'): the queues the engine
+  // uses on it, and whether its link was up at the last periodic processing.
+  struct BondPort {
+    BondPort(std::shared_ptr<PmdPort> port, dpdk::RxRing *rx, dpdk::TxRing *tx)
+        : pmd_port(std::move(port)), rxring(rx), txring(tx), txbatch(tx) {}
+    std::shared_ptr<PmdPort> pmd_port;
+    dpdk::RxRing *rxring;
+    dpdk::TxRing *txring;
+    dpdk::TxBatch txbatch;
+    std::optional<dpdk::NicClock> nic_clock;
+    bool link_up{true};
+  };
+  std::vector<std::unique_ptr<BondPort>> bond_ports_{};
+  // Whether the link of the engine's own port was up (tracked with bonds only).
+  bool link_up_{true};
+  // Zero-copy RX (see `SetRxZeroCopy'): the channel whose buffers the RX
+  // queue's packets use (nullptr if inactive), and how many of them it lent.
+  bool rx_zerocopy_enabled_{false};
+  shm::Channel *rx_zerocopy_channel_{nullptr};
+  uint32_t rx_zerocopy_bufs_nr_{0};
+  uint32_t rx_zerocopy_bufs_max_{0};
+  // Epoll events of the channel doorbells the engine waits on; must stay valid
+  // while registered.
+  std::unordered_map<const shm::Channel *, struct rte_epoll_event>
+      doorbell_events_{};
   // List of pending control plane requests.
   std::list<std::tuple<uint64_t, MachnetCtrlQueueEntry_t,
                        const std::shared_ptr<shm::Channel>>>
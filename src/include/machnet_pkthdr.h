@@ -19,20 +19,78 @@ struct __attribute__((packed)) MachnetPktHdr {
   be16_t magic;  // Magic value tagged after initialization for the flow.
   enum class MachnetFlags : uint8_t {
     kData = 0b0,
-    kSyn = 0b1,         // SYN packet.
-    kAck = 0b10,        // ACK packet.
-    kSynAck = 0b11,     // SYN-ACK packet.
-    kRst = 0b10000000,  // RST packet.
+    kSyn = 0b1,          // SYN packet.
+    kAck = 0b10,         // ACK packet.
+    kSynAck = 0b11,      // SYN-ACK packet.
+    kKeepAlive = 0b100,  // Keep-alive probe, answered with an ACK.
+    kRst = 0b10000000,   // RST packet.
   };
   MachnetFlags net_flags;  // Network flags.
   uint8_t msg_flags;       // Field to reflect the `MachnetMsgBuf_t' flags.
   be32_t seqno;  // Sequence number to denote the packet counter in the flow.
   be32_t ackno;  // Sequence number to denote the packet counter in the flow.
-  be64_t sack_bitmap[4];     // Bitmap of the SACKs received.
-  be16_t sack_bitmap_count;  // Length of the SACK bitmap [0-256].
-  be64_t timestamp1;         // Timestamp of the packet before sending.
+  // Bitmap of the SACKs received: bit `i' is set if the packet `ackno' +
+  // `sack_offset' + `i' was received. Windows larger than the bitmap (see
+  // `MachnetSynOptions') are reported in slices, a multiple of 64 apart.
+  be64_t sack_bitmap[4];
+  be16_t sack_offset;
+  // Data packets: TSC of the sender when the packet was sent. Other packets:
+  // echo of `timestamp1' of the last data packet received, or zero.
+  be64_t timestamp1;
+  // When echoing: time (in ns) from the arrival of that data packet to the
+  // transmission of this packet, and the part of it the data packet spent
+  // queued at the receiver before the flow processed it.
+  be32_t remote_delay;
+  be32_t remote_queuing;
+  // ACKs: number of data packets that arrived with an ECN CE mark since the
+  // previous ACK.
+  be16_t ecn_ce_nr;
+  // ACKs: receive window, i.e., number of packets from `ackno' on the sender
+  // of the ACK has room for (see `MachnetSynOptions::window' for its maximum).
+  be16_t rcv_wnd;
+};
+static_assert(sizeof(MachnetPktHdr) == 66, "MachnetPktHdr size mismatch");
+
+/**
+ * Options of a flow, carried as the payload of SYN and SYN-ACK packets. A peer
+ * that sends none gets the defaults.
+ */
+struct __attribute__((packed)) MachnetSynOptions {
+  static constexpr uint32_t kDefaultWindow = 256;
+  static constexpr size_t kMaxPaths = 8;
+  // Receive window, in packets: the sender may have up to this many packets
+  // not cumulatively acknowledged.
+  be32_t window;
+  // Maximum payload of the data packets (after the Machnet header) the sender
+  // of the options takes. The SYN or SYN-ACK is padded to this payload if it
+  // is larger than the default, so that the handshake proves the path carries
+  // packets that large.
+  be16_t mss;
+  // Multipath: in a SYN, the number of paths the flow may spray its packets
+  // over, and the UDP ports of the sender of the SYN for the paths beyond the
+  // first (whose port is the one of the flow); in a SYN-ACK, the number of
+  // those paths the flow uses. Zero or one means a single path.
+  uint8_t paths_nr;
+  be16_t path_ports[kMaxPaths - 1];
+  // Encryption: whether the sender encrypts the data of the flow, and its
+  // random nonce, from which the keys of the flow derive. Options that end
+  // before these fields (e.g., from older peers) mean no encryption.
+  uint8_t crypto;
+  uint8_t crypto_nonce[12];
+  // Whether the sender of the options splits aggregated data packets (see
+  // `MachnetAggHdr'). Options that end before it (e.g., from older peers)
+  // mean not: such peers get one packet per message.
+  uint8_t aggregation;
+};
+
+/**
+ * Header of each message in the payload of an aggregated data packet, one
+ * whose `msg_flags' have `MACHNET_MSGBUF_FLAGS_AGGREGATE': the payload is a
+ * sequence of small, whole messages, each a header and then its bytes.
+ */
+struct __attribute__((packed)) MachnetAggHdr {
+  be16_t len;  // Length of the message that follows, not zero.
 };
-static_assert(sizeof(MachnetPktHdr) == 54, "MachnetPktHdr size mismatch");
 
 inline MachnetPktHdr::MachnetFlags operator|(MachnetPktHdr::MachnetFlags lhs,
                                              MachnetPktHdr::MachnetFlags rhs) {
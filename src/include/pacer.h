@@ -0,0 +1,164 @@
+/**
+ * @file pacer.h
+ * @brief Per-engine timing wheel that releases the paced transmissions of
+ * flows at their scheduled TSC.
+ */
+#ifndef SRC_INCLUDE_PACER_H_
+#define SRC_INCLUDE_PACER_H_
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+class Flow;  // forward declaration
+
+/**
+ * @brief Class `Pacer' is a single-level timing wheel of flows, driven by the
+ * TSC. A flow that may not send its next packets yet schedules itself at the
+ * time it may (see `Flow::TransmitPackets'); the engine advances the wheel on
+ * every cycle and resumes the transmissions of the flows that are due.
+ *
+ * Time is split in slots of `slot_cycles'; a flow scheduled anywhere within a
+ * slot is released once the slot is over, so flows are released at most one
+ * slot late. Scheduling beyond the horizon of the wheel (`slots_nr' slots)
+ * releases the flow early, on the last slot; it is up to the flow to check its
+ * deadline and schedule itself again.
+ *
+ * Flows carry a priority class (0 being the highest): the flows due on the same
+ * slot are released in class order, so that higher classes get to transmit
+ * first (see `Flow::SetPriority').
+ *
+ * Scheduling a flow and releasing the flows of a slot are O(1) per flow. The
+ * wheel does not track which flows it holds: callers must not schedule a flow
+ * twice, and must `Remove' a flow before destroying it.
+ *
+ * This class is not thread-safe.
+ */
+class Pacer {
+ public:
+  static constexpr uint64_t kDefaultSlotNs = 1000;
+  static constexpr size_t kDefaultSlotsNr = 4096;
+
+  /**
+   * @brief Construct a new Pacer object.
+   * @param slot_cycles Length of a slot, in TSC cycles.
+   * @param slots_nr    Number of slots; rounded up to a power of two.
+   * @param now         Current TSC.
+   */
+  explicit Pacer(uint64_t slot_cycles, size_t slots_nr = kDefaultSlotsNr,
+                 uint64_t now = 0)
+      : slot_cycles_(std::max<uint64_t>(slot_cycles, 1)),
+        slots_(std::bit_ceil(std::max<size_t>(slots_nr, 2))),
+        mask_(slots_.size() - 1),
+        cursor_(now / slot_cycles_) {}
+  Pacer(const Pacer &) = delete;
+  Pacer &operator=(const Pacer &) = delete;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint64_t GetSlotCycles() const { return slot_cycles_; }
+
+  /**
+   * @brief Schedules a flow to be released at `tsc' (or on the next call of
+   * `Advance', if `tsc' has passed), after the flows of higher priority
+   * classes (lower `prio') due on the same slot.
+   */
+  void Schedule(Flow *flow, uint64_t tsc, uint32_t prio = 0) {
+    // Round up, so that the flow is not released before `tsc'.
+    auto slot = std::max((tsc + slot_cycles_ - 1) / slot_cycles_, cursor_);
+    slot = std::min(slot, cursor_ + mask_);
+    slots_[slot & mask_].push_back({flow, prio});
+    size_++;
+  }
+
+  /**
+   * @brief Removes a flow from the wheel, if it is scheduled. This walks all
+   * the slots, and is meant for flows that are being destroyed.
+   */
+  void Remove(const Flow *flow) {
+    if (size_ == 0) return;
+    for (auto &slot : slots_) {
+      const auto removed = std::erase_if(
+          slot, [flow](const Entry &entry) { return entry.flow == flow; });
+      size_ -= removed;
+    }
+  }
+
+  /**
+   * @brief Releases the flows scheduled up to `now'.
+   *
+   * @param now     Current TSC.
+   * @param release Callable invoked as `release(Flow *)' for each flow that is
+   *                due. It may schedule flows again.
+   */
+  template <typename F>
+  void Advance(uint64_t now, F &&release) {
+    const auto target = now / slot_cycles_;
+    if (size_ == 0) [[likely]] {
+      cursor_ = std::max(cursor_, target);
+      return;
+    }
+    // After a long pause every slot is due; visit each one once.
+    if (target >= cursor_ + slots_.size()) cursor_ = target - mask_;
+    while (cursor_ <= target && size_ != 0) {
+      auto &slot = slots_[cursor_ & mask_];
+      // Flows scheduled while releasing this slot land on the next one.
+      cursor_++;
+      if (slot.empty()) continue;
+      due_.swap(slot);
+      size_ -= due_.size();
+      // Slots mostly hold flows of one class; sort only when needed.
+      if (!std::is_sorted(due_.begin(), due_.end(), ByPriority)) {
+        std::stable_sort(due_.begin(), due_.end(), ByPriority);
+      }
+      for (const auto &entry : due_) release(entry.flow);
+      due_.clear();
+    }
+    cursor_ = std::max(cursor_, target);
+  }
+
+  /**
+   * @brief Empties the wheel, invoking `fn(Flow *)' for each flow it held;
+   * e.g., to detach the flows from a pacer that goes away.
+   */
+  template <typename F>
+  void Drain(F &&fn) {
+    std::vector<Flow *> flows;
+    for (auto &slot : slots_) {
+      for (const auto &entry : slot) flows.push_back(entry.flow);
+      slot.clear();
+    }
+    size_ = 0;
+    for (auto *flow : flows) fn(flow);
+  }
+
+ private:
+  struct Entry {
+    Flow *flow;
+    uint32_t prio;
+  };
+  static bool ByPriority(const Entry &a, const Entry &b) {
+    return a.prio < b.prio;
+  }
+
+  const uint64_t slot_cycles_;
+  std::vector<std::vector<Entry>> slots_;
+  const uint64_t mask_;
+  // Number of the next slot to release.
+  uint64_t cursor_;
+  // Flows scheduled.
+  size_t size_{0};
+  // Flows being released (kept to reuse its allocation).
+  std::vector<Entry> due_;
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_PACER_H_
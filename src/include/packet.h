@@ -6,6 +6,7 @@
 #include <glog/logging.h>
 #include <ipv4.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
 #include <utils.h>
 #include <x86intrin.h>
 
@@ -81,17 +82,76 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
         static_cast<const Packet &>(*this).head_data<T>(offset));
   }
 
+  /**
+   * @return IO address (IOVA) of the head data with a given offset, e.g., for
+   * a DMA device to copy into.
+   */
+  rte_iova_t head_iova(uint16_t offset = 0) const {
+    return rte_pktmbuf_iova_offset(&mbuf_, offset);
+  }
+
   /**
    * @return Length of the packet.
    */
   uint16_t length() const { return rte_pktmbuf_pkt_len(&mbuf_); }
 
+  /**
+   * @return Number of segments (i.e., chained mbufs) of the packet.
+   */
+  uint16_t segments_nr() const { return mbuf_.nb_segs; }
+
   /**
    * @return RSS hash value associated with the packet.
    * @note This is valid only if the DPDK PMD was initialized with RSS enabled.
    */
   uint32_t rss_hash() const { return mbuf_.hash.rss; }
 
+  /**
+   * @return True if the PMD filled in the RSS hash of the packet.
+   */
+  bool has_rss_hash() const { return mbuf_.ol_flags & RTE_MBUF_F_RX_RSS_HASH; }
+
+  /**
+   * @brief Registers the mbuf dynamic field and flag that carry RX timestamps
+   * (see `RTE_ETH_RX_OFFLOAD_TIMESTAMP'). Must be called before the accessors
+   * below may report a timestamp.
+   * @return True on success.
+   */
+  static bool RegisterRxTimestamp() {
+    if (rx_timestamp_offset_ >= 0) return true;
+    return rte_mbuf_dyn_rx_timestamp_register(&rx_timestamp_offset_,
+                                              &rx_timestamp_flag_) == 0;
+  }
+
+  /**
+   * @return True if the packet carries an RX timestamp.
+   */
+  bool has_rx_timestamp() const {
+    return rx_timestamp_offset_ >= 0 && (mbuf_.ol_flags & rx_timestamp_flag_);
+  }
+
+  /**
+   * @return RX timestamp of the packet; valid only if `has_rx_timestamp()'.
+   * In NIC clock units, as set by the PMD, unless replaced with
+   * `set_rx_timestamp'.
+   */
+  uint64_t rx_timestamp() const {
+    return *RTE_MBUF_DYNFIELD(&mbuf_, rx_timestamp_offset_, const uint64_t *);
+  }
+
+  /**
+   * @brief Replaces the RX timestamp of the packet (e.g., converted to another
+   * clock).
+   */
+  void set_rx_timestamp(uint64_t timestamp) {
+    *RTE_MBUF_DYNFIELD(&mbuf_, rx_timestamp_offset_, uint64_t *) = timestamp;
+  }
+
+  /**
+   * @brief Drops the RX timestamp of the packet.
+   */
+  void clear_rx_timestamp() { mbuf_.ol_flags &= ~rx_timestamp_flag_; }
+
   // Setters.
   void set_l2_len(uint16_t length) { mbuf_.l2_len = length; }
   void set_l3_len(uint16_t length) { mbuf_.l3_len = length; }
@@ -102,6 +162,19 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
     offload_ipv4_csum();
     mbuf_.ol_flags |= (RTE_MBUF_F_TX_UDP_CKSUM);
   }
+  /**
+   * @brief Requests UDP segmentation offload: the NIC splits the UDP payload
+   * of this packet in chunks of `segsz' bytes, and sends each of them with a
+   * copy of the L2-L4 headers (fixing up lengths and checksums).
+   * @param l4_len Length of the UDP header.
+   * @param segsz Length of the UDP payload of each resulting segment.
+   */
+  void offload_udpv4_seg(uint16_t l4_len, uint16_t segsz) {
+    offload_udpv4_csum();
+    mbuf_.ol_flags |= RTE_MBUF_F_TX_UDP_SEG;
+    mbuf_.l4_len = l4_len;
+    mbuf_.tso_segsz = segsz;
+  }
 
   /**
    * @brief Attach external buffer to this packet mbuf.
@@ -122,6 +195,34 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
     rte_mbuf_refcnt_set(&mbuf_, 1);
   }
 
+  /**
+   * @return Start address of the data buffer of the packet (not of the data).
+   */
+  template <typename T = void *>
+  T buf_addr() const {
+    return reinterpret_cast<T>(mbuf_.buf_addr);
+  }
+
+  /**
+   * @brief Replaces the data buffer of this (direct) packet with `buf_va',
+   * e.g., a buffer of a Machnet channel; the packet becomes empty. Unlike
+   * external buffers, the replacement sticks when the packet is freed, and is
+   * what the driver posts to the NIC when it reallocates the packet for RX.
+   * `Reset' restores the packet's own buffer.
+   * @param buf_va Buffer virtual address (VA).
+   * @param buf_iova Buffer IO address (IOVA).
+   * @param buf_len Total length of the buffer.
+   */
+  void set_buf(void *buf_va, uint64_t buf_iova, uint16_t buf_len) {
+    DCHECK(RTE_MBUF_DIRECT(&mbuf_));
+    mbuf_.buf_addr = buf_va;
+    mbuf_.buf_iova = buf_iova;
+    mbuf_.buf_len = buf_len;
+    rte_pktmbuf_reset_headroom(&mbuf_);
+    mbuf_.data_len = 0;
+    mbuf_.pkt_len = 0;
+  }
+
   /**
    * @brief Append len bytes to this packet and return a pointer to the start
    * address of the appended data.
@@ -146,6 +247,34 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
     return reinterpret_cast<T>(rte_pktmbuf_prepend(&mbuf_, len));
   }
 
+  /**
+   * @brief Removes `len' bytes from the start of the packet and returns a
+   * pointer to the new start of the data.
+   *
+   * If the packet is shorter, return nullptr, without affecting it.
+   */
+  template <typename T = void *>
+  T adj(uint16_t len) {
+    return reinterpret_cast<T>(rte_pktmbuf_adj(&mbuf_, len));
+  }
+
+  /**
+   * @brief Removes `len' bytes from the end of the packet.
+   * @return False if the last segment is shorter, in which case the packet is
+   * not modified.
+   */
+  bool trim(uint16_t len) { return rte_pktmbuf_trim(&mbuf_, len) == 0; }
+
+  /**
+   * @brief Chain `tail' at the end of this packet. On success, the segments of
+   * `tail' belong to this packet and are freed along with it.
+   * @return True on success, false if the resulting packet would have too many
+   * segments, in which case neither packet is modified.
+   */
+  bool chain(Packet *tail) {
+    return rte_pktmbuf_chain(&mbuf_, &tail->mbuf_) == 0;
+  }
+
   /**
    * @return String representation of L2 and L3 headers.
    */
@@ -158,6 +287,11 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
  private:
   struct rte_mbuf mbuf_;  //!< Underlying DPDK mbuf structure.
 
+  // Offset of the RX timestamp dynamic field, and the flag that marks it as
+  // valid; see `RegisterRxTimestamp'.
+  inline static int rx_timestamp_offset_{-1};
+  inline static uint64_t rx_timestamp_flag_{0};
+
   friend class PacketPool;
   friend class PacketBatch;
 };
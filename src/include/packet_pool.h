@@ -39,10 +39,13 @@ class PacketPool {
    * @param nmbufs Number of mbufs.
    * @param mbuf_size Size of each mbuf.
    * @param mempool_name Name of the mempool.
+   * @param socket_id NUMA node to allocate the mbufs on; `SOCKET_ID_ANY' picks
+   * the node of the calling thread.
    */
   PacketPool(uint32_t nmbufs = kRteDefaultMbufsNum_,
              uint16_t mbuf_size = kRteDefaultMbufDataSz_,
-             const char *mempool_name = kRteDefaultMempoolName);
+             const char *mempool_name = kRteDefaultMempoolName,
+             int socket_id = SOCKET_ID_ANY);
   ~PacketPool();
 
   /**
@@ -50,6 +53,11 @@ class PacketPool {
    */
   const char *GetPacketPoolName() { return mpool_->name; }
 
+  /**
+   * @return The NUMA node the mbufs are allocated on.
+   */
+  int GetSocketId() const { return mpool_->socket_id; }
+
   /**
    * @return The data room size of the packet.
    */
@@ -67,7 +75,10 @@ class PacketPool {
    * @return Pointer to the allocated packet.
    */
   Packet *PacketAlloc() {
-    return reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    auto *packet = reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    if (packet == nullptr) [[unlikely]]
+      alloc_failures_nr_++;
+    return packet;
   }
 
   /**
@@ -81,6 +92,7 @@ class PacketPool {
         mpool_, reinterpret_cast<struct rte_mbuf **>(pkts), cnt);
     if (ret == 0) [[likely]]
       return true;
+    alloc_failures_nr_++;
     return false;
   }
 
@@ -94,8 +106,10 @@ class PacketPool {
     (void)DCHECK_NOTNULL(batch);
     int ret = rte_pktmbuf_alloc_bulk(
         mpool_, reinterpret_cast<struct rte_mbuf **>(batch->pkts()), cnt);
-    if (ret != 0) [[unlikely]]
+    if (ret != 0) [[unlikely]] {
+      alloc_failures_nr_++;
       return false;
+    }
 
     batch->IncrCount(cnt);
     return true;
@@ -111,12 +125,64 @@ class PacketPool {
    */
   uint32_t AvailPacketsCount() { return rte_mempool_avail_count(mpool_); }
 
+  /**
+   * @return The number of allocations that failed as the pool was empty, by
+   * this pool object (i.e., by the thread using it, not by the NIC).
+   */
+  uint64_t GetAllocFailures() const { return alloc_failures_nr_; }
+
  private:
   const bool
       is_dpdk_primary_process_;  //!< Indicates if it's a DPDK primary process.
   static uint16_t next_id_;  //!< Static ID for the next packet pool instance.
   rte_mempool *mpool_;       //!< Underlying rte mbuf pool.
   uint16_t id_;              //!< Unique ID for this packet pool instance.
+  uint64_t alloc_failures_nr_{0};  //!< Failed allocations (not thread-safe).
+};
+
+/**
+ * @brief A stash of packets allocated in bulk from a pool, for senders of one
+ * packet at a time (e.g., ACKs): a pool access per `kSize' packets rather
+ * than per packet. Packets are reset as they are stashed, all at once, and
+ * handed out ready to be filled. Not thread-safe, as the pool's stats.
+ */
+class PacketCache {
+ public:
+  static constexpr uint16_t kSize = 32;
+
+  explicit PacketCache(PacketPool *pool) : pool_(pool) {}
+  PacketCache(const PacketCache &) = delete;
+  PacketCache &operator=(const PacketCache &) = delete;
+  ~PacketCache() {
+    for (uint16_t i = 0; i < nr_; i++) Packet::Free(pkts_[i]);
+  }
+
+  /**
+   * @return An empty packet, or nullptr if the pool is exhausted.
+   */
+  Packet *Alloc() {
+    if (nr_ == 0) [[unlikely]] {
+      if (!Refill()) {
+        // Fewer than `kSize' packets left; take them one by one.
+        auto *packet = pool_->PacketAlloc();
+        if (packet != nullptr) Packet::Reset(packet);
+        return packet;
+      }
+    }
+    return pkts_[--nr_];
+  }
+
+ private:
+  bool Refill() {
+    if (!pool_->PacketBulkAlloc(pkts_, kSize)) return false;
+    for (uint16_t i = 0; i < kSize; i++) Packet::Reset(pkts_[i]);
+    nr_ = kSize;
+    return true;
+  }
+
+  PacketPool *pool_;
+  Packet *pkts_[kSize];
+  uint16_t nr_{0};
 };
 
 }  // namespace dpdk
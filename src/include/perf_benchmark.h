@@ -0,0 +1,118 @@
+/**
+ * @file perf_benchmark.h
+ * @brief Reports the runs of Google Benchmark binaries through `perf::Report'
+ * (see perf_report.h), alongside the usual console output.
+ */
+#ifndef SRC_INCLUDE_PERF_BENCHMARK_H_
+#define SRC_INCLUDE_PERF_BENCHMARK_H_
+
+#include <benchmark/benchmark.h>
+#include <perf_report.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace perf {
+
+/**
+ * @brief Class `Reporter' prints runs to the console, and adds them to
+ * a report:
+ *  - name: the benchmark function; params: its arguments (named ones by their
+ *    name, others as `arg0', `arg1', ...) and its number of threads.
+ *  - `ops_per_sec': the `items_per_second' counter if set, else iterations
+ *    per second.
+ *  - The user counters: rates are higher-better; cycle counts and times
+ *    (names ending in `_ns' or `_us') are lower-better; others are recorded
+ *    but not compared.
+ * Aggregates of repetitions and skipped runs are not reported.
+ */
+class Reporter : public benchmark::ConsoleReporter {
+ public:
+  explicit Reporter(Report *report) : report_(report) {}
+
+  void ReportRuns(const std::vector<Run> &runs) override {
+    benchmark::ConsoleReporter::ReportRuns(runs);
+    for (const auto &run : runs) {
+      if (run.run_type != Run::RT_Iteration || run.skipped) continue;
+      report_->Add(ToResult(run));
+    }
+  }
+
+ private:
+  static Result ToResult(const Run &run) {
+    Result result;
+    result.name = run.run_name.function_name;
+    size_t pos = 0, arg_nr = 0;
+    const auto &args = run.run_name.args;
+    while (pos < args.size()) {
+      auto end = args.find('/', pos);
+      if (end == std::string::npos) end = args.size();
+      const auto arg = args.substr(pos, end - pos);
+      const auto colon = arg.find(':');
+      if (colon == std::string::npos) {
+        result.Param("arg" + std::to_string(arg_nr), arg);
+      } else {
+        result.Param(arg.substr(0, colon), arg.substr(colon + 1));
+      }
+      arg_nr++;
+      pos = end + 1;
+    }
+    if (run.threads > 1) result.Param("threads", run.threads);
+
+    const auto items = run.counters.find("items_per_second");
+    if (items != run.counters.end()) {
+      result.OpsPerSec(items->second.value);
+    } else if (run.real_accumulated_time > 0) {
+      result.OpsPerSec(run.iterations / run.real_accumulated_time);
+    }
+    for (const auto &[name, counter] : run.counters) {
+      if (name == "items_per_second") continue;
+      auto better = Better::kNone;
+      if (counter.flags & benchmark::Counter::kIsRate) {
+        better = Better::kHigher;
+      } else if (name.find("cycles") != std::string::npos ||
+                 name.ends_with("_ns") || name.ends_with("_us")) {
+        better = Better::kLower;
+      }
+      result.Set(name, counter.value, better);
+    }
+    return result;
+  }
+
+  Report *const report_;
+};
+
+/**
+ * @brief Runs the benchmarks selected on the command line, as
+ * `benchmark::RunSpecifiedBenchmarks' does, then writes and compares their
+ * report as `options' ask (see `perf::Finish').
+ * @return The exit status of the binary.
+ */
+[[maybe_unused]] static int RunSpecifiedBenchmarks(const std::string &name,
+                                                   const Options &options) {
+  Report report(name);
+  Reporter reporter(&report);
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  return Finish(report, options);
+}
+
+/**
+ * @brief The `main' of a benchmark binary that needs no setup; the
+ * counterpart of `BENCHMARK_MAIN()'.
+ */
+[[maybe_unused]] static int BenchmarkMain(const std::string &name, int argc,
+                                          char **argv) {
+  const auto options = Options::Parse(&argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return EXIT_FAILURE;
+  const int status = RunSpecifiedBenchmarks(name, options);
+  benchmark::Shutdown();
+  return status;
+}
+
+}  // namespace perf
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_PERF_BENCHMARK_H_
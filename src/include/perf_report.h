@@ -0,0 +1,355 @@
+/**
+ * @file perf_report.h
+ * @brief Machine-readable results of the benchmarks and perf tools, and their
+ * comparison against a baseline: the basis of perf-regression gating.
+ *
+ * A `Report' holds the results of one binary. Each result is a named
+ * measurement with its parameters (message size, window, ...) and metrics
+ * (ops/s, ns or cycles per op, latency percentiles); every metric says
+ * whether higher or lower is better. Reports are written as JSON:
+ *
+ *   {"benchmark": "channel_bench", "context": {...},
+ *    "results": [{"name": "stack_to_app", "params": {"msg_size": "64"},
+ *                 "metrics": {"ops_per_sec": {"value": 3.1e7,
+ *                                             "better": "higher"}}}]}
+ *
+ * Binaries accept the options of `Options' on their command line.
+ */
+#ifndef SRC_INCLUDE_PERF_REPORT_H_
+#define SRC_INCLUDE_PERF_REPORT_H_
+
+#include <glog/logging.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+#define JSON_NOEXCEPTION  // Disable exceptions for nlohmann::json
+#include <nlohmann/json.hpp>
+
+namespace juggler {
+namespace perf {
+
+// Well-known metric names.
+inline constexpr char kOpsPerSec[] = "ops_per_sec";
+inline constexpr char kNsPerOp[] = "ns_per_op";
+inline constexpr char kCyclesPerOp[] = "cycles_per_op";
+inline constexpr char kP50Ns[] = "p50_ns";
+inline constexpr char kP99Ns[] = "p99_ns";
+inline constexpr char kP999Ns[] = "p999_ns";
+
+/**
+ * @brief Which way a metric improves. `kNone' metrics are informative only,
+ * and never flagged as regressions.
+ */
+enum class Better { kHigher, kLower, kNone };
+
+[[maybe_unused]] static const char *BetterToString(Better better) {
+  switch (better) {
+    case Better::kHigher:
+      return "higher";
+    case Better::kLower:
+      return "lower";
+    default:
+      return "none";
+  }
+}
+
+[[maybe_unused]] static Better BetterFromString(const std::string &str) {
+  if (str == "higher") return Better::kHigher;
+  if (str == "lower") return Better::kLower;
+  return Better::kNone;
+}
+
+struct Metric {
+  double value;
+  Better better;
+};
+
+/**
+ * @brief One measurement. Results are matched against the baseline by their
+ * `Key()': their name and parameters.
+ */
+struct Result {
+  std::string name;
+  std::map<std::string, std::string> params;
+  std::map<std::string, Metric> metrics;
+
+  std::string Key() const {
+    std::string key = name;
+    for (const auto &[param, value] : params) key += "/" + param + ":" + value;
+    return key;
+  }
+
+  template <typename T>
+  Result &Param(const std::string &param, const T &value) {
+    if constexpr (std::is_convertible_v<T, std::string>) {
+      params[param] = value;
+    } else {
+      params[param] = std::to_string(value);
+    }
+    return *this;
+  }
+
+  Result &Set(const std::string &metric, double value, Better better) {
+    metrics[metric] = {value, better};
+    return *this;
+  }
+  // Shorthands for the well-known metrics.
+  Result &OpsPerSec(double value) {
+    return Set(kOpsPerSec, value, Better::kHigher);
+  }
+  Result &NsPerOp(double value) { return Set(kNsPerOp, value, Better::kLower); }
+  Result &CyclesPerOp(double value) {
+    return Set(kCyclesPerOp, value, Better::kLower);
+  }
+  // Latency percentiles, in nanoseconds.
+  Result &Latency(double p50_ns, double p99_ns, double p999_ns) {
+    Set(kP50Ns, p50_ns, Better::kLower);
+    Set(kP99Ns, p99_ns, Better::kLower);
+    return Set(kP999Ns, p999_ns, Better::kLower);
+  }
+};
+
+/**
+ * @brief A metric of the current run that is worse than its baseline by more
+ * than the tolerance.
+ */
+struct Regression {
+  std::string key;
+  std::string metric;
+  double baseline;
+  double current;
+  // Relative change, signed so that negative is worse.
+  double change;
+};
+
+/**
+ * @brief Class `Report' holds the results of a binary, and (de)serializes them
+ * as JSON.
+ */
+class Report {
+ public:
+  explicit Report(std::string benchmark) : benchmark_(std::move(benchmark)) {}
+
+  const std::string &benchmark() const { return benchmark_; }
+  const std::vector<Result> &results() const { return results_; }
+
+  /**
+   * @brief Adds a result. A result with the same name and parameters as an
+   * earlier one replaces it (e.g., repetitions of a benchmark).
+   */
+  Result &Add(Result result) {
+    for (auto &r : results_) {
+      if (r.Key() == result.Key()) return r = std::move(result);
+    }
+    return results_.emplace_back(std::move(result));
+  }
+
+  const Result *Find(const std::string &key) const {
+    for (const auto &r : results_) {
+      if (r.Key() == key) return &r;
+    }
+    return nullptr;
+  }
+
+  nlohmann::json ToJson() const {
+    char hostname[256] = {};
+    gethostname(hostname, sizeof(hostname) - 1);
+    char date[32];
+    const auto now = std::time(nullptr);
+    std::tm tm;
+    std::strftime(date, sizeof(date), "%FT%TZ", gmtime_r(&now, &tm));
+
+    nlohmann::json json;
+    json["benchmark"] = benchmark_;
+    json["context"] = {{"host", hostname}, {"date", date}};
+    json["results"] = nlohmann::json::array();
+    for (const auto &result : results_) {
+      nlohmann::json r;
+      r["name"] = result.name;
+      r["params"] = result.params;
+      r["metrics"] = nlohmann::json::object();
+      for (const auto &[name, metric] : result.metrics) {
+        r["metrics"][name] = {{"value", metric.value},
+                              {"better", BetterToString(metric.better)}};
+      }
+      json["results"].emplace_back(std::move(r));
+    }
+    return json;
+  }
+
+  // Writes the report as JSON to `path'; returns whether it was written.
+  bool Write(const std::string &path) const {
+    std::ofstream out(path, std::ios::trunc);
+    out << ToJson().dump(2) << std::endl;
+    out.close();
+    return !out.fail();
+  }
+
+  /**
+   * @brief Reads a report written by `Write'.
+   * @return The report, or std::nullopt if the file cannot be read or is not
+   * a report.
+   */
+  static std::optional<Report> Load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) return std::nullopt;
+    const auto json = nlohmann::json::parse(in, nullptr, false);
+    if (json.is_discarded() || !json.is_object() ||
+        !json.contains("results") || !json["results"].is_array())
+      return std::nullopt;
+
+    Report report(json.value("benchmark", ""));
+    for (const auto &r : json["results"]) {
+      if (!r.is_object() || !r.contains("name")) return std::nullopt;
+      Result result;
+      result.name = r.value("name", "");
+      if (r.contains("params") && r["params"].is_object()) {
+        for (const auto &[param, value] : r["params"].items()) {
+          if (!value.is_string()) return std::nullopt;
+          result.params[param] = value.get<std::string>();
+        }
+      }
+      if (r.contains("metrics") && r["metrics"].is_object()) {
+        for (const auto &[name, metric] : r["metrics"].items()) {
+          if (!metric.is_object() || !metric.contains("value") ||
+              !metric["value"].is_number())
+            return std::nullopt;
+          result.Set(name, metric["value"].get<double>(),
+                     BetterFromString(metric.value("better", "")));
+        }
+      }
+      report.Add(std::move(result));
+    }
+    return report;
+  }
+
+  /**
+   * @brief Compares this report against `baseline'.
+   * @param tolerance Relative change of a metric, in the direction it gets
+   *                  worse, that is still not a regression (e.g., 0.05).
+   * @return The regressions. Results or metrics missing from either report
+   * are skipped.
+   */
+  std::vector<Regression> Compare(const Report &baseline,
+                                  double tolerance) const {
+    std::vector<Regression> regressions;
+    for (const auto &result : results_) {
+      const auto *base = baseline.Find(result.Key());
+      if (base == nullptr) continue;
+      for (const auto &[name, metric] : result.metrics) {
+        const auto it = base->metrics.find(name);
+        if (it == base->metrics.end() || metric.better == Better::kNone ||
+            it->second.value == 0)
+          continue;
+        const double base_value = it->second.value;
+        double change = (metric.value - base_value) / std::abs(base_value);
+        if (metric.better == Better::kLower) change = -change;
+        if (change < -tolerance) {
+          regressions.push_back(
+              {result.Key(), name, base_value, metric.value, change});
+        }
+      }
+    }
+    return regressions;
+  }
+
+ private:
+  std::string benchmark_;
+  std::vector<Result> results_;
+};
+
+/**
+ * @brief Reporting options of a binary, given on its command line:
+ *  --perf_json=<path>        Write the report as JSON to <path>.
+ *  --perf_baseline=<path>    Compare the report against the one in <path>,
+ *                            and fail if any metric regressed.
+ *  --perf_tolerance=<ratio>  Relative change that is not a regression
+ *                            (default: 0.05).
+ */
+struct Options {
+  static constexpr double kDefaultTolerance = 0.05;
+
+  std::string json_path;
+  std::string baseline_path;
+  double tolerance{kDefaultTolerance};
+
+  /**
+   * @brief Parses and removes the options above from the command line, so
+   * that the rest can be handed to other parsers (gflags, Google Benchmark).
+   */
+  static Options Parse(int *argc, char **argv) {
+    Options options;
+    int kept = 1;
+    for (int i = 1; i < *argc; i++) {
+      const char *arg = argv[i];
+      if (const char *value = Match(arg, "--perf_json=")) {
+        options.json_path = value;
+      } else if (const char *value = Match(arg, "--perf_baseline=")) {
+        options.baseline_path = value;
+      } else if (const char *value = Match(arg, "--perf_tolerance=")) {
+        options.tolerance = std::strtod(value, nullptr);
+      } else {
+        argv[kept++] = argv[i];
+      }
+    }
+    *argc = kept;
+    argv[kept] = nullptr;
+    return options;
+  }
+
+ private:
+  static const char *Match(const char *arg, const char *prefix) {
+    const auto len = std::strlen(prefix);
+    return std::strncmp(arg, prefix, len) == 0 ? arg + len : nullptr;
+  }
+};
+
+/**
+ * @brief Writes and compares `report' as `options' ask.
+ * @return The exit status of the binary: nonzero if the report could not be
+ * written, the baseline could not be read, or a metric regressed.
+ */
+[[maybe_unused]] static int Finish(const Report &report,
+                                   const Options &options) {
+  int status = EXIT_SUCCESS;
+  if (!options.json_path.empty()) {
+    if (report.Write(options.json_path)) {
+      LOG(INFO) << "Wrote " << report.results().size() << " results to "
+                << options.json_path;
+    } else {
+      LOG(ERROR) << "Cannot write " << options.json_path;
+      status = EXIT_FAILURE;
+    }
+  }
+
+  if (options.baseline_path.empty()) return status;
+  const auto baseline = Report::Load(options.baseline_path);
+  if (!baseline.has_value()) {
+    LOG(ERROR) << "Cannot read baseline " << options.baseline_path;
+    return EXIT_FAILURE;
+  }
+  const auto regressions = report.Compare(baseline.value(), options.tolerance);
+  for (const auto &r : regressions) {
+    LOG(ERROR) << "Regression: " << r.key << " " << r.metric << ": "
+               << r.baseline << " -> " << r.current << " ("
+               << (r.change * 100) << "%)";
+  }
+  LOG(INFO) << regressions.size() << " regressions against "
+            << options.baseline_path << " (tolerance "
+            << (options.tolerance * 100) << "%)";
+  return regressions.empty() ? status : EXIT_FAILURE;
+}
+
+}  // namespace perf
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_PERF_REPORT_H_
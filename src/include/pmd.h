@@ -4,6 +4,7 @@
 #include <glog/logging.h>
 #include <rte_bus_pci.h>
 #include <rte_ethdev.h>
+#include <rte_interrupts.h>
 
 #include <memory>
 #include <optional>
@@ -11,6 +12,9 @@
 #include <utility>
 #include <vector>
 
+#include "af_xdp.h"
+#include "copy_engine.h"
+#include "crypto_engine.h"
 #include "dpdk.h"
 #include "ether.h"
 #include "packet.h"
@@ -60,12 +64,14 @@ class PmdRing {
         ndesc_(ndesc),
         ppool_(nullptr) {}
   PmdRing(const PmdPort *port, uint8_t port_id, uint16_t ring_id,
-          uint16_t ndesc, uint32_t nmbufs, uint32_t mbuf_sz)
+          uint16_t ndesc, uint32_t nmbufs, uint32_t mbuf_sz, int socket_id)
       : pmd_port_(port),
         port_id_(port_id),
         ring_id_(ring_id),
         ndesc_(ndesc),
-        ppool_(std::unique_ptr<PacketPool>(new PacketPool(nmbufs, mbuf_sz))) {}
+        ppool_(std::unique_ptr<PacketPool>(
+            new PacketPool(nmbufs, mbuf_sz, PacketPool::kRteDefaultMempoolName,
+                           socket_id))) {}
 
   rte_mempool *GetPacketMemPool() const { return ppool_.get()->GetMemPool(); }
 
@@ -94,8 +100,8 @@ class TxRing : public PmdRing {
 
   TxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc, struct rte_eth_txconf txconf, uint32_t nmbufs,
-         uint32_t mbuf_sz)
-      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
+         uint32_t mbuf_sz, int socket_id = SOCKET_ID_ANY)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz, socket_id),
         conf_(txconf) {}
 
   TxRing(TxRing const &) = delete;
@@ -111,6 +117,8 @@ class TxRing : public PmdRing {
    * @return Number of packets successfully sent.
    */
   uint16_t TrySendPackets(Packet **pkts, uint16_t nb_pkts) const {
+    if (sw_csum_flags_) [[unlikely]]
+      ChecksumInSoftware(pkts, nb_pkts);
     const uint16_t nb_success =
         rte_eth_tx_burst(this->GetPortId(), this->GetRingId(),
                          reinterpret_cast<struct rte_mbuf **>(pkts), nb_pkts);
@@ -137,9 +145,13 @@ class TxRing : public PmdRing {
    *
    * @param pkts Array of packet pointers to send.
    * @param nb_pkts Number of packets to send.
+   * @return Number of retries, i.e., of bursts that found the ring full.
    */
-  void SendPackets(Packet **pkts, uint16_t nb_pkts) const {
+  uint32_t SendPackets(Packet **pkts, uint16_t nb_pkts) const {
+    if (sw_csum_flags_) [[unlikely]]
+      ChecksumInSoftware(pkts, nb_pkts);
     uint16_t nb_remaining = nb_pkts;
+    uint32_t retries = 0;
 
     do {
       auto index = nb_pkts - nb_remaining;
@@ -147,7 +159,9 @@ class TxRing : public PmdRing {
           this->GetPortId(), this->GetRingId(),
           reinterpret_cast<struct rte_mbuf **>(&pkts[index]), nb_remaining);
       nb_remaining -= nb_success;
+      if (nb_remaining) retries++;
     } while (nb_remaining);
+    return retries;
   }
 
   /**
@@ -155,10 +169,12 @@ class TxRing : public PmdRing {
    * until all are sent.
    *
    * @param batch Pointer to the PacketBatch.
+   * @return Number of retries, i.e., of bursts that found the ring full.
    */
-  void SendPackets(PacketBatch *batch) const {
-    SendPackets(batch->pkts(), batch->GetSize());
+  uint32_t SendPackets(PacketBatch *batch) const {
+    const auto retries = SendPackets(batch->pkts(), batch->GetSize());
     batch->Clear();
+    return retries;
   }
 
   /**
@@ -169,8 +185,147 @@ class TxRing : public PmdRing {
     return rte_eth_tx_done_cleanup(this->GetPortId(), this->GetRingId(), 0);
   }
 
+  /**
+   * @brief Sets the checksum requests (`RTE_MBUF_F_TX_IP_CKSUM' and
+   * `RTE_MBUF_F_TX_UDP_CKSUM') that this ring fulfills in software, before
+   * handing packets to a NIC that lacks the corresponding offloads.
+   */
+  void SetSwChecksums(uint64_t ol_flags) { sw_csum_flags_ = ol_flags; }
+  uint64_t GetSwChecksums() const { return sw_csum_flags_; }
+
  private:
+  /**
+   * @brief Computes the checksums of `pkts' that `sw_csum_flags_' cover, and
+   * clears the corresponding requests. Packets must have their L2 and L3
+   * lengths set, and their headers in their first segment. Packets flagged
+   * for UDP segmentation are left to the NIC.
+   */
+  void ChecksumInSoftware(Packet **pkts, uint16_t nb_pkts) const;
+
   struct rte_eth_txconf conf_;
+  uint64_t sw_csum_flags_{0};
+};
+
+/**
+ * @brief Class `TxBatch' stages packets headed to a `TxRing'. Packets generated
+ * by different sources (e.g., flows, control packets) during one iteration of
+ * the engine are accumulated here and handed to the NIC in as few bursts as
+ * possible, so that the cost of the TX doorbell is amortized over a full burst.
+ * The batch is flushed when it fills up, or when `Flush' is called explicitly.
+ *
+ * This class is not thread-safe.
+ */
+class TxBatch {
+ public:
+  explicit TxBatch(TxRing *txring)
+      : txring_(CHECK_NOTNULL(txring)),
+        packet_cache_(txring->GetPacketPool()),
+        batch_(),
+        bursts_nr_(0),
+        pkts_nr_(0),
+        ring_full_nr_(0) {}
+  TxBatch(TxBatch const &) = delete;
+  TxBatch &operator=(TxBatch const &) = delete;
+  ~TxBatch() { Flush(); }
+
+  TxRing *GetRing() const { return txring_; }
+  PacketPool *GetPacketPool() const { return txring_->GetPacketPool(); }
+
+  /**
+   * @brief Allocates an empty packet from the pool of the ring, through a
+   * cache refilled in bulk; for senders of single packets (e.g., ACKs).
+   * @return The packet, or nullptr if the pool is exhausted.
+   */
+  Packet *PacketAlloc() { return packet_cache_.Alloc(); }
+
+  // Sets the engine that copies payloads into staged packets; its pending
+  // copies are waited for before the batch is sent. May be nullptr.
+  void SetCopyEngine(CopyEngine *copy_engine) { copy_engine_ = copy_engine; }
+  CopyEngine *GetCopyEngine() const { return copy_engine_; }
+  // Sets the engine that encrypts staged packets; its pending encryptions
+  // are waited for before the batch is sent, after the copies. May be
+  // nullptr.
+  void SetCryptoEngine(CryptoEngine *crypto_engine) {
+    crypto_engine_ = crypto_engine;
+  }
+  CryptoEngine *GetCryptoEngine() const { return crypto_engine_; }
+
+  /**
+   * @brief Stages a packet for transmission. The batch is flushed first if it
+   * is full.
+   *
+   * @param pkt Packet to send.
+   */
+  void Append(Packet *pkt) {
+    if (batch_.IsFull()) [[unlikely]]
+      Flush();
+    batch_.Append(pkt);
+  }
+
+  /**
+   * @brief Stages a packet for transmission if the batch has room, and frees
+   * it otherwise. For best-effort packets (e.g., ICMP echo replies), which
+   * must not make the caller wait for a full TX ring.
+   *
+   * @param pkt Packet to send.
+   * @return True if the packet was staged.
+   */
+  bool TryAppend(Packet *pkt) {
+    if (batch_.IsFull()) [[unlikely]] {
+      Packet::Free(pkt);
+      return false;
+    }
+    batch_.Append(pkt);
+    return true;
+  }
+
+  /**
+   * @brief Stages a batch of packets for transmission. The source batch is
+   * cleared.
+   *
+   * @param batch Pointer to the PacketBatch.
+   */
+  void Append(PacketBatch *batch) {
+    for (uint16_t i = 0; i < batch->GetSize(); i++) {
+      Append(batch->pkts()[i]);
+    }
+    batch->Clear();
+  }
+
+  /**
+   * @brief Sends all staged packets through the TX ring. Retries until all are
+   * sent.
+   */
+  void Flush() {
+    if (batch_.IsEmpty()) return;
+    if (copy_engine_ != nullptr) copy_engine_->Wait();
+    if (crypto_engine_ != nullptr) crypto_engine_->Wait();
+    bursts_nr_++;
+    pkts_nr_ += batch_.GetSize();
+    ring_full_nr_ += txring_->SendPackets(&batch_);
+  }
+
+  uint16_t GetSize() const { return batch_.GetSize(); }
+  // Number of bursts (i.e., flushes of a non-empty batch) so far.
+  uint64_t GetBurstCount() const { return bursts_nr_; }
+  // Number of packets sent so far.
+  uint64_t GetPacketCount() const { return pkts_nr_; }
+  // Number of bursts retried so far, as the TX ring was full: the NIC falls
+  // behind the engine.
+  uint64_t GetRingFullCount() const { return ring_full_nr_; }
+  double GetAvgBurstSize() const {
+    return bursts_nr_ == 0 ? 0.0 : static_cast<double>(pkts_nr_) / bursts_nr_;
+  }
+
+ private:
+  TxRing *txring_;
+  PacketCache packet_cache_;
+  PacketBatch batch_;
+  uint64_t bursts_nr_;
+  uint64_t pkts_nr_;
+  uint64_t ring_full_nr_;
+  CopyEngine *copy_engine_{nullptr};
+  CryptoEngine *crypto_engine_{nullptr};
 };
 
 /**
@@ -186,8 +341,8 @@ class RxRing : public PmdRing {
 
   RxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc, struct rte_eth_rxconf rxconf, uint32_t nmbufs,
-         uint32_t mbuf_sz)
-      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
+         uint32_t mbuf_sz, int socket_id = SOCKET_ID_ANY)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz, socket_id),
         conf_(rxconf) {}
 
   RxRing(RxRing const &) = delete;
@@ -229,6 +384,58 @@ class RxRing : public PmdRing {
     return nb_rx;
   }
 
+  /**
+   * @brief Adds the RX interrupt of this ring to the calling thread's epoll
+   * instance (`RTE_EPOLL_PER_THREAD'), so that `rte_epoll_wait()' returns
+   * when the interrupt fires. Must be called from the thread that waits, and
+   * the port must have been initialized with RX interrupts enabled.
+   *
+   * @return True on success, false if the interrupt cannot be used (e.g., the
+   * driver does not support RX interrupts).
+   */
+  bool RegisterInterrupt() {
+    return rte_eth_dev_rx_intr_ctl_q(this->GetPortId(), this->GetRingId(),
+                                     RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD,
+                                     nullptr) == 0;
+  }
+
+  /**
+   * @brief Arms the RX interrupt of this ring; it fires once the next packet
+   * arrives.
+   * @return True on success, false otherwise.
+   */
+  bool EnableInterrupt() {
+    return rte_eth_dev_rx_intr_enable(this->GetPortId(), this->GetRingId()) ==
+           0;
+  }
+
+  /**
+   * @brief Disarms the RX interrupt of this ring, to resume polling.
+   */
+  void DisableInterrupt() {
+    rte_eth_dev_rx_intr_disable(this->GetPortId(), this->GetRingId());
+  }
+
+  /**
+   * @brief Stops this ring while the port keeps running. The driver returns
+   * all packets posted to the NIC to the ring's packet pool.
+   * @return True on success, false otherwise (e.g., not supported).
+   */
+  bool Stop() {
+    return rte_eth_dev_rx_queue_stop(this->GetPortId(), this->GetRingId()) ==
+           0;
+  }
+
+  /**
+   * @brief Restarts a stopped ring (see `Stop'); the driver posts packets from
+   * the ring's packet pool to the NIC again.
+   * @return True on success, false otherwise.
+   */
+  bool Start() {
+    return rte_eth_dev_rx_queue_start(this->GetPortId(), this->GetRingId()) ==
+           0;
+  }
+
  private:
   struct rte_eth_rxconf conf_;
 };
@@ -281,6 +488,8 @@ class PmdPort {
         rx_rings_nr_(rx_rings_nr),
         tx_ring_desc_nr_(tx_desc_nr),
         rx_ring_desc_nr_(rx_desc_nr),
+        tx_offloads_(0),
+        rx_offloads_(0),
         initialized_(false) {
     // Get L2 address.
     rte_ether_addr temp;
@@ -304,8 +513,19 @@ class PmdPort {
    *
    * @param mtu (Optional) Maximum Transmission Unit to set for the port.
    * Default is PmdRing::kDefaultFrameSize.
+   * @param rx_intr (Optional) Enable RX queue interrupts, needed by engines
+   * that sleep when idle. Default is false.
+   * @param tx_uso (Optional) Enable UDP segmentation offload (and multi-segment
+   * TX) if the NIC supports it; see `IsTxUsoEnabled'. Default is false.
+   * @param tx_extbuf (Optional) TX packets may carry external (e.g., channel)
+   * buffers, which rules out the `FAST_FREE' offload; see
+   * `IsTxFastFreeEnabled'. Default is false.
+   * @param rx_timestamp (Optional) Enable hardware RX timestamps if the NIC
+   * supports them; see `IsRxTimestampEnabled'. Default is false.
    */
-  void InitDriver(uint16_t mtu = PmdRing::kDefaultFrameSize);
+  void InitDriver(uint16_t mtu = PmdRing::kDefaultFrameSize,
+                  bool rx_intr = false, bool tx_uso = false,
+                  bool tx_extbuf = false, bool rx_timestamp = false);
 
   /**
    * @brief Deinitializes the port.
@@ -325,6 +545,62 @@ class PmdPort {
     return juggler::utils::Format("%s", devinfo_.driver_name);
   }
 
+  // Whether the port is on AF_XDP sockets (see `AfXdp').
+  bool IsAfXdp() const { return GetDriverName() == AfXdp::kDriverName; }
+
+  /**
+   * @brief Checks if UDP segmentation offload is enabled on the TX queues of
+   * this port. If so, multi-segment packets flagged with
+   * `Packet::offload_udpv4_seg' are split by the NIC.
+   */
+  bool IsTxUsoEnabled() const {
+    return tx_offloads_ & RTE_ETH_TX_OFFLOAD_UDP_TSO;
+  }
+
+  /**
+   * @brief Checks if the NIC computes IPv4 header and UDP checksums. If not,
+   * the TX rings of this port compute them in software.
+   */
+  bool IsTxIpv4ChecksumOffloaded() const {
+    return tx_offloads_ & RTE_ETH_TX_OFFLOAD_IPV4_CKSUM;
+  }
+  bool IsTxUdpChecksumOffloaded() const {
+    return tx_offloads_ & RTE_ETH_TX_OFFLOAD_UDP_CKSUM;
+  }
+
+  /**
+   * @brief Checks if the `FAST_FREE' offload is enabled on the TX queues of
+   * this port. If so, the driver recycles sent packets without detaching
+   * external buffers, so packets must not carry any.
+   */
+  bool IsTxFastFreeEnabled() const {
+    return tx_offloads_ & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
+  }
+
+  /**
+   * @brief Checks if the NIC timestamps received packets. If so, packets carry
+   * their arrival time in NIC clock units (see `Packet::rx_timestamp' and
+   * `NicClock').
+   */
+  bool IsRxTimestampEnabled() const {
+    return rx_offloads_ & RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+  }
+
+  /**
+   * @brief Checks, without waiting, if the link of the port is up. Ports whose
+   * driver cannot tell are considered up.
+   */
+  bool IsLinkUp() const {
+    struct rte_eth_link link;
+    if (rte_eth_link_get_nowait(port_id_, &link) != 0) return true;
+    return link.link_status == RTE_ETH_LINK_UP;
+  }
+
+  /**
+   * @return Maximum number of segments (mbufs) in a packet the NIC accepts.
+   */
+  uint16_t GetTxMaxSegsNr() const { return devinfo_.tx_desc_lim.nb_seg_max; }
+
   /**
    * @brief Retrieves the associated device for this port.
    *
@@ -332,6 +608,13 @@ class PmdPort {
    */
   rte_device *GetDevice() const { return device_; }
 
+  /**
+   * @brief Retrieves the NUMA node the port's device is attached to.
+   *
+   * @return The NUMA node, or `SOCKET_ID_ANY' if it is unknown.
+   */
+  int GetNumaNode() const { return rte_eth_dev_socket_id(port_id_); }
+
   template <typename T>
   decltype(auto) GetRing(uint16_t id) const {
     constexpr bool is_tx_ring = std::is_same<T, TxRing>::value;
@@ -386,6 +669,24 @@ class PmdPort {
     return rss_reta_conf_[index].reta[shift];
   }
 
+  /**
+   * @brief Retrieves the RSS indirection table: the RX queue of each RSS hash
+   * bucket (see `GetRSSRxQueue').
+   *
+   * @return The RX queue indices, or an empty vector if the port has no
+   * indirection table.
+   */
+  std::vector<uint16_t> GetRSSReta() const {
+    std::vector<uint16_t> reta;
+    if (rss_reta_conf_.size() * RTE_ETH_RETA_GROUP_SIZE < devinfo_.reta_size)
+      return reta;
+    for (auto i = 0u; i < devinfo_.reta_size; i++) {
+      reta.emplace_back(rss_reta_conf_[i / RTE_ETH_RETA_GROUP_SIZE]
+                            .reta[i % RTE_ETH_RETA_GROUP_SIZE]);
+    }
+    return reta;
+  }
+
   /**
    * @brief Retrieves the number of RX queues for the port.
    *
@@ -393,6 +694,13 @@ class PmdPort {
    */
   uint16_t GetRxQueuesNr() const { return rx_rings_nr_; }
 
+  /**
+   * @brief Retrieves the number of TX queues for the port.
+   *
+   * @return Number of TX queues.
+   */
+  uint16_t GetTxQueuesNr() const { return tx_rings_nr_; }
+
   /**
    * @brief Updates the statistics for this port.
    */
@@ -412,6 +720,9 @@ class PmdPort {
 
   uint64_t GetPortRxNoMbufErr() const { return port_stats_.rx_nombuf; }
 
+  // Packets received with errors, and dropped by the NIC.
+  uint64_t GetPortRxErrors() const { return port_stats_.ierrors; }
+
   uint64_t GetPortQueueRxPkts(uint16_t queue_id) const {
     CHECK_LT(queue_id,
              std::min(rx_rings_.size(),
@@ -426,6 +737,14 @@ class PmdPort {
     return port_stats_.q_ibytes[queue_id];
   }
 
+  // Packets dropped by a RX queue, on drivers that count them per queue.
+  uint64_t GetPortQueueRxDrops(uint16_t queue_id) const {
+    CHECK_LT(queue_id,
+             std::min(rx_rings_.size(),
+                      static_cast<size_t>(RTE_ETHDEV_QUEUE_STAT_CNTRS)));
+    return port_stats_.q_errors[queue_id];
+  }
+
   uint64_t GetPortQueueTxPkts(uint16_t queue_id) const {
     CHECK_LT(queue_id,
              std::min(tx_rings_.size(),
@@ -440,14 +759,28 @@ class PmdPort {
     return port_stats_.q_obytes[queue_id];
   }
 
+  /**
+   * @brief Updates the extended statistics of the port (see `GetXstats').
+   */
+  void UpdateXstats();
+
+  /**
+   * @brief Retrieves the extended statistics of the driver (`rte_eth_xstats'),
+   * by name, as of the last `UpdateXstats': per-queue counters, and drops by
+   * cause where the driver tells them apart (e.g., `rx_out_of_buffer').
+   */
+  const std::vector<std::pair<std::string, uint64_t>> &GetXstats() const {
+    return xstats_;
+  }
+
   void DumpStats() {
     UpdatePortStats();
     LOG(INFO) << juggler::utils::Format(
         "[STATS - Port: %u] [TX] Pkts: %lu, Bytes: %lu, Drops: %lu [RX] Pkts: "
-        "%lu, Bytes: %lu, Drops: %lu, NoRXMbufs: %lu",
+        "%lu, Bytes: %lu, Drops: %lu, NoRXMbufs: %lu, Errors: %lu",
         port_id_, GetPortTxPkts(), GetPortTxBytes(), GetPortTxDrops(),
         GetPortRxPkts(), GetPortRxBytes(), GetPortRxDrops(),
-        GetPortRxNoMbufErr());
+        GetPortRxNoMbufErr(), GetPortRxErrors());
 
     for (uint16_t i = 0; i < tx_rings_nr_; i++) {
       LOG(INFO) << juggler::utils::Format(
@@ -457,12 +790,26 @@ class PmdPort {
 
     for (uint16_t i = 0; i < rx_rings_nr_; i++) {
       LOG(INFO) << juggler::utils::Format(
-          "[STATS - Port: %u, Queue: %u] [RX] Pkts: %lu, Bytes: %lu", port_id_,
-          i, GetPortQueueRxPkts(i), GetPortQueueRxBytes(i));
+          "[STATS - Port: %u, Queue: %u] [RX] Pkts: %lu, Bytes: %lu, Drops: "
+          "%lu",
+          port_id_, i, GetPortQueueRxPkts(i), GetPortQueueRxBytes(i),
+          GetPortQueueRxDrops(i));
+    }
+
+    // The extended statistics are many; only the nonzero ones tell something.
+    UpdateXstats();
+    for (const auto &[name, value] : xstats_) {
+      if (value == 0) continue;
+      LOG(INFO) << juggler::utils::Format("[STATS - Port: %u] [XSTATS] %s: %lu",
+                                          port_id_, name.c_str(), value);
     }
   }
 
  private:
+  // Reads the RSS configuration of an AF_XDP port from the kernel, which owns
+  // it, into `rss_hash_key_' and `rss_reta_conf_'.
+  void FetchKernelRssConf();
+
   const bool is_dpdk_primary_process_;
   const uint16_t port_id_;
   const uint16_t tx_rings_nr_, rx_rings_nr_;
@@ -474,10 +821,59 @@ class PmdPort {
   rte_device *device_;
   std::vector<rte_eth_rss_reta_entry64> rss_reta_conf_;
   struct rte_eth_stats port_stats_;
+  std::vector<std::pair<std::string, uint64_t>> xstats_;
   std::vector<uint8_t> rss_hash_key_;
   std::string pci_info_;
+  uint64_t tx_offloads_;
+  uint64_t rx_offloads_;
   bool initialized_;
 };
+
+/**
+ * @brief Converts NIC clock timestamps (e.g., of received packets) to TSC.
+ *
+ * The NIC clock is sampled along with the TSC on every `Sync'; timestamps are
+ * converted relative to the last sample, with the ratio of the clock rates
+ * between the last two samples. `Sync' should be called often enough to keep
+ * up with drift, e.g., on every periodic processing of an engine.
+ * This class is not thread-safe.
+ */
+class NicClock {
+ public:
+  explicit NicClock(uint16_t port_id) : port_id_(port_id) {}
+
+  /**
+   * @brief Samples the NIC clock and the TSC.
+   * @return True on success.
+   */
+  bool Sync() {
+    uint64_t nic_clock;
+    const auto tsc = time::rdtsc();
+    if (rte_eth_read_clock(port_id_, &nic_clock) != 0) return false;
+    if (last_tsc_ != 0 && nic_clock > last_nic_clock_) {
+      tsc_per_tick_ = static_cast<double>(tsc - last_tsc_) /
+                      static_cast<double>(nic_clock - last_nic_clock_);
+    }
+    last_tsc_ = tsc;
+    last_nic_clock_ = nic_clock;
+    return true;
+  }
+
+  // True once two samples have been taken, i.e., `ToTsc' may be used.
+  bool IsSynced() const { return tsc_per_tick_ > 0; }
+
+  uint64_t ToTsc(uint64_t nic_timestamp) const {
+    DCHECK(IsSynced());
+    const auto ticks = static_cast<int64_t>(nic_timestamp - last_nic_clock_);
+    return last_tsc_ + static_cast<int64_t>(ticks * tsc_per_tick_);
+  }
+
+ private:
+  const uint16_t port_id_;
+  uint64_t last_tsc_{0};
+  uint64_t last_nic_clock_{0};
+  double tsc_per_tick_{0};
+};
 }  // namespace dpdk
 }  // namespace juggler
 
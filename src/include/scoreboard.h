@@ -0,0 +1,349 @@
+/**
+ * @file scoreboard.h
+ * @brief Sender-side scoreboard of the packets in flight of a flow, with
+ * time-based (RACK) loss detection.
+ */
+#ifndef SRC_INCLUDE_SCOREBOARD_H_
+#define SRC_INCLUDE_SCOREBOARD_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+/**
+ * @brief Class `Scoreboard' tracks the state of every packet a flow sent and
+ * that is not cumulatively acknowledged yet: in flight, selectively
+ * acknowledged (SACKed), or deemed lost and waiting to be retransmitted.
+ *
+ * Packets are kept in a ring indexed by seqno, sized to the window of the flow
+ * (see `Resize'). Besides, the packets in flight
+ * are linked in the order they were (re)transmitted, and the lost ones in the
+ * order they should be retransmitted. Loss detection follows RACK (RFC 8985):
+ * a packet is lost once a packet sent after it was delivered and a reordering
+ * window has passed since it should have been. Since the list of packets in
+ * flight is sorted by transmission time, detecting losses only looks at the
+ * packets it marks lost plus one; marking a packet SACKed or retransmitting a
+ * lost one are O(1), and a SACK bitmap costs O(1) per word plus O(1) per
+ * newly SACKed packet. SACK bitmaps cover `kSackBitmapSize' packets from an
+ * offset, so that windows larger than a bitmap are reported in slices.
+ *
+ * Timestamps are TSC values. Each packet carries a 32-bit cookie for the
+ * caller (e.g., the index of its message buffer).
+ *
+ * This class is not thread-safe.
+ */
+class Scoreboard {
+ public:
+  // Default and maximum number of packets tracked, i.e., in flight.
+  static constexpr size_t kDefaultCapacity = 256;
+  static constexpr size_t kMaxCapacity = 16384;
+  // Packets covered by a SACK bitmap, in 64-bit words.
+  static constexpr size_t kSackBitmapSize = 256;
+  static constexpr size_t kSackWordsNr = kSackBitmapSize / 64;
+  using SackBitmap = std::array<uint64_t, kSackWordsNr>;
+
+  explicit Scoreboard(size_t capacity = kDefaultCapacity) { Resize(capacity); }
+  Scoreboard(const Scoreboard &) = delete;
+  Scoreboard &operator=(const Scoreboard &) = delete;
+
+  // Number of packets tracked, and of those SACKed, lost (and not
+  // retransmitted yet), and in flight.
+  uint32_t size() const { return nxt_ - una_; }
+  bool empty() const { return size() == 0; }
+  // Seqno of the oldest packet tracked, if any.
+  uint32_t una() const { return una_; }
+  uint32_t sacked_nr() const { return sacked_nr_; }
+  uint32_t lost_nr() const { return lost_.nr; }
+  uint32_t inflight_nr() const { return inflight_.nr; }
+  uint32_t capacity() const { return packets_.size(); }
+  // Number of packets that may be sent before the scoreboard is full.
+  uint32_t room() const { return capacity() - size(); }
+
+  /**
+   * @brief Sets the number of packets tracked, a power of two (at least 64,
+   * and at most `kMaxCapacity'); the scoreboard must be empty.
+   */
+  void Resize(size_t capacity) {
+    CHECK(empty());
+    CHECK(capacity >= 64 && capacity <= kMaxCapacity &&
+          (capacity & (capacity - 1)) == 0)
+        << "Invalid capacity: " << capacity;
+    packets_.assign(capacity, Packet{});
+    sacked_.assign(capacity / 64, 0);
+    mask_ = capacity - 1;
+  }
+
+  /**
+   * @brief Tracks a packet sent for the first time; seqnos must be
+   * consecutive, unless the scoreboard is empty.
+   */
+  void OnSend(uint32_t seqno, uint32_t cookie, uint64_t tx_tsc) {
+    if (empty()) una_ = nxt_ = seqno;
+    DCHECK_EQ(seqno, nxt_);
+    DCHECK_LT(size(), capacity());
+    auto &packet = packets_[Index(seqno)];
+    packet.tx_tsc = tx_tsc;
+    packet.cookie = cookie;
+    packet.state = State::kInflight;
+    packet.retransmitted = false;
+    Link(&inflight_, Index(seqno));
+    nxt_++;
+  }
+
+  /**
+   * @brief Stops tracking the packets before `ackno', which the receiver
+   * acknowledged cumulatively.
+   */
+  void OnAck(uint32_t ackno) {
+    if (static_cast<int32_t>(ackno - una_) <= 0) return;
+    const auto acked_nr = std::min(ackno - una_, size());
+    for (uint32_t i = 0; i < acked_nr; i++) {
+      const auto index = Index(una_ + i);
+      if (packets_[index].state == State::kSacked) {
+        sacked_[index / 64] &= ~(uint64_t{1} << (index % 64));
+        sacked_nr_--;
+        continue;
+      }
+      Deliver(una_ + i);
+    }
+    una_ += acked_nr;
+  }
+
+  /**
+   * @brief Marks the packets a SACK bitmap reports received as SACKed.
+   *
+   * @param ackno  Cumulative ACK the bitmap is relative to; a bitmap relative
+   *               to an older ACK is ignored.
+   * @param offset Offset of the bitmap from `ackno', a multiple of 64.
+   * @param bitmap Bit `i' (bit `i % 64' of word `i / 64') is set if the
+   *               packet `ackno + offset + i' was received.
+   */
+  void OnSack(uint32_t ackno, uint32_t offset, const SackBitmap &bitmap) {
+    if (ackno != una_ || empty() || offset % 64 != 0) return;
+    for (size_t w = 0; w < kSackWordsNr; w++) {
+      // Ignore bits beyond the packets sent.
+      const uint32_t first = offset + w * 64;
+      if (first >= size()) break;
+      uint64_t fresh = bitmap[w] & ~SackedWord(una_ + first);
+      if (size() - first < 64) fresh &= (uint64_t{1} << (size() - first)) - 1;
+      while (fresh != 0) {
+        const auto seqno = una_ + first + std::countr_zero(fresh);
+        const auto index = Index(seqno);
+        Deliver(seqno);
+        packets_[index].state = State::kSacked;
+        sacked_[index / 64] |= uint64_t{1} << (index % 64);
+        sacked_nr_++;
+        fresh &= fresh - 1;
+      }
+    }
+  }
+
+  /**
+   * @brief Marks lost the packets in flight that were sent before a packet
+   * since delivered, and are overdue by at least the reordering window.
+   *
+   * @param now     Current TSC.
+   * @param rtt     Round-trip time of the most recent delivery.
+   * @param reo_wnd Reordering window.
+   * @return The TSC at which the next packet in flight would be deemed lost,
+   * if nothing else is delivered; zero if there is none.
+   */
+  uint64_t DetectLosses(uint64_t now, uint64_t rtt, uint64_t reo_wnd) {
+    while (inflight_.head != kNil) {
+      const auto index = inflight_.head;
+      const auto &packet = packets_[index];
+      const uint32_t seqno = una_ + ((index - una_) & mask_);
+      const bool sent_before =
+          packet.tx_tsc < rack_tsc_ ||
+          (packet.tx_tsc == rack_tsc_ &&
+           static_cast<int32_t>(seqno - rack_seqno_) < 0);
+      if (!has_rack_ || !sent_before) break;
+      const auto deadline = packet.tx_tsc + rtt + reo_wnd;
+      if (deadline > now) return deadline;
+      MarkLost(index);
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Marks lost all the packets not SACKed, e.g., on a retransmission
+   * timeout; they are to be retransmitted in seqno order.
+   */
+  void MarkAllLost() {
+    inflight_ = List{};
+    lost_ = List{};
+    for (uint32_t seqno = una_; seqno != nxt_; seqno++) {
+      const auto index = Index(seqno);
+      if (packets_[index].state == State::kSacked) continue;
+      packets_[index].state = State::kLost;
+      Link(&lost_, index);
+    }
+  }
+
+  /**
+   * @brief Takes the next lost packet to retransmit, if any, and tracks it as
+   * in flight again, retransmitted at `tx_tsc'.
+   * @return Its seqno.
+   */
+  std::optional<uint32_t> RetransmitLost(uint64_t tx_tsc) {
+    if (lost_.head == kNil) return std::nullopt;
+    const auto index = lost_.head;
+    Unlink(&lost_, index);
+    return Retransmit(index, tx_tsc);
+  }
+
+  /**
+   * @brief Takes the packet in flight sent last, to retransmit it at `tx_tsc'
+   * as a tail loss probe, if any.
+   * @return Its seqno.
+   */
+  std::optional<uint32_t> RetransmitNewest(uint64_t tx_tsc) {
+    if (inflight_.tail == kNil) return std::nullopt;
+    const auto index = inflight_.tail;
+    Unlink(&inflight_, index);
+    return Retransmit(index, tx_tsc);
+  }
+
+  /**
+   * @brief The cookie of a tracked packet.
+   */
+  uint32_t cookie(uint32_t seqno) const {
+    DCHECK_LT(seqno - una_, size());
+    return packets_[Index(seqno)].cookie;
+  }
+
+ private:
+  static constexpr uint16_t kNil = UINT16_MAX;
+  static_assert(kMaxCapacity < kNil && kSackBitmapSize <= kMaxCapacity);
+
+  enum class State : uint8_t { kInflight, kSacked, kLost };
+  struct Packet {
+    uint64_t tx_tsc;
+    uint32_t cookie;
+    // Links in `inflight_' or `lost_'.
+    uint16_t prev;
+    uint16_t next;
+    State state;
+    bool retransmitted;
+  };
+  // Doubly-linked list of packets, by index.
+  struct List {
+    uint16_t head{kNil};
+    uint16_t tail{kNil};
+    uint32_t nr{0};
+  };
+
+  uint16_t Index(uint32_t seqno) const { return seqno & mask_; }
+
+  // The 64 bits of `sacked_' from the packet `seqno' on (which is 64-aligned
+  // relative to `una_', but not necessarily in the ring).
+  uint64_t SackedWord(uint32_t seqno) const {
+    const auto index = Index(seqno);
+    const size_t w = index / 64;
+    const size_t bits = index % 64;
+    uint64_t word = sacked_[w] >> bits;
+    if (bits != 0) word |= sacked_[(w + 1) % sacked_.size()] << (64 - bits);
+    return word;
+  }
+
+  void Link(List *list, uint16_t index) {
+    auto &packet = packets_[index];
+    packet.prev = list->tail;
+    packet.next = kNil;
+    if (list->tail != kNil) {
+      packets_[list->tail].next = index;
+    } else {
+      list->head = index;
+    }
+    list->tail = index;
+    list->nr++;
+  }
+  void Unlink(List *list, uint16_t index) {
+    const auto &packet = packets_[index];
+    if (packet.prev != kNil) {
+      packets_[packet.prev].next = packet.next;
+    } else {
+      list->head = packet.next;
+    }
+    if (packet.next != kNil) {
+      packets_[packet.next].prev = packet.prev;
+    } else {
+      list->tail = packet.prev;
+    }
+    list->nr--;
+  }
+
+  void MarkLost(uint16_t index) {
+    Unlink(&inflight_, index);
+    packets_[index].state = State::kLost;
+    Link(&lost_, index);
+  }
+
+  uint32_t Retransmit(uint16_t index, uint64_t tx_tsc) {
+    auto &packet = packets_[index];
+    packet.tx_tsc = tx_tsc;
+    packet.state = State::kInflight;
+    packet.retransmitted = true;
+    Link(&inflight_, index);
+    return una_ + ((index - una_) & mask_);
+  }
+
+  // Takes a packet SACKed or acknowledged (for the first time) out of the
+  // lists, and moves the RACK time forward. Retransmitted packets do not, as it
+  // is not known which of their transmissions was delivered.
+  void Deliver(uint32_t seqno) {
+    const auto index = Index(seqno);
+    auto &packet = packets_[index];
+    switch (packet.state) {
+      case State::kSacked:
+        return;
+      case State::kInflight:
+        Unlink(&inflight_, index);
+        break;
+      case State::kLost:
+        Unlink(&lost_, index);
+        break;
+    }
+    if (packet.retransmitted) return;
+    if (!has_rack_ || packet.tx_tsc > rack_tsc_ ||
+        (packet.tx_tsc == rack_tsc_ &&
+         static_cast<int32_t>(seqno - rack_seqno_) > 0)) {
+      has_rack_ = true;
+      rack_tsc_ = packet.tx_tsc;
+      rack_seqno_ = seqno;
+    }
+  }
+
+  std::vector<Packet> packets_;
+  uint32_t mask_{0};
+  // Oldest packet tracked, and next seqno to send.
+  uint32_t una_{0};
+  uint32_t nxt_{0};
+  // Packets SACKed, by index in the ring.
+  std::vector<uint64_t> sacked_;
+  uint32_t sacked_nr_{0};
+  // Packets in flight, by transmission time, and lost.
+  List inflight_{};
+  List lost_{};
+  // Transmission time and seqno of the packet sent last among those delivered
+  // (RACK.xmit_ts and RACK.end_seq in RFC 8985).
+  bool has_rack_{false};
+  uint64_t rack_tsc_{0};
+  uint32_t rack_seqno_{0};
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_SCOREBOARD_H_
@@ -0,0 +1,140 @@
+/**
+ * @file slab.h
+ * @brief A slab allocator for objects of one type that are created and
+ * destroyed often and looked up on the datapath (e.g., flows).
+ */
+#ifndef SRC_INCLUDE_SLAB_H_
+#define SRC_INCLUDE_SLAB_H_
+
+#include <common.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+namespace utils {
+
+/**
+ * @brief Class `Slab' carves objects of type `T' out of large chunks, in slots
+ * aligned to cache lines. Unlike objects from `new', they carry no allocator
+ * header, never share a cache line with unrelated data, and sit next to each
+ * other; freed slots are reused last-in, first-out, while still warm.
+ *
+ * Objects are handed out as `Ptr's, which destroy them back into the slab.
+ * Each keeps the slab alive, so objects may outlive the slab's creator (e.g.,
+ * flows of a channel that moves to another engine). Chunks are returned to
+ * the system when the slab goes away.
+ *
+ * Allocation and release take a lock, uncontended unless objects are released
+ * by a thread other than the one that allocates: they are meant for the
+ * control path only.
+ */
+template <typename T>
+class Slab : public std::enable_shared_from_this<Slab<T>> {
+ public:
+  // Slots per chunk; chunks are allocated as slots run out.
+  static constexpr size_t kSlotsPerChunk = 64;
+  // Alignment and size of slots; functions, so that `Ptr' may be named where
+  // `T' is incomplete.
+  static constexpr size_t SlotAlign() {
+    return std::max(alignof(T), hardware_constructive_interference_size);
+  }
+  static constexpr size_t SlotSize() {
+    return (sizeof(T) + SlotAlign() - 1) / SlotAlign() * SlotAlign();
+  }
+
+  class Deleter {
+   public:
+    Deleter() = default;
+    explicit Deleter(std::shared_ptr<Slab> slab) : slab_(std::move(slab)) {}
+    void operator()(T *obj) const {
+      obj->~T();
+      slab_->Free(obj);
+    }
+
+   private:
+    std::shared_ptr<Slab> slab_;
+  };
+  using Ptr = std::unique_ptr<T, Deleter>;
+
+  // Slabs are shared (see `Deleter'); create them with `std::make_shared'.
+  Slab() = default;
+  Slab(const Slab &) = delete;
+  Slab &operator=(const Slab &) = delete;
+  ~Slab() {
+    DCHECK_EQ(size_, 0);
+    for (auto *chunk : chunks_) std::free(chunk);
+  }
+
+  /**
+   * @brief Constructs an object in a free slot.
+   * @param args Arguments forwarded to the constructor of `T'.
+   * @return The object, or nullptr if out of memory.
+   */
+  template <typename... Args>
+  Ptr New(Args &&...args) {
+    void *slot = Allocate();
+    if (slot == nullptr) return Ptr(nullptr, Deleter());
+    auto *obj = new (slot) T(std::forward<Args>(args)...);
+    return Ptr(obj, Deleter(this->shared_from_this()));
+  }
+
+  // Number of live objects.
+  size_t size() const {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    return size_;
+  }
+  // Number of slots, live or free.
+  size_t capacity() const {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    return chunks_.size() * kSlotsPerChunk;
+  }
+
+ private:
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+
+  void *Allocate() {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    if (free_ == nullptr) {
+      auto *chunk = static_cast<uint8_t *>(
+          std::aligned_alloc(SlotAlign(), SlotSize() * kSlotsPerChunk));
+      if (chunk == nullptr) return nullptr;
+      chunks_.emplace_back(chunk);
+      // Thread the slots so that the first one is handed out first.
+      for (size_t i = kSlotsPerChunk; i-- > 0;) {
+        free_ = new (chunk + i * SlotSize()) FreeSlot{free_};
+      }
+    }
+    auto *slot = free_;
+    free_ = slot->next;
+    size_++;
+    return slot;
+  }
+
+  void Free(void *slot) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    DCHECK_GT(size_, 0);
+    free_ = new (slot) FreeSlot{free_};
+    size_--;
+  }
+
+  mutable std::mutex mtx_;
+  FreeSlot *free_{nullptr};
+  std::vector<void *> chunks_{};
+  size_t size_{0};
+};
+
+}  // namespace utils
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_SLAB_H_
@@ -0,0 +1,233 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical timing wheel for the per-flow timers of an engine (e.g.,
+ * retransmission timeouts).
+ */
+#ifndef SRC_INCLUDE_TIMER_WHEEL_H_
+#define SRC_INCLUDE_TIMER_WHEEL_H_
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace juggler {
+namespace net {
+namespace flow {
+
+/**
+ * @brief Class `TimerWheel' is a hierarchical timing wheel, driven by the TSC
+ * (see G. Varghese and T. Lauck, "Hashed and hierarchical timing wheels").
+ *
+ * Time is split in ticks of `tick_cycles'. Level 0 has one slot per tick for
+ * the next `kSlotsNr' ticks; each level above has slots `kSlotsNr' times as
+ * long as the level below. A timer is filed in the lowest level whose range
+ * covers its expiry; as time reaches a slot of an upper level, its timers are
+ * moved down ("cascaded"), until they expire from level 0. Timers further
+ * away than the range of the top level expire early, at the end of the range;
+ * owners are expected to check their own deadline and re-arm.
+ *
+ * Timers are nodes of intrusive lists, embedded in their owners, so that
+ * arming, re-arming and cancelling a timer are O(1) without allocations.
+ * `Advance' costs O(1) per tick with timers in level 0, O(1) per level-0
+ * range otherwise, plus O(1) per timer cascaded or expired: unlike walking
+ * all the flows, its cost does not grow with the number of idle timers.
+ *
+ * This class is not thread-safe.
+ *
+ * @tparam T The type of the owners of the timers.
+ */
+template <typename T>
+class TimerWheel {
+  // Links of the intrusive (circular) lists of timers; slots have a sentinel.
+  struct Node {
+    Node *prev{nullptr};
+    Node *next{nullptr};
+  };
+
+ public:
+  static constexpr size_t kSlotsBits = 6;
+  static constexpr size_t kSlotsNr = 1 << kSlotsBits;
+  static constexpr size_t kLevelsNr = 4;
+  static constexpr uint64_t kDefaultTickNs = 1000;
+
+  /**
+   * @brief A timer, to be embedded in its owner. It must be cancelled (or have
+   * expired) before it is destroyed.
+   */
+  class Timer : private Node {
+   public:
+    explicit Timer(T *owner) : owner_(owner) {}
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    ~Timer() { DCHECK(!armed()); }
+
+    bool armed() const { return this->next != nullptr; }
+    T *owner() const { return owner_; }
+
+   private:
+    friend class TimerWheel;
+    T *const owner_;
+    // Tick the timer expires at, and the level it is filed in.
+    uint64_t expiry_{0};
+    size_t level_{0};
+  };
+
+  /**
+   * @brief Construct a new TimerWheel object.
+   * @param tick_cycles Length of a tick, in TSC cycles.
+   * @param now         Current TSC.
+   */
+  explicit TimerWheel(uint64_t tick_cycles, uint64_t now = 0)
+      : tick_cycles_(std::max<uint64_t>(tick_cycles, 1)),
+        cursor_(now / tick_cycles_) {
+    for (auto &level : slots_) {
+      for (auto &head : level) head.prev = head.next = &head;
+    }
+  }
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+  ~TimerWheel() { Clear(); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint64_t GetTickCycles() const { return tick_cycles_; }
+
+  /**
+   * @brief Arms `timer' to expire at `tsc' (or on the next call of `Advance',
+   * if `tsc' has passed), re-arming it if it is armed already.
+   */
+  void Schedule(Timer *timer, uint64_t tsc) {
+    Cancel(timer);
+    // Round up, so that the timer does not expire before `tsc'.
+    const uint64_t tick = (tsc + tick_cycles_ - 1) / tick_cycles_;
+    timer->expiry_ = std::clamp(tick, cursor_, cursor_ + kMaxDelta);
+    File(timer);
+  }
+
+  /**
+   * @brief Disarms `timer', if armed.
+   */
+  void Cancel(Timer *timer) {
+    if (!timer->armed()) return;
+    Unlink(timer);
+    counts_[timer->level_]--;
+    size_--;
+  }
+
+  /**
+   * @brief Expires the timers due up to `now'.
+   *
+   * @param now    Current TSC.
+   * @param expire Callable invoked as `expire(T *)' with the owner of each
+   *               timer that expires; the timer is disarmed already, and may
+   *               be armed again (or its owner destroyed) by the callable.
+   */
+  template <typename F>
+  void Advance(uint64_t now, F &&expire) {
+    const uint64_t target = now / tick_cycles_;
+    while (cursor_ <= target) {
+      if (size_ == 0) [[likely]] {
+        cursor_ = target + 1;
+        return;
+      }
+      // Skip the ticks of ranges with no timers in the levels below.
+      size_t empty_levels = 0;
+      while (counts_[empty_levels] == 0) empty_levels++;
+      const uint64_t span_mask = Span(empty_levels) - 1;
+      if ((cursor_ & span_mask) != 0) {
+        cursor_ = std::min((cursor_ | span_mask) + 1, target + 1);
+        continue;
+      }
+      Cascade();
+
+      Node *head = &slots_[0][cursor_ & kSlotsMask];
+      // Timers armed while expiring this tick go to the next one.
+      cursor_++;
+      while (head->next != head) {
+        auto *timer = static_cast<Timer *>(head->next);
+        Cancel(timer);
+        expire(timer->owner());
+      }
+    }
+  }
+
+  /**
+   * @brief Disarms all the timers.
+   */
+  void Clear() {
+    for (auto &level : slots_) {
+      for (auto &head : level) {
+        while (head.next != &head) Unlink(head.next);
+      }
+    }
+    counts_.fill(0);
+    size_ = 0;
+  }
+
+ private:
+  static constexpr uint64_t kSlotsMask = kSlotsNr - 1;
+  // Range, in ticks, of the wheel.
+  static constexpr uint64_t kMaxDelta =
+      (uint64_t{1} << (kSlotsBits * kLevelsNr)) - 1;
+
+  // Number of ticks covered by a slot of `level'.
+  static constexpr uint64_t Span(size_t level) {
+    return uint64_t{1} << (kSlotsBits * level);
+  }
+
+  static void Link(Node *node, Node *head) {
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+  }
+  static void Unlink(Node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+  }
+
+  // Files a timer in the level that covers its expiry.
+  void File(Timer *timer) {
+    const uint64_t delta = timer->expiry_ - cursor_;
+    size_t level = 0;
+    while (level < kLevelsNr - 1 && delta >= Span(level + 1)) level++;
+    const auto slot = (timer->expiry_ >> (kSlotsBits * level)) & kSlotsMask;
+    timer->level_ = level;
+    Link(timer, &slots_[level][slot]);
+    counts_[level]++;
+    size_++;
+  }
+
+  // Moves down the timers of the upper-level slots that start at `cursor_'.
+  void Cascade() {
+    for (size_t level = 1; level < kLevelsNr; level++) {
+      if ((cursor_ & (Span(level) - 1)) != 0) break;
+      if (counts_[level] == 0) continue;
+      const auto slot = (cursor_ >> (kSlotsBits * level)) & kSlotsMask;
+      Node *head = &slots_[level][slot];
+      while (head->next != head) {
+        auto *timer = static_cast<Timer *>(head->next);
+        Cancel(timer);
+        File(timer);
+      }
+    }
+  }
+
+  const uint64_t tick_cycles_;
+  // Next tick to expire.
+  uint64_t cursor_;
+  std::array<std::array<Node, kSlotsNr>, kLevelsNr> slots_;
+  // Number of timers filed in each level, and in total.
+  std::array<size_t, kLevelsNr> counts_{};
+  size_t size_{0};
+};
+
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_TIMER_WHEEL_H_
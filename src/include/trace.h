@@ -0,0 +1,257 @@
+/**
+ * @file trace.h
+ * @brief Per-engine binary trace of dataplane events (retransmissions, flow
+ * state changes, drops), cheap enough to record in the hot path.
+ */
+#ifndef SRC_INCLUDE_TRACE_H_
+#define SRC_INCLUDE_TRACE_H_
+
+#include <flow_key.h>
+#include <glog/logging.h>
+#include <ttime.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace trace {
+
+// Tracing is compiled in with the `MACHNET_TRACE' CMake option (on by
+// default); without it, recording an event compiles down to nothing.
+#ifdef MACHNET_TRACE
+inline constexpr bool kEnabled = true;
+#else
+inline constexpr bool kEnabled = false;
+#endif
+
+// Where engines dump their trace on demand (see
+// `MachnetEngine::RequestTraceDump').
+inline constexpr char kDefaultDir[] = "/var/run/machnet";
+
+/**
+ * @brief Events of the trace. The meaning of the `seqno' and `arg' fields of a
+ * record depends on the event; new events go at the end, so that older traces
+ * still decode.
+ */
+enum class Event : uint16_t {
+  kNone = 0,
+  kFastRetransmit,     // seqno: snd_una, arg: packets presumed lost.
+  kRtoRetransmit,      // seqno: snd_una, arg: consecutive RTOs.
+  kSynRetransmit,      // seqno: SYN seqno, arg: consecutive RTOs.
+  kFlowState,          // seqno: snd_nxt, arg: new `Flow::State'.
+  kFlowFailed,         // seqno: snd_una, arg: `Flow::State'.
+  kKeepAliveTimeout,   // seqno: snd_una.
+  kFlowRemoved,        // seqno: snd_una.
+  kDropTooFarAhead,    // seqno: packet seqno, arg: rcv_nxt.
+  kDropOversized,      // seqno: packet seqno, arg: payload length.
+  kDropBadMagic,       // arg: magic.
+  kDropBadState,       // seqno: packet seqno, arg: flags << 8 | state.
+  kDropBadAckno,       // seqno: snd_una, arg: ackno.
+  kDropNoListener,     // arg: RSS hash of the packet.
+  kDropNotSyn,         // seqno: packet seqno, arg: flags.
+  kDropIpv4Length,     // arg: IPv4 total length.
+  kDropIpProtocol,     // arg: IP protocol.
+  kDropMsgNoFlow,      // arg: message length.
+  kRssHashMismatch,    // seqno: software hash, arg: NIC hash.
+  kEventsNr
+};
+
+[[maybe_unused]] static const char *EventToString(Event event) {
+  switch (event) {
+    case Event::kNone:
+      return "none";
+    case Event::kFastRetransmit:
+      return "fast_retransmit";
+    case Event::kRtoRetransmit:
+      return "rto_retransmit";
+    case Event::kSynRetransmit:
+      return "syn_retransmit";
+    case Event::kFlowState:
+      return "flow_state";
+    case Event::kFlowFailed:
+      return "flow_failed";
+    case Event::kKeepAliveTimeout:
+      return "keepalive_timeout";
+    case Event::kFlowRemoved:
+      return "flow_removed";
+    case Event::kDropTooFarAhead:
+      return "drop_too_far_ahead";
+    case Event::kDropOversized:
+      return "drop_oversized";
+    case Event::kDropBadMagic:
+      return "drop_bad_magic";
+    case Event::kDropBadState:
+      return "drop_bad_state";
+    case Event::kDropBadAckno:
+      return "drop_bad_ackno";
+    case Event::kDropNoListener:
+      return "drop_no_listener";
+    case Event::kDropNotSyn:
+      return "drop_not_syn";
+    case Event::kDropIpv4Length:
+      return "drop_ipv4_length";
+    case Event::kDropIpProtocol:
+      return "drop_ip_protocol";
+    case Event::kDropMsgNoFlow:
+      return "drop_msg_no_flow";
+    case Event::kRssHashMismatch:
+      return "rss_hash_mismatch";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * @brief Identifies a flow in the trace: a hash of its key, as the engine and
+ * the flow both compute it.
+ */
+[[maybe_unused]] static uint32_t FlowId(const net::flow::Key &key) {
+  return static_cast<uint32_t>(std::hash<net::flow::Key>{}(key));
+}
+
+/**
+ * @brief A record of the trace. Records are fixed-size and stored in host
+ * byte order; dumps are meant to be decoded on the same architecture.
+ */
+struct Record {
+  uint64_t tsc;
+  uint32_t flow;
+  uint32_t seqno;
+  uint32_t arg;
+  uint16_t event;
+  uint16_t reserved;
+};
+static_assert(sizeof(Record) == 24);
+
+/**
+ * @brief Header of a trace dump, followed by `records_nr' records, oldest
+ * first.
+ */
+struct FileHeader {
+  static constexpr char kMagic[8] = "MNTRACE";
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t tsc_hz;
+  uint64_t records_nr;
+  // Records overwritten before the dump, as the ring wrapped around.
+  uint64_t lost_nr;
+  uint16_t port_id;
+  uint16_t rx_queue_id;
+  uint32_t reserved;
+};
+static_assert(sizeof(FileHeader) == 48);
+
+/**
+ * @brief Class `Tracer' is a ring of the most recent trace records of an
+ * engine. Recording an event is a store of a record and an increment; once
+ * the ring is full, the oldest records are overwritten.
+ *
+ * This class is not thread-safe: the engine records events and dumps the
+ * trace from its own thread (see `MachnetEngine::RequestTraceDump').
+ */
+class Tracer {
+ public:
+  static constexpr size_t kDefaultRecordsNr = 1 << 16;
+
+  /**
+   * @brief Construct a new Tracer object.
+   * @param records_nr Capacity of the ring; rounded up to a power of two. No
+   *                   memory is allocated if tracing is compiled out.
+   */
+  explicit Tracer(size_t records_nr = kDefaultRecordsNr)
+      : records_(kEnabled ? std::bit_ceil(std::max<size_t>(records_nr, 1))
+                          : 0),
+        mask_(records_.empty() ? 0 : records_.size() - 1) {}
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  size_t capacity() const { return records_.size(); }
+  // Number of records recorded so far, including overwritten ones.
+  uint64_t recorded() const { return head_; }
+
+  void Record(Event event, uint32_t flow, uint32_t seqno, uint32_t arg = 0) {
+    if constexpr (kEnabled) {
+      records_[head_++ & mask_] = {time::rdtsc(), flow, seqno, arg,
+                                   static_cast<uint16_t>(event), 0};
+    }
+  }
+
+  // Returns the records of the ring, oldest first.
+  std::vector<trace::Record> Snapshot() const {
+    const auto nr = std::min<uint64_t>(head_, records_.size());
+    std::vector<trace::Record> records;
+    records.reserve(nr);
+    for (auto i = head_ - nr; i != head_; i++)
+      records.emplace_back(records_[i & mask_]);
+    return records;
+  }
+
+  /**
+   * @brief Writes the records of the ring to `path' (see `FileHeader').
+   * @return Whether the trace was written.
+   */
+  bool Dump(const std::string &path, uint16_t port_id,
+            uint16_t rx_queue_id) const {
+    const auto records = Snapshot();
+    FileHeader header = {};
+    std::memcpy(header.magic, FileHeader::kMagic, sizeof(header.magic));
+    header.version = FileHeader::kVersion;
+    header.record_size = sizeof(trace::Record);
+    header.tsc_hz =
+        time::tsc_hz != 0 ? time::tsc_hz : time::estimate_tsc_hz();
+    header.records_nr = records.size();
+    header.lost_nr = head_ - records.size();
+    header.port_id = port_id;
+    header.rx_queue_id = rx_queue_id;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(records.data()),
+              records.size() * sizeof(trace::Record));
+    out.close();
+    return !out.fail();
+  }
+
+  /**
+   * @brief Reads a trace dumped by `Dump'.
+   * @return The header and the records of the trace, or std::nullopt if the
+   * file is not a trace this version can decode.
+   */
+  static std::optional<std::pair<FileHeader, std::vector<trace::Record>>> Load(
+      const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+      return std::nullopt;
+    if (std::memcmp(header.magic, FileHeader::kMagic, sizeof(header.magic)) !=
+            0 ||
+        header.version != FileHeader::kVersion ||
+        header.record_size != sizeof(trace::Record))
+      return std::nullopt;
+    std::vector<trace::Record> records(header.records_nr);
+    if (!in.read(reinterpret_cast<char *>(records.data()),
+                 records.size() * sizeof(trace::Record)))
+      return std::nullopt;
+    return std::make_pair(header, std::move(records));
+  }
+
+ private:
+  std::vector<trace::Record> records_;
+  const uint64_t mask_;
+  uint64_t head_{0};
+};
+
+}  // namespace trace
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_TRACE_H_
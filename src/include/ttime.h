@@ -81,6 +81,10 @@ template <typename T = double>
   return cycles_to_ns<T>(cycles) / 1E9;
 }
 
+[[maybe_unused]] static inline uint64_t ns_to_cycles(uint64_t ns) {
+  return ns * tsc_hz / 1E9;
+}
+
 [[maybe_unused]] static inline uint64_t us_to_cycles(uint64_t us) {
   return us * tsc_hz / 1E6;
 }
@@ -6,9 +6,12 @@
 #ifndef SRC_INCLUDE_UD_SOCKET_H_
 #define SRC_INCLUDE_UD_SOCKET_H_
 
+#include <sys/types.h>
+
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -46,7 +49,14 @@ class UDSocket {
 
   bool SendMsg(const char *msg, size_t len);
   bool SendMsgWithFd(const char *msg, size_t len, int fd);
+  bool SendMsgWithFds(const char *msg, size_t len, const int *fds,
+                      size_t fds_nr);
   int RecvMsgWithFd(char *msg, size_t len, int *fd);
+  // Receives a message and up to `*fds_nr' descriptors with it; `*fds_nr' is
+  // set to the number received.
+  int RecvMsgWithFds(char *msg, size_t len, int *fds, size_t *fds_nr);
+  // The user id of the process on the other end, if connected.
+  std::optional<uid_t> GetPeerUid() const;
 
   void *GetContext() const { return context_; }
   bool AllocateUserData(size_t size);
@@ -91,9 +101,21 @@ class UDServer {
   UDServer(const std::string &path, on_connect_cb_t on_connect,
            on_close_cb_t on_close, on_message_cb_t on_message,
            on_timeout_cb_t on_timeout);
+  // Serves the connections of a socket that is listening already, e.g., one
+  // handed over by another process (see `GetListenFd').
+  UDServer(int listen_fd, on_connect_cb_t on_connect, on_close_cb_t on_close,
+           on_message_cb_t on_message, on_timeout_cb_t on_timeout);
   ~UDServer();
 
+  // Serves a client connected already (e.g., handed over with the listening
+  // socket), as if it had just connected; must be called before `Run'.
+  // Returns the client's socket, or nullptr if `on_connect' refused it.
+  UDSocket *AdoptClient(int fd);
+  int GetListenFd() const { return listen_socket_.GetFd(); }
+
   void Run();
+  // Stops the server; when called from a callback, no further event of the
+  // current round is handled.
   void Stop();
 
  private:
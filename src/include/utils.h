@@ -10,6 +10,8 @@
 #include <sched.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdarg>
 #include <cstring>
@@ -21,6 +23,7 @@
 #include <type_traits>
 #include <vector>
 
+#include "checksum.h"
 #include "ttime.h"
 
 #define XXH_STATIC_LINKING_ONLY
@@ -37,6 +40,68 @@ namespace utils {
   std::memcpy(dest, src, nbytes);
 }
 
+#if defined(__x86_64__)
+/**
+ * @brief Copies with non-temporal (streaming) stores of 32 bytes, which write
+ * the destination to memory without reading it into, or evicting anything
+ * from, the cache. Head and tail bytes, up to an aligned destination, are
+ * copied with regular stores.
+ */
+__attribute__((target("avx2"))) static inline void CopyNonTemporalAvx2(
+    uint8_t *__restrict__ dest, const uint8_t *__restrict__ src,
+    std::size_t nbytes) {
+  const size_t misalign = reinterpret_cast<uintptr_t>(dest) % 32;
+  const size_t head = std::min(nbytes, misalign == 0 ? 0 : 32 - misalign);
+  std::memcpy(dest, src, head);
+  size_t i = head;
+  for (; i + 32 <= nbytes; i += 32) {
+    const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(dest + i), v);
+  }
+  std::memcpy(dest + i, src + i, nbytes - i);
+}
+
+// As `CopyNonTemporalAvx2', with the 16-byte stores of SSE2.
+static inline void CopyNonTemporalSse2(uint8_t *__restrict__ dest,
+                                       const uint8_t *__restrict__ src,
+                                       std::size_t nbytes) {
+  const size_t misalign = reinterpret_cast<uintptr_t>(dest) % 16;
+  const size_t head = std::min(nbytes, misalign == 0 ? 0 : 16 - misalign);
+  std::memcpy(dest, src, head);
+  size_t i = head;
+  for (; i + 16 <= nbytes; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_stream_si128(reinterpret_cast<__m128i *>(dest + i), v);
+  }
+  std::memcpy(dest + i, src + i, nbytes - i);
+}
+#endif
+
+/**
+ * @brief Copies a large buffer that the caller will not read back soon (e.g.,
+ * a payload headed to a NIC or to another process) without polluting the
+ * cache: with AVX2 or SSE2 streaming stores, picked at runtime. Stores are
+ * fenced, so the copy is visible to other cores and devices once it returns.
+ */
+[[maybe_unused]] static inline void CopyNonTemporal(
+    void *__restrict__ dest, const void *__restrict__ src,
+    std::size_t nbytes) {
+#if defined(__x86_64__)
+  static const bool kAvx2 = __builtin_cpu_supports("avx2");
+  auto *d = static_cast<uint8_t *>(dest);
+  const auto *s = static_cast<const uint8_t *>(src);
+  if (kAvx2) {
+    CopyNonTemporalAvx2(d, s, nbytes);
+  } else {
+    CopyNonTemporalSse2(d, s, nbytes);
+  }
+  _mm_sfence();
+#else
+  std::memcpy(dest, src, nbytes);
+#endif
+}
+
 [[maybe_unused]] static inline std::string HexDump(uint8_t *data, size_t len) {
   std::stringstream ss;
   for (size_t i = 0; i < len; i++) {
@@ -140,10 +205,10 @@ namespace utils {
  * This function calculates a 16-bit checksum over a given input data using the
  * one's complement method. The checksum is computed by adding 16-bit words of
  * the input data. If the input data length is not a multiple of 2 bytes (16
- * bits), the last remaining byte is padded with zeros on its least significant
- * byte and included in the checksum. The sum is then folded into 16 bits by
+ * bits), the last remaining byte is padded with a zero byte that follows it in
+ * memory, as RFC 1071 prescribes. The sum is then folded into 16 bits by
  * adding the high and low parts, and finally, the bitwise complement of the sum
- * is returned.
+ * is returned. The sum uses the vectorized kernels of checksum.h.
  *
  * @param data Pointer to the input data. The input data is treated as a
  * sequence of 16-bit words.
@@ -158,22 +223,7 @@ namespace utils {
  */
 [[maybe_unused]] static inline uint16_t ComputeChecksum16(const uint8_t *data,
                                                           size_t length) {
-  uint32_t sum = 0;
-  const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data);
-
-  for (; length > 1; length -= 2) {
-    sum += *ptr++;
-  }
-
-  if (length == 1) {
-    sum += static_cast<uint16_t>(*reinterpret_cast<const uint8_t *>(ptr) << 8);
-  }
-
-  while (sum >> 16) {
-    sum = (sum & 0xFFFF) + (sum >> 16);
-  }
-
-  return static_cast<uint16_t>(~sum);
+  return static_cast<uint16_t>(~RawChecksum(data, length));
 }
 
 [[maybe_unused]] static inline void UUIDUnparse(const unsigned char uuid[16],
@@ -267,6 +317,41 @@ static constexpr inline T hash(const char *str, size_t len) {
   }
 }
 
+/**
+ * @brief A value with one writer and any number of readers, which never
+ * block or slow down the writer: readers retry if the value changed while
+ * they copied it.
+ */
+template <typename T>
+requires std::is_trivially_copyable_v<T>
+class SeqLock {
+ public:
+  // Publishes a new value. Not thread-safe with other writers.
+  void Store(const T &value) {
+    const auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&value_, &value, sizeof(T));
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Returns the last value published. (thread-safe)
+  T Load() const {
+    T value;
+    uint64_t seq;
+    do {
+      seq = seq_.load(std::memory_order_acquire);
+      std::memcpy(&value, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != seq_.load(std::memory_order_relaxed));
+    return value;
+  }
+
+ private:
+  std::atomic<uint64_t> seq_{0};
+  T value_{};
+};
+
 // Derived from BESS.
 class CmdLineOpts {
  public:
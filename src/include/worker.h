@@ -12,6 +12,7 @@
 #include <ttime.h>
 
 #include <atomic>
+#include <concepts>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -57,8 +58,18 @@ class Task {
   void *const context_;
 };
 
+// Tasks that can put their thread to sleep when idle provide
+// `bool IdleSleep(uint64_t now)', which the worker calls after each cycle; it
+// returns true if the task slept.
+template <class T>
+concept IdleSleepingTask = requires(T t, uint64_t now) {
+  { t.IdleSleep(now) } -> std::same_as<bool>;
+};
+
 // This class abstracts a worker. A worker is pinned on an OS thread, and
-// executes a custom task in a tight loop.
+// executes one or more custom tasks in a tight loop, one after the other.
+// Tasks that sleep when idle only do so if they have their worker to
+// themselves: a sleeping task would stall the others.
 template <class T>
 class Worker {
  public:
@@ -69,8 +80,9 @@ class Worker {
     WORKER_FINISHED
   };
 
-  Worker(uint8_t id, std::shared_ptr<T> engine, std::vector<uint8_t> cpus = {})
-      : id_(id), state_(WORKER_STOPPED), engine_(engine) {
+  Worker(uint32_t id, std::shared_ptr<T> engine,
+         std::vector<uint8_t> cpus = {})
+      : id_(id), state_(WORKER_STOPPED), engines_{engine} {
     if (!cpus.empty()) {
       CPU_ZERO(&cpuset_p_);
 
@@ -86,8 +98,17 @@ class Worker {
     }
   }
 
-  Worker(uint8_t id, std::shared_ptr<T> engine, cpu_set_t cpu_mask)
-      : id_(id), state_(WORKER_STOPPED), engine_(engine), cpuset_p_(cpu_mask) {}
+  Worker(uint32_t id, std::shared_ptr<T> engine, cpu_set_t cpu_mask)
+      : Worker(id, std::vector<std::shared_ptr<T>>{engine}, cpu_mask) {}
+
+  Worker(uint32_t id, std::vector<std::shared_ptr<T>> engines,
+         cpu_set_t cpu_mask)
+      : id_(id),
+        state_(WORKER_STOPPED),
+        engines_(std::move(engines)),
+        cpuset_p_(cpu_mask) {
+    CHECK(!engines_.empty());
+  }
 
   Worker(Worker const &) = delete;
   Worker &operator=(Worker const &) = delete;
@@ -124,7 +145,7 @@ class Worker {
     return state_.load(std::memory_order_relaxed) == WORKER_FINISHED;
   }
 
-  uint8_t GetId() const { return id_; }
+  uint32_t GetId() const { return id_; }
 
  protected:
   friend class WorkerPool<T>;
@@ -135,7 +156,7 @@ class Worker {
     if (!std::atomic_compare_exchange_strong(&state_, &expected, desired))
       return;  // Failed to stop. 'quit()' requested in the meantime?
 
-    LOG(INFO) << "Worker [" << static_cast<uint32_t>(id_) << "] stopped..";
+    LOG(INFO) << "Worker [" << id_ << "] stopped..";
     do {
       __asm__("pause;");
       now_ = juggler::time::rdtsc();
@@ -150,38 +171,48 @@ class Worker {
 
     // Estimate TSC frequency.
     juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
-    LOG(INFO) << "Worker [" << static_cast<uint32_t>(id_)
-              << "] (cpu_mask: " << std::hex
+    LOG(INFO) << "Worker [" << id_ << "] (cpu_mask: " << std::hex
               << utils::cpuset_to_sizet(cpuset_p_) << std::dec
-              << ") starting..";
+              << ", tasks: " << engines_.size() << ") starting..";
     // Get the starting timestamp.
     start_time_ = juggler::time::rdtsc();
     cycles_ = 0;
     accounting_cycles_ = 0;
+    bool slept = false;
     do {
       now_ = juggler::time::rdtsc();
 
-      if ((cycles_ & kAccountingMask_) == 0) {
+      // After a sleep, do not wait for the accounting round to honor a stop
+      // request.
+      if ((cycles_ & kAccountingMask_) == 0 || slept) {
         // We do accounting/reporting in this round.
         ++accounting_cycles_;
         if (shouldStop()) idle();
         if (shouldQuit()) break;
       }
 
-      engine_->Run(now_);
+      engines_[0]->Run(now_);
+      for (size_t i = 1; i < engines_.size(); i++) {
+        engines_[i]->Run(juggler::time::rdtsc());
+      }
       cycles_++;
+      if constexpr (IdleSleepingTask<T>) {
+        if (engines_.size() == 1) {
+          slept = engines_[0]->IdleSleep(juggler::time::rdtsc());
+        }
+      }
     } while (true);
 
-    LOG(INFO) << "Worker [" << static_cast<uint32_t>(id_)
+    LOG(INFO) << "Worker [" << id_
               << "] terminating.. [Total cycles: " << cycles_
               << " , Accounting Cycles: " << accounting_cycles_ << "]";
   }
 
  private:
   const uint32_t kAccountingMask_ = 0xffff;
-  uint8_t id_;  // Worker id
+  uint32_t id_;  // Worker id
   std::atomic<State> state_;
-  std::shared_ptr<T> engine_;
+  const std::vector<std::shared_ptr<T>> engines_;
   cpu_set_t cpuset_p_;  // CPU affinity
   uint64_t start_time_;
   uint64_t now_;
@@ -193,8 +224,6 @@ class Worker {
 template <class T>
 class WorkerPool {
  public:
-  static const uint8_t kMaxWorkers_ = 16;
-
   /**
    * @brief Construct a new Worker Pool object
    *
@@ -204,8 +233,7 @@ class WorkerPool {
    */
   WorkerPool(std::vector<std::shared_ptr<T>> tasks,
              std::vector<std::vector<uint8_t>> cpus)
-      : workers_nr_(tasks.size()), tasks_(tasks) {
-    CHECK_LE(tasks.size(), kMaxWorkers_);
+      : workers_nr_(tasks.size()), tasks_(SingleTasks(tasks)) {
     CHECK_EQ(cpus.size(), tasks.size());
     for (const auto &cpu_list : cpus) {
       CHECK_LE(cpu_list.size(), CPU_SETSIZE);
@@ -233,13 +261,26 @@ class WorkerPool {
    */
   WorkerPool(std::vector<std::shared_ptr<T>> tasks,
              std::vector<cpu_set_t> cpu_masks)
-      : workers_nr_(tasks.size()), tasks_(tasks), cpuset_p_(cpu_masks) {
-    CHECK_LE(tasks.size(), kMaxWorkers_);
-    CHECK_EQ(cpu_masks.size(), tasks.size());
+      : WorkerPool(SingleTasks(tasks), std::move(cpu_masks)) {}
+
+  /**
+   * @brief Construct a new Worker Pool object, whose workers run several
+   * tasks each.
+   *
+   * @param tasks      Vector of the T-type tasks/engines each worker executes
+   *                   (at least one per worker).
+   * @param cpu_masks  Vector of CPU masks to pin each worker to.
+   */
+  WorkerPool(std::vector<std::vector<std::shared_ptr<T>>> tasks,
+             std::vector<cpu_set_t> cpu_masks)
+      : workers_nr_(tasks.size()),
+        tasks_(std::move(tasks)),
+        cpuset_p_(std::move(cpu_masks)) {
+    CHECK_EQ(cpuset_p_.size(), tasks_.size());
   }
 
   void Init() {
-    for (uint8_t i = 0; i < workers_nr_; i++) {
+    for (uint32_t i = 0; i < workers_nr_; i++) {
       workers_.emplace_back(
           std::make_unique<Worker<T>>(i, tasks_[i], cpuset_p_[i]));
       auto worker = workers_.back().get();
@@ -247,7 +288,7 @@ class WorkerPool {
     }
   }
 
-  void LaunchWorker(uint8_t wid) {
+  void LaunchWorker(uint32_t wid) {
     CHECK_LT(wid, workers_.size());
     workers_[wid].get()->start();
   }
@@ -274,8 +315,15 @@ class WorkerPool {
   }
 
  private:
-  const uint8_t workers_nr_;
-  const std::vector<std::shared_ptr<T>> tasks_;
+  static std::vector<std::vector<std::shared_ptr<T>>> SingleTasks(
+      const std::vector<std::shared_ptr<T>> &tasks) {
+    std::vector<std::vector<std::shared_ptr<T>>> single_tasks;
+    for (const auto &task : tasks) single_tasks.push_back({task});
+    return single_tasks;
+  }
+
+  const uint32_t workers_nr_;
+  const std::vector<std::vector<std::shared_ptr<T>>> tasks_;
   std::vector<cpu_set_t> cpuset_p_{};
   std::vector<std::unique_ptr<Worker<T>>> workers_{};
   std::vector<std::thread> worker_threads_{};